@@ -0,0 +1,212 @@
+/*
+ * Copyright (C) 2021 Masahiro Ide
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "wasmbox/wasmbox.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifndef WASMBOX_BENCH_DIR
+#  define WASMBOX_BENCH_DIR "bench"
+#endif
+
+#define WARMUP_CALLS (3)
+
+/* A workload exports `run`, which takes one i32 and returns an i32. */
+typedef struct bench_workload_t {
+  const char *name;
+  wasm_s32_t argument;
+  wasm_s32_t expected;
+  int calls;
+} bench_workload_t;
+
+static const bench_workload_t workloads[] = {
+    {"fib", 25, 75025, 20},
+    {"gemm", 64, 7343061, 20},
+    {"sha256", 256, 316393950, 50},
+    {"json_scan", 100, 680662848, 50},
+};
+
+static wasm_u64_t now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (wasm_u64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int compare_u64(const void *a, const void *b) {
+  wasm_u64_t x = *(const wasm_u64_t *) a;
+  wasm_u64_t y = *(const wasm_u64_t *) b;
+  return x < y ? -1 : x > y;
+}
+
+static wasm_u8_t *read_file(const char *path, size_t *len) {
+  FILE *fp = fopen(path, "rb");
+  if (fp == NULL) {
+    return NULL;
+  }
+  fseek(fp, 0, SEEK_END);
+  *len = ftell(fp);
+  fseek(fp, 0, SEEK_SET);
+  wasm_u8_t *data = (wasm_u8_t *) malloc(*len);
+  if (fread(data, 1, *len, fp) != *len) {
+    free(data);
+    data = NULL;
+  }
+  fclose(fp);
+  return data;
+}
+
+static int call(wasmbox_instance_t *instance, const wasmbox_export_t *run,
+                const bench_workload_t *w, wasm_u64_t *elapsed) {
+  wasmbox_value_t arg = {.s32 = w->argument};
+  wasmbox_value_t result = {};
+  wasm_u64_t start = now();
+  int ret = wasmbox_call(instance, run, &arg, &result);
+  *elapsed = now() - start;
+  if (ret != 0 || result.s32 != w->expected) {
+    fprintf(stderr, "%s: expected %d but got %d\n", w->name, w->expected,
+            result.s32);
+    return -1;
+  }
+  return 0;
+}
+
+// Writes one JSON object per line to `out`. Load is reading the binary,
+// compile is parsing it into a compiled module, and instantiate is creating
+// an instance from it. The first call includes whatever is deferred to it,
+// and the steady state is measured after a few more calls.
+static int run_workload(const bench_workload_t *w, FILE *out) {
+  char path[1024];
+  snprintf(path, sizeof(path), "%s/%s.wat.wasm", WASMBOX_BENCH_DIR, w->name);
+  size_t len = 0;
+  wasm_u64_t start = now();
+  wasm_u8_t *data = read_file(path, &len);
+  wasm_u64_t load_ns = now() - start;
+  if (data == NULL) {
+    fprintf(stderr, "%s: cannot read %s\n", w->name, path);
+    return -1;
+  }
+
+  wasmbox_module_t mod = {};
+  start = now();
+  if (wasmbox_load_module_from_buffer(&mod, data, len) != 0) {
+    fprintf(stderr, "%s: cannot load %s\n", w->name, path);
+    free(data);
+    return -1;
+  }
+  wasmbox_compiled_module_t *compiled = wasmbox_compiled_module_create(&mod);
+  wasm_u64_t compile_ns = now() - start;
+  free(data);
+
+  wasmbox_instance_t instance = {};
+  start = now();
+  int ret = wasmbox_instance_init(&instance, compiled);
+  wasm_u64_t instantiate_ns = now() - start;
+  const wasmbox_export_t *run = wasmbox_lookup_export(&instance, "run");
+  wasm_u64_t first_call_ns = 0;
+  wasm_u64_t *samples = (wasm_u64_t *) malloc(sizeof(wasm_u64_t) * w->calls);
+  if (ret != 0 || run == NULL) {
+    fprintf(stderr, "%s: no function to run\n", w->name);
+    ret = -1;
+  } else {
+    ret = call(&instance, run, w, &first_call_ns);
+  }
+#ifdef WASMBOX_VM_USE_PERF_COUNTERS
+  int counting = 0;
+#endif
+  for (int i = 0; ret == 0 && i < WARMUP_CALLS + w->calls; i++) {
+#ifdef WASMBOX_VM_USE_PERF_COUNTERS
+    // Hardware events are counted over the measured calls only.
+    if (i == WARMUP_CALLS) {
+      counting = wasmbox_perf_counters_start(&instance) == 0;
+    }
+#endif
+    wasm_u64_t elapsed;
+    ret = call(&instance, run, w, &elapsed);
+    if (i >= WARMUP_CALLS) {
+      samples[i - WARMUP_CALLS] = elapsed;
+    }
+  }
+  if (ret == 0) {
+    qsort(samples, w->calls, sizeof(wasm_u64_t), compare_u64);
+    wasm_u64_t median_ns = samples[w->calls / 2];
+    fprintf(out,
+            "{\"workload\": \"%s\", \"argument\": %d, \"load_ns\": %llu, "
+            "\"compile_ns\": %llu, \"instantiate_ns\": %llu, "
+            "\"first_call_ns\": %llu, \"calls\": %d, \"min_ns\": %llu, "
+            "\"median_ns\": %llu, \"calls_per_sec\": %.2f",
+            w->name, w->argument, (unsigned long long) load_ns,
+            (unsigned long long) compile_ns,
+            (unsigned long long) instantiate_ns,
+            (unsigned long long) first_call_ns, w->calls,
+            (unsigned long long) samples[0], (unsigned long long) median_ns,
+            median_ns > 0 ? 1e9 / (double) median_ns : 0.0);
+#ifdef WASMBOX_VM_USE_PERF_COUNTERS
+    wasmbox_perf_counts_t counts;
+    if (counting && wasmbox_perf_counters_read(&instance, run, &counts) == 0 &&
+        counts.calls > 0) {
+      double calls = (double) counts.calls;
+      fprintf(out,
+              ", \"cycles_per_call\": %.0f, \"instructions_per_call\": %.0f, "
+              "\"ipc\": %.2f, \"branch_misses_per_call\": %.0f, "
+              "\"l1d_misses_per_call\": %.0f, \"llc_misses_per_call\": %.0f",
+              counts.cycles / calls, counts.instructions / calls,
+              counts.cycles > 0 ? (double) counts.instructions / counts.cycles
+                                : 0.0,
+              counts.branch_misses / calls, counts.l1d_misses / calls,
+              counts.llc_misses / calls);
+    }
+#endif
+    fprintf(out, "}\n");
+  }
+  free(samples);
+  wasmbox_module_dispose(&instance);
+  wasmbox_compiled_module_dispose(compiled);
+  return ret;
+}
+
+// Usage: WasmBoxBench [-o results.jsonl] [workload...]
+// Every workload runs by default. The results go to stdout unless a file is
+// given.
+int main(int argc, char const *argv[]) {
+  FILE *out = stdout;
+  int first = 1;
+  if (argc > 2 && strcmp(argv[1], "-o") == 0) {
+    out = fopen(argv[2], "w");
+    if (out == NULL) {
+      fprintf(stderr, "cannot open %s\n", argv[2]);
+      return 1;
+    }
+    first = 3;
+  }
+  int failed = 0;
+  size_t count = sizeof(workloads) / sizeof(workloads[0]);
+  for (size_t i = 0; i < count; i++) {
+    int selected = argc <= first;
+    for (int j = first; j < argc; j++) {
+      selected |= strcmp(argv[j], workloads[i].name) == 0;
+    }
+    if (selected && run_workload(&workloads[i], out) != 0) {
+      failed = 1;
+    }
+  }
+  if (out != stdout) {
+    fclose(out);
+  }
+  return failed;
+}
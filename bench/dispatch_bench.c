@@ -0,0 +1,117 @@
+/*
+ * Copyright (C) 2021 Masahiro Ide
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* The WasmBoxBench built against each dispatch, the first being the
+ * baseline. */
+static const char *const dispatches[] = {"switch", "direct", "tail"};
+static const char *const benches[] = {WASMBOX_BENCH_SWITCH,
+                                      WASMBOX_BENCH_DIRECT, WASMBOX_BENCH_TAIL};
+#define DISPATCH_SIZE (sizeof(dispatches) / sizeof(dispatches[0]))
+
+#define MAX_WORKLOADS (16)
+
+typedef struct workload_result_t {
+  char name[64];
+  unsigned long long median_ns[DISPATCH_SIZE];
+} workload_result_t;
+
+static workload_result_t results[MAX_WORKLOADS];
+static int result_size;
+
+static workload_result_t *find_result(const char *name) {
+  for (int i = 0; i < result_size; i++) {
+    if (strcmp(results[i].name, name) == 0) {
+      return &results[i];
+    }
+  }
+  if (result_size == MAX_WORKLOADS) {
+    return NULL;
+  }
+  workload_result_t *result = &results[result_size++];
+  snprintf(result->name, sizeof(result->name), "%s", name);
+  return result;
+}
+
+// Reads the "workload" and "median_ns" of each line WasmBoxBench prints.
+static int run_bench(size_t dispatch, int argc, char const *argv[]) {
+  char command[4096];
+  int len = snprintf(command, sizeof(command), "'%s'", benches[dispatch]);
+  for (int i = 1; i < argc && len < (int) sizeof(command); i++) {
+    len += snprintf(command + len, sizeof(command) - len, " '%s'", argv[i]);
+  }
+  FILE *fp = popen(command, "r");
+  if (fp == NULL) {
+    fprintf(stderr, "cannot run %s\n", benches[dispatch]);
+    return -1;
+  }
+  char line[1024];
+  while (fgets(line, sizeof(line), fp) != NULL) {
+    char name[64];
+    const char *workload = strstr(line, "\"workload\": \"");
+    const char *median = strstr(line, "\"median_ns\": ");
+    if (workload == NULL || median == NULL ||
+        sscanf(workload + strlen("\"workload\": \""), "%63[^\"]", name) != 1) {
+      continue;
+    }
+    workload_result_t *result = find_result(name);
+    if (result != NULL) {
+      result->median_ns[dispatch] =
+          strtoull(median + strlen("\"median_ns\": "), NULL, 10);
+    }
+  }
+  return pclose(fp) == 0 ? 0 : -1;
+}
+
+// Usage: WasmBoxDispatchBench [workload...]
+// Runs the workloads with every dispatch and prints their median call time
+// and the speedup over switch dispatch.
+int main(int argc, char const *argv[]) {
+  int failed = 0;
+  for (size_t i = 0; i < DISPATCH_SIZE; i++) {
+    if (run_bench(i, argc, argv) != 0) {
+      fprintf(stderr, "%s dispatch failed\n", dispatches[i]);
+      failed = 1;
+    }
+  }
+  fprintf(stdout, "%-12s", "workload");
+  for (size_t i = 0; i < DISPATCH_SIZE; i++) {
+    fprintf(stdout, " %20s", dispatches[i]);
+  }
+  fprintf(stdout, "\n");
+  for (int i = 0; i < result_size; i++) {
+    workload_result_t *result = &results[i];
+    fprintf(stdout, "%-12s", result->name);
+    for (size_t j = 0; j < DISPATCH_SIZE; j++) {
+      unsigned long long ns = result->median_ns[j];
+      if (ns == 0) {
+        fprintf(stdout, " %20s", "-");
+        continue;
+      }
+      double speedup =
+          result->median_ns[0] > 0 ? (double) result->median_ns[0] / ns : 0.0;
+      char cell[32];
+      snprintf(cell, sizeof(cell), "%.3f ms (%.2fx)", ns / 1e6, speedup);
+      fprintf(stdout, " %20s", cell);
+    }
+    fprintf(stdout, "\n");
+  }
+  return failed;
+}
@@ -0,0 +1,148 @@
+(module
+  ;; C = A * B over n x n i32 matrices (n <= 64), the loop nest of the
+  ;; PolyBench gemm kernel. Returns the sum of the elements of C.
+  (memory 1)
+  (func $gemm (export "run") (param i32) (result i32)
+    (local i32 i32 i32 i32 i32)
+    ;; A[i][j] = (i * j + 1) % 13 at 0, B[i][j] = (i + 2 * j) % 11 at 16384
+    i32.const 0
+    local.set 1
+    block
+      loop
+        local.get 1
+        local.get 0
+        i32.ge_u
+        br_if 1
+        i32.const 0
+        local.set 2
+        block
+          loop
+            local.get 2
+            local.get 0
+            i32.ge_u
+            br_if 1
+            local.get 1
+            local.get 0
+            i32.mul
+            local.get 2
+            i32.add
+            i32.const 2
+            i32.shl
+            local.tee 3
+            local.get 1
+            local.get 2
+            i32.mul
+            i32.const 1
+            i32.add
+            i32.const 13
+            i32.rem_u
+            i32.store
+            local.get 3
+            local.get 1
+            local.get 2
+            i32.const 1
+            i32.shl
+            i32.add
+            i32.const 11
+            i32.rem_u
+            i32.store offset=16384
+            local.get 2
+            i32.const 1
+            i32.add
+            local.set 2
+            br 0
+          end
+        end
+        local.get 1
+        i32.const 1
+        i32.add
+        local.set 1
+        br 0
+      end
+    end
+    ;; C[i][j] = sum of A[i][k] * B[k][j] at 32768
+    i32.const 0
+    local.set 5
+    i32.const 0
+    local.set 1
+    block
+      loop
+        local.get 1
+        local.get 0
+        i32.ge_u
+        br_if 1
+        i32.const 0
+        local.set 2
+        block
+          loop
+            local.get 2
+            local.get 0
+            i32.ge_u
+            br_if 1
+            i32.const 0
+            local.set 4
+            i32.const 0
+            local.set 3
+            block
+              loop
+                local.get 3
+                local.get 0
+                i32.ge_u
+                br_if 1
+                local.get 4
+                local.get 1
+                local.get 0
+                i32.mul
+                local.get 3
+                i32.add
+                i32.const 2
+                i32.shl
+                i32.load
+                local.get 3
+                local.get 0
+                i32.mul
+                local.get 2
+                i32.add
+                i32.const 2
+                i32.shl
+                i32.load offset=16384
+                i32.mul
+                i32.add
+                local.set 4
+                local.get 3
+                i32.const 1
+                i32.add
+                local.set 3
+                br 0
+              end
+            end
+            local.get 1
+            local.get 0
+            i32.mul
+            local.get 2
+            i32.add
+            i32.const 2
+            i32.shl
+            local.get 4
+            i32.store offset=32768
+            local.get 5
+            local.get 4
+            i32.add
+            local.set 5
+            local.get 2
+            i32.const 1
+            i32.add
+            local.set 2
+            br 0
+          end
+        end
+        local.get 1
+        i32.const 1
+        i32.add
+        local.set 1
+        br 0
+      end
+    end
+    local.get 5
+  )
+)
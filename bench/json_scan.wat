@@ -0,0 +1,261 @@
+(module
+  ;; A JSON tokenizer: a state machine over the bytes of a document, which
+  ;; dispatches on its state and on the class of each byte with br_table.
+  ;; Scans the document n times and returns a checksum of the tokens.
+  (memory 1)
+  ;; Class of each byte at 0: 1 quote, 2 backslash, 3 digit or minus,
+  ;; 4 letter, 5 structural, 6 space and 0 anything else.
+  (data (i32.const 0) "\00\00\00\00\00\00\00\00\00\00\06\00\00\00\00\00")
+  (data (i32.const 16) "\00\00\00\00\00\00\00\00\00\00\00\00\00\00\00\00")
+  (data (i32.const 32) "\06\00\01\00\00\00\00\00\00\00\00\00\05\03\00\00")
+  (data (i32.const 48) "\03\03\03\03\03\03\03\03\03\03\05\00\00\00\00\00")
+  (data (i32.const 64) "\00\00\00\00\00\00\00\00\00\00\00\00\00\00\00\00")
+  (data (i32.const 80) "\00\00\00\00\00\00\00\00\00\00\00\05\02\05\00\00")
+  (data (i32.const 96) "\00\04\04\04\04\04\04\04\04\04\04\04\04\04\04\04")
+  (data (i32.const 112) "\04\04\04\04\04\04\04\04\04\04\04\05\00\05\00\00")
+  (data (i32.const 128) "\00\00\00\00\00\00\00\00\00\00\00\00\00\00\00\00")
+  (data (i32.const 144) "\00\00\00\00\00\00\00\00\00\00\00\00\00\00\00\00")
+  (data (i32.const 160) "\00\00\00\00\00\00\00\00\00\00\00\00\00\00\00\00")
+  (data (i32.const 176) "\00\00\00\00\00\00\00\00\00\00\00\00\00\00\00\00")
+  (data (i32.const 192) "\00\00\00\00\00\00\00\00\00\00\00\00\00\00\00\00")
+  (data (i32.const 208) "\00\00\00\00\00\00\00\00\00\00\00\00\00\00\00\00")
+  (data (i32.const 224) "\00\00\00\00\00\00\00\00\00\00\00\00\00\00\00\00")
+  (data (i32.const 240) "\00\00\00\00\00\00\00\00\00\00\00\00\00\00\00\00")
+  ;; The document at 256.
+  (data (i32.const 256) "[\0a")
+  (data (i32.const 258) "  {\22id\22: 0, \22name\22: \22item-0\22, \22tags\22: [\22")
+  (data (i32.const 298) "x\22, \22y\5c\220\22], \22ok\22: false, \22score\22: 50, \22")
+  (data (i32.const 338) "next\22: null},\0a")
+  (data (i32.const 352) "  {\22id\22: 1, \22name\22: \22item-1\22, \22tags\22: [\22")
+  (data (i32.const 392) "x\22, \22y\5c\221\22], \22ok\22: true, \22score\22: 43, \22n")
+  (data (i32.const 432) "ext\22: null},\0a")
+  (data (i32.const 445) "  {\22id\22: 2, \22name\22: \22item-2\22, \22tags\22: [\22")
+  (data (i32.const 485) "x\22, \22y\5c\222\22], \22ok\22: true, \22score\22: 36, \22n")
+  (data (i32.const 525) "ext\22: null},\0a")
+  (data (i32.const 538) "  {\22id\22: 3, \22name\22: \22item-3\22, \22tags\22: [\22")
+  (data (i32.const 578) "x\22, \22y\5c\223\22], \22ok\22: false, \22score\22: 29, \22")
+  (data (i32.const 618) "next\22: null},\0a")
+  (data (i32.const 632) "  {\22id\22: 4, \22name\22: \22item-4\22, \22tags\22: [\22")
+  (data (i32.const 672) "x\22, \22y\5c\224\22], \22ok\22: true, \22score\22: 22, \22n")
+  (data (i32.const 712) "ext\22: null},\0a")
+  (data (i32.const 725) "  {\22id\22: 5, \22name\22: \22item-5\22, \22tags\22: [\22")
+  (data (i32.const 765) "x\22, \22y\5c\225\22], \22ok\22: true, \22score\22: 15, \22n")
+  (data (i32.const 805) "ext\22: null},\0a")
+  (data (i32.const 818) "  {\22id\22: 6, \22name\22: \22item-6\22, \22tags\22: [\22")
+  (data (i32.const 858) "x\22, \22y\5c\226\22], \22ok\22: false, \22score\22: 8, \22n")
+  (data (i32.const 898) "ext\22: null},\0a")
+  (data (i32.const 911) "  {\22id\22: 7, \22name\22: \22item-7\22, \22tags\22: [\22")
+  (data (i32.const 951) "x\22, \22y\5c\227\22], \22ok\22: true, \22score\22: 1, \22ne")
+  (data (i32.const 991) "xt\22: null},\0a")
+  (data (i32.const 1003) "  {\22id\22: 8, \22name\22: \22item-8\22, \22tags\22: [\22")
+  (data (i32.const 1043) "x\22, \22y\5c\228\22], \22ok\22: true, \22score\22: -6, \22n")
+  (data (i32.const 1083) "ext\22: null},\0a")
+  (data (i32.const 1096) "  {\22id\22: 9, \22name\22: \22item-9\22, \22tags\22: [\22")
+  (data (i32.const 1136) "x\22, \22y\5c\229\22], \22ok\22: false, \22score\22: -13, ")
+  (data (i32.const 1176) "\22next\22: null},\0a")
+  (data (i32.const 1191) "  {\22id\22: 10, \22name\22: \22item-10\22, \22tags\22: ")
+  (data (i32.const 1231) "[\22x\22, \22y\5c\2210\22], \22ok\22: true, \22score\22: -20")
+  (data (i32.const 1271) ", \22next\22: null},\0a")
+  (data (i32.const 1288) "  {\22id\22: 11, \22name\22: \22item-11\22, \22tags\22: ")
+  (data (i32.const 1328) "[\22x\22, \22y\5c\2211\22], \22ok\22: true, \22score\22: -27")
+  (data (i32.const 1368) ", \22next\22: null},\0a")
+  (data (i32.const 1385) "  {\22id\22: 12, \22name\22: \22item-12\22, \22tags\22: ")
+  (data (i32.const 1425) "[\22x\22, \22y\5c\2212\22], \22ok\22: false, \22score\22: -3")
+  (data (i32.const 1465) "4, \22next\22: null},\0a")
+  (data (i32.const 1483) "  {\22id\22: 13, \22name\22: \22item-13\22, \22tags\22: ")
+  (data (i32.const 1523) "[\22x\22, \22y\5c\2213\22], \22ok\22: true, \22score\22: -41")
+  (data (i32.const 1563) ", \22next\22: null},\0a")
+  (data (i32.const 1580) "  {\22id\22: 14, \22name\22: \22item-14\22, \22tags\22: ")
+  (data (i32.const 1620) "[\22x\22, \22y\5c\2214\22], \22ok\22: true, \22score\22: -48")
+  (data (i32.const 1660) ", \22next\22: null},\0a")
+  (data (i32.const 1677) "  {\22id\22: 15, \22name\22: \22item-15\22, \22tags\22: ")
+  (data (i32.const 1717) "[\22x\22, \22y\5c\2215\22], \22ok\22: false, \22score\22: -5")
+  (data (i32.const 1757) "5, \22next\22: null},\0a")
+  (data (i32.const 1775) "  {\22id\22: 16, \22name\22: \22item-16\22, \22tags\22: ")
+  (data (i32.const 1815) "[\22x\22, \22y\5c\2216\22], \22ok\22: true, \22score\22: -62")
+  (data (i32.const 1855) ", \22next\22: null},\0a")
+  (data (i32.const 1872) "  {\22id\22: 17, \22name\22: \22item-17\22, \22tags\22: ")
+  (data (i32.const 1912) "[\22x\22, \22y\5c\2217\22], \22ok\22: true, \22score\22: -69")
+  (data (i32.const 1952) ", \22next\22: null},\0a")
+  (data (i32.const 1969) "  {\22id\22: 18, \22name\22: \22item-18\22, \22tags\22: ")
+  (data (i32.const 2009) "[\22x\22, \22y\5c\2218\22], \22ok\22: false, \22score\22: -7")
+  (data (i32.const 2049) "6, \22next\22: null},\0a")
+  (data (i32.const 2067) "  {\22id\22: 19, \22name\22: \22item-19\22, \22tags\22: ")
+  (data (i32.const 2107) "[\22x\22, \22y\5c\2219\22], \22ok\22: true, \22score\22: -83")
+  (data (i32.const 2147) ", \22next\22: null},\0a")
+  (data (i32.const 2164) "  {\22id\22: 20, \22name\22: \22item-20\22, \22tags\22: ")
+  (data (i32.const 2204) "[\22x\22, \22y\5c\2220\22], \22ok\22: true, \22score\22: -90")
+  (data (i32.const 2244) ", \22next\22: null},\0a")
+  (data (i32.const 2261) "  {\22id\22: 21, \22name\22: \22item-21\22, \22tags\22: ")
+  (data (i32.const 2301) "[\22x\22, \22y\5c\2221\22], \22ok\22: false, \22score\22: -9")
+  (data (i32.const 2341) "7, \22next\22: null},\0a")
+  (data (i32.const 2359) "  {\22id\22: 22, \22name\22: \22item-22\22, \22tags\22: ")
+  (data (i32.const 2399) "[\22x\22, \22y\5c\2222\22], \22ok\22: true, \22score\22: -10")
+  (data (i32.const 2439) "4, \22next\22: null},\0a")
+  (data (i32.const 2457) "  {\22id\22: 23, \22name\22: \22item-23\22, \22tags\22: ")
+  (data (i32.const 2497) "[\22x\22, \22y\5c\2223\22], \22ok\22: true, \22score\22: -11")
+  (data (i32.const 2537) "1, \22next\22: null},\0a")
+  (data (i32.const 2555) "  {\22id\22: 24, \22name\22: \22item-24\22, \22tags\22: ")
+  (data (i32.const 2595) "[\22x\22, \22y\5c\2224\22], \22ok\22: false, \22score\22: -1")
+  (data (i32.const 2635) "18, \22next\22: null},\0a")
+  (data (i32.const 2654) "  {\22id\22: 25, \22name\22: \22item-25\22, \22tags\22: ")
+  (data (i32.const 2694) "[\22x\22, \22y\5c\2225\22], \22ok\22: true, \22score\22: -12")
+  (data (i32.const 2734) "5, \22next\22: null},\0a")
+  (data (i32.const 2752) "  {\22id\22: 26, \22name\22: \22item-26\22, \22tags\22: ")
+  (data (i32.const 2792) "[\22x\22, \22y\5c\2226\22], \22ok\22: true, \22score\22: -13")
+  (data (i32.const 2832) "2, \22next\22: null},\0a")
+  (data (i32.const 2850) "  {\22id\22: 27, \22name\22: \22item-27\22, \22tags\22: ")
+  (data (i32.const 2890) "[\22x\22, \22y\5c\2227\22], \22ok\22: false, \22score\22: -1")
+  (data (i32.const 2930) "39, \22next\22: null},\0a")
+  (data (i32.const 2949) "  {\22id\22: 28, \22name\22: \22item-28\22, \22tags\22: ")
+  (data (i32.const 2989) "[\22x\22, \22y\5c\2228\22], \22ok\22: true, \22score\22: -14")
+  (data (i32.const 3029) "6, \22next\22: null},\0a")
+  (data (i32.const 3047) "  {\22id\22: 29, \22name\22: \22item-29\22, \22tags\22: ")
+  (data (i32.const 3087) "[\22x\22, \22y\5c\2229\22], \22ok\22: true, \22score\22: -15")
+  (data (i32.const 3127) "3, \22next\22: null},\0a")
+  (data (i32.const 3145) "  {\22id\22: 30, \22name\22: \22item-30\22, \22tags\22: ")
+  (data (i32.const 3185) "[\22x\22, \22y\5c\2230\22], \22ok\22: false, \22score\22: -1")
+  (data (i32.const 3225) "60, \22next\22: null},\0a")
+  (data (i32.const 3244) "  {\22id\22: 31, \22name\22: \22item-31\22, \22tags\22: ")
+  (data (i32.const 3284) "[\22x\22, \22y\5c\2231\22], \22ok\22: true, \22score\22: -16")
+  (data (i32.const 3324) "7, \22next\22: null}\0a")
+  (data (i32.const 3341) "]\0a")
+  (func $scan (export "run") (param i32) (result i32)
+    (local i32 i32 i32 i32 i32)
+    i32.const 0
+    local.set 4
+    i32.const 0
+    local.set 5
+    block
+      loop
+        local.get 5
+        local.get 0
+        i32.ge_u
+        br_if 1
+        i32.const 0
+        local.set 1
+        i32.const 0
+        local.set 2
+        block
+          loop
+            local.get 1
+            i32.const 3087
+            i32.ge_u
+            br_if 1
+            local.get 1
+            i32.load8_u offset=256
+            i32.load8_u
+            local.set 3
+            block
+              block
+                block
+                  block
+                    block
+                      block
+                        local.get 2
+                        br_table 0 1 2 3 4 0
+                      end
+                      ;; outside of a token
+                      block
+                        block
+                          block
+                            block
+                              local.get 3
+                              br_table 8 0 8 1 2 3 8 8
+                            end
+                            i32.const 1
+                            local.set 2
+                            br 7
+                          end
+                          i32.const 3
+                          local.set 2
+                          br 6
+                        end
+                        i32.const 4
+                        local.set 2
+                        br 5
+                      end
+                      local.get 4
+                      i32.const 31
+                      i32.mul
+                      i32.const 5
+                      i32.add
+                      local.set 4
+                      br 4
+                    end
+                    ;; in a string
+                    local.get 3
+                    i32.const 2
+                    i32.eq
+                    if
+                      i32.const 2
+                      local.set 2
+                      br 4
+                    end
+                    local.get 3
+                    i32.const 1
+                    i32.eq
+                    if
+                      local.get 4
+                      i32.const 31
+                      i32.mul
+                      i32.const 1
+                      i32.add
+                      local.set 4
+                      i32.const 0
+                      local.set 2
+                    end
+                    br 3
+                  end
+                  ;; after a backslash in a string
+                  i32.const 1
+                  local.set 2
+                  br 2
+                end
+                ;; in a number, which ends before the byte that is not part of it
+                local.get 3
+                i32.const 3
+                i32.eq
+                br_if 1
+                local.get 4
+                i32.const 31
+                i32.mul
+                i32.const 3
+                i32.add
+                local.set 4
+                i32.const 0
+                local.set 2
+                br 2
+              end
+              ;; in true, false or null
+              local.get 3
+              i32.const 4
+              i32.eq
+              br_if 0
+              local.get 4
+              i32.const 31
+              i32.mul
+              i32.const 4
+              i32.add
+              local.set 4
+              i32.const 0
+              local.set 2
+              br 1
+            end
+            local.get 1
+            i32.const 1
+            i32.add
+            local.set 1
+            br 0
+          end
+        end
+        local.get 5
+        i32.const 1
+        i32.add
+        local.set 5
+        br 0
+      end
+    end
+    local.get 4
+  )
+)
@@ -0,0 +1,365 @@
+(module
+  ;; The SHA-256 compression function over n 64-byte blocks, with the
+  ;; message words read little-endian. Returns the xor of the state words.
+  (memory 1)
+  ;; Round constants at 0, the message schedule at 256, the state at 512
+  ;; and the message at 1024.
+  (data (i32.const 0) "\98\2f\8a\42\91\44\37\71\cf\fb\c0\b5\a5\db\b5\e9")
+  (data (i32.const 16) "\5b\c2\56\39\f1\11\f1\59\a4\82\3f\92\d5\5e\1c\ab")
+  (data (i32.const 32) "\98\aa\07\d8\01\5b\83\12\be\85\31\24\c3\7d\0c\55")
+  (data (i32.const 48) "\74\5d\be\72\fe\b1\de\80\a7\06\dc\9b\74\f1\9b\c1")
+  (data (i32.const 64) "\c1\69\9b\e4\86\47\be\ef\c6\9d\c1\0f\cc\a1\0c\24")
+  (data (i32.const 80) "\6f\2c\e9\2d\aa\84\74\4a\dc\a9\b0\5c\da\88\f9\76")
+  (data (i32.const 96) "\52\51\3e\98\6d\c6\31\a8\c8\27\03\b0\c7\7f\59\bf")
+  (data (i32.const 112) "\f3\0b\e0\c6\47\91\a7\d5\51\63\ca\06\67\29\29\14")
+  (data (i32.const 128) "\85\0a\b7\27\38\21\1b\2e\fc\6d\2c\4d\13\0d\38\53")
+  (data (i32.const 144) "\54\73\0a\65\bb\0a\6a\76\2e\c9\c2\81\85\2c\72\92")
+  (data (i32.const 160) "\a1\e8\bf\a2\4b\66\1a\a8\70\8b\4b\c2\a3\51\6c\c7")
+  (data (i32.const 176) "\19\e8\92\d1\24\06\99\d6\85\35\0e\f4\70\a0\6a\10")
+  (data (i32.const 192) "\16\c1\a4\19\08\6c\37\1e\4c\77\48\27\b5\bc\b0\34")
+  (data (i32.const 208) "\b3\0c\1c\39\4a\aa\d8\4e\4f\ca\9c\5b\f3\6f\2e\68")
+  (data (i32.const 224) "\ee\82\8f\74\6f\63\a5\78\14\78\c8\84\08\02\c7\8c")
+  (data (i32.const 240) "\fa\ff\be\90\eb\6c\50\a4\f7\a3\f9\be\f2\78\71\c6")
+  (func $sha256 (export "run") (param i32) (result i32)
+    (local i32 i32 i32 i32 i32 i32 i32 i32 i32 i32 i32 i32 i32)
+    ;; Message byte i is i * 7 mod 256.
+    i32.const 0
+    local.set 2
+    block
+      loop
+        local.get 2
+        local.get 0
+        i32.const 6
+        i32.shl
+        i32.ge_u
+        br_if 1
+        local.get 2
+        local.get 2
+        i32.const 7
+        i32.mul
+        i32.store8 offset=1024
+        local.get 2
+        i32.const 1
+        i32.add
+        local.set 2
+        br 0
+      end
+    end
+    i32.const 0
+    i32.const 0x6a09e667
+    i32.store offset=512
+    i32.const 0
+    i32.const 0xbb67ae85
+    i32.store offset=516
+    i32.const 0
+    i32.const 0x3c6ef372
+    i32.store offset=520
+    i32.const 0
+    i32.const 0xa54ff53a
+    i32.store offset=524
+    i32.const 0
+    i32.const 0x510e527f
+    i32.store offset=528
+    i32.const 0
+    i32.const 0x9b05688c
+    i32.store offset=532
+    i32.const 0
+    i32.const 0x1f83d9ab
+    i32.store offset=536
+    i32.const 0
+    i32.const 0x5be0cd19
+    i32.store offset=540
+    i32.const 0
+    local.set 1
+    block
+      loop
+        local.get 1
+        local.get 0
+        i32.ge_u
+        br_if 1
+        local.get 1
+        i32.const 6
+        i32.shl
+        i32.const 1024
+        i32.add
+        local.set 13
+        ;; W[t] = M[t] for t < 16
+        i32.const 0
+        local.set 2
+        block
+          loop
+            local.get 2
+            i32.const 16
+            i32.ge_u
+            br_if 1
+            local.get 2
+            i32.const 2
+            i32.shl
+            local.tee 12
+            local.get 12
+            local.get 13
+            i32.add
+            i32.load
+            i32.store offset=256
+            local.get 2
+            i32.const 1
+            i32.add
+            local.set 2
+            br 0
+          end
+        end
+        ;; W[t] = W[t-16] + s0(W[t-15]) + W[t-7] + s1(W[t-2])
+        block
+          loop
+            local.get 2
+            i32.const 64
+            i32.ge_u
+            br_if 1
+            local.get 2
+            i32.const 2
+            i32.shl
+            local.set 12
+            local.get 12
+            local.get 12
+            i32.load offset=192
+            local.get 12
+            i32.load offset=196
+            i32.const 7
+            i32.rotr
+            local.get 12
+            i32.load offset=196
+            i32.const 18
+            i32.rotr
+            i32.xor
+            local.get 12
+            i32.load offset=196
+            i32.const 3
+            i32.shr_u
+            i32.xor
+            i32.add
+            local.get 12
+            i32.load offset=228
+            i32.add
+            local.get 12
+            i32.load offset=248
+            i32.const 17
+            i32.rotr
+            local.get 12
+            i32.load offset=248
+            i32.const 19
+            i32.rotr
+            i32.xor
+            local.get 12
+            i32.load offset=248
+            i32.const 10
+            i32.shr_u
+            i32.xor
+            i32.add
+            i32.store offset=256
+            local.get 2
+            i32.const 1
+            i32.add
+            local.set 2
+            br 0
+          end
+        end
+        ;; a..h are locals 3..10
+        i32.const 0
+        i32.load offset=512
+        local.set 3
+        i32.const 0
+        i32.load offset=516
+        local.set 4
+        i32.const 0
+        i32.load offset=520
+        local.set 5
+        i32.const 0
+        i32.load offset=524
+        local.set 6
+        i32.const 0
+        i32.load offset=528
+        local.set 7
+        i32.const 0
+        i32.load offset=532
+        local.set 8
+        i32.const 0
+        i32.load offset=536
+        local.set 9
+        i32.const 0
+        i32.load offset=540
+        local.set 10
+        i32.const 0
+        local.set 2
+        block
+          loop
+            local.get 2
+            i32.const 64
+            i32.ge_u
+            br_if 1
+            local.get 2
+            i32.const 2
+            i32.shl
+            local.set 12
+            ;; t1 = h + S1(e) + ch(e, f, g) + K[t] + W[t]
+            local.get 10
+            local.get 7
+            i32.const 6
+            i32.rotr
+            local.get 7
+            i32.const 11
+            i32.rotr
+            i32.xor
+            local.get 7
+            i32.const 25
+            i32.rotr
+            i32.xor
+            i32.add
+            local.get 7
+            local.get 8
+            i32.and
+            local.get 7
+            i32.const -1
+            i32.xor
+            local.get 9
+            i32.and
+            i32.xor
+            i32.add
+            local.get 12
+            i32.load
+            i32.add
+            local.get 12
+            i32.load offset=256
+            i32.add
+            local.set 11
+            local.get 9
+            local.set 10
+            local.get 8
+            local.set 9
+            local.get 7
+            local.set 8
+            local.get 6
+            local.get 11
+            i32.add
+            local.set 7
+            ;; a = t1 + S0(a) + maj(a, b, c)
+            local.get 11
+            local.get 3
+            i32.const 2
+            i32.rotr
+            local.get 3
+            i32.const 13
+            i32.rotr
+            i32.xor
+            local.get 3
+            i32.const 22
+            i32.rotr
+            i32.xor
+            i32.add
+            local.get 3
+            local.get 4
+            i32.and
+            local.get 3
+            local.get 5
+            i32.and
+            i32.xor
+            local.get 4
+            local.get 5
+            i32.and
+            i32.xor
+            i32.add
+            local.set 12
+            local.get 5
+            local.set 6
+            local.get 4
+            local.set 5
+            local.get 3
+            local.set 4
+            local.get 12
+            local.set 3
+            local.get 2
+            i32.const 1
+            i32.add
+            local.set 2
+            br 0
+          end
+        end
+        i32.const 0
+        i32.const 0
+        i32.load offset=512
+        local.get 3
+        i32.add
+        i32.store offset=512
+        i32.const 0
+        i32.const 0
+        i32.load offset=516
+        local.get 4
+        i32.add
+        i32.store offset=516
+        i32.const 0
+        i32.const 0
+        i32.load offset=520
+        local.get 5
+        i32.add
+        i32.store offset=520
+        i32.const 0
+        i32.const 0
+        i32.load offset=524
+        local.get 6
+        i32.add
+        i32.store offset=524
+        i32.const 0
+        i32.const 0
+        i32.load offset=528
+        local.get 7
+        i32.add
+        i32.store offset=528
+        i32.const 0
+        i32.const 0
+        i32.load offset=532
+        local.get 8
+        i32.add
+        i32.store offset=532
+        i32.const 0
+        i32.const 0
+        i32.load offset=536
+        local.get 9
+        i32.add
+        i32.store offset=536
+        i32.const 0
+        i32.const 0
+        i32.load offset=540
+        local.get 10
+        i32.add
+        i32.store offset=540
+        local.get 1
+        i32.const 1
+        i32.add
+        local.set 1
+        br 0
+      end
+    end
+    i32.const 0
+    i32.load offset=512
+    i32.const 0
+    i32.load offset=516
+    i32.xor
+    i32.const 0
+    i32.load offset=520
+    i32.xor
+    i32.const 0
+    i32.load offset=524
+    i32.xor
+    i32.const 0
+    i32.load offset=528
+    i32.xor
+    i32.const 0
+    i32.load offset=532
+    i32.xor
+    i32.const 0
+    i32.load offset=536
+    i32.xor
+    i32.const 0
+    i32.load offset=540
+    i32.xor
+  )
+)
@@ -18,6 +18,7 @@
 #define WASMBOX_H
 
 #include <limits.h>
+#include <stddef.h>
 #include <stdint.h>
 
 #ifdef __cplusplus
@@ -64,22 +65,32 @@ typedef enum wasmbox_value_type_t {
   WASM_TYPE_F32 = 3,
   WASM_TYPE_F64 = 4,
   WASM_TYPE_FUNCREF = 5,
-  WASM_TYPE_EXTERNREF = 6
+  WASM_TYPE_EXTERNREF = 6,
+  /* Takes two slots and two entries of wasmbox_type_t.args, the low half
+   * first. Embedders pass and receive a v128 as two i64 values. */
+  WASM_TYPE_V128 = 7
 } wasmbox_value_type_t;
 
 typedef struct wasmbox_name_t {
   wasm_u32_t len;
-  wasm_u8_t value[0];
+  /* The bytes follow this header, or lie in a borrowed module binary. */
+  wasm_u8_t *value;
 } wasmbox_name_t;
 
 typedef struct wasmbox_limit_t {
   wasm_u32_t min;
   wasm_u32_t max;
+  wasm_u8_t shared;
+  /* Set for a memory of the memory64 proposal, indexed by i64 addresses. */
+  wasm_u8_t memory64;
 } wasmbox_limit_t;
 
 typedef struct wasmbox_type_t {
   wasm_u16_t return_size;
   wasm_u16_t argument_size;
+  /* Canonical id of the parameters and results, equal for equal types of
+   * any module, which an indirect call compares with the type of its callee. */
+  wasm_u32_t id;
   wasmbox_value_type_t args[0];
 } wasmbox_type_t;
 
@@ -91,30 +102,146 @@ typedef struct wasmbox_function_t {
   wasmbox_name_t *name;
   wasm_u16_t locals;
   wasm_u16_t code_size;
+  /* Number of stack slots used by the function, including arguments of calls */
+  wasm_u16_t frame_size;
 } wasmbox_function_t;
 
-typedef struct wasmbox_table_t {
+/* Type id of an empty table entry, which no type has. */
+#define WASMBOX_TABLE_ENTRY_EMPTY ((wasm_u32_t) -1)
+
+/**
+ * An element of a table. It is packed so that an indirect call finds the code
+ * of its callee and checks its type with a single load.
+ */
+typedef struct wasmbox_table_entry_t {
+  wasmbox_code_t *code;
+  wasm_u32_t type_id;
+  /* frame_size of the function, for the stack check of the call. */
+  wasm_u16_t frame_size;
+  /* The reference table.get returns: the wasmbox_function_t* of a funcref,
+   * or an externref as it was stored. 0 is null. */
+  wasm_u64_t ref;
+} wasmbox_table_entry_t;
+
+/**
+ * A table of references. Each instance has its own copy, which table.set and
+ * table.grow modify. Only the entries of functions can be called.
+ */
+typedef struct wasmbox_ref_table_t {
+  wasmbox_value_type_t type;
   wasm_u32_t size;
-  union table_entry {
-    wasmbox_code_t *code;
-    wasmbox_function_t *func;
-    wasm_u16_t block_id;
-  } labels[];
-} wasmbox_table_t;
+  wasm_u32_t max;
+  wasm_u32_t capacity;
+  wasmbox_table_entry_t *entries;
+} wasmbox_ref_table_t;
+
+/* Kinds of wasmbox_export_t, as encoded in the export section. */
+#define WASMBOX_EXPORT_FUNCTION (0)
+#define WASMBOX_EXPORT_TABLE    (1)
+#define WASMBOX_EXPORT_MEMORY   (2)
+#define WASMBOX_EXPORT_GLOBAL   (3)
+
+/**
+ * An export of a module, found by wasmbox_lookup_export. It stays valid as
+ * long as the module, and is shared by the instances of a compiled module.
+ */
+typedef struct wasmbox_export_t {
+  wasmbox_name_t *name;
+  wasm_u8_t kind;
+  wasm_u32_t index;
+  /* The exported function if `kind` is WASMBOX_EXPORT_FUNCTION. */
+  wasmbox_function_t *func;
+} wasmbox_export_t;
+
+/**
+ * An indirect call site: the type its callee must have and the table it is
+ * looked up in. The instances of a compiled module share it.
+ */
+typedef struct wasmbox_call_cache_t {
+  struct wasmbox_call_cache_t *next;
+  wasmbox_type_t *type;
+  /* type->id, which the callee must have. */
+  wasm_u32_t type_id;
+  wasm_u32_t tableidx;
+#ifdef WASMBOX_VM_USE_LAZY_COMPILE
+  /* Profile of the site: the function it is in (NULL if it is not profiled),
+   * where it is in the module source, the callee it called last and how many
+   * times in a row it did. */
+  wasmbox_function_t *caller;
+  wasm_u32_t site;
+  wasm_u32_t hits;
+  wasm_u64_t target;
+#endif
+} wasmbox_call_cache_t;
+
+/**
+ * The function exported by a linked module which an imported function
+ * resolves to. OPCODE_MODULE_CALL refers to it.
+ */
+typedef struct wasmbox_module_link_t {
+  struct wasmbox_module_t *module;
+  wasmbox_function_t *func;
+} wasmbox_module_link_t;
+
+#ifdef WASMBOX_VM_USE_COMPACT_CODE
+/**
+ * Compact instruction encoding. Each operand is 4 bytes wide and registers are
+ * 16 bits. Jump targets and wide immediates (constants, function and table
+ * pointers) are referred by `offset`, the byte distance from the instruction
+ * to the target instruction or to an entry of the constant pool placed right
+ * after the function code.
+ */
+typedef wasm_s16_t wasmbox_code_reg_t;
+
+union wasmbox_code_operands {
+  wasm_u32_t index;
+  wasmbox_code_reg_t reg;
+  wasm_s32_t offset;
+  struct registers {
+    wasmbox_code_reg_t reg1;
+    wasmbox_code_reg_t reg2;
+  } r;
+};
+
+typedef union wasmbox_code_constant_t {
+  wasmbox_value_t value;
+  wasmbox_function_t *func;
+  wasmbox_call_cache_t *cache;
+} wasmbox_code_constant_t;
+
+#  define WASMBOX_CODE_OFFSET(CODE, OP, TYPE) \
+    ((TYPE *) ((char *) (CODE) + (CODE)->OP.offset))
+#  define WASMBOX_CODE_TARGET(CODE, OP) \
+    WASMBOX_CODE_OFFSET(CODE, OP, wasmbox_code_t)
+#  define WASMBOX_CODE_VALUE(CODE, OP) \
+    (WASMBOX_CODE_OFFSET(CODE, OP, wasmbox_code_constant_t)->value)
+/* Functions are referred to by their index in the module, so that the code
+ * keeps no pointer to them. */
+#  define WASMBOX_CODE_FUNC(MOD, CODE, OP) ((MOD)->functions[(CODE)->OP.index])
+#  define WASMBOX_CODE_CACHE(CODE, OP) \
+    (WASMBOX_CODE_OFFSET(CODE, OP, wasmbox_code_constant_t)->cache)
+#else
+typedef wasm_s32_t wasmbox_code_reg_t;
 
 union wasmbox_code_operands {
   wasmbox_value_t value;
   wasm_u32_t index;
-  wasm_s32_t reg;
+  wasmbox_code_reg_t reg;
   struct registers {
-    wasm_s32_t reg1;
-    wasm_s32_t reg2;
+    wasmbox_code_reg_t reg1;
+    wasmbox_code_reg_t reg2;
   } r;
   wasmbox_function_t *func;
   wasmbox_code_t *code;
-  wasmbox_table_t *table;
+  wasmbox_call_cache_t *cache;
 };
 
+#  define WASMBOX_CODE_TARGET(CODE, OP) ((CODE)->OP.code)
+#  define WASMBOX_CODE_VALUE(CODE, OP)  ((CODE)->OP.value)
+#  define WASMBOX_CODE_FUNC(MOD, CODE, OP) ((CODE)->OP.func)
+#  define WASMBOX_CODE_CACHE(CODE, OP)  ((CODE)->OP.cache)
+#endif /* WASMBOX_VM_USE_COMPACT_CODE */
+
 /**
  * WasmBox stack from design.
  * We share single stack for operand stack and value stack. When
@@ -148,7 +275,12 @@ union wasmbox_code_operands {
  */
 typedef wasmbox_value_t wasmbox_stack_t;
 
-#define WASMBOX_FUNCTION_CALL_OFFSET (2)
+#ifdef WASMBOX_VM_USE_COMPACT_FRAME
+/* &prev_stack_top and next_pc are packed into a single slot. */
+#  define WASMBOX_FUNCTION_CALL_OFFSET (1)
+#else
+#  define WASMBOX_FUNCTION_CALL_OFFSET (2)
+#endif
 
 #define WASMBOX_ADD_ARGUMENT(STACK, INDEX, TYPE, V)                 \
   do {                                                              \
@@ -157,8 +289,15 @@ typedef wasmbox_value_t wasmbox_stack_t;
 
 struct wasmbox_code_t {
   struct header {
+#ifndef WASMBOX_VM_USE_COMPACT_CODE
     void *label;
+#endif
     wasm_u16_t opcode;
+#ifdef WASMBOX_VM_USE_ACCUMULATOR
+    /* Operands which are the result of the previous instruction, read from
+     * the accumulator of the interpreter (WASMBOX_ACC_OP1, WASMBOX_ACC_OP2). */
+    wasm_u8_t acc;
+#endif
   } h;
   union wasmbox_code_operands op0;
   union wasmbox_code_operands op1;
@@ -170,31 +309,1223 @@ typedef struct wasmbox_memory_block_t {
   wasm_u8_t data[0 /* WASMBOX_PAGE_SIZE * page_size */];
 } wasmbox_memory_block_t;
 
+/* Bytes of a passive data segment, copied into memory by memory.init. */
+typedef struct wasmbox_data_segment_t {
+  wasm_u8_t *data;
+  wasm_u32_t size;
+  /* Size before data.drop. A resettable module keeps the bytes. */
+  wasm_u32_t length;
+  /* Set if `data` points into the module binary, which the module keeps
+   * instead of a copy. */
+  wasm_u8_t borrowed;
+} wasmbox_data_segment_t;
+
+/* Huge pages obtained for a module (wasmbox_module_t.huge_pages). */
+#define WASMBOX_HUGE_PAGES_MEMORY       (1 << 0) /* madvise(MADV_HUGEPAGE) */
+#define WASMBOX_HUGE_PAGES_CODE         (1 << 1) /* madvise(MADV_HUGEPAGE) */
+#define WASMBOX_HUGE_PAGES_CODE_HUGETLB (1 << 2) /* MAP_HUGETLB */
+
+typedef struct wasmbox_code_region_t wasmbox_code_region_t;
+typedef struct wasmbox_slab_t wasmbox_slab_t;
+typedef struct wasmbox_instance_pool_t wasmbox_instance_pool_t;
+typedef struct wasmbox_instance_slot_t wasmbox_instance_slot_t;
+
+/* Initial contents of a linear memory, shared by the instances of a module. */
+typedef struct wasmbox_memory_image_t wasmbox_memory_image_t;
+typedef struct wasmbox_memory_tracker_t wasmbox_memory_tracker_t;
+typedef struct wasmbox_shared_memory_t wasmbox_shared_memory_t;
+typedef struct wasmbox_code_cache_t wasmbox_code_cache_t;
+typedef struct wasmbox_compiled_module_t wasmbox_compiled_module_t;
+
+/**
+ * Signatures of a host function. A WASMBOX_HOST_FRAME function reads the
+ * arguments from, and writes the results to, the frame of the call in place.
+ * The others take and return unboxed values. Every kind can only be imported
+ * with exactly its type, which the frame kinds give in `types`.
+ */
+#define WASMBOX_HOST_FRAME       (0) /* `types` */
+#define WASMBOX_HOST_I32_I32     (1) /* (i32) -> i32 */
+#define WASMBOX_HOST_I32_I32_I32 (2) /* (i32, i32) -> i32 */
+#define WASMBOX_HOST_I64_I64     (3) /* (i64) -> i64 */
+#define WASMBOX_HOST_ASYNC       (4) /* `types`, may suspend the call */
+
+/**
+ * Allocator which a module takes its heap memory from instead of libc, such
+ * as an arena per tenant or a pool local to a NUMA node. Each function is
+ * called with `ctx`. Blocks go back to the allocator they came from, and
+ * `free` is given the size the block was last allocated with. Blocks must be
+ * aligned to 16 bytes.
+ */
+typedef struct wasmbox_allocator_t {
+  void *(*malloc)(void *ctx, size_t size);
+  void *(*realloc)(void *ctx, void *ptr, size_t size);
+  void (*free)(void *ctx, void *ptr, size_t size);
+  void *ctx;
+} wasmbox_allocator_t;
+
+struct wasmbox_module_t;
+
+/* A function which a module imports as `module`.`name`. */
+typedef struct wasmbox_host_function_t {
+  const char *module;
+  const char *name;
+  wasm_u8_t kind;
+  union wasmbox_host_entry {
+    void (*frame)(struct wasmbox_module_t *mod, const wasmbox_value_t *args,
+                  wasmbox_value_t *results, void *data);
+    wasm_s32_t (*i32_i32)(void *data, wasm_s32_t a);
+    wasm_s32_t (*i32_i32_i32)(void *data, wasm_s32_t a, wasm_s32_t b);
+    wasm_s64_t (*i64_i64)(void *data, wasm_s64_t a);
+    /* Returns nonzero to suspend the call with WASMBOX_SUSPENDED. The host
+     * then writes `results` before the call is resumed. */
+    int (*async)(struct wasmbox_module_t *mod, const wasmbox_value_t *args,
+                 wasmbox_value_t *results, void *data);
+  } entry;
+  void *data;
+  /* Types of the parameters followed by those of the results of a
+   * WASMBOX_HOST_FRAME or WASMBOX_HOST_ASYNC function, with an entry per slot
+   * as in wasmbox_type_t. */
+  const wasmbox_value_type_t *types;
+  wasm_u16_t param_size;
+  wasm_u16_t result_size;
+} wasmbox_host_function_t;
+
+/* A loaded module whose exported functions a module imports as `name`. */
+typedef struct wasmbox_linked_module_t {
+  const char *name;
+  struct wasmbox_module_t *module;
+} wasmbox_linked_module_t;
+
+/* Heap memory taken by wasmbox in the whole process, in bytes. */
+typedef struct wasmbox_allocation_stats_t {
+  wasm_u64_t allocations;
+  wasm_u64_t frees;
+  /* Includes growth by realloc. Shrinking counts as freed. */
+  wasm_u64_t allocated;
+  wasm_u64_t freed;
+} wasmbox_allocation_stats_t;
+
+/* Heap memory taken from one call site of the allocator. */
+typedef struct wasmbox_allocation_site_t {
+  /* Return address of the call, to be symbolized with dladdr or addr2line. */
+  const void *caller;
+  wasm_u64_t count;
+  wasm_u64_t bytes;
+  /* Bytes of the site which are not freed yet, and their maximum. */
+  wasm_u64_t live;
+  wasm_u64_t peak;
+} wasmbox_allocation_site_t;
+
+/* Bytes taken by a module, filled in by wasmbox_module_memory_usage. */
+typedef struct wasmbox_memory_usage_t {
+  /* Shared by the instances of a compiled module. */
+  wasm_u64_t code; /* with the targets of br_table */
+  wasm_u64_t types;
+  wasm_u64_t names;
+  /* Owned by each instance. */
+  wasm_u64_t globals;
+  wasm_u64_t ref_tables;
+  wasm_u64_t memory_committed;
+  wasm_u64_t memory_reserved;
+  wasm_u64_t stack_high_water;
+} wasmbox_memory_usage_t;
+
+/* Wall time and number of runs of one phase of loading a module. */
+typedef struct wasmbox_load_phase_t {
+  wasm_u64_t ns;
+  wasm_u32_t count;
+} wasmbox_load_phase_t;
+
+/* What compiling one function body took and produced. */
+typedef struct wasmbox_function_load_stats_t {
+  wasm_u64_t decode_ns; /* parsing the body into blocks */
+  wasm_u64_t freeze_ns; /* optimizing, linking and compiling to native code */
+  wasm_u64_t link_ns;   /* linking the blocks, part of freeze_ns */
+  /* Instructions of the frozen code, and those among them which only copy a
+   * slot, do nothing or jump. */
+  wasm_u32_t instructions;
+  wasm_u32_t moves;
+  wasm_u32_t nops;
+  wasm_u32_t jumps;
+} wasmbox_function_load_stats_t;
+
+/* Section ids go up to the data count section. */
+#define WASMBOX_SECTION_COUNT (13)
+
+/* Cost of loading a module, filled in by wasmbox_module_load_stats. */
+typedef struct wasmbox_load_stats_t {
+  wasmbox_load_phase_t total;
+  wasmbox_load_phase_t file_read;
+  /* Each section parser, by section id. The code section includes compiling
+   * the function bodies and the data section the data initialization. */
+  wasmbox_load_phase_t sections[WASMBOX_SECTION_COUNT];
+  /* Sums of `functions`. */
+  wasmbox_load_phase_t decode;
+  wasmbox_load_phase_t freeze;
+  wasmbox_load_phase_t link;
+  wasm_u64_t instructions;
+  wasm_u64_t moves;
+  wasm_u64_t nops;
+  wasm_u64_t jumps;
+  /* Copying the data segments into memory. */
+  wasmbox_load_phase_t data_init;
+  /* Evaluating the global initializers. */
+  wasmbox_load_phase_t global_init;
+  /* One per function of the module. Imported functions and functions which
+   * are compiled lazily or taken from a code cache are zero. Owned by the
+   * module. */
+  const wasmbox_function_load_stats_t *functions;
+  wasm_u32_t function_size;
+} wasmbox_load_stats_t;
+
+/* Diagnostics of loading a module, from the least to the most detailed. */
+#define WASMBOX_LOG_NONE (0)
+/* Imports and sections with no effect on the module. */
+#define WASMBOX_LOG_INFO (1)
+/* Block types and the compiled code of every function. */
+#define WASMBOX_LOG_DEBUG (2)
+
+/* Receives one message, which is only valid during the call. */
+typedef void (*wasmbox_log_callback_t)(void *data, int level,
+                                       const char *message);
+
+/* The linear memory of a module as an embedder may read and write it. */
+typedef struct wasmbox_memory_view_t {
+  /* First byte, or NULL if there is no memory. */
+  wasm_u8_t *base;
+  /* Bytes the guest can access. */
+  wasm_u64_t length;
+  /* Changes whenever `base` or `length` does, so a pointer taken from a view
+   * stays valid while the generation is the same. */
+  wasm_u64_t generation;
+} wasmbox_memory_view_t;
+
+/* Receives the view of `mod` after it grew its memory. */
+typedef void (*wasmbox_memory_grow_callback_t)(
+    void *data, struct wasmbox_module_t *mod,
+    const wasmbox_memory_view_t *view);
+
+#ifdef WASMBOX_VM_USE_MEMORY_PROFILE
+/* Loads and stores which touched one page of linear memory. */
+typedef struct wasmbox_memory_page_count_t {
+  wasm_u64_t reads;
+  wasm_u64_t writes;
+} wasmbox_memory_page_count_t;
+
+typedef struct wasmbox_memory_profile_t wasmbox_memory_profile_t;
+#endif
+
+#ifdef WASMBOX_VM_USE_OPCODE_PROFILE
+typedef struct wasmbox_opcode_profile_t wasmbox_opcode_profile_t;
+#endif
+
+#ifdef WASMBOX_VM_USE_SAMPLING_PROFILE
+typedef struct wasmbox_sampling_profile_t wasmbox_sampling_profile_t;
+typedef struct wasmbox_debug_sections_t wasmbox_debug_sections_t;
+#endif
+
+#ifdef WASMBOX_VM_USE_PERF_COUNTERS
+typedef struct wasmbox_perf_counters_t wasmbox_perf_counters_t;
+#endif
+
+#ifdef WASMBOX_VM_USE_LATENCY_HISTOGRAM
+typedef struct wasmbox_latency_histogram_t wasmbox_latency_histogram_t;
+#endif
+
+#ifdef WASMBOX_VM_USE_AOT
+/* Native code of a function translated to C by wasmbox_aot_translate.
+ * `stack` is its frame, laid out as for the interpreter. */
+typedef void (*wasmbox_aot_entry_t)(struct wasmbox_module_t *mod,
+                                    wasmbox_value_t *stack);
+
+typedef struct wasmbox_aot_function_t {
+  wasm_u32_t index;
+  /* Of the function it was translated from, checked against the function
+   * at `index` when a module is loaded. */
+  wasm_u16_t argument_size;
+  wasm_u16_t return_size;
+  wasm_u16_t frame_size;
+  wasmbox_aot_entry_t entry;
+} wasmbox_aot_function_t;
+
+/* The translated functions of one module binary. */
+typedef struct wasmbox_aot_module_t {
+  const wasmbox_aot_function_t *functions;
+  wasm_u32_t function_size;
+} wasmbox_aot_module_t;
+#endif
+
 typedef struct wasmbox_module_t {
+  /* The state which running code reads on memory, global and table accesses
+   * and on metered, interruptible or checked calls and loops. It comes first
+   * and fills the first 64 bytes, so that it shares one cache line and is
+   * reached with one load from the module pointer the interpreter keeps in a
+   * register. */
+  wasmbox_memory_block_t *memory_block;
+  wasmbox_value_t *globals;
+  /* Tables of references, owned by each module or instance. */
+  wasmbox_ref_table_t *tables;
+  wasm_s64_t fuel;
+  wasm_u64_t *epoch;
+  wasm_u64_t epoch_deadline;
+  wasmbox_value_t *stack_end;
+  wasm_u32_t memory_block_size;
+  wasm_u32_t memory_block_capacity;
+  /* If set before wasmbox_load_module or wasmbox_instance_init, everything
+   * the module allocates on the heap, when loaded and when run, comes from
+   * it. It must outlive the module. Reserved linear memories, stacks and code
+   * regions are pages mapped from the host. */
+  const wasmbox_allocator_t *allocator;
   wasmbox_function_t **functions;
   wasm_u32_t function_size;
   wasm_u32_t function_capacity;
-  wasmbox_value_t *globals;
   wasm_u32_t global_size;
-  wasmbox_memory_block_t *memory_block;
-  wasm_u32_t memory_block_size;
-  wasm_u32_t memory_block_capacity;
+  /* Index plus 1 of the global taken for the stack pointer of the guest, the
+   * first mutable i32 one like __stack_pointer of clang, or 0. */
+  wasm_u32_t stack_pointer_global;
+  /* Per global, the LOAD_CONST opcode that materializes it if it is immutable
+   * and its initial value is known at load time, or 0. */
+  wasm_u16_t *global_constants;
+  /* Per global, its wasmbox_value_type_t. */
+  wasm_u8_t *global_types;
+  /* See wasmbox_memory_view_t. */
+  wasm_u64_t memory_generation;
+  /* Set if the memory is a memory64. Its addresses are i64 values, which
+   * every access checks against the size of the memory. */
+  wasm_u8_t memory64;
+  /* If set, called after the module grows its memory, by memory.grow or
+   * otherwise. Growth of a shared memory by other modules is not reported. */
+  wasmbox_memory_grow_callback_t memory_grow_callback;
+  void *memory_grow_data;
+  /* If set before wasmbox_load_module, the memory starts as a copy-on-write
+   * view of this image and the data segments are not copied again. */
+  wasmbox_memory_image_t *memory_image;
+  /* Set before wasmbox_load_module to back the linear memory and the code
+   * with huge pages where the host provides them. `huge_pages` reports the
+   * WASMBOX_HUGE_PAGES_* which were actually obtained. */
+  wasm_u8_t use_huge_pages;
+  wasm_u8_t huge_pages;
+  wasmbox_code_region_t *code_region;
+  /* The code of the functions, laid out in call order in one piece once the
+   * module is loaded, unless it lives in `code_region`. It is read-only. */
+  void *code_arena;
+  wasm_u64_t code_arena_size;
+  /* If set before wasmbox_load_module, the code of a function runs from one
+   * copy which every module of the process loaded with it shares with the
+   * functions compiled to equal code. Modules with their own allocator, code
+   * region or code cache keep their code. */
+  wasm_u8_t deduplicate_code;
+  /* If set before wasmbox_load_module, the memory, the globals and a value
+   * stack come from a slot of this pool, which is returned on dispose. */
+  wasmbox_instance_pool_t *instance_pool;
+  wasmbox_instance_slot_t *instance_slot;
+  /* If set before wasmbox_load_module, the time each phase of the load
+   * takes is recorded for wasmbox_module_load_stats. */
+  wasm_u8_t record_load_stats;
+  wasmbox_load_stats_t *load_stats;
+  /* If set before wasmbox_load_module, the messages up to `log_level` are
+   * passed to it. Nothing is formatted otherwise. */
+  wasmbox_log_callback_t log_callback;
+  void *log_data;
+  wasm_u8_t log_level;
+  /* If set before wasmbox_load_module, the state right after loading is
+   * recorded and wasmbox_instance_reset returns to it. */
+  wasm_u8_t resettable;
+  wasmbox_value_t *initial_globals;
+  wasmbox_ref_table_t *initial_tables;
+  wasmbox_memory_tracker_t *memory_tracker;
+  /* If set before wasmbox_load_module, the memory and the globals are taken
+   * from this file, written by wasmbox_instance_snapshot, instead of applying
+   * the data segments and evaluating the global initializers. */
+  const char *snapshot_file;
+  wasmbox_memory_image_t *snapshot_image;
+  /* Set once table.set or table.grow has run, after which the tables differ
+   * from what instantiation gives them and the module cannot be snapshot. */
+  wasm_u8_t tables_modified;
+  /* If set before wasmbox_load_module, the compiled code is written to a file
+   * in this directory, named after a hash of the module binary, and is mapped
+   * from there instead of compiled the next time the binary is loaded. JIT and
+   * lazily compiling builds, wasmbox_stream_create, and modules importing
+   * functions do not use it. */
+  const char *code_cache_dir;
+  wasmbox_code_cache_t *code_cache;
+#ifdef WASMBOX_VM_USE_AOT
+  /* If set before wasmbox_load_module, the functions it has native code for
+   * run it instead of being interpreted. It is translated from the same
+   * binary by a build with the same options. Metered and interruptible
+   * modules, modules importing asynchronous host functions, and JIT, lazily
+   * compiling and compact code builds do not use it. */
+  const wasmbox_aot_module_t *aot;
+#endif
+  /* A shared memory which the module defines or imports is this one if it is
+   * set before wasmbox_load_module. Otherwise a module defining a shared
+   * memory creates it here, for other modules to use. */
+  wasmbox_shared_memory_t *shared_memory;
+  /* Function imports are resolved by name among these host functions, which
+   * must be set before wasmbox_load_module and outlive the module. */
+  const wasmbox_host_function_t *host_functions;
+  wasm_u32_t host_function_size;
+  /* Function imports which are not host functions are resolved by name among
+   * the exports of these modules, which must be set before
+   * wasmbox_load_module and outlive the module. Calls to them run the code of
+   * the linked module directly, with its memory and its globals. Modules
+   * whose calls can stop, metered, interruptible or importing asynchronous
+   * host functions, cannot be linked. */
+  const wasmbox_linked_module_t *linked_modules;
+  wasm_u32_t linked_module_size;
+  /* The imported functions come first in `functions`. */
+  wasm_u32_t import_function_size;
+  /* Indexed by data index. Active and dropped segments are empty. */
+  wasmbox_data_segment_t *data_segments;
+  wasm_u32_t data_segment_size;
   wasmbox_function_t *global_function;
   wasmbox_type_t **types;
   wasm_u32_t type_size;
   wasm_u32_t type_capacity;
-  wasmbox_table_t **tables;
   wasm_u32_t table_size;
+  wasmbox_call_cache_t *call_caches;
+  /* Types, names and functions, freed together. */
+  wasmbox_slab_t *metadata;
+  wasmbox_export_t *exports;
+  wasm_u32_t export_size;
+  /* Open addressing hash table of the exports by name. Each bucket is an
+   * index in `exports` plus one, or 0. The size is a power of two. */
+  wasm_u32_t *export_buckets;
+  wasm_u32_t export_bucket_size;
   wasmbox_code_t shared_code[2];
+  /* Maximum number of instructions of a leaf function which is inlined into
+   * its callers. 0 uses the default and a negative value disables inlining. */
+  wasm_s32_t inline_threshold;
+#ifdef WASMBOX_VM_USE_LAZY_COMPILE
+  /* Number of calls in a row to one callee after which an indirect call site
+   * is speculated to call it. Its function is recompiled once to call it
+   * directly when the table entry still holds it, inlining it if it is small.
+   * 0 uses the default and a negative value disables speculation. */
+  wasm_s32_t speculation_threshold;
+  /* Number of calls and loop iterations after which a function is
+   * recompiled with every optimization, and to native code with the JIT.
+   * Until then it is compiled quickly, without inlining, fusing instructions
+   * or optimizing moves. A call running a loop which makes its function hot
+   * continues in the new code. 0 uses the default and a negative value
+   * compiles every function fully on its first call. */
+  wasm_s32_t tier_up_threshold;
+#endif
+  /* If set before wasmbox_load_module, each function call and each iteration
+   * of a loop costs `fuel` one unit per instruction of the function or loop
+   * body. A call which would take it below 0 stops with WASMBOX_OUT_OF_FUEL,
+   * to be continued by wasmbox_resume once the embedder adds more. Metered
+   * functions are not compiled to native code. */
+  wasm_u8_t fuel_metering;
+  /* If set before wasmbox_load_module, each function call and each iteration
+   * of a loop checks whether `epoch` has reached `epoch_deadline`, and the
+   * call stops with WASMBOX_INTERRUPTED if it has. `epoch` is advanced by
+   * another thread, such as a timer. If it is NULL when the module is loaded
+   * it is the counter of the process, advanced by wasmbox_epoch_increment.
+   * Interruptible functions are not compiled to native code. */
+  wasm_u8_t epoch_interruption;
+  /* Number of values of a stack passed to wasmbox_eval_module or
+   * wasmbox_eval_export. A call whose frame would not fit in it traps instead
+   * of running past its end. 0 leaves such stacks unchecked. */
+  wasm_u32_t stack_size;
+  /* `stack_end`, at the start, is the end of the stack of the running call.
+   * Each call checks that the frame of its callee ends below it. */
+  /* End of the deepest frame of the running call, and the most bytes of
+   * stack any call has used. */
+  wasmbox_value_t *stack_peak;
+  wasm_u64_t stack_high_water;
+#if defined(WASMBOX_VM_USE_JIT) || defined(WASMBOX_VM_USE_AOT)
+  /* Lowest machine stack address native code may call down to. Deeper calls
+   * go through the interpreter, which traps. */
+  void *native_stack_limit;
+#endif
+  /* Where the VM stopped, and why, or NULL. */
+  wasmbox_code_t *resume_code;
+  wasmbox_value_t *resume_stack;
+  int resume_status;
+  /* The stack the stopped call was started with, and its number of results,
+   * which are at the bottom of it once it returns. */
+  wasmbox_value_t *resume_results;
+  wasm_u16_t resume_result_size;
+#ifdef WASMBOX_VM_USE_PARALLEL_COMPILE
+  /* Number of threads compiling function bodies. 0 uses every online CPU. */
+  wasm_u32_t compile_threads;
+#endif
+#ifdef WASMBOX_VM_USE_EXECUTOR
+  /* NUMA node plus one which wasmbox_executor_place put the instance on, or
+   * 0. Its jobs are queued on the workers of that node. */
+  wasm_u32_t home_node;
+#endif
+#ifdef WASMBOX_VM_USE_MEMORY_PROFILE
+  /* Per-page access counts, allocated on the first load or store. */
+  wasmbox_memory_profile_t *memory_profile;
+#endif
+#ifdef WASMBOX_VM_USE_OPCODE_PROFILE
+  /* Runs of each interpreter handler and of each pair of them in a row,
+   * allocated on the first instruction. */
+  wasmbox_opcode_profile_t *opcode_profile;
+#endif
+#ifdef WASMBOX_VM_USE_SAMPLING_PROFILE
+  /* Stacks sampled since wasmbox_sampling_profile_start. */
+  wasmbox_sampling_profile_t *sampling_profile;
+  /* The DWARF line tables which samples are mapped to source lines by, and
+   * the start of the code section their addresses are relative to. */
+  wasmbox_debug_sections_t *debug_sections;
+  wasm_u32_t code_section_offset;
+#endif
+#ifdef WASMBOX_VM_USE_PERF_COUNTERS
+  /* Hardware events of the export calls since wasmbox_perf_counters_start. */
+  wasmbox_perf_counters_t *perf_counters;
+#endif
+#ifdef WASMBOX_VM_USE_LATENCY_HISTOGRAM
+  /* Latencies of the export calls since wasmbox_latency_histograms_start,
+   * one histogram per export. */
+  wasmbox_latency_histogram_t *latency_histograms;
+#endif
+  /* Size and hash of the module binary, to match a snapshot or a code cache
+   * file with it. */
+  wasm_u32_t source_size;
+  wasm_u64_t source_hash;
+  /* Module binary, kept for the functions compiled on their first call and
+   * for the passive data segments which point into a mapped file or a
+   * borrowed buffer. */
+  wasm_u8_t *source;
+  wasm_u8_t source_kind;
+  /* Function names of the name section in `source`, which are decoded once
+   * wasmbox_function_name asks for one. `name_size` is 0 after. */
+  wasm_u32_t name_offset;
+  wasm_u32_t name_size;
+  char name_lock;
+#ifdef WASMBOX_VM_USE_LAZY_COMPILE
+  /* Held while a function is compiled on its first call. */
+  char compile_lock;
+#endif
+  /* If set before wasmbox_load_module_from_buffer, the caller promises that
+   * the buffer outlives the module, so names point into it. */
+  wasm_u8_t borrow_source;
+  /* Set on an instance. The functions, types and passive data bytes belong
+   * to this compiled module and are only borrowed. */
+  wasmbox_compiled_module_t *compiled;
 } wasmbox_module_t;
 
+/**
+ * A module run as an instance of a compiled module. It is the context the
+ * interpreter runs with, and owns only its memory, globals, tables and data
+ * segment sizes, so any number of them can share one copy of the code.
+ *
+ * Running an instance does not modify its compiled module, except for the
+ * code of functions compiled on their first call, which is updated
+ * race-free. So any number of threads may each run their own
+ * instances of one compiled module at once. An instance, like a module, is
+ * used by one thread at a time; only a shared memory is accessed by several.
+ */
+typedef wasmbox_module_t wasmbox_instance_t;
+
 int wasmbox_load_module(wasmbox_module_t *mod, const char *file_name,
                         wasm_u16_t file_name_len);
 
+/**
+ * Loads a module binary which is already in memory. It is parsed in place and
+ * only needs to stay alive during the call, unless `borrow_source` is set.
+ */
+int wasmbox_load_module_from_buffer(wasmbox_module_t *mod,
+                                    const wasm_u8_t *data, size_t len);
+
+typedef struct wasmbox_stream_t wasmbox_stream_t;
+
+/**
+ * Starts loading `mod` from a binary which arrives in pieces. Each section is
+ * parsed, and each function body compiled, as soon as its bytes are there.
+ * Returns NULL if `mod` cannot be loaded this way, as with `snapshot_file`.
+ */
+wasmbox_stream_t *wasmbox_stream_create(wasmbox_module_t *mod);
+
+/* Appends the next `len` bytes. Returns -1 once the binary is malformed. */
+int wasmbox_stream_feed(wasmbox_stream_t *stream, const wasm_u8_t *bytes,
+                        size_t len);
+
+/**
+ * Ends the binary and frees `stream`. Returns 0 if `mod` is loaded as by
+ * wasmbox_load_module, and -1 if the binary was malformed or truncated.
+ */
+int wasmbox_stream_finish(wasmbox_stream_t *stream);
+
+/* Runs the function exported as `_start`. */
 int wasmbox_eval_module(wasmbox_module_t *mod, wasmbox_value_t stack[]);
 
+/* Returns the export called `name`, or NULL. */
+const wasmbox_export_t *wasmbox_lookup_export(wasmbox_module_t *mod,
+                                              const char *name);
+
+/**
+ * Returns the name of the function at `index`, after its export or the name
+ * section, or NULL. The name section of a mapped file or a borrowed buffer
+ * is decoded on the first call, and the names stay with the module.
+ */
+wasmbox_name_t *wasmbox_function_name(wasmbox_module_t *mod,
+                                      wasm_u32_t index);
+
+/* Statuses of a call which stopped before the end and can be resumed. */
+/* Returned by a call of a metered module which ran out of fuel. */
+#define WASMBOX_OUT_OF_FUEL (1)
+/* Returned by a call of an interruptible module past its epoch deadline. */
+#define WASMBOX_INTERRUPTED (2)
+/* Returned by a call which a WASMBOX_HOST_ASYNC function suspended. */
+#define WASMBOX_SUSPENDED (3)
+
+/**
+ * Runs an exported function with the stack laid out as for
+ * wasmbox_eval_module. Returns -1 if it traps or `export` is not a function,
+ * and one of the statuses above if it stops before the end.
+ */
+int wasmbox_eval_export(wasmbox_module_t *mod, const wasmbox_export_t *export,
+                        wasmbox_value_t stack[]);
+
+/**
+ * Calls an exported function with `args`, one value per parameter, and
+ * stores a value per result in `results`. The frame is laid out on the stack
+ * of the instance pool slot, or else on a stack which each calling thread
+ * reserves once, so a call allocates nothing. A call whose frame would not
+ * fit in the stack traps. Returns -1 if it traps or `export` is not a
+ * function, and one of the statuses above if it stops before the end. The
+ * thread then resumes it before it calls the instance again, or uses a
+ * wasmbox_context_t to have several calls stopped at once.
+ */
+int wasmbox_call(wasmbox_instance_t *instance, const wasmbox_export_t *export,
+                 const wasmbox_value_t *args, wasmbox_value_t *results);
+
+/**
+ * Calls an exported function `n` times in a row. `args` holds the arguments
+ * of each call one after another, and `results` receives their results in
+ * the same way. Every call returns straight into the next one, so the VM is
+ * entered once for the whole batch. Returns -1 if a call traps, keeping the
+ * results of the calls before it. A batch which stops returns its status the
+ * same way, and cannot be resumed.
+ */
+int wasmbox_call_batch(wasmbox_instance_t *instance,
+                       const wasmbox_export_t *export,
+                       const wasmbox_value_t *args, wasmbox_value_t *results,
+                       size_t n);
+
+/**
+ * Continues the call which last stopped on `instance`. Once it returns 0,
+ * its results are on its stack as for wasmbox_eval_export, and are also
+ * copied to `results` unless it is NULL. Returns -1 if there is no such call
+ * or it traps, and a status again if it stops again.
+ */
+int wasmbox_resume(wasmbox_instance_t *instance, wasmbox_value_t *results);
+
+/* Advances the epoch of the modules which do not have their own. */
+void wasmbox_epoch_increment(void);
+
+/* Moves the deadline of `instance` to `ticks` past its current epoch. */
+void wasmbox_set_epoch_deadline(wasmbox_instance_t *instance,
+                                wasm_u64_t ticks);
+
+/**
+ * A call with a stack of its own, which keeps where the call stopped. Any
+ * number of them can be stopped at once, and resumed in any order by the
+ * thread running the instance, like green threads sharing its memory.
+ */
+typedef struct wasmbox_context_t wasmbox_context_t;
+
+/**
+ * Creates a context running calls of `instance` on a stack of `stack_size`
+ * values, or of the size wasmbox_call uses if it is 0.
+ */
+wasmbox_context_t *wasmbox_context_create(wasmbox_instance_t *instance,
+                                          size_t stack_size);
+
+void wasmbox_context_dispose(wasmbox_context_t *ctx);
+
+/**
+ * Starts a call as wasmbox_call does. Returns -1 if the context is already
+ * running a call which stopped.
+ */
+int wasmbox_context_call(wasmbox_context_t *ctx,
+                         const wasmbox_export_t *export,
+                         const wasmbox_value_t *args, wasmbox_value_t *results);
+
+/**
+ * Continues the call of `ctx` where it stopped, as wasmbox_resume does, and
+ * stores its results in `results` once it returns 0.
+ */
+int wasmbox_context_resume(wasmbox_context_t *ctx, wasmbox_value_t *results);
+
 int wasmbox_module_dispose(wasmbox_module_t *mod);
 
+/**
+ * Breaks down what a loaded module costs, to pack modules on hosts. The
+ * linear memory is committed up to its current size, and reserved up to
+ * the address space mapped for it. The stack high-water mark covers every
+ * call made so far.
+ */
+void wasmbox_module_memory_usage(wasmbox_module_t *mod,
+                                 wasmbox_memory_usage_t *usage);
+
+/**
+ * Fills `stats` with the phases of loading `mod`, which was loaded with
+ * `record_load_stats` set. Returns -1 if it was not.
+ */
+int wasmbox_module_load_stats(wasmbox_module_t *mod,
+                              wasmbox_load_stats_t *stats);
+
+/* Sums up the heap memory allocated and freed so far by every thread. */
+void wasmbox_allocation_stats(wasmbox_allocation_stats_t *stats);
+
+/**
+ * Starts or stops breaking down allocations by their call site. Blocks are
+ * counted against the site they were allocated at, so frees and reallocs of
+ * blocks allocated while it was off are not tracked.
+ */
+void wasmbox_allocation_sites_enable(int enable);
+
+/**
+ * Fills `sites` with up to `count` call sites seen so far, and returns the
+ * number of such sites.
+ */
+wasm_u32_t wasmbox_allocation_sites(wasmbox_allocation_site_t *sites,
+                                    wasm_u32_t count);
+
+/**
+ * Captures the linear memory of a loaded module, typically right after its
+ * data segments are applied. Returns NULL if the module has no memory.
+ */
+wasmbox_memory_image_t *wasmbox_memory_image_create(wasmbox_module_t *mod);
+
+void wasmbox_memory_image_dispose(wasmbox_memory_image_t *image);
+
+/**
+ * Fills `view` with the current linear memory of `mod`. With a reservation
+ * the base never moves, and only the length changes as the memory grows.
+ */
+void wasmbox_memory_view(wasmbox_module_t *mod, wasmbox_memory_view_t *view);
+
+/* Modes of wasmbox_memory_map. */
+/* Stores of the guest to the mapped bytes trap. */
+#define WASMBOX_MAP_READ_ONLY     (0)
+/* Stores go to private copies of the pages and leave the file alone. */
+#define WASMBOX_MAP_COPY_ON_WRITE (1)
+
+/**
+ * Maps `size` bytes of `fd` from `file_offset` over the linear memory of
+ * `mod` at `offset`, so the guest sees them without a copy. Both offsets are
+ * multiples of the host page size, and the range, rounded up to whole host
+ * pages, lies in the current memory. The last page reads zeros past the end
+ * of the file. Returns -1 where the memory is not reserved, is shared, or
+ * tracks writes for wasmbox_instance_reset.
+ */
+int wasmbox_memory_map(wasmbox_module_t *mod, wasm_u32_t offset, int fd,
+                       wasm_u64_t file_offset, wasm_u64_t size, int mode);
+
+/* Puts zeroed writable pages back over a range of wasmbox_memory_map. */
+int wasmbox_memory_unmap(wasmbox_module_t *mod, wasm_u32_t offset,
+                         wasm_u64_t size);
+
+/**
+ * Reserves `slot_count` instances up front, each with a linear memory, room
+ * for `global_count` globals and a stack of `stack_size` values. Instances
+ * then cost no allocation, and disposing one only drops the pages it used.
+ * Returns NULL where memory cannot be reserved.
+ */
+wasmbox_instance_pool_t *wasmbox_instance_pool_create(wasm_u32_t slot_count,
+                                                      wasm_u32_t global_count,
+                                                      wasm_u32_t stack_size);
+
+/* Every module using the pool must have been disposed. */
+void wasmbox_instance_pool_dispose(wasmbox_instance_pool_t *pool);
+
+/* Returns the value stack of the pool slot of `mod`, or NULL. */
+wasmbox_value_t *wasmbox_module_stack(wasmbox_module_t *mod);
+
+/**
+ * Brings a module loaded with `resettable` set back to its state right after
+ * loading: the globals, the data segments and the linear memory. Only the
+ * memory pages written since the last reset are restored, and pages added by
+ * memory.grow are released. Returns -1 if the module is not resettable.
+ */
+int wasmbox_instance_reset(wasmbox_module_t *mod);
+
+/**
+ * Takes over `mod`, which is loaded but has not run, as the code and the
+ * initial state of instances. `mod` is left empty. Returns NULL, and leaves
+ * `mod` as is, if it was loaded from an instance pool.
+ */
+wasmbox_compiled_module_t *
+wasmbox_compiled_module_create(wasmbox_module_t *mod);
+
+/**
+ * Instantiates `compiled` into `instance`, which is zeroed except for the
+ * options of wasmbox_load_module which concern the state: `allocator`,
+ * `instance_pool`, `use_huge_pages`, `resettable`, `memory_image` and
+ * `shared_memory`. Nothing
+ * is parsed or compiled, and the memory starts as a copy-on-write view of
+ * the initial memory where the host allows it. Dispose the instance with
+ * wasmbox_module_dispose.
+ */
+int wasmbox_instance_init(wasmbox_instance_t *instance,
+                          wasmbox_compiled_module_t *compiled);
+
+/* Every instance of `compiled` must have been disposed. */
+void wasmbox_compiled_module_dispose(wasmbox_compiled_module_t *compiled);
+
+/**
+ * Creates a shared linear memory to be imported by modules running on several
+ * threads. Each module holds a reference while it is loaded, and the memory is
+ * freed once the creator and every module have released it. Returns NULL where
+ * memory cannot be reserved.
+ */
+wasmbox_shared_memory_t *wasmbox_shared_memory_create(wasm_u32_t min,
+                                                      wasm_u32_t max);
+
+void wasmbox_shared_memory_release(wasmbox_shared_memory_t *memory);
+
+/**
+ * Writes the memory and the globals of an initialized module to `file_name`.
+ * Loading the same module with `snapshot_file` set maps the memory back in
+ * lazily. Tables are not saved but rebuilt by instantiation, so a module
+ * whose tables table.set or table.grow has modified is refused.
+ */
+int wasmbox_instance_snapshot(wasmbox_module_t *mod, const char *file_name);
+
+/**
+ * Host side of the I/O calls of WASI preview1: fd_read, fd_write, fd_pread
+ * and fd_pwrite, imported from "wasi_snapshot_preview1". The iovecs of a call
+ * point the host readv and writev straight into the linear memory, so nothing
+ * is copied. A guest file descriptor reaches only the host one it is mapped
+ * to; 0, 1 and 2 start mapped to the standard streams.
+ */
+typedef struct wasmbox_wasi_t wasmbox_wasi_t;
+
+wasmbox_wasi_t *wasmbox_wasi_create(void);
+
+/**
+ * Maps guest `fd` to `host_fd`, or unmaps it if `host_fd` is -1. Returns -1
+ * if `fd` is too large.
+ */
+int wasmbox_wasi_map_fd(wasmbox_wasi_t *wasi, wasm_u32_t fd, int host_fd);
+
+/**
+ * Returns the host functions to load modules with, which live as long as
+ * `wasi`, and stores their number in `size`. To import other host functions
+ * as well, copy these next to them.
+ */
+const wasmbox_host_function_t *wasmbox_wasi_functions(wasmbox_wasi_t *wasi,
+                                                      wasm_u32_t *size);
+
+/* Every module using `wasi` must have been disposed. */
+void wasmbox_wasi_dispose(wasmbox_wasi_t *wasi);
+
+#ifdef WASMBOX_VM_USE_MEMORY_PROFILE
+/**
+ * Fills `pages` with the loads and stores counted in each `page_size` bytes of
+ * the linear memory, up to `page_count` pages. `page_size` is a multiple of
+ * 4 KiB, usually 4096 or WASMBOX_PAGE_SIZE. Returns the number of such pages
+ * in the memory, or 0 if `page_size` is not supported.
+ */
+wasm_u32_t wasmbox_memory_profile_pages(wasmbox_module_t *mod,
+                                        wasm_u32_t page_size,
+                                        wasmbox_memory_page_count_t *pages,
+                                        wasm_u32_t page_count);
+
+void wasmbox_memory_profile_clear(wasmbox_module_t *mod);
+
+/* Prints the working set and a heat map of the pages touched so far. */
+void wasmbox_memory_report_profile(wasmbox_module_t *mod);
+#endif
+
+#ifdef WASMBOX_VM_USE_OPCODE_PROFILE
+#  define WASMBOX_OPCODE_PROFILE_TOP_PAIRS (20)
+
+/**
+ * Returns how many times the interpreter ran the opcode `name`, which is
+ * spelled as in opcodes.h without the OPCODE_ prefix, e.g. "I32_ADD".
+ */
+wasm_u64_t wasmbox_opcode_profile_count(wasmbox_module_t *mod,
+                                        const char *name);
+
+/* Returns how many times the opcode `current` ran right after `previous`. */
+wasm_u64_t wasmbox_opcode_profile_pair_count(wasmbox_module_t *mod,
+                                             const char *previous,
+                                             const char *current);
+
+void wasmbox_opcode_profile_clear(wasmbox_module_t *mod);
+
+/**
+ * Prints the opcodes run so far, most run first, then the `top_pairs` pairs
+ * of opcodes run most often in a row, the candidates for superinstructions.
+ * Disposing prints it with WASMBOX_OPCODE_PROFILE_TOP_PAIRS pairs.
+ */
+void wasmbox_opcode_report_profile(wasmbox_module_t *mod, wasm_u32_t top_pairs);
+#endif
+
+#ifdef WASMBOX_VM_USE_SAMPLING_PROFILE
+/**
+ * Samples the functions `mod` runs every `interval_us` microseconds of CPU
+ * time, from a SIGPROF timer, until wasmbox_sampling_profile_stop. One
+ * profile runs at a time in a process. Returns -1 if one is running already.
+ */
+int wasmbox_sampling_profile_start(wasmbox_module_t *mod,
+                                   wasm_u32_t interval_us);
+
+/**
+ * Stops sampling and writes the samples to `file_name` unless it is NULL, as
+ * collapsed stacks for flamegraph.pl: a "caller;callee count" line per
+ * distinct stack. Functions are named after their export or the name section.
+ * If the module has a .debug_line section, each frame is followed by the
+ * source line it was at, as in "fib (fib.c:6)"; callers are at their call.
+ * With the JIT, the native code of the module is appended to
+ * /tmp/perf-<pid>.map for perf. Returns the number of samples or -1.
+ */
+int wasmbox_sampling_profile_stop(wasmbox_module_t *mod,
+                                  const char *file_name);
+#endif
+
+#ifdef WASMBOX_VM_USE_PERF_COUNTERS
+/* Hardware events counted over the calls of one export. */
+typedef struct wasmbox_perf_counts_t {
+  wasm_u64_t calls;
+  wasm_u64_t cycles;
+  wasm_u64_t instructions;
+  wasm_u64_t branch_misses;
+  /* Reads which missed the L1 data cache. */
+  wasm_u64_t l1d_misses;
+  wasm_u64_t llc_misses;
+} wasmbox_perf_counts_t;
+
+/**
+ * Counts the hardware events of the calls to the exports of `mod` which the
+ * calling thread makes by wasmbox_eval_export, wasmbox_eval_module,
+ * wasmbox_call and wasmbox_call_batch, with perf_event_open. Events the host
+ * does not count stay 0. Returns -1 if it cannot count cycles, e.g. when
+ * perf_event_paranoid forbids it, or if the counters run already.
+ */
+int wasmbox_perf_counters_start(wasmbox_module_t *mod);
+
+/* Copies the events counted over the calls of `export`, or returns -1. */
+int wasmbox_perf_counters_read(wasmbox_module_t *mod,
+                               const wasmbox_export_t *export,
+                               wasmbox_perf_counts_t *counts);
+
+/* Closes the counters and drops what they counted. */
+void wasmbox_perf_counters_stop(wasmbox_module_t *mod);
+#endif
+
+#ifdef WASMBOX_VM_USE_LATENCY_HISTOGRAM
+/**
+ * Buckets of a latency histogram. Latencies below 16ns have a bucket each,
+ * and each power of two above is split into 16 buckets, so a bucket is at
+ * most 1/16 wider than the latencies it holds.
+ */
+#  define WASMBOX_LATENCY_BUCKETS (61 * 16)
+
+/* Latencies of the calls of one export, in nanoseconds. */
+struct wasmbox_latency_histogram_t {
+  /* Calls which returned or trapped, and how long they took. */
+  wasm_u64_t calls;
+  wasm_u64_t total_ns;
+  wasm_u64_t max_ns;
+  wasm_u64_t traps;
+  /* Calls which stopped with WASMBOX_OUT_OF_FUEL or WASMBOX_INTERRUPTED.
+   * They are not timed, and neither are the resumptions which finish them. */
+  wasm_u64_t fuel_interruptions;
+  wasm_u64_t epoch_interruptions;
+  wasm_u64_t counts[WASMBOX_LATENCY_BUCKETS];
+};
+
+/**
+ * Times the calls to the exports of `mod` by wasmbox_eval_export,
+ * wasmbox_eval_module, wasmbox_call and wasmbox_call_batch, which counts
+ * each call of a batch at the mean of the batch. Threads record into the
+ * histograms without locks. Returns -1 if they are recording already.
+ */
+int wasmbox_latency_histograms_start(wasmbox_module_t *mod);
+
+/**
+ * Copies the histogram of `export` into `histogram`, and empties it if
+ * `reset` is set, without losing the calls recorded meanwhile. Returns -1 if
+ * the histograms are not recording or `export` is not of `mod`.
+ */
+int wasmbox_latency_histogram_snapshot(wasmbox_module_t *mod,
+                                       const wasmbox_export_t *export,
+                                       wasmbox_latency_histogram_t *histogram,
+                                       int reset);
+
+/**
+ * Returns the latency under which `percentile` percent of the timed calls
+ * of `histogram` fall, to the precision of its buckets, or 0 if it has none.
+ */
+wasm_u64_t wasmbox_latency_percentile(
+    const wasmbox_latency_histogram_t *histogram, double percentile);
+
+/* Stops recording and drops the histograms. */
+void wasmbox_latency_histograms_stop(wasmbox_module_t *mod);
+#endif
+
+#ifdef WASMBOX_VM_USE_TRACE
+/**
+ * Records every instruction the interpreter runs on this thread into a ring
+ * of the last `capacity` events, rounded up to a power of two, with the time
+ * every `timestamp_interval` events, 0 for never. Resumes into the ring of
+ * the thread if it has the same capacity. Native code of the JIT is not
+ * traced.
+ */
+int wasmbox_trace_start(wasm_u32_t capacity, wasm_u32_t timestamp_interval);
+
+/* Stops recording on this thread. The ring is kept for wasmbox_trace_write. */
+void wasmbox_trace_stop(void);
+
+/* Frees the ring of this thread. */
+void wasmbox_trace_dispose(void);
+
+/**
+ * Writes the ring of this thread to `file_name` with the code ranges and
+ * names of the functions of `mod`. Only calls async-signal-safe functions,
+ * so a crash handler can call it. Returns the number of records or -1.
+ */
+int wasmbox_trace_write(wasmbox_module_t *mod, const char *file_name);
+
+/**
+ * Prints a file of wasmbox_trace_write to `output_file_name`, or stdout if it
+ * is NULL, one event per line as "event function+offset OPCODE". Returns the
+ * number of records or -1.
+ */
+int wasmbox_trace_decode(const char *file_name, const char *output_file_name);
+#endif
+
+#ifdef WASMBOX_VM_USE_AOT
+/**
+ * Translates the functions of the loaded `mod` to C in `file_name`, which
+ * defines `const wasmbox_aot_module_t wasmbox_aot_<name>` for
+ * wasmbox_module_t.aot. A function using an instruction without a
+ * translation keeps being interpreted. Returns the number of functions
+ * translated or -1.
+ */
+int wasmbox_aot_translate(wasmbox_module_t *mod, const char *name,
+                          const char *file_name);
+
+/* Runtime of the translated code, which calls nothing else of WasmBox. */
+
+/* Checks an access of `size` bytes at `addr` and returns where it is. */
+wasm_u8_t *wasmbox_aot_memory(wasmbox_module_t *mod, wasm_u64_t addr,
+                              wasm_u32_t size);
+wasm_u32_t wasmbox_aot_memory_size(wasmbox_module_t *mod);
+wasm_u32_t wasmbox_aot_memory_grow(wasmbox_module_t *mod, wasm_u32_t delta);
+/* Calls function `index` or the element of `table` whose type is `type`,
+ * with the callee frame at `frame`. */
+void wasmbox_aot_call(wasmbox_module_t *mod, wasmbox_value_t *frame,
+                      wasm_u32_t index);
+void wasmbox_aot_call_indirect(wasmbox_module_t *mod, wasmbox_value_t *frame,
+                               wasm_u32_t table, wasm_u32_t type,
+                               wasm_u32_t element);
+void wasmbox_aot_trap(const char *message);
+#endif
+
+#ifdef WASMBOX_VM_USE_EXECUTOR
+/**
+ * A pool of worker threads running calls of instances. Each worker runs the
+ * jobs it was given newest first, and an idle worker steals the oldest job of
+ * another one.
+ */
+typedef struct wasmbox_executor_t wasmbox_executor_t;
+
+/**
+ * A call run by an executor. The embedder fills the fields up to `data` and
+ * keeps the job until it is done. An instance runs one job at a time.
+ */
+typedef struct wasmbox_job_t {
+  wasmbox_instance_t *instance;
+  /* Exported function to call. */
+  const wasmbox_export_t *function;
+  const wasmbox_value_t *args;
+  wasmbox_value_t *results;
+  /* Called on the worker once the job is done, or NULL. It may submit jobs,
+   * including this one. */
+  void (*done)(struct wasmbox_job_t *job);
+  void *data;
+  /* Set once the job is done, as wasmbox_call returns. A job which stopped
+   * keeps its call, which continues when the job is submitted again. */
+  int status;
+  /* Number of times the job ran out of its fuel slice and yielded. */
+  wasm_u32_t yields;
+  /* The call of the job, on a stack of its own. */
+  wasmbox_context_t *context;
+} wasmbox_job_t;
+
+typedef struct wasmbox_executor_stats_t {
+  /* Jobs done. */
+  wasm_u64_t jobs;
+  /* Runs of a job until it was done or yielded. */
+  wasm_u64_t runs;
+  wasm_u64_t yields;
+  /* Jobs taken from another worker. */
+  wasm_u64_t steals;
+} wasmbox_executor_stats_t;
+
+/**
+ * Starts `workers` threads, or one per online CPU if it is 0. On a host with
+ * several NUMA nodes the workers are spread over the nodes and each is kept
+ * on the CPUs of its node. With a `fuel_slice` above 0, each run of a job of
+ * a metered instance is given that much fuel. A job which runs out of it
+ * yields to the other jobs of its worker and may be stolen by an idle one,
+ * instead of being done with WASMBOX_OUT_OF_FUEL. Returns NULL if a thread
+ * could not be started.
+ */
+wasmbox_executor_t *wasmbox_executor_create(wasm_u32_t workers,
+                                            wasm_s64_t fuel_slice);
+
+/**
+ * Puts `instance` on the NUMA node of the workers with the fewest instances
+ * so far, and binds its linear memory, globals and stack to the node, as
+ * far as they span whole pages. Its jobs then run on the workers of the node,
+ * which steal from another node only when a worker there has more than one
+ * job queued. Returns the node.
+ */
+wasm_u32_t wasmbox_executor_place(wasmbox_executor_t *executor,
+                                  wasmbox_instance_t *instance);
+
+/**
+ * Queues `job` on the worker running the caller, or else on the workers in
+ * turn, keeping to the node of a placed instance. Returns -1 if its function
+ * is not a function.
+ */
+int wasmbox_executor_submit(wasmbox_executor_t *executor, wasmbox_job_t *job);
+
+/* Waits until every job submitted is done. Not to be called by a worker. */
+void wasmbox_executor_wait(wasmbox_executor_t *executor);
+
+void wasmbox_executor_stats(wasmbox_executor_t *executor,
+                            wasmbox_executor_stats_t *stats);
+
+/**
+ * Waits for the jobs and stops the workers. The calls of the jobs which
+ * stopped are dropped.
+ */
+void wasmbox_executor_dispose(wasmbox_executor_t *executor);
+
+/* A range of linear memory which a call of wasmbox_executor_fork_join
+ * covers, and how the call ended. */
+typedef struct wasmbox_shard_t {
+  wasm_u32_t offset;
+  wasm_u32_t size;
+  /* The result of the call, if the function has one. */
+  wasmbox_value_t result;
+  /* As wasmbox_call returns. */
+  int status;
+} wasmbox_shard_t;
+
+/**
+ * Cuts the `size` bytes at `offset` into `shard_size` ranges of about the
+ * same size, each starting at a multiple of `align` bytes past `offset`.
+ */
+void wasmbox_shards_split(wasmbox_shard_t *shards, wasm_u32_t shard_size,
+                          wasm_u32_t offset, wasm_u32_t size,
+                          wasm_u32_t align);
+
+/**
+ * Calls `function` of `instance`, which takes an offset and a size in linear
+ * memory as two i32 and returns at most one value, once per shard on the
+ * workers, and waits for every call. Each call runs in a clone of `instance`
+ * which shares its code and starts with a copy of its globals. A shared
+ * memory is shared with the clones; any other memory is a copy-on-write view
+ * of the memory at the fork, so stores do not reach `instance`, except that
+ * with `write_back` set the range of each shard which returned is copied back
+ * once it is done. The ranges are then to be disjoint. `instance` is of a
+ * compiled module, and runs nothing meanwhile. Not to be called by a worker.
+ * Returns -1 if a shard did not return, or could not be started.
+ */
+int wasmbox_executor_fork_join(wasmbox_executor_t *executor,
+                               wasmbox_instance_t *instance,
+                               const wasmbox_export_t *function,
+                               wasmbox_shard_t *shards, wasm_u32_t shard_size,
+                               int write_back);
+#endif
+
+#ifdef WASMBOX_VM_USE_WARM_POOL
+/**
+ * Instances of a compiled module initialized ahead of use by a thread of
+ * their own, so handing one out costs no instantiation.
+ */
+typedef struct wasmbox_warm_pool_t wasmbox_warm_pool_t;
+
+typedef struct wasmbox_warm_pool_stats_t {
+  /* Instances handed out ready, and initialized by the taker since none
+   * was. */
+  wasm_u64_t hits;
+  wasm_u64_t misses;
+  /* Released instances which were reset and handed out again. */
+  wasm_u64_t reuses;
+  /* Instances ready now. */
+  wasm_u32_t ready;
+} wasmbox_warm_pool_stats_t;
+
+/**
+ * Starts a thread which keeps `size` instances of `compiled` ready. Each is
+ * initialized with the options which wasmbox_instance_init takes from
+ * `options`, or with none if it is NULL. Returns NULL if the thread could not
+ * be started.
+ */
+wasmbox_warm_pool_t *
+wasmbox_warm_pool_create(wasmbox_compiled_module_t *compiled, wasm_u32_t size,
+                         const wasmbox_instance_t *options);
+
+/**
+ * Hands out a ready instance and has the thread initialize another one. If
+ * none is ready, the instance is initialized by the caller. Returns NULL if
+ * that fails.
+ */
+wasmbox_instance_t *wasmbox_warm_pool_take(wasmbox_warm_pool_t *pool);
+
+/**
+ * Gives back an instance taken from `pool`. The thread disposes it, or
+ * resets it and keeps it ready if it is resettable and the pool is short of
+ * instances.
+ */
+void wasmbox_warm_pool_release(wasmbox_warm_pool_t *pool,
+                               wasmbox_instance_t *instance);
+
+void wasmbox_warm_pool_stats(wasmbox_warm_pool_t *pool,
+                             wasmbox_warm_pool_stats_t *stats);
+
+/* Every instance taken must have been released. */
+void wasmbox_warm_pool_dispose(wasmbox_warm_pool_t *pool);
+#endif
+
+#ifdef WASMBOX_VM_USE_ASYNC_COMPILE
+/**
+ * Threads which load and compile module binaries in the background, so a
+ * thread serving calls never waits for a new module to compile.
+ */
+typedef struct wasmbox_compiler_t wasmbox_compiler_t;
+
+/**
+ * Receives the module compiled as by wasmbox_compiled_module_create, which
+ * the callback owns, or NULL if the binary could not be loaded. It runs on a
+ * thread of the compiler.
+ */
+typedef void (*wasmbox_compile_callback_t)(void *data,
+                                           wasmbox_compiled_module_t *compiled);
+
+/**
+ * Starts `threads` threads, or one per CPU if it is 0. Returns NULL if they
+ * could not be started.
+ */
+wasmbox_compiler_t *wasmbox_compiler_create(wasm_u32_t threads);
+
+/**
+ * Queues `bytes` to be loaded into a module which is zeroed except for the
+ * options of wasmbox_load_module copied from `options`, or none if it is
+ * NULL, and compiled. A `code_cache_dir` is read or filled on the way. The
+ * bytes must stay alive until `callback` runs, or as long as the module if
+ * `borrow_source` is set. Returns -1 if the compiler is being disposed.
+ */
+int wasmbox_compile_async(wasmbox_compiler_t *compiler, const wasm_u8_t *bytes,
+                          wasm_u64_t len, const wasmbox_module_t *options,
+                          wasmbox_compile_callback_t callback, void *data);
+
+/* Compiles the queued binaries and runs their callbacks, then stops. */
+void wasmbox_compiler_dispose(wasmbox_compiler_t *compiler);
+#endif
+
 #ifdef __cplusplus
 }
 #endif
@@ -17,47 +17,470 @@
 #include "wasmbox/wasmbox.h"
 #include "allocator.h"
 
-static wasm_s64_t allocated;
-static wasm_s64_t freed;
-
-void *wasmbox_malloc(wasm_u32_t size) {
-  wasm_s32_t *mem = (wasm_s32_t *) malloc(size + sizeof(wasm_s32_t));
-  bzero(&mem[1], size);
-  mem[0] = (wasm_s32_t) size;
-#ifdef WASMBOX_ALLOCATOR_DEBUG_TRACE
-  fprintf(stdout, "A: %p %d\n", mem, size);
+#ifdef __unix__
+#  include <sys/mman.h>
 #endif
-  allocated += size;
+#ifdef WASMBOX_VM_USE_PARALLEL_COMPILE
+#  include <pthread.h>
+#endif
+
+// Modules are loaded, compiled and run on several threads at once. Each
+// thread counts in its own shard, which it shares only when there are more
+// threads than shards.
+#define ALLOCATOR_SHARD_COUNT (16)
+#define ALLOCATOR_COUNT(VAR, SIZE) \
+  __atomic_fetch_add(&(VAR), (SIZE), __ATOMIC_RELAXED)
+
+typedef struct wasmbox_allocator_shard_t {
+  _Alignas(64) wasmbox_allocation_stats_t stats;
+} wasmbox_allocator_shard_t;
+
+static wasmbox_allocator_shard_t shards[ALLOCATOR_SHARD_COUNT];
+static wasm_u32_t shard_count;
+static _Thread_local wasmbox_allocation_stats_t *current_stats;
+
+static wasmbox_allocation_stats_t *wasmbox_allocator_stats(void) {
+  wasmbox_allocation_stats_t *stats = current_stats;
+  if (stats == NULL) {
+    wasm_u32_t shard = __atomic_fetch_add(&shard_count, 1, __ATOMIC_RELAXED);
+    stats = current_stats = &shards[shard % ALLOCATOR_SHARD_COUNT].stats;
+  }
+  return stats;
+}
+
+// Call sites are kept in an open addressing table which is never cleared, so
+// that blocks can refer to their site by index.
+#define ALLOCATION_SITE_COUNT (512)
+
+static wasmbox_allocation_site_t sites[ALLOCATION_SITE_COUNT];
+static int site_tracking;
+
+/* Returns the index of the site of `caller` plus one, or 0 if the table is
+ * full. */
+static wasm_u32_t wasmbox_allocation_site_of(const void *caller) {
+  wasm_u32_t hash = (wasm_u32_t) (((uintptr_t) caller >> 2) * 0x9e3779b1u);
+  for (wasm_u32_t i = 0; i < ALLOCATION_SITE_COUNT; i++) {
+    wasm_u32_t index = (hash + i) % ALLOCATION_SITE_COUNT;
+    const void *site = __atomic_load_n(&sites[index].caller, __ATOMIC_ACQUIRE);
+    if (site == NULL) {
+      __atomic_compare_exchange_n(&sites[index].caller, &site, caller, 0,
+                                  __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+    }
+    if (site == NULL || site == caller) {
+      return index + 1;
+    }
+  }
+  return 0;
+}
+
+static void wasmbox_allocation_site_count(wasm_u32_t site, wasm_s64_t count,
+                                          wasm_s64_t bytes) {
+  wasmbox_allocation_site_t *s = &sites[site - 1];
+  ALLOCATOR_COUNT(s->count, count);
+  if (bytes > 0) {
+    ALLOCATOR_COUNT(s->bytes, bytes);
+  }
+  wasm_u64_t live = __atomic_add_fetch(&s->live, bytes, __ATOMIC_RELAXED);
+  wasm_u64_t peak = __atomic_load_n(&s->peak, __ATOMIC_RELAXED);
+  while (live > peak &&
+         !__atomic_compare_exchange_n(&s->peak, &peak, live, 1,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+  }
+}
+
+/* Header of a block, followed by `size` bytes. It keeps the payload as
+ * aligned as the block itself for the 16-byte loads of codes and values. */
+typedef struct wasmbox_allocation_t {
+  /* Where the block came from, or NULL for libc. */
+  _Alignas(16) const wasmbox_allocator_t *allocator;
+  wasm_u32_t size;
+  /* Index of the call site plus one, or 0 if it is not tracked. */
+  wasm_u32_t site;
+} wasmbox_allocation_t;
+
+static _Thread_local const wasmbox_allocator_t *current_allocator;
+
+const wasmbox_allocator_t *
+wasmbox_allocator_enter(const wasmbox_allocator_t *allocator) {
+  const wasmbox_allocator_t *previous = current_allocator;
+  current_allocator = allocator;
+  return previous;
+}
+
+void wasmbox_allocator_leave(const wasmbox_allocator_t *previous) {
+  current_allocator = previous;
+}
+
+static void *wasmbox_allocate(wasm_u32_t size, int zero, const void *caller) {
+  const wasmbox_allocator_t *allocator = current_allocator;
+  size_t total = sizeof(wasmbox_allocation_t) + size;
+  wasmbox_allocation_t *mem;
+  if (allocator != NULL) {
+    mem = (wasmbox_allocation_t *) allocator->malloc(allocator->ctx, total);
+    if (zero) {
+      bzero(&mem[1], size);
+    }
+  } else if (zero) {
+    // Large blocks are fresh pages which calloc does not clear again.
+    mem = (wasmbox_allocation_t *) calloc(1, total);
+  } else {
+    mem = (wasmbox_allocation_t *) malloc(total);
+  }
+  mem->allocator = allocator;
+  mem->size = size;
+  mem->site = 0;
+  wasmbox_allocation_stats_t *stats = wasmbox_allocator_stats();
+  ALLOCATOR_COUNT(stats->allocations, 1);
+  ALLOCATOR_COUNT(stats->allocated, size);
+  if (__atomic_load_n(&site_tracking, __ATOMIC_RELAXED)) {
+    mem->site = wasmbox_allocation_site_of(caller);
+    if (mem->site != 0) {
+      wasmbox_allocation_site_count(mem->site, 1, size);
+    }
+  }
   return &mem[1];
 }
 
+void *wasmbox_malloc(wasm_u32_t size) {
+  return wasmbox_allocate(size, 1, __builtin_return_address(0));
+}
+
+void *wasmbox_malloc_uninit(wasm_u32_t size) {
+  return wasmbox_allocate(size, 0, __builtin_return_address(0));
+}
+
 void *wasmbox_realloc(void *ptr, wasm_u32_t size) {
-  wasm_s32_t *mem = &((wasm_s32_t *) ptr)[-1];
-  wasm_s32_t old = mem[0];
-  mem = (wasm_s32_t *) realloc(mem, size + sizeof(wasm_s32_t));
-  mem[0] = (wasm_s32_t) size;
-#ifdef WASMBOX_ALLOCATOR_DEBUG_TRACE
-  fprintf(stdout, "R: %p -> %p %d -> %d\n", &((wasm_s32_t *) ptr)[-1], mem, old,
-          size);
-#endif
-  allocated += size - old;
+  wasmbox_allocation_t *mem = &((wasmbox_allocation_t *) ptr)[-1];
+  const wasmbox_allocator_t *allocator = mem->allocator;
+  wasm_u32_t old = mem->size;
+  size_t total = sizeof(wasmbox_allocation_t) + size;
+  mem = (wasmbox_allocation_t *) (allocator != NULL
+                                      ? allocator->realloc(allocator->ctx, mem,
+                                                           total)
+                                      : realloc(mem, total));
+  mem->size = size;
+  wasmbox_allocation_stats_t *stats = wasmbox_allocator_stats();
+  if (size > old) {
+    ALLOCATOR_COUNT(stats->allocated, size - old);
+  } else {
+    ALLOCATOR_COUNT(stats->freed, old - size);
+  }
+  if (mem->site != 0) {
+    wasmbox_allocation_site_count(mem->site, 0, (wasm_s64_t) size - old);
+  }
   return &mem[1];
 }
 
 void wasmbox_free(void *ptr) {
-  wasm_s32_t *mem = &((wasm_s32_t *) ptr)[-1];
-  freed += mem[0];
-#ifdef WASMBOX_ALLOCATOR_DEBUG_TRACE
-  fprintf(stdout, "F: %p %d\n", mem, mem[0]);
+  wasmbox_allocation_t *mem = &((wasmbox_allocation_t *) ptr)[-1];
+  const wasmbox_allocator_t *allocator = mem->allocator;
+  wasmbox_allocation_stats_t *stats = wasmbox_allocator_stats();
+  ALLOCATOR_COUNT(stats->frees, 1);
+  ALLOCATOR_COUNT(stats->freed, mem->size);
+  if (mem->site != 0) {
+    wasmbox_allocation_site_count(mem->site, 0, -(wasm_s64_t) mem->size);
+  }
+  if (allocator != NULL) {
+    allocator->free(allocator->ctx, mem,
+                    sizeof(wasmbox_allocation_t) + mem->size);
+  } else {
+    free(mem);
+  }
+}
+
+void wasmbox_allocation_stats(wasmbox_allocation_stats_t *stats) {
+  *stats = (wasmbox_allocation_stats_t){};
+  for (int i = 0; i < ALLOCATOR_SHARD_COUNT; i++) {
+    wasmbox_allocation_stats_t *shard = &shards[i].stats;
+    stats->allocations += __atomic_load_n(&shard->allocations, __ATOMIC_RELAXED);
+    stats->frees += __atomic_load_n(&shard->frees, __ATOMIC_RELAXED);
+    stats->allocated += __atomic_load_n(&shard->allocated, __ATOMIC_RELAXED);
+    stats->freed += __atomic_load_n(&shard->freed, __ATOMIC_RELAXED);
+  }
+}
+
+void wasmbox_allocation_sites_enable(int enable) {
+  __atomic_store_n(&site_tracking, enable, __ATOMIC_RELAXED);
+}
+
+wasm_u32_t wasmbox_allocation_sites(wasmbox_allocation_site_t *out,
+                                    wasm_u32_t count) {
+  wasm_u32_t found = 0;
+  for (int i = 0; i < ALLOCATION_SITE_COUNT; i++) {
+    wasmbox_allocation_site_t *s = &sites[i];
+    const void *caller = __atomic_load_n(&s->caller, __ATOMIC_ACQUIRE);
+    if (caller == NULL) {
+      continue;
+    }
+    if (found < count) {
+      out[found].caller = caller;
+      out[found].count = __atomic_load_n(&s->count, __ATOMIC_RELAXED);
+      out[found].bytes = __atomic_load_n(&s->bytes, __ATOMIC_RELAXED);
+      out[found].live = __atomic_load_n(&s->live, __ATOMIC_RELAXED);
+      out[found].peak = __atomic_load_n(&s->peak, __ATOMIC_RELAXED);
+    }
+    found++;
+  }
+  return found;
+}
+
+#define ARENA_CHUNK_SIZE (16 * 1024)
+#define ARENA_ALIGN(SIZE) (((SIZE) + 7) & ~(wasm_u64_t) 7)
+
+struct wasmbox_arena_chunk_t {
+  wasmbox_arena_chunk_t *prev;
+  wasm_u32_t capacity;
+  wasm_u32_t used;
+  /* Offset of the last allocation, which can grow in place. */
+  wasm_u32_t last;
+  _Alignas(8) char data[];
+};
+
+void *wasmbox_arena_alloc(wasmbox_arena_t *arena, wasm_u32_t size) {
+  size = ARENA_ALIGN(size);
+  wasmbox_arena_chunk_t *chunk = arena->chunk;
+  if (chunk == NULL || chunk->used + size > chunk->capacity) {
+    wasm_u32_t capacity = ARENA_CHUNK_SIZE;
+    if (chunk != NULL && chunk->capacity > capacity) {
+      capacity = chunk->capacity;
+    }
+    while (capacity < size) {
+      capacity *= 2;
+    }
+    chunk = (wasmbox_arena_chunk_t *) wasmbox_malloc_uninit(sizeof(*chunk) +
+                                                            capacity);
+    chunk->prev = arena->chunk;
+    chunk->capacity = capacity;
+    chunk->used = 0;
+    arena->chunk = chunk;
+  }
+  chunk->last = chunk->used;
+  chunk->used += size;
+  return chunk->data + chunk->last;
+}
+
+void *wasmbox_arena_realloc(wasmbox_arena_t *arena, void *ptr,
+                            wasm_u32_t old_size, wasm_u32_t size) {
+  wasmbox_arena_chunk_t *chunk = arena->chunk;
+  if (chunk != NULL && (char *) ptr == chunk->data + chunk->last &&
+      chunk->last + ARENA_ALIGN(size) <= chunk->capacity) {
+    chunk->used = chunk->last + ARENA_ALIGN(size);
+    return ptr;
+  }
+  void *mem = wasmbox_arena_alloc(arena, size);
+  memcpy(mem, ptr, old_size < size ? old_size : size);
+  return mem;
+}
+
+void wasmbox_arena_reset(wasmbox_arena_t *arena) {
+  wasmbox_arena_chunk_t *chunk = arena->chunk;
+  if (chunk == NULL) {
+    return;
+  }
+  // Keep the latest chunk, which is the largest one.
+  while (chunk->prev != NULL) {
+    wasmbox_arena_chunk_t *prev = chunk->prev;
+    chunk->prev = prev->prev;
+    wasmbox_free(prev);
+  }
+  chunk->used = chunk->last = 0;
+}
+
+void wasmbox_arena_dispose(wasmbox_arena_t *arena) {
+  while (arena->chunk != NULL) {
+    wasmbox_arena_chunk_t *chunk = arena->chunk;
+    arena->chunk = chunk->prev;
+    wasmbox_free(chunk);
+  }
+}
+
+struct wasmbox_slab_t {
+  wasmbox_arena_t arena;
+#ifdef WASMBOX_VM_USE_PARALLEL_COMPILE
+  // Tables of br_table are allocated on the compile threads.
+  pthread_mutex_t lock;
+#endif
+};
+
+wasmbox_slab_t *wasmbox_slab_create(void) {
+  wasmbox_slab_t *slab = (wasmbox_slab_t *) wasmbox_malloc(sizeof(*slab));
+#ifdef WASMBOX_VM_USE_PARALLEL_COMPILE
+  pthread_mutex_init(&slab->lock, NULL);
 #endif
-  free(mem);
+  return slab;
+}
+
+void *wasmbox_slab_alloc(wasmbox_slab_t *slab, wasm_u32_t size) {
+#ifdef WASMBOX_VM_USE_PARALLEL_COMPILE
+  pthread_mutex_lock(&slab->lock);
+#endif
+  void *mem = wasmbox_arena_alloc(&slab->arena, size);
+#ifdef WASMBOX_VM_USE_PARALLEL_COMPILE
+  pthread_mutex_unlock(&slab->lock);
+#endif
+  bzero(mem, size);
+  return mem;
+}
+
+void wasmbox_slab_dispose(wasmbox_slab_t *slab) {
+  wasmbox_arena_dispose(&slab->arena);
+#ifdef WASMBOX_VM_USE_PARALLEL_COMPILE
+  pthread_mutex_destroy(&slab->lock);
+#endif
+  wasmbox_free(slab);
+}
+
+#ifdef __unix__
+#  define CODE_REGION_HUGE_PAGE_SIZE ((wasm_u64_t) 2 * 1024 * 1024)
+#  define CODE_REGION_ALIGN(SIZE)    (((SIZE) + 63) & ~(wasm_u64_t) 63)
+
+typedef struct wasmbox_code_chunk_t {
+  struct wasmbox_code_chunk_t *prev;
+  char *base;
+  wasm_u64_t size;
+  wasm_u64_t used;
+} wasmbox_code_chunk_t;
+
+struct wasmbox_code_region_t {
+  wasmbox_code_chunk_t *chunk;
+  wasm_u32_t huge_pages;
+#  ifdef WASMBOX_VM_USE_PARALLEL_COMPILE
+  // Functions are frozen on the compile threads.
+  pthread_mutex_t lock;
+#  endif
+};
+
+static char *wasmbox_code_region_map(wasm_u64_t size, wasm_u32_t *huge_pages) {
+#  ifdef MAP_HUGETLB
+  void *mem = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+  if (mem != MAP_FAILED) {
+    *huge_pages |= WASMBOX_HUGE_PAGES_CODE_HUGETLB;
+    return (char *) mem;
+  }
+#  endif
+  // Transparent huge pages back only aligned ranges. Map one huge page more
+  // than needed and trim both ends.
+  wasm_u64_t align = CODE_REGION_HUGE_PAGE_SIZE;
+  void *raw = mmap(NULL, size + align, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (raw == MAP_FAILED) {
+    return NULL;
+  }
+  char *base =
+      (char *) (((uintptr_t) raw + align - 1) & ~(uintptr_t) (align - 1));
+  wasm_u64_t head = base - (char *) raw;
+  if (head > 0) {
+    munmap(raw, head);
+  }
+  if (align - head > 0) {
+    munmap(base + size, align - head);
+  }
+#  ifdef MADV_HUGEPAGE
+  if (madvise(base, size, MADV_HUGEPAGE) == 0) {
+    *huge_pages |= WASMBOX_HUGE_PAGES_CODE;
+  }
+#  endif
+  return base;
+}
+
+wasmbox_code_region_t *wasmbox_code_region_create(void) {
+  wasmbox_code_region_t *region =
+      (wasmbox_code_region_t *) wasmbox_malloc(sizeof(*region));
+#  ifdef WASMBOX_VM_USE_PARALLEL_COMPILE
+  pthread_mutex_init(&region->lock, NULL);
+#  endif
+  return region;
 }
 
-void wasmbox_allocator_report_statics() {
-  fprintf(stdout, "allocated: %lld byte (%lld KB)\n", allocated, allocated / 1024);
-  fprintf(stdout, "freed:     %lld byte (%lld KB)\n", freed, freed / 1024);
-  if (allocated != freed) {
-    fprintf(stdout, "allocated != freed");
-    exit(-1);
+void *wasmbox_code_region_alloc(wasmbox_code_region_t *region,
+                                wasm_u64_t size) {
+  void *mem = NULL;
+  size = CODE_REGION_ALIGN(size);
+#  ifdef WASMBOX_VM_USE_PARALLEL_COMPILE
+  pthread_mutex_lock(&region->lock);
+#  endif
+  wasmbox_code_chunk_t *chunk = region->chunk;
+  if (chunk == NULL || chunk->used + size > chunk->size) {
+    wasm_u64_t capacity = (size + CODE_REGION_HUGE_PAGE_SIZE - 1) &
+                          ~(CODE_REGION_HUGE_PAGE_SIZE - 1);
+    char *base = wasmbox_code_region_map(capacity, &region->huge_pages);
+    chunk = NULL;
+    if (base != NULL) {
+      chunk = (wasmbox_code_chunk_t *) wasmbox_malloc(sizeof(*chunk));
+      chunk->prev = region->chunk;
+      chunk->base = base;
+      chunk->size = capacity;
+      region->chunk = chunk;
+    }
   }
+  if (chunk != NULL) {
+    mem = chunk->base + chunk->used;
+    chunk->used += size;
+  }
+#  ifdef WASMBOX_VM_USE_PARALLEL_COMPILE
+  pthread_mutex_unlock(&region->lock);
+#  endif
+  return mem;
+}
+
+int wasmbox_code_region_contains(wasmbox_code_region_t *region,
+                                 const void *ptr) {
+  for (wasmbox_code_chunk_t *chunk = region->chunk; chunk != NULL;
+       chunk = chunk->prev) {
+    if ((const char *) ptr >= chunk->base &&
+        (const char *) ptr < chunk->base + chunk->size) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+wasm_u32_t wasmbox_code_region_huge_pages(wasmbox_code_region_t *region) {
+  return region->huge_pages;
+}
+
+void wasmbox_code_region_dispose(wasmbox_code_region_t *region) {
+  while (region->chunk != NULL) {
+    wasmbox_code_chunk_t *chunk = region->chunk;
+    region->chunk = chunk->prev;
+    munmap(chunk->base, chunk->size);
+    wasmbox_free(chunk);
+  }
+#  ifdef WASMBOX_VM_USE_PARALLEL_COMPILE
+  pthread_mutex_destroy(&region->lock);
+#  endif
+  wasmbox_free(region);
+}
+
+void *wasmbox_code_arena_map(wasm_u64_t size) {
+  void *mem = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  return mem != MAP_FAILED ? mem : NULL;
+}
+
+void wasmbox_code_arena_seal(void *arena, wasm_u64_t size) {
+  mprotect(arena, size, PROT_READ);
+}
+
+void wasmbox_code_arena_unmap(void *arena, wasm_u64_t size) {
+  munmap(arena, size);
+}
+#else
+wasmbox_code_region_t *wasmbox_code_region_create(void) { return NULL; }
+void *wasmbox_code_region_alloc(wasmbox_code_region_t *region,
+                                wasm_u64_t size) {
+  return NULL;
+}
+int wasmbox_code_region_contains(wasmbox_code_region_t *region,
+                                 const void *ptr) {
+  return 0;
+}
+wasm_u32_t wasmbox_code_region_huge_pages(wasmbox_code_region_t *region) {
+  return 0;
 }
+void wasmbox_code_region_dispose(wasmbox_code_region_t *region) {}
+void *wasmbox_code_arena_map(wasm_u64_t size) { return NULL; }
+void wasmbox_code_arena_seal(void *arena, wasm_u64_t size) {}
+void wasmbox_code_arena_unmap(void *arena, wasm_u64_t size) {}
+#endif /* __unix__ */
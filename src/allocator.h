@@ -27,10 +27,80 @@
 extern "C" {
 #  endif
 
+/**
+ * Heap memory of the current allocator of the thread, aligned to 16 bytes.
+ * wasmbox_realloc and wasmbox_free return a block to the allocator it came
+ * from, whichever is current. wasmbox_malloc returns zeroed memory, and
+ * wasmbox_realloc leaves the grown part uninitialized.
+ */
 void *wasmbox_malloc(wasm_u32_t size);
+/* For blocks which are written in full right away. */
+void *wasmbox_malloc_uninit(wasm_u32_t size);
 void *wasmbox_realloc(void *ptr, wasm_u32_t size);
 void wasmbox_free(void *ptr);
-void wasmbox_allocator_report_statics();
+
+/**
+ * Makes `allocator` (libc if NULL) the current allocator of the thread and
+ * returns the previous one, to be passed to wasmbox_allocator_leave. Every
+ * entry point which allocates for a module enters `mod->allocator`.
+ */
+const wasmbox_allocator_t *
+wasmbox_allocator_enter(const wasmbox_allocator_t *allocator);
+void wasmbox_allocator_leave(const wasmbox_allocator_t *previous);
+
+typedef struct wasmbox_arena_chunk_t wasmbox_arena_chunk_t;
+
+/**
+ * Bump allocator for data which lives only while a function is compiled.
+ * Allocations are not freed one by one. wasmbox_arena_reset releases all of
+ * them at once and keeps the memory for the next function.
+ */
+typedef struct wasmbox_arena_t {
+  wasmbox_arena_chunk_t *chunk;
+} wasmbox_arena_t;
+
+/* Returns uninitialized memory, aligned to 8 bytes. */
+void *wasmbox_arena_alloc(wasmbox_arena_t *arena, wasm_u32_t size);
+/* Grows `ptr` in place if it is the last allocation, or copies it. */
+void *wasmbox_arena_realloc(wasmbox_arena_t *arena, void *ptr,
+                            wasm_u32_t old_size, wasm_u32_t size);
+void wasmbox_arena_reset(wasmbox_arena_t *arena);
+void wasmbox_arena_dispose(wasmbox_arena_t *arena);
+
+/**
+ * Bump allocator for the metadata of a module, which is allocated while the
+ * module is loaded or its functions are compiled and lives as long as the
+ * module. Small objects are packed together instead of getting a block and a
+ * header each, and wasmbox_slab_dispose releases all of them at once.
+ */
+wasmbox_slab_t *wasmbox_slab_create(void);
+/* Returns zeroed memory, aligned to 8 bytes. */
+void *wasmbox_slab_alloc(wasmbox_slab_t *slab, wasm_u32_t size);
+void wasmbox_slab_dispose(wasmbox_slab_t *slab);
+
+/**
+ * Bump allocator for the frozen code of the functions of a module, released
+ * only as a whole. Chunks are mapped with MAP_HUGETLB if the host has huge
+ * pages reserved, or else with madvise(MADV_HUGEPAGE), so that the code of a
+ * module needs few TLB entries. Returns NULL on hosts without mmap.
+ */
+wasmbox_code_region_t *wasmbox_code_region_create(void);
+/* Returns zeroed memory aligned to 64 bytes, or NULL if mapping failed. */
+void *wasmbox_code_region_alloc(wasmbox_code_region_t *region,
+                                wasm_u64_t size);
+int wasmbox_code_region_contains(wasmbox_code_region_t *region,
+                                 const void *ptr);
+/* Returns the WASMBOX_HUGE_PAGES_CODE* flags of the chunks mapped so far. */
+wasm_u32_t wasmbox_code_region_huge_pages(wasmbox_code_region_t *region);
+void wasmbox_code_region_dispose(wasmbox_code_region_t *region);
+
+/**
+ * Pages holding the code of every function of a module in one piece. They are
+ * written once and then sealed read-only. Returns NULL on hosts without mmap.
+ */
+void *wasmbox_code_arena_map(wasm_u64_t size);
+void wasmbox_code_arena_seal(void *arena, wasm_u64_t size);
+void wasmbox_code_arena_unmap(void *arena, wasm_u64_t size);
 
 #  ifdef __cplusplus
 }
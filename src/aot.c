@@ -0,0 +1,1049 @@
+/*
+ * Copyright (C) 2021 Masahiro Ide
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "aot.h"
+
+#include "allocator.h"
+#include "interpreter.h"
+#include "memory.h"
+#include "opcodes.h"
+#include "sampling-profile.h"
+#include "trap.h"
+#include "wasmbox/wasmbox.h"
+
+#include <stdio.h>
+#include <string.h>
+
+/*
+ * Ahead-of-time translation of the frozen code of a module to C. Each
+ * instruction is expanded to a C template. Slots of the frame become locals
+ * of the C function, loaded from the frame on entry and written back for the
+ * calls which read them, so that the C compiler allocates them to registers.
+ * The slots below the frame, which hold the results, stay in memory. The
+ * translated code keeps the frame layout of the interpreter, so both can
+ * call each other.
+ */
+
+wasm_u8_t *wasmbox_aot_memory(wasmbox_module_t *mod, wasm_u64_t addr,
+                              wasm_u32_t size) {
+  // The size the translated code checked against may be out of date.
+  if (addr + size > (wasm_u64_t) wasmbox_memory_size(mod) * WASMBOX_PAGE_SIZE) {
+    wasmbox_trap("out of bounds memory access");
+  }
+  return mod->memory_block->data + addr;
+}
+
+wasm_u32_t wasmbox_aot_memory_size(wasmbox_module_t *mod) {
+  return wasmbox_memory_size(mod);
+}
+
+wasm_u32_t wasmbox_aot_memory_grow(wasmbox_module_t *mod, wasm_u32_t delta) {
+  return wasmbox_memory_grow(mod, delta);
+}
+
+void wasmbox_aot_trap(const char *message) {
+  wasmbox_trap(message);
+}
+
+// Runs `code` with its frame at `frame`, as native code if it has some.
+// Traps if the frame fits in neither the VM nor the machine stack.
+static void wasmbox_aot_run(wasmbox_module_t *mod, wasmbox_code_t *code,
+                            wasmbox_value_t *frame, wasm_u16_t frame_size) {
+  if (frame + frame_size > mod->stack_end ||
+      (void *) __builtin_frame_address(0) < mod->native_stack_limit) {
+    wasmbox_trap("call stack exhausted");
+  }
+  if (frame + frame_size > mod->stack_peak) {
+    mod->stack_peak = frame + frame_size;
+  }
+#ifdef WASMBOX_NATIVE_CODE_ENABLED
+  if (code->h.opcode == OPCODE_JIT_ENTRY) {
+    ((wasmbox_jit_entry_t) (uintptr_t) code->op0.value.u64)(mod, frame);
+    return;
+  }
+#endif
+  WASMBOX_FRAME_LINK(frame, frame, &mod->shared_code[1]);
+#ifdef WASMBOX_VM_USE_SAMPLING_PROFILE
+  // Back in native code, the caller is the one running.
+  wasmbox_sampling_state_t sampled = wasmbox_sampling_state;
+  wasmbox_eval_function(mod, code, frame);
+  wasmbox_sampling_state = sampled;
+#else
+  wasmbox_eval_function(mod, code, frame);
+#endif
+}
+
+void wasmbox_aot_call(wasmbox_module_t *mod, wasmbox_value_t *frame,
+                      wasm_u32_t index) {
+  wasmbox_function_t *func = mod->functions[index];
+  wasmbox_aot_run(mod, func->code, frame, func->frame_size);
+}
+
+void wasmbox_aot_call_indirect(wasmbox_module_t *mod, wasmbox_value_t *frame,
+                               wasm_u32_t table, wasm_u32_t type,
+                               wasm_u32_t element) {
+  wasmbox_ref_table_t *t = &mod->tables[table];
+  if (element >= t->size) {
+    wasmbox_trap("undefined element");
+  }
+  wasmbox_table_entry_t *entry = &t->entries[element];
+  if (entry->type_id != mod->types[type]->id) {
+    wasmbox_trap(entry->code == NULL ? "undefined element"
+                                     : "indirect call type mismatch");
+  }
+  wasmbox_aot_run(mod, entry->code, frame, entry->frame_size);
+}
+
+#ifdef WASMBOX_AOT_ENABLED
+/* Definitions every translated file starts with. */
+static const char aot_prelude[] =
+    "#include \"wasmbox/wasmbox.h\"\n"
+    "\n"
+    "#include <math.h>\n"
+    "#include <stdint.h>\n"
+    "#include <string.h>\n"
+    "\n"
+    "static inline wasm_u8_t *wasmbox_aot_base(wasmbox_module_t *mod) {\n"
+    "  return mod->memory_block != NULL ? mod->memory_block->data : NULL;\n"
+    "}\n"
+    "\n"
+    "static inline wasm_u8_t *wasmbox_aot_address(wasmbox_module_t *mod,\n"
+    "                                             wasm_u8_t *mem,\n"
+    "                                             wasm_u64_t mem_size,\n"
+    "                                             wasm_u64_t addr,\n"
+    "                                             wasm_u32_t size) {\n"
+    "  if (__builtin_expect(addr + size > mem_size, 0)) {\n"
+    "    return wasmbox_aot_memory(mod, addr, size);\n"
+    "  }\n"
+    "  return mem + addr;\n"
+    "}\n"
+    "\n"
+    "/* Claims `size` slots from `frame` for a direct call if both stacks have\n"
+    " * room for it. */\n"
+    "static inline int wasmbox_aot_fits(wasmbox_module_t *mod,\n"
+    "                                   wasmbox_value_t *frame,\n"
+    "                                   wasm_u32_t size) {\n"
+    "  wasmbox_value_t *end = frame + size;\n"
+    "  if (end > mod->stack_end ||\n"
+    "      (uintptr_t) __builtin_frame_address(0) <\n"
+    "          (uintptr_t) mod->native_stack_limit) {\n"
+    "    return 0;\n"
+    "  }\n"
+    "  if (end > mod->stack_peak) {\n"
+    "    mod->stack_peak = end;\n"
+    "  }\n"
+    "  return 1;\n"
+    "}\n"
+    "\n"
+    "#define WASMBOX_AOT_LOAD(TYPE, PTR) \\\n"
+    "  static inline TYPE wasmbox_aot_load_##TYPE(const wasm_u8_t *p) { \\\n"
+    "    TYPE v; \\\n"
+    "    memcpy(&v, p, sizeof(v)); \\\n"
+    "    return v; \\\n"
+    "  } \\\n"
+    "  static inline void wasmbox_aot_store_##TYPE(wasm_u8_t *p, TYPE v) { \\\n"
+    "    memcpy(p, &v, sizeof(v)); \\\n"
+    "  }\n"
+    "WASMBOX_AOT_LOAD(wasm_u8_t, p)\n"
+    "WASMBOX_AOT_LOAD(wasm_s8_t, p)\n"
+    "WASMBOX_AOT_LOAD(wasm_u16_t, p)\n"
+    "WASMBOX_AOT_LOAD(wasm_s16_t, p)\n"
+    "WASMBOX_AOT_LOAD(wasm_u32_t, p)\n"
+    "WASMBOX_AOT_LOAD(wasm_s32_t, p)\n"
+    "WASMBOX_AOT_LOAD(wasm_u64_t, p)\n"
+    "WASMBOX_AOT_LOAD(wasm_f32_t, p)\n"
+    "WASMBOX_AOT_LOAD(wasm_f64_t, p)\n"
+    "#undef WASMBOX_AOT_LOAD\n"
+    "\n"
+    "static inline wasm_u32_t wasmbox_aot_rotl32(wasm_u32_t x, wasm_u32_t y) {\n"
+    "  return (x << (y & 31)) | (x >> (-y & 31));\n"
+    "}\n"
+    "static inline wasm_u32_t wasmbox_aot_rotr32(wasm_u32_t x, wasm_u32_t y) {\n"
+    "  return (x >> (y & 31)) | (x << (-y & 31));\n"
+    "}\n"
+    "static inline wasm_u64_t wasmbox_aot_rotl64(wasm_u64_t x, wasm_u64_t y) {\n"
+    "  return (x << (y & 63)) | (x >> (-y & 63));\n"
+    "}\n"
+    "static inline wasm_u64_t wasmbox_aot_rotr64(wasm_u64_t x, wasm_u64_t y) {\n"
+    "  return (x >> (y & 63)) | (x << (-y & 63));\n"
+    "}\n"
+    "\n"
+    "#define WASMBOX_AOT_TRUNC_SAT(name, rtype, atype, fmin, fmax, imin, imax) \\\n"
+    "  static inline rtype wasmbox_aot_##name(atype v) { \\\n"
+    "    return v != v ? 0 : v <= (fmin) ? (imin) : v >= (fmax) ? (imax) \\\n"
+    "                                                          : (rtype) v; \\\n"
+    "  }\n"
+    "WASMBOX_AOT_TRUNC_SAT(trunc_sat_f32_s32, wasm_s32_t, wasm_f32_t,\n"
+    "                      -2147483648.0, 2147483648.0, INT32_MIN, INT32_MAX)\n"
+    "WASMBOX_AOT_TRUNC_SAT(trunc_sat_f32_u32, wasm_u32_t, wasm_f32_t, 0.0,\n"
+    "                      4294967296.0, 0, UINT32_MAX)\n"
+    "WASMBOX_AOT_TRUNC_SAT(trunc_sat_f64_s32, wasm_s32_t, wasm_f64_t,\n"
+    "                      -2147483648.0, 2147483648.0, INT32_MIN, INT32_MAX)\n"
+    "WASMBOX_AOT_TRUNC_SAT(trunc_sat_f64_u32, wasm_u32_t, wasm_f64_t, 0.0,\n"
+    "                      4294967296.0, 0, UINT32_MAX)\n"
+    "WASMBOX_AOT_TRUNC_SAT(trunc_sat_f32_s64, wasm_s64_t, wasm_f32_t,\n"
+    "                      -9223372036854775808.0, 9223372036854775808.0,\n"
+    "                      INT64_MIN, INT64_MAX)\n"
+    "WASMBOX_AOT_TRUNC_SAT(trunc_sat_f32_u64, wasm_u64_t, wasm_f32_t, 0.0,\n"
+    "                      18446744073709551616.0, 0, UINT64_MAX)\n"
+    "WASMBOX_AOT_TRUNC_SAT(trunc_sat_f64_s64, wasm_s64_t, wasm_f64_t,\n"
+    "                      -9223372036854775808.0, 9223372036854775808.0,\n"
+    "                      INT64_MIN, INT64_MAX)\n"
+    "WASMBOX_AOT_TRUNC_SAT(trunc_sat_f64_u64, wasm_u64_t, wasm_f64_t, 0.0,\n"
+    "                      18446744073709551616.0, 0, UINT64_MAX)\n"
+    "#undef WASMBOX_AOT_TRUNC_SAT\n";
+
+#  define DIV_ZERO(OP, TYPE) \
+    "if (" OP "." TYPE " == 0) wasmbox_aot_trap(\"integer divide by zero\");\n"
+
+/*
+ * C templates of the instructions which need nothing but their slots:
+ *   $0 $1 $2  slots of op0, op1 and op2
+ *   $3 $4     slots of op2.r.reg1 and op2.r.reg2
+ *   $i        the immediate of op2, as wasm_u64_t
+ */
+typedef struct wasmbox_aot_template_t {
+  wasm_u16_t opcode;
+  const char *text;
+} wasmbox_aot_template_t;
+
+static const wasmbox_aot_template_t aot_templates[] = {
+    {OPCODE_NOP, ""},
+    {OPCODE_UNREACHABLE, "wasmbox_aot_trap(\"unreachable\");"},
+    {OPCODE_MOVE, "$0.u64 = $1.u64;"},
+    {OPCODE_SELECT, "$0.u64 = $1.u32 ? $3.u64 : $4.u64;"},
+    {OPCODE_RETURN, "return;"},
+    {OPCODE_MEMORY_SIZE, "$0.u32 = wasmbox_aot_memory_size(mod);"},
+    {OPCODE_I32_EQZ, "$0.u32 = $1.u32 == 0;"},
+    {OPCODE_I32_EQ, "$0.s32 = $1.u32 == $2.u32;"},
+    {OPCODE_I32_NE, "$0.s32 = $1.u32 != $2.u32;"},
+    {OPCODE_I32_LT_S, "$0.s32 = $1.s32 < $2.s32;"},
+    {OPCODE_I32_LT_U, "$0.s32 = $1.u32 < $2.u32;"},
+    {OPCODE_I32_GT_S, "$0.s32 = $1.s32 > $2.s32;"},
+    {OPCODE_I32_GT_U, "$0.s32 = $1.u32 > $2.u32;"},
+    {OPCODE_I32_LE_S, "$0.s32 = $1.s32 <= $2.s32;"},
+    {OPCODE_I32_LE_U, "$0.s32 = $1.u32 <= $2.u32;"},
+    {OPCODE_I32_GE_S, "$0.s32 = $1.s32 >= $2.s32;"},
+    {OPCODE_I32_GE_U, "$0.s32 = $1.u32 >= $2.u32;"},
+    {OPCODE_I64_EQZ, "$0.u64 = $1.u64 == 0;"},
+    {OPCODE_I64_EQ, "$0.s32 = $1.u64 == $2.u64;"},
+    {OPCODE_I64_NE, "$0.s32 = $1.u64 != $2.u64;"},
+    {OPCODE_I64_LT_S, "$0.s32 = $1.s64 < $2.s64;"},
+    {OPCODE_I64_LT_U, "$0.s32 = $1.u64 < $2.u64;"},
+    {OPCODE_I64_GT_S, "$0.s32 = $1.s64 > $2.s64;"},
+    {OPCODE_I64_GT_U, "$0.s32 = $1.u64 > $2.u64;"},
+    {OPCODE_I64_LE_S, "$0.s32 = $1.s64 <= $2.s64;"},
+    {OPCODE_I64_LE_U, "$0.s32 = $1.u64 <= $2.u64;"},
+    {OPCODE_I64_GE_S, "$0.s32 = $1.s64 >= $2.s64;"},
+    {OPCODE_I64_GE_U, "$0.s32 = $1.u64 >= $2.u64;"},
+    {OPCODE_F32_EQ, "$0.s32 = $1.f32 == $2.f32;"},
+    {OPCODE_F32_NE, "$0.s32 = $1.f32 != $2.f32;"},
+    {OPCODE_F32_LT, "$0.s32 = $1.f32 < $2.f32;"},
+    {OPCODE_F32_GT, "$0.s32 = $1.f32 > $2.f32;"},
+    {OPCODE_F32_LE, "$0.s32 = $1.f32 <= $2.f32;"},
+    {OPCODE_F32_GE, "$0.s32 = $1.f32 >= $2.f32;"},
+    {OPCODE_F64_EQ, "$0.s32 = $1.f64 == $2.f64;"},
+    {OPCODE_F64_NE, "$0.s32 = $1.f64 != $2.f64;"},
+    {OPCODE_F64_LT, "$0.s32 = $1.f64 < $2.f64;"},
+    {OPCODE_F64_GT, "$0.s32 = $1.f64 > $2.f64;"},
+    {OPCODE_F64_LE, "$0.s32 = $1.f64 <= $2.f64;"},
+    {OPCODE_F64_GE, "$0.s32 = $1.f64 >= $2.f64;"},
+    {OPCODE_I32_CLZ, "$0.u32 = $1.u32 == 0 ? 32 : __builtin_clz($1.u32);"},
+    {OPCODE_I32_CTZ, "$0.u32 = $1.u32 == 0 ? 32 : __builtin_ctz($1.u32);"},
+    {OPCODE_I32_POPCNT, "$0.u32 = __builtin_popcount($1.u32);"},
+    {OPCODE_I32_ADD, "$0.u32 = $1.u32 + $2.u32;"},
+    {OPCODE_I32_SUB, "$0.u32 = $1.u32 - $2.u32;"},
+    {OPCODE_I32_MUL, "$0.u32 = $1.u32 * $2.u32;"},
+    {OPCODE_I32_DIV_S,
+     DIV_ZERO("$2", "u32") "if ($1.u32 == 0x80000000u && $2.s32 == -1) "
+                           "wasmbox_aot_trap(\"integer overflow\");\n"
+                           "$0.s32 = $1.s32 / $2.s32;"},
+    {OPCODE_I32_DIV_U, DIV_ZERO("$2", "u32") "$0.u32 = $1.u32 / $2.u32;"},
+    {OPCODE_I32_REM_S,
+     DIV_ZERO("$2", "u32") "$0.s32 = $2.s32 == -1 ? 0 : $1.s32 % $2.s32;"},
+    {OPCODE_I32_REM_U, DIV_ZERO("$2", "u32") "$0.u32 = $1.u32 % $2.u32;"},
+    {OPCODE_I32_AND, "$0.u32 = $1.u32 & $2.u32;"},
+    {OPCODE_I32_OR, "$0.u32 = $1.u32 | $2.u32;"},
+    {OPCODE_I32_XOR, "$0.u32 = $1.u32 ^ $2.u32;"},
+    {OPCODE_I32_SHL, "$0.u32 = $1.u32 << ($2.u32 & 31);"},
+    {OPCODE_I32_SHR_S, "$0.s32 = $1.s32 >> ($2.u32 & 31);"},
+    {OPCODE_I32_SHR_U, "$0.u32 = $1.u32 >> ($2.u32 & 31);"},
+    {OPCODE_I32_ROTL, "$0.u32 = wasmbox_aot_rotl32($1.u32, $2.u32);"},
+    {OPCODE_I32_ROTR, "$0.u32 = wasmbox_aot_rotr32($1.u32, $2.u32);"},
+    {OPCODE_I64_CLZ, "$0.u64 = $1.u64 == 0 ? 64 : __builtin_clzll($1.u64);"},
+    {OPCODE_I64_CTZ, "$0.u64 = $1.u64 == 0 ? 64 : __builtin_ctzll($1.u64);"},
+    {OPCODE_I64_POPCNT, "$0.u64 = __builtin_popcountll($1.u64);"},
+    {OPCODE_I64_ADD, "$0.u64 = $1.u64 + $2.u64;"},
+    {OPCODE_I64_SUB, "$0.u64 = $1.u64 - $2.u64;"},
+    {OPCODE_I64_MUL, "$0.u64 = $1.u64 * $2.u64;"},
+    {OPCODE_I64_DIV_S,
+     DIV_ZERO("$2", "u64") "if ($1.u64 == 0x8000000000000000ull && "
+                           "$2.s64 == -1) "
+                           "wasmbox_aot_trap(\"integer overflow\");\n"
+                           "$0.s64 = $1.s64 / $2.s64;"},
+    {OPCODE_I64_DIV_U, DIV_ZERO("$2", "u64") "$0.u64 = $1.u64 / $2.u64;"},
+    {OPCODE_I64_REM_S,
+     DIV_ZERO("$2", "u64") "$0.s64 = $2.s64 == -1 ? 0 : $1.s64 % $2.s64;"},
+    {OPCODE_I64_REM_U, DIV_ZERO("$2", "u64") "$0.u64 = $1.u64 % $2.u64;"},
+    {OPCODE_I64_AND, "$0.u64 = $1.u64 & $2.u64;"},
+    {OPCODE_I64_OR, "$0.u64 = $1.u64 | $2.u64;"},
+    {OPCODE_I64_XOR, "$0.u64 = $1.u64 ^ $2.u64;"},
+    {OPCODE_I64_SHL, "$0.u64 = $1.u64 << ($2.u64 & 63);"},
+    {OPCODE_I64_SHR_S, "$0.s64 = $1.s64 >> ($2.u64 & 63);"},
+    {OPCODE_I64_SHR_U, "$0.u64 = $1.u64 >> ($2.u64 & 63);"},
+    {OPCODE_I64_ROTL, "$0.u64 = wasmbox_aot_rotl64($1.u64, $2.u64);"},
+    {OPCODE_I64_ROTR, "$0.u64 = wasmbox_aot_rotr64($1.u64, $2.u64);"},
+    {OPCODE_F32_CEIL, "$0.f32 = ceilf($1.f32);"},
+    {OPCODE_F32_FLOOR, "$0.f32 = floorf($1.f32);"},
+    {OPCODE_F32_TRUNC, "$0.f32 = truncf($1.f32);"},
+    {OPCODE_F32_NEAREST, "$0.f32 = rintf($1.f32);"},
+    {OPCODE_F32_ADD, "$0.f32 = $1.f32 + $2.f32;"},
+    {OPCODE_F32_SUB, "$0.f32 = $1.f32 - $2.f32;"},
+    {OPCODE_F32_MUL, "$0.f32 = $1.f32 * $2.f32;"},
+    {OPCODE_F32_DIV, "$0.f32 = $1.f32 / $2.f32;"},
+    {OPCODE_F64_CEIL, "$0.f64 = ceil($1.f64);"},
+    {OPCODE_F64_FLOOR, "$0.f64 = floor($1.f64);"},
+    {OPCODE_F64_TRUNC, "$0.f64 = trunc($1.f64);"},
+    {OPCODE_F64_NEAREST, "$0.f64 = rint($1.f64);"},
+    {OPCODE_F64_ADD, "$0.f64 = $1.f64 + $2.f64;"},
+    {OPCODE_F64_SUB, "$0.f64 = $1.f64 - $2.f64;"},
+    {OPCODE_F64_MUL, "$0.f64 = $1.f64 * $2.f64;"},
+    {OPCODE_F64_DIV, "$0.f64 = $1.f64 / $2.f64;"},
+    {OPCODE_WRAP_I64, "$0.u32 = (wasm_u32_t) $1.u64;"},
+    {OPCODE_I64_EXTEND_I32_S, "$0.s64 = $1.s32;"},
+    {OPCODE_I64_EXTEND_I32_U, "$0.u64 = $1.u32;"},
+    {OPCODE_F32_CONVERT_I32_S, "$0.f32 = (wasm_f32_t) $1.s32;"},
+    {OPCODE_F32_CONVERT_I32_U, "$0.f32 = (wasm_f32_t) $1.u32;"},
+    {OPCODE_F32_CONVERT_I64_S, "$0.f32 = (wasm_f32_t) $1.s64;"},
+    {OPCODE_F32_CONVERT_I64_U, "$0.f32 = (wasm_f32_t) $1.u64;"},
+    {OPCODE_F32_DEMOTE_F64, "$0.f32 = (wasm_f32_t) $1.f64;"},
+    {OPCODE_F64_CONVERT_I32_S, "$0.f64 = (wasm_f64_t) $1.s32;"},
+    {OPCODE_F64_CONVERT_I32_U, "$0.f64 = (wasm_f64_t) $1.u32;"},
+    {OPCODE_F64_CONVERT_I64_S, "$0.f64 = (wasm_f64_t) $1.s64;"},
+    {OPCODE_F64_CONVERT_I64_U, "$0.f64 = (wasm_f64_t) $1.u64;"},
+    {OPCODE_F64_PROMOTE_F32, "$0.f64 = (wasm_f64_t) $1.f32;"},
+    {OPCODE_I32_REINTERPRET_F32, "$0.u32 = $1.u32;"},
+    {OPCODE_I64_REINTERPRET_F64, "$0.u64 = $1.u64;"},
+    {OPCODE_F32_REINTERPRET_I32, "$0.u32 = $1.u32;"},
+    {OPCODE_F64_REINTERPRET_I64, "$0.u64 = $1.u64;"},
+    {OPCODE_I32_EXTEND8_S, "$0.s32 = $1.s8;"},
+    {OPCODE_I32_EXTEND16_S, "$0.s32 = $1.s16;"},
+    {OPCODE_I64_EXTEND8_S, "$0.s64 = $1.s8;"},
+    {OPCODE_I64_EXTEND16_S, "$0.s64 = $1.s16;"},
+    {OPCODE_I64_EXTEND32_S, "$0.s64 = $1.s32;"},
+    {OPCODE_I32_TRUNC_SAT_F32_S, "$0.s32 = wasmbox_aot_trunc_sat_f32_s32($1.f32);"},
+    {OPCODE_I32_TRUNC_SAT_F32_U, "$0.u32 = wasmbox_aot_trunc_sat_f32_u32($1.f32);"},
+    {OPCODE_I32_TRUNC_SAT_F64_S, "$0.s32 = wasmbox_aot_trunc_sat_f64_s32($1.f64);"},
+    {OPCODE_I32_TRUNC_SAT_F64_U, "$0.u32 = wasmbox_aot_trunc_sat_f64_u32($1.f64);"},
+    {OPCODE_I64_TRUNC_SAT_F32_S, "$0.s64 = wasmbox_aot_trunc_sat_f32_s64($1.f32);"},
+    {OPCODE_I64_TRUNC_SAT_F32_U, "$0.u64 = wasmbox_aot_trunc_sat_f32_u64($1.f32);"},
+    {OPCODE_I64_TRUNC_SAT_F64_S, "$0.s64 = wasmbox_aot_trunc_sat_f64_s64($1.f64);"},
+    {OPCODE_I64_TRUNC_SAT_F64_U, "$0.u64 = wasmbox_aot_trunc_sat_f64_u64($1.f64);"},
+    {OPCODE_I32_ADD_IMM, "$0.u32 = $1.u32 + (wasm_u32_t) $i;"},
+    {OPCODE_I32_SUB_IMM, "$0.u32 = $1.u32 - (wasm_u32_t) $i;"},
+    {OPCODE_I32_MUL_IMM, "$0.u32 = $1.u32 * (wasm_u32_t) $i;"},
+    {OPCODE_I32_AND_IMM, "$0.u32 = $1.u32 & (wasm_u32_t) $i;"},
+    {OPCODE_I32_OR_IMM, "$0.u32 = $1.u32 | (wasm_u32_t) $i;"},
+    {OPCODE_I32_XOR_IMM, "$0.u32 = $1.u32 ^ (wasm_u32_t) $i;"},
+    {OPCODE_I32_SHL_IMM, "$0.u32 = $1.u32 << ($i & 31);"},
+    {OPCODE_I32_SHR_S_IMM, "$0.s32 = $1.s32 >> ($i & 31);"},
+    {OPCODE_I32_SHR_U_IMM, "$0.u32 = $1.u32 >> ($i & 31);"},
+    {OPCODE_I64_ADD_IMM, "$0.u64 = $1.u64 + $i;"},
+    {OPCODE_I64_SUB_IMM, "$0.u64 = $1.u64 - $i;"},
+    {OPCODE_I64_MUL_IMM, "$0.u64 = $1.u64 * $i;"},
+    {OPCODE_I64_AND_IMM, "$0.u64 = $1.u64 & $i;"},
+    {OPCODE_I64_OR_IMM, "$0.u64 = $1.u64 | $i;"},
+    {OPCODE_I64_XOR_IMM, "$0.u64 = $1.u64 ^ $i;"},
+    {OPCODE_I64_SHL_IMM, "$0.u64 = $1.u64 << ($i & 63);"},
+    {OPCODE_I64_SHR_S_IMM, "$0.s64 = $1.s64 >> ($i & 63);"},
+    {OPCODE_I64_SHR_U_IMM, "$0.u64 = $1.u64 >> ($i & 63);"},
+    // The C compiler derives its own multiply-high sequence from the divisor.
+#  define FUNC(type, operand, inst, vmopcode) \
+    {vmopcode, "$0." #type " = $1." #type " " #operand " (wasm_" #type "_t) $i;"},
+    DIVISION_MAGIC_INST_EACH(FUNC)
+#  undef FUNC
+};
+#  undef DIV_ZERO
+
+/* Conditions of the branches, which jump to op0 if they hold. */
+static const wasmbox_aot_template_t aot_branches[] = {
+    {OPCODE_JUMP_IF, "$1.u32"},
+#  define FUNC(param, type, operand, cmp, vmopcode) \
+    {vmopcode, "$1." #type " " #operand " " AOT_RHS_##param(type)},
+#  define AOT_RHS_unary(type)  "0"
+#  define AOT_RHS_binary(type) "$2." #type
+    COMPARE_AND_BRANCH_INST_EACH(FUNC)
+#  undef AOT_RHS_unary
+#  undef AOT_RHS_binary
+#  undef FUNC
+#  define FUNC(type, operand, cmp, vmopcode) \
+    {vmopcode, "($1.u32 += (wasm_u32_t) $s, $1." #type " " #operand " $3." #type ")"},
+    LOOP_INC_INST_EACH(FUNC)
+#  undef FUNC
+};
+
+/* Loads and stores: the type in memory and the slot field. The address of an
+ * indexed access is a base plus a scaled index, and an unchecked access is
+ * within a loop whose memory guard has checked it. */
+typedef struct wasmbox_aot_access_t {
+  wasm_u16_t opcode;
+  wasm_u8_t store;
+  const char *type;
+  const char *field;
+  wasm_u8_t indexed;
+  wasm_u8_t unchecked;
+} wasmbox_aot_access_t;
+
+#  define AOT_STORE_load  0
+#  define AOT_STORE_store 1
+
+static const wasmbox_aot_access_t aot_accesses[] = {
+    {OPCODE_I32_LOAD, 0, "wasm_u32_t", "u32"},
+    {OPCODE_I64_LOAD, 0, "wasm_u64_t", "u64"},
+    {OPCODE_F32_LOAD, 0, "wasm_f32_t", "f32"},
+    {OPCODE_F64_LOAD, 0, "wasm_f64_t", "f64"},
+    {OPCODE_I32_LOAD8_S, 0, "wasm_s8_t", "s32"},
+    {OPCODE_I32_LOAD8_U, 0, "wasm_u8_t", "u32"},
+    {OPCODE_I32_LOAD16_S, 0, "wasm_s16_t", "s32"},
+    {OPCODE_I32_LOAD16_U, 0, "wasm_u16_t", "u32"},
+    {OPCODE_I64_LOAD8_S, 0, "wasm_s8_t", "s64"},
+    {OPCODE_I64_LOAD8_U, 0, "wasm_u8_t", "u64"},
+    {OPCODE_I64_LOAD16_S, 0, "wasm_s16_t", "s64"},
+    {OPCODE_I64_LOAD16_U, 0, "wasm_u16_t", "u64"},
+    {OPCODE_I64_LOAD32_S, 0, "wasm_s32_t", "s64"},
+    {OPCODE_I64_LOAD32_U, 0, "wasm_u32_t", "u64"},
+    {OPCODE_I32_STORE, 1, "wasm_u32_t", "u32"},
+    {OPCODE_I64_STORE, 1, "wasm_u64_t", "u64"},
+    {OPCODE_F32_STORE, 1, "wasm_f32_t", "f32"},
+    {OPCODE_F64_STORE, 1, "wasm_f64_t", "f64"},
+    {OPCODE_I32_STORE8, 1, "wasm_u8_t", "u8"},
+    {OPCODE_I32_STORE16, 1, "wasm_u16_t", "u16"},
+    {OPCODE_I64_STORE8, 1, "wasm_u8_t", "u8"},
+    {OPCODE_I64_STORE16, 1, "wasm_u16_t", "u16"},
+    {OPCODE_I64_STORE32, 1, "wasm_u32_t", "u32"},
+#  define FUNC(inst, mtype, field, unfused, vmopcode) \
+    {vmopcode, AOT_STORE_##inst, #mtype, #field, 1},
+    INDEXED_MEMORY_INST_EACH(FUNC)
+#  undef FUNC
+#  define FUNC(inst, mtype, field, unfused, vmopcode) \
+    {OPCODE_##unfused##_INDEXED_UNCHECKED, AOT_STORE_##inst, #mtype, #field, \
+     1, 1},
+    INDEXED_MEMORY_INST_EACH(FUNC)
+#  undef FUNC
+};
+
+#  define AOT_LENGTH(ARRAY) (sizeof(ARRAY) / sizeof((ARRAY)[0]))
+
+static const wasmbox_aot_template_t *
+aot_find(const wasmbox_aot_template_t *templates, size_t size,
+         wasm_u16_t opcode) {
+  for (size_t i = 0; i < size; i++) {
+    if (templates[i].opcode == opcode) {
+      return &templates[i];
+    }
+  }
+  return NULL;
+}
+
+static const wasmbox_aot_access_t *aot_find_access(wasm_u16_t opcode) {
+  for (size_t i = 0; i < AOT_LENGTH(aot_accesses); i++) {
+    if (aot_accesses[i].opcode == opcode) {
+      return &aot_accesses[i];
+    }
+  }
+  return NULL;
+}
+
+typedef struct wasmbox_aot_translator_t {
+  FILE *out;
+  wasmbox_module_t *mod;
+  const char *name;
+  /* Per function of the module, 1 if it is translated. */
+  wasm_u8_t *translated;
+  /* Of the function being translated: per slot of its frame, 1 if it is
+   * used, and per instruction, 1 if it is the target of a branch. */
+  wasmbox_function_t *func;
+  wasm_u8_t *slots;
+  wasm_u8_t *targets;
+  wasm_u8_t uses_memory;
+} wasmbox_aot_translator_t;
+
+/* A slot is a local of the C function if it lies in the frame. */
+static int aot_is_local(wasmbox_aot_translator_t *t, wasm_s64_t reg) {
+  return reg >= WASMBOX_FUNCTION_CALL_OFFSET && reg < t->func->frame_size;
+}
+
+static void aot_slot(wasmbox_aot_translator_t *t, wasm_s64_t reg) {
+  if (aot_is_local(t, reg)) {
+    fprintf(t->out, "r%lld", (long long) reg);
+  } else {
+    fprintf(t->out, "stack[%lld]", (long long) reg);
+  }
+}
+
+static void aot_use(wasmbox_aot_translator_t *t, wasm_s64_t reg) {
+  if (aot_is_local(t, reg)) {
+    t->slots[reg] = 1;
+  }
+}
+
+static wasm_u32_t aot_code_index(wasmbox_aot_translator_t *t,
+                                 wasmbox_code_t *target) {
+  return (wasm_u32_t) (target - t->func->code);
+}
+
+static wasm_s64_t aot_function_index(wasmbox_module_t *mod,
+                                     wasmbox_function_t *func) {
+  for (wasm_u32_t i = 0; i < mod->function_size; i++) {
+    if (mod->functions[i] == func) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+static wasm_s64_t aot_type_index(wasmbox_module_t *mod, wasm_u32_t type_id) {
+  for (wasm_u32_t i = 0; i < mod->type_size; i++) {
+    if (mod->types[i]->id == type_id) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+// Writes `text` with the slots of `code` in place of its placeholders, or
+// only marks the slots it uses if `t->out` is NULL.
+static void aot_expand(wasmbox_aot_translator_t *t, wasmbox_code_t *code,
+                       const char *text) {
+  for (const char *p = text; *p != '\0'; p++) {
+    if (*p != '$') {
+      if (t->out != NULL) {
+        fputc(*p, t->out);
+      }
+      continue;
+    }
+    p++;
+    wasm_s64_t reg = 0;
+    switch (*p) {
+      case '0':
+        reg = code->op0.reg;
+        break;
+      case '1':
+        reg = code->op1.reg;
+        break;
+      case '2':
+        reg = code->op2.reg;
+        break;
+      case '3':
+        reg = code->op2.r.reg1;
+        break;
+      case '4':
+        reg = code->op2.r.reg2;
+        break;
+      case '5':
+        reg = code->op1.r.reg2;
+        break;
+      case 'i':
+        if (t->out != NULL) {
+          fprintf(t->out, "((wasm_u64_t) 0x%llxull)",
+                  (unsigned long long) WASMBOX_CODE_VALUE(code, op2).u64);
+        }
+        continue;
+      case 's':
+        if (t->out != NULL) {
+          fprintf(t->out, "%d", (int) code->op2.r.reg2);
+        }
+        continue;
+    }
+    if (t->out != NULL) {
+      aot_slot(t, reg);
+    } else {
+      aot_use(t, reg);
+    }
+  }
+}
+
+/* Frame of the callee of a call, relative to the frame of the caller. */
+static wasm_s64_t aot_callee_frame(wasmbox_code_t *code) {
+  if (code->h.opcode == OPCODE_STATIC_CALL) {
+    return (wasm_s64_t) code->op0.reg + code->op2.index;
+  }
+  return (wasm_s64_t) code->op0.reg +
+         WASMBOX_CODE_CACHE(code, op1)->type->return_size;
+}
+
+static wasmbox_type_t *aot_callee_type(wasmbox_module_t *mod,
+                                       wasmbox_code_t *code) {
+  if (code->h.opcode == OPCODE_STATIC_CALL) {
+    return WASMBOX_CODE_FUNC(mod, code, op1)->type;
+  }
+  return WASMBOX_CODE_CACHE(code, op1)->type;
+}
+
+// Returns 1 if every instruction of `func` has a translation, and marks the
+// slots and the branch targets it uses.
+static int aot_scan_function(wasmbox_aot_translator_t *t) {
+  wasmbox_function_t *func = t->func;
+  wasmbox_code_t *code = func->code;
+  t->uses_memory = 0;
+  // The native code indexes the memory with 32-bit addresses, and a memory64
+  // is left to the interpreter.
+  if (func->code_size == 0 || code[0].h.opcode == OPCODE_JIT_ENTRY ||
+      t->mod->memory64) {
+    return 0;
+  }
+  FILE *out = t->out;
+  t->out = NULL;
+  int supported = 1;
+  for (wasm_u32_t pc = 0; supported && pc < func->code_size;
+       pc += wasmbox_code_length(&code[pc])) {
+    wasmbox_code_t *c = &code[pc];
+    wasm_u16_t opcode = c->h.opcode;
+    const wasmbox_aot_template_t *tmpl;
+    const wasmbox_aot_access_t *access;
+    if ((tmpl = aot_find(aot_templates, AOT_LENGTH(aot_templates), opcode)) !=
+        NULL) {
+      aot_expand(t, c, tmpl->text);
+    } else if ((tmpl = aot_find(aot_branches, AOT_LENGTH(aot_branches),
+                                opcode)) != NULL) {
+      aot_expand(t, c, tmpl->text);
+      t->targets[aot_code_index(t, WASMBOX_CODE_TARGET(c, op0))] = 1;
+    } else if ((access = aot_find_access(opcode)) != NULL) {
+      aot_expand(t, c, access->indexed ? "$0$1$5" : "$0$1");
+      t->uses_memory = 1;
+    } else {
+      switch (opcode) {
+        case OPCODE_JUMP:
+          t->targets[aot_code_index(t, WASMBOX_CODE_TARGET(c, op0))] = 1;
+          break;
+        case OPCODE_JUMP_TABLE: {
+          wasmbox_jump_target_t *targets = WASMBOX_JUMP_TABLE_TARGETS(c);
+          for (wasm_u32_t k = 0; k < c->op0.index; k++) {
+            t->targets[aot_code_index(
+                t, WASMBOX_JUMP_TARGET_CODE(c, &targets[k]))] = 1;
+          }
+          t->targets[aot_code_index(t, WASMBOX_CODE_TARGET(c, op1))] = 1;
+          aot_expand(t, c, "$2");
+          break;
+        }
+        case OPCODE_LOAD_CONST_I32:
+        case OPCODE_LOAD_CONST_I64:
+        case OPCODE_LOAD_CONST_F32:
+        case OPCODE_LOAD_CONST_F64:
+        case OPCODE_GLOBAL_GET:
+        case OPCODE_STACK_POINTER_GET:
+        case OPCODE_STACK_POINTER_ADD:
+          aot_expand(t, c, "$0");
+          break;
+        case OPCODE_GLOBAL_SET:
+        case OPCODE_STACK_POINTER_SET:
+          aot_expand(t, c, "$1");
+          break;
+        case OPCODE_ZERO_LOCALS:
+          for (wasm_u32_t i = 0; i < c->op1.index; i++) {
+            aot_use(t, c->op0.reg + i);
+          }
+          break;
+        case OPCODE_MEMORY_GROW:
+          aot_expand(t, c, "$0$1");
+          t->uses_memory = 1;
+          break;
+#  define FUNC(size, shift, vmopcode) case vmopcode:
+          MEMORY_GUARD_INST_EACH(FUNC)
+#  undef FUNC
+          aot_expand(t, c, "$1$5");
+          t->targets[aot_code_index(t, WASMBOX_CODE_TARGET(c, op0))] = 1;
+          t->uses_memory = 1;
+          break;
+        case OPCODE_STATIC_CALL:
+        case OPCODE_DYNAMIC_CALL: {
+          wasmbox_type_t *type = aot_callee_type(t->mod, c);
+          wasm_s64_t frame = aot_callee_frame(c);
+          if (opcode == OPCODE_STATIC_CALL
+                  ? aot_function_index(t->mod,
+                                       WASMBOX_CODE_FUNC(t->mod, c, op1)) < 0
+                  : aot_type_index(t->mod, WASMBOX_CODE_CACHE(c, op1)
+                                               ->type_id) < 0) {
+            supported = 0;
+          }
+          for (wasm_u32_t k = 0; k < type->argument_size; k++) {
+            aot_use(t, frame + WASMBOX_FUNCTION_CALL_OFFSET + k);
+          }
+          for (wasm_u32_t k = 0; k < type->return_size; k++) {
+            aot_use(t, frame - type->return_size + k);
+          }
+          if (opcode == OPCODE_DYNAMIC_CALL) {
+            aot_expand(t, c, "$2");
+          }
+          break;
+        }
+        default:
+          supported = 0;
+          break;
+      }
+    }
+  }
+  t->out = out;
+  return supported;
+}
+
+static void aot_function_name(wasmbox_aot_translator_t *t, wasm_u32_t index) {
+  fprintf(t->out, "wasmbox_aot_%s_%u", t->name, index);
+}
+
+static void aot_reload_memory(wasmbox_aot_translator_t *t) {
+  fprintf(t->out, "  mem = wasmbox_aot_base(mod);\n"
+                  "  mem_size = (wasm_u64_t) mod->memory_block_size * "
+                  "WASMBOX_PAGE_SIZE;\n");
+}
+
+static void aot_emit_call(wasmbox_aot_translator_t *t, wasmbox_code_t *c) {
+  FILE *out = t->out;
+  wasmbox_type_t *type = aot_callee_type(t->mod, c);
+  wasm_s64_t frame = aot_callee_frame(c);
+  for (wasm_u32_t k = 0; k < type->argument_size; k++) {
+    wasm_s64_t reg = frame + WASMBOX_FUNCTION_CALL_OFFSET + k;
+    if (aot_is_local(t, reg)) {
+      fprintf(out, "  stack[%lld] = r%lld;\n", (long long) reg,
+              (long long) reg);
+    }
+  }
+  if (c->h.opcode == OPCODE_STATIC_CALL) {
+    wasmbox_function_t *callee = WASMBOX_CODE_FUNC(t->mod, c, op1);
+    wasm_u32_t index = (wasm_u32_t) aot_function_index(t->mod, callee);
+    if (t->translated[index]) {
+      // Native code calls native code directly while both stacks have room.
+      fprintf(out, "  if (wasmbox_aot_fits(mod, stack + %lld, %u)) {\n    ",
+              (long long) frame, callee->frame_size);
+      aot_function_name(t, index);
+      fprintf(out,
+              "(mod, stack + %lld);\n"
+              "  } else {\n"
+              "    wasmbox_aot_call(mod, stack + %lld, %u);\n"
+              "  }\n",
+              (long long) frame, (long long) frame, index);
+    } else {
+      fprintf(out, "  wasmbox_aot_call(mod, stack + %lld, %u);\n",
+              (long long) frame, index);
+    }
+  } else {
+    wasmbox_call_cache_t *cache = WASMBOX_CODE_CACHE(c, op1);
+    fprintf(out, "  wasmbox_aot_call_indirect(mod, stack + %lld, %u, %u, ",
+            (long long) frame, cache->tableidx,
+            (wasm_u32_t) aot_type_index(t->mod, cache->type_id));
+    aot_expand(t, c, "$2.u32);\n");
+  }
+  for (wasm_u32_t k = 0; k < type->return_size; k++) {
+    wasm_s64_t reg = frame - type->return_size + k;
+    if (aot_is_local(t, reg)) {
+      fprintf(out, "  r%lld = stack[%lld];\n", (long long) reg,
+              (long long) reg);
+    }
+  }
+  // The callee may have grown the memory.
+  if (t->uses_memory) {
+    aot_reload_memory(t);
+  }
+}
+
+static void aot_emit_access(wasmbox_aot_translator_t *t, wasmbox_code_t *c,
+                            const wasmbox_aot_access_t *access) {
+  FILE *out = t->out;
+  // The address is op1 for loads and op0 for stores, or op1.r for both if
+  // the access is indexed, whose op0 is then the value.
+  fprintf(out, "  ");
+  if (!access->store) {
+    aot_expand(t, c, "$0.");
+    fprintf(out, "%s = wasmbox_aot_load_%s(", access->field, access->type);
+  } else {
+    fprintf(out, "wasmbox_aot_store_%s(", access->type);
+  }
+  if (access->unchecked) {
+    fprintf(out, "mem + ((wasm_u64_t) ");
+  } else {
+    fprintf(out, "wasmbox_aot_address(mod, mem, mem_size, (wasm_u64_t) ");
+  }
+  if (access->indexed) {
+    aot_expand(t, c, "(wasm_u32_t) ($1.u32 + ($5.u32 << ");
+    fprintf(out, "%d))", (int) c->op0.r.reg2);
+  } else {
+    aot_expand(t, c, access->store ? "$0.u32" : "$1.u32");
+  }
+  if (access->unchecked) {
+    fprintf(out, " + %uu)", c->op2.index);
+  } else {
+    fprintf(out, " + %uu, sizeof(%s))", c->op2.index, access->type);
+  }
+  if (access->store) {
+    fprintf(out, ", (%s) ", access->type);
+    aot_expand(t, c, access->indexed ? "$0." : "$1.");
+    fprintf(out, "%s", access->field);
+  }
+  fprintf(out, ");\n");
+}
+
+static void aot_emit_code(wasmbox_aot_translator_t *t, wasmbox_code_t *c) {
+  FILE *out = t->out;
+  wasm_u16_t opcode = c->h.opcode;
+  const wasmbox_aot_template_t *tmpl;
+  const wasmbox_aot_access_t *access;
+  if ((tmpl = aot_find(aot_templates, AOT_LENGTH(aot_templates), opcode)) !=
+      NULL) {
+    if (tmpl->text[0] != '\0') {
+      fprintf(out, "  ");
+      aot_expand(t, c, tmpl->text);
+      fprintf(out, "\n");
+    }
+    return;
+  }
+  if ((tmpl = aot_find(aot_branches, AOT_LENGTH(aot_branches), opcode)) !=
+      NULL) {
+    fprintf(out, "  if (");
+    aot_expand(t, c, tmpl->text);
+    fprintf(out, ") goto L%u;\n",
+            aot_code_index(t, WASMBOX_CODE_TARGET(c, op0)));
+    return;
+  }
+  if ((access = aot_find_access(opcode)) != NULL) {
+    aot_emit_access(t, c, access);
+    return;
+  }
+  switch (opcode) {
+    case OPCODE_JUMP:
+      fprintf(out, "  goto L%u;\n",
+              aot_code_index(t, WASMBOX_CODE_TARGET(c, op0)));
+      break;
+    case OPCODE_JUMP_TABLE: {
+      wasmbox_jump_target_t *targets = WASMBOX_JUMP_TABLE_TARGETS(c);
+      fprintf(out, "  switch (");
+      aot_expand(t, c, "$2.u32");
+      fprintf(out, ") {\n");
+      for (wasm_u32_t k = 0; k < c->op0.index; k++) {
+        fprintf(out, "    case %u: goto L%u;\n", k,
+                aot_code_index(t, WASMBOX_JUMP_TARGET_CODE(c, &targets[k])));
+      }
+      fprintf(out, "    default: goto L%u;\n  }\n",
+              aot_code_index(t, WASMBOX_CODE_TARGET(c, op1)));
+      break;
+    }
+    case OPCODE_LOAD_CONST_I32:
+    case OPCODE_LOAD_CONST_F32:
+      fprintf(out, "  ");
+      aot_expand(t, c, "$0.u32");
+      fprintf(out, " = 0x%xu;\n", WASMBOX_CODE_VALUE(c, op1).u32);
+      break;
+    case OPCODE_LOAD_CONST_I64:
+    case OPCODE_LOAD_CONST_F64:
+      fprintf(out, "  ");
+      aot_expand(t, c, "$0.u64");
+      fprintf(out, " = 0x%llxull;\n",
+              (unsigned long long) WASMBOX_CODE_VALUE(c, op1).u64);
+      break;
+    case OPCODE_GLOBAL_GET:
+      fprintf(out, "  ");
+      aot_expand(t, c, "$0.u64");
+      fprintf(out, " = mod->globals[%u].u64;\n", c->op1.index);
+      break;
+    case OPCODE_GLOBAL_SET:
+      fprintf(out, "  mod->globals[%u].u64 = ", c->op0.index);
+      aot_expand(t, c, "$1.u64;\n");
+      break;
+    // Translated code keeps the stack pointer of the guest in its global.
+    case OPCODE_STACK_POINTER_GET:
+      fprintf(out, "  ");
+      aot_expand(t, c, "$0.u64");
+      fprintf(out, " = mod->globals[%u].u64;\n", c->op1.index);
+      break;
+    case OPCODE_STACK_POINTER_SET:
+      fprintf(out, "  mod->globals[%u].u64 = (wasm_u32_t) (", c->op0.index);
+      aot_expand(t, c, "$1.u32");
+      fprintf(out, " + %uu);\n", c->op2.index);
+      break;
+    case OPCODE_STACK_POINTER_ADD:
+      fprintf(out, "  ");
+      aot_expand(t, c, "$0.u64");
+      fprintf(out,
+              " = mod->globals[%u].u64 = "
+              "(wasm_u32_t) (mod->globals[%u].u32 + %uu);\n",
+              c->op1.index, c->op1.index, c->op2.index);
+      break;
+    case OPCODE_ZERO_LOCALS:
+      for (wasm_u32_t i = 0; i < c->op1.index; i++) {
+        fprintf(out, "  ");
+        aot_slot(t, c->op0.reg + i);
+        fprintf(out, ".u64 = 0;\n");
+      }
+      break;
+    case OPCODE_MEMORY_GROW:
+      fprintf(out, "  ");
+      aot_expand(t, c, "$0.u32 = wasmbox_aot_memory_grow(mod, $1.u32);\n");
+      aot_reload_memory(t);
+      break;
+#  define FUNC(size, shift, vmopcode)                             \
+    case vmopcode:                                                \
+      aot_expand(t, c,                                            \
+                 "  if (!($1.u32 < $5.u32 && "                    \
+                 "((wasm_u64_t) ($5.u32 - 1) << " #shift ") + "); \
+      fprintf(out, "%uu <= mem_size)) goto L%u;\n", c->op2.index, \
+              aot_code_index(t, WASMBOX_CODE_TARGET(c, op0)));    \
+      break;
+      MEMORY_GUARD_INST_EACH(FUNC)
+#  undef FUNC
+    case OPCODE_STATIC_CALL:
+    case OPCODE_DYNAMIC_CALL:
+      aot_emit_call(t, c);
+      break;
+  }
+}
+
+static void aot_emit_function(wasmbox_aot_translator_t *t, wasm_u32_t index) {
+  FILE *out = t->out;
+  wasmbox_function_t *func = t->func;
+  wasmbox_code_t *code = func->code;
+  fprintf(out, "\nstatic void ");
+  aot_function_name(t, index);
+  fprintf(out, "(wasmbox_module_t *mod, wasmbox_value_t *stack) {\n");
+  for (wasm_u32_t reg = 0; reg < func->frame_size; reg++) {
+    if (!t->slots[reg]) {
+      continue;
+    }
+    if (reg < WASMBOX_FUNCTION_CALL_OFFSET + func->type->argument_size) {
+      fprintf(out, "  wasmbox_value_t r%u = stack[%u];\n", reg, reg);
+    } else {
+      fprintf(out, "  wasmbox_value_t r%u = {0};\n", reg);
+    }
+  }
+  if (t->uses_memory) {
+    fprintf(out, "  wasm_u8_t *mem = wasmbox_aot_base(mod);\n"
+                 "  wasm_u64_t mem_size = (wasm_u64_t) "
+                 "mod->memory_block_size * WASMBOX_PAGE_SIZE;\n");
+  }
+  for (wasm_u32_t pc = 0; pc < func->code_size;
+       pc += wasmbox_code_length(&code[pc])) {
+    if (t->targets[pc]) {
+      fprintf(out, "L%u:;\n", pc);
+    }
+    aot_emit_code(t, &code[pc]);
+  }
+  fprintf(out, "}\n");
+}
+
+static int aot_is_identifier(const char *name) {
+  if (name[0] == '\0' || (name[0] >= '0' && name[0] <= '9')) {
+    return 0;
+  }
+  for (const char *p = name; *p != '\0'; p++) {
+    if (!(*p == '_' || (*p >= '0' && *p <= '9') || (*p >= 'a' && *p <= 'z') ||
+          (*p >= 'A' && *p <= 'Z'))) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+int wasmbox_aot_translate(wasmbox_module_t *mod, const char *name,
+                          const char *file_name) {
+  if (!aot_is_identifier(name)) {
+    return -1;
+  }
+  FILE *out = fopen(file_name, "w");
+  if (out == NULL) {
+    return -1;
+  }
+  wasmbox_aot_translator_t t = {};
+  t.out = out;
+  t.mod = mod;
+  t.name = name;
+  t.translated = (wasm_u8_t *) wasmbox_malloc(mod->function_size + 1);
+  t.slots = (wasm_u8_t *) wasmbox_malloc(UINT16_MAX + 1);
+  wasm_u32_t max_code_size = 1;
+  for (wasm_u32_t i = mod->import_function_size; i < mod->function_size; i++) {
+    if (mod->functions[i]->code_size > max_code_size) {
+      max_code_size = mod->functions[i]->code_size;
+    }
+  }
+  t.targets = (wasm_u8_t *) wasmbox_malloc(max_code_size);
+
+  // A call is direct only if its callee is translated, which is known once
+  // every function is scanned.
+  wasm_u32_t translated = 0;
+  for (wasm_u32_t i = mod->import_function_size; i < mod->function_size; i++) {
+    t.func = mod->functions[i];
+    memset(t.slots, 0, UINT16_MAX + 1);
+    memset(t.targets, 0, max_code_size);
+    t.translated[i] = aot_scan_function(&t);
+    translated += t.translated[i];
+  }
+
+  fprintf(out, "/* Translated by wasmbox_aot_translate. Do not edit. */\n%s",
+          aot_prelude);
+  for (wasm_u32_t i = 0; i < mod->function_size; i++) {
+    if (t.translated[i]) {
+      fprintf(out, "\nstatic void ");
+      aot_function_name(&t, i);
+      fprintf(out, "(wasmbox_module_t *mod, wasmbox_value_t *stack);");
+    }
+  }
+  fprintf(out, "\n");
+  for (wasm_u32_t i = 0; i < mod->function_size; i++) {
+    if (!t.translated[i]) {
+      continue;
+    }
+    t.func = mod->functions[i];
+    memset(t.slots, 0, UINT16_MAX + 1);
+    memset(t.targets, 0, max_code_size);
+    aot_scan_function(&t);
+    aot_emit_function(&t, i);
+  }
+
+  if (translated > 0) {
+    fprintf(out, "\nstatic const wasmbox_aot_function_t "
+                 "wasmbox_aot_%s_functions[] = {\n",
+            name);
+    for (wasm_u32_t i = 0; i < mod->function_size; i++) {
+      if (t.translated[i]) {
+        wasmbox_function_t *func = mod->functions[i];
+        fprintf(out, "    {%u, %u, %u, %u, ", i, func->type->argument_size,
+                func->type->return_size, func->frame_size);
+        aot_function_name(&t, i);
+        fprintf(out, "},\n");
+      }
+    }
+    fprintf(out, "};\n\nconst wasmbox_aot_module_t wasmbox_aot_%s = {\n"
+                 "    wasmbox_aot_%s_functions, %u};\n",
+            name, name, translated);
+  } else {
+    fprintf(out, "\nconst wasmbox_aot_module_t wasmbox_aot_%s = {NULL, 0};\n",
+            name);
+  }
+  wasmbox_free(t.targets);
+  wasmbox_free(t.slots);
+  wasmbox_free(t.translated);
+  int failed = ferror(out);
+  if (fclose(out) != 0 || failed) {
+    return -1;
+  }
+  return (int) translated;
+}
+#else
+int wasmbox_aot_translate(wasmbox_module_t *mod, const char *name,
+                          const char *file_name) {
+  (void) mod;
+  (void) name;
+  (void) file_name;
+  return -1;
+}
+#endif /* WASMBOX_AOT_ENABLED */
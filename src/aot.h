@@ -0,0 +1,43 @@
+/*
+ * Copyright (C) 2021 Masahiro Ide
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef WASMBOX_AOT_H
+#define WASMBOX_AOT_H
+
+#include "jit.h"
+#include "wasmbox/wasmbox.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Translated functions replace their first instruction like the JIT, whose
+ * operand holds a pointer, and need the code of every function at load. */
+#if defined(WASMBOX_VM_USE_AOT) && !defined(WASMBOX_VM_USE_COMPACT_CODE) && \
+    !defined(WASMBOX_VM_USE_LAZY_COMPILE) && !defined(WASMBOX_JIT_ENABLED)
+#  define WASMBOX_AOT_ENABLED 1
+#endif
+
+/* Some functions may run native code through OPCODE_JIT_ENTRY. */
+#if defined(WASMBOX_JIT_ENABLED) || defined(WASMBOX_AOT_ENABLED)
+#  define WASMBOX_NATIVE_CODE_ENABLED 1
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* end of include guard */
@@ -0,0 +1,163 @@
+/*
+ * Copyright (C) 2021 Masahiro Ide
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "allocator.h"
+#include "wasmbox/wasmbox.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <unistd.h> // sysconf
+
+#define LOG(MSG) fprintf(stderr, "(%s:%d)" MSG, __FILE__, __LINE__)
+
+typedef struct wasmbox_compile_job_t {
+  struct wasmbox_compile_job_t *next;
+  const wasm_u8_t *bytes;
+  wasm_u64_t len;
+  /* The options of wasmbox_load_module the module is loaded with. */
+  wasmbox_module_t options;
+  wasmbox_compile_callback_t callback;
+  void *data;
+} wasmbox_compile_job_t;
+
+struct wasmbox_compiler_t {
+  pthread_t *threads;
+  wasm_u32_t thread_size;
+  /* Guards the fields below. */
+  pthread_mutex_t lock;
+  /* Signalled when a job is queued, or on dispose. */
+  pthread_cond_t available;
+  /* Queued jobs, the oldest first. */
+  wasmbox_compile_job_t *head;
+  wasmbox_compile_job_t *tail;
+  wasm_u8_t stopping;
+};
+
+static wasmbox_compiled_module_t *
+wasmbox_compiler_compile(wasmbox_compile_job_t *job) {
+  wasmbox_module_t *mod =
+      (wasmbox_module_t *) wasmbox_malloc(sizeof(wasmbox_module_t));
+  *mod = job->options;
+  wasmbox_compiled_module_t *compiled = NULL;
+  if (wasmbox_load_module_from_buffer(mod, job->bytes, (size_t) job->len) !=
+      0) {
+    LOG("failed to load module");
+  } else if ((compiled = wasmbox_compiled_module_create(mod)) == NULL) {
+    LOG("failed to compile module");
+  }
+  // The compiled module took over `mod`, which is left empty.
+  wasmbox_module_dispose(mod);
+  wasmbox_free(mod);
+  return compiled;
+}
+
+// Runs the queued jobs one at a time until the compiler is stopping and the
+// queue is empty. Loading runs without the lock, so other threads take jobs
+// meanwhile.
+static void *wasmbox_compiler_run(void *data) {
+  wasmbox_compiler_t *compiler = (wasmbox_compiler_t *) data;
+  pthread_mutex_lock(&compiler->lock);
+  for (;;) {
+    wasmbox_compile_job_t *job = compiler->head;
+    if (job == NULL) {
+      if (compiler->stopping) {
+        break;
+      }
+      pthread_cond_wait(&compiler->available, &compiler->lock);
+      continue;
+    }
+    compiler->head = job->next;
+    if (compiler->head == NULL) {
+      compiler->tail = NULL;
+    }
+    pthread_mutex_unlock(&compiler->lock);
+    job->callback(job->data, wasmbox_compiler_compile(job));
+    wasmbox_free(job);
+    pthread_mutex_lock(&compiler->lock);
+  }
+  pthread_mutex_unlock(&compiler->lock);
+  return NULL;
+}
+
+static void wasmbox_compiler_stop(wasmbox_compiler_t *compiler) {
+  pthread_mutex_lock(&compiler->lock);
+  compiler->stopping = 1;
+  pthread_cond_broadcast(&compiler->available);
+  pthread_mutex_unlock(&compiler->lock);
+  for (wasm_u32_t i = 0; i < compiler->thread_size; i++) {
+    pthread_join(compiler->threads[i], NULL);
+  }
+  pthread_mutex_destroy(&compiler->lock);
+  pthread_cond_destroy(&compiler->available);
+  wasmbox_free(compiler->threads);
+  wasmbox_free(compiler);
+}
+
+wasmbox_compiler_t *wasmbox_compiler_create(wasm_u32_t threads) {
+  if (threads == 0) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    threads = cpus > 0 ? (wasm_u32_t) cpus : 1;
+  }
+  wasmbox_compiler_t *compiler =
+      (wasmbox_compiler_t *) wasmbox_malloc(sizeof(wasmbox_compiler_t));
+  compiler->threads =
+      (pthread_t *) wasmbox_malloc(sizeof(pthread_t) * threads);
+  pthread_mutex_init(&compiler->lock, NULL);
+  pthread_cond_init(&compiler->available, NULL);
+  for (; compiler->thread_size < threads; compiler->thread_size++) {
+    if (pthread_create(&compiler->threads[compiler->thread_size], NULL,
+                       wasmbox_compiler_run, compiler) != 0) {
+      LOG("failed to start thread");
+      wasmbox_compiler_stop(compiler);
+      return NULL;
+    }
+  }
+  return compiler;
+}
+
+int wasmbox_compile_async(wasmbox_compiler_t *compiler, const wasm_u8_t *bytes,
+                          wasm_u64_t len, const wasmbox_module_t *options,
+                          wasmbox_compile_callback_t callback, void *data) {
+  wasmbox_compile_job_t *job =
+      (wasmbox_compile_job_t *) wasmbox_malloc(sizeof(wasmbox_compile_job_t));
+  job->bytes = bytes;
+  job->len = len;
+  if (options != NULL) {
+    job->options = *options;
+  }
+  job->callback = callback;
+  job->data = data;
+  pthread_mutex_lock(&compiler->lock);
+  if (compiler->stopping) {
+    pthread_mutex_unlock(&compiler->lock);
+    wasmbox_free(job);
+    return -1;
+  }
+  if (compiler->tail != NULL) {
+    compiler->tail->next = job;
+  } else {
+    compiler->head = job;
+  }
+  compiler->tail = job;
+  pthread_cond_signal(&compiler->available);
+  pthread_mutex_unlock(&compiler->lock);
+  return 0;
+}
+
+void wasmbox_compiler_dispose(wasmbox_compiler_t *compiler) {
+  wasmbox_compiler_stop(compiler);
+}
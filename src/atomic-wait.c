@@ -0,0 +1,154 @@
+/*
+ * Copyright (C) 2021 Masahiro Ide
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "atomic-wait.h"
+#include <time.h>
+
+#ifdef __linux__
+#  include <linux/futex.h>
+#  include <sys/syscall.h>
+#  include <unistd.h>
+#else
+#  include <sched.h>
+#endif
+
+/* Waiters are kept in lists, one per group of addresses. */
+#define WASMBOX_ATOMIC_WAIT_BUCKETS (64)
+
+typedef struct wasmbox_atomic_waiter_t {
+  struct wasmbox_atomic_waiter_t *next;
+  void *addr;
+  /* Set to 1 by the notifying thread. The waiter sleeps on it. */
+  wasm_u32_t woken;
+} wasmbox_atomic_waiter_t;
+
+typedef struct wasmbox_atomic_wait_bucket_t {
+  wasmbox_atomic_waiter_t *waiters;
+  char lock;
+} wasmbox_atomic_wait_bucket_t;
+
+static wasmbox_atomic_wait_bucket_t buckets[WASMBOX_ATOMIC_WAIT_BUCKETS];
+
+static wasmbox_atomic_wait_bucket_t *wasmbox_atomic_wait_bucket(void *addr) {
+  uintptr_t key = (uintptr_t) addr >> 2;
+  return &buckets[(key ^ (key >> 6)) % WASMBOX_ATOMIC_WAIT_BUCKETS];
+}
+
+static void wasmbox_atomic_wait_lock(wasmbox_atomic_wait_bucket_t *bucket) {
+  while (__atomic_test_and_set(&bucket->lock, __ATOMIC_ACQUIRE)) {
+  }
+}
+
+static void wasmbox_atomic_wait_unlock(wasmbox_atomic_wait_bucket_t *bucket) {
+  __atomic_clear(&bucket->lock, __ATOMIC_RELEASE);
+}
+
+static wasm_s64_t wasmbox_atomic_wait_now(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (wasm_s64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+// Sleeps while `*word` is 0, at most `timeout` nanoseconds if it is not
+// negative. May return early.
+static void wasmbox_atomic_wait_sleep(wasm_u32_t *word, wasm_s64_t timeout) {
+#ifdef __linux__
+  struct timespec rel = {timeout / 1000000000, timeout % 1000000000};
+  syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, 0, timeout < 0 ? NULL : &rel,
+          NULL, 0);
+#else
+  (void) word;
+  (void) timeout;
+  sched_yield();
+#endif
+}
+
+static void wasmbox_atomic_wait_wake(wasm_u32_t *word) {
+#ifdef __linux__
+  syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+#else
+  (void) word;
+#endif
+}
+
+wasm_u32_t wasmbox_atomic_wait(void *addr, wasm_u64_t expected, int is_64,
+                               wasm_s64_t timeout) {
+  wasmbox_atomic_wait_bucket_t *bucket = wasmbox_atomic_wait_bucket(addr);
+  wasmbox_atomic_waiter_t waiter = {NULL, addr, 0};
+  // The value is compared under the lock taken by wasmbox_atomic_notify, so
+  // a notification after the store which the guest waits for is not lost.
+  wasmbox_atomic_wait_lock(bucket);
+  wasm_u64_t value =
+      is_64 ? __atomic_load_n((wasm_u64_t *) addr, __ATOMIC_SEQ_CST)
+            : __atomic_load_n((wasm_u32_t *) addr, __ATOMIC_SEQ_CST);
+  if (value != expected) {
+    wasmbox_atomic_wait_unlock(bucket);
+    return WASMBOX_ATOMIC_WAIT_NOT_EQUAL;
+  }
+  // Waiters are woken in the order they started waiting.
+  wasmbox_atomic_waiter_t **tail = &bucket->waiters;
+  while (*tail != NULL) {
+    tail = &(*tail)->next;
+  }
+  *tail = &waiter;
+  wasmbox_atomic_wait_unlock(bucket);
+
+  wasm_s64_t deadline = timeout < 0 ? 0 : wasmbox_atomic_wait_now() + timeout;
+  while (!__atomic_load_n(&waiter.woken, __ATOMIC_ACQUIRE)) {
+    wasm_s64_t remaining = -1;
+    if (timeout >= 0) {
+      remaining = deadline - wasmbox_atomic_wait_now();
+      if (remaining <= 0) {
+        break;
+      }
+    }
+    wasmbox_atomic_wait_sleep(&waiter.woken, remaining);
+  }
+
+  // Also waits for a notifying thread to be done with `waiter`.
+  wasmbox_atomic_wait_lock(bucket);
+  wasm_u32_t result = WASMBOX_ATOMIC_WAIT_OK;
+  if (!waiter.woken) {
+    wasmbox_atomic_waiter_t **link = &bucket->waiters;
+    while (*link != &waiter) {
+      link = &(*link)->next;
+    }
+    *link = waiter.next;
+    result = WASMBOX_ATOMIC_WAIT_TIMED_OUT;
+  }
+  wasmbox_atomic_wait_unlock(bucket);
+  return result;
+}
+
+wasm_u32_t wasmbox_atomic_notify(void *addr, wasm_u32_t count) {
+  wasmbox_atomic_wait_bucket_t *bucket = wasmbox_atomic_wait_bucket(addr);
+  wasm_u32_t woken = 0;
+  wasmbox_atomic_wait_lock(bucket);
+  wasmbox_atomic_waiter_t **link = &bucket->waiters;
+  while (*link != NULL && woken < count) {
+    wasmbox_atomic_waiter_t *waiter = *link;
+    if (waiter->addr != addr) {
+      link = &waiter->next;
+      continue;
+    }
+    *link = waiter->next;
+    __atomic_store_n(&waiter->woken, 1, __ATOMIC_RELEASE);
+    wasmbox_atomic_wait_wake(&waiter->woken);
+    woken++;
+  }
+  wasmbox_atomic_wait_unlock(bucket);
+  return woken;
+}
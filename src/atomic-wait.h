@@ -0,0 +1,46 @@
+/*
+ * Copyright (C) 2021 Masahiro Ide
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef WASMBOX_ATOMIC_WAIT_H
+#define WASMBOX_ATOMIC_WAIT_H
+
+#include "wasmbox/wasmbox.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Results of memory.atomic.wait. */
+#define WASMBOX_ATOMIC_WAIT_OK        (0)
+#define WASMBOX_ATOMIC_WAIT_NOT_EQUAL (1)
+#define WASMBOX_ATOMIC_WAIT_TIMED_OUT (2)
+
+/**
+ * Suspends the calling thread until wasmbox_atomic_notify is called for
+ * `addr`, if the 4 or 8 (`is_64`) bytes at `addr` equal `expected`. A negative
+ * `timeout` in nanoseconds waits forever.
+ */
+wasm_u32_t wasmbox_atomic_wait(void *addr, wasm_u64_t expected, int is_64,
+                               wasm_s64_t timeout);
+
+/* Wakes up to `count` threads waiting on `addr`, and returns how many. */
+wasm_u32_t wasmbox_atomic_notify(void *addr, wasm_u32_t count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* end of include guard */
@@ -0,0 +1,603 @@
+/*
+ * Copyright (C) 2021 Masahiro Ide
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "code-cache.h"
+#include "allocator.h"
+#include "opcodes.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+wasm_u64_t wasmbox_code_cache_hash(const wasm_u8_t *data, wasm_u32_t length) {
+  // FNV-1a
+  wasm_u64_t hash = 0xcbf29ce484222325ULL;
+  for (wasm_u32_t i = 0; i < length; i++) {
+    hash = (hash ^ data[i]) * 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+#ifdef WASMBOX_CODE_CACHE_ENABLED
+
+#define LOG(MSG) fprintf(stderr, "(%s:%d)" MSG, __FILE__, __LINE__)
+
+#define WASMBOX_CODE_CACHE_MAGIC   "WBCC"
+#define WASMBOX_CODE_CACHE_VERSION (5)
+
+#ifdef WASMBOX_VM_USE_COMPACT_CODE
+#  define WASMBOX_CODE_CACHE_COMPACT   (1)
+#  define WASMBOX_CODE_CACHE_SLOT_SIZE sizeof(wasmbox_code_constant_t)
+#else
+#  define WASMBOX_CODE_CACHE_COMPACT   (0)
+#  define WASMBOX_CODE_CACHE_SLOT_SIZE sizeof(void *)
+#endif
+
+#ifdef WASMBOX_VM_USE_ACCUMULATOR
+#  define WASMBOX_CODE_CACHE_ACCUMULATOR (1)
+#else
+#  define WASMBOX_CODE_CACHE_ACCUMULATOR (0)
+#endif
+
+/* Files written by a build with another instruction encoding are ignored. */
+#define WASMBOX_CODE_CACHE_BUILD                                           \
+  ((wasm_u32_t) sizeof(wasmbox_code_t) |                                   \
+   (wasm_u32_t) OPCODE_THREADED_CODE << 8 | WASMBOX_CODE_CACHE_COMPACT << 24 | \
+   WASMBOX_CODE_CACHE_ACCUMULATOR << 25)
+
+/* Constant pool entries of compact code which hold plain values. */
+#define WASMBOX_CODE_CACHE_VALUE (4)
+
+#define WASMBOX_CODE_CACHE_ALIGN(N, A) (((N) + (A) -1) / (A) * (A))
+
+typedef struct wasmbox_code_cache_operand_t {
+  union wasmbox_code_operands *op;
+  wasm_u32_t kind;
+} wasmbox_code_cache_operand_t;
+
+typedef struct wasmbox_code_cache_callee_t {
+  wasmbox_function_t *func;
+  wasm_u32_t index;
+} wasmbox_code_cache_callee_t;
+
+typedef struct wasmbox_code_cache_writer_t {
+  FILE *fp;
+  wasm_u64_t pos;
+  wasmbox_module_t *mod;
+  /* Functions sorted by address, to find the index of a callee. */
+  wasmbox_code_cache_callee_t *callees;
+  wasmbox_code_cache_relocation_t *relocations;
+  wasm_u32_t relocation_size;
+  wasm_u32_t relocation_capacity;
+} wasmbox_code_cache_writer_t;
+
+static int wasmbox_code_cache_path(char *path, size_t size,
+                                   wasmbox_module_t *mod, wasm_u64_t hash,
+                                   const char *suffix) {
+  int len = snprintf(path, size, "%s/%016llx.wbc%s", mod->code_cache_dir,
+                     (unsigned long long) hash, suffix);
+  return len > 0 && (size_t) len < size ? 0 : -1;
+}
+
+// Lists the operands of `code` which refer to code, functions, call caches
+// or, in compact code, to the constant pool. Returns -1 for instructions
+// which cannot be cached. The targets of a br_table are not operands.
+static int wasmbox_code_cache_operands(wasmbox_code_t *code,
+                                       wasmbox_code_cache_operand_t *operands) {
+  switch (code->h.opcode) {
+    case OPCODE_JUMP:
+    case OPCODE_JUMP_IF:
+#define FUNC(param, type, operand, cmp, vmopcode) case vmopcode:
+      COMPARE_AND_BRANCH_INST_EACH(FUNC)
+#undef FUNC
+#define FUNC(type, operand, cmp, vmopcode) case vmopcode:
+      LOOP_INC_INST_EACH(FUNC)
+#undef FUNC
+#define FUNC(size, shift, vmopcode) case vmopcode:
+      MEMORY_GUARD_INST_EACH(FUNC)
+#undef FUNC
+      operands[0].op = &code->op0;
+      operands[0].kind = WASMBOX_RELOCATION_CODE;
+      return 1;
+    case OPCODE_JUMP_TABLE:
+      operands[0].op = &code->op1;
+      operands[0].kind = WASMBOX_RELOCATION_CODE;
+      return 1;
+    case OPCODE_STATIC_CALL:
+    case OPCODE_STATIC_TAIL_CALL:
+    case OPCODE_REF_FUNC:
+    case OPCODE_HOTNESS:
+      operands[0].op = &code->op1;
+      operands[0].kind = WASMBOX_RELOCATION_FUNC;
+      return 1;
+    case OPCODE_DYNAMIC_CALL:
+    case OPCODE_DYNAMIC_TAIL_CALL:
+      operands[0].op = &code->op1;
+      operands[0].kind = WASMBOX_RELOCATION_CACHE;
+      return 1;
+#ifdef WASMBOX_VM_USE_COMPACT_CODE
+#  define FUNC(opcode, type, inst, attr, vmopcode) case vmopcode:
+      CONST_OP_EACH(FUNC)
+#  undef FUNC
+      operands[0].op = &code->op1;
+      operands[0].kind = WASMBOX_CODE_CACHE_VALUE;
+      return 1;
+#  define FUNC(wtype, type, operand, inst, vmopcode) case vmopcode:
+      IMMEDIATE_INST_EACH(FUNC)
+#  undef FUNC
+#  define FUNC(type, operand, inst, vmopcode) case vmopcode:
+      DIVISION_MAGIC_INST_EACH(FUNC)
+#  undef FUNC
+      operands[0].op = &code->op2;
+      operands[0].kind = WASMBOX_CODE_CACHE_VALUE;
+      return 1;
+#endif
+    case OPCODE_JIT_ENTRY:
+    case OPCODE_LAZY_COMPILE:
+      return -1;
+    default:
+      return 0;
+  }
+}
+
+// Returns where the pointer of `op` is kept. Compact code keeps it in the
+// constant pool, and its branches are relative and its functions indices, so
+// they need no slot.
+static void **wasmbox_code_cache_slot(wasmbox_code_t *code,
+                                      wasmbox_code_cache_operand_t *operand) {
+#ifdef WASMBOX_VM_USE_COMPACT_CODE
+  if (operand->kind == WASMBOX_RELOCATION_CODE ||
+      operand->kind == WASMBOX_RELOCATION_FUNC) {
+    return NULL;
+  }
+  return (void **) ((char *) code + operand->op->offset);
+#else
+  return (void **) operand->op;
+#endif
+}
+
+static int wasmbox_code_cache_compare_function(const void *a, const void *b) {
+  uintptr_t x = (uintptr_t) ((const wasmbox_code_cache_callee_t *) a)->func;
+  uintptr_t y = (uintptr_t) ((const wasmbox_code_cache_callee_t *) b)->func;
+  return x < y ? -1 : x > y;
+}
+
+static int wasmbox_code_cache_function_index(wasmbox_code_cache_writer_t *w,
+                                             wasmbox_function_t *func,
+                                             wasm_u32_t *index) {
+  wasmbox_code_cache_callee_t key = {func, 0};
+  wasmbox_code_cache_callee_t *found = (wasmbox_code_cache_callee_t *) bsearch(
+      &key, w->callees, w->mod->function_size, sizeof(key),
+      wasmbox_code_cache_compare_function);
+  if (found == NULL) {
+    return -1;
+  }
+  *index = found->index;
+  return 0;
+}
+
+static int wasmbox_code_cache_relocate(wasmbox_code_cache_writer_t *w,
+                                       wasmbox_mutable_function_t *func,
+                                       wasm_u32_t slot, wasm_u32_t kind,
+                                       void *pointer) {
+  wasmbox_code_cache_relocation_t r = {slot, kind, 0, 0};
+  switch (kind) {
+    case WASMBOX_RELOCATION_CODE:
+      r.value = (char *) pointer - (char *) func->base.code;
+      break;
+    case WASMBOX_RELOCATION_FUNC:
+      if (wasmbox_code_cache_function_index(w, (wasmbox_function_t *) pointer,
+                                            &r.value) != 0) {
+        return -1;
+      }
+      break;
+    case WASMBOX_RELOCATION_CACHE: {
+      wasmbox_call_cache_t *cache = (wasmbox_call_cache_t *) pointer;
+      for (r.value = 0; r.value < w->mod->type_size; r.value++) {
+        if (w->mod->types[r.value] == cache->type) {
+          break;
+        }
+      }
+      if (r.value == w->mod->type_size) {
+        return -1;
+      }
+      r.tableidx = cache->tableidx;
+      break;
+    }
+  }
+  if (w->relocation_size == w->relocation_capacity) {
+    if (w->relocations == NULL) {
+      w->relocation_capacity = 16;
+      w->relocations = (wasmbox_code_cache_relocation_t *) wasmbox_malloc(
+          sizeof(r) * w->relocation_capacity);
+    } else {
+      w->relocation_capacity *= 2;
+      w->relocations = (wasmbox_code_cache_relocation_t *) wasmbox_realloc(
+          w->relocations, sizeof(r) * w->relocation_capacity);
+    }
+  }
+  w->relocations[w->relocation_size++] = r;
+  return 0;
+}
+
+static int wasmbox_code_cache_write(wasmbox_code_cache_writer_t *w,
+                                    const void *data, wasm_u64_t size) {
+  if (size > 0 && fwrite(data, size, 1, w->fp) != 1) {
+    return -1;
+  }
+  w->pos += size;
+  return 0;
+}
+
+static int wasmbox_code_cache_pad(wasmbox_code_cache_writer_t *w,
+                                  wasm_u32_t align) {
+  static const wasm_u8_t zero[16] = {};
+  return wasmbox_code_cache_write(
+      w, zero, WASMBOX_CODE_CACHE_ALIGN(w->pos, align) - w->pos);
+}
+
+static int wasmbox_code_cache_write_function(
+    wasmbox_code_cache_writer_t *w, wasmbox_mutable_function_t *func,
+    wasmbox_code_cache_function_t *record) {
+  wasmbox_code_t *code = func->base.code;
+  wasm_u32_t code_bytes = sizeof(wasmbox_code_t) * func->base.code_size;
+  wasm_u32_t end = code_bytes;
+  w->relocation_size = 0;
+  for (wasm_u32_t i = 0; i < func->base.code_size;
+       i += wasmbox_code_length(&code[i])) {
+    wasmbox_code_cache_operand_t operands[2];
+    int size = wasmbox_code_cache_operands(&code[i], operands);
+    if (size < 0) {
+      return -1;
+    }
+#ifndef WASMBOX_VM_USE_COMPACT_CODE
+    if (code[i].h.opcode == OPCODE_JUMP_TABLE) {
+      wasmbox_jump_target_t *targets = WASMBOX_JUMP_TABLE_TARGETS(&code[i]);
+      for (wasm_u32_t k = 0; k < code[i].op0.index; k++) {
+        if (wasmbox_code_cache_relocate(
+                w, func, (char *) &targets[k].code - (char *) code,
+                WASMBOX_RELOCATION_CODE, targets[k].code) != 0) {
+          return -1;
+        }
+      }
+    }
+#endif
+    for (int j = 0; j < size; j++) {
+      void **slot = wasmbox_code_cache_slot(&code[i], &operands[j]);
+      if (slot == NULL) {
+        continue;
+      }
+      wasm_u32_t offset = (char *) slot - (char *) code;
+      if (end < offset + WASMBOX_CODE_CACHE_SLOT_SIZE) {
+        end = offset + WASMBOX_CODE_CACHE_SLOT_SIZE;
+      }
+      if (operands[j].kind != WASMBOX_CODE_CACHE_VALUE &&
+          wasmbox_code_cache_relocate(w, func, offset, operands[j].kind,
+                                      *slot) != 0) {
+        return -1;
+      }
+    }
+  }
+
+  // Labels and pointers are different in every process, so they are left
+  // out to keep the file the same for the same module.
+  wasm_u8_t *blob = (wasm_u8_t *) wasmbox_malloc_uninit(end);
+  memcpy(blob, code, end);
+#ifndef WASMBOX_VM_USE_COMPACT_CODE
+  for (wasm_u32_t i = 0; i < func->base.code_size;
+       i += wasmbox_code_length(&code[i])) {
+    ((wasmbox_code_t *) blob)[i].h.label = NULL;
+#  ifdef WASMBOX_VM_USE_CODE_LABEL
+    if (code[i].h.opcode == OPCODE_JUMP_TABLE) {
+      wasmbox_jump_target_t *targets =
+          WASMBOX_JUMP_TABLE_TARGETS((wasmbox_code_t *) blob + i);
+      for (wasm_u32_t k = 0; k < code[i].op0.index; k++) {
+        targets[k].label = NULL;
+      }
+    }
+#  endif
+  }
+#endif
+  for (wasm_u32_t i = 0; i < w->relocation_size; i++) {
+    memset(blob + w->relocations[i].slot, 0, sizeof(void *));
+  }
+  int written = wasmbox_code_cache_pad(w, 16) == 0;
+  record->offset = w->pos;
+  record->code_size = func->base.code_size;
+  record->constant_size = end - code_bytes;
+  record->locals = func->base.locals;
+  record->frame_size = func->base.frame_size;
+  written = written && wasmbox_code_cache_write(w, blob, end) == 0;
+  wasmbox_free(blob);
+
+  written = written && wasmbox_code_cache_pad(w, 8) == 0;
+  record->relocation_offset = w->pos;
+  record->relocation_size = w->relocation_size;
+  written = written &&
+            wasmbox_code_cache_write(w, w->relocations,
+                                     sizeof(*w->relocations) *
+                                         w->relocation_size) == 0;
+  return written ? 0 : -1;
+}
+
+static int wasmbox_code_cache_write_module(wasmbox_code_cache_writer_t *w,
+                                           wasm_u64_t hash) {
+  wasmbox_module_t *mod = w->mod;
+  wasmbox_code_cache_header_t header = {};
+  memcpy(header.magic, WASMBOX_CODE_CACHE_MAGIC, sizeof(header.magic));
+  header.version = WASMBOX_CODE_CACHE_VERSION;
+  header.build = WASMBOX_CODE_CACHE_BUILD;
+  header.inline_threshold = mod->inline_threshold;
+  header.fuel_metering = mod->fuel_metering;
+  header.epoch_interruption = mod->epoch_interruption;
+  header.source_hash = hash;
+  header.source_size = mod->source_size;
+  header.function_size = mod->function_size;
+  wasm_u32_t records_size =
+      sizeof(wasmbox_code_cache_function_t) * mod->function_size;
+  wasmbox_code_cache_function_t *records =
+      (wasmbox_code_cache_function_t *) wasmbox_malloc(records_size + 1);
+  memset(records, 0, records_size);
+
+  // The records are written again once the functions are laid out.
+  int written =
+      wasmbox_code_cache_write(w, &header, sizeof(header)) == 0 &&
+      wasmbox_code_cache_write(w, records, records_size) == 0;
+  for (wasm_u32_t i = 0; written && i < mod->function_size; i++) {
+    written = wasmbox_code_cache_write_function(
+                  w, (wasmbox_mutable_function_t *) mod->functions[i],
+                  &records[i]) == 0;
+  }
+  written = written && fseek(w->fp, sizeof(header), SEEK_SET) == 0 &&
+            fwrite(records, 1, records_size, w->fp) == records_size;
+  wasmbox_free(records);
+  return written ? 0 : -1;
+}
+
+int wasmbox_code_cache_save(wasmbox_module_t *mod, wasm_u64_t hash) {
+  // Imported functions point to host functions of this process.
+  if (mod->import_function_size > 0) {
+    return 0;
+  }
+  char path[4096], temp[4096];
+  char suffix[32];
+  snprintf(suffix, sizeof(suffix), ".%d", (int) getpid());
+  if (wasmbox_code_cache_path(path, sizeof(path), mod, hash, "") != 0 ||
+      wasmbox_code_cache_path(temp, sizeof(temp), mod, hash, suffix) != 0) {
+    LOG("code cache path too long");
+    return -1;
+  }
+  wasmbox_code_cache_writer_t w = {};
+  w.mod = mod;
+  w.fp = fopen(temp, "wb");
+  if (w.fp == NULL) {
+    LOG("failed to create code cache");
+    return -1;
+  }
+  w.callees = (wasmbox_code_cache_callee_t *) wasmbox_malloc(
+      sizeof(wasmbox_code_cache_callee_t) * mod->function_size + 1);
+  for (wasm_u32_t i = 0; i < mod->function_size; i++) {
+    w.callees[i].func = mod->functions[i];
+    w.callees[i].index = i;
+  }
+  qsort(w.callees, mod->function_size, sizeof(*w.callees),
+        wasmbox_code_cache_compare_function);
+  int written = wasmbox_code_cache_write_module(&w, hash) == 0;
+  wasmbox_free(w.callees);
+  if (w.relocations != NULL) {
+    wasmbox_free(w.relocations);
+  }
+  written = fclose(w.fp) == 0 && written;
+  // Readers see either no file or a whole one.
+  if (!written || rename(temp, path) != 0) {
+    unlink(temp);
+    LOG("failed to write code cache");
+    return -1;
+  }
+  return 0;
+}
+
+static int wasmbox_code_cache_validate(wasmbox_code_cache_t *cache,
+                                       wasmbox_module_t *mod,
+                                       wasm_u64_t hash) {
+  const wasmbox_code_cache_header_t *header =
+      (const wasmbox_code_cache_header_t *) cache->data;
+  if (cache->size < sizeof(*header) ||
+      memcmp(header->magic, WASMBOX_CODE_CACHE_MAGIC, sizeof(header->magic)) !=
+          0 ||
+      header->version != WASMBOX_CODE_CACHE_VERSION ||
+      header->build != WASMBOX_CODE_CACHE_BUILD ||
+      header->inline_threshold != mod->inline_threshold ||
+      header->fuel_metering != mod->fuel_metering ||
+      header->epoch_interruption != mod->epoch_interruption ||
+      header->source_hash != hash || header->source_size != mod->source_size) {
+    return -1;
+  }
+  const wasmbox_code_cache_function_t *records =
+      (const wasmbox_code_cache_function_t *) (header + 1);
+  if (cache->size - sizeof(*header) <
+      (wasm_u64_t) sizeof(*records) * header->function_size) {
+    return -1;
+  }
+  for (wasm_u32_t i = 0; i < header->function_size; i++) {
+    const wasmbox_code_cache_function_t *r = &records[i];
+    if (r->offset % 16 != 0 ||
+        r->offset + (wasm_u64_t) sizeof(wasmbox_code_t) * r->code_size +
+                r->constant_size >
+            cache->size ||
+        r->relocation_offset +
+                (wasm_u64_t) sizeof(wasmbox_code_cache_relocation_t) *
+                    r->relocation_size >
+            cache->size) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+void wasmbox_code_cache_open(wasmbox_module_t *mod, wasm_u64_t hash) {
+  char path[4096];
+  if (wasmbox_code_cache_path(path, sizeof(path), mod, hash, "") != 0) {
+    return;
+  }
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    return;
+  }
+  struct stat st;
+  void *data = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && st.st_size > 0) {
+    // Private, so that the code can be patched in place.
+    data = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  }
+  close(fd);
+  if (data == MAP_FAILED) {
+    return;
+  }
+  wasmbox_code_cache_t cache = {(wasm_u8_t *) data, (wasm_u64_t) st.st_size};
+  if (wasmbox_code_cache_validate(&cache, mod, hash) != 0) {
+    munmap(data, st.st_size);
+    return;
+  }
+  mod->code_cache =
+      (wasmbox_code_cache_t *) wasmbox_malloc(sizeof(wasmbox_code_cache_t));
+  *mod->code_cache = cache;
+}
+
+static int wasmbox_code_cache_install_function(
+    wasmbox_module_t *mod, wasmbox_mutable_function_t *func,
+    const wasmbox_code_cache_function_t *r) {
+  wasmbox_code_cache_t *cache = mod->code_cache;
+  wasm_u32_t code_bytes = sizeof(wasmbox_code_t) * r->code_size;
+  wasmbox_code_t *code = (wasmbox_code_t *) (cache->data + r->offset);
+  func->base.code = code;
+  func->base.code_size = r->code_size;
+  func->base.locals = r->locals;
+  func->base.frame_size = r->frame_size;
+#ifdef WASMBOX_VM_USE_CODE_LABEL
+  void **labels = (void **) mod->shared_code[0].op0.value.u64;
+#endif
+  for (wasm_u32_t i = 0; i < r->code_size; i += wasmbox_code_length(&code[i])) {
+    if (code[i].h.opcode >= OPCODE_THREADED_CODE ||
+        r->code_size - i < wasmbox_code_length(&code[i])) {
+      return -1;
+    }
+#ifdef WASMBOX_VM_USE_COMPACT_CODE
+    wasmbox_code_cache_operand_t operands[2];
+    if (wasmbox_code_cache_operands(&code[i], operands) == 1 &&
+        operands[0].kind == WASMBOX_RELOCATION_FUNC &&
+        operands[0].op->index >= mod->function_size) {
+      return -1;
+    }
+#endif
+#ifdef WASMBOX_VM_USE_CODE_LABEL
+    code[i].h.label = labels[code[i].h.opcode];
+#endif
+  }
+  const wasmbox_code_cache_relocation_t *relocations =
+      (const wasmbox_code_cache_relocation_t *) (cache->data +
+                                                 r->relocation_offset);
+  for (wasm_u32_t i = 0; i < r->relocation_size; i++) {
+    const wasmbox_code_cache_relocation_t *reloc = &relocations[i];
+    if (reloc->slot % sizeof(void *) != 0 ||
+        reloc->slot + sizeof(void *) > code_bytes + r->constant_size) {
+      return -1;
+    }
+    void **slot = (void **) ((char *) code + reloc->slot);
+    switch (reloc->kind) {
+      case WASMBOX_RELOCATION_CODE:
+        if (reloc->value > code_bytes) {
+          return -1;
+        }
+        *slot = (char *) code + reloc->value;
+        break;
+      case WASMBOX_RELOCATION_FUNC:
+        if (reloc->value >= mod->function_size) {
+          return -1;
+        }
+        *slot = mod->functions[reloc->value];
+        break;
+      case WASMBOX_RELOCATION_CACHE:
+        if (reloc->value >= mod->type_size) {
+          return -1;
+        }
+        *slot = wasmbox_module_add_call_cache(mod, mod->types[reloc->value],
+                                              reloc->tableidx);
+        break;
+      default:
+        return -1;
+    }
+  }
+#ifdef WASMBOX_VM_USE_CODE_LABEL
+  // Targets are labelled once all of the code is.
+  for (wasm_u32_t i = 0; i < r->code_size; i += wasmbox_code_length(&code[i])) {
+    if (code[i].h.opcode == OPCODE_JUMP_TABLE) {
+      wasmbox_jump_target_t *targets = WASMBOX_JUMP_TABLE_TARGETS(&code[i]);
+      for (wasm_u32_t k = 0; k < code[i].op0.index; k++) {
+        if (targets[k].code == NULL ||
+            targets[k].code >= code + r->code_size) {
+          return -1;
+        }
+        targets[k].label = targets[k].code->h.label;
+      }
+    }
+  }
+#endif
+  return 0;
+}
+
+int wasmbox_code_cache_install(wasmbox_module_t *mod,
+                               wasmbox_input_stream_t *ins,
+                               wasm_u64_t section_size) {
+  const wasmbox_code_cache_header_t *header =
+      (const wasmbox_code_cache_header_t *) mod->code_cache->data;
+  const wasmbox_code_cache_function_t *records =
+      (const wasmbox_code_cache_function_t *) (header + 1);
+  if (header->function_size != mod->function_size) {
+    LOG("code cache does not match the module");
+    return -1;
+  }
+  for (wasm_u32_t i = 0; i < mod->function_size; i++) {
+    if (wasmbox_code_cache_install_function(
+            mod, (wasmbox_mutable_function_t *) mod->functions[i],
+            &records[i]) != 0) {
+      LOG("broken code cache");
+      return -1;
+    }
+  }
+  ins->index += section_size;
+  return 0;
+}
+
+int wasmbox_code_cache_contains(wasmbox_code_cache_t *cache,
+                                wasmbox_code_t *code) {
+  return cache != NULL && (wasm_u8_t *) code >= cache->data &&
+         (wasm_u8_t *) code < cache->data + cache->size;
+}
+
+void wasmbox_code_cache_dispose(wasmbox_module_t *mod) {
+  if (mod->code_cache != NULL) {
+    munmap(mod->code_cache->data, mod->code_cache->size);
+    wasmbox_free(mod->code_cache);
+    mod->code_cache = NULL;
+  }
+}
+
+#endif /* WASMBOX_CODE_CACHE_ENABLED */
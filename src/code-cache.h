@@ -0,0 +1,116 @@
+/*
+ * Copyright (C) 2021 Masahiro Ide
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef WASMBOX_CODE_CACHE_H
+#define WASMBOX_CODE_CACHE_H
+
+#include "input-stream.h"
+#include "jit.h"
+#include "wasmbox/wasmbox.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Native code and lazily compiled bodies are not in the frozen code. */
+#if !defined(WASMBOX_JIT_ENABLED) && !defined(WASMBOX_VM_USE_LAZY_COMPILE)
+#  define WASMBOX_CODE_CACHE_ENABLED 1
+#endif
+
+/**
+ * Layout of a code cache file. A record per function follows the header.
+ * The code of each function, with its constant pool, lies at `offset` and is
+ * followed by its relocations.
+ */
+typedef struct wasmbox_code_cache_header_t {
+  char magic[4];
+  wasm_u32_t version;
+  /* Encoding of the instructions this build runs. */
+  wasm_u32_t build;
+  wasm_s32_t inline_threshold;
+  wasm_u64_t source_hash;
+  wasm_u32_t source_size;
+  wasm_u32_t function_size;
+  wasm_u32_t fuel_metering;
+  wasm_u32_t epoch_interruption;
+} wasmbox_code_cache_header_t;
+
+typedef struct wasmbox_code_cache_function_t {
+  wasm_u64_t offset;
+  /* Number of instructions, and bytes of the constant pool after them. */
+  wasm_u32_t code_size;
+  wasm_u32_t constant_size;
+  wasm_u16_t locals;
+  wasm_u16_t frame_size;
+  wasm_u64_t relocation_offset;
+  wasm_u32_t relocation_size;
+  wasm_u32_t padding;
+} wasmbox_code_cache_function_t;
+
+/* Pointers in the code which are patched when the file is loaded. */
+#define WASMBOX_RELOCATION_CODE  (0) /* byte offset in the function code */
+#define WASMBOX_RELOCATION_FUNC  (1) /* function index */
+#define WASMBOX_RELOCATION_CACHE (2) /* call cache for a type and table */
+
+typedef struct wasmbox_code_cache_relocation_t {
+  /* Byte offset of the pointer from the start of the function code. */
+  wasm_u32_t slot;
+  wasm_u32_t kind;
+  wasm_u32_t value;
+  wasm_u32_t tableidx;
+} wasmbox_code_cache_relocation_t;
+
+struct wasmbox_code_cache_t {
+  wasm_u8_t *data;
+  wasm_u64_t size;
+};
+
+/* Hash of a module binary, which snapshots are matched with in every build. */
+wasm_u64_t wasmbox_code_cache_hash(const wasm_u8_t *data, wasm_u32_t length);
+
+/**
+ * Maps the cache file of the module binary with `hash` in
+ * `mod->code_cache_dir` as `mod->code_cache`. Leaves it NULL if there is no
+ * file, or if it was written by another build.
+ */
+void wasmbox_code_cache_open(wasmbox_module_t *mod, wasm_u64_t hash);
+
+/**
+ * Takes the code of every function from `mod->code_cache` instead of
+ * compiling the code section, which `ins` is at the start of.
+ */
+int wasmbox_code_cache_install(wasmbox_module_t *mod,
+                               wasmbox_input_stream_t *ins,
+                               wasm_u64_t section_size);
+
+/* Writes the code of the loaded module to its cache file. */
+int wasmbox_code_cache_save(wasmbox_module_t *mod, wasm_u64_t hash);
+
+int wasmbox_code_cache_contains(wasmbox_code_cache_t *cache,
+                                wasmbox_code_t *code);
+
+void wasmbox_code_cache_dispose(wasmbox_module_t *mod);
+
+/* Defined by the loader, which owns the call caches of the module. */
+wasmbox_call_cache_t *wasmbox_module_add_call_cache(wasmbox_module_t *mod,
+                                                    wasmbox_type_t *type,
+                                                    wasm_u32_t tableidx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* end of include guard */
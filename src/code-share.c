@@ -0,0 +1,168 @@
+/*
+ * Copyright (C) 2021 Masahiro Ide
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "code-share.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "opcodes.h"
+
+/* A shared body, which follows its header in the same block. The bodies are
+ * chained in buckets by the hash of their position independent form, outside
+ * of any module allocator. */
+typedef struct wasmbox_shared_code_t {
+  struct wasmbox_shared_code_t *next;
+  wasm_u64_t hash;
+  wasm_u64_t size;
+  wasm_u32_t code_size;
+  wasm_u32_t refs;
+} __attribute__((aligned(16))) wasmbox_shared_code_t;
+
+static struct {
+  wasmbox_shared_code_t **buckets;
+  wasm_u32_t size;
+  wasm_u32_t capacity;
+  char lock;
+} shared;
+
+#define WASMBOX_CODE_SHARE_INIT_SIZE (64)
+
+static wasmbox_code_t *wasmbox_shared_code_body(wasmbox_shared_code_t *entry) {
+  return (wasmbox_code_t *) (entry + 1);
+}
+
+// Copies `code` with its branches made offsets from its start, the form in
+// which equal bodies compare equal wherever they lie.
+static wasmbox_code_t *wasmbox_code_share_key(const wasmbox_code_t *code,
+                                              wasm_u32_t code_size,
+                                              wasm_u64_t size) {
+  wasmbox_code_t *key = (wasmbox_code_t *) malloc(size);
+  if (key != NULL) {
+    memcpy(key, code, size);
+    wasmbox_code_relocate(key, code_size, -(ptrdiff_t) (uintptr_t) code);
+  }
+  return key;
+}
+
+static wasm_u64_t wasmbox_code_share_hash(const wasmbox_code_t *key,
+                                          wasm_u64_t size) {
+  // FNV-1a over the position independent form.
+  const wasm_u8_t *data = (const wasm_u8_t *) key;
+  wasm_u64_t hash = 14695981039346656037ull;
+  for (wasm_u64_t i = 0; i < size; ++i) {
+    hash = (hash ^ data[i]) * 1099511628211ull;
+  }
+  return hash;
+}
+
+static int wasmbox_code_share_equals(wasmbox_shared_code_t *entry,
+                                     const wasmbox_code_t *key,
+                                     wasm_u32_t code_size, wasm_u64_t size) {
+  if (entry->size != size || entry->code_size != code_size) {
+    return 0;
+  }
+  wasmbox_code_t *other =
+      wasmbox_code_share_key(wasmbox_shared_code_body(entry), code_size, size);
+  int equals = other != NULL && memcmp(other, key, size) == 0;
+  free(other);
+  return equals;
+}
+
+// Doubles the buckets, keeping at most one body per bucket on average.
+static int wasmbox_code_share_grow(void) {
+  wasm_u32_t capacity = shared.capacity == 0 ? WASMBOX_CODE_SHARE_INIT_SIZE
+                                             : shared.capacity * 2;
+  wasmbox_shared_code_t **buckets =
+      (wasmbox_shared_code_t **) calloc(capacity, sizeof(*buckets));
+  if (buckets == NULL) {
+    return -1;
+  }
+  for (wasm_u32_t i = 0; i < shared.capacity; ++i) {
+    wasmbox_shared_code_t *entry = shared.buckets[i];
+    while (entry != NULL) {
+      wasmbox_shared_code_t *next = entry->next;
+      wasmbox_shared_code_t **bucket = &buckets[entry->hash & (capacity - 1)];
+      entry->next = *bucket;
+      *bucket = entry;
+      entry = next;
+    }
+  }
+  free(shared.buckets);
+  shared.buckets = buckets;
+  shared.capacity = capacity;
+  return 0;
+}
+
+wasmbox_code_t *wasmbox_code_share(const wasmbox_code_t *code,
+                                   wasm_u32_t code_size, wasm_u64_t size) {
+  wasmbox_code_t *key = wasmbox_code_share_key(code, code_size, size);
+  if (key == NULL) {
+    return NULL;
+  }
+  wasm_u64_t hash = wasmbox_code_share_hash(key, size);
+  wasmbox_code_t *body = NULL;
+  while (__atomic_test_and_set(&shared.lock, __ATOMIC_ACQUIRE)) {
+  }
+  if (shared.size + 1 > shared.capacity && wasmbox_code_share_grow() != 0) {
+    goto unlock;
+  }
+  wasmbox_shared_code_t **bucket = &shared.buckets[hash & (shared.capacity - 1)];
+  for (wasmbox_shared_code_t *entry = *bucket; entry != NULL;
+       entry = entry->next) {
+    if (entry->hash == hash &&
+        wasmbox_code_share_equals(entry, key, code_size, size)) {
+      entry->refs++;
+      body = wasmbox_shared_code_body(entry);
+      goto unlock;
+    }
+  }
+  wasmbox_shared_code_t *entry =
+      (wasmbox_shared_code_t *) malloc(sizeof(wasmbox_shared_code_t) + size);
+  if (entry != NULL) {
+    entry->hash = hash;
+    entry->size = size;
+    entry->code_size = code_size;
+    entry->refs = 1;
+    entry->next = *bucket;
+    *bucket = entry;
+    shared.size++;
+    body = wasmbox_shared_code_body(entry);
+    memcpy(body, code, size);
+    wasmbox_code_relocate(body, code_size, (char *) body - (char *) code);
+  }
+unlock:
+  __atomic_clear(&shared.lock, __ATOMIC_RELEASE);
+  free(key);
+  return body;
+}
+
+void wasmbox_code_unshare(wasmbox_code_t *code) {
+  wasmbox_shared_code_t *entry = (wasmbox_shared_code_t *) code - 1;
+  while (__atomic_test_and_set(&shared.lock, __ATOMIC_ACQUIRE)) {
+  }
+  if (--entry->refs == 0) {
+    wasmbox_shared_code_t **link =
+        &shared.buckets[entry->hash & (shared.capacity - 1)];
+    while (*link != entry) {
+      link = &(*link)->next;
+    }
+    *link = entry->next;
+    shared.size--;
+    free(entry);
+  }
+  __atomic_clear(&shared.lock, __ATOMIC_RELEASE);
+}
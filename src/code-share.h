@@ -0,0 +1,46 @@
+/*
+ * Copyright (C) 2021 Masahiro Ide
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef WASMBOX_CODE_SHARE_H
+#define WASMBOX_CODE_SHARE_H
+
+#include "wasmbox/wasmbox.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Returns a copy of the `size` bytes of `code`, the `code_size` instructions
+ * of a frozen body followed by its constants, which every module of the
+ * process sharing an equal body runs. Bodies are equal if they differ only
+ * in where they lie, so that their branches go to the same instructions.
+ * `code` stays with the caller. Returns NULL if the copy cannot be made.
+ */
+wasmbox_code_t *wasmbox_code_share(const wasmbox_code_t *code,
+                                   wasm_u32_t code_size, wasm_u64_t size);
+
+/**
+ * Drops a body returned by wasmbox_code_share, which is freed once no module
+ * runs it.
+ */
+void wasmbox_code_unshare(wasmbox_code_t *code);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* end of include guard */
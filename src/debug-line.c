@@ -0,0 +1,556 @@
+/*
+ * Copyright (C) 2021 Masahiro Ide
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "debug-line.h"
+#include "allocator.h"
+#include "leb128.h"
+
+#include <stdio.h>
+#include <stdlib.h> // qsort
+#include <string.h> // memcmp, memcpy, strnlen
+
+#define LOG(MSG) fprintf(stderr, "(%s:%d)" MSG, __FILE__, __LINE__)
+
+#define WASMBOX_LINE_TABLE_INIT_SIZE (64)
+
+/* Standard opcodes of a line program. */
+#define DW_LNS_copy (1)
+#define DW_LNS_advance_pc (2)
+#define DW_LNS_advance_line (3)
+#define DW_LNS_set_file (4)
+#define DW_LNS_const_add_pc (8)
+#define DW_LNS_fixed_advance_pc (9)
+
+/* Extended opcodes, which follow a 0 and their length. */
+#define DW_LNE_end_sequence (1)
+#define DW_LNE_set_address (2)
+
+/* Content types and forms of the file entries of DWARF 5. */
+#define DW_LNCT_path (1)
+#define DW_FORM_block (0x09)
+#define DW_FORM_data1 (0x0b)
+#define DW_FORM_data2 (0x05)
+#define DW_FORM_data4 (0x06)
+#define DW_FORM_data8 (0x07)
+#define DW_FORM_data16 (0x1e)
+#define DW_FORM_line_strp (0x1f)
+#define DW_FORM_string (0x08)
+#define DW_FORM_strp (0x0e)
+#define DW_FORM_udata (0x0f)
+
+/* The formats of an entry of DWARF 5: pairs of content type and form. */
+#define WASMBOX_DWARF_ENTRY_FORMAT_MAX (16)
+
+// Tells if the custom section `name` is `expected`.
+static int wasmbox_debug_section_is(const wasm_u8_t *name, wasm_u32_t name_len,
+                                    const char *expected) {
+  return strlen(expected) == name_len && memcmp(expected, name, name_len) == 0;
+}
+
+void wasmbox_debug_sections_add(wasmbox_module_t *mod, const wasm_u8_t *name,
+                                wasm_u32_t name_len, const wasm_u8_t *bytes,
+                                wasm_u32_t size, int borrow) {
+  const wasm_u8_t **data;
+  wasm_u32_t *data_size;
+  wasmbox_debug_sections_t *sections = mod->debug_sections;
+  if (sections == NULL) {
+    if (name_len < 6 || memcmp(name, ".debug", 6) != 0) {
+      return;
+    }
+    sections = (wasmbox_debug_sections_t *) wasmbox_malloc(
+        sizeof(wasmbox_debug_sections_t));
+    sections->borrowed = borrow;
+    mod->debug_sections = sections;
+  }
+  if (wasmbox_debug_section_is(name, name_len, ".debug_line")) {
+    data = &sections->line;
+    data_size = &sections->line_size;
+  } else if (wasmbox_debug_section_is(name, name_len, ".debug_line_str")) {
+    data = &sections->line_str;
+    data_size = &sections->line_str_size;
+  } else if (wasmbox_debug_section_is(name, name_len, ".debug_str")) {
+    data = &sections->str;
+    data_size = &sections->str_size;
+  } else {
+    return;
+  }
+  // A section which comes twice is kept once.
+  if (*data != NULL) {
+    return;
+  }
+  if (borrow) {
+    *data = bytes;
+  } else {
+    wasm_u8_t *copy = (wasm_u8_t *) wasmbox_malloc_uninit(size > 0 ? size : 1);
+    memcpy(copy, bytes, size);
+    *data = copy;
+  }
+  *data_size = size;
+}
+
+void wasmbox_debug_sections_dispose(wasmbox_debug_sections_t *sections) {
+  if (!sections->borrowed) {
+    const wasm_u8_t *data[] = {sections->line, sections->line_str,
+                               sections->str};
+    for (size_t i = 0; i < sizeof(data) / sizeof(data[0]); i++) {
+      if (data[i] != NULL) {
+        wasmbox_free((void *) data[i]);
+      }
+    }
+  }
+  wasmbox_free(sections);
+}
+
+/* Reads a section. Reading past `end` stops at it and sets `failed`. */
+typedef struct wasmbox_dwarf_reader_t {
+  const wasm_u8_t *data;
+  wasm_u32_t index;
+  wasm_u32_t end;
+  wasm_u8_t failed;
+} wasmbox_dwarf_reader_t;
+
+// Reads a little-endian number of `size` bytes, of which the first 8 count.
+static wasm_u64_t wasmbox_dwarf_read(wasmbox_dwarf_reader_t *r,
+                                     wasm_u32_t size) {
+  if (size > r->end - r->index) {
+    r->failed = 1;
+    r->index = r->end;
+    return 0;
+  }
+  wasm_u64_t value = 0;
+  for (wasm_u32_t i = 0; i < size && i < sizeof(value); i++) {
+    value |= (wasm_u64_t) r->data[r->index + i] << (8 * i);
+  }
+  r->index += size;
+  return value;
+}
+
+static wasm_u64_t wasmbox_dwarf_read_uleb(wasmbox_dwarf_reader_t *r) {
+  if (r->index >= r->end) {
+    r->failed = 1;
+    return 0;
+  }
+  return wasmbox_parse_unsigned_leb128(r->data + r->index, &r->index, r->end);
+}
+
+static wasm_s64_t wasmbox_dwarf_read_sleb(wasmbox_dwarf_reader_t *r) {
+  if (r->index >= r->end) {
+    r->failed = 1;
+    return 0;
+  }
+  return wasmbox_parse_signed_leb128(r->data + r->index, &r->index, r->end);
+}
+
+// Reads a NUL-terminated string into `name`.
+static void wasmbox_dwarf_read_string(wasmbox_dwarf_reader_t *r,
+                                      wasmbox_name_t *name) {
+  const wasm_u8_t *start = r->data + r->index;
+  size_t len = strnlen((const char *) start, r->end - r->index);
+  if (len == r->end - r->index) {
+    r->failed = 1;
+    r->index = r->end;
+    return;
+  }
+  name->value = (wasm_u8_t *) start;
+  name->len = (wasm_u32_t) len;
+  r->index += (wasm_u32_t) len + 1;
+}
+
+// Points `name` to the string at `offset` of `data`.
+static int wasmbox_dwarf_string_at(const wasm_u8_t *data, wasm_u32_t size,
+                                   wasm_u64_t offset, wasmbox_name_t *name) {
+  if (data == NULL || offset >= size) {
+    return -1;
+  }
+  wasmbox_dwarf_reader_t r = {data, (wasm_u32_t) offset, size, 0};
+  wasmbox_dwarf_read_string(&r, name);
+  return r.failed ? -1 : 0;
+}
+
+static void wasmbox_line_table_add_file(wasmbox_line_table_t *table,
+                                        const wasmbox_name_t *name) {
+  if (table->files == NULL) {
+    table->file_capacity = WASMBOX_LINE_TABLE_INIT_SIZE;
+    table->files = (wasmbox_name_t *) wasmbox_malloc(
+        sizeof(wasmbox_name_t) * table->file_capacity);
+  } else if (table->file_size == table->file_capacity) {
+    table->file_capacity *= 2;
+    table->files = (wasmbox_name_t *) wasmbox_realloc(
+        table->files, sizeof(wasmbox_name_t) * table->file_capacity);
+  }
+  table->files[table->file_size++] = *name;
+}
+
+static void wasmbox_line_table_add_row(wasmbox_line_table_t *table,
+                                       wasm_u32_t address, wasm_u32_t file,
+                                       wasm_u32_t line) {
+  if (table->rows == NULL) {
+    table->row_capacity = WASMBOX_LINE_TABLE_INIT_SIZE;
+    table->rows = (wasmbox_line_row_t *) wasmbox_malloc(
+        sizeof(wasmbox_line_row_t) * table->row_capacity);
+  } else if (table->row_size == table->row_capacity) {
+    table->row_capacity *= 2;
+    table->rows = (wasmbox_line_row_t *) wasmbox_realloc(
+        table->rows, sizeof(wasmbox_line_row_t) * table->row_capacity);
+  }
+  table->rows[table->row_size++] = (wasmbox_line_row_t){address, file, line};
+}
+
+/* The header fields of a unit which its line program needs. */
+typedef struct wasmbox_line_unit_t {
+  wasm_u16_t version;
+  /* Size of the offsets into other sections: 4, or 8 in 64-bit DWARF. */
+  wasm_u8_t offset_size;
+  wasm_u8_t min_inst_length;
+  wasm_s8_t line_base;
+  wasm_u8_t line_range;
+  wasm_u8_t opcode_base;
+  const wasm_u8_t *opcode_lengths;
+  /* Index in the table of the file which the file register counts from. */
+  wasm_u32_t first_file;
+  wasm_u32_t file_size;
+} wasmbox_line_unit_t;
+
+// Reads a value of `form` into `name` if it is a string, or skips it.
+static void wasmbox_dwarf_read_form(wasmbox_dwarf_reader_t *r,
+                                    const wasmbox_debug_sections_t *sections,
+                                    const wasmbox_line_unit_t *unit,
+                                    wasm_u64_t form, wasmbox_name_t *name) {
+  switch (form) {
+    case DW_FORM_string:
+      wasmbox_dwarf_read_string(r, name);
+      break;
+    case DW_FORM_line_strp:
+    case DW_FORM_strp: {
+      wasm_u64_t offset = wasmbox_dwarf_read(r, unit->offset_size);
+      int found = form == DW_FORM_line_strp
+                      ? wasmbox_dwarf_string_at(sections->line_str,
+                                                sections->line_str_size,
+                                                offset, name)
+                      : wasmbox_dwarf_string_at(sections->str,
+                                                sections->str_size, offset,
+                                                name);
+      if (found != 0) {
+        name->len = 0;
+      }
+      break;
+    }
+    case DW_FORM_udata:
+      wasmbox_dwarf_read_uleb(r);
+      break;
+    case DW_FORM_data1:
+      wasmbox_dwarf_read(r, 1);
+      break;
+    case DW_FORM_data2:
+      wasmbox_dwarf_read(r, 2);
+      break;
+    case DW_FORM_data4:
+      wasmbox_dwarf_read(r, 4);
+      break;
+    case DW_FORM_data8:
+      wasmbox_dwarf_read(r, 8);
+      break;
+    case DW_FORM_data16:
+      wasmbox_dwarf_read(r, 16);
+      break;
+    case DW_FORM_block:
+      wasmbox_dwarf_read(r, (wasm_u32_t) wasmbox_dwarf_read_uleb(r));
+      break;
+    default:
+      // E.g. indices into .debug_str_offsets, which is not kept.
+      LOG("unknown form of a file entry\n");
+      r->failed = 1;
+      r->index = r->end;
+      break;
+  }
+}
+
+// Reads the directories or the files of a DWARF 5 header, adding the paths
+// of the files to `table` if `files` is set.
+static void
+wasmbox_line_unit_read_entries(wasmbox_dwarf_reader_t *r,
+                               const wasmbox_debug_sections_t *sections,
+                               wasmbox_line_unit_t *unit,
+                               wasmbox_line_table_t *table, int files) {
+  wasm_u8_t format_size = (wasm_u8_t) wasmbox_dwarf_read(r, 1);
+  wasm_u64_t formats[WASMBOX_DWARF_ENTRY_FORMAT_MAX][2];
+  if (format_size > WASMBOX_DWARF_ENTRY_FORMAT_MAX) {
+    r->failed = 1;
+    return;
+  }
+  for (wasm_u8_t i = 0; i < format_size; i++) {
+    formats[i][0] = wasmbox_dwarf_read_uleb(r);
+    formats[i][1] = wasmbox_dwarf_read_uleb(r);
+  }
+  wasm_u64_t size = wasmbox_dwarf_read_uleb(r);
+  for (wasm_u64_t i = 0; i < size && !r->failed; i++) {
+    wasmbox_name_t path = {0, NULL};
+    for (wasm_u8_t j = 0; j < format_size; j++) {
+      wasmbox_name_t value = {0, NULL};
+      wasmbox_dwarf_read_form(r, sections, unit, formats[j][1], &value);
+      if (formats[j][0] == DW_LNCT_path) {
+        path = value;
+      }
+    }
+    if (files && !r->failed) {
+      wasmbox_line_table_add_file(table, &path);
+      unit->file_size++;
+    }
+  }
+}
+
+// Reads the file names of a header before DWARF 5, after the directories.
+static void wasmbox_line_unit_read_files(wasmbox_dwarf_reader_t *r,
+                                         wasmbox_line_unit_t *unit,
+                                         wasmbox_line_table_t *table) {
+  wasmbox_name_t name;
+  do {
+    wasmbox_dwarf_read_string(r, &name);
+  } while (!r->failed && name.len > 0);
+  for (;;) {
+    wasmbox_dwarf_read_string(r, &name);
+    if (r->failed || name.len == 0) {
+      break;
+    }
+    // The directory, the modification time and the size.
+    wasmbox_dwarf_read_uleb(r);
+    wasmbox_dwarf_read_uleb(r);
+    wasmbox_dwarf_read_uleb(r);
+    wasmbox_line_table_add_file(table, &name);
+    unit->file_size++;
+  }
+}
+
+// Returns the index in the table of the file register `file`.
+static wasm_u32_t wasmbox_line_unit_file(const wasmbox_line_unit_t *unit,
+                                         wasm_u64_t file) {
+  // Files count from 1 before DWARF 5 and from 0 since.
+  if (unit->version < 5) {
+    if (file == 0) {
+      return WASMBOX_LINE_FILE_UNKNOWN;
+    }
+    file--;
+  }
+  return file < unit->file_size ? unit->first_file + (wasm_u32_t) file
+                                : WASMBOX_LINE_FILE_UNKNOWN;
+}
+
+// Runs the line program of `unit` from `r` up to its end, adding a row per
+// row of the DWARF line table. Sequences at address 0 or at the tombstone
+// are of functions the linker dropped, and overlap the code of others.
+static void wasmbox_line_unit_run(wasmbox_dwarf_reader_t *r,
+                                  const wasmbox_line_unit_t *unit,
+                                  wasmbox_line_table_t *table) {
+  wasm_u64_t address = 0;
+  wasm_u64_t file = 1;
+  wasm_s64_t line = 1;
+  wasm_u32_t sequence = table->row_size;
+  while (r->index < r->end && !r->failed) {
+    wasm_u8_t opcode = (wasm_u8_t) wasmbox_dwarf_read(r, 1);
+    if (opcode >= unit->opcode_base) {
+      wasm_u32_t adjusted = opcode - unit->opcode_base;
+      address += (adjusted / unit->line_range) * unit->min_inst_length;
+      line += unit->line_base + (wasm_s32_t) (adjusted % unit->line_range);
+      wasmbox_line_table_add_row(table, (wasm_u32_t) address,
+                                 wasmbox_line_unit_file(unit, file),
+                                 (wasm_u32_t) line);
+      continue;
+    }
+    switch (opcode) {
+      case 0: {
+        wasm_u64_t len = wasmbox_dwarf_read_uleb(r);
+        if (len == 0 || len > r->end - r->index) {
+          r->failed = 1;
+          break;
+        }
+        wasm_u32_t next = r->index + (wasm_u32_t) len;
+        wasm_u8_t extended = (wasm_u8_t) wasmbox_dwarf_read(r, 1);
+        if (extended == DW_LNE_end_sequence) {
+          wasm_u32_t start = table->rows != NULL && sequence < table->row_size
+                                 ? table->rows[sequence].address
+                                 : (wasm_u32_t) address;
+          if (start == 0 || start == WASM_U32_MAX) {
+            table->row_size = sequence;
+          } else {
+            wasmbox_line_table_add_row(table, (wasm_u32_t) address,
+                                       WASMBOX_LINE_FILE_UNKNOWN, 0);
+          }
+          sequence = table->row_size;
+          address = 0;
+          file = 1;
+          line = 1;
+        } else if (extended == DW_LNE_set_address) {
+          address = wasmbox_dwarf_read(r, (wasm_u32_t) len - 1);
+        }
+        r->index = next;
+        break;
+      }
+      case DW_LNS_copy:
+        wasmbox_line_table_add_row(table, (wasm_u32_t) address,
+                                   wasmbox_line_unit_file(unit, file),
+                                   (wasm_u32_t) line);
+        break;
+      case DW_LNS_advance_pc:
+        address += wasmbox_dwarf_read_uleb(r) * unit->min_inst_length;
+        break;
+      case DW_LNS_advance_line:
+        line += wasmbox_dwarf_read_sleb(r);
+        break;
+      case DW_LNS_set_file:
+        file = wasmbox_dwarf_read_uleb(r);
+        break;
+      case DW_LNS_const_add_pc:
+        address += ((255 - unit->opcode_base) / unit->line_range) *
+                   unit->min_inst_length;
+        break;
+      case DW_LNS_fixed_advance_pc:
+        address += wasmbox_dwarf_read(r, 2);
+        break;
+      default:
+        // Operands of the other opcodes do not change the rows.
+        for (wasm_u8_t i = 0; i < unit->opcode_lengths[opcode - 1]; i++) {
+          wasmbox_dwarf_read_uleb(r);
+        }
+        break;
+    }
+  }
+  // A sequence left open has no end to bound its last row.
+  table->row_size = sequence;
+}
+
+// Decodes the unit which starts at `r`, and moves `r` past it.
+static int wasmbox_line_unit_decode(wasmbox_dwarf_reader_t *r,
+                                    const wasmbox_debug_sections_t *sections,
+                                    wasmbox_line_table_t *table) {
+  wasmbox_line_unit_t unit = {};
+  unit.offset_size = 4;
+  wasm_u64_t length = wasmbox_dwarf_read(r, 4);
+  if (length == 0xffffffff) {
+    unit.offset_size = 8;
+    length = wasmbox_dwarf_read(r, 8);
+  }
+  if (r->failed || length > r->end - r->index) {
+    LOG("line table out of bounds\n");
+    return -1;
+  }
+  wasm_u32_t end = r->index + (wasm_u32_t) length;
+  wasmbox_dwarf_reader_t unit_reader = {r->data, r->index, end, 0};
+  r->index = end;
+  r = &unit_reader;
+  unit.version = (wasm_u16_t) wasmbox_dwarf_read(r, 2);
+  if (unit.version < 2 || unit.version > 5) {
+    LOG("unknown version of a line table\n");
+    return -1;
+  }
+  if (unit.version >= 5) {
+    // The address size and the segment selector size.
+    wasmbox_dwarf_read(r, 2);
+  }
+  wasm_u64_t header_length = wasmbox_dwarf_read(r, unit.offset_size);
+  if (header_length > r->end - r->index) {
+    LOG("line table header out of bounds\n");
+    return -1;
+  }
+  wasm_u32_t program = r->index + (wasm_u32_t) header_length;
+  unit.min_inst_length = (wasm_u8_t) wasmbox_dwarf_read(r, 1);
+  if (unit.version >= 4) {
+    // The maximum operations per instruction, only more than 1 for VLIW.
+    wasmbox_dwarf_read(r, 1);
+  }
+  // Whether rows start statements, which samples do not care about.
+  wasmbox_dwarf_read(r, 1);
+  unit.line_base = (wasm_s8_t) wasmbox_dwarf_read(r, 1);
+  unit.line_range = (wasm_u8_t) wasmbox_dwarf_read(r, 1);
+  unit.opcode_base = (wasm_u8_t) wasmbox_dwarf_read(r, 1);
+  if (unit.line_range == 0 || unit.opcode_base == 0) {
+    LOG("malformed line table header\n");
+    return -1;
+  }
+  unit.opcode_lengths = r->data + r->index;
+  wasmbox_dwarf_read(r, unit.opcode_base - 1);
+  unit.first_file = table->file_size;
+  if (unit.version >= 5) {
+    wasmbox_line_unit_read_entries(r, sections, &unit, table, 0);
+    wasmbox_line_unit_read_entries(r, sections, &unit, table, 1);
+  } else {
+    wasmbox_line_unit_read_files(r, &unit, table);
+  }
+  if (r->failed) {
+    LOG("malformed line table header\n");
+    return -1;
+  }
+  r->index = program;
+  wasmbox_line_unit_run(r, &unit, table);
+  if (r->failed) {
+    LOG("malformed line program\n");
+    return -1;
+  }
+  return 0;
+}
+
+static int wasmbox_line_row_compare(const void *a, const void *b) {
+  const wasmbox_line_row_t *x = (const wasmbox_line_row_t *) a;
+  const wasmbox_line_row_t *y = (const wasmbox_line_row_t *) b;
+  if (x->address != y->address) {
+    return x->address < y->address ? -1 : 1;
+  }
+  // The end of a sequence gives way to a sequence starting there.
+  return (x->line != 0) - (y->line != 0);
+}
+
+int wasmbox_line_table_init(wasmbox_line_table_t *table,
+                            const wasmbox_debug_sections_t *sections) {
+  memset(table, 0, sizeof(*table));
+  int decoded = 0;
+  wasmbox_dwarf_reader_t r = {sections->line, 0, sections->line_size, 0};
+  while (r.index < r.end && decoded == 0) {
+    decoded = wasmbox_line_unit_decode(&r, sections, table);
+  }
+  if (table->row_size > 0) {
+    qsort(table->rows, table->row_size, sizeof(table->rows[0]),
+          wasmbox_line_row_compare);
+  }
+  return decoded;
+}
+
+const wasmbox_line_row_t *
+wasmbox_line_table_find(const wasmbox_line_table_t *table, wasm_u32_t address) {
+  // The last row at or before `address`.
+  wasm_u32_t low = 0;
+  wasm_u32_t high = table->row_size;
+  while (low < high) {
+    wasm_u32_t mid = low + (high - low) / 2;
+    if (table->rows[mid].address <= address) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+  if (low == 0 || table->rows[low - 1].line == 0) {
+    return NULL;
+  }
+  return &table->rows[low - 1];
+}
+
+void wasmbox_line_table_dispose(wasmbox_line_table_t *table) {
+  if (table->rows != NULL) {
+    wasmbox_free(table->rows);
+  }
+  if (table->files != NULL) {
+    wasmbox_free(table->files);
+  }
+  memset(table, 0, sizeof(*table));
+}
@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2021 Masahiro Ide
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef WASMBOX_DEBUG_LINE_H
+#define WASMBOX_DEBUG_LINE_H
+
+#include "wasmbox/wasmbox.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifdef WASMBOX_VM_USE_SAMPLING_PROFILE
+/**
+ * The DWARF custom sections of a module which source lines are looked up in.
+ * They are kept as they are and only decoded once a line is asked for.
+ */
+struct wasmbox_debug_sections_t {
+  const wasm_u8_t *line;
+  wasm_u32_t line_size;
+  /* Strings which the file names of DWARF 5 line tables refer to. */
+  const wasm_u8_t *line_str;
+  wasm_u32_t line_str_size;
+  const wasm_u8_t *str;
+  wasm_u32_t str_size;
+  /* Set if the bytes lie in the module source rather than in copies. */
+  wasm_u8_t borrowed;
+};
+
+/**
+ * Keeps the custom section `name` of `mod` if it is one of the above. Its
+ * `bytes` are borrowed if `borrow` is set, or else copied.
+ */
+void wasmbox_debug_sections_add(wasmbox_module_t *mod, const wasm_u8_t *name,
+                                wasm_u32_t name_len, const wasm_u8_t *bytes,
+                                wasm_u32_t size, int borrow);
+
+void wasmbox_debug_sections_dispose(wasmbox_debug_sections_t *sections);
+
+/* Unknown file of a row, e.g. one past the files of its line table. */
+#  define WASMBOX_LINE_FILE_UNKNOWN ((wasm_u32_t) -1)
+
+/**
+ * The code from `address`, an offset in the code section, up to the next row
+ * comes from `line` of `file`. A `line` of 0 ends a sequence of rows.
+ */
+typedef struct wasmbox_line_row_t {
+  wasm_u32_t address;
+  wasm_u32_t file;
+  wasm_u32_t line;
+} wasmbox_line_row_t;
+
+/* The rows of the line programs of .debug_line, sorted by address. */
+typedef struct wasmbox_line_table_t {
+  wasmbox_line_row_t *rows;
+  wasm_u32_t row_size;
+  wasm_u32_t row_capacity;
+  /* Names of the files of every unit, which the rows refer to by index. */
+  wasmbox_name_t *files;
+  wasm_u32_t file_size;
+  wasm_u32_t file_capacity;
+} wasmbox_line_table_t;
+
+/**
+ * Runs the line programs of `sections`. Returns -1 if one is malformed or
+ * uses a form this decoder does not know, keeping the units before it.
+ */
+int wasmbox_line_table_init(wasmbox_line_table_t *table,
+                            const wasmbox_debug_sections_t *sections);
+
+/* Returns the row `address` falls in, or NULL if no line covers it. */
+const wasmbox_line_row_t *
+wasmbox_line_table_find(const wasmbox_line_table_t *table, wasm_u32_t address);
+
+void wasmbox_line_table_dispose(wasmbox_line_table_t *table);
+#endif /* WASMBOX_VM_USE_SAMPLING_PROFILE */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* end of include guard */
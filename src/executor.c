@@ -0,0 +1,726 @@
+/*
+ * Copyright (C) 2021 Masahiro Ide
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifdef __linux__
+#  define _GNU_SOURCE // pthread_setaffinity_np
+#endif
+
+#include "allocator.h"
+#include "instance-pool.h"
+#include "interpreter.h"
+#include "memory.h"
+#include "wasmbox/wasmbox.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h> // memcpy
+#include <unistd.h> // sysconf
+
+#define LOG(MSG) fprintf(stderr, "(%s:%d)" MSG, __FILE__, __LINE__)
+
+#define WASMBOX_EXECUTOR_RING_INIT_SIZE (16)
+
+/* The workers on one NUMA node. */
+typedef struct wasmbox_executor_node_t {
+  wasm_u32_t first_worker;
+  wasm_u32_t worker_size;
+  /* Updated atomically. The worker of the next job submitted from outside of
+   * the node, and the instances placed on it. */
+  wasm_u32_t next;
+  wasm_u32_t placed;
+#ifdef __linux__
+  cpu_set_t cpus;
+  int has_cpus;
+#endif
+} wasmbox_executor_node_t;
+
+typedef struct wasmbox_executor_worker_t {
+  wasmbox_executor_t *executor;
+  pthread_t thread;
+  wasm_u32_t node;
+  /* Guards the ring, which other workers steal from. */
+  pthread_mutex_t lock;
+  /* Ring of the queued jobs, oldest at `head`. The capacity is a power of
+   * two. */
+  wasmbox_job_t **jobs;
+  wasm_u32_t head;
+  wasm_u32_t size;
+  wasm_u32_t capacity;
+  /* Contexts without a stopped call, which the next jobs start in. */
+  wasmbox_context_t **contexts;
+  wasm_u32_t context_size;
+  wasm_u32_t context_capacity;
+  /* Counted by the worker and read by wasmbox_executor_stats. */
+  wasmbox_executor_stats_t stats;
+} wasmbox_executor_worker_t;
+
+struct wasmbox_executor_t {
+  wasmbox_executor_worker_t *workers;
+  wasm_u32_t worker_size;
+  wasmbox_executor_node_t *nodes;
+  wasm_u32_t node_size;
+  /* Workers whose thread was started. */
+  wasm_u32_t started;
+  wasm_s64_t fuel_slice;
+  /* Guards the fields below, which are not atomic, and the conditions. */
+  pthread_mutex_t lock;
+  /* Signalled when a job is queued while a worker sleeps, or on dispose. */
+  pthread_cond_t available;
+  /* Signalled once every job submitted is done. */
+  pthread_cond_t idle;
+  wasm_u8_t stopping;
+  /* Every context created by the workers, disposed with the executor. */
+  wasmbox_context_t **contexts;
+  wasm_u32_t context_size;
+  wasm_u32_t context_capacity;
+  /* Updated atomically. Jobs in the rings, jobs ever pushed, workers waiting
+   * for one, jobs submitted but not done, and the worker of the next job
+   * submitted from outside of the executor. */
+  wasm_u32_t queued;
+  wasm_u32_t pushes;
+  wasm_u32_t sleeping;
+  wasm_u64_t pending;
+  wasm_u32_t next;
+};
+
+// Worker running the current thread, so a job submitted from a job stays on
+// the same core.
+static _Thread_local wasmbox_executor_worker_t *wasmbox_executor_current;
+
+static void wasmbox_executor_count(wasm_u64_t *counter) {
+  __atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + 1,
+                   __ATOMIC_RELAXED);
+}
+
+// Queues `job` on `worker`, as its newest job or else as its oldest one, which
+// is the next to be stolen.
+static void wasmbox_executor_push(wasmbox_executor_worker_t *worker,
+                                  wasmbox_job_t *job, int newest) {
+  wasmbox_executor_t *executor = worker->executor;
+  pthread_mutex_lock(&worker->lock);
+  if (worker->size == worker->capacity) {
+    wasm_u32_t capacity = worker->capacity * 2;
+    wasmbox_job_t **jobs =
+        (wasmbox_job_t **) wasmbox_malloc(sizeof(wasmbox_job_t *) * capacity);
+    for (wasm_u32_t i = 0; i < worker->size; i++) {
+      jobs[i] = worker->jobs[(worker->head + i) & (worker->capacity - 1)];
+    }
+    wasmbox_free(worker->jobs);
+    worker->jobs = jobs;
+    worker->head = 0;
+    worker->capacity = capacity;
+  }
+  wasm_u32_t mask = worker->capacity - 1;
+  if (newest) {
+    worker->jobs[(worker->head + worker->size) & mask] = job;
+  } else {
+    worker->head = (worker->head - 1) & mask;
+    worker->jobs[worker->head] = job;
+  }
+  worker->size++;
+  pthread_mutex_unlock(&worker->lock);
+  // A worker going to sleep counts itself before it checks `pushes`, so one
+  // of them sees the other.
+  __atomic_add_fetch(&executor->queued, 1, __ATOMIC_SEQ_CST);
+  __atomic_add_fetch(&executor->pushes, 1, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&executor->sleeping, __ATOMIC_SEQ_CST) > 0) {
+    pthread_mutex_lock(&executor->lock);
+    // A worker of another node may leave the job alone, so all of them are
+    // woken when there are several nodes.
+    if (executor->node_size > 1) {
+      pthread_cond_broadcast(&executor->available);
+    } else {
+      pthread_cond_signal(&executor->available);
+    }
+    pthread_mutex_unlock(&executor->lock);
+  }
+}
+
+// Takes the newest job of `worker`, or the oldest one if it is stolen, as long
+// as it has at least `min` jobs.
+static wasmbox_job_t *wasmbox_executor_pop(wasmbox_executor_worker_t *worker,
+                                           int newest, wasm_u32_t min) {
+  wasmbox_job_t *job = NULL;
+  pthread_mutex_lock(&worker->lock);
+  if (worker->size >= min && worker->size > 0) {
+    wasm_u32_t mask = worker->capacity - 1;
+    if (newest) {
+      job = worker->jobs[(worker->head + worker->size - 1) & mask];
+    } else {
+      job = worker->jobs[worker->head];
+      worker->head = (worker->head + 1) & mask;
+    }
+    worker->size--;
+  }
+  pthread_mutex_unlock(&worker->lock);
+  if (job != NULL) {
+    __atomic_sub_fetch(&worker->executor->queued, 1, __ATOMIC_SEQ_CST);
+  }
+  return job;
+}
+
+// Takes a job of `worker`, or steals one from the workers after it. The
+// workers of the same node are tried first. One of another node is robbed only
+// if it has a job waiting behind the next, since the memory of the job stays
+// on that node.
+static wasmbox_job_t *wasmbox_executor_take(wasmbox_executor_worker_t *worker) {
+  wasmbox_job_t *job = wasmbox_executor_pop(worker, 1, 1);
+  if (job != NULL) {
+    return job;
+  }
+  wasmbox_executor_t *executor = worker->executor;
+  wasm_u32_t self = worker - executor->workers;
+  for (int remote = 0; remote < (executor->node_size > 1 ? 2 : 1); remote++) {
+    for (wasm_u32_t i = 1; i < executor->worker_size; i++) {
+      wasmbox_executor_worker_t *victim =
+          &executor->workers[(self + i) % executor->worker_size];
+      if ((victim->node != worker->node) != remote) {
+        continue;
+      }
+      job = wasmbox_executor_pop(victim, 0, remote ? 2 : 1);
+      if (job != NULL) {
+        wasmbox_executor_count(&worker->stats.steals);
+        return job;
+      }
+    }
+  }
+  return NULL;
+}
+
+#define WASMBOX_EXECUTOR_CONTEXTS_INIT_SIZE (4)
+static void wasmbox_executor_add_context(wasmbox_context_t ***contexts,
+                                         wasm_u32_t *size,
+                                         wasm_u32_t *capacity,
+                                         wasmbox_context_t *ctx) {
+  if (*contexts == NULL) {
+    *capacity = WASMBOX_EXECUTOR_CONTEXTS_INIT_SIZE;
+    *contexts = (wasmbox_context_t **) wasmbox_malloc(
+        sizeof(wasmbox_context_t *) * *capacity);
+  } else if (*size == *capacity) {
+    *capacity *= 2;
+    *contexts = (wasmbox_context_t **) wasmbox_realloc(
+        *contexts, sizeof(wasmbox_context_t *) * *capacity);
+  }
+  (*contexts)[(*size)++] = ctx;
+}
+
+// Returns a context without a stopped call which runs on `instance`.
+static wasmbox_context_t *
+wasmbox_executor_context(wasmbox_executor_worker_t *worker,
+                         wasmbox_instance_t *instance) {
+  if (worker->context_size > 0) {
+    wasmbox_context_t *ctx = worker->contexts[--worker->context_size];
+    wasmbox_context_rebind(ctx, instance);
+    return ctx;
+  }
+  wasmbox_context_t *ctx = wasmbox_context_create(instance, 0);
+  if (ctx == NULL) {
+    return NULL;
+  }
+  wasmbox_executor_t *executor = worker->executor;
+  pthread_mutex_lock(&executor->lock);
+  wasmbox_executor_add_context(&executor->contexts, &executor->context_size,
+                               &executor->context_capacity, ctx);
+  pthread_mutex_unlock(&executor->lock);
+  return ctx;
+}
+
+static void wasmbox_executor_release_context(wasmbox_executor_worker_t *worker,
+                                             wasmbox_context_t *ctx) {
+  wasmbox_executor_add_context(&worker->contexts, &worker->context_size,
+                               &worker->context_capacity, ctx);
+}
+
+// Runs `job` until it is done, or until it runs out of its fuel slice and is
+// queued again.
+static void wasmbox_executor_run(wasmbox_executor_worker_t *worker,
+                                 wasmbox_job_t *job) {
+  wasmbox_executor_t *executor = worker->executor;
+  wasmbox_instance_t *instance = job->instance;
+  if (executor->fuel_slice > 0 && instance->fuel_metering) {
+    instance->fuel = executor->fuel_slice;
+  }
+  int ret;
+  if (job->context == NULL) {
+    job->context = wasmbox_executor_context(worker, instance);
+    ret = job->context != NULL ? wasmbox_context_call(job->context,
+                                                      job->function, job->args,
+                                                      job->results)
+                               : -1;
+  } else {
+    ret = wasmbox_context_resume(job->context, job->results);
+  }
+  wasmbox_executor_count(&worker->stats.runs);
+  if (ret == WASMBOX_OUT_OF_FUEL && executor->fuel_slice > 0) {
+    job->yields++;
+    wasmbox_executor_count(&worker->stats.yields);
+    wasmbox_executor_push(worker, job, 0);
+    return;
+  }
+  if (ret <= 0 && job->context != NULL) {
+    wasmbox_executor_release_context(worker, job->context);
+    job->context = NULL;
+  }
+  job->status = ret;
+  wasmbox_executor_count(&worker->stats.jobs);
+  if (job->done != NULL) {
+    job->done(job);
+  }
+  if (__atomic_sub_fetch(&executor->pending, 1, __ATOMIC_ACQ_REL) == 0) {
+    pthread_mutex_lock(&executor->lock);
+    pthread_cond_broadcast(&executor->idle);
+    pthread_mutex_unlock(&executor->lock);
+  }
+}
+
+static void *wasmbox_executor_work(void *data) {
+  wasmbox_executor_worker_t *worker = (wasmbox_executor_worker_t *) data;
+  wasmbox_executor_t *executor = worker->executor;
+  wasmbox_executor_current = worker;
+#ifdef __linux__
+  wasmbox_executor_node_t *node = &executor->nodes[worker->node];
+  if (node->has_cpus &&
+      pthread_setaffinity_np(pthread_self(), sizeof(node->cpus),
+                             &node->cpus) != 0) {
+    LOG("failed to keep worker on its node");
+  }
+#endif
+  for (;;) {
+    // Jobs left to workers of other nodes do not keep this one awake, but
+    // any job pushed after the check does.
+    wasm_u32_t pushes = __atomic_load_n(&executor->pushes, __ATOMIC_SEQ_CST);
+    wasmbox_job_t *job = wasmbox_executor_take(worker);
+    if (job != NULL) {
+      wasmbox_executor_run(worker, job);
+      continue;
+    }
+    pthread_mutex_lock(&executor->lock);
+    __atomic_add_fetch(&executor->sleeping, 1, __ATOMIC_SEQ_CST);
+    while (__atomic_load_n(&executor->pushes, __ATOMIC_SEQ_CST) == pushes &&
+           !executor->stopping) {
+      pthread_cond_wait(&executor->available, &executor->lock);
+    }
+    __atomic_sub_fetch(&executor->sleeping, 1, __ATOMIC_SEQ_CST);
+    int stop = executor->stopping &&
+               __atomic_load_n(&executor->queued, __ATOMIC_SEQ_CST) == 0;
+    pthread_mutex_unlock(&executor->lock);
+    if (stop) {
+      break;
+    }
+  }
+  wasmbox_executor_current = NULL;
+  return NULL;
+}
+
+#ifdef __linux__
+// Reads the list of numbers like "0-3,8" in `path` into `cpus`, and returns
+// the last one plus one, or 0 if it cannot be read.
+static wasm_u32_t wasmbox_executor_read_list(const char *path,
+                                             cpu_set_t *cpus) {
+  FILE *fp = fopen(path, "r");
+  if (fp == NULL) {
+    return 0;
+  }
+  wasm_u32_t end = 0;
+  unsigned first, last;
+  while (fscanf(fp, "%u", &first) == 1) {
+    last = first;
+    int c = fgetc(fp);
+    if (c == '-') {
+      if (fscanf(fp, "%u", &last) != 1) {
+        break;
+      }
+      c = fgetc(fp);
+    }
+    for (unsigned i = first; cpus != NULL && i <= last && i < CPU_SETSIZE;
+         i++) {
+      CPU_SET(i, cpus);
+    }
+    end = last + 1;
+    if (c != ',') {
+      break;
+    }
+  }
+  fclose(fp);
+  return end;
+}
+#endif
+
+// Spreads the workers over the online NUMA nodes, so that worker `i` is on node
+// `i * nodes / workers`.
+static void wasmbox_executor_init_nodes(wasmbox_executor_t *executor) {
+  wasm_u32_t nodes = 0;
+#ifdef __linux__
+  nodes = wasmbox_executor_read_list("/sys/devices/system/node/online", NULL);
+#endif
+  if (nodes == 0 || nodes > WASMBOX_MEMORY_MAX_NODES) {
+    nodes = 1;
+  }
+  executor->node_size = nodes;
+  executor->nodes = (wasmbox_executor_node_t *) wasmbox_malloc(
+      sizeof(wasmbox_executor_node_t) * nodes);
+  for (wasm_u32_t i = executor->worker_size; i-- > 0;) {
+    wasm_u32_t node = (wasm_u32_t) ((wasm_u64_t) i * nodes /
+                                    executor->worker_size);
+    executor->workers[i].node = node;
+    executor->nodes[node].first_worker = i;
+    executor->nodes[node].worker_size++;
+  }
+#ifdef __linux__
+  for (wasm_u32_t i = 0; nodes > 1 && i < nodes; i++) {
+    char path[64];
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%u/cpulist", i);
+    CPU_ZERO(&executor->nodes[i].cpus);
+    executor->nodes[i].has_cpus =
+        wasmbox_executor_read_list(path, &executor->nodes[i].cpus) > 0;
+  }
+#endif
+}
+
+wasmbox_executor_t *wasmbox_executor_create(wasm_u32_t workers,
+                                            wasm_s64_t fuel_slice) {
+  if (workers == 0) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    workers = cpus > 0 ? (wasm_u32_t) cpus : 1;
+  }
+  wasmbox_executor_t *executor =
+      (wasmbox_executor_t *) wasmbox_malloc(sizeof(wasmbox_executor_t));
+  executor->fuel_slice = fuel_slice;
+  pthread_mutex_init(&executor->lock, NULL);
+  pthread_cond_init(&executor->available, NULL);
+  pthread_cond_init(&executor->idle, NULL);
+  executor->workers = (wasmbox_executor_worker_t *) wasmbox_malloc(
+      sizeof(wasmbox_executor_worker_t) * workers);
+  for (wasm_u32_t i = 0; i < workers; i++) {
+    wasmbox_executor_worker_t *worker = &executor->workers[i];
+    worker->executor = executor;
+    pthread_mutex_init(&worker->lock, NULL);
+    worker->capacity = WASMBOX_EXECUTOR_RING_INIT_SIZE;
+    worker->jobs = (wasmbox_job_t **) wasmbox_malloc(sizeof(wasmbox_job_t *) *
+                                                     worker->capacity);
+  }
+  // Workers steal from the others, so they all exist before any starts.
+  executor->worker_size = workers;
+  wasmbox_executor_init_nodes(executor);
+  for (; executor->started < workers; executor->started++) {
+    wasmbox_executor_worker_t *worker = &executor->workers[executor->started];
+    if (pthread_create(&worker->thread, NULL, wasmbox_executor_work, worker) !=
+        0) {
+      LOG("failed to start worker");
+      break;
+    }
+  }
+  if (executor->started < workers) {
+    wasmbox_executor_dispose(executor);
+    return NULL;
+  }
+  return executor;
+}
+
+// Binding is best effort: where it fails the pages stay where they were
+// first touched.
+static void wasmbox_executor_bind(wasmbox_instance_t *instance,
+                                  wasm_u32_t node) {
+  if (instance->memory_block != NULL && !wasmbox_memory_is_shared(instance)) {
+    wasmbox_memory_bind(instance->memory_block->data,
+                        wasmbox_memory_reserved_size(instance), node);
+  }
+  if (instance->global_size > 0) {
+    wasmbox_memory_bind(instance->globals,
+                        sizeof(wasmbox_value_t) * instance->global_size, node);
+  }
+  wasmbox_value_t *stack = wasmbox_module_stack(instance);
+  if (stack != NULL) {
+    wasmbox_memory_bind(stack,
+                        sizeof(wasmbox_value_t) *
+                            wasmbox_module_stack_size(instance),
+                        node);
+  }
+}
+
+wasm_u32_t wasmbox_executor_place(wasmbox_executor_t *executor,
+                                  wasmbox_instance_t *instance) {
+  wasm_u32_t best = 0;
+  wasm_u32_t best_placed = 0;
+  for (wasm_u32_t i = 0; i < executor->node_size; i++) {
+    wasmbox_executor_node_t *node = &executor->nodes[i];
+    wasm_u32_t placed = __atomic_load_n(&node->placed, __ATOMIC_RELAXED);
+    if (node->worker_size > 0 &&
+        (executor->nodes[best].worker_size == 0 || placed < best_placed)) {
+      best = i;
+      best_placed = placed;
+    }
+  }
+  __atomic_add_fetch(&executor->nodes[best].placed, 1, __ATOMIC_RELAXED);
+  instance->home_node = best + 1;
+  // The contexts of the workers get their stacks from the node by first
+  // touch, so only the instance is moved.
+  if (executor->node_size > 1) {
+    wasmbox_executor_bind(instance, best);
+  }
+  return best;
+}
+
+int wasmbox_executor_submit(wasmbox_executor_t *executor, wasmbox_job_t *job) {
+  if (job->function->kind != WASMBOX_EXPORT_FUNCTION) {
+    LOG("not a function");
+    return -1;
+  }
+  __atomic_add_fetch(&executor->pending, 1, __ATOMIC_ACQ_REL);
+  wasmbox_executor_worker_t *worker = wasmbox_executor_current;
+  wasm_u32_t home = job->instance->home_node;
+  if (home > executor->node_size) {
+    home = 0;
+  }
+  if (worker == NULL || worker->executor != executor ||
+      (home != 0 && worker->node != home - 1)) {
+    if (home != 0) {
+      wasmbox_executor_node_t *node = &executor->nodes[home - 1];
+      wasm_u32_t next = __atomic_fetch_add(&node->next, 1, __ATOMIC_RELAXED);
+      worker =
+          &executor->workers[node->first_worker + next % node->worker_size];
+    } else {
+      wasm_u32_t next =
+          __atomic_fetch_add(&executor->next, 1, __ATOMIC_RELAXED);
+      worker = &executor->workers[next % executor->worker_size];
+    }
+  }
+  wasmbox_executor_push(worker, job, 1);
+  return 0;
+}
+
+void wasmbox_executor_wait(wasmbox_executor_t *executor) {
+  pthread_mutex_lock(&executor->lock);
+  while (__atomic_load_n(&executor->pending, __ATOMIC_ACQUIRE) > 0) {
+    pthread_cond_wait(&executor->idle, &executor->lock);
+  }
+  pthread_mutex_unlock(&executor->lock);
+}
+
+void wasmbox_executor_stats(wasmbox_executor_t *executor,
+                            wasmbox_executor_stats_t *stats) {
+  memset(stats, 0, sizeof(*stats));
+  for (wasm_u32_t i = 0; i < executor->worker_size; i++) {
+    wasmbox_executor_stats_t *s = &executor->workers[i].stats;
+    stats->jobs += __atomic_load_n(&s->jobs, __ATOMIC_RELAXED);
+    stats->runs += __atomic_load_n(&s->runs, __ATOMIC_RELAXED);
+    stats->yields += __atomic_load_n(&s->yields, __ATOMIC_RELAXED);
+    stats->steals += __atomic_load_n(&s->steals, __ATOMIC_RELAXED);
+  }
+}
+
+void wasmbox_executor_dispose(wasmbox_executor_t *executor) {
+  wasmbox_executor_wait(executor);
+  pthread_mutex_lock(&executor->lock);
+  executor->stopping = 1;
+  pthread_cond_broadcast(&executor->available);
+  pthread_mutex_unlock(&executor->lock);
+  for (wasm_u32_t i = 0; i < executor->started; i++) {
+    pthread_join(executor->workers[i].thread, NULL);
+  }
+  for (wasm_u32_t i = 0; i < executor->worker_size; i++) {
+    wasmbox_executor_worker_t *worker = &executor->workers[i];
+    pthread_mutex_destroy(&worker->lock);
+    wasmbox_free(worker->jobs);
+    if (worker->contexts != NULL) {
+      wasmbox_free(worker->contexts);
+    }
+  }
+  for (wasm_u32_t i = 0; i < executor->context_size; i++) {
+    wasmbox_context_dispose(executor->contexts[i]);
+  }
+  if (executor->contexts != NULL) {
+    wasmbox_free(executor->contexts);
+  }
+  wasmbox_free(executor->workers);
+  wasmbox_free(executor->nodes);
+  pthread_mutex_destroy(&executor->lock);
+  pthread_cond_destroy(&executor->available);
+  pthread_cond_destroy(&executor->idle);
+  wasmbox_free(executor);
+}
+
+void wasmbox_shards_split(wasmbox_shard_t *shards, wasm_u32_t shard_size,
+                          wasm_u32_t offset, wasm_u32_t size,
+                          wasm_u32_t align) {
+  if (align == 0) {
+    align = 1;
+  }
+  wasm_u32_t units = (wasm_u32_t) (((wasm_u64_t) size + align - 1) / align);
+  wasm_u32_t end = offset + size;
+  for (wasm_u32_t i = 0; i < shard_size; i++) {
+    // The first `units % shard_size` shards take one unit more.
+    wasm_u64_t first = (wasm_u64_t) units * i / shard_size;
+    wasm_u64_t last = (wasm_u64_t) units * (i + 1) / shard_size;
+    wasm_u64_t start = offset + first * align;
+    wasm_u64_t stop = offset + last * align;
+    shards[i].offset = start < end ? (wasm_u32_t) start : end;
+    shards[i].size = (stop < end ? (wasm_u32_t) stop : end) - shards[i].offset;
+    shards[i].status = 0;
+  }
+}
+
+/* A clone of the instance of a fork-join call, running one shard. */
+typedef struct wasmbox_executor_fork_t {
+  wasmbox_instance_t instance;
+  wasmbox_job_t job;
+  wasmbox_value_t args[2];
+  struct wasmbox_executor_join_t *join;
+} wasmbox_executor_fork_t;
+
+/* Counts down the shards of a fork-join call still running. */
+typedef struct wasmbox_executor_join_t {
+  pthread_mutex_t lock;
+  pthread_cond_t done;
+  wasm_u32_t running;
+} wasmbox_executor_join_t;
+
+static void wasmbox_executor_fork_done(wasmbox_job_t *job) {
+  wasmbox_executor_join_t *join = ((wasmbox_executor_fork_t *) job->data)->join;
+  pthread_mutex_lock(&join->lock);
+  if (--join->running == 0) {
+    pthread_cond_signal(&join->done);
+  }
+  pthread_mutex_unlock(&join->lock);
+}
+
+// Instantiates the compiled module of `instance` into `clone` with the
+// memory of `image`, or the shared memory, and the globals of `instance`.
+static int wasmbox_executor_clone(wasmbox_instance_t *clone,
+                                  wasmbox_instance_t *instance,
+                                  wasmbox_memory_image_t *image) {
+  clone->allocator = instance->allocator;
+  clone->use_huge_pages = instance->use_huge_pages;
+  clone->memory_image = image;
+  if (image == NULL) {
+    clone->shared_memory = instance->shared_memory;
+  }
+  if (wasmbox_instance_init(clone, instance->compiled) != 0) {
+    return -1;
+  }
+  if (instance->global_size > 0) {
+    memcpy(clone->globals, instance->globals,
+           sizeof(*instance->globals) * instance->global_size);
+  }
+  clone->fuel = instance->fuel;
+  clone->epoch = instance->epoch;
+  clone->epoch_deadline = instance->epoch_deadline;
+  clone->home_node = instance->home_node;
+  return 0;
+}
+
+int wasmbox_executor_fork_join(wasmbox_executor_t *executor,
+                               wasmbox_instance_t *instance,
+                               const wasmbox_export_t *function,
+                               wasmbox_shard_t *shards, wasm_u32_t shard_size,
+                               int write_back) {
+  if (instance->compiled == NULL) {
+    LOG("only instances of compiled modules fork");
+    return -1;
+  }
+  if (function->kind != WASMBOX_EXPORT_FUNCTION) {
+    LOG("not a function");
+    return -1;
+  }
+  const wasmbox_type_t *type = function->func->type;
+  if (type->argument_size != 2 || type->args[0] != WASM_TYPE_I32 ||
+      type->args[1] != WASM_TYPE_I32 || type->return_size > 1) {
+    LOG("a shard is called with an offset and a size");
+    return -1;
+  }
+  wasm_u64_t memory_size =
+      instance->memory_block != NULL
+          ? (wasm_u64_t) WASMBOX_PAGE_SIZE * wasmbox_memory_size(instance)
+          : 0;
+  for (wasm_u32_t i = 0; i < shard_size; i++) {
+    if ((wasm_u64_t) shards[i].offset + shards[i].size > memory_size) {
+      LOG("shard out of the memory");
+      return -1;
+    }
+  }
+  if (shard_size == 0) {
+    return 0;
+  }
+  wasmbox_memory_image_t *image = NULL;
+  if (instance->memory_block != NULL && !wasmbox_memory_is_shared(instance)) {
+    image = wasmbox_memory_image_create(instance);
+    if (image == NULL) {
+      return -1;
+    }
+  }
+  wasmbox_executor_fork_t *forks = (wasmbox_executor_fork_t *) wasmbox_malloc(
+      sizeof(wasmbox_executor_fork_t) * shard_size);
+  wasmbox_executor_join_t join;
+  pthread_mutex_init(&join.lock, NULL);
+  pthread_cond_init(&join.done, NULL);
+  join.running = shard_size;
+  wasm_u32_t cloned = 0;
+  while (cloned < shard_size &&
+         wasmbox_executor_clone(&forks[cloned].instance, instance, image) ==
+             0) {
+    cloned++;
+  }
+  int started = cloned == shard_size;
+  int ret = 0;
+  if (!started) {
+    LOG("failed to clone instance");
+    // The clone which failed is disposed with the others.
+    cloned++;
+    ret = -1;
+  }
+  for (wasm_u32_t i = 0; started && i < shard_size; i++) {
+    wasmbox_executor_fork_t *fork = &forks[i];
+    fork->args[0].u32 = shards[i].offset;
+    fork->args[1].u32 = shards[i].size;
+    fork->join = &join;
+    fork->job.instance = &fork->instance;
+    fork->job.function = function;
+    fork->job.args = fork->args;
+    fork->job.results = &shards[i].result;
+    fork->job.done = wasmbox_executor_fork_done;
+    fork->job.data = fork;
+    wasmbox_executor_submit(executor, &fork->job);
+  }
+  if (started) {
+    pthread_mutex_lock(&join.lock);
+    while (join.running > 0) {
+      pthread_cond_wait(&join.done, &join.lock);
+    }
+    pthread_mutex_unlock(&join.lock);
+  }
+  for (wasm_u32_t i = 0; i < cloned; i++) {
+    wasmbox_executor_fork_t *fork = &forks[i];
+    if (started) {
+      shards[i].status = fork->job.status;
+      if (shards[i].status != 0) {
+        ret = -1;
+      } else if (write_back && image != NULL && shards[i].size > 0) {
+        memcpy(instance->memory_block->data + shards[i].offset,
+               fork->instance.memory_block->data + shards[i].offset,
+               shards[i].size);
+      }
+    }
+    wasmbox_module_dispose(&fork->instance);
+  }
+  pthread_mutex_destroy(&join.lock);
+  pthread_cond_destroy(&join.done);
+  wasmbox_free(forks);
+  if (image != NULL) {
+    wasmbox_memory_image_dispose(image);
+  }
+  return ret;
+}
@@ -16,28 +16,79 @@
 
 #include "input-stream.h"
 
+#include "allocator.h"
 #include "wasmbox/wasmbox.h"
 
 #include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
 
+#ifdef __unix__
+#  include <fcntl.h>
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#  include <unistd.h>
+#endif
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+#ifdef __unix__
+static wasmbox_input_stream_t *wasmbox_input_stream_map(
+    wasmbox_input_stream_t *ins, const char *file_name) {
+  int fd = open(file_name, O_RDONLY);
+  if (fd < 0) {
+    return NULL;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0 ||
+      st.st_size > (off_t) WASM_U32_MAX) {
+    close(fd);
+    return NULL;
+  }
+  int flags = MAP_PRIVATE;
+#  ifdef MAP_POPULATE
+  // The whole module is parsed right away.
+  flags |= MAP_POPULATE;
+#  endif
+  void *data = mmap(NULL, (size_t) st.st_size, PROT_READ, flags, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    return NULL;
+  }
+#  ifdef MADV_SEQUENTIAL
+  madvise(data, (size_t) st.st_size, MADV_SEQUENTIAL);
+#  endif
+  ins->data = (wasm_u8_t *) data;
+  ins->length = (wasm_u32_t) st.st_size;
+  ins->index = 0;
+  ins->kind = WASMBOX_INPUT_STREAM_MAPPED;
+  return ins;
+}
+#endif
+
 wasmbox_input_stream_t *wasmbox_input_stream_open(wasmbox_input_stream_t *ins,
                                                   const char *file_name) {
   assert(ins != NULL);
+#ifdef __unix__
+  // Regular files are parsed from the page cache instead of a copy.
+  if (wasmbox_input_stream_map(ins, file_name) != NULL) {
+    return ins;
+  }
+#endif
 
   FILE *fp = fopen(file_name, "r");
-  assert(fp != NULL);
+  if (fp == NULL) {
+    return NULL;
+  }
   fseek(fp, 0, SEEK_END);
   ins->length = (size_t) ftell(fp);
   fseek(fp, 0, SEEK_SET);
   ins->index = 0;
+  ins->kind = WASMBOX_INPUT_STREAM_HEAP;
 
-  ins->data = (wasm_u8_t *) malloc(ins->length);
+  ins->data = (wasm_u8_t *) wasmbox_malloc_uninit(ins->length);
   size_t readed = fread(ins->data, 1, ins->length, fp);
   assert(ins->length == readed);
   fclose(fp);
@@ -45,6 +96,16 @@ wasmbox_input_stream_t *wasmbox_input_stream_open(wasmbox_input_stream_t *ins,
   return ins;
 }
 
+wasmbox_input_stream_t *wasmbox_input_stream_open_buffer(
+    wasmbox_input_stream_t *ins, const wasm_u8_t *data, wasm_u32_t length) {
+  assert(ins != NULL);
+  ins->data = (wasm_u8_t *) data;
+  ins->length = length;
+  ins->index = 0;
+  ins->kind = WASMBOX_INPUT_STREAM_BORROWED;
+  return ins;
+}
+
 int wasmbox_input_stream_is_end_of_stream(wasmbox_input_stream_t *ins) {
   return ins->index >= ins->length;
 }
@@ -73,7 +134,20 @@ wasm_u32_t wasmbox_input_stream_read_u32(wasmbox_input_stream_t *ins) {
 }
 
 void wasmbox_input_stream_close(wasmbox_input_stream_t *ins) {
-  free(ins->data);
+  switch (ins->kind) {
+#ifdef __unix__
+    case WASMBOX_INPUT_STREAM_MAPPED:
+      munmap(ins->data, ins->length);
+      break;
+#endif
+    case WASMBOX_INPUT_STREAM_BORROWED:
+      break;
+    default:
+      if (ins->data != NULL) {
+        wasmbox_free(ins->data);
+      }
+      break;
+  }
 }
 
 #ifdef __cplusplus
@@ -30,11 +30,21 @@ typedef struct wasmbox_input_stream_t {
   wasm_u32_t index;
   wasm_u32_t length;
   wasm_u8_t *data;
+  /* WASMBOX_INPUT_STREAM_* telling how the data is released. */
+  wasm_u8_t kind;
 } wasmbox_input_stream_t;
 
+#  define WASMBOX_INPUT_STREAM_HEAP     (0) /* malloc'ed copy of the file */
+#  define WASMBOX_INPUT_STREAM_MAPPED   (1) /* read-only mapping of the file */
+#  define WASMBOX_INPUT_STREAM_BORROWED (2) /* buffer owned by the caller */
+
 wasmbox_input_stream_t *wasmbox_input_stream_open(wasmbox_input_stream_t *ins,
                                                   const char *file_name);
 
+/* Reads `data` in place. Closing the stream leaves the buffer alone. */
+wasmbox_input_stream_t *wasmbox_input_stream_open_buffer(
+    wasmbox_input_stream_t *ins, const wasm_u8_t *data, wasm_u32_t length);
+
 int wasmbox_input_stream_is_end_of_stream(wasmbox_input_stream_t *ins);
 
 wasm_u8_t wasmbox_input_stream_peek_u8(wasmbox_input_stream_t *ins);
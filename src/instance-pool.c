@@ -0,0 +1,170 @@
+/*
+ * Copyright (C) 2021 Masahiro Ide
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "instance-pool.h"
+#include "allocator.h"
+#include "memory.h"
+#include <stdio.h>
+
+#ifdef WASMBOX_MEMORY_USE_RESERVATION
+#  include <sys/mman.h>
+#  include <unistd.h> // sysconf
+#endif
+
+#define LOG(MSG) fprintf(stderr, "(%s:%d)" MSG, __FILE__, __LINE__)
+
+struct wasmbox_instance_slot_t {
+  wasmbox_instance_slot_t *next;
+  wasmbox_instance_pool_t *pool;
+  wasm_u8_t *memory;
+  wasmbox_value_t *globals;
+  wasmbox_value_t *stack;
+};
+
+struct wasmbox_instance_pool_t {
+  wasmbox_instance_slot_t *slots;
+  wasmbox_instance_slot_t *free_slots;
+  wasm_u32_t slot_count;
+  wasm_u32_t global_count;
+  /* Number of values of the stack of every slot, which fills its pages. */
+  wasm_u32_t stack_size;
+  /* Globals and stack of every slot, `data_size` bytes each. */
+  wasm_u8_t *data;
+  wasm_u64_t data_size;
+  char lock;
+};
+
+#ifdef WASMBOX_MEMORY_USE_RESERVATION
+static void wasmbox_instance_pool_lock(wasmbox_instance_pool_t *pool) {
+  while (__atomic_test_and_set(&pool->lock, __ATOMIC_ACQUIRE)) {
+  }
+}
+
+static void wasmbox_instance_pool_unlock(wasmbox_instance_pool_t *pool) {
+  __atomic_clear(&pool->lock, __ATOMIC_RELEASE);
+}
+
+wasmbox_instance_pool_t *wasmbox_instance_pool_create(wasm_u32_t slot_count,
+                                                      wasm_u32_t global_count,
+                                                      wasm_u32_t stack_size) {
+  wasm_u64_t page = (wasm_u64_t) sysconf(_SC_PAGESIZE);
+  wasmbox_instance_pool_t *pool =
+      (wasmbox_instance_pool_t *) wasmbox_malloc(sizeof(*pool));
+  pool->global_count = global_count;
+  pool->data_size =
+      (sizeof(wasmbox_value_t) * ((wasm_u64_t) global_count + stack_size) +
+       page - 1) &
+      ~(page - 1);
+  pool->stack_size =
+      pool->data_size / sizeof(wasmbox_value_t) - global_count;
+  if (slot_count > 0 && pool->data_size > 0) {
+    void *data = mmap(NULL, pool->data_size * slot_count,
+                      PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+                      -1, 0);
+    if (data == MAP_FAILED) {
+      LOG("failed to map instance pool");
+      wasmbox_free(pool);
+      return NULL;
+    }
+    pool->data = (wasm_u8_t *) data;
+  }
+  pool->slots = (wasmbox_instance_slot_t *) wasmbox_malloc(
+      sizeof(wasmbox_instance_slot_t) * slot_count);
+  for (wasm_u32_t i = 0; i < slot_count; ++i) {
+    wasmbox_instance_slot_t *slot = &pool->slots[i];
+    slot->memory = wasmbox_memory_reserve(0);
+    if (slot->memory == NULL) {
+      LOG("failed to reserve instance memory");
+      wasmbox_instance_pool_dispose(pool);
+      return NULL;
+    }
+    pool->slot_count = i + 1;
+    slot->pool = pool;
+    slot->globals = (wasmbox_value_t *) (pool->data + pool->data_size * i);
+    slot->stack = slot->globals + global_count;
+    slot->next = pool->free_slots;
+    pool->free_slots = slot;
+  }
+  return pool;
+}
+
+void wasmbox_instance_pool_dispose(wasmbox_instance_pool_t *pool) {
+  for (wasm_u32_t i = 0; i < pool->slot_count; ++i) {
+    wasmbox_memory_unreserve(pool->slots[i].memory);
+  }
+  if (pool->data != NULL) {
+    munmap(pool->data, pool->data_size * pool->slot_count);
+  }
+  wasmbox_free(pool->slots);
+  wasmbox_free(pool);
+}
+
+wasmbox_instance_slot_t *
+wasmbox_instance_pool_acquire(wasmbox_instance_pool_t *pool) {
+  wasmbox_instance_pool_lock(pool);
+  wasmbox_instance_slot_t *slot = pool->free_slots;
+  if (slot != NULL) {
+    pool->free_slots = slot->next;
+  }
+  wasmbox_instance_pool_unlock(pool);
+  return slot;
+}
+
+void wasmbox_instance_pool_release(wasmbox_instance_slot_t *slot) {
+  wasmbox_instance_pool_t *pool = slot->pool;
+  // Pages which were never touched cost nothing to drop.
+  if (pool->data_size > 0) {
+    madvise(slot->globals, pool->data_size, MADV_DONTNEED);
+  }
+  wasmbox_instance_pool_lock(pool);
+  slot->next = pool->free_slots;
+  pool->free_slots = slot;
+  wasmbox_instance_pool_unlock(pool);
+}
+#else
+wasmbox_instance_pool_t *wasmbox_instance_pool_create(wasm_u32_t slot_count,
+                                                      wasm_u32_t global_count,
+                                                      wasm_u32_t stack_size) {
+  LOG("instance pools need reserved memory");
+  return NULL;
+}
+
+void wasmbox_instance_pool_dispose(wasmbox_instance_pool_t *pool) {}
+
+wasmbox_instance_slot_t *
+wasmbox_instance_pool_acquire(wasmbox_instance_pool_t *pool) {
+  return NULL;
+}
+
+void wasmbox_instance_pool_release(wasmbox_instance_slot_t *slot) {}
+#endif /* WASMBOX_MEMORY_USE_RESERVATION */
+
+wasm_u8_t *wasmbox_instance_slot_memory(wasmbox_instance_slot_t *slot) {
+  return slot->memory;
+}
+
+wasmbox_value_t *wasmbox_instance_slot_globals(wasmbox_instance_slot_t *slot,
+                                               wasm_u32_t size) {
+  return size <= slot->pool->global_count ? slot->globals : NULL;
+}
+
+wasmbox_value_t *wasmbox_module_stack(wasmbox_module_t *mod) {
+  return mod->instance_slot != NULL ? mod->instance_slot->stack : NULL;
+}
+
+wasm_u32_t wasmbox_module_stack_size(wasmbox_module_t *mod) {
+  return mod->instance_slot != NULL ? mod->instance_slot->pool->stack_size : 0;
+}
@@ -0,0 +1,53 @@
+/*
+ * Copyright (C) 2021 Masahiro Ide
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef WASMBOX_INSTANCE_POOL_H
+#define WASMBOX_INSTANCE_POOL_H
+
+#include "wasmbox/wasmbox.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Takes a free slot of `pool`, or returns NULL if every slot is in use. The
+ * memory of a slot is inaccessible and its globals and stack are zeroed.
+ */
+wasmbox_instance_slot_t *
+wasmbox_instance_pool_acquire(wasmbox_instance_pool_t *pool);
+
+/**
+ * Returns `slot` to its pool and drops the pages of its globals and stack.
+ * The memory must have been decommitted (see wasmbox_memory_dispose).
+ */
+void wasmbox_instance_pool_release(wasmbox_instance_slot_t *slot);
+
+/* Reserved memory of `slot`, see wasmbox_memory_reserve. */
+wasm_u8_t *wasmbox_instance_slot_memory(wasmbox_instance_slot_t *slot);
+
+/* Returns the globals of `slot` if it has room for `size` of them. */
+wasmbox_value_t *wasmbox_instance_slot_globals(wasmbox_instance_slot_t *slot,
+                                               wasm_u32_t size);
+
+/* Number of values of wasmbox_module_stack(mod), or 0. */
+wasm_u32_t wasmbox_module_stack_size(wasmbox_module_t *mod);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* end of include guard */
@@ -0,0 +1,63 @@
+/*
+ * Copyright (C) 2021 Masahiro Ide
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * The interpreter loop, included from interpreter.c once per CPU level it is
+ * built for. WASMBOX_VM_ISA names the level; every symbol defined here is
+ * suffixed by it via WASMBOX_VM_ISA_NAME(X).
+ * No include guard: this file is meant to be included once per level.
+ */
+
+#ifdef WASMBOX_VM_USE_TAIL_CALL_DISPATCH
+// Handlers are functions which take over the VM state in their arguments.
+#  define LABELS WASMBOX_VM_ISA_NAME(wasmbox_labels)
+static void *LABELS[OPCODE_THREADED_CODE + 1];
+
+#  include "interpreter-handlers.h"
+
+static void *LABELS[OPCODE_THREADED_CODE + 1] = {
+#  include "interpreter-labels.h"
+};
+
+static void WASMBOX_VM_ISA_NAME(wasmbox_eval_function)(
+    wasmbox_module_t *mod, wasmbox_code_t *code, wasmbox_value_t *stack) {
+#  ifdef WASMBOX_VM_USE_ACCUMULATOR
+  wasmbox_value_t acc = {};
+#  endif
+  wasm_u32_t sp = wasmbox_runtime_load_sp(mod);
+  // `code` may not be labelled yet (e.g. THREADED_CODE at VM init).
+  ((wasmbox_op_handler_t) LABELS[code->h.opcode])(mod, code,
+                                                  stack ACC_ARG SP_ARG);
+}
+#  undef LABELS
+#else
+static void WASMBOX_VM_ISA_NAME(wasmbox_eval_function)(
+    wasmbox_module_t *mod, wasmbox_code_t *code, wasmbox_value_t *stack) {
+#  ifdef WASMBOX_VM_USE_DIRECT_THREADED_CODE
+  static void *LABELS[] = {
+#    include "interpreter-labels.h"
+  };
+#  endif
+#  ifdef WASMBOX_VM_USE_ACCUMULATOR
+  wasmbox_value_t acc = {};
+#  endif
+  wasm_u32_t sp = wasmbox_runtime_load_sp(mod);
+  DISPATCH_START(code) {
+#  include "interpreter-handlers.h"
+  }
+  DISPATCH_END(code);
+}
+#endif /* WASMBOX_VM_USE_TAIL_CALL_DISPATCH */
@@ -0,0 +1,1662 @@
+/*
+ * Copyright (C) 2021 Masahiro Ide
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Instruction handlers of the interpreter, included from interpreter.c. The
+ * dispatch mode defines CASE(X) to start the handler of OPCODE_X and
+ * GOTO_NEXT(PC) to transfer control to the handler of PC. Handlers are either
+ * labels in wasmbox_eval_function or functions (tail-call dispatch).
+ * COLD_CASE(X) starts a handler which is rare in the opcode profiles of
+ * bench/ (traps, set-up, memory and table management, waits and the
+ * conversions between integers and floats), placed out of the hot path.
+ * No include guard: this file is meant to be included where handlers are
+ * expanded.
+ */
+
+COLD_CASE(THREADED_CODE) {
+#if defined(WASMBOX_VM_USE_DIRECT_THREADED_CODE) || \
+    defined(WASMBOX_VM_USE_TAIL_CALL_DISPATCH)
+  stack[0].u64 = (wasm_u64_t) (uintptr_t) LABELS;
+#endif
+  return;
+}
+COLD_CASE(UNREACHABLE) {
+  wasmbox_trap("unreachable");
+}
+COLD_CASE(NOP) {
+  /* do nothing */
+  code++;
+  GOTO_NEXT(code);
+}
+CASE(SELECT) {
+  if (stack[code->op1.reg].u32) {
+    stack[code->op0.reg].u64 = stack[code->op2.r.reg1].u64;
+  } else {
+    stack[code->op0.reg].u64 = stack[code->op2.r.reg2].u64;
+  }
+  code++;
+  GOTO_NEXT(code);
+}
+CASE(EXIT) {
+  return;
+}
+CASE(RETURN) {
+  code = WASMBOX_FRAME_RETURN_CODE(stack);
+  stack = WASMBOX_FRAME_CALLER(stack);
+  GOTO_NEXT(code);
+}
+CASE(MOVE) {
+  stack[code->op0.reg].u64 = stack[code->op1.reg].u64;
+  code++;
+  GOTO_NEXT(code);
+}
+CASE(JUMP) {
+  code = WASMBOX_CODE_TARGET(code, op0);
+  GOTO_NEXT(code);
+}
+CASE(JUMP_IF) {
+  if (ACC_OPERAND(op1, WASMBOX_ACC_OP1).u32) {
+    code = WASMBOX_CODE_TARGET(code, op0);
+  } else {
+    code++;
+  }
+  GOTO_NEXT(code);
+}
+CASE(JUMP_TABLE) {
+  wasm_u32_t index = stack[code->op2.reg].u32;
+  if (index < code->op0.index) {
+    wasmbox_jump_target_t *target = WASMBOX_JUMP_TABLE_TARGETS(code) + index;
+#ifdef WASMBOX_VM_USE_CODE_LABEL
+    code = target->code;
+    GOTO_LABEL(code, target->label);
+#else
+    code = WASMBOX_JUMP_TARGET_CODE(code, target);
+#endif
+  } else {
+    code = WASMBOX_CODE_TARGET(code, op1);
+  }
+  GOTO_NEXT(code);
+}
+CASE(DYNAMIC_CALL) {
+  wasmbox_call_cache_t *cache = WASMBOX_CODE_CACHE(code, op1);
+  wasmbox_value_t *stack_top =
+      &stack[code->op0.reg] + cache->type->return_size;
+  wasmbox_table_entry_t *entry = wasmbox_runtime_table_lookup(
+      mod, cache, stack[code->op2.reg].u32, stack_top);
+#ifdef WASMBOX_VM_USE_LAZY_COMPILE
+  wasmbox_runtime_profile_call(mod, cache, entry);
+#endif
+  WASMBOX_FRAME_LINK(stack_top, stack, code + 1);
+  stack = stack_top;
+  code = entry->code;
+  GOTO_NEXT(code);
+}
+CASE(STATIC_CALL) {
+  wasmbox_function_t *func = WASMBOX_CODE_FUNC(mod, code, op1);
+  wasmbox_value_t *stack_top = &stack[code->op0.reg] + code->op2.index;
+  WASMBOX_RUNTIME_CHECK_FRAME(mod, stack_top, func->frame_size);
+  WASMBOX_FRAME_LINK(stack_top, stack, code + 1);
+  stack = stack_top;
+  code = WASMBOX_FUNCTION_CODE(func);
+  GOTO_NEXT(code);
+}
+#define TAIL_CALL(TYPE, CALLEE)                                           \
+  do {                                                                    \
+    wasmbox_value_t *args = &stack[code->op0.reg] + (TYPE)->return_size + \
+                            WASMBOX_FUNCTION_CALL_OFFSET;                 \
+    memmove(stack + WASMBOX_FUNCTION_CALL_OFFSET, args,                   \
+            sizeof(wasmbox_value_t) * (TYPE)->argument_size);             \
+    code = (CALLEE);                                                      \
+  } while (0)
+CASE(DYNAMIC_TAIL_CALL) {
+  // Reuse the current frame. The return link in stack[0] and stack[1] is
+  // kept, so the callee returns to the caller of the current function.
+  wasmbox_call_cache_t *cache = WASMBOX_CODE_CACHE(code, op1);
+  wasmbox_table_entry_t *entry = wasmbox_runtime_table_lookup(
+      mod, cache, stack[code->op2.reg].u32, stack);
+  TAIL_CALL(cache->type, entry->code);
+  GOTO_NEXT(code);
+}
+CASE(STATIC_TAIL_CALL) {
+  wasmbox_function_t *func = WASMBOX_CODE_FUNC(mod, code, op1);
+  WASMBOX_RUNTIME_CHECK_FRAME(mod, stack, func->frame_size);
+  TAIL_CALL(func->type, WASMBOX_FUNCTION_CODE(func));
+  GOTO_NEXT(code);
+}
+#undef TAIL_CALL
+CASE(JIT_ENTRY) {
+#ifdef WASMBOX_NATIVE_CODE_ENABLED
+  wasmbox_jit_entry_t entry =
+      (wasmbox_jit_entry_t) (uintptr_t) WASMBOX_CODE_VALUE(code, op0).u64;
+  entry(mod, stack);
+  sp = wasmbox_runtime_load_sp(mod);
+  code = WASMBOX_FRAME_RETURN_CODE(stack);
+  stack = WASMBOX_FRAME_CALLER(stack);
+  GOTO_NEXT(code);
+#else
+  NOT_IMPLEMENTED();
+#endif
+}
+CASE(HOTNESS) {
+#ifdef WASMBOX_VM_USE_LAZY_COMPILE
+  // The count is a hint, so threads running the function may race on it.
+  wasmbox_mutable_function_t *func =
+      (wasmbox_mutable_function_t *) WASMBOX_CODE_FUNC(mod, code, op1);
+  wasm_s32_t hotness = __atomic_load_n(&func->hotness, __ATOMIC_RELAXED) - 1;
+  __atomic_store_n(&func->hotness, hotness, __ATOMIC_RELAXED);
+  if (__builtin_expect(hotness <= 0, 0)) {
+    wasmbox_code_t *resume =
+        wasmbox_module_tier_up(mod, &func->base, code->op0.index);
+    // Inlined callees may need a larger frame, which might not fit.
+    if (resume != NULL && stack + func->base.frame_size <= mod->stack_end) {
+      WASMBOX_RUNTIME_CHECK_FRAME(mod, stack, func->base.frame_size);
+      code = resume;
+      GOTO_NEXT(code);
+    }
+  }
+  code++;
+  GOTO_NEXT(code);
+#else
+  NOT_IMPLEMENTED();
+#endif
+}
+COLD_CASE(LAZY_COMPILE) {
+#ifdef WASMBOX_VM_USE_LAZY_COMPILE
+  // The frame of the callee is already set up. Run its code once compiled.
+  wasmbox_function_t *func = WASMBOX_CODE_FUNC(mod, code, op1);
+  if (wasmbox_module_compile_function(mod, func) != 0) {
+    wasmbox_trap("failed to compile function");
+  }
+  // The caller checked the frame before its size was known.
+  WASMBOX_RUNTIME_CHECK_FRAME(mod, stack, func->frame_size);
+  code = func->code;
+  GOTO_NEXT(code);
+#else
+  NOT_IMPLEMENTED();
+#endif
+}
+#define COMPARE_AND_BRANCH_COND_unary(type, operand) \
+  (ACC_OPERAND(op1, WASMBOX_ACC_OP1).type operand 0)
+#define COMPARE_AND_BRANCH_COND_binary(type, operand)  \
+  (ACC_OPERAND(op1, WASMBOX_ACC_OP1).type operand      \
+       ACC_OPERAND(op2, WASMBOX_ACC_OP2).type)
+#define FUNC(param, type, operand, cmp, vmopcode)         \
+  CASE(JUMP_IF_##cmp) {                                   \
+    if (COMPARE_AND_BRANCH_COND_##param(type, operand)) { \
+      code = WASMBOX_CODE_TARGET(code, op0);              \
+    } else {                                              \
+      code++;                                             \
+    }                                                     \
+    GOTO_NEXT(code);                                      \
+  }
+COMPARE_AND_BRANCH_INST_EACH(FUNC)
+#undef FUNC
+#define FUNC(type, operand, cmp, vmopcode)                               \
+  CASE(LOOP_INC_##cmp) {                                                 \
+    stack[code->op1.reg].u32 += (wasm_u32_t) code->op2.r.reg2;           \
+    if (stack[code->op1.reg].type operand stack[code->op2.r.reg1].type) { \
+      code = WASMBOX_CODE_TARGET(code, op0);                             \
+    } else {                                                             \
+      code++;                                                            \
+    }                                                                    \
+    GOTO_NEXT(code);                                                     \
+  }
+LOOP_INC_INST_EACH(FUNC)
+#undef FUNC
+#define FUNC(wtype, type, operand, inst, vmopcode)              \
+  CASE(inst##_IMM) {                                            \
+    ACC_RESULT(type, ACC_OPERAND(op1, WASMBOX_ACC_OP1).type     \
+                         operand WASMBOX_CODE_VALUE(code, op2).type); \
+    code++;                                                     \
+    GOTO_NEXT(code);                                            \
+  }
+IMMEDIATE_INST_EACH(FUNC)
+#undef FUNC
+CASE(I32_DIV_U_MAGIC) {
+  ACC_RESULT(u32, wasmbox_runtime_div_u32(
+                      ACC_OPERAND(op1, WASMBOX_ACC_OP1).u32,
+                      WASMBOX_CODE_VALUE(code, op2).u64));
+  code++;
+  GOTO_NEXT(code);
+}
+CASE(I32_REM_U_MAGIC) {
+  wasm_u32_t x = ACC_OPERAND(op1, WASMBOX_ACC_OP1).u32;
+  wasm_u64_t magic = WASMBOX_CODE_VALUE(code, op2).u64;
+  ACC_RESULT(u32, x - wasmbox_runtime_div_u32(x, magic) * (wasm_u32_t) magic);
+  code++;
+  GOTO_NEXT(code);
+}
+CASE(I32_DIV_S_MAGIC) {
+  ACC_RESULT(s32, wasmbox_runtime_div_s32(
+                      ACC_OPERAND(op1, WASMBOX_ACC_OP1).s32,
+                      WASMBOX_CODE_VALUE(code, op2).u64));
+  code++;
+  GOTO_NEXT(code);
+}
+CASE(I32_REM_S_MAGIC) {
+  wasm_s32_t x = ACC_OPERAND(op1, WASMBOX_ACC_OP1).s32;
+  wasm_u64_t magic = WASMBOX_CODE_VALUE(code, op2).u64;
+  ACC_RESULT(u32, (wasm_u32_t) x - (wasm_u32_t) wasmbox_runtime_div_s32(
+                                       x, magic) * (wasm_u32_t) magic);
+  code++;
+  GOTO_NEXT(code);
+}
+CASE(GLOBAL_GET) {
+  stack[code->op0.reg].u64 = mod->globals[code->op1.index].u64;
+  code++;
+  GOTO_NEXT(code);
+}
+CASE(GLOBAL_SET) {
+  mod->globals[code->op0.index].u64 = stack[code->op1.reg].u64;
+  code++;
+  GOTO_NEXT(code);
+}
+CASE(STACK_POINTER_GET) {
+  stack[code->op0.reg].u64 = sp;
+  code++;
+  GOTO_NEXT(code);
+}
+CASE(STACK_POINTER_SET) {
+  sp = stack[code->op1.reg].u32 + code->op2.index;
+  mod->globals[code->op0.index].u64 = sp;
+  code++;
+  GOTO_NEXT(code);
+}
+CASE(STACK_POINTER_ADD) {
+  sp += code->op2.index;
+  stack[code->op0.reg].u64 = sp;
+  mod->globals[code->op1.index].u64 = sp;
+  code++;
+  GOTO_NEXT(code);
+}
+CASE(ZERO_LOCALS) {
+  memset(&stack[code->op0.reg], 0, sizeof(wasmbox_value_t) * code->op1.index);
+  code++;
+  GOTO_NEXT(code);
+}
+CASE(MODULE_CALL) {
+  wasmbox_module_link_t *link =
+      (wasmbox_module_link_t *) (uintptr_t) WASMBOX_CODE_VALUE(code, op1).u64;
+  wasmbox_function_t *func = link->func;
+  wasmbox_value_t *stack_top =
+      &stack[code->op0.reg] + func->type->return_size;
+  WASMBOX_RUNTIME_CHECK_FRAME(mod, stack_top, func->frame_size);
+  stack[code->op2.reg].u64 = (wasm_u64_t) (uintptr_t) mod;
+  WASMBOX_FRAME_LINK(stack_top, stack, code + 1);
+  mod = wasmbox_runtime_module_enter(mod, link->module);
+  sp = wasmbox_runtime_load_sp(mod);
+  stack = stack_top;
+  code = WASMBOX_FUNCTION_CODE(func);
+  GOTO_NEXT(code);
+}
+CASE(MODULE_RESTORE) {
+  mod = wasmbox_runtime_module_leave(
+      mod, (wasmbox_module_t *) (uintptr_t) stack[code->op0.reg].u64);
+  sp = wasmbox_runtime_load_sp(mod);
+  code++;
+  GOTO_NEXT(code);
+}
+
+#define LOAD_OP(itype, otype, out_type)                                      \
+  do {                                                                       \
+    wasm_u64_t addr =                                                        \
+        (wasm_u64_t) stack[code->op1.reg].u32 + code->op2.index;             \
+    WASMBOX_MEMORY_CHECK(mod, addr, sizeof(itype));                          \
+    stack[code->op0.reg].otype =                                             \
+        (out_type) * (itype *) &mod->memory_block->data[addr];               \
+    WASMBOX_MEMORY_PROFILE(mod, addr, reads);                                \
+    code++;                                                                  \
+  } while (0)
+CASE(I32_LOAD) {
+  LOAD_OP(wasm_u32_t, u32, wasm_u32_t);
+  GOTO_NEXT(code);
+}
+CASE(I64_LOAD) {
+  LOAD_OP(wasm_u64_t, u64, wasm_u64_t);
+  GOTO_NEXT(code);
+}
+CASE(F32_LOAD) {
+  LOAD_OP(wasm_f32_t, f32, wasm_f32_t);
+  GOTO_NEXT(code);
+}
+CASE(F64_LOAD) {
+  LOAD_OP(wasm_f64_t, f64, wasm_f64_t);
+  GOTO_NEXT(code);
+}
+CASE(I32_LOAD8_S) {
+  LOAD_OP(wasm_s8_t, s32, wasm_s32_t);
+  GOTO_NEXT(code);
+}
+CASE(I32_LOAD8_U) {
+  LOAD_OP(wasm_u8_t, u32, wasm_u32_t);
+  GOTO_NEXT(code);
+}
+CASE(I32_LOAD16_S) {
+  LOAD_OP(wasm_s16_t, s32, wasm_s32_t);
+  GOTO_NEXT(code);
+}
+CASE(I32_LOAD16_U) {
+  LOAD_OP(wasm_u16_t, u32, wasm_u32_t);
+  GOTO_NEXT(code);
+}
+CASE(I64_LOAD8_S) {
+  LOAD_OP(wasm_s8_t, s64, wasm_s64_t);
+  GOTO_NEXT(code);
+}
+CASE(I64_LOAD8_U) {
+  LOAD_OP(wasm_u8_t, u64, wasm_u64_t);
+  GOTO_NEXT(code);
+}
+CASE(I64_LOAD16_S) {
+  LOAD_OP(wasm_s16_t, s64, wasm_s64_t);
+  GOTO_NEXT(code);
+}
+CASE(I64_LOAD16_U) {
+  LOAD_OP(wasm_u16_t, u64, wasm_u64_t);
+  GOTO_NEXT(code);
+}
+CASE(I64_LOAD32_S) {
+  LOAD_OP(wasm_s32_t, s64, wasm_s64_t);
+  GOTO_NEXT(code);
+}
+CASE(I64_LOAD32_U) {
+  LOAD_OP(wasm_u32_t, u64, wasm_u64_t);
+  GOTO_NEXT(code);
+}
+#define STORE_OP(itype, otype)                                               \
+  do {                                                                       \
+    wasm_u64_t addr =                                                        \
+        (wasm_u64_t) stack[code->op0.reg].u32 + code->op2.index;             \
+    WASMBOX_MEMORY_CHECK(mod, addr, sizeof(otype));                          \
+    *(otype *) &mod->memory_block->data[addr] =                              \
+        (otype) stack[code->op1.reg].itype;                                  \
+    WASMBOX_MEMORY_PROFILE(mod, addr, writes);                               \
+    code++;                                                                  \
+  } while (0)
+CASE(I32_STORE) {
+  STORE_OP(u32, wasm_u32_t);
+  GOTO_NEXT(code);
+}
+CASE(I64_STORE) {
+  STORE_OP(u64, wasm_u64_t);
+  GOTO_NEXT(code);
+}
+CASE(F32_STORE) {
+  STORE_OP(f32, wasm_f32_t);
+  GOTO_NEXT(code);
+}
+CASE(F64_STORE) {
+  STORE_OP(f64, wasm_f64_t);
+  GOTO_NEXT(code);
+}
+CASE(I32_STORE8) {
+  STORE_OP(u32, wasm_u8_t);
+  GOTO_NEXT(code);
+}
+CASE(I32_STORE16) {
+  STORE_OP(u32, wasm_u16_t);
+  GOTO_NEXT(code);
+}
+CASE(I64_STORE8) {
+  STORE_OP(u64, wasm_u8_t);
+  GOTO_NEXT(code);
+}
+CASE(I64_STORE16) {
+  STORE_OP(u64, wasm_u16_t);
+  GOTO_NEXT(code);
+}
+CASE(I64_STORE32) {
+  STORE_OP(u64, wasm_u32_t);
+  GOTO_NEXT(code);
+}
+#define INDEXED_ACCESS_load(mtype, field)                                    \
+  stack[code->op0.r.reg1].field = *(mtype *) &mod->memory_block->data[addr]; \
+  WASMBOX_MEMORY_PROFILE(mod, addr, reads)
+#define INDEXED_ACCESS_store(mtype, field)    \
+  *(mtype *) &mod->memory_block->data[addr] = \
+      (mtype) stack[code->op0.r.reg1].field;  \
+  WASMBOX_MEMORY_PROFILE(mod, addr, writes)
+#define INDEXED_ADDRESS()                                                 \
+  wasm_u32_t index = stack[code->op1.r.reg2].u32                        \
+                     << (wasm_u32_t) code->op0.r.reg2;                  \
+  wasm_u64_t addr =                                                     \
+      (wasm_u64_t) (wasm_u32_t) (stack[code->op1.r.reg1].u32 + index) + \
+      code->op2.index
+#define FUNC(inst, mtype, field, unfused, vmopcode) \
+  CASE(unfused##_INDEXED) {                         \
+    INDEXED_ADDRESS();                              \
+    WASMBOX_MEMORY_CHECK(mod, addr, sizeof(mtype)); \
+    INDEXED_ACCESS_##inst(mtype, field);            \
+    code++;                                         \
+    GOTO_NEXT(code);                                \
+  }                                                 \
+  CASE(unfused##_INDEXED_UNCHECKED) {               \
+    INDEXED_ADDRESS();                              \
+    INDEXED_ACCESS_##inst(mtype, field);            \
+    code++;                                         \
+    GOTO_NEXT(code);                                \
+  }
+INDEXED_MEMORY_INST_EACH(FUNC)
+#undef FUNC
+#define FUNC(size, shift, vmopcode)                                    \
+  CASE(MEMORY_GUARD_##size) {                                          \
+    wasm_u32_t index = stack[code->op1.r.reg1].u32;                    \
+    wasm_u32_t limit = stack[code->op1.r.reg2].u32;                    \
+    if (index < limit &&                                               \
+        ((wasm_u64_t) (limit - 1) << shift) + code->op2.index <=       \
+            (wasm_u64_t) mod->memory_block_size * WASMBOX_PAGE_SIZE) { \
+      code++;                                                          \
+    } else {                                                           \
+      code = WASMBOX_CODE_TARGET(code, op0);                           \
+    }                                                                  \
+    GOTO_NEXT(code);                                                   \
+  }
+MEMORY_GUARD_INST_EACH(FUNC)
+#undef FUNC
+#define MEMORY64_ADDRESS_load  op1
+#define MEMORY64_ADDRESS_store op0
+#define MEMORY64_ACCESS_load(mtype, field)                                \
+  stack[code->op0.reg].field = *(mtype *) &mod->memory_block->data[addr]; \
+  WASMBOX_MEMORY_PROFILE(mod, addr, reads)
+#define MEMORY64_ACCESS_store(mtype, field)   \
+  *(mtype *) &mod->memory_block->data[addr] = \
+      (mtype) stack[code->op1.reg].field;     \
+  WASMBOX_MEMORY_PROFILE(mod, addr, writes)
+#define FUNC(inst, mtype, field, unfused, vmopcode)                         \
+  CASE(unfused##_MEMORY64) {                                                \
+    wasm_u64_t addr = stack[code->MEMORY64_ADDRESS_##inst.reg].u64;         \
+    wasm_u64_t limit =                                                      \
+        (wasm_u64_t) mod->memory_block_size * WASMBOX_PAGE_SIZE;            \
+    if (addr > limit ||                                                     \
+        limit - addr < (wasm_u64_t) code->op2.index + sizeof(mtype)) {      \
+      wasmbox_trap("out of bounds memory access");                          \
+    }                                                                       \
+    addr += code->op2.index;                                                \
+    MEMORY64_ACCESS_##inst(mtype, field);                                   \
+    code++;                                                                 \
+    GOTO_NEXT(code);                                                        \
+  }
+MEMORY64_INST_EACH(FUNC)
+#undef FUNC
+COLD_CASE(MEMORY_SIZE) {
+  stack[code->op0.reg].u64 = wasmbox_runtime_memory_size(mod);
+  code++;
+  GOTO_NEXT(code);
+}
+COLD_CASE(MEMORY_GROW) {
+  stack[code->op0.reg].u64 =
+      wasmbox_runtime_memory_grow(mod, stack[code->op1.reg]);
+  code++;
+  GOTO_NEXT(code);
+}
+COLD_CASE(MEMORY_INIT) {
+  wasmbox_runtime_memory_init(mod, code->op0.index, stack[code->op1.r.reg1],
+                              stack[code->op1.r.reg2].u32,
+                              stack[code->op2.reg].u32);
+  code++;
+  GOTO_NEXT(code);
+}
+COLD_CASE(DATA_DROP) {
+  wasmbox_runtime_data_drop(mod, code->op0.index);
+  code++;
+  GOTO_NEXT(code);
+}
+CASE(MEMORY_COPY) {
+  wasmbox_runtime_memory_copy(mod, stack[code->op0.reg], stack[code->op1.reg],
+                              stack[code->op2.reg]);
+  code++;
+  GOTO_NEXT(code);
+}
+CASE(MEMORY_FILL) {
+  wasmbox_runtime_memory_fill(mod, stack[code->op0.reg],
+                              (wasm_u8_t) stack[code->op1.reg].u32,
+                              stack[code->op2.reg]);
+  code++;
+  GOTO_NEXT(code);
+}
+COLD_CASE(REF_FUNC) {
+  stack[code->op0.reg].u64 =
+      (wasm_u64_t) (uintptr_t) WASMBOX_CODE_FUNC(mod, code, op1);
+  code++;
+  GOTO_NEXT(code);
+}
+CASE(TABLE_GET) {
+  wasmbox_ref_table_t *table = &mod->tables[code->op2.index];
+  wasm_u32_t index = stack[code->op1.reg].u32;
+  if (index >= table->size) {
+    wasmbox_trap("out of bounds table access");
+  }
+  stack[code->op0.reg].u64 = table->entries[index].ref;
+  code++;
+  GOTO_NEXT(code);
+}
+CASE(TABLE_SET) {
+  wasmbox_ref_table_t *table = &mod->tables[code->op2.index];
+  wasm_u32_t index = stack[code->op0.reg].u32;
+  if (index >= table->size) {
+    wasmbox_trap("out of bounds table access");
+  }
+  wasmbox_table_entry_set(table, &table->entries[index],
+                          stack[code->op1.reg].u64);
+  mod->tables_modified = 1;
+  code++;
+  GOTO_NEXT(code);
+}
+COLD_CASE(TABLE_GROW) {
+  wasmbox_ref_table_t *table = &mod->tables[code->op2.index];
+  stack[code->op0.reg].s32 = wasmbox_table_grow(
+      table, stack[code->op1.r.reg2].u32, stack[code->op1.r.reg1].u64);
+  mod->tables_modified = 1;
+  code++;
+  GOTO_NEXT(code);
+}
+COLD_CASE(TABLE_SIZE) {
+  stack[code->op0.reg].u32 = mod->tables[code->op2.index].size;
+  code++;
+  GOTO_NEXT(code);
+}
+#define ATOMIC_ADDRESS(REG, itype)                                           \
+  ((itype *) wasmbox_runtime_atomic_address(mod, stack[REG].u32,             \
+                                            code->op2.index, sizeof(itype)))
+#define ATOMIC_LOAD_OP(itype, otype)                                         \
+  do {                                                                       \
+    itype *ptr = ATOMIC_ADDRESS(code->op1.reg, itype);                       \
+    stack[code->op0.reg].otype = __atomic_load_n(ptr, __ATOMIC_SEQ_CST);     \
+    code++;                                                                  \
+  } while (0)
+#define ATOMIC_STORE_OP(itype, otype)                                        \
+  do {                                                                       \
+    itype *ptr = ATOMIC_ADDRESS(code->op0.reg, itype);                       \
+    __atomic_store_n(ptr, (itype) stack[code->op1.reg].otype,                \
+                     __ATOMIC_SEQ_CST);                                      \
+    code++;                                                                  \
+  } while (0)
+#define ATOMIC_RMW_OP(itype, otype, op)                                      \
+  do {                                                                       \
+    itype *ptr = ATOMIC_ADDRESS(code->op1.r.reg1, itype);                    \
+    stack[code->op0.reg].otype = __atomic_##op(                              \
+        ptr, (itype) stack[code->op1.r.reg2].otype, __ATOMIC_SEQ_CST);       \
+    code++;                                                                  \
+  } while (0)
+#define ATOMIC_CMPXCHG_OP(itype, otype)                                      \
+  do {                                                                       \
+    itype *ptr = ATOMIC_ADDRESS(code->op1.r.reg1, itype);                    \
+    itype expected = (itype) stack[code->op1.r.reg2].otype;                  \
+    __atomic_compare_exchange_n(ptr, &expected,                              \
+                                (itype) stack[code->op0.r.reg2].otype, 0,    \
+                                __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);         \
+    stack[code->op0.r.reg1].otype = expected;                                \
+    code++;                                                                  \
+  } while (0)
+COLD_CASE(MEMORY_ATOMIC_NOTIFY) {
+  stack[code->op0.reg].u32 = wasmbox_runtime_atomic_notify(
+      mod, stack[code->op1.r.reg1].u32, code->op2.index,
+      stack[code->op1.r.reg2].u32);
+  code++;
+  GOTO_NEXT(code);
+}
+COLD_CASE(MEMORY_ATOMIC_WAIT32) {
+  stack[code->op0.r.reg1].u32 = wasmbox_runtime_atomic_wait(
+      mod, stack[code->op1.r.reg1].u32, code->op2.index,
+      stack[code->op1.r.reg2].u32, 0, stack[code->op0.r.reg2].s64);
+  code++;
+  GOTO_NEXT(code);
+}
+COLD_CASE(MEMORY_ATOMIC_WAIT64) {
+  stack[code->op0.r.reg1].u32 = wasmbox_runtime_atomic_wait(
+      mod, stack[code->op1.r.reg1].u32, code->op2.index,
+      stack[code->op1.r.reg2].u64, 1, stack[code->op0.r.reg2].s64);
+  code++;
+  GOTO_NEXT(code);
+}
+CASE(I32_ATOMIC_LOAD) {
+  ATOMIC_LOAD_OP(wasm_u32_t, u32);
+  GOTO_NEXT(code);
+}
+CASE(I64_ATOMIC_LOAD) {
+  ATOMIC_LOAD_OP(wasm_u64_t, u64);
+  GOTO_NEXT(code);
+}
+CASE(I32_ATOMIC_LOAD8_U) {
+  ATOMIC_LOAD_OP(wasm_u8_t, u32);
+  GOTO_NEXT(code);
+}
+CASE(I32_ATOMIC_LOAD16_U) {
+  ATOMIC_LOAD_OP(wasm_u16_t, u32);
+  GOTO_NEXT(code);
+}
+CASE(I64_ATOMIC_LOAD8_U) {
+  ATOMIC_LOAD_OP(wasm_u8_t, u64);
+  GOTO_NEXT(code);
+}
+CASE(I64_ATOMIC_LOAD16_U) {
+  ATOMIC_LOAD_OP(wasm_u16_t, u64);
+  GOTO_NEXT(code);
+}
+CASE(I64_ATOMIC_LOAD32_U) {
+  ATOMIC_LOAD_OP(wasm_u32_t, u64);
+  GOTO_NEXT(code);
+}
+CASE(I32_ATOMIC_STORE) {
+  ATOMIC_STORE_OP(wasm_u32_t, u32);
+  GOTO_NEXT(code);
+}
+CASE(I64_ATOMIC_STORE) {
+  ATOMIC_STORE_OP(wasm_u64_t, u64);
+  GOTO_NEXT(code);
+}
+CASE(I32_ATOMIC_STORE8) {
+  ATOMIC_STORE_OP(wasm_u8_t, u32);
+  GOTO_NEXT(code);
+}
+CASE(I32_ATOMIC_STORE16) {
+  ATOMIC_STORE_OP(wasm_u16_t, u32);
+  GOTO_NEXT(code);
+}
+CASE(I64_ATOMIC_STORE8) {
+  ATOMIC_STORE_OP(wasm_u8_t, u64);
+  GOTO_NEXT(code);
+}
+CASE(I64_ATOMIC_STORE16) {
+  ATOMIC_STORE_OP(wasm_u16_t, u64);
+  GOTO_NEXT(code);
+}
+CASE(I64_ATOMIC_STORE32) {
+  ATOMIC_STORE_OP(wasm_u32_t, u64);
+  GOTO_NEXT(code);
+}
+CASE(I32_ATOMIC_RMW_ADD) {
+  ATOMIC_RMW_OP(wasm_u32_t, u32, fetch_add);
+  GOTO_NEXT(code);
+}
+CASE(I64_ATOMIC_RMW_ADD) {
+  ATOMIC_RMW_OP(wasm_u64_t, u64, fetch_add);
+  GOTO_NEXT(code);
+}
+CASE(I32_ATOMIC_RMW8_ADD_U) {
+  ATOMIC_RMW_OP(wasm_u8_t, u32, fetch_add);
+  GOTO_NEXT(code);
+}
+CASE(I32_ATOMIC_RMW16_ADD_U) {
+  ATOMIC_RMW_OP(wasm_u16_t, u32, fetch_add);
+  GOTO_NEXT(code);
+}
+CASE(I64_ATOMIC_RMW8_ADD_U) {
+  ATOMIC_RMW_OP(wasm_u8_t, u64, fetch_add);
+  GOTO_NEXT(code);
+}
+CASE(I64_ATOMIC_RMW16_ADD_U) {
+  ATOMIC_RMW_OP(wasm_u16_t, u64, fetch_add);
+  GOTO_NEXT(code);
+}
+CASE(I64_ATOMIC_RMW32_ADD_U) {
+  ATOMIC_RMW_OP(wasm_u32_t, u64, fetch_add);
+  GOTO_NEXT(code);
+}
+CASE(I32_ATOMIC_RMW_SUB) {
+  ATOMIC_RMW_OP(wasm_u32_t, u32, fetch_sub);
+  GOTO_NEXT(code);
+}
+CASE(I64_ATOMIC_RMW_SUB) {
+  ATOMIC_RMW_OP(wasm_u64_t, u64, fetch_sub);
+  GOTO_NEXT(code);
+}
+CASE(I32_ATOMIC_RMW8_SUB_U) {
+  ATOMIC_RMW_OP(wasm_u8_t, u32, fetch_sub);
+  GOTO_NEXT(code);
+}
+CASE(I32_ATOMIC_RMW16_SUB_U) {
+  ATOMIC_RMW_OP(wasm_u16_t, u32, fetch_sub);
+  GOTO_NEXT(code);
+}
+CASE(I64_ATOMIC_RMW8_SUB_U) {
+  ATOMIC_RMW_OP(wasm_u8_t, u64, fetch_sub);
+  GOTO_NEXT(code);
+}
+CASE(I64_ATOMIC_RMW16_SUB_U) {
+  ATOMIC_RMW_OP(wasm_u16_t, u64, fetch_sub);
+  GOTO_NEXT(code);
+}
+CASE(I64_ATOMIC_RMW32_SUB_U) {
+  ATOMIC_RMW_OP(wasm_u32_t, u64, fetch_sub);
+  GOTO_NEXT(code);
+}
+CASE(I32_ATOMIC_RMW_AND) {
+  ATOMIC_RMW_OP(wasm_u32_t, u32, fetch_and);
+  GOTO_NEXT(code);
+}
+CASE(I64_ATOMIC_RMW_AND) {
+  ATOMIC_RMW_OP(wasm_u64_t, u64, fetch_and);
+  GOTO_NEXT(code);
+}
+CASE(I32_ATOMIC_RMW8_AND_U) {
+  ATOMIC_RMW_OP(wasm_u8_t, u32, fetch_and);
+  GOTO_NEXT(code);
+}
+CASE(I32_ATOMIC_RMW16_AND_U) {
+  ATOMIC_RMW_OP(wasm_u16_t, u32, fetch_and);
+  GOTO_NEXT(code);
+}
+CASE(I64_ATOMIC_RMW8_AND_U) {
+  ATOMIC_RMW_OP(wasm_u8_t, u64, fetch_and);
+  GOTO_NEXT(code);
+}
+CASE(I64_ATOMIC_RMW16_AND_U) {
+  ATOMIC_RMW_OP(wasm_u16_t, u64, fetch_and);
+  GOTO_NEXT(code);
+}
+CASE(I64_ATOMIC_RMW32_AND_U) {
+  ATOMIC_RMW_OP(wasm_u32_t, u64, fetch_and);
+  GOTO_NEXT(code);
+}
+CASE(I32_ATOMIC_RMW_OR) {
+  ATOMIC_RMW_OP(wasm_u32_t, u32, fetch_or);
+  GOTO_NEXT(code);
+}
+CASE(I64_ATOMIC_RMW_OR) {
+  ATOMIC_RMW_OP(wasm_u64_t, u64, fetch_or);
+  GOTO_NEXT(code);
+}
+CASE(I32_ATOMIC_RMW8_OR_U) {
+  ATOMIC_RMW_OP(wasm_u8_t, u32, fetch_or);
+  GOTO_NEXT(code);
+}
+CASE(I32_ATOMIC_RMW16_OR_U) {
+  ATOMIC_RMW_OP(wasm_u16_t, u32, fetch_or);
+  GOTO_NEXT(code);
+}
+CASE(I64_ATOMIC_RMW8_OR_U) {
+  ATOMIC_RMW_OP(wasm_u8_t, u64, fetch_or);
+  GOTO_NEXT(code);
+}
+CASE(I64_ATOMIC_RMW16_OR_U) {
+  ATOMIC_RMW_OP(wasm_u16_t, u64, fetch_or);
+  GOTO_NEXT(code);
+}
+CASE(I64_ATOMIC_RMW32_OR_U) {
+  ATOMIC_RMW_OP(wasm_u32_t, u64, fetch_or);
+  GOTO_NEXT(code);
+}
+CASE(I32_ATOMIC_RMW_XOR) {
+  ATOMIC_RMW_OP(wasm_u32_t, u32, fetch_xor);
+  GOTO_NEXT(code);
+}
+CASE(I64_ATOMIC_RMW_XOR) {
+  ATOMIC_RMW_OP(wasm_u64_t, u64, fetch_xor);
+  GOTO_NEXT(code);
+}
+CASE(I32_ATOMIC_RMW8_XOR_U) {
+  ATOMIC_RMW_OP(wasm_u8_t, u32, fetch_xor);
+  GOTO_NEXT(code);
+}
+CASE(I32_ATOMIC_RMW16_XOR_U) {
+  ATOMIC_RMW_OP(wasm_u16_t, u32, fetch_xor);
+  GOTO_NEXT(code);
+}
+CASE(I64_ATOMIC_RMW8_XOR_U) {
+  ATOMIC_RMW_OP(wasm_u8_t, u64, fetch_xor);
+  GOTO_NEXT(code);
+}
+CASE(I64_ATOMIC_RMW16_XOR_U) {
+  ATOMIC_RMW_OP(wasm_u16_t, u64, fetch_xor);
+  GOTO_NEXT(code);
+}
+CASE(I64_ATOMIC_RMW32_XOR_U) {
+  ATOMIC_RMW_OP(wasm_u32_t, u64, fetch_xor);
+  GOTO_NEXT(code);
+}
+CASE(I32_ATOMIC_RMW_XCHG) {
+  ATOMIC_RMW_OP(wasm_u32_t, u32, exchange_n);
+  GOTO_NEXT(code);
+}
+CASE(I64_ATOMIC_RMW_XCHG) {
+  ATOMIC_RMW_OP(wasm_u64_t, u64, exchange_n);
+  GOTO_NEXT(code);
+}
+CASE(I32_ATOMIC_RMW8_XCHG_U) {
+  ATOMIC_RMW_OP(wasm_u8_t, u32, exchange_n);
+  GOTO_NEXT(code);
+}
+CASE(I32_ATOMIC_RMW16_XCHG_U) {
+  ATOMIC_RMW_OP(wasm_u16_t, u32, exchange_n);
+  GOTO_NEXT(code);
+}
+CASE(I64_ATOMIC_RMW8_XCHG_U) {
+  ATOMIC_RMW_OP(wasm_u8_t, u64, exchange_n);
+  GOTO_NEXT(code);
+}
+CASE(I64_ATOMIC_RMW16_XCHG_U) {
+  ATOMIC_RMW_OP(wasm_u16_t, u64, exchange_n);
+  GOTO_NEXT(code);
+}
+CASE(I64_ATOMIC_RMW32_XCHG_U) {
+  ATOMIC_RMW_OP(wasm_u32_t, u64, exchange_n);
+  GOTO_NEXT(code);
+}
+CASE(I32_ATOMIC_RMW_CMPXCHG) {
+  ATOMIC_CMPXCHG_OP(wasm_u32_t, u32);
+  GOTO_NEXT(code);
+}
+CASE(I64_ATOMIC_RMW_CMPXCHG) {
+  ATOMIC_CMPXCHG_OP(wasm_u64_t, u64);
+  GOTO_NEXT(code);
+}
+CASE(I32_ATOMIC_RMW8_CMPXCHG_U) {
+  ATOMIC_CMPXCHG_OP(wasm_u8_t, u32);
+  GOTO_NEXT(code);
+}
+CASE(I32_ATOMIC_RMW16_CMPXCHG_U) {
+  ATOMIC_CMPXCHG_OP(wasm_u16_t, u32);
+  GOTO_NEXT(code);
+}
+CASE(I64_ATOMIC_RMW8_CMPXCHG_U) {
+  ATOMIC_CMPXCHG_OP(wasm_u8_t, u64);
+  GOTO_NEXT(code);
+}
+CASE(I64_ATOMIC_RMW16_CMPXCHG_U) {
+  ATOMIC_CMPXCHG_OP(wasm_u16_t, u64);
+  GOTO_NEXT(code);
+}
+CASE(I64_ATOMIC_RMW32_CMPXCHG_U) {
+  ATOMIC_CMPXCHG_OP(wasm_u32_t, u64);
+  GOTO_NEXT(code);
+}
+#define SIMD_V128(REG) wasmbox_v128_get(stack, code->REG)
+#define SIMD_OPERANDS_load(rtype, atype, op)                             \
+  wasm_u64_t addr = (wasm_u64_t) stack[code->op1.reg].u32 + code->op2.index; \
+  WASMBOX_MEMORY_CHECK(mod, addr, rtype);                                \
+  wasmbox_v128_set(stack, code->op0.reg, op(&mod->memory_block->data[addr])); \
+  WASMBOX_MEMORY_PROFILE(mod, addr, reads)
+#define SIMD_OPERANDS_store(rtype, atype, op)                            \
+  wasm_u64_t addr = (wasm_u64_t) stack[code->op0.reg].u32 + code->op2.index; \
+  WASMBOX_MEMORY_CHECK(mod, addr, rtype);                                \
+  memcpy(&mod->memory_block->data[addr], &stack[code->op1.reg], rtype);  \
+  WASMBOX_MEMORY_PROFILE(mod, addr, writes)
+#define SIMD_OPERANDS_shuffle(rtype, atype, op)                          \
+  wasmbox_v128_t r;                                                      \
+  r.rtype = op(SIMD_V128(op1.reg).atype, SIMD_V128(op2.r.reg1).atype,    \
+               SIMD_V128(op2.r.reg2).atype);                             \
+  wasmbox_v128_set(stack, code->op0.reg, r)
+#define SIMD_OPERANDS_splat(rtype, atype, op)                            \
+  wasmbox_v128_t r;                                                      \
+  r.rtype = (wasmbox_##rtype##_t){0} +                                   \
+            (__typeof__(r.rtype[0])) stack[code->op1.reg].atype;         \
+  wasmbox_v128_set(stack, code->op0.reg, r)
+#define SIMD_OPERANDS_extract(rtype, atype, op) \
+  stack[code->op0.reg].rtype = SIMD_V128(op1.reg).atype[code->op2.index]
+#define SIMD_OPERANDS_replace(rtype, atype, op)                          \
+  wasmbox_v128_t r = SIMD_V128(op1.reg);                                 \
+  r.atype[code->op2.r.reg2] =                                            \
+      (__typeof__(r.atype[0])) stack[code->op2.r.reg1].rtype;            \
+  wasmbox_v128_set(stack, code->op0.reg, r)
+#define SIMD_OPERANDS_unary(rtype, atype, op)                            \
+  wasmbox_v128_t r;                                                      \
+  r.rtype = (wasmbox_##rtype##_t) (op SIMD_V128(op1.reg).atype);         \
+  wasmbox_v128_set(stack, code->op0.reg, r)
+#define SIMD_OPERANDS_unary_fn(rtype, atype, op)                         \
+  wasmbox_v128_t r;                                                      \
+  r.rtype = op(SIMD_V128(op1.reg).atype);                                \
+  wasmbox_v128_set(stack, code->op0.reg, r)
+#define SIMD_OPERANDS_binary(rtype, atype, op)                           \
+  wasmbox_v128_t r;                                                      \
+  r.rtype = (wasmbox_##rtype##_t) (SIMD_V128(op1.reg)                    \
+                                       .atype op SIMD_V128(op2.reg)      \
+                                       .atype);                          \
+  wasmbox_v128_set(stack, code->op0.reg, r)
+#define SIMD_OPERANDS_binary_fn(rtype, atype, op)                        \
+  wasmbox_v128_t r;                                                      \
+  r.rtype = op(SIMD_V128(op1.reg).atype, SIMD_V128(op2.reg).atype);      \
+  wasmbox_v128_set(stack, code->op0.reg, r)
+#define SIMD_OPERANDS_ternary(rtype, atype, op)                          \
+  wasmbox_v128_t r;                                                      \
+  r.rtype = op(SIMD_V128(op1.reg).atype, SIMD_V128(op2.r.reg1).atype,    \
+               SIMD_V128(op2.r.reg2).atype);                             \
+  wasmbox_v128_set(stack, code->op0.reg, r)
+#define SIMD_OPERANDS_shift(rtype, atype, op)                            \
+  wasmbox_v128_t a = SIMD_V128(op1.reg);                                 \
+  int shift =                                                            \
+      (int) (stack[code->op2.reg].u32 & (sizeof(a.atype[0]) * 8 - 1));   \
+  a.rtype = (wasmbox_##rtype##_t) (a.atype op shift);                    \
+  wasmbox_v128_set(stack, code->op0.reg, a)
+#define SIMD_OPERANDS_test(rtype, atype, op) \
+  stack[code->op0.reg].u32 = op(SIMD_V128(op1.reg).atype)
+#define FUNC(opcode, operands, rtype, atype, op, name) \
+  CASE(name) {                                         \
+    SIMD_OPERANDS_##operands(rtype, atype, op);        \
+    code++;                                            \
+    GOTO_NEXT(code);                                   \
+  }
+SIMD_INST_EACH(FUNC)
+#undef FUNC
+#undef SIMD_OPERANDS_load
+#undef SIMD_OPERANDS_store
+#undef SIMD_OPERANDS_shuffle
+#undef SIMD_OPERANDS_splat
+#undef SIMD_OPERANDS_extract
+#undef SIMD_OPERANDS_replace
+#undef SIMD_OPERANDS_unary
+#undef SIMD_OPERANDS_unary_fn
+#undef SIMD_OPERANDS_binary
+#undef SIMD_OPERANDS_binary_fn
+#undef SIMD_OPERANDS_ternary
+#undef SIMD_OPERANDS_shift
+#undef SIMD_OPERANDS_test
+#undef SIMD_V128
+COLD_CASE(ATOMIC_FENCE) {
+  wasmbox_runtime_atomic_fence();
+  code++;
+  GOTO_NEXT(code);
+}
+CASE(BATCH_NEXT) {
+  wasmbox_batch_t *batch =
+      (wasmbox_batch_t *) (uintptr_t) WASMBOX_CODE_VALUE(code, op0).u64;
+  code = wasmbox_runtime_batch_next(batch, code, stack);
+  if (code == NULL) {
+    return;
+  }
+  GOTO_NEXT(code);
+}
+CASE(HOST_CALL) {
+  const wasmbox_host_function_t *host =
+      (const wasmbox_host_function_t *) (uintptr_t)
+          WASMBOX_CODE_VALUE(code, op0).u64;
+  wasmbox_value_t *args = stack + WASMBOX_FUNCTION_CALL_OFFSET;
+  switch (code->op1.index) {
+    case WASMBOX_HOST_I32_I32:
+      stack[-1].s32 = host->entry.i32_i32(host->data, args[0].s32);
+      break;
+    case WASMBOX_HOST_I32_I32_I32:
+      stack[-1].s32 =
+          host->entry.i32_i32_i32(host->data, args[0].s32, args[1].s32);
+      break;
+    case WASMBOX_HOST_I64_I64:
+      stack[-1].s64 = host->entry.i64_i64(host->data, args[0].s64);
+      break;
+    case WASMBOX_HOST_ASYNC:
+      if (host->entry.async(mod, args, stack - code->op2.index, host->data)) {
+        // Returns to the caller on resume, once the host wrote the results.
+        mod->resume_code = WASMBOX_FRAME_RETURN_CODE(stack);
+        mod->resume_stack = WASMBOX_FRAME_CALLER(stack);
+        mod->resume_status = WASMBOX_SUSPENDED;
+        return;
+      }
+      break;
+    default:
+      host->entry.frame(mod, args, stack - code->op2.index, host->data);
+      break;
+  }
+  // The host may have run code of the guest, or set the global.
+  sp = wasmbox_runtime_load_sp(mod);
+  code = WASMBOX_FRAME_RETURN_CODE(stack);
+  stack = WASMBOX_FRAME_CALLER(stack);
+  GOTO_NEXT(code);
+}
+CASE(FUEL) {
+  wasm_s64_t fuel = mod->fuel - code->op0.index;
+  if (__builtin_expect(fuel < 0, 0)) {
+    // Runs this instruction again on wasmbox_resume.
+    mod->resume_code = code;
+    mod->resume_stack = stack;
+    mod->resume_status = WASMBOX_OUT_OF_FUEL;
+    return;
+  }
+  mod->fuel = fuel;
+  code++;
+  GOTO_NEXT(code);
+}
+CASE(EPOCH) {
+  if (__builtin_expect(__atomic_load_n(mod->epoch, __ATOMIC_RELAXED) >=
+                           mod->epoch_deadline,
+                       0)) {
+    mod->resume_code = code;
+    mod->resume_stack = stack;
+    mod->resume_status = WASMBOX_INTERRUPTED;
+    return;
+  }
+  code++;
+  GOTO_NEXT(code);
+}
+#define LOAD_CONST_OP(type)                               \
+  do {                                                    \
+    ACC_RESULT(type, WASMBOX_CODE_VALUE(code, op1).type); \
+    code++;                                               \
+  } while (0)
+CASE(LOAD_CONST_I32) {
+  LOAD_CONST_OP(u32);
+  GOTO_NEXT(code);
+}
+CASE(LOAD_CONST_I64) {
+  LOAD_CONST_OP(u64);
+  GOTO_NEXT(code);
+}
+CASE(LOAD_CONST_F32) {
+  LOAD_CONST_OP(f32);
+  GOTO_NEXT(code);
+}
+CASE(LOAD_CONST_F64) {
+  LOAD_CONST_OP(f64);
+  GOTO_NEXT(code);
+}
+#define ARITHMETIC_OP(arg_type, operand) \
+  ARITHMETIC_OP2(arg_type, arg_type, operand)
+
+#define ARITHMETIC_OP2(arg_type, ret_type, operand)                 \
+  do {                                                              \
+    ACC_RESULT(ret_type, ACC_OPERAND(op1, WASMBOX_ACC_OP1).arg_type \
+                             operand                                \
+                                 ACC_OPERAND(op2, WASMBOX_ACC_OP2)  \
+                                     .arg_type);                    \
+    code++;                                                         \
+  } while (0)
+/* Divisions check their divisor. Only x86 would fault on a zero one, and
+ * INT_MIN / -1 traps as an overflow while a remainder by -1 is taken by 1,
+ * which is 0 even for INT_MIN. */
+#define DIVISION_OP(type, operand, SIGNED_CASE)                  \
+  do {                                                           \
+    wasmbox_value_t lhs = ACC_OPERAND(op1, WASMBOX_ACC_OP1);     \
+    wasmbox_value_t rhs = ACC_OPERAND(op2, WASMBOX_ACC_OP2);     \
+    if (rhs.type == 0) {                                         \
+      wasmbox_trap("integer divide by zero");                    \
+    }                                                            \
+    SIGNED_CASE;                                                 \
+    ACC_RESULT(type, lhs.type operand rhs.type);                 \
+    code++;                                                      \
+  } while (0)
+#define DIV_S_OVERFLOW(type, MIN)                                \
+  if (rhs.type == -1 && lhs.type == (MIN)) {                     \
+    wasmbox_trap("integer overflow");                            \
+  }
+#define REM_S_BY_MINUS_ONE(type)                                 \
+  if (rhs.type == -1) {                                          \
+    rhs.type = 1;                                                \
+  }
+CASE(I32_EQZ) {
+  stack[code->op0.reg].u32 = stack[code->op1.reg].u32 == 0;
+  code++;
+  GOTO_NEXT(code);
+}
+CASE(I32_EQ) {
+  ARITHMETIC_OP(s32, ==);
+  GOTO_NEXT(code);
+}
+CASE(I32_NE) {
+  ARITHMETIC_OP(s32, !=);
+  GOTO_NEXT(code);
+}
+CASE(I32_LT_S) {
+  ARITHMETIC_OP(s32, <);
+  GOTO_NEXT(code);
+}
+CASE(I32_LT_U) {
+  ARITHMETIC_OP(u32, <);
+  GOTO_NEXT(code);
+}
+CASE(I32_GT_S) {
+  ARITHMETIC_OP(s32, >);
+  GOTO_NEXT(code);
+}
+CASE(I32_GT_U) {
+  ARITHMETIC_OP(u32, >);
+  GOTO_NEXT(code);
+}
+CASE(I32_LE_S) {
+  ARITHMETIC_OP(s32, <=);
+  GOTO_NEXT(code);
+}
+CASE(I32_LE_U) {
+  ARITHMETIC_OP(u32, <=);
+  GOTO_NEXT(code);
+}
+CASE(I32_GE_S) {
+  ARITHMETIC_OP(s32, >=);
+  GOTO_NEXT(code);
+}
+CASE(I32_GE_U) {
+  ARITHMETIC_OP(u32, >=);
+  GOTO_NEXT(code);
+}
+CASE(I64_EQZ) {
+  stack[code->op0.reg].u64 = stack[code->op1.reg].u64 == 0;
+  code++;
+  GOTO_NEXT(code);
+}
+CASE(I64_EQ) {
+  ARITHMETIC_OP2(u64, s32, ==);
+  GOTO_NEXT(code);
+}
+CASE(I64_NE) {
+  ARITHMETIC_OP2(u64, s32, !=);
+  GOTO_NEXT(code);
+}
+CASE(I64_LT_S) {
+  ARITHMETIC_OP2(s64, s32, <);
+  GOTO_NEXT(code);
+}
+CASE(I64_LT_U) {
+  ARITHMETIC_OP2(u64, s32, <);
+  GOTO_NEXT(code);
+}
+CASE(I64_GT_S) {
+  ARITHMETIC_OP2(s64, s32, >);
+  GOTO_NEXT(code);
+}
+CASE(I64_GT_U) {
+  ARITHMETIC_OP2(u64, s32, >);
+  GOTO_NEXT(code);
+}
+CASE(I64_LE_S) {
+  ARITHMETIC_OP2(s64, s32, <=);
+  GOTO_NEXT(code);
+}
+CASE(I64_LE_U) {
+  ARITHMETIC_OP2(u64, s32, <=);
+  GOTO_NEXT(code);
+}
+CASE(I64_GE_S) {
+  ARITHMETIC_OP2(s64, s32, >=);
+  GOTO_NEXT(code);
+}
+CASE(I64_GE_U) {
+  ARITHMETIC_OP2(u64, s32, >=);
+  GOTO_NEXT(code);
+}
+CASE(F32_EQ) {
+  ARITHMETIC_OP2(f32, s32, ==);
+  GOTO_NEXT(code);
+}
+CASE(F32_NE) {
+  ARITHMETIC_OP2(f32, s32, !=);
+  GOTO_NEXT(code);
+}
+CASE(F32_LT) {
+  ARITHMETIC_OP2(f32, s32, <);
+  GOTO_NEXT(code);
+}
+CASE(F32_GT) {
+  ARITHMETIC_OP2(f32, s32, >);
+  GOTO_NEXT(code);
+}
+CASE(F32_LE) {
+  ARITHMETIC_OP2(f32, s32, <=);
+  GOTO_NEXT(code);
+}
+CASE(F32_GE) {
+  ARITHMETIC_OP2(f32, s32, >=);
+  GOTO_NEXT(code);
+}
+CASE(F64_EQ) {
+  ARITHMETIC_OP2(f64, s32, ==);
+  GOTO_NEXT(code);
+}
+CASE(F64_NE) {
+  ARITHMETIC_OP2(f64, s32, !=);
+  GOTO_NEXT(code);
+}
+CASE(F64_LT) {
+  ARITHMETIC_OP2(f64, s32, <);
+  GOTO_NEXT(code);
+}
+CASE(F64_GT) {
+  ARITHMETIC_OP2(f64, s32, >);
+  GOTO_NEXT(code);
+}
+CASE(F64_LE) {
+  ARITHMETIC_OP2(f64, s32, <=);
+  GOTO_NEXT(code);
+}
+CASE(F64_GE) {
+  ARITHMETIC_OP2(f64, s32, >=);
+  GOTO_NEXT(code);
+}
+CASE(I32_CLZ) {
+  stack[code->op0.reg].u32 =
+      wasmbox_runtime_clz32(stack[code->op1.reg].u64);
+  code++;
+  GOTO_NEXT(code);
+}
+CASE(I32_CTZ) {
+  stack[code->op0.reg].u32 =
+      wasmbox_runtime_ctz32(stack[code->op1.reg].u64);
+  code++;
+  GOTO_NEXT(code);
+}
+CASE(I32_POPCNT) {
+  stack[code->op0.reg].u32 =
+      wasmbox_runtime_popcnt32(stack[code->op1.reg].u32);
+  code++;
+  GOTO_NEXT(code);
+}
+CASE(I32_ADD) {
+  ARITHMETIC_OP(u32, +);
+  GOTO_NEXT(code);
+}
+CASE(I32_SUB) {
+  ARITHMETIC_OP(u32, -);
+  GOTO_NEXT(code);
+}
+CASE(I32_MUL) {
+  ARITHMETIC_OP(u32, *);
+  GOTO_NEXT(code);
+}
+CASE(I32_DIV_S) {
+  DIVISION_OP(s32, /, DIV_S_OVERFLOW(s32, INT32_MIN));
+  GOTO_NEXT(code);
+}
+CASE(I32_DIV_U) {
+  DIVISION_OP(u32, /, );
+  GOTO_NEXT(code);
+}
+CASE(I32_REM_S) {
+  DIVISION_OP(s32, %, REM_S_BY_MINUS_ONE(s32));
+  GOTO_NEXT(code);
+}
+CASE(I32_REM_U) {
+  DIVISION_OP(u32, %, );
+  GOTO_NEXT(code);
+}
+CASE(I32_AND) {
+  ARITHMETIC_OP(u32, &);
+  GOTO_NEXT(code);
+}
+CASE(I32_OR) {
+  ARITHMETIC_OP(u32, |);
+  GOTO_NEXT(code);
+}
+CASE(I32_XOR) {
+  ARITHMETIC_OP(u32, ^);
+  GOTO_NEXT(code);
+}
+CASE(I32_SHL) {
+  ARITHMETIC_OP(u32, <<);
+  GOTO_NEXT(code);
+}
+CASE(I32_SHR_S) {
+  ARITHMETIC_OP(s32, >>);
+  GOTO_NEXT(code);
+}
+CASE(I32_SHR_U) {
+  ARITHMETIC_OP(u32, >>);
+  GOTO_NEXT(code);
+}
+CASE(I32_ROTL) {
+  ACC_RESULT(u32, wasmbox_runtime_rotl32(
+                      ACC_OPERAND(op1, WASMBOX_ACC_OP1).u32,
+                      ACC_OPERAND(op2, WASMBOX_ACC_OP2).u32));
+  code++;
+  GOTO_NEXT(code);
+}
+CASE(I32_ROTR) {
+  ACC_RESULT(u32, wasmbox_runtime_rotr32(
+                      ACC_OPERAND(op1, WASMBOX_ACC_OP1).u32,
+                      ACC_OPERAND(op2, WASMBOX_ACC_OP2).u32));
+  code++;
+  GOTO_NEXT(code);
+}
+CASE(I64_CLZ) {
+  stack[code->op0.reg].u64 =
+      wasmbox_runtime_clz64(stack[code->op1.reg].u64);
+  code++;
+  GOTO_NEXT(code);
+}
+CASE(I64_CTZ) {
+  stack[code->op0.reg].u64 =
+      wasmbox_runtime_ctz64(stack[code->op1.reg].u64);
+  code++;
+  GOTO_NEXT(code);
+}
+CASE(I64_POPCNT) {
+  stack[code->op0.reg].u64 =
+      wasmbox_runtime_popcnt64(stack[code->op1.reg].u64);
+  code++;
+  GOTO_NEXT(code);
+}
+CASE(I64_ADD) {
+  ARITHMETIC_OP2(s64, s64, +);
+  GOTO_NEXT(code);
+}
+CASE(I64_SUB) {
+  ARITHMETIC_OP2(s64, s64, -);
+  GOTO_NEXT(code);
+}
+CASE(I64_MUL) {
+  ARITHMETIC_OP2(s64, s64, *);
+  GOTO_NEXT(code);
+}
+CASE(I64_DIV_S) {
+  DIVISION_OP(s64, /, DIV_S_OVERFLOW(s64, INT64_MIN));
+  GOTO_NEXT(code);
+}
+CASE(I64_DIV_U) {
+  DIVISION_OP(u64, /, );
+  GOTO_NEXT(code);
+}
+CASE(I64_REM_S) {
+  DIVISION_OP(s64, %, REM_S_BY_MINUS_ONE(s64));
+  GOTO_NEXT(code);
+}
+CASE(I64_REM_U) {
+  DIVISION_OP(u64, %, );
+  GOTO_NEXT(code);
+}
+CASE(I64_AND) {
+  ARITHMETIC_OP2(u64, u64, &);
+  GOTO_NEXT(code);
+}
+CASE(I64_OR) {
+  ARITHMETIC_OP2(u64, u64, |);
+  GOTO_NEXT(code);
+}
+CASE(I64_XOR) {
+  ARITHMETIC_OP2(u64, u64, ^);
+  GOTO_NEXT(code);
+}
+CASE(I64_SHL) {
+  ARITHMETIC_OP2(u64, u64, <<);
+  GOTO_NEXT(code);
+}
+CASE(I64_SHR_S) {
+  ARITHMETIC_OP2(s64, s64, >>);
+  GOTO_NEXT(code);
+}
+CASE(I64_SHR_U) {
+  ARITHMETIC_OP2(u64, u64, >>);
+  GOTO_NEXT(code);
+}
+CASE(I64_ROTL) {
+  ACC_RESULT(u64, wasmbox_runtime_rotl64(
+                      ACC_OPERAND(op1, WASMBOX_ACC_OP1).u64,
+                      ACC_OPERAND(op2, WASMBOX_ACC_OP2).u64));
+  code++;
+  GOTO_NEXT(code);
+}
+CASE(I64_ROTR) {
+  ACC_RESULT(u64, wasmbox_runtime_rotr64(
+                      ACC_OPERAND(op1, WASMBOX_ACC_OP1).u64,
+                      ACC_OPERAND(op2, WASMBOX_ACC_OP2).u64));
+  code++;
+  GOTO_NEXT(code);
+}
+CASE(F32_ABS) {
+  NOT_IMPLEMENTED();
+}
+CASE(F32_NEG) {
+  NOT_IMPLEMENTED();
+}
+// The rounding mode is never changed, so rint rounds half to even.
+#define FLOAT_UNARY_OP(type, func)                               \
+  do {                                                           \
+    stack[code->op0.reg].type = func(stack[code->op1.reg].type); \
+    code++;                                                      \
+  } while (0)
+CASE(F32_CEIL) {
+  FLOAT_UNARY_OP(f32, __builtin_ceilf);
+  GOTO_NEXT(code);
+}
+CASE(F32_FLOOR) {
+  FLOAT_UNARY_OP(f32, __builtin_floorf);
+  GOTO_NEXT(code);
+}
+CASE(F32_TRUNC) {
+  FLOAT_UNARY_OP(f32, __builtin_truncf);
+  GOTO_NEXT(code);
+}
+CASE(F32_NEAREST) {
+  FLOAT_UNARY_OP(f32, __builtin_rintf);
+  GOTO_NEXT(code);
+}
+CASE(F32_SQRT) {
+  NOT_IMPLEMENTED();
+}
+CASE(F32_ADD) {
+  ARITHMETIC_OP2(f32, f32, +);
+  GOTO_NEXT(code);
+}
+CASE(F32_SUB) {
+  ARITHMETIC_OP2(f32, f32, -);
+  GOTO_NEXT(code);
+}
+CASE(F32_MUL) {
+  ARITHMETIC_OP2(f32, f32, *);
+  GOTO_NEXT(code);
+}
+CASE(F32_DIV) {
+  ARITHMETIC_OP2(f32, f32, /);
+  GOTO_NEXT(code);
+}
+CASE(F32_MIN) {
+  NOT_IMPLEMENTED();
+}
+CASE(F32_MAX) {
+  NOT_IMPLEMENTED();
+}
+CASE(F32_COPYSIGN) {
+  NOT_IMPLEMENTED();
+}
+CASE(F64_ABS) {
+  NOT_IMPLEMENTED();
+}
+CASE(F64_NEG) {
+  NOT_IMPLEMENTED();
+}
+CASE(F64_CEIL) {
+  FLOAT_UNARY_OP(f64, __builtin_ceil);
+  GOTO_NEXT(code);
+}
+CASE(F64_FLOOR) {
+  FLOAT_UNARY_OP(f64, __builtin_floor);
+  GOTO_NEXT(code);
+}
+CASE(F64_TRUNC) {
+  FLOAT_UNARY_OP(f64, __builtin_trunc);
+  GOTO_NEXT(code);
+}
+CASE(F64_NEAREST) {
+  FLOAT_UNARY_OP(f64, __builtin_rint);
+  GOTO_NEXT(code);
+}
+CASE(F64_SQRT) {
+  NOT_IMPLEMENTED();
+}
+CASE(F64_ADD) {
+  ARITHMETIC_OP2(f64, f64, +);
+  GOTO_NEXT(code);
+}
+CASE(F64_SUB) {
+  ARITHMETIC_OP2(f64, f64, -);
+  GOTO_NEXT(code);
+}
+CASE(F64_MUL) {
+  ARITHMETIC_OP2(f64, f64, *);
+  GOTO_NEXT(code);
+}
+CASE(F64_DIV) {
+  ARITHMETIC_OP2(f64, f64, /);
+  GOTO_NEXT(code);
+}
+CASE(F64_MIN) {
+  NOT_IMPLEMENTED();
+}
+CASE(F64_MAX) {
+  NOT_IMPLEMENTED();
+}
+CASE(F64_COPYSIGN) {
+  NOT_IMPLEMENTED();
+}
+CASE(WRAP_I64) {
+  stack[code->op0.reg].u32 = (wasm_u32_t) stack[code->op1.reg].u64;
+  code++;
+  GOTO_NEXT(code);
+}
+COLD_CASE(I32_TRUNC_F32_S) {
+  NOT_IMPLEMENTED();
+}
+COLD_CASE(I32_TRUNC_F32_U) {
+  NOT_IMPLEMENTED();
+}
+COLD_CASE(I32_TRUNC_F64_S) {
+  NOT_IMPLEMENTED();
+}
+COLD_CASE(I32_TRUNC_F64_U) {
+  NOT_IMPLEMENTED();
+}
+#define CONVERT_OP(arg_type, ret_type, operand)                              \
+  do {                                                                       \
+    stack[code->op0.reg].ret_type = (operand) stack[code->op1.reg].arg_type; \
+    code++;                                                                  \
+  } while (0)
+CASE(I64_EXTEND_I32_S) {
+  CONVERT_OP(s32, s64, wasm_s64_t);
+  GOTO_NEXT(code);
+}
+CASE(I64_EXTEND_I32_U) {
+  CONVERT_OP(u32, u64, wasm_u64_t);
+  GOTO_NEXT(code);
+}
+COLD_CASE(I64_TRUNC_F32_S) {
+  NOT_IMPLEMENTED();
+}
+COLD_CASE(I64_TRUNC_F32_U) {
+  NOT_IMPLEMENTED();
+}
+COLD_CASE(I64_TRUNC_F64_S) {
+  NOT_IMPLEMENTED();
+}
+COLD_CASE(I64_TRUNC_F64_U) {
+  NOT_IMPLEMENTED();
+}
+
+COLD_CASE(F32_CONVERT_I32_S) {
+  CONVERT_OP(s32, f32, wasm_f32_t);
+  GOTO_NEXT(code);
+}
+COLD_CASE(F32_CONVERT_I32_U) {
+  CONVERT_OP(u32, f32, wasm_f32_t);
+  GOTO_NEXT(code);
+}
+COLD_CASE(F32_CONVERT_I64_S) {
+  CONVERT_OP(s64, f32, wasm_f32_t);
+  GOTO_NEXT(code);
+}
+COLD_CASE(F32_CONVERT_I64_U) {
+  CONVERT_OP(u64, f32, wasm_f32_t);
+  GOTO_NEXT(code);
+}
+COLD_CASE(F32_DEMOTE_F64) {
+  CONVERT_OP(f64, f32, wasm_f32_t);
+  GOTO_NEXT(code);
+}
+COLD_CASE(F64_CONVERT_I32_S) {
+  CONVERT_OP(s32, f64, wasm_f64_t);
+  GOTO_NEXT(code);
+}
+COLD_CASE(F64_CONVERT_I32_U) {
+  CONVERT_OP(u32, f64, wasm_f64_t);
+  GOTO_NEXT(code);
+}
+COLD_CASE(F64_CONVERT_I64_S) {
+  CONVERT_OP(s64, f64, wasm_f64_t);
+  GOTO_NEXT(code);
+}
+COLD_CASE(F64_CONVERT_I64_U) {
+  CONVERT_OP(u64, f64, wasm_f32_t);
+  GOTO_NEXT(code);
+}
+COLD_CASE(F64_PROMOTE_F32) {
+  CONVERT_OP(f32, f64, wasm_f64_t);
+  GOTO_NEXT(code);
+}
+CASE(I32_REINTERPRET_F32) {
+  stack[code->op0.reg].u32 = stack[code->op1.reg].u32;
+  code++;
+  GOTO_NEXT(code);
+}
+CASE(I64_REINTERPRET_F64) {
+  stack[code->op0.reg].u64 = stack[code->op1.reg].u64;
+  code++;
+  GOTO_NEXT(code);
+}
+CASE(F32_REINTERPRET_I32) {
+  stack[code->op0.reg].f32 = stack[code->op1.reg].f32;
+  code++;
+  GOTO_NEXT(code);
+}
+CASE(F64_REINTERPRET_I64) {
+  stack[code->op0.reg].f64 = stack[code->op1.reg].f64;
+  code++;
+  GOTO_NEXT(code);
+}
+#define EXTEND_OP(arg_type, ret_type, operand)                               \
+  do {                                                                       \
+    stack[code->op0.reg].ret_type = (operand) stack[code->op1.reg].arg_type; \
+    code++;                                                                  \
+  } while (0)
+CASE(I32_EXTEND8_S) {
+  EXTEND_OP(s8, s32, wasm_s32_t);
+  GOTO_NEXT(code);
+}
+CASE(I32_EXTEND16_S) {
+  EXTEND_OP(s16, s32, wasm_s32_t);
+  GOTO_NEXT(code);
+}
+CASE(I64_EXTEND8_S) {
+  EXTEND_OP(s8, s64, wasm_s64_t);
+  GOTO_NEXT(code);
+}
+CASE(I64_EXTEND16_S) {
+  EXTEND_OP(s16, s64, wasm_s64_t);
+  GOTO_NEXT(code);
+}
+CASE(I64_EXTEND32_S) {
+  EXTEND_OP(s32, s64, wasm_s64_t);
+  GOTO_NEXT(code);
+}
+#define TRUNC_SAT_OP(arg_type, ret_type, func)                           \
+  do {                                                                   \
+    stack[code->op0.reg].ret_type = func(stack[code->op1.reg].arg_type); \
+    code++;                                                              \
+  } while (0)
+COLD_CASE(I32_TRUNC_SAT_F32_S) {
+  TRUNC_SAT_OP(f32, s32, wasmbox_runtime_trunc_sat_f32_s32);
+  GOTO_NEXT(code);
+}
+COLD_CASE(I32_TRUNC_SAT_F32_U) {
+  TRUNC_SAT_OP(f32, u32, wasmbox_runtime_trunc_sat_f32_u32);
+  GOTO_NEXT(code);
+}
+COLD_CASE(I32_TRUNC_SAT_F64_S) {
+  TRUNC_SAT_OP(f64, s32, wasmbox_runtime_trunc_sat_f64_s32);
+  GOTO_NEXT(code);
+}
+COLD_CASE(I32_TRUNC_SAT_F64_U) {
+  TRUNC_SAT_OP(f64, u32, wasmbox_runtime_trunc_sat_f64_u32);
+  GOTO_NEXT(code);
+}
+COLD_CASE(I64_TRUNC_SAT_F32_S) {
+  TRUNC_SAT_OP(f32, s64, wasmbox_runtime_trunc_sat_f32_s64);
+  GOTO_NEXT(code);
+}
+COLD_CASE(I64_TRUNC_SAT_F32_U) {
+  TRUNC_SAT_OP(f32, u64, wasmbox_runtime_trunc_sat_f32_u64);
+  GOTO_NEXT(code);
+}
+COLD_CASE(I64_TRUNC_SAT_F64_S) {
+  TRUNC_SAT_OP(f64, s64, wasmbox_runtime_trunc_sat_f64_s64);
+  GOTO_NEXT(code);
+}
+COLD_CASE(I64_TRUNC_SAT_F64_U) {
+  TRUNC_SAT_OP(f64, u64, wasmbox_runtime_trunc_sat_f64_u64);
+  GOTO_NEXT(code);
+}
@@ -0,0 +1,321 @@
+/*
+ * Copyright (C) 2021 Masahiro Ide
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Handler table of the interpreter indexed by opcode, included from
+ * interpreter.c. The dispatch mode defines LP(X) as the address of the handler
+ * of OPCODE_X. The order must follow enum wasmbox_opcode.
+ */
+
+LP(UNREACHABLE),
+LP(NOP),
+NULL /*drop*/,
+LP(SELECT),
+LP(I32_EQZ),
+LP(I32_EQ),
+LP(I32_NE),
+LP(I32_LT_S),
+LP(I32_LT_U),
+LP(I32_GT_S),
+LP(I32_GT_U),
+LP(I32_LE_S),
+LP(I32_LE_U),
+LP(I32_GE_S),
+LP(I32_GE_U),
+LP(I64_EQZ),
+LP(I64_EQ),
+LP(I64_NE),
+LP(I64_LT_S),
+LP(I64_LT_U),
+LP(I64_GT_S),
+LP(I64_GT_U),
+LP(I64_LE_S),
+LP(I64_LE_U),
+LP(I64_GE_S),
+LP(I64_GE_U),
+LP(F32_EQ),
+LP(F32_NE),
+LP(F32_LT),
+LP(F32_GT),
+LP(F32_LE),
+LP(F32_GE),
+LP(F64_EQ),
+LP(F64_NE),
+LP(F64_LT),
+LP(F64_GT),
+LP(F64_LE),
+LP(F64_GE),
+LP(I32_CLZ),
+LP(I32_CTZ),
+LP(I32_POPCNT),
+LP(I32_ADD),
+LP(I32_SUB),
+LP(I32_MUL),
+LP(I32_DIV_S),
+LP(I32_DIV_U),
+LP(I32_REM_S),
+LP(I32_REM_U),
+LP(I32_AND),
+LP(I32_OR),
+LP(I32_XOR),
+LP(I32_SHL),
+LP(I32_SHR_S),
+LP(I32_SHR_U),
+LP(I32_ROTL),
+LP(I32_ROTR),
+LP(I64_CLZ),
+LP(I64_CTZ),
+LP(I64_POPCNT),
+LP(I64_ADD),
+LP(I64_SUB),
+LP(I64_MUL),
+LP(I64_DIV_S),
+LP(I64_DIV_U),
+LP(I64_REM_S),
+LP(I64_REM_U),
+LP(I64_AND),
+LP(I64_OR),
+LP(I64_XOR),
+LP(I64_SHL),
+LP(I64_SHR_S),
+LP(I64_SHR_U),
+LP(I64_ROTL),
+LP(I64_ROTR),
+LP(F32_ABS),
+LP(F32_NEG),
+LP(F32_CEIL),
+LP(F32_FLOOR),
+LP(F32_TRUNC),
+LP(F32_NEAREST),
+LP(F32_SQRT),
+LP(F32_ADD),
+LP(F32_SUB),
+LP(F32_MUL),
+LP(F32_DIV),
+LP(F32_MIN),
+LP(F32_MAX),
+LP(F32_COPYSIGN),
+LP(F64_ABS),
+LP(F64_NEG),
+LP(F64_CEIL),
+LP(F64_FLOOR),
+LP(F64_TRUNC),
+LP(F64_NEAREST),
+LP(F64_SQRT),
+LP(F64_ADD),
+LP(F64_SUB),
+LP(F64_MUL),
+LP(F64_DIV),
+LP(F64_MIN),
+LP(F64_MAX),
+LP(F64_COPYSIGN),
+LP(WRAP_I64),
+LP(I32_TRUNC_F32_S),
+LP(I32_TRUNC_F32_U),
+LP(I32_TRUNC_F64_S),
+LP(I32_TRUNC_F64_U),
+LP(I64_EXTEND_I32_S),
+LP(I64_EXTEND_I32_U),
+LP(I64_TRUNC_F32_S),
+LP(I64_TRUNC_F32_U),
+LP(I64_TRUNC_F64_S),
+LP(I64_TRUNC_F64_U),
+LP(F32_CONVERT_I32_S),
+LP(F32_CONVERT_I32_U),
+LP(F32_CONVERT_I64_S),
+LP(F32_CONVERT_I64_U),
+LP(F32_DEMOTE_F64),
+LP(F64_CONVERT_I32_S),
+LP(F64_CONVERT_I32_U),
+LP(F64_CONVERT_I64_S),
+LP(F64_CONVERT_I64_U),
+LP(F64_PROMOTE_F32),
+LP(I32_REINTERPRET_F32),
+LP(I64_REINTERPRET_F64),
+LP(F32_REINTERPRET_I32),
+LP(F64_REINTERPRET_I64),
+LP(I32_EXTEND8_S),
+LP(I32_EXTEND16_S),
+LP(I64_EXTEND8_S),
+LP(I64_EXTEND16_S),
+LP(I64_EXTEND32_S),
+LP(GLOBAL_GET),
+LP(GLOBAL_SET),
+LP(I32_LOAD),
+LP(I64_LOAD),
+LP(F32_LOAD),
+LP(F64_LOAD),
+LP(I32_LOAD8_S),
+LP(I32_LOAD8_U),
+LP(I32_LOAD16_S),
+LP(I32_LOAD16_U),
+LP(I64_LOAD8_S),
+LP(I64_LOAD8_U),
+LP(I64_LOAD16_S),
+LP(I64_LOAD16_U),
+LP(I64_LOAD32_S),
+LP(I64_LOAD32_U),
+LP(I32_STORE),
+LP(I64_STORE),
+LP(F32_STORE),
+LP(F64_STORE),
+LP(I32_STORE8),
+LP(I32_STORE16),
+LP(I64_STORE8),
+LP(I64_STORE16),
+LP(I64_STORE32),
+LP(MEMORY_SIZE),
+LP(MEMORY_GROW),
+LP(LOAD_CONST_I32),
+LP(LOAD_CONST_I64),
+LP(LOAD_CONST_F32),
+LP(LOAD_CONST_F64),
+LP(I32_TRUNC_SAT_F32_S),
+LP(I32_TRUNC_SAT_F32_U),
+LP(I32_TRUNC_SAT_F64_S),
+LP(I32_TRUNC_SAT_F64_U),
+LP(I64_TRUNC_SAT_F32_S),
+LP(I64_TRUNC_SAT_F32_U),
+LP(I64_TRUNC_SAT_F64_S),
+LP(I64_TRUNC_SAT_F64_U),
+LP(MEMORY_INIT),
+LP(DATA_DROP),
+LP(MEMORY_COPY),
+LP(MEMORY_FILL),
+LP(REF_FUNC),
+LP(TABLE_GET),
+LP(TABLE_SET),
+LP(TABLE_GROW),
+LP(TABLE_SIZE),
+LP(MEMORY_ATOMIC_NOTIFY),
+LP(MEMORY_ATOMIC_WAIT32),
+LP(MEMORY_ATOMIC_WAIT64),
+LP(I32_ATOMIC_LOAD),
+LP(I64_ATOMIC_LOAD),
+LP(I32_ATOMIC_LOAD8_U),
+LP(I32_ATOMIC_LOAD16_U),
+LP(I64_ATOMIC_LOAD8_U),
+LP(I64_ATOMIC_LOAD16_U),
+LP(I64_ATOMIC_LOAD32_U),
+LP(I32_ATOMIC_STORE),
+LP(I64_ATOMIC_STORE),
+LP(I32_ATOMIC_STORE8),
+LP(I32_ATOMIC_STORE16),
+LP(I64_ATOMIC_STORE8),
+LP(I64_ATOMIC_STORE16),
+LP(I64_ATOMIC_STORE32),
+LP(I32_ATOMIC_RMW_ADD),
+LP(I64_ATOMIC_RMW_ADD),
+LP(I32_ATOMIC_RMW8_ADD_U),
+LP(I32_ATOMIC_RMW16_ADD_U),
+LP(I64_ATOMIC_RMW8_ADD_U),
+LP(I64_ATOMIC_RMW16_ADD_U),
+LP(I64_ATOMIC_RMW32_ADD_U),
+LP(I32_ATOMIC_RMW_SUB),
+LP(I64_ATOMIC_RMW_SUB),
+LP(I32_ATOMIC_RMW8_SUB_U),
+LP(I32_ATOMIC_RMW16_SUB_U),
+LP(I64_ATOMIC_RMW8_SUB_U),
+LP(I64_ATOMIC_RMW16_SUB_U),
+LP(I64_ATOMIC_RMW32_SUB_U),
+LP(I32_ATOMIC_RMW_AND),
+LP(I64_ATOMIC_RMW_AND),
+LP(I32_ATOMIC_RMW8_AND_U),
+LP(I32_ATOMIC_RMW16_AND_U),
+LP(I64_ATOMIC_RMW8_AND_U),
+LP(I64_ATOMIC_RMW16_AND_U),
+LP(I64_ATOMIC_RMW32_AND_U),
+LP(I32_ATOMIC_RMW_OR),
+LP(I64_ATOMIC_RMW_OR),
+LP(I32_ATOMIC_RMW8_OR_U),
+LP(I32_ATOMIC_RMW16_OR_U),
+LP(I64_ATOMIC_RMW8_OR_U),
+LP(I64_ATOMIC_RMW16_OR_U),
+LP(I64_ATOMIC_RMW32_OR_U),
+LP(I32_ATOMIC_RMW_XOR),
+LP(I64_ATOMIC_RMW_XOR),
+LP(I32_ATOMIC_RMW8_XOR_U),
+LP(I32_ATOMIC_RMW16_XOR_U),
+LP(I64_ATOMIC_RMW8_XOR_U),
+LP(I64_ATOMIC_RMW16_XOR_U),
+LP(I64_ATOMIC_RMW32_XOR_U),
+LP(I32_ATOMIC_RMW_XCHG),
+LP(I64_ATOMIC_RMW_XCHG),
+LP(I32_ATOMIC_RMW8_XCHG_U),
+LP(I32_ATOMIC_RMW16_XCHG_U),
+LP(I64_ATOMIC_RMW8_XCHG_U),
+LP(I64_ATOMIC_RMW16_XCHG_U),
+LP(I64_ATOMIC_RMW32_XCHG_U),
+LP(I32_ATOMIC_RMW_CMPXCHG),
+LP(I64_ATOMIC_RMW_CMPXCHG),
+LP(I32_ATOMIC_RMW8_CMPXCHG_U),
+LP(I32_ATOMIC_RMW16_CMPXCHG_U),
+LP(I64_ATOMIC_RMW8_CMPXCHG_U),
+LP(I64_ATOMIC_RMW16_CMPXCHG_U),
+LP(I64_ATOMIC_RMW32_CMPXCHG_U),
+#define FUNC(opcode, operands, rtype, atype, op, name) LP(name),
+SIMD_INST_EACH(FUNC)
+#undef FUNC
+LP(EXIT),
+LP(RETURN),
+LP(JUMP),
+LP(JUMP_IF),
+LP(JUMP_TABLE),
+LP(MOVE),
+LP(DYNAMIC_CALL),
+LP(STATIC_CALL),
+LP(DYNAMIC_TAIL_CALL),
+LP(STATIC_TAIL_CALL),
+LP(JIT_ENTRY),
+LP(LAZY_COMPILE),
+LP(ATOMIC_FENCE),
+LP(BATCH_NEXT),
+LP(HOST_CALL),
+LP(FUEL),
+LP(EPOCH),
+LP(HOTNESS),
+#define FUNC(param, type, operand, cmp, vmopcode) LP(JUMP_IF_##cmp),
+COMPARE_AND_BRANCH_INST_EACH(FUNC)
+#undef FUNC
+#define FUNC(wtype, type, operand, inst, vmopcode) LP(inst##_IMM),
+IMMEDIATE_INST_EACH(FUNC)
+#undef FUNC
+#define FUNC(type, operand, inst, vmopcode) LP(inst##_MAGIC),
+DIVISION_MAGIC_INST_EACH(FUNC)
+#undef FUNC
+#define FUNC(type, operand, cmp, vmopcode) LP(LOOP_INC_##cmp),
+LOOP_INC_INST_EACH(FUNC)
+#undef FUNC
+#define FUNC(inst, mtype, field, unfused, vmopcode) LP(unfused##_INDEXED),
+INDEXED_MEMORY_INST_EACH(FUNC)
+#undef FUNC
+#define FUNC(inst, mtype, field, unfused, vmopcode) \
+  LP(unfused##_INDEXED_UNCHECKED),
+INDEXED_MEMORY_INST_EACH(FUNC)
+#undef FUNC
+#define FUNC(size, shift, vmopcode) LP(MEMORY_GUARD_##size),
+MEMORY_GUARD_INST_EACH(FUNC)
+#undef FUNC
+#define FUNC(inst, mtype, field, unfused, vmopcode) LP(unfused##_MEMORY64),
+MEMORY64_INST_EACH(FUNC)
+#undef FUNC
+LP(STACK_POINTER_GET),
+LP(STACK_POINTER_SET),
+LP(STACK_POINTER_ADD),
+LP(ZERO_LOCALS),
+LP(MODULE_CALL),
+LP(MODULE_RESTORE),
+LP(THREADED_CODE),
@@ -17,10 +17,26 @@
 #include "interpreter.h"
 
 #include "allocator.h"
+#include "aot.h"
+#include "atomic-wait.h"
+#include "instance-pool.h"
+#include "jit.h"
+#include "latency-histogram.h"
+#include "memory.h"
+#include "memory-profile.h"
+#include "opcode-profile.h"
 #include "opcodes.h"
+#include "perf-counters.h"
+#include "sampling-profile.h"
+#include "simd.h"
+#include "trace.h"
+#include "trap.h"
 #include "wasmbox/wasmbox.h"
 
-#include <stdlib.h> // exit
+#include <stddef.h> // offsetof
+#include <stdlib.h> // exit, malloc
+#include <string.h> // memmove, memset
+#include <threads.h> // tss_create, call_once
 
 #define LOG(MSG) fprintf(stderr, "(%s:%d)" MSG, __FILE__, __LINE__)
 
@@ -30,51 +46,177 @@
     return;                 \
   } while (0)
 
-#ifdef TRACE_VM
-static void dump_stack(wasmbox_value_t *stack);
-#else
-#endif
+WASMBOX_COLD static wasm_u32_t
+wasmbox_runtime_memory_size(wasmbox_module_t *mod) {
+  return wasmbox_memory_size(mod);
+}
+
+// Addresses and sizes of a memory64 are i64 values, and those of other
+// memories i32 ones.
+static wasm_u64_t wasmbox_runtime_address(wasmbox_module_t *mod,
+                                          wasmbox_value_t value) {
+  return mod->memory64 ? value.u64 : value.u32;
+}
+
+WASMBOX_COLD static wasm_u64_t
+wasmbox_runtime_memory_grow(wasmbox_module_t *mod, wasmbox_value_t delta) {
+  wasm_u64_t pages = wasmbox_runtime_address(mod, delta);
+  wasm_u32_t current = pages > WASM_U32_MAX
+                           ? WASM_U32_MAX
+                           : wasmbox_memory_grow(mod, (wasm_u32_t) pages);
+  if (current == WASM_U32_MAX) {
+    return mod->memory64 ? WASM_U64_MAX : WASM_U32_MAX;
+  }
+  return current;
+}
+
+// Bulk memory instructions check their whole range once, and trap before
+// anything is written.
+static wasm_u8_t *wasmbox_runtime_memory_range(wasmbox_module_t *mod,
+                                               wasm_u64_t addr,
+                                               wasm_u64_t size) {
+  wasm_u64_t limit = (wasm_u64_t) wasmbox_memory_size(mod) * WASMBOX_PAGE_SIZE;
+  if (addr > limit || size > limit - addr) {
+    wasmbox_trap("out of bounds memory access");
+  }
+  return mod->memory_block->data + addr;
+}
+
+static void wasmbox_runtime_memory_copy(wasmbox_module_t *mod,
+                                        wasmbox_value_t dst,
+                                        wasmbox_value_t src,
+                                        wasmbox_value_t size) {
+  wasm_u64_t n = wasmbox_runtime_address(mod, size);
+  wasm_u8_t *to =
+      wasmbox_runtime_memory_range(mod, wasmbox_runtime_address(mod, dst), n);
+  wasm_u8_t *from =
+      wasmbox_runtime_memory_range(mod, wasmbox_runtime_address(mod, src), n);
+  memmove(to, from, n);
+}
 
-static wasm_u32_t wasmbox_runtime_memory_size(wasmbox_module_t *mod) {
-  return mod->memory_block_size;
+static void wasmbox_runtime_memory_fill(wasmbox_module_t *mod,
+                                        wasmbox_value_t dst, wasm_u8_t value,
+                                        wasmbox_value_t size) {
+  wasm_u64_t n = wasmbox_runtime_address(mod, size);
+  memset(
+      wasmbox_runtime_memory_range(mod, wasmbox_runtime_address(mod, dst), n),
+      value, n);
 }
 
-static wasm_u32_t wasmbox_runtime_memory_grow(wasmbox_module_t *mod,
-                                              wasm_u32_t new_size) {
-  wasm_u32_t current_page_size = wasmbox_runtime_memory_size(mod);
-  if (new_size <= 0 ||
-      current_page_size + new_size >
-          mod->memory_block_capacity) { // TODO Need to confirm WASM spec.
-    return current_page_size;
+WASMBOX_COLD static void
+wasmbox_runtime_memory_init(wasmbox_module_t *mod, wasm_u32_t index,
+                            wasmbox_value_t dst, wasm_u32_t src,
+                            wasm_u32_t size) {
+  wasmbox_data_segment_t *segment = &mod->data_segments[index];
+  if ((wasm_u64_t) src + size > segment->size) {
+    wasmbox_trap("out of bounds memory access");
   }
-  wasm_u32_t new_block_size = WASMBOX_PAGE_SIZE * new_size;
-  mod->memory_block = (wasmbox_memory_block_t *) wasmbox_malloc(
-      sizeof(*mod->memory_block) + new_block_size);
-  mod->memory_block_size = new_size;
-  return current_page_size;
+  memcpy(wasmbox_runtime_memory_range(mod, wasmbox_runtime_address(mod, dst),
+                                      size),
+         segment->data + src, size);
 }
 
+WASMBOX_COLD static void wasmbox_runtime_data_drop(wasmbox_module_t *mod,
+                                                   wasm_u32_t index) {
+  wasmbox_data_segment_t *segment = &mod->data_segments[index];
+  // Resettable modules and instances keep the bytes, which they may share.
+  if (segment->data != NULL && !segment->borrowed && !mod->resettable &&
+      mod->compiled == NULL) {
+    wasmbox_free(segment->data);
+    segment->data = NULL;
+  }
+  segment->size = 0;
+}
+
+// Atomic accesses trap unless they are naturally aligned.
+static wasm_u8_t *wasmbox_runtime_atomic_address(wasmbox_module_t *mod,
+                                                 wasm_u32_t addr,
+                                                 wasm_u32_t offset,
+                                                 wasm_u32_t size) {
+  wasm_u64_t ea = (wasm_u64_t) addr + offset;
+  WASMBOX_MEMORY_CHECK(mod, ea, size);
+  if ((ea & (size - 1)) != 0) {
+    wasmbox_trap("unaligned atomic");
+  }
+  return mod->memory_block->data + ea;
+}
+
+// A sequentially consistent read-modify-write orders memory like a fence, and
+// unlike __atomic_thread_fence it is understood by ThreadSanitizer.
+WASMBOX_COLD static void wasmbox_runtime_atomic_fence(void) {
+  static wasm_u32_t fence;
+  __atomic_fetch_add(&fence, 0, __ATOMIC_SEQ_CST);
+}
+
+// Waits and notifications are always bounds checked, since a fault would
+// unwind while a wait queue is locked.
+static wasm_u8_t *wasmbox_runtime_atomic_wait_address(wasmbox_module_t *mod,
+                                                      wasm_u32_t addr,
+                                                      wasm_u32_t offset,
+                                                      wasm_u32_t size) {
+  wasm_u64_t ea = (wasm_u64_t) addr + offset;
+  if (ea + size > (wasm_u64_t) wasmbox_memory_size(mod) * WASMBOX_PAGE_SIZE) {
+    wasmbox_trap("out of bounds memory access");
+  }
+  return wasmbox_runtime_atomic_address(mod, addr, offset, size);
+}
+
+WASMBOX_COLD static wasm_u32_t
+wasmbox_runtime_atomic_wait(wasmbox_module_t *mod, wasm_u32_t addr,
+                            wasm_u32_t offset, wasm_u64_t expected, int is_64,
+                            wasm_s64_t timeout) {
+  wasm_u8_t *ptr =
+      wasmbox_runtime_atomic_wait_address(mod, addr, offset, is_64 ? 8 : 4);
+  if (!wasmbox_memory_is_shared(mod)) {
+    wasmbox_trap("expected shared memory");
+  }
+  return wasmbox_atomic_wait(ptr, expected, is_64, timeout);
+}
+
+WASMBOX_COLD static wasm_u32_t
+wasmbox_runtime_atomic_notify(wasmbox_module_t *mod, wasm_u32_t addr,
+                              wasm_u32_t offset, wasm_u32_t count) {
+  wasm_u8_t *ptr = wasmbox_runtime_atomic_wait_address(mod, addr, offset, 4);
+  // Nobody can wait on a memory which is not shared.
+  if (!wasmbox_memory_is_shared(mod)) {
+    return 0;
+  }
+  return wasmbox_atomic_notify(ptr, count);
+}
+
+// Zero is checked here as the builtins leave it undefined. Where LZCNT, TZCNT
+// and POPCNT are available, the compiler folds the check into the instruction.
 static wasm_u32_t wasmbox_runtime_clz32(wasm_u32_t v) {
-  return __builtin_clz(v);
+  return v == 0 ? 32 : __builtin_clz(v);
 }
 
 static wasm_u32_t wasmbox_runtime_ctz32(wasm_u32_t v) {
-  return __builtin_ctz(v);
+  return v == 0 ? 32 : __builtin_ctz(v);
 }
 
 static wasm_u64_t wasmbox_runtime_clz64(wasm_u64_t v) {
-  return __builtin_clzl(v);
+  return v == 0 ? 64 : __builtin_clzll(v);
 }
 
 static wasm_u64_t wasmbox_runtime_ctz64(wasm_u64_t v) {
-  return __builtin_ctzl(v);
+  return v == 0 ? 64 : __builtin_ctzll(v);
+}
+
+static wasm_u32_t wasmbox_runtime_popcnt32(wasm_u32_t v) {
+  return __builtin_popcount(v);
+}
+
+static wasm_u64_t wasmbox_runtime_popcnt64(wasm_u64_t v) {
+  return __builtin_popcountll(v);
 }
 
+// Both shift amounts are masked, which gcc recognizes as a single rotate and
+// keeps the shift defined when `y` is a multiple of the width.
 static wasm_u32_t wasmbox_runtime_rotl32(wasm_u32_t x, wasm_u32_t y) {
 #ifdef __llvm__
   return __builtin_rotateleft32(x, y);
 #else
-  return (x << y) | (x >> (sizeof(x) * 8 - y));
+  return (x << (y & 31)) | (x >> (-y & 31));
 #endif
 }
 
@@ -82,7 +224,7 @@ static wasm_u32_t wasmbox_runtime_rotr32(wasm_u32_t x, wasm_u32_t y) {
 #ifdef __llvm__
   return __builtin_rotateright32(x, y);
 #else
-  return (x >> y) | (x << (sizeof(x) * 8 - y));
+  return (x >> (y & 31)) | (x << (-y & 31));
 #endif
 }
 
@@ -90,7 +232,7 @@ static wasm_u64_t wasmbox_runtime_rotl64(wasm_u64_t x, wasm_u64_t y) {
 #ifdef __llvm__
   return __builtin_rotateleft64(x, y);
 #else
-  return (x << y) | (x >> (sizeof(x) * 8 - y));
+  return (x << (y & 63)) | (x >> (-y & 63));
 #endif
 }
 
@@ -98,19 +240,273 @@ static wasm_u64_t wasmbox_runtime_rotr64(wasm_u64_t x, wasm_u64_t y) {
 #ifdef __llvm__
   return __builtin_rotateright64(x, y);
 #else
-  return (x >> y) | (x << (sizeof(x) * 8 - y));
+  return (x >> (y & 63)) | (x << (-y & 63));
 #endif
 }
-#ifdef WASMBOX_VM_USE_DIRECT_THREADED_CODE
+
+// Quotients by the divisor in the lower half of `magic`, which is neither 0
+// nor a power of two, and whose magic number is in its upper half (Granlund
+// and Montgomery, "Division by Invariant Integers using Multiplication").
+// The shift is ceil(log2(d)), which is one lzcnt.
+static wasm_u32_t wasmbox_runtime_div_u32(wasm_u32_t x, wasm_u64_t magic) {
+  wasm_u32_t d = (wasm_u32_t) magic;
+  wasm_u32_t l = 32 - __builtin_clz(d - 1);
+  wasm_u32_t t = (wasm_u32_t) (((magic >> 32) * x) >> 32);
+  return (t + ((x - t) >> 1)) >> (l - 1);
+}
+
+// Signed as above, for divisors other than -1, 0 and 1. The magic number is
+// below 2^32, so the product fits in 64 bits.
+static wasm_s32_t wasmbox_runtime_div_s32(wasm_s32_t x, wasm_u64_t magic) {
+  wasm_s32_t d = (wasm_s32_t) magic;
+  wasm_u32_t abs = d < 0 ? -(wasm_u32_t) d : (wasm_u32_t) d;
+  wasm_u32_t l = 32 - __builtin_clz(abs - 1);
+  wasm_s32_t q = (wasm_s32_t) (((wasm_s64_t) x * (wasm_s64_t) (magic >> 32)) >>
+                               32);
+  q = (q >> (l - 1)) - (x >> 31);
+  wasm_s32_t sign = d >> 31;
+  return (wasm_s32_t) (((wasm_u32_t) q ^ sign) - sign);
+}
+
+// NaN yields 0 and out of range values the nearest bound. In range values,
+// which are the common case, are converted by a single cvttss2si/cvttsd2si
+// after two compares.
+#define WASMBOX_RUNTIME_TRUNC_SAT(name, rtype, atype, fmin, fmax, imin, imax) \
+  static rtype wasmbox_runtime_##name(atype v) {                             \
+    return v != v        ? 0                                                 \
+           : v <= (fmin) ? (imin)                                            \
+           : v >= (fmax) ? (imax)                                            \
+                         : (rtype) v;                                        \
+  }
+WASMBOX_RUNTIME_TRUNC_SAT(trunc_sat_f32_s32, wasm_s32_t, wasm_f32_t,
+                          -2147483648.0, 2147483648.0, INT32_MIN, INT32_MAX)
+WASMBOX_RUNTIME_TRUNC_SAT(trunc_sat_f32_u32, wasm_u32_t, wasm_f32_t, 0.0,
+                          4294967296.0, 0, UINT32_MAX)
+WASMBOX_RUNTIME_TRUNC_SAT(trunc_sat_f64_s32, wasm_s32_t, wasm_f64_t,
+                          -2147483648.0, 2147483648.0, INT32_MIN, INT32_MAX)
+WASMBOX_RUNTIME_TRUNC_SAT(trunc_sat_f64_u32, wasm_u32_t, wasm_f64_t, 0.0,
+                          4294967296.0, 0, UINT32_MAX)
+WASMBOX_RUNTIME_TRUNC_SAT(trunc_sat_f32_s64, wasm_s64_t, wasm_f32_t,
+                          -9223372036854775808.0, 9223372036854775808.0,
+                          INT64_MIN, INT64_MAX)
+WASMBOX_RUNTIME_TRUNC_SAT(trunc_sat_f32_u64, wasm_u64_t, wasm_f32_t, 0.0,
+                          18446744073709551616.0, 0, UINT64_MAX)
+WASMBOX_RUNTIME_TRUNC_SAT(trunc_sat_f64_s64, wasm_s64_t, wasm_f64_t,
+                          -9223372036854775808.0, 9223372036854775808.0,
+                          INT64_MIN, INT64_MAX)
+WASMBOX_RUNTIME_TRUNC_SAT(trunc_sat_f64_u64, wasm_u64_t, wasm_f64_t, 0.0,
+                          18446744073709551616.0, 0, UINT64_MAX)
+#undef WASMBOX_RUNTIME_TRUNC_SAT
+
+#ifdef WASMBOX_VM_USE_LAZY_COMPILE
+/* Code of a function, which another thread may have just compiled. */
+#  define WASMBOX_FUNCTION_CODE(FUNC) \
+    __atomic_load_n(&(FUNC)->code, __ATOMIC_ACQUIRE)
+#else
+#  define WASMBOX_FUNCTION_CODE(FUNC) ((FUNC)->code)
+#endif
+
+/* Traps unless a frame of SIZE values from FRAME fits in the stack, and
+ * records how deep the stack goes. */
+#define WASMBOX_RUNTIME_CHECK_FRAME(MOD, FRAME, SIZE)           \
+  do {                                                          \
+    wasmbox_value_t *frame_end = (FRAME) + (SIZE);              \
+    if (__builtin_expect(frame_end > (MOD)->stack_end, 0)) {    \
+      wasmbox_trap("call stack exhausted");                     \
+    }                                                           \
+    if (__builtin_expect(frame_end > (MOD)->stack_peak, 0)) {   \
+      (MOD)->stack_peak = frame_end;                            \
+    }                                                           \
+  } while (0)
+
+/* End of a stack whose size is not known, which is never reached. */
+#define WASMBOX_STACK_UNCHECKED ((wasmbox_value_t *) UINTPTR_MAX)
+
+// Looks up the entry of an indirect call whose callee frame starts at `frame`.
+// An empty entry never matches the type id of a call site.
+static inline wasmbox_table_entry_t *
+wasmbox_runtime_table_lookup(wasmbox_module_t *mod, wasmbox_call_cache_t *site,
+                             wasm_u32_t index, wasmbox_value_t *frame) {
+  wasmbox_ref_table_t *table = &mod->tables[site->tableidx];
+  if (__builtin_expect(index >= table->size, 0)) {
+    wasmbox_trap("undefined element");
+  }
+  wasmbox_table_entry_t *entry = &table->entries[index];
+  if (__builtin_expect(entry->type_id != site->type_id, 0)) {
+    wasmbox_trap(entry->code == NULL ? "undefined element"
+                                     : "indirect call type mismatch");
+  }
+  WASMBOX_RUNTIME_CHECK_FRAME(mod, frame, entry->frame_size);
+  return entry;
+}
+
+#ifdef WASMBOX_VM_USE_LAZY_COMPILE
+// Counts the calls in a row of a profiled site to the callee of `entry`, and
+// has the function of the site recompiled once it reaches the threshold. The
+// counts are hints, so threads running the same site may race on them.
+static inline void wasmbox_runtime_profile_call(wasmbox_module_t *mod,
+                                                wasmbox_call_cache_t *site,
+                                                wasmbox_table_entry_t *entry) {
+  if (site->caller == NULL) {
+    return;
+  }
+  wasm_u32_t hits = 0;
+  if (__atomic_load_n(&site->target, __ATOMIC_RELAXED) == entry->ref) {
+    hits = __atomic_load_n(&site->hits, __ATOMIC_RELAXED) + 1;
+  } else {
+    __atomic_store_n(&site->target, entry->ref, __ATOMIC_RELAXED);
+  }
+  __atomic_store_n(&site->hits, hits, __ATOMIC_RELAXED);
+  wasm_s32_t threshold = mod->speculation_threshold;
+  if (hits == (wasm_u32_t) (threshold == 0 ? WASMBOX_SPECULATION_THRESHOLD
+                                           : threshold)) {
+    wasmbox_module_speculate(mod, site->caller);
+  }
+}
+#endif
+
+/* State of wasmbox_call_batch, which OPCODE_BATCH_NEXT refers to. */
+typedef struct wasmbox_batch_t {
+  wasmbox_function_t *func;
+  const wasmbox_value_t *args;
+  wasmbox_value_t *results;
+  size_t index;
+  size_t size;
+} wasmbox_batch_t;
+
+// Stores the results of the call which returned to `stack` and sets up the
+// frame of the next call, which returns to `code` again. Returns NULL once
+// every call is done.
+static wasmbox_code_t *wasmbox_runtime_batch_next(wasmbox_batch_t *batch,
+                                                  wasmbox_code_t *code,
+                                                  wasmbox_value_t *stack) {
+  wasmbox_type_t *type = batch->func->type;
+  wasmbox_value_t *results = batch->results + batch->index * type->return_size;
+  for (wasm_u16_t i = 0; i < type->return_size; i++) {
+    results[i] = stack[i - type->return_size];
+  }
+  if (++batch->index == batch->size) {
+    return NULL;
+  }
+  const wasmbox_value_t *args =
+      batch->args + batch->index * type->argument_size;
+  for (wasm_u16_t i = 0; i < type->argument_size; i++) {
+    stack[WASMBOX_FUNCTION_CALL_OFFSET + i] = args[i];
+  }
+  WASMBOX_FRAME_LINK(stack, stack, code);
+  return WASMBOX_FUNCTION_CODE(batch->func);
+}
+
+#ifdef WASMBOX_VM_USE_ACCUMULATOR
+/* `acc` holds the result of the last instruction which keeps it there. It is
+ * a local of the interpreter loop, or an argument of each handler with
+ * tail-call dispatch, so that it can stay in a register. */
+#  define ACC_PARAM , wasmbox_value_t acc
+#  define ACC_ARG   , acc
+/* Operand OP of the instruction, which is `acc` if FLAG is set. */
+#  define ACC_OPERAND(OP, FLAG) \
+    (code->h.acc & (FLAG) ? acc : stack[code->OP.reg])
+/* Writes the result of the instruction to op0 and `acc`. */
+#  define ACC_RESULT(type, VALUE) \
+    (stack[code->op0.reg].type = acc.type = (VALUE))
+#else
+#  define ACC_PARAM
+#  define ACC_ARG
+#  define ACC_OPERAND(OP, FLAG)   (stack[code->OP.reg])
+#  define ACC_RESULT(type, VALUE) (stack[code->op0.reg].type = (VALUE))
+#endif
+
+/* `sp` holds the stack pointer of the guest, which compiled C code moves on
+ * most calls, in a register like `acc`. Its global is stored to as well, so
+ * that the host always reads it there, and `sp` is loaded again from it once
+ * host or native code ran. */
+#define SP_PARAM , wasm_u32_t sp
+#define SP_ARG   , sp
+
+static inline wasm_u32_t wasmbox_runtime_load_sp(wasmbox_module_t *mod) {
+  return mod != NULL && mod->stack_pointer_global != 0
+             ? mod->globals[mod->stack_pointer_global - 1].u32
+             : 0;
+}
+
+// Runs the code of `to`, a module linked into `from`, on the call stack of
+// `from`. Faults in the guard region of `to` are traps from now on.
+static inline wasmbox_module_t *
+wasmbox_runtime_module_enter(wasmbox_module_t *from, wasmbox_module_t *to) {
+  to->stack_end = from->stack_end;
+  to->stack_peak = from->stack_peak;
+#ifdef WASMBOX_NATIVE_CODE_ENABLED
+  to->native_stack_limit = from->native_stack_limit;
+#endif
+  wasmbox_trap_switch_module(to);
+  return to;
+}
+
+// Returns from `from` to `to`, the module which called into it.
+static inline wasmbox_module_t *
+wasmbox_runtime_module_leave(wasmbox_module_t *from, wasmbox_module_t *to) {
+  if (from->stack_peak > to->stack_peak) {
+    to->stack_peak = from->stack_peak;
+  }
+  wasmbox_trap_switch_module(to);
+  return to;
+}
+
+#ifdef WASMBOX_VM_USE_TAIL_CALL_DISPATCH
+#  ifdef __has_attribute
+#    if __has_attribute(musttail)
+#      define MUSTTAIL __attribute__((musttail))
+#    endif
+#  endif
+#  ifndef MUSTTAIL
+// Handlers must not grow the native stack. Without musttail, rely on the
+// sibling call optimization, which is also forced in unoptimized builds.
+#    define MUSTTAIL
+#    pragma GCC optimize("O2")
+#  endif
+typedef void (*wasmbox_op_handler_t)(wasmbox_module_t *mod,
+                                     wasmbox_code_t *code,
+                                     wasmbox_value_t *stack ACC_PARAM
+                                         SP_PARAM);
+#  define L(X)  WASMBOX_VM_ISA_NAME(wasmbox_op_##X)
+#  define LP(X) ((void *) L(X))
+#  define CASE(X)                                                   \
+    static void L(X)(wasmbox_module_t * mod, wasmbox_code_t * code, \
+                     wasmbox_value_t * stack ACC_PARAM SP_PARAM)
+/* Handlers of the opcodes which the opcode profile of the benchmarks shows to
+ * be rare are cold functions, kept apart from the hot ones. Handlers in
+ * wasmbox_eval_function go to its cold section once they call a WASMBOX_COLD
+ * helper; marking their labels cold instead changes the register allocation
+ * of the whole loop, and slowed the benchmarks down. */
+#  define COLD_CASE(X) __attribute__((cold)) CASE(X)
+#  ifdef WASMBOX_VM_USE_CODE_LABEL
+#    define LABEL_POINTER(PC) ((wasmbox_op_handler_t) (PC)->h.label)
+#  else
+#    define LABEL_POINTER(PC) ((wasmbox_op_handler_t) LABELS[(PC)->h.opcode])
+#  endif
+#  define GOTO_NEXT(PC) \
+    MUSTTAIL return LABEL_POINTER(PC)(mod, PC, stack ACC_ARG SP_ARG)
+/* Jumps to PC, whose label is already loaded. */
+#  define GOTO_LABEL(PC, LABEL)                              \
+    MUSTTAIL return ((wasmbox_op_handler_t) (LABEL))(mod, PC, \
+                                                     stack ACC_ARG SP_ARG)
+#elif defined(WASMBOX_VM_USE_DIRECT_THREADED_CODE)
 #  define L(X)               L_OPCODE_##X
 #  define LP(X)              (&&L(X))
 #  define CASE(X)            L(X) :
+#  define COLD_CASE(X)       CASE(X)
 #  define DISPATCH_START(PC) goto *LABELS[(PC)->h.opcode];
 #  define DISPATCH_END(PC)
-#  define LABEL_POINTER(PC) *((PC)->h.label)
-#  define GOTO_NEXT(PC)     goto LABEL_POINTER(PC)
+#  ifdef WASMBOX_VM_USE_CODE_LABEL
+#    define LABEL_POINTER(PC) *((PC)->h.label)
+#  else
+#    define LABEL_POINTER(PC) *LABELS[(PC)->h.opcode]
+#  endif
+#  define GOTO_NEXT(PC)         goto LABEL_POINTER(PC)
+#  define GOTO_LABEL(PC, LABEL) goto *(LABEL)
 #else /* switch-case */
-#  define CASE(X) case OPCODE_##X:
+#  define CASE(X)      case OPCODE_##X:
+#  define COLD_CASE(X) CASE(X)
 #  define DISPATCH_START(PC) \
   L_head:                    \
     switch ((PC)->h.opcode)
@@ -118,1032 +514,288 @@ static wasm_u64_t wasmbox_runtime_rotr64(wasm_u64_t x, wasm_u64_t y) {
 #  define GOTO_NEXT(PC) goto L_head
 #endif
 
-void wasmbox_eval_function(wasmbox_module_t *mod, wasmbox_code_t *code,
-                           wasmbox_value_t *stack) {
-#ifdef WASMBOX_VM_USE_DIRECT_THREADED_CODE
-  static void *LABELS[] = {
-      LP(UNREACHABLE),
-      LP(NOP),
-      NULL /*drop*/,
-      LP(SELECT),
-      LP(I32_EQZ),
-      LP(I32_EQ),
-      LP(I32_NE),
-      LP(I32_LT_S),
-      LP(I32_LT_U),
-      LP(I32_GT_S),
-      LP(I32_GT_U),
-      LP(I32_LE_S),
-      LP(I32_LE_U),
-      LP(I32_GE_S),
-      LP(I32_GE_U),
-      LP(I64_EQZ),
-      LP(I64_EQ),
-      LP(I64_NE),
-      LP(I64_LT_S),
-      LP(I64_LT_U),
-      LP(I64_GT_S),
-      LP(I64_GT_U),
-      LP(I64_LE_S),
-      LP(I64_LE_U),
-      LP(I64_GE_S),
-      LP(I64_GE_U),
-      LP(F32_EQ),
-      LP(F32_NE),
-      LP(F32_LT),
-      LP(F32_GT),
-      LP(F32_LE),
-      LP(F32_GE),
-      LP(F64_EQ),
-      LP(F64_NE),
-      LP(F64_LT),
-      LP(F64_GT),
-      LP(F64_LE),
-      LP(F64_GE),
-      LP(I32_CLZ),
-      LP(I32_CTZ),
-      LP(I32_POPCNT),
-      LP(I32_ADD),
-      LP(I32_SUB),
-      LP(I32_MUL),
-      LP(I32_DIV_S),
-      LP(I32_DIV_U),
-      LP(I32_REM_S),
-      LP(I32_REM_U),
-      LP(I32_AND),
-      LP(I32_OR),
-      LP(I32_XOR),
-      LP(I32_SHL),
-      LP(I32_SHR_S),
-      LP(I32_SHR_U),
-      LP(I32_ROTL),
-      LP(I32_ROTR),
-      LP(I64_CLZ),
-      LP(I64_CTZ),
-      LP(I64_POPCNT),
-      LP(I64_ADD),
-      LP(I64_SUB),
-      LP(I64_MUL),
-      LP(I64_DIV_S),
-      LP(I64_DIV_U),
-      LP(I64_REM_S),
-      LP(I64_REM_U),
-      LP(I64_AND),
-      LP(I64_OR),
-      LP(I64_XOR),
-      LP(I64_SHL),
-      LP(I64_SHR_S),
-      LP(I64_SHR_U),
-      LP(I64_ROTL),
-      LP(I64_ROTR),
-      LP(F32_ABS),
-      LP(F32_NEG),
-      LP(F32_CEIL),
-      LP(F32_FLOOR),
-      LP(F32_TRUNC),
-      LP(F32_NEAREST),
-      LP(F32_SQRT),
-      LP(F32_ADD),
-      LP(F32_SUB),
-      LP(F32_MUL),
-      LP(F32_DIV),
-      LP(F32_MIN),
-      LP(F32_MAX),
-      LP(F32_COPYSIGN),
-      LP(F64_ABS),
-      LP(F64_NEG),
-      LP(F64_CEIL),
-      LP(F64_FLOOR),
-      LP(F64_TRUNC),
-      LP(F64_NEAREST),
-      LP(F64_SQRT),
-      LP(F64_ADD),
-      LP(F64_SUB),
-      LP(F64_MUL),
-      LP(F64_DIV),
-      LP(F64_MIN),
-      LP(F64_MAX),
-      LP(F64_COPYSIGN),
-      LP(WRAP_I64),
-      LP(I32_TRUNC_F32_S),
-      LP(I32_TRUNC_F32_U),
-      LP(I32_TRUNC_F64_S),
-      LP(I32_TRUNC_F64_U),
-      LP(I64_EXTEND_I32_S),
-      LP(I64_EXTEND_I32_U),
-      LP(I64_TRUNC_F32_S),
-      LP(I64_TRUNC_F32_U),
-      LP(I64_TRUNC_F64_S),
-      LP(I64_TRUNC_F64_U),
-      LP(F32_CONVERT_I32_S),
-      LP(F32_CONVERT_I32_U),
-      LP(F32_CONVERT_I64_S),
-      LP(F32_CONVERT_I64_U),
-      LP(F32_DEMOTE_F64),
-      LP(F64_CONVERT_I32_S),
-      LP(F64_CONVERT_I32_U),
-      LP(F64_CONVERT_I64_S),
-      LP(F64_CONVERT_I64_U),
-      LP(F64_PROMOTE_F32),
-      LP(I32_REINTERPRET_F32),
-      LP(I64_REINTERPRET_F64),
-      LP(F32_REINTERPRET_I32),
-      LP(F64_REINTERPRET_I64),
-      LP(I32_EXTEND8_S),
-      LP(I32_EXTEND16_S),
-      LP(I64_EXTEND8_S),
-      LP(I64_EXTEND16_S),
-      LP(I64_EXTEND32_S),
-      LP(GLOBAL_GET),
-      LP(GLOBAL_SET),
-      LP(I32_LOAD),
-      LP(I64_LOAD),
-      LP(F32_LOAD),
-      LP(F64_LOAD),
-      LP(I32_LOAD8_S),
-      LP(I32_LOAD8_U),
-      LP(I32_LOAD16_S),
-      LP(I32_LOAD16_U),
-      LP(I64_LOAD8_S),
-      LP(I64_LOAD8_U),
-      LP(I64_LOAD16_S),
-      LP(I64_LOAD16_U),
-      LP(I64_LOAD32_S),
-      LP(I64_LOAD32_U),
-      LP(I32_STORE),
-      LP(I64_STORE),
-      LP(F32_STORE),
-      LP(F64_STORE),
-      LP(I32_STORE8),
-      LP(I32_STORE16),
-      LP(I64_STORE8),
-      LP(I64_STORE16),
-      LP(I64_STORE32),
-      LP(MEMORY_SIZE),
-      LP(MEMORY_GROW),
-      LP(LOAD_CONST_I32),
-      LP(LOAD_CONST_I64),
-      LP(LOAD_CONST_F32),
-      LP(LOAD_CONST_F64),
-      LP(I32_TRUNC_SAT_F32_S),
-      LP(I32_TRUNC_SAT_F32_U),
-      LP(I32_TRUNC_SAT_F64_S),
-      LP(I32_TRUNC_SAT_F64_U),
-      LP(I64_TRUNC_SAT_F32_S),
-      LP(I64_TRUNC_SAT_F32_U),
-      LP(I64_TRUNC_SAT_F64_S),
-      LP(I64_TRUNC_SAT_F64_U),
-      LP(EXIT),
-      LP(RETURN),
-      LP(JUMP),
-      LP(JUMP_IF),
-      LP(JUMP_TABLE),
-      LP(MOVE),
-      LP(DYNAMIC_CALL),
-      LP(STATIC_CALL),
-      LP(THREADED_CODE),
-  };
+#if defined(WASMBOX_VM_USE_OPCODE_PROFILE) ||   \
+    defined(WASMBOX_VM_USE_SAMPLING_PROFILE) || \
+    defined(WASMBOX_VM_USE_TRACE)
+/* Counts every handler run, tells the sampler where it runs and traces it.
+ * THREADED_CODE runs without a module. */
+#  define PROFILE_CASE(X)                            \
+    if (OPCODE_##X != OPCODE_THREADED_CODE) {        \
+      WASMBOX_OPCODE_PROFILE(mod, OPCODE_##X, code); \
+      WASMBOX_SAMPLING_PROFILE(code, stack);         \
+      WASMBOX_TRACE(OPCODE_##X, code);               \
+    }
+#  undef CASE
+#  ifdef WASMBOX_VM_USE_TAIL_CALL_DISPATCH
+/* The counter goes in front of the body, which becomes a function of its
+ * own that the handler tail calls. */
+#    define CASE(X)                                                       \
+      static void L(X##_BODY)(wasmbox_module_t * mod, wasmbox_code_t * code, \
+                              wasmbox_value_t * stack ACC_PARAM SP_PARAM); \
+      static void L(X)(wasmbox_module_t * mod, wasmbox_code_t * code,     \
+                       wasmbox_value_t * stack ACC_PARAM SP_PARAM) {      \
+        PROFILE_CASE(X);                                                  \
+        MUSTTAIL return L(X##_BODY)(mod, code, stack ACC_ARG SP_ARG);     \
+      }                                                                   \
+      static void L(X##_BODY)(wasmbox_module_t * mod, wasmbox_code_t * code, \
+                              wasmbox_value_t * stack ACC_PARAM SP_PARAM)
+#  elif defined(WASMBOX_VM_USE_DIRECT_THREADED_CODE)
+#    define CASE(X) L(X) : PROFILE_CASE(X)
+#  else
+#    define CASE(X) case OPCODE_##X : PROFILE_CASE(X)
+#  endif
 #endif
-  DISPATCH_START(code) {
-    CASE(THREADED_CODE) {
-#ifdef WASMBOX_VM_USE_DIRECT_THREADED_CODE
-      stack[0].u64 = (wasm_u64_t) (uintptr_t) LABELS;
+
+#ifdef WASMBOX_VM_USE_COMPACT_CODE
+_Static_assert(sizeof(wasmbox_code_t) == 16,
+               "compact instruction should fit in 16 bytes");
 #endif
-      return;
-    }
-    CASE(UNREACHABLE) {
-      exit(-1);
-    }
-    CASE(NOP) {
-      /* do nothing */
-      code++;
-      GOTO_NEXT(code);
-    }
-    CASE(SELECT) {
-      if (stack[code->op1.reg].u32) {
-        stack[code->op0.reg].u64 = stack[code->op2.r.reg1].u64;
-      } else {
-        stack[code->op0.reg].u64 = stack[code->op2.r.reg2].u64;
-      }
-      code++;
-      GOTO_NEXT(code);
-    }
-    CASE(EXIT) {
-      return;
-    }
-    CASE(RETURN) {
-      code = (wasmbox_code_t *) stack[1].u64;
-      stack = (wasmbox_value_t *) stack[0].u64;
-      GOTO_NEXT(code);
-    }
-    CASE(MOVE) {
-      stack[code->op0.reg].u64 = stack[code->op1.reg].u64;
-      code++;
-      GOTO_NEXT(code);
-    }
-    CASE(JUMP) {
-      code = code->op0.code;
-      GOTO_NEXT(code);
-    }
-    CASE(JUMP_IF) {
-      if (stack[code->op1.reg].u32) {
-        code = code->op0.code;
-      } else {
-        code++;
-      }
-      GOTO_NEXT(code);
-    }
-    CASE(JUMP_TABLE) {
-      wasm_u32_t index = stack[code->op2.reg].u32;
-      if (code->op0.table->size < index) {
-        code = code->op0.table->labels[index].code;
-      } else {
-        code = code->op1.code;
-      }
-      GOTO_NEXT(code);
-    }
-    CASE(DYNAMIC_CALL) {
-      wasmbox_function_t *func = mod->tables[0]->labels[code->op1.index].func;
-      wasmbox_value_t *stack_top = &stack[code->op0.reg] + code->op2.index;
-      stack_top[0].u64 = (wasm_u64_t) (uintptr_t) stack;
-      stack_top[1].u64 = (wasm_u64_t) (uintptr_t) (code + 1);
-      stack = stack_top;
-      code = func->code;
-      GOTO_NEXT(code);
-    }
-    CASE(STATIC_CALL) {
-      wasmbox_function_t *func = code->op1.func;
-      wasmbox_value_t *stack_top = &stack[code->op0.reg] + code->op2.index;
-      stack_top[0].u64 = (wasm_u64_t) (uintptr_t) stack;
-      stack_top[1].u64 = (wasm_u64_t) (uintptr_t) (code + 1);
-      stack = stack_top;
-      code = func->code;
-      GOTO_NEXT(code);
-    }
-    CASE(GLOBAL_GET) {
-      stack[code->op0.reg].u64 = mod->globals[code->op1.reg].u64;
-      code++;
-      GOTO_NEXT(code);
-    }
-    CASE(GLOBAL_SET) {
-      mod->globals[code->op0.reg].u64 = stack[code->op1.reg].u64;
-      code++;
-      GOTO_NEXT(code);
-    }
 
-#define LOAD_OP(itype, otype, out_type)                                   \
-  do {                                                                    \
-    stack[code->op0.reg].otype =                                          \
-        (out_type) * (itype *) &mod->memory_block->data[code->op1.index]; \
-    code++;                                                               \
-  } while (0)
-    CASE(I32_LOAD) {
-      LOAD_OP(wasm_u32_t, u32, wasm_u32_t);
-      GOTO_NEXT(code);
-    }
-    CASE(I64_LOAD) {
-      LOAD_OP(wasm_u64_t, u64, wasm_u64_t);
-      GOTO_NEXT(code);
-    }
-    CASE(F32_LOAD) {
-      LOAD_OP(wasm_f32_t, f32, wasm_f32_t);
-      GOTO_NEXT(code);
-    }
-    CASE(F64_LOAD) {
-      LOAD_OP(wasm_f64_t, f64, wasm_f64_t);
-      GOTO_NEXT(code);
-    }
-    CASE(I32_LOAD8_S) {
-      LOAD_OP(wasm_s8_t, s32, wasm_s32_t);
-      GOTO_NEXT(code);
-    }
-    CASE(I32_LOAD8_U) {
-      LOAD_OP(wasm_u8_t, u32, wasm_u32_t);
-      GOTO_NEXT(code);
-    }
-    CASE(I32_LOAD16_S) {
-      LOAD_OP(wasm_s16_t, s32, wasm_s32_t);
-      GOTO_NEXT(code);
-    }
-    CASE(I32_LOAD16_U) {
-      LOAD_OP(wasm_u16_t, u32, wasm_u32_t);
-      GOTO_NEXT(code);
-    }
-    CASE(I64_LOAD8_S) {
-      LOAD_OP(wasm_s8_t, s64, wasm_s64_t);
-      GOTO_NEXT(code);
-    }
-    CASE(I64_LOAD8_U) {
-      LOAD_OP(wasm_u8_t, u64, wasm_u64_t);
-      GOTO_NEXT(code);
-    }
-    CASE(I64_LOAD16_S) {
-      LOAD_OP(wasm_s16_t, s64, wasm_s64_t);
-      GOTO_NEXT(code);
-    }
-    CASE(I64_LOAD16_U) {
-      LOAD_OP(wasm_u16_t, u64, wasm_u64_t);
-      GOTO_NEXT(code);
-    }
-    CASE(I64_LOAD32_S) {
-      LOAD_OP(wasm_s32_t, s64, wasm_s64_t);
-      GOTO_NEXT(code);
-    }
-    CASE(I64_LOAD32_U) {
-      LOAD_OP(wasm_u32_t, u64, wasm_u64_t);
-      GOTO_NEXT(code);
-    }
-#define STORE_OP(itype, otype)                             \
-  do {                                                     \
-    *(otype *) &mod->memory_block->data[code->op0.index] = \
-        (otype) stack[code->op1.reg].itype;                \
-    code++;                                                \
-  } while (0)
-    CASE(I32_STORE) {
-      STORE_OP(u32, wasm_u32_t);
-      GOTO_NEXT(code);
-    }
-    CASE(I64_STORE) {
-      STORE_OP(u64, wasm_u64_t);
-      GOTO_NEXT(code);
-    }
-    CASE(F32_STORE) {
-      STORE_OP(f32, wasm_f32_t);
-      GOTO_NEXT(code);
-    }
-    CASE(F64_STORE) {
-      STORE_OP(f64, wasm_f64_t);
-      GOTO_NEXT(code);
-    }
-    CASE(I32_STORE8) {
-      STORE_OP(u8, wasm_u32_t);
-      GOTO_NEXT(code);
-    }
-    CASE(I32_STORE16) {
-      STORE_OP(u16, wasm_u32_t);
-      GOTO_NEXT(code);
-    }
-    CASE(I64_STORE8) {
-      STORE_OP(u8, wasm_u64_t);
-      GOTO_NEXT(code);
-    }
-    CASE(I64_STORE16) {
-      STORE_OP(u16, wasm_u64_t);
-      GOTO_NEXT(code);
-    }
-    CASE(I64_STORE32) {
-      STORE_OP(u32, wasm_u64_t);
-      GOTO_NEXT(code);
-    }
-    CASE(MEMORY_SIZE) {
-      stack[code->op0.reg].u32 = wasmbox_runtime_memory_size(mod);
-      code++;
-      GOTO_NEXT(code);
-    }
-    CASE(MEMORY_GROW) {
-      stack[code->op0.reg].u32 =
-          wasmbox_runtime_memory_grow(mod, stack[code->op1.reg].u32);
-      code++;
-      GOTO_NEXT(code);
-    }
-#define LOAD_CONST_OP(type)                           \
-  do {                                                \
-    stack[code->op0.reg].type = code->op1.value.type; \
-    code++;                                           \
-  } while (0)
-    CASE(LOAD_CONST_I32) {
-      LOAD_CONST_OP(u32);
-      GOTO_NEXT(code);
-    }
-    CASE(LOAD_CONST_I64) {
-      LOAD_CONST_OP(u64);
-      GOTO_NEXT(code);
-    }
-    CASE(LOAD_CONST_F32) {
-      LOAD_CONST_OP(f32);
-      GOTO_NEXT(code);
-    }
-    CASE(LOAD_CONST_F64) {
-      LOAD_CONST_OP(f64);
-      GOTO_NEXT(code);
-    }
-#define ARITHMETIC_OP(arg_type, operand) \
-  ARITHMETIC_OP2(arg_type, arg_type, operand)
+_Static_assert(offsetof(wasmbox_module_t, memory_block_capacity) +
+                       sizeof(wasm_u32_t) <=
+                   64,
+               "state read by handlers should fit in one cache line");
 
-#define ARITHMETIC_OP2(arg_type, ret_type, operand)                          \
-  do {                                                                       \
-    stack[code->op0.reg].ret_type =                                          \
-        stack[code->op1.reg].arg_type operand stack[code->op2.reg].arg_type; \
-    code++;                                                                  \
-  } while (0)
-    CASE(I32_EQZ) {
-      stack[code->op0.reg].u32 = stack[code->op1.reg].u32 == 0;
-      code++;
-      GOTO_NEXT(code);
-    }
-    CASE(I32_EQ) {
-      ARITHMETIC_OP(s32, ==);
-      GOTO_NEXT(code);
-    }
-    CASE(I32_NE) {
-      ARITHMETIC_OP(s32, !=);
-      GOTO_NEXT(code);
-    }
-    CASE(I32_LT_S) {
-      ARITHMETIC_OP(s32, <);
-      GOTO_NEXT(code);
-    }
-    CASE(I32_LT_U) {
-      ARITHMETIC_OP(u32, <);
-      GOTO_NEXT(code);
-    }
-    CASE(I32_GT_S) {
-      ARITHMETIC_OP(s32, >);
-      GOTO_NEXT(code);
-    }
-    CASE(I32_GT_U) {
-      ARITHMETIC_OP(u32, >);
-      GOTO_NEXT(code);
-    }
-    CASE(I32_LE_S) {
-      ARITHMETIC_OP(s32, <=);
-      GOTO_NEXT(code);
-    }
-    CASE(I32_LE_U) {
-      ARITHMETIC_OP(u32, <=);
-      GOTO_NEXT(code);
-    }
-    CASE(I32_GE_S) {
-      ARITHMETIC_OP(s32, >=);
-      GOTO_NEXT(code);
-    }
-    CASE(I32_GE_U) {
-      ARITHMETIC_OP(u32, >=);
-      GOTO_NEXT(code);
-    }
-    CASE(I64_EQZ) {
-      stack[code->op0.reg].u64 = stack[code->op1.reg].u64 == 0;
-      code++;
-      GOTO_NEXT(code);
-    }
-    CASE(I64_EQ) {
-      ARITHMETIC_OP2(u64, s32, ==);
-      GOTO_NEXT(code);
-    }
-    CASE(I64_NE) {
-      ARITHMETIC_OP2(u64, s32, !=);
-      GOTO_NEXT(code);
-    }
-    CASE(I64_LT_S) {
-      ARITHMETIC_OP2(s64, s32, <);
-      GOTO_NEXT(code);
-    }
-    CASE(I64_LT_U) {
-      ARITHMETIC_OP2(u64, s32, <);
-      GOTO_NEXT(code);
-    }
-    CASE(I64_GT_S) {
-      ARITHMETIC_OP2(s64, s32, >);
-      GOTO_NEXT(code);
-    }
-    CASE(I64_GT_U) {
-      ARITHMETIC_OP2(u64, s32, >);
-      GOTO_NEXT(code);
-    }
-    CASE(I64_LE_S) {
-      ARITHMETIC_OP2(s64, s32, <=);
-      GOTO_NEXT(code);
-    }
-    CASE(I64_LE_U) {
-      ARITHMETIC_OP2(u64, s32, <=);
-      GOTO_NEXT(code);
-    }
-    CASE(I64_GE_S) {
-      ARITHMETIC_OP2(s64, s32, >=);
-      GOTO_NEXT(code);
-    }
-    CASE(I64_GE_U) {
-      ARITHMETIC_OP2(u64, s32, >=);
-      GOTO_NEXT(code);
-    }
-    CASE(F32_EQ) {
-      ARITHMETIC_OP2(f32, s32, ==);
-      GOTO_NEXT(code);
-    }
-    CASE(F32_NE) {
-      ARITHMETIC_OP2(f32, s32, !=);
-      GOTO_NEXT(code);
-    }
-    CASE(F32_LT) {
-      ARITHMETIC_OP2(f32, s32, <);
-      GOTO_NEXT(code);
-    }
-    CASE(F32_GT) {
-      ARITHMETIC_OP2(f32, s32, >);
-      GOTO_NEXT(code);
-    }
-    CASE(F32_LE) {
-      ARITHMETIC_OP2(f32, s32, <=);
-      GOTO_NEXT(code);
-    }
-    CASE(F32_GE) {
-      ARITHMETIC_OP2(f32, s32, >=);
-      GOTO_NEXT(code);
-    }
-    CASE(F64_EQ) {
-      ARITHMETIC_OP2(f64, s32, ==);
-      GOTO_NEXT(code);
-    }
-    CASE(F64_NE) {
-      ARITHMETIC_OP2(f64, s32, !=);
-      GOTO_NEXT(code);
-    }
-    CASE(F64_LT) {
-      ARITHMETIC_OP2(f64, s32, <);
-      GOTO_NEXT(code);
-    }
-    CASE(F64_GT) {
-      ARITHMETIC_OP2(f64, s32, >);
-      GOTO_NEXT(code);
-    }
-    CASE(F64_LE) {
-      ARITHMETIC_OP2(f64, s32, <=);
-      GOTO_NEXT(code);
-    }
-    CASE(F64_GE) {
-      ARITHMETIC_OP2(f64, s32, >=);
-      GOTO_NEXT(code);
-    }
-    CASE(I32_CLZ) {
-      stack[code->op0.reg].u32 =
-          wasmbox_runtime_clz32(stack[code->op1.reg].u64);
-      code++;
-      GOTO_NEXT(code);
-    }
-    CASE(I32_CTZ) {
-      stack[code->op0.reg].u32 =
-          wasmbox_runtime_ctz32(stack[code->op1.reg].u64);
-      code++;
-      GOTO_NEXT(code);
-    }
-    CASE(I32_POPCNT) {
-      NOT_IMPLEMENTED();
-    }
-    CASE(I32_ADD) {
-      ARITHMETIC_OP(u32, +);
-      GOTO_NEXT(code);
-    }
-    CASE(I32_SUB) {
-      ARITHMETIC_OP(u32, -);
-      GOTO_NEXT(code);
-    }
-    CASE(I32_MUL) {
-      ARITHMETIC_OP(u32, *);
-      GOTO_NEXT(code);
-    }
-    CASE(I32_DIV_S) {
-      ARITHMETIC_OP(s32, /);
-      GOTO_NEXT(code);
-    }
-    CASE(I32_DIV_U) {
-      ARITHMETIC_OP(u32, /);
-      GOTO_NEXT(code);
-    }
-    CASE(I32_REM_S) {
-      ARITHMETIC_OP(s32, %);
-      GOTO_NEXT(code);
-    }
-    CASE(I32_REM_U) {
-      ARITHMETIC_OP(u32, %);
-      GOTO_NEXT(code);
-    }
-    CASE(I32_AND) {
-      ARITHMETIC_OP(u32, &);
-      GOTO_NEXT(code);
-    }
-    CASE(I32_OR) {
-      ARITHMETIC_OP(u32, |);
-      GOTO_NEXT(code);
-    }
-    CASE(I32_XOR) {
-      ARITHMETIC_OP(u32, ^);
-      GOTO_NEXT(code);
-    }
-    CASE(I32_SHL) {
-      ARITHMETIC_OP(u32, <<);
-      GOTO_NEXT(code);
-    }
-    CASE(I32_SHR_S) {
-      ARITHMETIC_OP(s32, >>);
-      GOTO_NEXT(code);
-    }
-    CASE(I32_SHR_U) {
-      ARITHMETIC_OP(u32, >>);
-      GOTO_NEXT(code);
-    }
-    CASE(I32_ROTL) {
-      stack[code->op0.reg].u32 = wasmbox_runtime_rotl32(
-          stack[code->op1.reg].u32, stack[code->op2.reg].u32);
-      code++;
-      GOTO_NEXT(code);
-    }
-    CASE(I32_ROTR) {
-      stack[code->op0.reg].u32 = wasmbox_runtime_rotr32(
-          stack[code->op1.reg].u32, stack[code->op2.reg].u32);
-      code++;
-      GOTO_NEXT(code);
-    }
-    CASE(I64_CLZ) {
-      stack[code->op0.reg].u64 =
-          wasmbox_runtime_clz64(stack[code->op1.reg].u64);
-      code++;
-      GOTO_NEXT(code);
-    }
-    CASE(I64_CTZ) {
-      stack[code->op0.reg].u64 =
-          wasmbox_runtime_ctz64(stack[code->op1.reg].u64);
-      code++;
-      GOTO_NEXT(code);
-    }
-    CASE(I64_POPCNT) {
-      NOT_IMPLEMENTED();
-    }
-    CASE(I64_ADD) {
-      ARITHMETIC_OP2(s64, s64, +);
-      GOTO_NEXT(code);
-    }
-    CASE(I64_SUB) {
-      ARITHMETIC_OP2(s64, s64, -);
-      GOTO_NEXT(code);
-    }
-    CASE(I64_MUL) {
-      ARITHMETIC_OP2(s64, s64, *);
-      GOTO_NEXT(code);
-    }
-    CASE(I64_DIV_S) {
-      ARITHMETIC_OP2(s64, s64, /);
-      GOTO_NEXT(code);
-    }
-    CASE(I64_DIV_U) {
-      ARITHMETIC_OP2(u64, u64, /);
-      GOTO_NEXT(code);
-    }
-    CASE(I64_REM_S) {
-      ARITHMETIC_OP2(s64, s64, %);
-      GOTO_NEXT(code);
-    }
-    CASE(I64_REM_U) {
-      ARITHMETIC_OP2(u64, u64, %);
-      GOTO_NEXT(code);
-    }
-    CASE(I64_AND) {
-      ARITHMETIC_OP2(u64, u64, &);
-      GOTO_NEXT(code);
-    }
-    CASE(I64_OR) {
-      ARITHMETIC_OP2(u64, u64, |);
-      GOTO_NEXT(code);
-    }
-    CASE(I64_XOR) {
-      ARITHMETIC_OP2(u64, u64, ^);
-      GOTO_NEXT(code);
-    }
-    CASE(I64_SHL) {
-      ARITHMETIC_OP2(u64, u64, <<);
-      GOTO_NEXT(code);
-    }
-    CASE(I64_SHR_S) {
-      ARITHMETIC_OP2(s64, s64, >>);
-      GOTO_NEXT(code);
-    }
-    CASE(I64_SHR_U) {
-      ARITHMETIC_OP2(u64, u64, >>);
-      GOTO_NEXT(code);
-    }
-    CASE(I64_ROTL) {
-      stack[code->op0.reg].u64 = wasmbox_runtime_rotl64(
-          stack[code->op1.reg].u64, stack[code->op2.reg].u64);
-      code++;
-      GOTO_NEXT(code);
-    }
-    CASE(I64_ROTR) {
-      stack[code->op0.reg].u64 = wasmbox_runtime_rotr64(
-          stack[code->op1.reg].u64, stack[code->op2.reg].u64);
-      code++;
-      GOTO_NEXT(code);
-    }
-    CASE(F32_ABS) {
-      NOT_IMPLEMENTED();
-    }
-    CASE(F32_NEG) {
-      NOT_IMPLEMENTED();
-    }
-    CASE(F32_CEIL) {
-      NOT_IMPLEMENTED();
-    }
-    CASE(F32_FLOOR) {
-      NOT_IMPLEMENTED();
-    }
-    CASE(F32_TRUNC) {
-      NOT_IMPLEMENTED();
-    }
-    CASE(F32_NEAREST) {
-      NOT_IMPLEMENTED();
-    }
-    CASE(F32_SQRT) {
-      NOT_IMPLEMENTED();
-    }
-    CASE(F32_ADD) {
-      ARITHMETIC_OP2(f32, f32, +);
-      GOTO_NEXT(code);
-    }
-    CASE(F32_SUB) {
-      ARITHMETIC_OP2(f32, f32, -);
-      GOTO_NEXT(code);
-    }
-    CASE(F32_MUL) {
-      ARITHMETIC_OP2(f32, f32, *);
-      GOTO_NEXT(code);
-    }
-    CASE(F32_DIV) {
-      ARITHMETIC_OP2(f32, f32, /);
-      GOTO_NEXT(code);
-    }
-    CASE(F32_MIN) {
-      NOT_IMPLEMENTED();
-    }
-    CASE(F32_MAX) {
-      NOT_IMPLEMENTED();
-    }
-    CASE(F32_COPYSIGN) {
-      NOT_IMPLEMENTED();
-    }
-    CASE(F64_ABS) {
-      NOT_IMPLEMENTED();
-    }
-    CASE(F64_NEG) {
-      NOT_IMPLEMENTED();
-    }
-    CASE(F64_CEIL) {
-      NOT_IMPLEMENTED();
-    }
-    CASE(F64_FLOOR) {
-      NOT_IMPLEMENTED();
-    }
-    CASE(F64_TRUNC) {
-      NOT_IMPLEMENTED();
-    }
-    CASE(F64_NEAREST) {
-      NOT_IMPLEMENTED();
-    }
-    CASE(F64_SQRT) {
-      NOT_IMPLEMENTED();
-    }
-    CASE(F64_ADD) {
-      ARITHMETIC_OP2(f64, f64, +);
-      GOTO_NEXT(code);
-    }
-    CASE(F64_SUB) {
-      ARITHMETIC_OP2(f64, f64, -);
-      GOTO_NEXT(code);
-    }
-    CASE(F64_MUL) {
-      ARITHMETIC_OP2(f64, f64, *);
-      GOTO_NEXT(code);
-    }
-    CASE(F64_DIV) {
-      ARITHMETIC_OP2(f64, f64, /);
-      GOTO_NEXT(code);
-    }
-    CASE(F64_MIN) {
-      NOT_IMPLEMENTED();
-    }
-    CASE(F64_MAX) {
-      NOT_IMPLEMENTED();
-    }
-    CASE(F64_COPYSIGN) {
-      NOT_IMPLEMENTED();
-    }
-    CASE(WRAP_I64) {
-      NOT_IMPLEMENTED();
-    }
-    CASE(I32_TRUNC_F32_S) {
-      NOT_IMPLEMENTED();
-    }
-    CASE(I32_TRUNC_F32_U) {
-      NOT_IMPLEMENTED();
-    }
-    CASE(I32_TRUNC_F64_S) {
-      NOT_IMPLEMENTED();
-    }
-    CASE(I32_TRUNC_F64_U) {
-      NOT_IMPLEMENTED();
-    }
-#define CONVERT_OP(arg_type, ret_type, operand)                              \
-  do {                                                                       \
-    stack[code->op0.reg].ret_type = (operand) stack[code->op1.reg].arg_type; \
-    code++;                                                                  \
-  } while (0)
-    CASE(I64_EXTEND_I32_S) {
-      CONVERT_OP(s32, s64, wasm_s64_t);
-      GOTO_NEXT(code);
-    }
-    CASE(I64_EXTEND_I32_U) {
-      CONVERT_OP(u32, u64, wasm_u64_t);
-      GOTO_NEXT(code);
-    }
-    CASE(I64_TRUNC_F32_S) {
-      NOT_IMPLEMENTED();
-    }
-    CASE(I64_TRUNC_F32_U) {}
-    NOT_IMPLEMENTED();
-    CASE(I64_TRUNC_F64_S) {
-      NOT_IMPLEMENTED();
-    }
-    CASE(I64_TRUNC_F64_U) {
-      NOT_IMPLEMENTED();
-    }
+/*
+ * The interpreter is built once per CPU level below and
+ * wasmbox_virtual_machine_init picks the best one the host supports. The
+ * runtime helpers are inlined into each build, so clz, ctz, popcnt, the
+ * rotates and float rounding use LZCNT, TZCNT, POPCNT, BMI2 and ROUNDSS where
+ * the hardware has them.
+ */
+#define WASMBOX_VM_ISA_CONCAT(X, ISA)  X##_##ISA
+#define WASMBOX_VM_ISA_CONCAT2(X, ISA) WASMBOX_VM_ISA_CONCAT(X, ISA)
+#define WASMBOX_VM_ISA_NAME(X)         WASMBOX_VM_ISA_CONCAT2(X, WASMBOX_VM_ISA)
 
-    CASE(F32_CONVERT_I32_S) {
-      CONVERT_OP(s32, f32, wasm_f32_t);
-      GOTO_NEXT(code);
-    }
-    CASE(F32_CONVERT_I32_U) {
-      CONVERT_OP(u32, f32, wasm_f32_t);
-      GOTO_NEXT(code);
-    }
-    CASE(F32_CONVERT_I64_S) {
-      CONVERT_OP(s64, f32, wasm_f32_t);
-      GOTO_NEXT(code);
-    }
-    CASE(F32_CONVERT_I64_U) {
-      CONVERT_OP(u64, f32, wasm_f32_t);
-      GOTO_NEXT(code);
-    }
-    CASE(F32_DEMOTE_F64) {
-      CONVERT_OP(f64, f32, wasm_f32_t);
-      GOTO_NEXT(code);
-    }
-    CASE(F64_CONVERT_I32_S) {
-      CONVERT_OP(s32, f64, wasm_f64_t);
-      GOTO_NEXT(code);
-    }
-    CASE(F64_CONVERT_I32_U) {
-      CONVERT_OP(u32, f64, wasm_f64_t);
-      GOTO_NEXT(code);
-    }
-    CASE(F64_CONVERT_I64_S) {
-      CONVERT_OP(s64, f64, wasm_f64_t);
-      GOTO_NEXT(code);
-    }
-    CASE(F64_CONVERT_I64_U) {
-      CONVERT_OP(u64, f64, wasm_f32_t);
-      GOTO_NEXT(code);
-    }
-    CASE(F64_PROMOTE_F32) {
-      CONVERT_OP(f32, f64, wasm_f64_t);
-      GOTO_NEXT(code);
-    }
-    CASE(I32_REINTERPRET_F32) {
-      stack[code->op0.reg].u32 = stack[code->op1.reg].u32;
-      code++;
-      GOTO_NEXT(code);
-    }
-    CASE(I64_REINTERPRET_F64) {
-      stack[code->op0.reg].u64 = stack[code->op1.reg].u64;
-      code++;
-      GOTO_NEXT(code);
-    }
-    CASE(F32_REINTERPRET_I32) {
-      stack[code->op0.reg].f32 = stack[code->op1.reg].f32;
-      code++;
-      GOTO_NEXT(code);
-    }
-    CASE(F64_REINTERPRET_I64) {
-      stack[code->op0.reg].f64 = stack[code->op1.reg].f64;
-      code++;
-      GOTO_NEXT(code);
-    }
-#define EXTEND_OP(arg_type, ret_type, operand)                               \
-  do {                                                                       \
-    stack[code->op0.reg].ret_type = (operand) stack[code->op1.reg].arg_type; \
-    code++;                                                                  \
-  } while (0)
-    CASE(I32_EXTEND8_S) {
-      EXTEND_OP(s8, s32, wasm_s32_t);
-      GOTO_NEXT(code);
-    }
-    CASE(I32_EXTEND16_S) {
-      EXTEND_OP(s16, s32, wasm_s32_t);
-      GOTO_NEXT(code);
-    }
-    CASE(I64_EXTEND8_S) {
-      EXTEND_OP(s8, s64, wasm_s64_t);
-      GOTO_NEXT(code);
-    }
-    CASE(I64_EXTEND16_S) {
-      EXTEND_OP(s16, s64, wasm_s64_t);
-      GOTO_NEXT(code);
-    }
-    CASE(I64_EXTEND32_S) {
-      EXTEND_OP(s32, s64, wasm_s64_t);
-      GOTO_NEXT(code);
-    }
-    CASE(I32_TRUNC_SAT_F32_S) {
-      NOT_IMPLEMENTED();
-    }
-    CASE(I32_TRUNC_SAT_F32_U) {
-      NOT_IMPLEMENTED();
-    }
-    CASE(I32_TRUNC_SAT_F64_S) {
-      NOT_IMPLEMENTED();
-    }
-    CASE(I32_TRUNC_SAT_F64_U) {
-      NOT_IMPLEMENTED();
-    }
-    CASE(I64_TRUNC_SAT_F32_S) {
-      NOT_IMPLEMENTED();
-    }
-    CASE(I64_TRUNC_SAT_F32_U) {
-      NOT_IMPLEMENTED();
-    }
-    CASE(I64_TRUNC_SAT_F64_S) {
-      NOT_IMPLEMENTED();
-    }
-    CASE(I64_TRUNC_SAT_F64_U) {
-      NOT_IMPLEMENTED();
-    }
-    // default:
-    //   LOG("unknown opcode");
-    //   return;
+#if defined(WASMBOX_VM_USE_CPU_DISPATCH) && defined(__x86_64__) && \
+    !defined(__clang__) && defined(__GNUC__) && __GNUC__ >= 12
+#  define WASMBOX_VM_ISA_X86_64 1
+#endif
+
+typedef void (*wasmbox_eval_function_t)(wasmbox_module_t *mod,
+                                        wasmbox_code_t *code,
+                                        wasmbox_value_t *stack);
+
+#define WASMBOX_VM_ISA generic
+#include "interpreter-eval.h"
+#undef WASMBOX_VM_ISA
+
+#ifdef WASMBOX_VM_ISA_X86_64
+#  pragma GCC push_options
+#  pragma GCC target("arch=x86-64-v2")
+#  define WASMBOX_VM_ISA x86_64_v2
+#  include "interpreter-eval.h"
+#  undef WASMBOX_VM_ISA
+#  pragma GCC pop_options
+
+#  pragma GCC push_options
+#  pragma GCC target("arch=x86-64-v3")
+#  define WASMBOX_VM_ISA x86_64_v3
+#  include "interpreter-eval.h"
+#  undef WASMBOX_VM_ISA
+#  pragma GCC pop_options
+#endif /* WASMBOX_VM_ISA_X86_64 */
+
+static wasmbox_eval_function_t wasmbox_eval_function_impl =
+    wasmbox_eval_function_generic;
+static once_flag wasmbox_eval_function_once = ONCE_FLAG_INIT;
+
+static void wasmbox_eval_function_select(void) {
+#ifdef WASMBOX_VM_ISA_X86_64
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("x86-64-v3")) {
+    wasmbox_eval_function_impl = wasmbox_eval_function_x86_64_v3;
+  } else if (__builtin_cpu_supports("x86-64-v2")) {
+    wasmbox_eval_function_impl = wasmbox_eval_function_x86_64_v2;
   }
-  DISPATCH_END(code);
+#endif
 }
 
-void wasmbox_dump_function(wasmbox_code_t *code_start, wasmbox_code_t *code_end,
+void wasmbox_eval_function(wasmbox_module_t *mod, wasmbox_code_t *code,
+                           wasmbox_value_t *stack) {
+  wasmbox_eval_function_impl(mod, code, stack);
+}
+
+void wasmbox_dump_function(FILE *out, wasmbox_module_t *mod,
+                           wasmbox_code_t *code_start, wasmbox_code_t *code_end,
                            const char *indent) {
   wasmbox_code_t *code = code_start;
   while (code < code_end) {
-    fprintf(stdout, "[%03ld:%p] ", code - code_start, code);
+    fprintf(out, "[%03ld:%p] ", code - code_start, code);
     switch (code->h.opcode) {
       case OPCODE_UNREACHABLE:
       case OPCODE_NOP:
       case OPCODE_SELECT:
         fprintf(
-            stdout,
+            out,
             "%sstack[%d].u64 = stack[%d].u64 ? stack[%d].u64 : stack[%d].u64\n",
             indent, code->op0.reg, code->op1.reg, code->op2.r.reg1,
             code->op2.r.reg2);
         break;
       case OPCODE_EXIT:
-        fprintf(stdout, "%sexit\n", indent);
+        fprintf(out, "%sexit\n", indent);
         break;
       case OPCODE_RETURN:
-        fprintf(stdout, "%sreturn;\n", indent);
+        fprintf(out, "%sreturn;\n", indent);
         break;
       case OPCODE_MOVE:
-        fprintf(stdout, "%sstack[%d].u64= stack[%d].u64\n", indent,
+        fprintf(out, "%sstack[%d].u64= stack[%d].u64\n", indent,
                 code->op0.reg, code->op1.reg);
         break;
       case OPCODE_JUMP:
-        fprintf(stdout, "%sjump to %p\n", indent, code->op0.code);
+        fprintf(out, "%sjump to %p\n", indent,
+                WASMBOX_CODE_TARGET(code, op0));
         break;
       case OPCODE_JUMP_IF:
-        fprintf(stdout, "%sjump to %p if stack[%d].u32\n", indent,
-                code->op0.code, code->op1.reg);
+        fprintf(out, "%sjump to %p if stack[%d].u32\n", indent,
+                WASMBOX_CODE_TARGET(code, op0), code->op1.reg);
         break;
       case OPCODE_JUMP_TABLE:
-        fprintf(stdout, "%sjump to (stack[%d].u32) \n", indent, code->op2.reg);
-        for (int i = 0; i < code->op0.table->size; ++i) {
-          fprintf(stdout, "%s%s%d -> %p\n", indent, indent, i,
-                  code->op0.table->labels[i].code);
+        fprintf(out, "%sjump to (stack[%d].u32) \n", indent, code->op2.reg);
+        for (wasm_u32_t i = 0; i < code->op0.index; ++i) {
+          fprintf(out, "%s%s%d -> %p\n", indent, indent, i,
+                  WASMBOX_JUMP_TARGET_CODE(
+                      code, WASMBOX_JUMP_TABLE_TARGETS(code) + i));
         }
-        fprintf(stdout, "%s%sdefault -> %p\n", indent, indent, code->op1.code);
+        fprintf(out, "%s%sdefault -> %p\n", indent, indent,
+                WASMBOX_CODE_TARGET(code, op1));
         break;
       case OPCODE_DYNAMIC_CALL:
-        fprintf(stdout, "%sstack[%d].u64= func%u()\n", indent, code->op0.reg,
-                code->op1.index);
+        fprintf(out, "%sstack[%d].u64= table%u[stack[%d].u32]()\n", indent,
+                code->op0.reg, WASMBOX_CODE_CACHE(code, op1)->tableidx,
+                code->op2.reg);
         break;
       case OPCODE_STATIC_CALL:
-        fprintf(stdout, "%sstack[%d].u64= func%p([args:%d, returns:%d])\n",
-                indent, code->op0.reg, code->op1.func,
-                code->op1.func->type->argument_size,
-                code->op1.func->type->argument_size);
-        break;
+        fprintf(out, "%sstack[%d].u64= func%p([args:%d, returns:%d])\n",
+                indent, code->op0.reg, WASMBOX_CODE_FUNC(mod, code, op1),
+                WASMBOX_CODE_FUNC(mod, code, op1)->type->argument_size,
+                WASMBOX_CODE_FUNC(mod, code, op1)->type->return_size);
+        break;
+      case OPCODE_DYNAMIC_TAIL_CALL:
+        fprintf(out, "%stail call table%u[stack[%d].u32]()\n", indent,
+                WASMBOX_CODE_CACHE(code, op1)->tableidx, code->op2.reg);
+        break;
+      case OPCODE_STATIC_TAIL_CALL:
+        fprintf(out, "%stail call func%p([args:%d, returns:%d])\n", indent,
+                WASMBOX_CODE_FUNC(mod, code, op1),
+                WASMBOX_CODE_FUNC(mod, code, op1)->type->argument_size,
+                WASMBOX_CODE_FUNC(mod, code, op1)->type->return_size);
+        break;
+      case OPCODE_JIT_ENTRY:
+        fprintf(out, "%snative code %p\n", indent,
+                (void *) (uintptr_t) WASMBOX_CODE_VALUE(code, op0).u64);
+        break;
+      case OPCODE_LAZY_COMPILE:
+        fprintf(out, "%scompile func%p on first call\n", indent,
+                WASMBOX_CODE_FUNC(mod, code, op1));
+        break;
+      case OPCODE_FUEL:
+        fprintf(out, "%sfuel -= %u\n", indent, code->op0.index);
+        break;
+      case OPCODE_EPOCH:
+        fprintf(out, "%scheck epoch\n", indent);
+        break;
+      case OPCODE_HOTNESS:
+        fprintf(out, "%scount hotness of func%p\n", indent,
+                WASMBOX_CODE_FUNC(mod, code, op1));
+        break;
+      case OPCODE_HOST_CALL:
+        fprintf(out, "%shost call %p\n", indent,
+                (void *) (uintptr_t) WASMBOX_CODE_VALUE(code, op0).u64);
+        break;
+      case OPCODE_BATCH_NEXT:
+        fprintf(out, "%snext call of batch %p\n", indent,
+                (void *) (uintptr_t) WASMBOX_CODE_VALUE(code, op0).u64);
+        break;
+#define DUMP_COMPARE_AND_BRANCH_unary(type, operand)                      \
+  fprintf(out, "%sjump to %p if stack[%d]." #type " " #operand " 0\n", \
+          indent, WASMBOX_CODE_TARGET(code, op0), code->op1.reg)
+#define DUMP_COMPARE_AND_BRANCH_binary(type, operand)                   \
+  fprintf(out,                                                       \
+          "%sjump to %p if stack[%d]." #type " " #operand " stack[%d]." \
+          #type "\n",                                                   \
+          indent, WASMBOX_CODE_TARGET(code, op0), code->op1.reg,        \
+          code->op2.reg)
+#define FUNC(param, type, operand, cmp, vmopcode)   \
+  case vmopcode:                                    \
+    DUMP_COMPARE_AND_BRANCH_##param(type, operand); \
+    break;
+        COMPARE_AND_BRANCH_INST_EACH(FUNC)
+#undef FUNC
+#define FUNC(type, operand, cmp, vmopcode)                                   \
+  case vmopcode:                                                             \
+    fprintf(out,                                                          \
+            "%sstack[%d].u32 += %d; jump to %p if stack[%d]." #type          \
+            " " #operand " stack[%d]." #type "\n",                           \
+            indent, code->op1.reg, code->op2.r.reg2,                         \
+            WASMBOX_CODE_TARGET(code, op0), code->op1.reg, code->op2.r.reg1); \
+    break;
+        LOOP_INC_INST_EACH(FUNC)
+#undef FUNC
+#define FUNC(wtype, type, operand, inst, vmopcode)                          \
+  case vmopcode:                                                            \
+    fprintf(out, "%sstack[%d]." #type " = stack[%d]." #type " " #operand \
+            " %lld\n",                                                      \
+            indent, code->op0.reg, code->op1.reg,                           \
+            (long long) WASMBOX_CODE_VALUE(code, op2).type);                \
+    break;
+        IMMEDIATE_INST_EACH(FUNC)
+#undef FUNC
+#define FUNC(type, operand, inst, vmopcode)                                 \
+  case vmopcode:                                                            \
+    fprintf(out, "%sstack[%d]." #type " = stack[%d]." #type " %s %d"        \
+                 " (magic 0x%x)\n",                                         \
+            indent, code->op0.reg, code->op1.reg, #operand,                 \
+            WASMBOX_CODE_VALUE(code, op2).s32,                              \
+            (wasm_u32_t) (WASMBOX_CODE_VALUE(code, op2).u64 >> 32));        \
+    break;
+        DIVISION_MAGIC_INST_EACH(FUNC)
+#undef FUNC
       case OPCODE_GLOBAL_GET:
-        fprintf(stdout, "%sstack[%d].u64= global[%d].u64\n", indent,
-                code->op0.reg, code->op1.reg);
+        fprintf(out, "%sstack[%d].u64= global[%u].u64\n", indent,
+                code->op0.reg, code->op1.index);
         break;
       case OPCODE_GLOBAL_SET:
-        fprintf(stdout, "%sglobal[%d].u64= stack[%d].u64\n", indent,
-                code->op0.reg, code->op1.reg);
+        fprintf(out, "%sglobal[%u].u64= stack[%d].u64\n", indent,
+                code->op0.index, code->op1.reg);
+        break;
+      case OPCODE_STACK_POINTER_GET:
+        fprintf(out, "%sstack[%d].u32= sp (global[%u])\n", indent,
+                code->op0.reg, code->op1.index);
+        break;
+      case OPCODE_STACK_POINTER_SET:
+        fprintf(out, "%ssp (global[%u])= stack[%d].u32 + %d\n", indent,
+                code->op0.index, code->op1.reg, (wasm_s32_t) code->op2.index);
+        break;
+      case OPCODE_STACK_POINTER_ADD:
+        fprintf(out, "%sstack[%d].u32= sp (global[%u]) += %d\n", indent,
+                code->op0.reg, code->op1.index, (wasm_s32_t) code->op2.index);
+        break;
+      case OPCODE_ZERO_LOCALS:
+        fprintf(out, "%sstack[%d..%d].u64= 0\n", indent, code->op0.reg,
+                code->op0.reg + (wasm_s32_t) code->op1.index);
+        break;
+      case OPCODE_MODULE_CALL: {
+        wasmbox_module_link_t *link =
+            (wasmbox_module_link_t *) (uintptr_t) WASMBOX_CODE_VALUE(code, op1)
+                .u64;
+        fprintf(out,
+                "%sstack[%d].u64= module%p.func%p([args:%d, returns:%d]), "
+                "module saved to stack[%d]\n",
+                indent, code->op0.reg, (void *) link->module,
+                (void *) link->func, link->func->type->argument_size,
+                link->func->type->return_size, code->op2.reg);
+        break;
+      }
+      case OPCODE_MODULE_RESTORE:
+        fprintf(out, "%smodule= stack[%d]\n", indent, code->op0.reg);
         break;
 #define DUMP_LOAD_OP(itype, otype)                          \
   do {                                                      \
-    fprintf(stdout,                                         \
+    fprintf(out,                                         \
             "stack[%d]." #otype " = (" #otype ") *(" #itype \
-            " *) &memory[%d]\n",                            \
-            code->op0.reg, code->op1.index);                \
+            " *) &memory[stack[%d].u32 + %u]\n",            \
+            code->op0.reg, code->op1.reg, code->op2.index); \
   } while (0)
       case OPCODE_I32_LOAD:
         DUMP_LOAD_OP(u32, u32);
@@ -1187,12 +839,12 @@ void wasmbox_dump_function(wasmbox_code_t *code_start, wasmbox_code_t *code_end,
       case OPCODE_I64_LOAD32_U:
         DUMP_LOAD_OP(u32, u64);
         break;
-#define DUMP_STORE_OP(itype, otype)                                          \
-  do {                                                                       \
-    fprintf(stdout,                                                          \
-            "*(" #otype " *) &memory[%d] = (" #otype ") = stack[%d]." #itype \
-            "\n",                                                            \
-            code->op0.index, code->op1.reg);                                 \
+#define DUMP_STORE_OP(itype, otype)                                     \
+  do {                                                                  \
+    fprintf(out,                                                     \
+            "*(" #otype " *) &memory[stack[%d].u32 + %u] = stack[%d]." \
+            #itype "\n",                                                \
+            code->op0.reg, code->op2.index, code->op1.reg);             \
   } while (0)
       case OPCODE_I32_STORE:
         DUMP_STORE_OP(u32, u32);
@@ -1221,17 +873,129 @@ void wasmbox_dump_function(wasmbox_code_t *code_start, wasmbox_code_t *code_end,
       case OPCODE_I64_STORE32:
         DUMP_STORE_OP(u64, u32);
         break;
+#define DUMP_INDEXED_load(mtype, field)                                 \
+  fprintf(out,                                                          \
+          "%sstack[%d]." #field " = *(" #mtype                          \
+          " *) &memory[stack[%d].u32 + (stack[%d].u32 << %d) + %u]\n",  \
+          indent, code->op0.r.reg1, code->op1.r.reg1, code->op1.r.reg2, \
+          code->op0.r.reg2, code->op2.index)
+#define DUMP_INDEXED_store(mtype, field)                                    \
+  fprintf(out,                                                              \
+          "%s*(" #mtype " *) &memory[stack[%d].u32 + (stack[%d].u32 << %d)" \
+          " + %u] = stack[%d]." #field "\n",                                \
+          indent, code->op1.r.reg1, code->op1.r.reg2, code->op0.r.reg2,     \
+          code->op2.index, code->op0.r.reg1)
+#define FUNC(inst, mtype, field, unfused, vmopcode) \
+  case vmopcode:                                    \
+  case OPCODE_##unfused##_INDEXED_UNCHECKED:        \
+    DUMP_INDEXED_##inst(mtype, field);              \
+    break;
+        INDEXED_MEMORY_INST_EACH(FUNC)
+#undef FUNC
+#define FUNC(size, shift, vmopcode)                                      \
+  case vmopcode:                                                         \
+    fprintf(out,                                                         \
+            "%sjump to %p unless stack[%d].u32 < stack[%d].u32 and "     \
+            "((stack[%d].u32 - 1) << %d) + %u <= memory.size * 65536\n", \
+            indent, WASMBOX_CODE_TARGET(code, op0), code->op1.r.reg1,    \
+            code->op1.r.reg2, code->op1.r.reg2, shift, code->op2.index); \
+    break;
+        MEMORY_GUARD_INST_EACH(FUNC)
+#undef FUNC
+#define DUMP_MEMORY64_load(mtype, field)                                     \
+  fprintf(out,                                                               \
+          "%sstack[%d]." #field " = *(" #mtype " *) &memory[stack[%d].u64" \
+          " + %u] (checked)\n",                                             \
+          indent, code->op0.reg, code->op1.reg, code->op2.index)
+#define DUMP_MEMORY64_store(mtype, field)                                   \
+  fprintf(out,                                                              \
+          "%s*(" #mtype " *) &memory[stack[%d].u64 + %u] = stack[%d]." #field \
+          " (checked)\n",                                                  \
+          indent, code->op0.reg, code->op2.index, code->op1.reg)
+#define FUNC(inst, mtype, field, unfused, vmopcode) \
+  case vmopcode:                                    \
+    DUMP_MEMORY64_##inst(mtype, field);             \
+    break;
+        MEMORY64_INST_EACH(FUNC)
+#undef FUNC
       case OPCODE_MEMORY_SIZE:
-        fprintf(stdout, "%sstack[%d].u32 = memory.size\n", indent,
+        fprintf(out, "%sstack[%d].u32 = memory.size\n", indent,
                 code->op0.reg);
         break;
       case OPCODE_MEMORY_GROW:
-        fprintf(stdout, "%sstack[%d].u32 = memory.grow(stack[%d].u32)\n",
+        fprintf(out, "%sstack[%d].u32 = memory.grow(stack[%d].u32)\n",
                 indent, code->op0.reg, code->op1.reg);
         break;
+      case OPCODE_MEMORY_INIT:
+        fprintf(out,
+                "%smemory.init(data[%u], stack[%d].u32, stack[%d].u32, "
+                "stack[%d].u32)\n",
+                indent, code->op0.index, code->op1.r.reg1, code->op1.r.reg2,
+                code->op2.reg);
+        break;
+      case OPCODE_DATA_DROP:
+        fprintf(out, "%sdata.drop(data[%u])\n", indent, code->op0.index);
+        break;
+      case OPCODE_MEMORY_COPY:
+      case OPCODE_MEMORY_FILL:
+        fprintf(out,
+                "%smemory.%s(stack[%d].u32, stack[%d].u32, stack[%d].u32)\n",
+                indent, code->h.opcode == OPCODE_MEMORY_COPY ? "copy" : "fill",
+                code->op0.reg, code->op1.reg, code->op2.reg);
+        break;
+      case OPCODE_REF_FUNC:
+        fprintf(out, "%sstack[%d] = ref.func func%p\n", indent,
+                code->op0.reg, WASMBOX_CODE_FUNC(mod, code, op1));
+        break;
+      case OPCODE_TABLE_GET:
+        fprintf(out, "%sstack[%d] = table[%u][stack[%d].u32]\n", indent,
+                code->op0.reg, code->op2.index, code->op1.reg);
+        break;
+      case OPCODE_TABLE_SET:
+        fprintf(out, "%stable[%u][stack[%d].u32] = stack[%d]\n", indent,
+                code->op2.index, code->op0.reg, code->op1.reg);
+        break;
+      case OPCODE_TABLE_GROW:
+        fprintf(out,
+                "%sstack[%d].u32 = table.grow(table[%u], stack[%d], "
+                "stack[%d].u32)\n",
+                indent, code->op0.reg, code->op2.index, code->op1.r.reg1,
+                code->op1.r.reg2);
+        break;
+      case OPCODE_TABLE_SIZE:
+        fprintf(out, "%sstack[%d].u32 = table.size(table[%u])\n", indent,
+                code->op0.reg, code->op2.index);
+        break;
+      case OPCODE_ATOMIC_FENCE:
+        fprintf(out, "%satomic.fence\n", indent);
+        break;
+#define DUMP_ATOMIC_load(NAME)                                            \
+  fprintf(out, "%sstack[%d] = " NAME "(stack[%d].u32 + %u)\n", indent, \
+          code->op0.reg, code->op1.reg, code->op2.index)
+#define DUMP_ATOMIC_store(NAME)                                          \
+  fprintf(out, "%s" NAME "(stack[%d].u32 + %u, stack[%d])\n", indent, \
+          code->op0.reg, code->op2.index, code->op1.reg)
+#define DUMP_ATOMIC_rmw(NAME)                                                \
+  fprintf(out, "%sstack[%d] = " NAME "(stack[%d].u32 + %u, stack[%d])\n", \
+          indent, code->op0.reg, code->op1.r.reg1, code->op2.index,          \
+          code->op1.r.reg2)
+#define DUMP_ATOMIC_notify(NAME) DUMP_ATOMIC_rmw(NAME)
+#define DUMP_ATOMIC_cmpxchg(NAME)                                          \
+  fprintf(out,                                                          \
+          "%sstack[%d] = " NAME "(stack[%d].u32 + %u, stack[%d], "         \
+          "stack[%d])\n",                                                  \
+          indent, code->op0.r.reg1, code->op1.r.reg1, code->op2.index,     \
+          code->op1.r.reg2, code->op0.r.reg2)
+#define DUMP_ATOMIC_wait(NAME) DUMP_ATOMIC_cmpxchg(NAME)
+#define FUNC(opcode, type, mtype, operands, vmopcode) \
+  case vmopcode:                                      \
+    DUMP_ATOMIC_##operands(#vmopcode);                \
+    break;
+        ATOMIC_INST_EACH(FUNC)
+#undef FUNC
 #define DUMP_LOAD_CONST_OP(type, formatter)                         \
-  fprintf(stdout, "%sstack[%d]." #type "= " formatter "\n", indent, \
-          code->op0.reg, code->op1.value.type)
+  fprintf(out, "%sstack[%d]." #type "= " formatter "\n", indent, \
+          code->op0.reg, WASMBOX_CODE_VALUE(code, op1).type)
       case OPCODE_LOAD_CONST_I32:
         DUMP_LOAD_CONST_OP(u32, "%d");
         break;
@@ -1245,13 +1009,13 @@ void wasmbox_dump_function(wasmbox_code_t *code_start, wasmbox_code_t *code_end,
         DUMP_LOAD_CONST_OP(f64, "%g");
         break;
 #define DUMP_ARITHMETIC_OP(type, operand_str)                       \
-  fprintf(stdout,                                                   \
+  fprintf(out,                                                   \
           "%sstack[%d]." #type "= stack[%d]." #type " " operand_str \
           " stack[%d]." #type "\n",                                 \
           indent, code->op0.reg, code->op2.reg, code->op1.reg)
 
       case OPCODE_I32_EQZ:
-        fprintf(stdout, "%sstack[%d].u32= stack[%d].u32 == 0\n", indent,
+        fprintf(out, "%sstack[%d].u32= stack[%d].u32 == 0\n", indent,
                 code->op0.reg, code->op1.reg);
         break;
       case OPCODE_I32_EQ:
@@ -1285,7 +1049,7 @@ void wasmbox_dump_function(wasmbox_code_t *code_start, wasmbox_code_t *code_end,
         DUMP_ARITHMETIC_OP(u32, ">=");
         break;
       case OPCODE_I64_EQZ:
-        fprintf(stdout, "%sstack[%d].u64= stack[%d].u64 == 0\n", indent,
+        fprintf(out, "%sstack[%d].u64= stack[%d].u64 == 0\n", indent,
                 code->op0.reg, code->op1.reg);
         break;
       case OPCODE_I64_EQ:
@@ -1355,11 +1119,11 @@ void wasmbox_dump_function(wasmbox_code_t *code_start, wasmbox_code_t *code_end,
         DUMP_ARITHMETIC_OP(f64, ">=");
         break;
       case OPCODE_I32_CLZ:
-        fprintf(stdout, "stack[%d].u32 = clz(stack[%d].u32)\n", code->op0.reg,
+        fprintf(out, "stack[%d].u32 = clz(stack[%d].u32)\n", code->op0.reg,
                 code->op1.reg);
         break;
       case OPCODE_I32_CTZ:
-        fprintf(stdout, "stack[%d].u32 = ctz(stack[%d].u32)\n", code->op0.reg,
+        fprintf(out, "stack[%d].u32 = ctz(stack[%d].u32)\n", code->op0.reg,
                 code->op1.reg);
         break;
       case OPCODE_I32_POPCNT:
@@ -1404,21 +1168,21 @@ void wasmbox_dump_function(wasmbox_code_t *code_start, wasmbox_code_t *code_end,
         DUMP_ARITHMETIC_OP(u32, ">>");
         break;
       case OPCODE_I32_ROTL:
-        fprintf(stdout,
+        fprintf(out,
                 "%sstack[%d].u32 = rotl(stack[%d].u32, stack[%d].u32)\n",
                 indent, code->op0.reg, code->op1.reg, code->op2.reg);
         break;
       case OPCODE_I32_ROTR:
-        fprintf(stdout,
+        fprintf(out,
                 "%sstack[%d].u32 = rotr(stack[%d].u32, stack[%d].u32)\n",
                 indent, code->op0.reg, code->op1.reg, code->op2.reg);
         break;
       case OPCODE_I64_CLZ:
-        fprintf(stdout, "stack[%d].u64 = clz(stack[%d].u64)\n", code->op0.reg,
+        fprintf(out, "stack[%d].u64 = clz(stack[%d].u64)\n", code->op0.reg,
                 code->op1.reg);
         break;
       case OPCODE_I64_CTZ:
-        fprintf(stdout, "stack[%d].u64 = ctz(stack[%d].u64)\n", code->op0.reg,
+        fprintf(out, "stack[%d].u64 = ctz(stack[%d].u64)\n", code->op0.reg,
                 code->op1.reg);
         break;
       case OPCODE_I64_POPCNT:
@@ -1463,12 +1227,12 @@ void wasmbox_dump_function(wasmbox_code_t *code_start, wasmbox_code_t *code_end,
         DUMP_ARITHMETIC_OP(u64, ">>");
         break;
       case OPCODE_I64_ROTL:
-        fprintf(stdout,
+        fprintf(out,
                 "%sstack[%d].u64 = rotl(stack[%d].u64, stack[%d].u64)\n",
                 indent, code->op0.reg, code->op1.reg, code->op2.reg);
         break;
       case OPCODE_I64_ROTR:
-        fprintf(stdout,
+        fprintf(out,
                 "%sstack[%d].u64 = rotr(stack[%d].u64, stack[%d].u64)\n",
                 indent, code->op0.reg, code->op1.reg, code->op2.reg);
         break;
@@ -1548,7 +1312,7 @@ void wasmbox_dump_function(wasmbox_code_t *code_start, wasmbox_code_t *code_end,
         NOT_IMPLEMENTED();
 #define DUMP_CONVERT_OP(arg_type, ret_type)                                  \
   do {                                                                       \
-    fprintf(stdout,                                                          \
+    fprintf(out,                                                          \
             "stack[%d]." #ret_type " = (" #ret_type ") stack[%d]." #arg_type \
             "\n",                                                            \
             code->op0.reg, code->op1.reg);                                   \
@@ -1581,7 +1345,7 @@ void wasmbox_dump_function(wasmbox_code_t *code_start, wasmbox_code_t *code_end,
         DUMP_CONVERT_OP(u64, f32);
         break;
       case OPCODE_F32_DEMOTE_F64:
-        fprintf(stdout, "%sstack[%d].f32 = demote(stack[%d].f64)\n", indent,
+        fprintf(out, "%sstack[%d].f32 = demote(stack[%d].f64)\n", indent,
                 code->op0.reg, code->op1.reg);
         break;
       case OPCODE_F64_CONVERT_I32_S:
@@ -1597,23 +1361,23 @@ void wasmbox_dump_function(wasmbox_code_t *code_start, wasmbox_code_t *code_end,
         DUMP_CONVERT_OP(u64, f64);
         break;
       case OPCODE_F64_PROMOTE_F32:
-        fprintf(stdout, "%sstack[%d].f64 = promote(stack[%d].f32)\n", indent,
+        fprintf(out, "%sstack[%d].f64 = promote(stack[%d].f32)\n", indent,
                 code->op0.reg, code->op1.reg);
         break;
       case OPCODE_I32_REINTERPRET_F32:
-        fprintf(stdout, "%sstack[%d].u32 = reinterpret_cast(stack[%d].f32)\n",
+        fprintf(out, "%sstack[%d].u32 = reinterpret_cast(stack[%d].f32)\n",
                 indent, code->op0.reg, code->op1.reg);
         break;
       case OPCODE_I64_REINTERPRET_F64:
-        fprintf(stdout, "%sstack[%d].u64 = reinterpret_cast(stack[%d].f64)\n",
+        fprintf(out, "%sstack[%d].u64 = reinterpret_cast(stack[%d].f64)\n",
                 indent, code->op0.reg, code->op1.reg);
         break;
       case OPCODE_F32_REINTERPRET_I32:
-        fprintf(stdout, "%sstack[%d].f32 = reinterpret_cast(stack[%d].u32)\n",
+        fprintf(out, "%sstack[%d].f32 = reinterpret_cast(stack[%d].u32)\n",
                 indent, code->op0.reg, code->op1.reg);
         break;
       case OPCODE_F64_REINTERPRET_I64:
-        fprintf(stdout, "%sstack[%d].f64 = reinterpret_cast(stack[%d].u64)\n",
+        fprintf(out, "%sstack[%d].f64 = reinterpret_cast(stack[%d].u64)\n",
                 indent, code->op0.reg, code->op1.reg);
         break;
       case OPCODE_I32_EXTEND8_S:
@@ -1647,68 +1411,404 @@ void wasmbox_dump_function(wasmbox_code_t *code_start, wasmbox_code_t *code_end,
         NOT_IMPLEMENTED();
       case OPCODE_I64_TRUNC_SAT_F64_U:
         NOT_IMPLEMENTED();
+#define FUNC(opcode, operands, rtype, atype, op, name)                     \
+  case OPCODE_##name:                                                      \
+    fprintf(out, "%s" #name " stack[%d], stack[%d], %d\n", indent,      \
+            code->op0.reg, code->op1.reg, code->op2.index);                \
+    break;
+        SIMD_INST_EACH(FUNC)
+#undef FUNC
 
       default:
         LOG("unknown opcode");
         return;
     }
-    code++;
+    code += wasmbox_code_length(code);
   }
 }
 
-#ifdef TRACE_VM
-static wasmbox_value_t *global_stack;
-static void dump_stack(wasmbox_value_t *stack) {
-  if (1 && global_stack != NULL) {
-    fprintf(stdout, "-----------------\n");
-    int diff = stack - global_stack;
-    for (int i = 0; i < 10; ++i) {
-      fprintf(stdout, "stack[%d] = %d (u64:%llu, %p)\n", (i - diff),
-              global_stack[i].s32, global_stack[i].u64,
-              (void *) (intptr_t) global_stack[i].u64);
-    }
-    fprintf(stdout, "-----------------\n");
+int wasmbox_eval_module(wasmbox_module_t *mod, wasmbox_value_t stack[]) {
+  const wasmbox_export_t *start = wasmbox_lookup_export(mod, "_start");
+  if (start == NULL || start->kind != WASMBOX_EXPORT_FUNCTION) {
+    LOG("_start function not found");
+    return -1;
   }
+  return wasmbox_eval_export(mod, start, stack);
 }
-#endif
 
-static wasmbox_function_t *
-wasmbox_module_find_entrypoint(wasmbox_module_t *mod) {
-  for (wasm_u32_t i = 0; i < mod->function_size; ++i) {
-    wasmbox_function_t *func = mod->functions[i];
-    wasm_u32_t start_len = strlen("_start");
-    if (func->name != NULL && func->name->len == start_len &&
-        strncmp((const char *) func->name->value, "_start", start_len) == 0) {
-      return func;
-    }
+// Raises the high-water mark to the deepest frame of a call on the stack
+// which starts at `base`.
+static void wasmbox_record_stack_peak(wasmbox_module_t *mod,
+                                      wasmbox_value_t *base) {
+  wasm_u64_t used = (char *) mod->stack_peak - (char *) base;
+  if (mod->stack_peak > base && used > mod->stack_high_water) {
+    mod->stack_high_water = used;
   }
-  return NULL;
 }
 
-int wasmbox_eval_module(wasmbox_module_t *mod, wasmbox_value_t stack[]) {
-  wasmbox_function_t *func = wasmbox_module_find_entrypoint(mod);
-  if (func == NULL) {
-    LOG("_start function not found");
+// Runs `code` with the frame `stack`, which is on the stack starting at
+// `base`, until it exits or stops, leaving where it stopped in
+// `mod->resume_code` and `mod->resume_stack`. Functions compiled on their
+// first call and memory profiles are allocated from the allocator of the
+// module.
+static int wasmbox_run(wasmbox_module_t *mod, wasmbox_code_t *code,
+                       wasmbox_value_t *stack, wasmbox_value_t *base) {
+  mod->resume_code = NULL;
+  if (mod->stack_peak < stack || mod->stack_peak > mod->stack_end) {
+    mod->stack_peak = stack;
+  }
+#ifdef WASMBOX_NATIVE_CODE_ENABLED
+  // Runs nested by a host call share the machine stack of the outermost one.
+  void *volatile native_stack_limit = mod->native_stack_limit;
+  if (native_stack_limit == NULL) {
+    mod->native_stack_limit =
+        (char *) __builtin_frame_address(0) - WASMBOX_JIT_NATIVE_STACK_SIZE;
+  }
+#endif
+#ifdef WASMBOX_VM_USE_SAMPLING_PROFILE
+  // Samples after the run belong to whatever ran before it.
+  wasmbox_sampling_state_t sampled = wasmbox_sampling_state;
+#endif
+  const wasmbox_allocator_t *volatile previous =
+      wasmbox_allocator_enter(mod->allocator);
+  wasmbox_trap_context_t trap;
+  wasmbox_trap_enter(&trap, mod);
+  if (WASMBOX_TRAP_CATCH(&trap) != 0) {
+    wasmbox_trap_leave(&trap);
+    wasmbox_allocator_leave(previous);
+#ifdef WASMBOX_VM_USE_SAMPLING_PROFILE
+    wasmbox_sampling_state = sampled;
+#endif
+#ifdef WASMBOX_NATIVE_CODE_ENABLED
+    mod->native_stack_limit = native_stack_limit;
+#endif
+    wasmbox_record_stack_peak(mod, base);
+    fprintf(stderr, "trap: %s\n", trap.message);
     return -1;
   }
-#ifdef TRACE_VM
-  global_stack = stack;
+  wasmbox_eval_function(mod, code, stack);
+  wasmbox_trap_leave(&trap);
+  wasmbox_allocator_leave(previous);
+#ifdef WASMBOX_VM_USE_SAMPLING_PROFILE
+  wasmbox_sampling_state = sampled;
+#endif
+#ifdef WASMBOX_NATIVE_CODE_ENABLED
+  mod->native_stack_limit = native_stack_limit;
 #endif
+  wasmbox_record_stack_peak(mod, base);
+  return mod->resume_code != NULL ? mod->resume_status : 0;
+}
+
+// Runs an exported function on a stack which ends at `stack_end`.
+static int wasmbox_eval_export_on(wasmbox_module_t *mod,
+                                  const wasmbox_export_t *export,
+                                  wasmbox_value_t *stack,
+                                  wasmbox_value_t *stack_end) {
+  if (export->kind != WASMBOX_EXPORT_FUNCTION) {
+    LOG("not a function");
+    return -1;
+  }
+  wasmbox_function_t *func = export->func;
   wasmbox_value_t *stack_top = stack + func->type->return_size;
-  stack_top[0].u64 = (wasm_u64_t) (uintptr_t) stack_top;
-  stack_top[1].u64 = (wasm_u64_t) (uintptr_t) &mod->shared_code[1];
-#ifdef TRACE_VM
-  dump_stack(stack_top);
+  if (stack_top + func->frame_size > stack_end) {
+    fprintf(stderr, "trap: call stack exhausted\n");
+    return -1;
+  }
+  mod->stack_end = stack_end;
+  mod->stack_peak = stack_top + func->frame_size;
+  WASMBOX_FRAME_LINK(stack_top, stack_top, &mod->shared_code[1]);
+  mod->resume_results = stack;
+  mod->resume_result_size = func->type->return_size;
+#ifdef WASMBOX_VM_USE_LATENCY_HISTOGRAM
+  wasm_u64_t started = wasmbox_latency_histogram_begin(mod);
+#endif
+#ifdef WASMBOX_VM_USE_PERF_COUNTERS
+  wasmbox_perf_reading_t start;
+  int counted = wasmbox_perf_counters_begin(mod, &start) == 0;
+#endif
+  int ret = wasmbox_run(mod, WASMBOX_FUNCTION_CODE(func), stack_top, stack);
+#ifdef WASMBOX_VM_USE_PERF_COUNTERS
+  if (counted) {
+    wasmbox_perf_counters_end(mod, export, &start, 1);
+  }
+#endif
+#ifdef WASMBOX_VM_USE_LATENCY_HISTOGRAM
+  wasmbox_latency_histogram_end(mod, export, started, ret, 1);
 #endif
-  wasmbox_eval_function(mod, func->code, stack_top);
+  return ret;
+}
+
+int wasmbox_eval_export(wasmbox_module_t *mod, const wasmbox_export_t *export,
+                        wasmbox_value_t stack[]) {
+  return wasmbox_eval_export_on(mod, export, stack,
+                                mod->stack_size > 0 ? stack + mod->stack_size
+                                                    : WASMBOX_STACK_UNCHECKED);
+}
+
+int wasmbox_resume(wasmbox_instance_t *instance, wasmbox_value_t *results) {
+  wasmbox_code_t *code = instance->resume_code;
+  if (code == NULL) {
+    LOG("nothing to resume");
+    return -1;
+  }
+  int ret = wasmbox_run(instance, code, instance->resume_stack,
+                        instance->resume_results);
+  if (ret == 0 && results != NULL && instance->resume_result_size > 0) {
+    memcpy(results, instance->resume_results,
+           sizeof(wasmbox_value_t) * instance->resume_result_size);
+  }
+  return ret;
+}
+
+/**
+ * Number of values in the stack of a thread calling wasmbox_call. Its pages
+ * are only committed once a call reaches them, so it is sized for deep
+ * recursion.
+ */
+#define WASMBOX_CALL_STACK_SIZE (1 << 20)
+
+// Reserved by the first call of each thread and released when it exits.
+static _Thread_local wasmbox_value_t *wasmbox_call_stack;
+static tss_t wasmbox_call_stack_key;
+static once_flag wasmbox_call_stack_once = ONCE_FLAG_INIT;
+
+static void wasmbox_call_stack_release(void *stack) {
+  wasmbox_stack_unreserve((wasmbox_value_t *) stack, WASMBOX_CALL_STACK_SIZE);
+}
+
+static void wasmbox_call_stack_key_create(void) {
+  tss_create(&wasmbox_call_stack_key, wasmbox_call_stack_release);
+}
+
+// Returns the stack which wasmbox_call lays the frame out on, and its end.
+static wasmbox_value_t *wasmbox_call_stack_of(wasmbox_instance_t *instance,
+                                              wasmbox_value_t **stack_end) {
+  wasmbox_value_t *stack = wasmbox_module_stack(instance);
+  if (stack != NULL) {
+    *stack_end = stack + wasmbox_module_stack_size(instance);
+    return stack;
+  }
+  if (wasmbox_call_stack == NULL) {
+    wasmbox_call_stack = wasmbox_stack_reserve(WASMBOX_CALL_STACK_SIZE);
+    if (wasmbox_call_stack == NULL) {
+      LOG("failed to allocate stack");
+      return NULL;
+    }
+    call_once(&wasmbox_call_stack_once, wasmbox_call_stack_key_create);
+    tss_set(wasmbox_call_stack_key, wasmbox_call_stack);
+  }
+  *stack_end = wasmbox_call_stack + WASMBOX_CALL_STACK_SIZE;
+  return wasmbox_call_stack;
+}
+
+int wasmbox_call(wasmbox_instance_t *instance, const wasmbox_export_t *export,
+                 const wasmbox_value_t *args, wasmbox_value_t *results) {
+  if (export->kind != WASMBOX_EXPORT_FUNCTION) {
+    LOG("not a function");
+    return -1;
+  }
+  wasmbox_value_t *stack_end;
+  wasmbox_value_t *stack = wasmbox_call_stack_of(instance, &stack_end);
+  if (stack == NULL) {
+    return -1;
+  }
+  wasmbox_type_t *type = export->func->type;
+  if (type->argument_size > 0) {
+    memcpy(stack + type->return_size + WASMBOX_FUNCTION_CALL_OFFSET, args,
+           sizeof(wasmbox_value_t) * type->argument_size);
+  }
+  int ret = wasmbox_eval_export_on(instance, export, stack, stack_end);
+  if (ret != 0) {
+    return ret;
+  }
+  if (type->return_size > 0) {
+    memcpy(results, stack, sizeof(wasmbox_value_t) * type->return_size);
+  }
   return 0;
 }
 
+int wasmbox_call_batch(wasmbox_instance_t *instance,
+                       const wasmbox_export_t *export,
+                       const wasmbox_value_t *args, wasmbox_value_t *results,
+                       size_t n) {
+  if (export->kind != WASMBOX_EXPORT_FUNCTION) {
+    LOG("not a function");
+    return -1;
+  }
+  if (n == 0) {
+    return 0;
+  }
+  wasmbox_value_t *stack_end;
+  wasmbox_value_t *stack = wasmbox_call_stack_of(instance, &stack_end);
+  if (stack == NULL) {
+    return -1;
+  }
+  wasmbox_function_t *func = export->func;
+  wasmbox_value_t *stack_top = stack + func->type->return_size;
+  if (stack_top + func->frame_size > stack_end) {
+    fprintf(stderr, "trap: call stack exhausted\n");
+    return -1;
+  }
+  wasmbox_batch_t batch = {func, args, results, 0, n};
+  // Every call returns to this instruction instead of OPCODE_EXIT.
+  struct {
+    wasmbox_code_t code;
+#ifdef WASMBOX_VM_USE_COMPACT_CODE
+    wasmbox_code_constant_t constant;
+#endif
+  } next;
+  next.code.h.opcode = OPCODE_BATCH_NEXT;
+#ifdef WASMBOX_VM_USE_COMPACT_CODE
+  next.constant.value.u64 = (wasm_u64_t) (uintptr_t) &batch;
+  next.code.op0.offset = (char *) &next.constant - (char *) &next.code;
+#else
+  next.code.op0.value.u64 = (wasm_u64_t) (uintptr_t) &batch;
+#endif
+#ifdef WASMBOX_VM_USE_CODE_LABEL
+  void **labels = (void **) instance->shared_code[0].op0.value.u64;
+  next.code.h.label = labels[OPCODE_BATCH_NEXT];
+#endif
+  for (wasm_u16_t i = 0; i < func->type->argument_size; i++) {
+    stack_top[WASMBOX_FUNCTION_CALL_OFFSET + i] = args[i];
+  }
+  WASMBOX_FRAME_LINK(stack_top, stack_top, &next.code);
+  instance->stack_end = stack_end;
+  instance->stack_peak = stack_top + func->frame_size;
+#ifdef WASMBOX_VM_USE_LATENCY_HISTOGRAM
+  wasm_u64_t started = wasmbox_latency_histogram_begin(instance);
+#endif
+#ifdef WASMBOX_VM_USE_PERF_COUNTERS
+  wasmbox_perf_reading_t start;
+  int counted = wasmbox_perf_counters_begin(instance, &start) == 0;
+#endif
+  int ret =
+      wasmbox_run(instance, WASMBOX_FUNCTION_CODE(func), stack_top, stack);
+#ifdef WASMBOX_VM_USE_PERF_COUNTERS
+  if (counted) {
+    wasmbox_perf_counters_end(instance, export, &start, batch.index);
+  }
+#endif
+#ifdef WASMBOX_VM_USE_LATENCY_HISTOGRAM
+  // A batch which traps or stops counts once, as the call which did.
+  wasmbox_latency_histogram_end(instance, export, started, ret,
+                                ret == 0 ? batch.index : 1);
+#endif
+  // The frames return to `next`, which is gone after this call.
+  instance->resume_code = NULL;
+  return ret;
+}
+
+struct wasmbox_context_t {
+  wasmbox_instance_t *instance;
+  wasmbox_value_t *stack;
+  size_t stack_size;
+  wasm_u16_t result_size;
+  /* Where the call stopped, or NULL. */
+  wasmbox_code_t *code;
+  wasmbox_value_t *sp;
+};
+
+wasmbox_context_t *wasmbox_context_create(wasmbox_instance_t *instance,
+                                          size_t stack_size) {
+  if (stack_size == 0) {
+    stack_size = WASMBOX_CALL_STACK_SIZE;
+  }
+  const wasmbox_allocator_t *previous =
+      wasmbox_allocator_enter(instance->allocator);
+  wasmbox_context_t *ctx =
+      (wasmbox_context_t *) wasmbox_malloc(sizeof(wasmbox_context_t));
+  wasmbox_allocator_leave(previous);
+  ctx->instance = instance;
+  ctx->stack = wasmbox_stack_reserve(stack_size);
+  if (ctx->stack == NULL) {
+    LOG("failed to allocate stack");
+    wasmbox_free(ctx);
+    return NULL;
+  }
+  ctx->stack_size = stack_size;
+  return ctx;
+}
+
+void wasmbox_context_dispose(wasmbox_context_t *ctx) {
+  wasmbox_stack_unreserve(ctx->stack, ctx->stack_size);
+  wasmbox_free(ctx);
+}
+
+void wasmbox_context_rebind(wasmbox_context_t *ctx,
+                            wasmbox_instance_t *instance) {
+  ctx->instance = instance;
+}
+
+// Runs the call of `ctx` from `code`. The instance keeps the call which it
+// stopped itself, if any.
+static int wasmbox_context_run(wasmbox_context_t *ctx, wasmbox_code_t *code,
+                               wasmbox_value_t *sp, wasmbox_value_t *results) {
+  wasmbox_instance_t *instance = ctx->instance;
+  wasmbox_code_t *resume_code = instance->resume_code;
+  wasmbox_value_t *resume_stack = instance->resume_stack;
+  int resume_status = instance->resume_status;
+  wasmbox_value_t *stack_end = instance->stack_end;
+  wasmbox_value_t *stack_peak = instance->stack_peak;
+  instance->stack_end = ctx->stack + ctx->stack_size;
+  int ret = wasmbox_run(instance, code, sp, ctx->stack);
+  ctx->code = instance->resume_code;
+  ctx->sp = instance->resume_stack;
+  instance->resume_code = resume_code;
+  instance->resume_stack = resume_stack;
+  instance->resume_status = resume_status;
+  instance->stack_end = stack_end;
+  instance->stack_peak = stack_peak;
+  if (ret == 0 && ctx->result_size > 0) {
+    memcpy(results, ctx->stack, sizeof(wasmbox_value_t) * ctx->result_size);
+  }
+  return ret;
+}
+
+int wasmbox_context_call(wasmbox_context_t *ctx,
+                         const wasmbox_export_t *export,
+                         const wasmbox_value_t *args,
+                         wasmbox_value_t *results) {
+  if (export->kind != WASMBOX_EXPORT_FUNCTION) {
+    LOG("not a function");
+    return -1;
+  }
+  if (ctx->code != NULL) {
+    LOG("context is running a call");
+    return -1;
+  }
+  wasmbox_function_t *func = export->func;
+  wasmbox_type_t *type = func->type;
+  wasmbox_value_t *stack_top = ctx->stack + type->return_size;
+  if (stack_top + func->frame_size > ctx->stack + ctx->stack_size) {
+    fprintf(stderr, "trap: call stack exhausted\n");
+    return -1;
+  }
+  if (type->argument_size > 0) {
+    memcpy(stack_top + WASMBOX_FUNCTION_CALL_OFFSET, args,
+           sizeof(wasmbox_value_t) * type->argument_size);
+  }
+  WASMBOX_FRAME_LINK(stack_top, stack_top,
+                     &ctx->instance->shared_code[1]);
+  ctx->result_size = type->return_size;
+  return wasmbox_context_run(ctx, WASMBOX_FUNCTION_CODE(func), stack_top,
+                             results);
+}
+
+int wasmbox_context_resume(wasmbox_context_t *ctx, wasmbox_value_t *results) {
+  if (ctx->code == NULL) {
+    LOG("nothing to resume");
+    return -1;
+  }
+  return wasmbox_context_run(ctx, ctx->code, ctx->sp, results);
+}
+
 void wasmbox_virtual_machine_init(wasmbox_module_t *mod) {
+  // Every module must see the same build, as its code holds the labels of it.
+  call_once(&wasmbox_eval_function_once, wasmbox_eval_function_select);
   if (mod->shared_code[0].h.opcode == 0) {
     mod->shared_code[0].h.opcode = OPCODE_THREADED_CODE;
     mod->shared_code[1].h.opcode = OPCODE_EXIT;
-#ifdef WASMBOX_VM_USE_DIRECT_THREADED_CODE
+#ifdef WASMBOX_VM_USE_CODE_LABEL
     wasmbox_value_t stack;
     wasmbox_eval_function(NULL, mod->shared_code, &stack);
     void **labels = (void **) stack.u64;
@@ -20,17 +20,95 @@
 #include "opcodes.h"
 #include "wasmbox/wasmbox.h"
 
+#include <stdio.h>
 #include <stdlib.h> // exit
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-void wasmbox_dump_function(wasmbox_code_t *code_start, wasmbox_code_t *code_end,
+/* Marks a function which rare instructions call. It is kept out of line, and
+ * the code of the handlers calling it is moved out of the hot path. */
+#define WASMBOX_COLD __attribute__((cold, noinline))
+
+/* Writes the instructions of `mod` from `code_start` to `code_end` to
+ * `out`. */
+void wasmbox_dump_function(FILE *out, wasmbox_module_t *mod,
+                           wasmbox_code_t *code_start, wasmbox_code_t *code_end,
                            const char *indent);
 void wasmbox_eval_function(wasmbox_module_t *mod, wasmbox_code_t *code,
                            wasmbox_value_t *stack);
 void wasmbox_virtual_machine_init(wasmbox_module_t *mod);
+/* Runs the next calls of `ctx`, which has no stopped call, on `instance`. */
+void wasmbox_context_rebind(wasmbox_context_t *ctx,
+                            wasmbox_instance_t *instance);
+
+/*
+ * The header of a frame links it to the frame of its caller and to the code
+ * to return to.
+ */
+#ifdef WASMBOX_VM_USE_COMPACT_FRAME
+/* Both share one slot: the return code in the upper 48 bits, which hold any
+ * user-space address, and the distance in slots back to the frame of the
+ * caller, which is below frame_size and so fits in the lower 16 bits. */
+#  define WASMBOX_FRAME_LINK(FRAME, CALLER, RETURN_CODE)             \
+    ((FRAME)[0].u64 = ((wasm_u64_t) (uintptr_t) (RETURN_CODE) << 16) | \
+                      (wasm_u64_t) ((FRAME) - (CALLER)))
+#  define WASMBOX_FRAME_CALLER(FRAME) \
+    ((FRAME) - (wasm_u16_t) (FRAME)[0].u64)
+#  define WASMBOX_FRAME_RETURN_CODE(FRAME) \
+    ((wasmbox_code_t *) (uintptr_t) ((FRAME)[0].u64 >> 16))
+#else
+#  define WASMBOX_FRAME_LINK(FRAME, CALLER, RETURN_CODE)          \
+    do {                                                          \
+      (FRAME)[0].u64 = (wasm_u64_t) (uintptr_t) (CALLER);         \
+      (FRAME)[1].u64 = (wasm_u64_t) (uintptr_t) (RETURN_CODE);    \
+    } while (0)
+#  define WASMBOX_FRAME_CALLER(FRAME) \
+    ((wasmbox_value_t *) (uintptr_t) (FRAME)[0].u64)
+#  define WASMBOX_FRAME_RETURN_CODE(FRAME) \
+    ((wasmbox_code_t *) (uintptr_t) (FRAME)[1].u64)
+#endif
+
+/**
+ * Sets an entry of `table` to `ref`, and grows `table` by `delta` entries of
+ * `ref`, returning its previous size or -1. Defined by the loader.
+ */
+void wasmbox_table_entry_set(wasmbox_ref_table_t *table,
+                             wasmbox_table_entry_t *entry, wasm_u64_t ref);
+WASMBOX_COLD wasm_s32_t wasmbox_table_grow(wasmbox_ref_table_t *table,
+                                           wasm_u32_t delta, wasm_u64_t ref);
+
+#ifdef WASMBOX_VM_USE_LAZY_COMPILE
+/* Default of wasmbox_module_t::speculation_threshold. */
+#define WASMBOX_SPECULATION_THRESHOLD (1000)
+
+/**
+ * Compiles the body of `func` if it has not been compiled yet. Defined by the
+ * loader, which keeps the module source for this purpose.
+ */
+WASMBOX_COLD int wasmbox_module_compile_function(wasmbox_module_t *mod,
+                                                 wasmbox_function_t *func);
+
+/**
+ * Recompiles `func` once, replacing the indirect calls which have called one
+ * callee `speculation_threshold` times in a row by guarded direct calls.
+ */
+int wasmbox_module_speculate(wasmbox_module_t *mod, wasmbox_function_t *func);
+
+/* Default of wasmbox_module_t::tier_up_threshold. */
+#define WASMBOX_TIER_UP_THRESHOLD (1000)
+
+/**
+ * Recompiles `func`, whose code is of the first tier, with every
+ * optimization. Returns where a frame of the first tier stopped at `entry`,
+ * the operand of OPCODE_HOTNESS, continues in the new code with the same
+ * slots, or NULL if it keeps running the first tier.
+ */
+wasmbox_code_t *wasmbox_module_tier_up(wasmbox_module_t *mod,
+                                       wasmbox_function_t *func,
+                                       wasm_u32_t entry);
+#endif
 
 #ifdef __cplusplus
 }
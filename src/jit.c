@@ -0,0 +1,619 @@
+/*
+ * Copyright (C) 2021 Masahiro Ide
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "jit.h"
+
+#include "allocator.h"
+#include "interpreter.h"
+#include "opcodes.h"
+#include "sampling-profile.h"
+#include "trap.h"
+#include "wasmbox/wasmbox.h"
+
+#ifdef WASMBOX_JIT_ENABLED
+#  include <stddef.h> // offsetof
+#  include <sys/mman.h>
+#  include <unistd.h> // sysconf
+
+#  define LOG(MSG) fprintf(stderr, "(%s:%d)" MSG, __FILE__, __LINE__)
+
+/*
+ * Baseline x86-64 JIT. Every instruction is expanded to a fixed machine code
+ * template. Frame slots stay in memory and are addressed relative to the
+ * pinned stack register:
+ *   rbx: stack (frame of the current function)
+ *   rbp: mod
+ *   rax, rcx, xmm0: scratch registers of a template
+ * Native functions follow the System V ABI with the signature of
+ * wasmbox_jit_entry_t.
+ */
+enum wasmbox_x86_register {
+  X86_RAX = 0,
+  X86_RCX = 1,
+  X86_RDX = 2,
+  X86_RBX = 3,
+  X86_RSP = 4,
+  X86_RBP = 5,
+  X86_RSI = 6,
+  X86_RDI = 7,
+};
+
+enum wasmbox_x86_condition {
+  X86_CC_B = 0x2,
+  X86_CC_AE = 0x3,
+  X86_CC_E = 0x4,
+  X86_CC_NE = 0x5,
+  X86_CC_BE = 0x6,
+  X86_CC_A = 0x7,
+  X86_CC_L = 0xC,
+  X86_CC_GE = 0xD,
+  X86_CC_LE = 0xE,
+  X86_CC_G = 0xF,
+};
+
+#  define X86_REX_W    0x48
+#  define X86_OP_JMP   0xE9
+#  define X86_OP_JCC   0x0F80
+#  define X86_OP_SETCC 0x0F90
+#  define X86_OP_CMOVE 0x0F44
+#  define X86_OP_MOVZB 0x0FB6
+#  define X86_OP_LOAD  0x8B
+#  define X86_OP_STORE 0x89
+#  define X86_OP_TEST  0x85
+#  define X86_OP_CMP   0x3B
+#  define X86_OP_SHIFT 0xD3
+
+#  define STACK_REG  X86_RBX
+#  define MODULE_REG X86_RBP
+#  define SLOT(REG)  ((wasm_s32_t) ((REG) * sizeof(wasmbox_value_t)))
+
+typedef struct wasmbox_jit_buffer_t {
+  wasm_u8_t *data;
+  wasm_u32_t size;
+  wasm_u32_t capacity;
+} wasmbox_jit_buffer_t;
+
+/* A branch whose rel32 at `offset` is resolved to instruction `target`. */
+typedef struct wasmbox_jit_fixup_t {
+  wasm_u32_t offset;
+  wasm_u32_t target;
+} wasmbox_jit_fixup_t;
+
+typedef struct wasmbox_jit_compiler_t {
+  wasmbox_jit_buffer_t buf;
+  wasmbox_module_t *mod;
+  wasmbox_function_t *func;
+  wasm_u32_t *offsets;
+  wasmbox_jit_fixup_t *fixups;
+  wasm_u32_t fixup_size;
+} wasmbox_jit_compiler_t;
+
+/* Operation of a binary integer instruction. */
+typedef struct wasmbox_jit_alu_t {
+  wasm_u8_t wide;
+  /* Shifts take the count in cl and `op` is the ModRM extension. */
+  wasm_u8_t shift;
+  wasm_u16_t op;
+} wasmbox_jit_alu_t;
+
+static void emit_u8(wasmbox_jit_buffer_t *buf, wasm_u8_t v) {
+  if (buf->capacity == 0) {
+    buf->capacity = 256;
+    buf->data = (wasm_u8_t *) wasmbox_malloc_uninit(buf->capacity);
+  } else if (buf->size == buf->capacity) {
+    buf->capacity *= 2;
+    buf->data = (wasm_u8_t *) wasmbox_realloc(buf->data, buf->capacity);
+  }
+  buf->data[buf->size++] = v;
+}
+
+static void emit_u16(wasmbox_jit_buffer_t *buf, wasm_u16_t v) {
+  emit_u8(buf, v & 0xFF);
+  emit_u8(buf, v >> 8);
+}
+
+static void emit_u32(wasmbox_jit_buffer_t *buf, wasm_u32_t v) {
+  for (int i = 0; i < 4; ++i) {
+    emit_u8(buf, (v >> (i * 8)) & 0xFF);
+  }
+}
+
+static void emit_u64(wasmbox_jit_buffer_t *buf, wasm_u64_t v) {
+  for (int i = 0; i < 8; ++i) {
+    emit_u8(buf, (v >> (i * 8)) & 0xFF);
+  }
+}
+
+static void emit_opcode(wasmbox_jit_buffer_t *buf, int wide, wasm_u16_t op) {
+  if (wide) {
+    emit_u8(buf, X86_REX_W);
+  }
+  if (op > 0xFF) {
+    emit_u8(buf, op >> 8);
+  }
+  emit_u8(buf, op & 0xFF);
+}
+
+// op reg, [base + disp32]
+static void emit_mem(wasmbox_jit_buffer_t *buf, int wide, wasm_u16_t op,
+                     int reg, int base, wasm_s32_t disp) {
+  emit_opcode(buf, wide, op);
+  emit_u8(buf, 0x80 | (reg << 3) | base);
+  emit_u32(buf, (wasm_u32_t) disp);
+}
+
+// op reg, rm
+static void emit_reg(wasmbox_jit_buffer_t *buf, int wide, wasm_u16_t op,
+                     int reg, int rm) {
+  emit_opcode(buf, wide, op);
+  emit_u8(buf, 0xC0 | (reg << 3) | rm);
+}
+
+static void emit_load(wasmbox_jit_buffer_t *buf, int wide, int reg,
+                      wasmbox_code_reg_t slot) {
+  emit_mem(buf, wide, X86_OP_LOAD, reg, STACK_REG, SLOT(slot));
+}
+
+static void emit_store(wasmbox_jit_buffer_t *buf, int wide, int reg,
+                       wasmbox_code_reg_t slot) {
+  emit_mem(buf, wide, X86_OP_STORE, reg, STACK_REG, SLOT(slot));
+}
+
+static void emit_mov_imm(wasmbox_jit_buffer_t *buf, int wide, int reg,
+                         wasm_u64_t v) {
+  emit_opcode(buf, wide, 0xB8 + reg);
+  if (wide) {
+    emit_u64(buf, v);
+  } else {
+    emit_u32(buf, (wasm_u32_t) v);
+  }
+}
+
+// Emits a jmp/jcc with a rel32 to be patched and returns its position.
+static wasm_u32_t emit_jump(wasmbox_jit_buffer_t *buf, wasm_u16_t op) {
+  emit_opcode(buf, 0, op);
+  wasm_u32_t pos = buf->size;
+  emit_u32(buf, 0);
+  return pos;
+}
+
+static void patch_jump(wasmbox_jit_buffer_t *buf, wasm_u32_t pos,
+                       wasm_u32_t target) {
+  wasm_s32_t rel = (wasm_s32_t) target - (wasm_s32_t) (pos + 4);
+  memcpy(buf->data + pos, &rel, sizeof(rel));
+}
+
+static void emit_prologue(wasmbox_jit_buffer_t *buf) {
+  emit_u8(buf, 0x50 + X86_RBX); // push rbx
+  emit_u8(buf, 0x50 + X86_RBP); // push rbp
+  emit_reg(buf, 1, 0x83, 5, X86_RSP); // sub rsp, 8 (keep 16-byte alignment)
+  emit_u8(buf, 8);
+  emit_reg(buf, 1, X86_OP_STORE, X86_RDI, MODULE_REG);
+  emit_reg(buf, 1, X86_OP_STORE, X86_RSI, STACK_REG);
+}
+
+static void emit_epilogue(wasmbox_jit_buffer_t *buf) {
+  emit_reg(buf, 1, 0x83, 0, X86_RSP); // add rsp, 8
+  emit_u8(buf, 8);
+  emit_u8(buf, 0x58 + X86_RBP); // pop rbp
+  emit_u8(buf, 0x58 + X86_RBX); // pop rbx
+  emit_u8(buf, 0xC3);           // ret
+}
+
+static void emit_branch(wasmbox_jit_compiler_t *c, wasm_u16_t op,
+                        wasmbox_code_t *target) {
+  wasmbox_jit_fixup_t *fixup = &c->fixups[c->fixup_size++];
+  fixup->offset = emit_jump(&c->buf, op);
+  fixup->target = target - c->func->code;
+}
+
+// Returns the condition code of a comparison, or -1.
+static int wasmbox_jit_condition(wasm_u16_t opcode, int *wide) {
+  *wide = 0;
+  switch (opcode) {
+    case OPCODE_I64_EQZ:
+    case OPCODE_I64_EQ:
+      *wide = 1;
+      // fallthrough
+    case OPCODE_I32_EQZ:
+    case OPCODE_I32_EQ:
+      return X86_CC_E;
+#  define CONDITION(CMP, CC) \
+    case OPCODE_I64_##CMP:   \
+      *wide = 1;             \
+      return CC;             \
+    case OPCODE_I32_##CMP:   \
+      return CC;
+      CONDITION(NE, X86_CC_NE)
+      CONDITION(LT_S, X86_CC_L)
+      CONDITION(LT_U, X86_CC_B)
+      CONDITION(GT_S, X86_CC_G)
+      CONDITION(GT_U, X86_CC_A)
+      CONDITION(LE_S, X86_CC_LE)
+      CONDITION(LE_U, X86_CC_BE)
+      CONDITION(GE_S, X86_CC_GE)
+      CONDITION(GE_U, X86_CC_AE)
+#  undef CONDITION
+    default:
+      return -1;
+  }
+}
+
+static int wasmbox_jit_alu(wasm_u16_t opcode, wasmbox_jit_alu_t *alu) {
+  alu->wide = alu->shift = 0;
+  switch (opcode) {
+#  define ALU(INST, OP, SHIFT) \
+    case OPCODE_I64_##INST:    \
+      alu->wide = 1;           \
+      /* fallthrough */        \
+    case OPCODE_I32_##INST:    \
+      alu->op = OP;            \
+      alu->shift = SHIFT;      \
+      return 0;
+    ALU(ADD, 0x03, 0)
+    ALU(SUB, 0x2B, 0)
+    ALU(MUL, 0x0FAF, 0)
+    ALU(AND, 0x23, 0)
+    ALU(OR, 0x0B, 0)
+    ALU(XOR, 0x33, 0)
+    ALU(SHL, 4, 1)
+    ALU(SHR_S, 7, 1)
+    ALU(SHR_U, 5, 1)
+#  undef ALU
+    default:
+      return -1;
+  }
+}
+
+// rax = rax <op> rhs, where rhs is a frame slot or rcx if `rhs` is negative.
+static void emit_alu(wasmbox_jit_buffer_t *buf, wasmbox_jit_alu_t *alu,
+                     wasmbox_code_reg_t rhs) {
+  if (alu->shift) {
+    if (rhs >= 0) {
+      emit_load(buf, 0, X86_RCX, rhs);
+    }
+    emit_reg(buf, alu->wide, X86_OP_SHIFT, alu->op, X86_RAX);
+  } else if (rhs >= 0) {
+    emit_mem(buf, alu->wide, alu->op, X86_RAX, STACK_REG, SLOT(rhs));
+  } else {
+    emit_reg(buf, alu->wide, alu->op, X86_RAX, X86_RCX);
+  }
+}
+
+// Sets the flags for a comparison of op1 and op2 (or op1 and zero).
+static void emit_compare(wasmbox_jit_buffer_t *buf, wasm_u16_t opcode,
+                         int wide, wasmbox_code_t *code) {
+  emit_load(buf, wide, X86_RAX, code->op1.reg);
+  if (opcode == OPCODE_I32_EQZ || opcode == OPCODE_I64_EQZ) {
+    emit_reg(buf, wide, X86_OP_TEST, X86_RAX, X86_RAX);
+  } else {
+    emit_mem(buf, wide, X86_OP_CMP, X86_RAX, STACK_REG, SLOT(code->op2.reg));
+  }
+}
+
+// op0 = op1 <op> op2 by SSE scalar instructions.
+static void emit_float_op(wasmbox_jit_buffer_t *buf, wasm_u8_t prefix,
+                          wasm_u16_t op, wasmbox_code_t *code) {
+  emit_u8(buf, prefix);
+  emit_mem(buf, 0, 0x0F10, 0, STACK_REG, SLOT(code->op1.reg));
+  emit_u8(buf, prefix);
+  emit_mem(buf, 0, op, 0, STACK_REG, SLOT(code->op2.reg));
+  emit_u8(buf, prefix);
+  emit_mem(buf, 0, 0x0F11, 0, STACK_REG, SLOT(code->op0.reg));
+}
+
+static void wasmbox_jit_call_interpreter(wasmbox_module_t *mod,
+                                         wasmbox_code_t *code,
+                                         wasmbox_value_t *stack,
+                                         wasmbox_function_t *callee) {
+  if (stack + callee->frame_size > mod->stack_end ||
+      (void *) __builtin_frame_address(0) < mod->native_stack_limit) {
+    wasmbox_trap("call stack exhausted");
+  }
+  if (stack + callee->frame_size > mod->stack_peak) {
+    mod->stack_peak = stack + callee->frame_size;
+  }
+  WASMBOX_FRAME_LINK(stack, stack, &mod->shared_code[1]);
+#ifdef WASMBOX_VM_USE_SAMPLING_PROFILE
+  // Back in native code, the caller is the one running.
+  wasmbox_sampling_state_t sampled = wasmbox_sampling_state;
+  wasmbox_eval_function(mod, code, stack);
+  wasmbox_sampling_state = sampled;
+#else
+  wasmbox_eval_function(mod, code, stack);
+#endif
+}
+
+// Calls the native code of the callee if it has been compiled when the call
+// is executed and its frame fits in both the VM and the machine stack.
+// Otherwise the callee runs on the interpreter, which traps if either stack
+// is exhausted.
+static void emit_static_call(wasmbox_jit_compiler_t *c, wasmbox_code_t *code) {
+  wasmbox_jit_buffer_t *buf = &c->buf;
+  wasmbox_function_t *callee = WASMBOX_CODE_FUNC(c->mod, code, op1);
+  wasm_s32_t frame = SLOT(code->op0.reg + code->op2.index);
+  emit_mov_imm(buf, 1, X86_RAX, (wasm_u64_t) (uintptr_t) callee);
+  emit_mem(buf, 1, X86_OP_LOAD, X86_RSI, X86_RAX,
+           offsetof(wasmbox_function_t, code));
+  // cmp word [rsi + opcode], OPCODE_JIT_ENTRY
+  emit_u8(buf, 0x66);
+  emit_mem(buf, 0, 0x81, 7, X86_RSI, offsetof(wasmbox_code_t, h.opcode));
+  emit_u16(buf, OPCODE_JIT_ENTRY);
+  wasm_u32_t slow = emit_jump(buf, X86_OP_JCC | X86_CC_NE);
+  // movzx ecx, word [rax + frame_size]
+  emit_mem(buf, 0, 0x0FB7, X86_RCX, X86_RAX,
+           offsetof(wasmbox_function_t, frame_size));
+  emit_reg(buf, 1, 0xC1, 4, X86_RCX); // shl rcx, 3
+  emit_u8(buf, 3);
+  emit_reg(buf, 1, 0x01, STACK_REG, X86_RCX); // add rcx, rbx
+  emit_reg(buf, 1, 0x81, 0, X86_RCX);         // add rcx, frame
+  emit_u32(buf, (wasm_u32_t) frame);
+  emit_mem(buf, 1, X86_OP_CMP, X86_RCX, MODULE_REG,
+           offsetof(wasmbox_module_t, stack_end));
+  wasm_u32_t overflow = emit_jump(buf, X86_OP_JCC | X86_CC_A);
+  emit_mem(buf, 1, X86_OP_CMP, X86_RSP, MODULE_REG,
+           offsetof(wasmbox_module_t, native_stack_limit));
+  wasm_u32_t too_deep = emit_jump(buf, X86_OP_JCC | X86_CC_B);
+  emit_mem(buf, 1, X86_OP_CMP, X86_RCX, MODULE_REG,
+           offsetof(wasmbox_module_t, stack_peak));
+  wasm_u32_t shallower = emit_jump(buf, X86_OP_JCC | X86_CC_BE);
+  emit_mem(buf, 1, X86_OP_STORE, X86_RCX, MODULE_REG,
+           offsetof(wasmbox_module_t, stack_peak));
+  patch_jump(buf, shallower, buf->size);
+  emit_mem(buf, 1, X86_OP_LOAD, X86_RAX, X86_RSI,
+           offsetof(wasmbox_code_t, op0));
+  emit_reg(buf, 1, X86_OP_STORE, MODULE_REG, X86_RDI);
+  emit_mem(buf, 1, 0x8D, X86_RSI, STACK_REG, frame); // lea
+  emit_reg(buf, 0, 0xFF, 2, X86_RAX);                // call rax
+  wasm_u32_t done = emit_jump(buf, X86_OP_JMP);
+  patch_jump(buf, slow, buf->size);
+  patch_jump(buf, overflow, buf->size);
+  patch_jump(buf, too_deep, buf->size);
+  emit_reg(buf, 1, X86_OP_STORE, MODULE_REG, X86_RDI);
+  emit_mem(buf, 1, 0x8D, X86_RDX, STACK_REG, frame);
+  emit_mov_imm(buf, 1, X86_RCX, (wasm_u64_t) (uintptr_t) callee);
+  emit_mov_imm(buf, 1, X86_RAX,
+               (wasm_u64_t) (uintptr_t) wasmbox_jit_call_interpreter);
+  emit_reg(buf, 0, 0xFF, 2, X86_RAX);
+  patch_jump(buf, done, buf->size);
+}
+
+static int wasmbox_jit_emit_code(wasmbox_jit_compiler_t *c,
+                                 wasmbox_code_t *code) {
+  wasmbox_jit_buffer_t *buf = &c->buf;
+  wasm_u16_t opcode = code->h.opcode;
+  wasmbox_jit_alu_t alu;
+  int wide;
+  int cc;
+  switch (opcode) {
+    case OPCODE_NOP:
+      return 0;
+    case OPCODE_RETURN:
+      emit_epilogue(buf);
+      return 0;
+    case OPCODE_MOVE:
+      emit_load(buf, 1, X86_RAX, code->op1.reg);
+      emit_store(buf, 1, X86_RAX, code->op0.reg);
+      return 0;
+    case OPCODE_SELECT:
+      emit_load(buf, 0, X86_RAX, code->op1.reg);
+      emit_reg(buf, 0, X86_OP_TEST, X86_RAX, X86_RAX);
+      emit_load(buf, 1, X86_RAX, code->op2.r.reg1);
+      emit_load(buf, 1, X86_RCX, code->op2.r.reg2);
+      emit_reg(buf, 1, X86_OP_CMOVE, X86_RAX, X86_RCX);
+      emit_store(buf, 1, X86_RAX, code->op0.reg);
+      return 0;
+    case OPCODE_JUMP:
+      emit_branch(c, X86_OP_JMP, WASMBOX_CODE_TARGET(code, op0));
+      return 0;
+    case OPCODE_JUMP_IF:
+      emit_load(buf, 0, X86_RAX, code->op1.reg);
+      emit_reg(buf, 0, X86_OP_TEST, X86_RAX, X86_RAX);
+      emit_branch(c, X86_OP_JCC | X86_CC_NE, WASMBOX_CODE_TARGET(code, op0));
+      return 0;
+    case OPCODE_STATIC_CALL:
+      emit_static_call(c, code);
+      return 0;
+    case OPCODE_LOAD_CONST_I32:
+    case OPCODE_LOAD_CONST_F32:
+      // mov dword [slot], imm32
+      emit_mem(buf, 0, 0xC7, 0, STACK_REG, SLOT(code->op0.reg));
+      emit_u32(buf, WASMBOX_CODE_VALUE(code, op1).u32);
+      return 0;
+    case OPCODE_LOAD_CONST_I64:
+    case OPCODE_LOAD_CONST_F64:
+      emit_mov_imm(buf, 1, X86_RAX, WASMBOX_CODE_VALUE(code, op1).u64);
+      emit_store(buf, 1, X86_RAX, code->op0.reg);
+      return 0;
+    // Native code keeps the stack pointer of the guest in its global.
+    case OPCODE_GLOBAL_GET:
+    case OPCODE_STACK_POINTER_GET:
+      emit_mem(buf, 1, X86_OP_LOAD, X86_RAX, MODULE_REG,
+               offsetof(wasmbox_module_t, globals));
+      emit_mem(buf, 1, X86_OP_LOAD, X86_RAX, X86_RAX, SLOT(code->op1.index));
+      emit_store(buf, 1, X86_RAX, code->op0.reg);
+      return 0;
+    case OPCODE_GLOBAL_SET:
+      emit_mem(buf, 1, X86_OP_LOAD, X86_RAX, MODULE_REG,
+               offsetof(wasmbox_module_t, globals));
+      emit_load(buf, 1, X86_RCX, code->op1.reg);
+      emit_mem(buf, 1, X86_OP_STORE, X86_RCX, X86_RAX, SLOT(code->op0.index));
+      return 0;
+    case OPCODE_STACK_POINTER_SET:
+      emit_mem(buf, 1, X86_OP_LOAD, X86_RAX, MODULE_REG,
+               offsetof(wasmbox_module_t, globals));
+      emit_load(buf, 0, X86_RCX, code->op1.reg);
+      emit_reg(buf, 0, 0x81, 0, X86_RCX); // add ecx, imm32
+      emit_u32(buf, code->op2.index);
+      emit_mem(buf, 1, X86_OP_STORE, X86_RCX, X86_RAX, SLOT(code->op0.index));
+      return 0;
+    case OPCODE_STACK_POINTER_ADD:
+      emit_mem(buf, 1, X86_OP_LOAD, X86_RAX, MODULE_REG,
+               offsetof(wasmbox_module_t, globals));
+      emit_mem(buf, 0, X86_OP_LOAD, X86_RCX, X86_RAX, SLOT(code->op1.index));
+      emit_reg(buf, 0, 0x81, 0, X86_RCX); // add ecx, imm32
+      emit_u32(buf, code->op2.index);
+      emit_mem(buf, 1, X86_OP_STORE, X86_RCX, X86_RAX, SLOT(code->op1.index));
+      emit_store(buf, 1, X86_RCX, code->op0.reg);
+      return 0;
+    // The locals left to zero once narrowed are few, so each is stored to.
+    case OPCODE_ZERO_LOCALS:
+      emit_reg(buf, 0, 0x33, X86_RAX, X86_RAX); // xor eax, eax
+      for (wasm_u32_t i = 0; i < code->op1.index; ++i) {
+        emit_store(buf, 1, X86_RAX, code->op0.reg + i);
+      }
+      return 0;
+    case OPCODE_I64_EXTEND_I32_S:
+      emit_mem(buf, 1, 0x63, X86_RAX, STACK_REG, SLOT(code->op1.reg));
+      emit_store(buf, 1, X86_RAX, code->op0.reg);
+      return 0;
+    case OPCODE_I64_EXTEND_I32_U:
+      emit_load(buf, 0, X86_RAX, code->op1.reg);
+      emit_store(buf, 1, X86_RAX, code->op0.reg);
+      return 0;
+#  define FLOAT_OP(INST, OP)              \
+    case OPCODE_F32_##INST:               \
+      emit_float_op(buf, 0xF3, OP, code); \
+      return 0;                           \
+    case OPCODE_F64_##INST:               \
+      emit_float_op(buf, 0xF2, OP, code); \
+      return 0;
+      FLOAT_OP(ADD, 0x0F58)
+      FLOAT_OP(SUB, 0x0F5C)
+      FLOAT_OP(MUL, 0x0F59)
+      FLOAT_OP(DIV, 0x0F5E)
+#  undef FLOAT_OP
+#  define FUNC(param, type, operand, cmp, vmopcode)                    \
+    case vmopcode:                                                     \
+      cc = wasmbox_jit_condition(OPCODE_##cmp, &wide);                 \
+      emit_compare(buf, OPCODE_##cmp, wide, code);                     \
+      emit_branch(c, X86_OP_JCC | cc, WASMBOX_CODE_TARGET(code, op0)); \
+      return 0;
+      COMPARE_AND_BRANCH_INST_EACH(FUNC)
+#  undef FUNC
+#  define FUNC(type, operand, cmp, vmopcode)                           \
+    case vmopcode:                                                     \
+      wasmbox_jit_alu(OPCODE_I32_ADD, &alu);                           \
+      emit_load(buf, 0, X86_RAX, code->op1.reg);                       \
+      emit_mov_imm(buf, 0, X86_RCX, (wasm_u32_t) code->op2.r.reg2);    \
+      emit_alu(buf, &alu, -1);                                         \
+      emit_store(buf, 0, X86_RAX, code->op1.reg);                      \
+      cc = wasmbox_jit_condition(OPCODE_##cmp, &wide);                 \
+      emit_compare(buf, OPCODE_##cmp, wide, code);                     \
+      emit_branch(c, X86_OP_JCC | cc, WASMBOX_CODE_TARGET(code, op0)); \
+      return 0;
+      LOOP_INC_INST_EACH(FUNC)
+#  undef FUNC
+#  define FUNC(wtype, type, operand, inst, vmopcode)     \
+    case vmopcode:                                       \
+      wasmbox_jit_alu(OPCODE_##inst, &alu);              \
+      emit_load(buf, alu.wide, X86_RAX, code->op1.reg);  \
+      emit_mov_imm(buf, alu.wide, X86_RCX,               \
+                   WASMBOX_CODE_VALUE(code, op2).u64);   \
+      emit_alu(buf, &alu, -1);                           \
+      emit_store(buf, alu.wide, X86_RAX, code->op0.reg); \
+      return 0;
+      IMMEDIATE_INST_EACH(FUNC)
+#  undef FUNC
+    default:
+      break;
+  }
+  if ((cc = wasmbox_jit_condition(opcode, &wide)) >= 0) {
+    emit_compare(buf, opcode, wide, code);
+    emit_reg(buf, 0, X86_OP_SETCC | cc, 0, X86_RAX);
+    emit_reg(buf, 0, X86_OP_MOVZB, X86_RAX, X86_RAX);
+    // i64.eqz writes the whole slot like the interpreter does.
+    emit_store(buf, opcode == OPCODE_I64_EQZ, X86_RAX, code->op0.reg);
+    return 0;
+  }
+  if (wasmbox_jit_alu(opcode, &alu) == 0) {
+    emit_load(buf, alu.wide, X86_RAX, code->op1.reg);
+    emit_alu(buf, &alu, code->op2.reg);
+    emit_store(buf, alu.wide, X86_RAX, code->op0.reg);
+    return 0;
+  }
+  return -1;
+}
+
+static void *wasmbox_jit_install(wasmbox_jit_buffer_t *buf, wasm_u32_t *size) {
+  long page_size = sysconf(_SC_PAGESIZE);
+  *size = (buf->size + page_size - 1) & ~(page_size - 1);
+  void *mem = mmap(NULL, *size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (mem == MAP_FAILED) {
+    LOG("failed to allocate executable memory\n");
+    return NULL;
+  }
+  memcpy(mem, buf->data, buf->size);
+  if (mprotect(mem, *size, PROT_READ | PROT_EXEC) != 0) {
+    LOG("failed to protect executable memory\n");
+    munmap(mem, *size);
+    return NULL;
+  }
+  return mem;
+}
+
+int wasmbox_jit_compile_function(wasmbox_module_t *mod,
+                                 wasmbox_function_t *func) {
+  if (func->code_size == 0) {
+    return -1;
+  }
+  wasmbox_jit_compiler_t c;
+  memset(&c, 0, sizeof(c));
+  c.mod = mod;
+  c.func = func;
+  // One more offset for a jump to the end of the function.
+  c.offsets = (wasm_u32_t *) wasmbox_malloc(sizeof(wasm_u32_t) *
+                                            (func->code_size + 1));
+  c.fixups = (wasmbox_jit_fixup_t *) wasmbox_malloc(
+      sizeof(wasmbox_jit_fixup_t) * func->code_size);
+  emit_prologue(&c.buf);
+  int status = 0;
+  for (wasm_u32_t i = 0; i < func->code_size; ++i) {
+    c.offsets[i] = c.buf.size;
+    if (wasmbox_jit_emit_code(&c, &func->code[i]) != 0) {
+      status = -1;
+      break;
+    }
+  }
+  void *mem = NULL;
+  wasm_u32_t size = 0;
+  if (status == 0) {
+    c.offsets[func->code_size] = c.buf.size;
+    for (wasm_u32_t i = 0; i < c.fixup_size; ++i) {
+      patch_jump(&c.buf, c.fixups[i].offset, c.offsets[c.fixups[i].target]);
+    }
+    mem = wasmbox_jit_install(&c.buf, &size);
+    status = mem != NULL ? 0 : -1;
+  }
+  wasmbox_free(c.buf.data);
+  wasmbox_free(c.offsets);
+  wasmbox_free(c.fixups);
+  if (status == 0) {
+    func->code[0].h.opcode = OPCODE_JIT_ENTRY;
+    func->code[0].op0.value.u64 = (wasm_u64_t) (uintptr_t) mem;
+    func->code[0].op1.index = size;
+  }
+  return status;
+}
+
+void wasmbox_jit_release_function(wasmbox_function_t *func) {
+  if (func->code_size > 0 && func->code[0].h.opcode == OPCODE_JIT_ENTRY) {
+    munmap((void *) (uintptr_t) func->code[0].op0.value.u64,
+           func->code[0].op1.index);
+  }
+}
+#endif /* WASMBOX_JIT_ENABLED */
@@ -0,0 +1,62 @@
+/*
+ * Copyright (C) 2021 Masahiro Ide
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef WASMBOX_JIT_H
+#define WASMBOX_JIT_H
+
+#include "opcodes.h"
+#include "wasmbox/wasmbox.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* The JIT needs pointer-sized operands, so it is not built for compact code. */
+#if defined(WASMBOX_VM_USE_JIT) && defined(__x86_64__) && \
+    !defined(WASMBOX_VM_USE_COMPACT_CODE)
+#  define WASMBOX_JIT_ENABLED 1
+#endif
+
+/**
+ * Native code of a function. `stack` is the frame laid out as for the
+ * interpreter, so both tiers can call each other.
+ */
+typedef void (*wasmbox_jit_entry_t)(wasmbox_module_t *mod,
+                                    wasmbox_value_t *stack);
+
+/* Machine stack native calls may use below the outermost VM entry. */
+#define WASMBOX_JIT_NATIVE_STACK_SIZE (4 << 20)
+
+#ifdef WASMBOX_JIT_ENABLED
+/**
+ * Compiles the frozen code of `func` to native code. On success the first
+ * instruction is replaced by OPCODE_JIT_ENTRY. Returns -1 and leaves the code
+ * untouched if the function uses an instruction the JIT does not support.
+ */
+int wasmbox_jit_compile_function(wasmbox_module_t *mod,
+                                 wasmbox_function_t *func);
+
+/**
+ * Frees the native code of `func` if it has been compiled.
+ */
+void wasmbox_jit_release_function(wasmbox_function_t *func);
+#endif /* WASMBOX_JIT_ENABLED */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* end of include guard */
@@ -0,0 +1,174 @@
+/*
+ * Copyright (C) 2021 Masahiro Ide
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "latency-histogram.h"
+#include "allocator.h"
+
+#include <stdio.h>
+#include <time.h>
+
+#define LOG(MSG) fprintf(stderr, "(%s:%d)" MSG, __FILE__, __LINE__)
+
+// Buckets per power of two.
+#define WASMBOX_LATENCY_SUB_BUCKETS (16)
+#define WASMBOX_LATENCY_SUB_BITS (4)
+
+static wasm_u32_t wasmbox_latency_bucket(wasm_u64_t ns) {
+  if (ns < WASMBOX_LATENCY_SUB_BUCKETS) {
+    return (wasm_u32_t) ns;
+  }
+  // The top bit selects the power of two, and the 4 bits below it the
+  // bucket within it.
+  wasm_u32_t exponent = 63 - __builtin_clzll(ns);
+  wasm_u32_t sub = (ns >> (exponent - WASMBOX_LATENCY_SUB_BITS)) &
+                   (WASMBOX_LATENCY_SUB_BUCKETS - 1);
+  return (exponent - WASMBOX_LATENCY_SUB_BITS + 1) *
+             WASMBOX_LATENCY_SUB_BUCKETS +
+         sub;
+}
+
+// The largest latency of `bucket`.
+static wasm_u64_t wasmbox_latency_bucket_limit(wasm_u32_t bucket) {
+  if (bucket < WASMBOX_LATENCY_SUB_BUCKETS) {
+    return bucket;
+  }
+  wasm_u32_t exponent =
+      bucket / WASMBOX_LATENCY_SUB_BUCKETS + WASMBOX_LATENCY_SUB_BITS - 1;
+  wasm_u64_t sub = bucket % WASMBOX_LATENCY_SUB_BUCKETS;
+  wasm_u32_t shift = exponent - WASMBOX_LATENCY_SUB_BITS;
+  wasm_u64_t low = (WASMBOX_LATENCY_SUB_BUCKETS + sub) << shift;
+  return low + ((wasm_u64_t) 1 << shift) - 1;
+}
+
+static wasm_u64_t wasmbox_latency_now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (wasm_u64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+int wasmbox_latency_histograms_start(wasmbox_module_t *mod) {
+  if (mod->latency_histograms != NULL) {
+    LOG("latency histograms are recording already\n");
+    return -1;
+  }
+  mod->latency_histograms = (wasmbox_latency_histogram_t *) wasmbox_malloc(
+      sizeof(wasmbox_latency_histogram_t) * mod->export_size);
+  return 0;
+}
+
+void wasmbox_latency_histograms_stop(wasmbox_module_t *mod) {
+  if (mod->latency_histograms == NULL) {
+    return;
+  }
+  wasmbox_free(mod->latency_histograms);
+  mod->latency_histograms = NULL;
+}
+
+wasm_u64_t wasmbox_latency_histogram_begin(wasmbox_module_t *mod) {
+  return mod->latency_histograms != NULL ? wasmbox_latency_now_ns() : 0;
+}
+
+void wasmbox_latency_histogram_end(wasmbox_module_t *mod,
+                                   const wasmbox_export_t *export,
+                                   wasm_u64_t start, int ret,
+                                   wasm_u64_t calls) {
+  wasmbox_latency_histogram_t *histograms = mod->latency_histograms;
+  wasm_u64_t index = export - mod->exports;
+  if (histograms == NULL || start == 0 || export < mod->exports ||
+      index >= mod->export_size) {
+    return;
+  }
+  wasmbox_latency_histogram_t *histogram = &histograms[index];
+  if (ret == WASMBOX_OUT_OF_FUEL) {
+    __atomic_fetch_add(&histogram->fuel_interruptions, 1, __ATOMIC_RELAXED);
+    return;
+  }
+  if (ret == WASMBOX_INTERRUPTED) {
+    __atomic_fetch_add(&histogram->epoch_interruptions, 1, __ATOMIC_RELAXED);
+    return;
+  }
+  if (ret == WASMBOX_SUSPENDED || calls == 0) {
+    return;
+  }
+  wasm_u64_t elapsed = wasmbox_latency_now_ns() - start;
+  wasm_u64_t ns = elapsed / calls;
+  if (ret != 0) {
+    __atomic_fetch_add(&histogram->traps, 1, __ATOMIC_RELAXED);
+  }
+  __atomic_fetch_add(&histogram->calls, calls, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&histogram->total_ns, elapsed, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&histogram->counts[wasmbox_latency_bucket(ns)], calls,
+                     __ATOMIC_RELAXED);
+  wasm_u64_t max = __atomic_load_n(&histogram->max_ns, __ATOMIC_RELAXED);
+  while (ns > max &&
+         !__atomic_compare_exchange_n(&histogram->max_ns, &max, ns, 1,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+  }
+}
+
+// Reads `*counter`, and takes what it read out of it if `reset` is set.
+static wasm_u64_t wasmbox_latency_take(wasm_u64_t *counter, int reset) {
+  return reset ? __atomic_exchange_n(counter, 0, __ATOMIC_RELAXED)
+               : __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+int wasmbox_latency_histogram_snapshot(wasmbox_module_t *mod,
+                                       const wasmbox_export_t *export,
+                                       wasmbox_latency_histogram_t *histogram,
+                                       int reset) {
+  wasmbox_latency_histogram_t *histograms = mod->latency_histograms;
+  wasm_u64_t index = export - mod->exports;
+  if (histograms == NULL || export < mod->exports ||
+      index >= mod->export_size) {
+    return -1;
+  }
+  // Each counter is taken on its own, so a call recorded meanwhile lands in
+  // this snapshot or the next one, though maybe not whole in either.
+  wasmbox_latency_histogram_t *from = &histograms[index];
+  histogram->calls = wasmbox_latency_take(&from->calls, reset);
+  histogram->total_ns = wasmbox_latency_take(&from->total_ns, reset);
+  histogram->max_ns = wasmbox_latency_take(&from->max_ns, reset);
+  histogram->traps = wasmbox_latency_take(&from->traps, reset);
+  histogram->fuel_interruptions =
+      wasmbox_latency_take(&from->fuel_interruptions, reset);
+  histogram->epoch_interruptions =
+      wasmbox_latency_take(&from->epoch_interruptions, reset);
+  for (wasm_u32_t i = 0; i < WASMBOX_LATENCY_BUCKETS; i++) {
+    histogram->counts[i] = wasmbox_latency_take(&from->counts[i], reset);
+  }
+  return 0;
+}
+
+wasm_u64_t wasmbox_latency_percentile(
+    const wasmbox_latency_histogram_t *histogram, double percentile) {
+  wasm_u64_t total = 0;
+  for (wasm_u32_t i = 0; i < WASMBOX_LATENCY_BUCKETS; i++) {
+    total += histogram->counts[i];
+  }
+  if (total == 0) {
+    return 0;
+  }
+  double rank = total * percentile / 100;
+  wasm_u64_t seen = 0;
+  for (wasm_u32_t i = 0; i < WASMBOX_LATENCY_BUCKETS; i++) {
+    seen += histogram->counts[i];
+    if (histogram->counts[i] > 0 && seen >= rank) {
+      wasm_u64_t limit = wasmbox_latency_bucket_limit(i);
+      return limit < histogram->max_ns ? limit : histogram->max_ns;
+    }
+  }
+  return histogram->max_ns;
+}
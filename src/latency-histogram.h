@@ -0,0 +1,44 @@
+/*
+ * Copyright (C) 2021 Masahiro Ide
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef WASMBOX_LATENCY_HISTOGRAM_H
+#define WASMBOX_LATENCY_HISTOGRAM_H
+
+#include "wasmbox/wasmbox.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifdef WASMBOX_VM_USE_LATENCY_HISTOGRAM
+/* Returns the time a call starts at, or 0 if `mod` is not recording. */
+wasm_u64_t wasmbox_latency_histogram_begin(wasmbox_module_t *mod);
+
+/**
+ * Records `calls` calls to `export` since `start`, which ended with `ret`
+ * as returned by wasmbox_eval_export.
+ */
+void wasmbox_latency_histogram_end(wasmbox_module_t *mod,
+                                   const wasmbox_export_t *export,
+                                   wasm_u64_t start, int ret,
+                                   wasm_u64_t calls);
+#endif /* WASMBOX_VM_USE_LATENCY_HISTOGRAM */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* end of include guard */
@@ -16,47 +16,123 @@
 
 #include "leb128.h"
 
+#include <string.h> // memcpy
+#if defined(__BMI2__) && defined(__x86_64__)
+#  include <immintrin.h>
+#endif
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-// https://en.wikipedia.org/wiki/LEB128#Decode_unsigned_integer
-wasm_u64_t wasmbox_parse_unsigned_leb128(const wasm_u8_t *p, wasm_u32_t *idx,
-                                         wasm_u32_t len) {
+#define LEB128_CONTINUATION_BITS (0x8080808080808080ULL)
+
+// Bytes which can be read at once without running past `len`.
+#define LEB128_WORD_SIZE (sizeof(wasm_u64_t))
+
+/**
+ * Returns the number of bytes (1 to 8) of the number which starts the
+ * little-endian `word`, or 0 if it is longer. `value` receives its 7-bit
+ * groups packed together.
+ */
+static inline unsigned leb128_decode_word(wasm_u64_t word,
+                                          wasm_u64_t *value) {
+  wasm_u64_t ends = ~word & LEB128_CONTINUATION_BITS;
+  if (ends == 0) {
+    return 0;
+  }
+  unsigned size = (__builtin_ctzll(ends) + 1) / 8;
+  if (size < LEB128_WORD_SIZE) {
+    word &= (1ULL << (size * 8)) - 1;
+  }
+#if defined(__BMI2__) && defined(__x86_64__)
+  *value = _pext_u64(word, ~LEB128_CONTINUATION_BITS);
+#else
+  // Squeeze out the continuation bits, doubling the width of the groups.
+  word &= ~LEB128_CONTINUATION_BITS;
+  word = ((word & 0x7f007f007f007f00ULL) >> 1) | (word & 0x007f007f007f007fULL);
+  word = ((word & 0x3fff00003fff0000ULL) >> 2) | (word & 0x00003fff00003fffULL);
+  word = ((word & 0x0fffffff00000000ULL) >> 4) | (word & 0x000000000fffffffULL);
+  *value = word;
+#endif
+  return size;
+}
+
+static inline wasm_u64_t leb128_load_word(const wasm_u8_t *p) {
+  wasm_u64_t word;
+  memcpy(&word, p, sizeof(word));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  word = __builtin_bswap64(word);
+#endif
+  return word;
+}
+
+// Decodes one byte at a time, for numbers near the end of the input or
+// longer than 8 bytes. `shift` receives the number of bits read.
+static wasm_u64_t leb128_decode_bytes(const wasm_u8_t *p, wasm_u32_t *idx,
+                                      wasm_u32_t len, unsigned *shift) {
   wasm_u64_t result = 0;
-  const wasm_u64_t mask = 1 << (sizeof(wasm_u8_t) * 8 - 1);
-  unsigned shift = 0;
-  wasm_u64_t v;
-  while (*idx <= len) {
-    v = *p++;
+  unsigned s = 0;
+  while (*idx < len) {
+    wasm_u64_t v = *p++;
     *idx += 1;
-    result |= (v & ~mask) << shift;
-    if ((v & mask) == 0) {
+    if (s < 64) {
+      result |= (v & 0x7f) << s;
+    }
+    s += 7;
+    if ((v & 0x80) == 0) {
       break;
     }
-    shift += 7;
   }
+  *shift = s;
   return result;
 }
 
+// https://en.wikipedia.org/wiki/LEB128#Decode_unsigned_integer
+wasm_u64_t wasmbox_parse_unsigned_leb128(const wasm_u8_t *p, wasm_u32_t *idx,
+                                         wasm_u32_t len) {
+  // Most immediates are below 128.
+  if (*idx < len && p[0] < 0x80) {
+    *idx += 1;
+    return p[0];
+  }
+  if (len - *idx >= LEB128_WORD_SIZE && *idx < len) {
+    wasm_u64_t value;
+    unsigned size = leb128_decode_word(leb128_load_word(p), &value);
+    if (size != 0) {
+      *idx += size;
+      return value;
+    }
+  }
+  unsigned shift;
+  return leb128_decode_bytes(p, idx, len, &shift);
+}
+
 // https://en.wikipedia.org/wiki/LEB128#Decode_signed_integer
 wasm_s64_t wasmbox_parse_signed_leb128(const wasm_u8_t *p, wasm_u32_t *idx,
                                        wasm_u32_t len) {
-  wasm_s64_t result = 0;
-  const wasm_s64_t mask = 1ULL << (sizeof(wasm_u8_t) * 8 - 1);
-  unsigned shift = 0;
-  wasm_s64_t v;
-  do {
-    v = *p++;
+  if (*idx < len && p[0] < 0x80) {
     *idx += 1;
-    result |= (v & ~mask) << shift;
-    shift += 7;
-  } while ((v & mask) != 0 && *idx < len);
-
-  if ((shift < sizeof(wasm_s64_t) * 8) && (v & 0x40) != 0) {
-    result |= (~0 << shift);
+    // Bit 6 is the sign.
+    return (wasm_s64_t) (wasm_s8_t) (p[0] << 1) >> 1;
   }
-  return result;
+  wasm_u64_t result;
+  unsigned shift = 0;
+  if (len - *idx >= LEB128_WORD_SIZE && *idx < len) {
+    unsigned size = leb128_decode_word(leb128_load_word(p), &result);
+    shift = size * 7;
+    if (size != 0) {
+      *idx += size;
+    }
+  }
+  if (shift == 0) {
+    result = leb128_decode_bytes(p, idx, len, &shift);
+  }
+  if (shift > 0 && shift < sizeof(wasm_s64_t) * 8 &&
+      (result >> (shift - 1)) & 1) {
+    result |= ~(wasm_u64_t) 0 << shift;
+  }
+  return (wasm_s64_t) result;
 }
 
 #ifdef __cplusplus
@@ -0,0 +1,139 @@
+/*
+ * Copyright (C) 2021 Masahiro Ide
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "memory-profile.h"
+#include "allocator.h"
+#include "memory.h"
+
+#define WASMBOX_MEMORY_PROFILE_GRANULE \
+  ((wasm_u32_t) 1 << WASMBOX_MEMORY_PROFILE_PAGE_SHIFT)
+
+/* Width of the bar of the most accessed page in the report. */
+#define WASMBOX_MEMORY_PROFILE_BAR_WIDTH (40)
+
+wasmbox_memory_profile_t *wasmbox_memory_profile_expand(wasmbox_module_t *mod,
+                                                        wasm_u64_t page) {
+  wasmbox_memory_profile_t *profile = mod->memory_profile;
+  wasm_u32_t old_size = profile != NULL ? profile->page_size : 0;
+  // Cover the whole memory, so that only memory.grow brings us back here.
+  wasm_u64_t size = (wasm_u64_t) wasmbox_memory_size(mod) *
+                    (WASMBOX_PAGE_SIZE / WASMBOX_MEMORY_PROFILE_GRANULE);
+  if (size <= page) {
+    size = page + 1;
+  }
+  wasm_u32_t bytes = sizeof(*profile) + sizeof(profile->pages[0]) * size;
+  if (profile == NULL) {
+    profile = (wasmbox_memory_profile_t *) wasmbox_malloc(bytes);
+  } else {
+    profile = (wasmbox_memory_profile_t *) wasmbox_realloc(profile, bytes);
+    memset(&profile->pages[old_size], 0,
+           sizeof(profile->pages[0]) * (size - old_size));
+  }
+  profile->page_size = (wasm_u32_t) size;
+  mod->memory_profile = profile;
+  return profile;
+}
+
+void wasmbox_memory_profile_dispose(wasmbox_module_t *mod) {
+  if (mod->memory_profile != NULL) {
+    wasmbox_free(mod->memory_profile);
+    mod->memory_profile = NULL;
+  }
+}
+
+wasm_u32_t wasmbox_memory_profile_pages(wasmbox_module_t *mod,
+                                        wasm_u32_t page_size,
+                                        wasmbox_memory_page_count_t *pages,
+                                        wasm_u32_t page_count) {
+  if (page_size < WASMBOX_MEMORY_PROFILE_GRANULE ||
+      page_size % WASMBOX_MEMORY_PROFILE_GRANULE != 0) {
+    return 0;
+  }
+  wasm_u32_t ratio = page_size / WASMBOX_MEMORY_PROFILE_GRANULE;
+  wasm_u64_t bytes = (wasm_u64_t) wasmbox_memory_size(mod) * WASMBOX_PAGE_SIZE;
+  wasm_u32_t size = (wasm_u32_t) ((bytes + page_size - 1) / page_size);
+  if (page_count > size) {
+    page_count = size;
+  }
+  if (page_count == 0) {
+    return size;
+  }
+  memset(pages, 0, sizeof(pages[0]) * page_count);
+  wasmbox_memory_profile_t *profile = mod->memory_profile;
+  if (profile == NULL) {
+    return size;
+  }
+  for (wasm_u32_t i = 0; i < profile->page_size; i++) {
+    wasm_u32_t page = i / ratio;
+    if (page >= page_count) {
+      break;
+    }
+    pages[page].reads += profile->pages[i].reads;
+    pages[page].writes += profile->pages[i].writes;
+  }
+  return size;
+}
+
+void wasmbox_memory_profile_clear(wasmbox_module_t *mod) {
+  wasmbox_memory_profile_t *profile = mod->memory_profile;
+  if (profile != NULL) {
+    memset(profile->pages, 0, sizeof(profile->pages[0]) * profile->page_size);
+  }
+}
+
+void wasmbox_memory_report_profile(wasmbox_module_t *mod) {
+  wasm_u32_t size =
+      wasmbox_memory_profile_pages(mod, WASMBOX_PAGE_SIZE, NULL, 0);
+  wasm_u32_t granules = wasmbox_memory_profile_pages(
+      mod, WASMBOX_MEMORY_PROFILE_GRANULE, NULL, 0);
+  wasmbox_memory_page_count_t *pages = (wasmbox_memory_page_count_t *)
+      wasmbox_malloc(sizeof(pages[0]) * (granules + 1));
+  wasm_u32_t touched_granules = 0;
+  wasmbox_memory_profile_pages(mod, WASMBOX_MEMORY_PROFILE_GRANULE, pages,
+                               granules);
+  for (wasm_u32_t i = 0; i < granules; i++) {
+    touched_granules += pages[i].reads + pages[i].writes != 0;
+  }
+
+  wasmbox_memory_profile_pages(mod, WASMBOX_PAGE_SIZE, pages, size);
+  wasm_u64_t reads = 0, writes = 0, hottest = 0;
+  wasm_u32_t touched = 0;
+  for (wasm_u32_t i = 0; i < size; i++) {
+    wasm_u64_t count = pages[i].reads + pages[i].writes;
+    reads += pages[i].reads;
+    writes += pages[i].writes;
+    touched += count != 0;
+    hottest = count > hottest ? count : hottest;
+  }
+  fprintf(stdout, "memory reads:  %llu\n", (unsigned long long) reads);
+  fprintf(stdout, "memory writes: %llu\n", (unsigned long long) writes);
+  fprintf(stdout, "working set:   %u/%u pages, %u/%u 4 KiB pages (%u KB)\n",
+          touched, size, touched_granules, granules,
+          touched_granules * (WASMBOX_MEMORY_PROFILE_GRANULE / 1024));
+  for (wasm_u32_t i = 0; i < size; i++) {
+    wasm_u64_t count = pages[i].reads + pages[i].writes;
+    if (count == 0) {
+      continue;
+    }
+    int width = (int) ((count * WASMBOX_MEMORY_PROFILE_BAR_WIDTH +
+                        hottest - 1) / hottest);
+    fprintf(stdout, "%6u r:%-12llu w:%-12llu %.*s\n", i,
+            (unsigned long long) pages[i].reads,
+            (unsigned long long) pages[i].writes, width,
+            "########################################");
+  }
+  wasmbox_free(pages);
+}
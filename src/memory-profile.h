@@ -0,0 +1,62 @@
+/*
+ * Copyright (C) 2021 Masahiro Ide
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef WASMBOX_MEMORY_PROFILE_H
+#define WASMBOX_MEMORY_PROFILE_H
+
+#include "wasmbox/wasmbox.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifdef WASMBOX_VM_USE_MEMORY_PROFILE
+/* Accesses are counted per 4 KiB page and summed up for larger pages. */
+#  define WASMBOX_MEMORY_PROFILE_PAGE_SHIFT (12)
+
+struct wasmbox_memory_profile_t {
+  wasm_u32_t page_size;
+  wasmbox_memory_page_count_t pages[];
+};
+
+/**
+ * Makes room for the counters of `page` and returns the profile. `page` is
+ * always in bounds, as accesses are recorded after they succeed.
+ */
+wasmbox_memory_profile_t *wasmbox_memory_profile_expand(wasmbox_module_t *mod,
+                                                        wasm_u64_t page);
+
+void wasmbox_memory_profile_dispose(wasmbox_module_t *mod);
+
+/* Counts an access to ADDR in the `reads` or `writes` (FIELD) of its page. */
+#  define WASMBOX_MEMORY_PROFILE(MOD, ADDR, FIELD)                   \
+    do {                                                             \
+      wasmbox_memory_profile_t *profile = (MOD)->memory_profile;     \
+      wasm_u64_t page = (ADDR) >> WASMBOX_MEMORY_PROFILE_PAGE_SHIFT; \
+      if (profile == NULL || page >= profile->page_size) {           \
+        profile = wasmbox_memory_profile_expand((MOD), page);        \
+      }                                                              \
+      profile->pages[page].FIELD++;                                  \
+    } while (0)
+#else
+#  define WASMBOX_MEMORY_PROFILE(MOD, ADDR, FIELD) ((void) 0)
+#endif /* WASMBOX_VM_USE_MEMORY_PROFILE */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* end of include guard */
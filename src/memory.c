@@ -0,0 +1,903 @@
+/*
+ * Copyright (C) 2021 Masahiro Ide
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifdef __linux__
+#  define _GNU_SOURCE // memfd_create
+#endif
+
+#include "memory.h"
+#include "allocator.h"
+#include "instance-pool.h"
+#include "trap.h"
+#include <stdio.h>
+#include <stdlib.h> // malloc
+#include <string.h>
+
+#define LOG(MSG) fprintf(stderr, "(%s:%d)" MSG, __FILE__, __LINE__)
+
+#ifdef WASMBOX_MEMORY_USE_RESERVATION
+#  include <sys/mman.h>
+#  include <unistd.h> // sysconf
+
+#  define WASMBOX_MEMORY_RESERVATION_SIZE                      \
+    ((size_t) WASMBOX_PAGE_SIZE * WASMBOX_MEMORY_MAX_PAGES + \
+     WASMBOX_MEMORY_GUARD_SIZE)
+#endif
+
+#ifdef WASMBOX_MEMORY_USE_NUMA
+#  include <linux/mempolicy.h> // MPOL_PREFERRED
+#  include <sys/syscall.h> // SYS_mbind
+#endif
+
+#ifdef WASMBOX_MEMORY_USE_MEMFD_IMAGE
+#  include <unistd.h> // ftruncate, pwrite
+
+/* Granularity at which all-zero parts of an image are left as holes. */
+#  define WASMBOX_MEMORY_IMAGE_CHUNK_SIZE (4096)
+#endif
+
+struct wasmbox_memory_image_t {
+  wasm_u32_t page_size;
+#ifdef WASMBOX_MEMORY_USE_MEMFD_IMAGE
+  int fd;
+  /* Position of the first page in the file. */
+  wasm_u64_t offset;
+#else
+  wasm_u8_t *data;
+#endif
+};
+
+/* State which wasmbox_memory_reset brings the memory back to. */
+struct wasmbox_memory_tracker_t {
+  wasmbox_memory_image_t *image;
+  wasm_u8_t owns_image;
+  /* Size of the memory in wasm pages when tracking started. */
+  wasm_u32_t page_size;
+#ifdef WASMBOX_MEMORY_USE_MEMFD_IMAGE
+  wasm_u8_t *base;
+  wasm_u64_t host_page_size;
+  /* One bit per host page, set once the page is written. */
+  wasm_u32_t *dirty;
+  wasm_u64_t dirty_words;
+  struct wasmbox_memory_tracker_t *next;
+#endif
+};
+
+#ifdef WASMBOX_MEMORY_USE_MEMFD_IMAGE
+/* Every tracked memory, searched by the fault handler. */
+static wasmbox_memory_tracker_t *tracked_memories;
+static char tracked_memories_lock;
+
+static void wasmbox_memory_lock_trackers(void) {
+  while (__atomic_test_and_set(&tracked_memories_lock, __ATOMIC_ACQUIRE)) {
+  }
+}
+
+static void wasmbox_memory_unlock_trackers(void) {
+  __atomic_clear(&tracked_memories_lock, __ATOMIC_RELEASE);
+}
+#endif
+
+#ifdef WASMBOX_MEMORY_USE_RESERVATION
+/* Transparent huge pages back only ranges aligned to the huge page size. */
+#  define WASMBOX_MEMORY_HUGE_PAGE_SIZE ((size_t) 2 * 1024 * 1024)
+
+static wasm_u8_t *wasmbox_memory_reserve_bytes(size_t size,
+                                               int huge_page_aligned) {
+  size_t align = huge_page_aligned ? WASMBOX_MEMORY_HUGE_PAGE_SIZE : 0;
+  wasm_u8_t *raw = mmap(NULL, size + align, PROT_NONE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (raw == MAP_FAILED) {
+    return NULL;
+  }
+  if (align == 0) {
+    return raw;
+  }
+  wasm_u8_t *base =
+      (wasm_u8_t *) (((uintptr_t) raw + align - 1) & ~(uintptr_t) (align - 1));
+  size_t head = base - raw;
+  if (head > 0) {
+    munmap(raw, head);
+  }
+  if (align - head > 0) {
+    munmap(base + size, align - head);
+  }
+  return base;
+}
+
+wasm_u8_t *wasmbox_memory_reserve(int huge_page_aligned) {
+  return wasmbox_memory_reserve_bytes(WASMBOX_MEMORY_RESERVATION_SIZE,
+                                      huge_page_aligned);
+}
+
+void wasmbox_memory_unreserve(wasm_u8_t *base) {
+  munmap(base, WASMBOX_MEMORY_RESERVATION_SIZE);
+}
+
+void wasmbox_memory_decommit(wasm_u8_t *base, wasm_u32_t page_size) {
+  // Replacing the mapping drops its pages, whether they are anonymous or
+  // still shared with an image, and makes the range inaccessible again.
+  if (page_size > 0) {
+    mmap(base, (size_t) WASMBOX_PAGE_SIZE * page_size, PROT_NONE,
+         MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0);
+  }
+}
+
+// Bytes of a stack of `size` values, rounded up to whole pages.
+static size_t wasmbox_stack_mapping_size(size_t size, size_t *guard) {
+  size_t page = (size_t) sysconf(_SC_PAGESIZE);
+  *guard = page;
+  return (sizeof(wasmbox_value_t) * size + page - 1) & ~(page - 1);
+}
+#endif
+
+wasmbox_value_t *wasmbox_stack_reserve(size_t size) {
+#ifdef WASMBOX_MEMORY_USE_RESERVATION
+  size_t guard;
+  size_t bytes = wasmbox_stack_mapping_size(size, &guard);
+  // Pages are committed by the first call which reaches them. The guard page
+  // after the stack catches a frame written past the checked limit.
+  wasm_u8_t *base = mmap(NULL, bytes + guard, PROT_NONE,
+                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (base == MAP_FAILED) {
+    return NULL;
+  }
+  if (mprotect(base, bytes, PROT_READ | PROT_WRITE) != 0) {
+    munmap(base, bytes + guard);
+    return NULL;
+  }
+  return (wasmbox_value_t *) base;
+#else
+  return (wasmbox_value_t *) malloc(sizeof(wasmbox_value_t) * size);
+#endif
+}
+
+void wasmbox_stack_unreserve(wasmbox_value_t *stack, size_t size) {
+#ifdef WASMBOX_MEMORY_USE_RESERVATION
+  size_t guard;
+  size_t bytes = wasmbox_stack_mapping_size(size, &guard);
+  munmap(stack, bytes + guard);
+#else
+  free(stack);
+#endif
+}
+
+int wasmbox_memory_bind(void *addr, size_t size, wasm_u32_t node) {
+#ifdef WASMBOX_MEMORY_USE_NUMA
+  if (node >= WASMBOX_MEMORY_MAX_NODES) {
+    return -1;
+  }
+  uintptr_t page = (uintptr_t) sysconf(_SC_PAGESIZE);
+  uintptr_t start = ((uintptr_t) addr + page - 1) & ~(page - 1);
+  uintptr_t end = ((uintptr_t) addr + size) & ~(page - 1);
+  if (start >= end) {
+    return 0;
+  }
+  const size_t bits = 8 * sizeof(unsigned long);
+  unsigned long mask[WASMBOX_MEMORY_MAX_NODES / (8 * sizeof(unsigned long))] =
+      {0};
+  mask[node / bits] = 1UL << (node % bits);
+  // Preferred rather than bound, so that a full node falls back to the
+  // others instead of failing the allocation.
+  return syscall(SYS_mbind, start, end - start, MPOL_PREFERRED, mask,
+                 WASMBOX_MEMORY_MAX_NODES, MPOL_MF_MOVE) == 0
+             ? 0
+             : -1;
+#else
+  (void) addr;
+  (void) size;
+  (void) node;
+  return -1;
+#endif
+}
+
+#ifdef WASMBOX_MEMORY_USE_RESERVATION
+/* A linear memory used by several modules, typically one per guest thread. */
+struct wasmbox_shared_memory_t {
+  wasm_u8_t *base;
+  /* Changed only by memory.grow under `lock`, and read without it. */
+  wasm_u32_t page_size;
+  wasm_u32_t capacity;
+  wasm_u32_t refs;
+  char lock;
+};
+
+static int wasmbox_memory_is_shared_block(wasmbox_module_t *mod) {
+  return mod->shared_memory != NULL && mod->memory_block != NULL &&
+         mod->memory_block->data == mod->shared_memory->base;
+}
+
+// Tells if `mod` reserves the index space of a memory64 for itself. Instance
+// slots and shared memories only have the reservation of a 32-bit memory.
+static int wasmbox_memory_reserves_memory64(wasmbox_module_t *mod) {
+  return mod->memory64 && mod->instance_slot == NULL &&
+         !wasmbox_memory_is_shared_block(mod);
+}
+
+// A memory64 checks every access instead of faulting on a guard region, so
+// its reservation only spans its `capacity` pages, however large.
+static size_t wasmbox_memory_reservation_size(wasmbox_module_t *mod,
+                                              wasm_u32_t capacity) {
+  if (wasmbox_memory_reserves_memory64(mod)) {
+    return (size_t) WASMBOX_PAGE_SIZE * (capacity > 0 ? capacity : 1);
+  }
+  return WASMBOX_MEMORY_RESERVATION_SIZE;
+}
+
+// A reservation borrowed from an instance slot is kept for the next instance
+// of the slot.
+static void wasmbox_memory_release(wasmbox_module_t *mod, wasm_u8_t *base,
+                                   wasm_u32_t page_size, wasm_u32_t capacity) {
+  if (mod->instance_slot != NULL) {
+    wasmbox_memory_decommit(base, page_size);
+  } else {
+    munmap(base, wasmbox_memory_reservation_size(mod, capacity));
+  }
+}
+#endif
+
+// Largest number of pages the memory of `mod` can have. Without a
+// reservation a memory is a block of the allocator, whose sizes are 32-bit.
+static wasm_u32_t wasmbox_memory_max_pages(wasmbox_module_t *mod) {
+#ifdef WASMBOX_MEMORY_USE_RESERVATION
+  if (wasmbox_memory_reserves_memory64(mod)) {
+    return WASMBOX_MEMORY64_MAX_PAGES;
+  }
+#else
+  (void) mod;
+#endif
+  return WASMBOX_MEMORY_MAX_PAGES;
+}
+
+int wasmbox_memory_init(wasmbox_module_t *mod, wasm_u32_t min, wasm_u32_t max) {
+  wasmbox_memory_image_t *image = mod->memory_image;
+  if (max > wasmbox_memory_max_pages(mod)) {
+    max = wasmbox_memory_max_pages(mod);
+  }
+  if (image != NULL && image->page_size > min) {
+    min = image->page_size;
+  }
+  if (min > max) {
+    LOG("memory is too large");
+    return -1;
+  }
+#ifdef WASMBOX_MEMORY_USE_RESERVATION
+  wasm_u8_t *base = mod->instance_slot != NULL
+                        ? wasmbox_instance_slot_memory(mod->instance_slot)
+                        : wasmbox_memory_reserve_bytes(
+                              wasmbox_memory_reservation_size(mod, max),
+                              mod->use_huge_pages);
+  if (base == NULL) {
+    LOG("failed to reserve memory");
+    return -1;
+  }
+  wasm_u32_t mapped = 0;
+#  ifdef WASMBOX_MEMORY_USE_MEMFD_IMAGE
+  // A private mapping of the image shares its pages until they are written.
+  if (image != NULL && image->page_size > 0) {
+    if (mmap(base, (size_t) WASMBOX_PAGE_SIZE * image->page_size,
+             PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, image->fd,
+             (off_t) image->offset) == MAP_FAILED) {
+      LOG("failed to map memory image");
+      wasmbox_memory_release(mod, base, 0, max);
+      return -1;
+    }
+    mapped = image->page_size;
+  }
+#  endif
+  if (min > mapped &&
+      mprotect(base + (size_t) WASMBOX_PAGE_SIZE * mapped,
+               (size_t) WASMBOX_PAGE_SIZE * (min - mapped),
+               PROT_READ | PROT_WRITE) != 0) {
+    LOG("failed to commit memory");
+    wasmbox_memory_release(mod, base, mapped, max);
+    return -1;
+  }
+#  ifdef MADV_HUGEPAGE
+  // Pages of the image stay shared with it and are not collapsed.
+  wasm_u32_t reserved = wasmbox_memory_reserves_memory64(mod)
+                            ? max
+                            : WASMBOX_MEMORY_MAX_PAGES;
+  if (mod->use_huge_pages && reserved > mapped &&
+      madvise(base + (size_t) WASMBOX_PAGE_SIZE * mapped,
+              (size_t) WASMBOX_PAGE_SIZE * (reserved - mapped),
+              MADV_HUGEPAGE) == 0) {
+    mod->huge_pages |= WASMBOX_HUGE_PAGES_MEMORY;
+  }
+#  endif
+  mod->memory_block = (wasmbox_memory_block_t *) base;
+#else
+  mod->memory_block = (wasmbox_memory_block_t *) wasmbox_malloc(
+      sizeof(*mod->memory_block) + WASMBOX_PAGE_SIZE * min);
+#endif
+#ifndef WASMBOX_MEMORY_USE_MEMFD_IMAGE
+  if (image != NULL) {
+    memcpy(mod->memory_block->data, image->data,
+           (size_t) WASMBOX_PAGE_SIZE * image->page_size);
+  }
+#endif
+  mod->memory_block_size = min;
+  mod->memory_block_capacity = max;
+  mod->memory_generation++;
+  return 0;
+}
+
+wasmbox_shared_memory_t *wasmbox_shared_memory_create(wasm_u32_t min,
+                                                      wasm_u32_t max) {
+#ifdef WASMBOX_MEMORY_USE_RESERVATION
+  if (max > WASMBOX_MEMORY_MAX_PAGES) {
+    max = WASMBOX_MEMORY_MAX_PAGES;
+  }
+  if (min > max) {
+    LOG("memory is too large");
+    return NULL;
+  }
+  wasm_u8_t *base = wasmbox_memory_reserve(0);
+  if (base == NULL) {
+    LOG("failed to reserve memory");
+    return NULL;
+  }
+  if (min > 0 && mprotect(base, (size_t) WASMBOX_PAGE_SIZE * min,
+                          PROT_READ | PROT_WRITE) != 0) {
+    LOG("failed to commit memory");
+    wasmbox_memory_unreserve(base);
+    return NULL;
+  }
+  wasmbox_shared_memory_t *memory =
+      (wasmbox_shared_memory_t *) wasmbox_malloc(sizeof(*memory));
+  memory->base = base;
+  memory->page_size = min;
+  memory->capacity = max;
+  memory->refs = 1;
+  return memory;
+#else
+  // Other threads would keep using the old block after a realloc.
+  LOG("shared memory needs a memory reservation");
+  return NULL;
+#endif
+}
+
+void wasmbox_shared_memory_release(wasmbox_shared_memory_t *memory) {
+#ifdef WASMBOX_MEMORY_USE_RESERVATION
+  if (__atomic_sub_fetch(&memory->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+    wasmbox_memory_unreserve(memory->base);
+    wasmbox_free(memory);
+  }
+#endif
+}
+
+int wasmbox_memory_init_shared(wasmbox_module_t *mod, wasm_u32_t min,
+                               wasm_u32_t max) {
+#ifdef WASMBOX_MEMORY_USE_RESERVATION
+  if (mod->memory_image != NULL) {
+    LOG("memory images do not apply to shared memory");
+    return -1;
+  }
+  wasmbox_shared_memory_t *memory = mod->shared_memory;
+  if (memory == NULL) {
+    memory = wasmbox_shared_memory_create(min, max);
+    if (memory == NULL) {
+      return -1;
+    }
+    mod->shared_memory = memory;
+  } else {
+    if (memory->capacity < min) {
+      LOG("shared memory is too small");
+      return -1;
+    }
+    __atomic_add_fetch(&memory->refs, 1, __ATOMIC_RELAXED);
+  }
+  mod->memory_block = (wasmbox_memory_block_t *) memory->base;
+  mod->memory_block_size =
+      __atomic_load_n(&memory->page_size, __ATOMIC_ACQUIRE);
+  mod->memory_block_capacity = memory->capacity;
+  return 0;
+#else
+  LOG("shared memory needs a memory reservation");
+  return -1;
+#endif
+}
+
+int wasmbox_memory_is_shared(wasmbox_module_t *mod) {
+#ifdef WASMBOX_MEMORY_USE_RESERVATION
+  return wasmbox_memory_is_shared_block(mod);
+#else
+  return 0;
+#endif
+}
+
+wasm_u64_t wasmbox_memory_reserved_size(wasmbox_module_t *mod) {
+  if (mod->memory_block == NULL) {
+    return 0;
+  }
+#ifdef WASMBOX_MEMORY_USE_RESERVATION
+  return wasmbox_memory_reservation_size(mod, mod->memory_block_capacity);
+#else
+  return (wasm_u64_t) WASMBOX_PAGE_SIZE * mod->memory_block_size;
+#endif
+}
+
+wasm_u32_t wasmbox_memory_size(wasmbox_module_t *mod) {
+#ifdef WASMBOX_MEMORY_USE_RESERVATION
+  // Another module may have grown a shared memory.
+  if (wasmbox_memory_is_shared_block(mod)) {
+    mod->memory_block_size =
+        __atomic_load_n(&mod->shared_memory->page_size, __ATOMIC_ACQUIRE);
+  }
+#endif
+  return mod->memory_block_size;
+}
+
+#ifdef WASMBOX_MEMORY_USE_RESERVATION
+static wasm_u32_t wasmbox_shared_memory_grow(wasmbox_module_t *mod,
+                                             wasm_u32_t delta) {
+  wasmbox_shared_memory_t *memory = mod->shared_memory;
+  while (__atomic_test_and_set(&memory->lock, __ATOMIC_ACQUIRE)) {
+  }
+  wasm_u32_t current = memory->page_size;
+  if (delta > memory->capacity - current ||
+      (delta > 0 &&
+       mprotect(memory->base + (size_t) WASMBOX_PAGE_SIZE * current,
+                (size_t) WASMBOX_PAGE_SIZE * delta,
+                PROT_READ | PROT_WRITE) != 0)) {
+    current = WASM_U32_MAX;
+  } else {
+    __atomic_store_n(&memory->page_size, current + delta, __ATOMIC_RELEASE);
+    mod->memory_block_size = current + delta;
+  }
+  __atomic_clear(&memory->lock, __ATOMIC_RELEASE);
+  return current;
+}
+#endif
+
+static wasm_u32_t wasmbox_memory_grow_pages(wasmbox_module_t *mod,
+                                            wasm_u32_t delta) {
+#ifdef WASMBOX_MEMORY_USE_RESERVATION
+  if (wasmbox_memory_is_shared_block(mod)) {
+    return wasmbox_shared_memory_grow(mod, delta);
+  }
+#endif
+  wasm_u32_t current = mod->memory_block_size;
+  if (delta > mod->memory_block_capacity - current) {
+    return WASM_U32_MAX;
+  }
+  if (delta == 0) {
+    return current;
+  }
+#ifdef WASMBOX_MEMORY_USE_RESERVATION
+  // Pages past the current size are still PROT_NONE and zero-filled by the
+  // kernel on first touch, so growing neither moves nor copies anything.
+  wasm_u8_t *end =
+      mod->memory_block->data + (size_t) WASMBOX_PAGE_SIZE * current;
+  if (mprotect(end, (size_t) WASMBOX_PAGE_SIZE * delta,
+               PROT_READ | PROT_WRITE) != 0) {
+    return WASM_U32_MAX;
+  }
+#else
+  wasm_u64_t size = (wasm_u64_t) WASMBOX_PAGE_SIZE * (current + delta);
+  if (size + sizeof(wasm_s32_t) > WASM_U32_MAX) {
+    return WASM_U32_MAX;
+  }
+  mod->memory_block = (wasmbox_memory_block_t *) wasmbox_realloc(
+      mod->memory_block, sizeof(*mod->memory_block) + (wasm_u32_t) size);
+  memset(mod->memory_block->data + WASMBOX_PAGE_SIZE * current, 0,
+         WASMBOX_PAGE_SIZE * delta);
+#endif
+  mod->memory_block_size = current + delta;
+  mod->memory_generation++;
+  return current;
+}
+
+wasm_u32_t wasmbox_memory_grow(wasmbox_module_t *mod, wasm_u32_t delta) {
+  wasm_u32_t current = wasmbox_memory_grow_pages(mod, delta);
+  if (current != WASM_U32_MAX && delta > 0 &&
+      mod->memory_grow_callback != NULL) {
+    wasmbox_memory_view_t view;
+    wasmbox_memory_view(mod, &view);
+    mod->memory_grow_callback(mod->memory_grow_data, mod, &view);
+  }
+  return current;
+}
+
+void wasmbox_memory_view(wasmbox_module_t *mod, wasmbox_memory_view_t *view) {
+  if (mod->memory_block == NULL) {
+    *view = (wasmbox_memory_view_t){NULL, 0, mod->memory_generation};
+    return;
+  }
+  wasm_u32_t size = wasmbox_memory_size(mod);
+  view->base = mod->memory_block->data;
+  view->length = (wasm_u64_t) WASMBOX_PAGE_SIZE * size;
+  // Other modules grow a shared memory too, and it never moves, so its size
+  // tells the views apart.
+  view->generation =
+      wasmbox_memory_is_shared(mod) ? size : mod->memory_generation;
+}
+
+#ifdef WASMBOX_MEMORY_USE_RESERVATION
+int wasmbox_memory_contains(wasmbox_module_t *mod, const void *addr) {
+  const wasm_u8_t *base = mod != NULL && mod->memory_block != NULL
+                              ? mod->memory_block->data
+                              : NULL;
+  return base != NULL && (const wasm_u8_t *) addr >= base &&
+         (const wasm_u8_t *) addr <
+             base + wasmbox_memory_reservation_size(
+                        mod, mod->memory_block_capacity);
+}
+#endif
+
+#ifdef WASMBOX_MEMORY_USE_RESERVATION
+// Returns the host pages of `mod` from `offset` which cover `size` bytes, or
+// NULL if they do not lie in the current memory or the memory cannot be
+// remapped.
+static wasm_u8_t *wasmbox_memory_map_range(wasmbox_module_t *mod,
+                                           wasm_u32_t offset,
+                                           wasm_u64_t *size) {
+  if (mod->memory_block == NULL || wasmbox_memory_is_shared_block(mod)) {
+    LOG("memory cannot be mapped");
+    return NULL;
+  }
+  if (mod->memory_tracker != NULL) {
+    LOG("memory tracks writes");
+    return NULL;
+  }
+  wasm_u64_t page = (wasm_u64_t) sysconf(_SC_PAGESIZE);
+  wasm_u64_t rounded = (*size + page - 1) & ~(page - 1);
+  if (offset % page != 0 || *size == 0 ||
+      *size > (wasm_u64_t) WASMBOX_PAGE_SIZE * WASMBOX_MEMORY_MAX_PAGES ||
+      offset + rounded >
+          (wasm_u64_t) WASMBOX_PAGE_SIZE * mod->memory_block_size) {
+    LOG("range is not in the memory");
+    return NULL;
+  }
+  *size = rounded;
+  return mod->memory_block->data + offset;
+}
+#endif
+
+int wasmbox_memory_map(wasmbox_module_t *mod, wasm_u32_t offset, int fd,
+                       wasm_u64_t file_offset, wasm_u64_t size, int mode) {
+#ifdef WASMBOX_MEMORY_USE_RESERVATION
+  wasm_u8_t *addr = wasmbox_memory_map_range(mod, offset, &size);
+  if (addr == NULL) {
+    return -1;
+  }
+  int prot =
+      mode == WASMBOX_MAP_COPY_ON_WRITE ? PROT_READ | PROT_WRITE : PROT_READ;
+  if (mmap(addr, size, prot, MAP_PRIVATE | MAP_FIXED, fd,
+           (off_t) file_offset) == MAP_FAILED) {
+    LOG("failed to map file");
+    // The pages may be gone already, so they are put back zeroed.
+    wasmbox_memory_unmap(mod, offset, size);
+    return -1;
+  }
+  return 0;
+#else
+  (void) mod;
+  (void) offset;
+  (void) fd;
+  (void) file_offset;
+  (void) size;
+  (void) mode;
+  return -1;
+#endif
+}
+
+int wasmbox_memory_unmap(wasmbox_module_t *mod, wasm_u32_t offset,
+                         wasm_u64_t size) {
+#ifdef WASMBOX_MEMORY_USE_RESERVATION
+  wasm_u8_t *addr = wasmbox_memory_map_range(mod, offset, &size);
+  if (addr == NULL ||
+      mmap(addr, size, PROT_READ | PROT_WRITE,
+           MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1,
+           0) == MAP_FAILED) {
+    return -1;
+  }
+  return 0;
+#else
+  (void) mod;
+  (void) offset;
+  (void) size;
+  return -1;
+#endif
+}
+
+void wasmbox_memory_dispose(wasmbox_module_t *mod) {
+  wasmbox_memory_tracker_t *tracker = mod->memory_tracker;
+  if (tracker != NULL) {
+    if (tracker->owns_image) {
+      wasmbox_memory_image_dispose(tracker->image);
+    }
+#ifdef WASMBOX_MEMORY_USE_MEMFD_IMAGE
+    wasmbox_memory_lock_trackers();
+    wasmbox_memory_tracker_t **link = &tracked_memories;
+    while (*link != tracker) {
+      link = &(*link)->next;
+    }
+    __atomic_store_n(link, tracker->next, __ATOMIC_RELEASE);
+    wasmbox_memory_unlock_trackers();
+    if (tracker->dirty != NULL) {
+      wasmbox_free(tracker->dirty);
+    }
+#endif
+    wasmbox_free(tracker);
+    mod->memory_tracker = NULL;
+  }
+  if (mod->memory_block == NULL) {
+    return;
+  }
+#ifdef WASMBOX_MEMORY_USE_RESERVATION
+  if (wasmbox_memory_is_shared_block(mod)) {
+    wasmbox_shared_memory_release(mod->shared_memory);
+    mod->shared_memory = NULL;
+    mod->memory_block = NULL;
+    mod->memory_block_size = 0;
+    return;
+  }
+  wasmbox_memory_release(mod, mod->memory_block->data, mod->memory_block_size,
+                         mod->memory_block_capacity);
+#else
+  wasmbox_free(mod->memory_block);
+#endif
+  mod->memory_block = NULL;
+  mod->memory_block_size = 0;
+  mod->memory_generation++;
+}
+
+wasmbox_memory_image_t *wasmbox_memory_image_create(wasmbox_module_t *mod) {
+  if (mod->memory_block == NULL) {
+    return NULL;
+  }
+  size_t size = (size_t) WASMBOX_PAGE_SIZE * mod->memory_block_size;
+  wasmbox_memory_image_t *image =
+      (wasmbox_memory_image_t *) wasmbox_malloc(sizeof(*image));
+  image->page_size = mod->memory_block_size;
+#ifdef WASMBOX_MEMORY_USE_MEMFD_IMAGE
+  image->fd = memfd_create("wasmbox-memory", MFD_CLOEXEC);
+  if (image->fd < 0 || ftruncate(image->fd, (off_t) size) != 0) {
+    LOG("failed to create memory image");
+    wasmbox_memory_image_dispose(image);
+    return NULL;
+  }
+  // The file reads as zero where nothing is written, so only chunks holding
+  // data take space.
+  const wasm_u8_t *data = mod->memory_block->data;
+  for (size_t i = 0; i < size; i += WASMBOX_MEMORY_IMAGE_CHUNK_SIZE) {
+    const wasm_u8_t *chunk = data + i;
+    if (chunk[0] == 0 &&
+        memcmp(chunk, chunk + 1, WASMBOX_MEMORY_IMAGE_CHUNK_SIZE - 1) == 0) {
+      continue;
+    }
+    if (pwrite(image->fd, chunk, WASMBOX_MEMORY_IMAGE_CHUNK_SIZE, (off_t) i) !=
+        WASMBOX_MEMORY_IMAGE_CHUNK_SIZE) {
+      LOG("failed to write memory image");
+      wasmbox_memory_image_dispose(image);
+      return NULL;
+    }
+  }
+#else
+  if (size > WASM_U32_MAX - sizeof(wasm_s32_t)) {
+    LOG("memory is too large");
+    wasmbox_free(image);
+    return NULL;
+  }
+  image->data = (wasm_u8_t *) wasmbox_malloc_uninit((wasm_u32_t) size);
+  memcpy(image->data, mod->memory_block->data, size);
+#endif
+  return image;
+}
+
+wasmbox_memory_image_t *wasmbox_memory_image_open(FILE *fp, wasm_u64_t offset,
+                                                  wasm_u32_t page_size) {
+  wasmbox_memory_image_t *image =
+      (wasmbox_memory_image_t *) wasmbox_malloc(sizeof(*image));
+  image->page_size = page_size;
+#ifdef WASMBOX_MEMORY_USE_MEMFD_IMAGE
+  // The pages are read from the file when they are first touched.
+  image->fd = dup(fileno(fp));
+  image->offset = offset;
+  if (image->fd < 0) {
+    LOG("failed to open memory image");
+    wasmbox_memory_image_dispose(image);
+    return NULL;
+  }
+#else
+  size_t size = (size_t) WASMBOX_PAGE_SIZE * page_size;
+  if (size > WASM_U32_MAX - sizeof(wasm_s32_t)) {
+    LOG("memory is too large");
+    wasmbox_free(image);
+    return NULL;
+  }
+  image->data = (wasm_u8_t *) wasmbox_malloc_uninit((wasm_u32_t) size);
+  if (fseek(fp, (long) offset, SEEK_SET) != 0 ||
+      fread(image->data, 1, size, fp) != size) {
+    LOG("failed to read memory image");
+    wasmbox_memory_image_dispose(image);
+    return NULL;
+  }
+#endif
+  return image;
+}
+
+void wasmbox_memory_image_dispose(wasmbox_memory_image_t *image) {
+  if (image == NULL) {
+    return;
+  }
+#ifdef WASMBOX_MEMORY_USE_MEMFD_IMAGE
+  if (image->fd >= 0) {
+    close(image->fd);
+  }
+#else
+  wasmbox_free(image->data);
+#endif
+  wasmbox_free(image);
+}
+
+int wasmbox_memory_track_writes(wasmbox_module_t *mod) {
+  if (mod->memory_block == NULL) {
+    return 0;
+  }
+  if (wasmbox_memory_is_shared(mod)) {
+    LOG("shared memory can not be reset");
+    return -1;
+  }
+  wasmbox_memory_tracker_t *tracker =
+      (wasmbox_memory_tracker_t *) wasmbox_malloc(sizeof(*tracker));
+  tracker->page_size = mod->memory_block_size;
+  // A memory loaded from an image still equals it.
+  tracker->image = mod->memory_image;
+  if (tracker->image == NULL) {
+    tracker->image = wasmbox_memory_image_create(mod);
+    tracker->owns_image = 1;
+    if (tracker->image == NULL) {
+      wasmbox_free(tracker);
+      return -1;
+    }
+  }
+  mod->memory_tracker = tracker;
+#ifdef WASMBOX_MEMORY_USE_MEMFD_IMAGE
+  wasm_u8_t *base = mod->memory_block->data;
+  size_t size = (size_t) WASMBOX_PAGE_SIZE * tracker->page_size;
+  size_t image_size = (size_t) WASMBOX_PAGE_SIZE * tracker->image->page_size;
+  tracker->base = base;
+  tracker->host_page_size = (wasm_u64_t) sysconf(_SC_PAGESIZE);
+  tracker->dirty_words = (size / tracker->host_page_size + 31) / 32;
+  if (tracker->dirty_words > 0) {
+    tracker->dirty = (wasm_u32_t *) wasmbox_malloc(sizeof(wasm_u32_t) *
+                                                   tracker->dirty_words);
+  }
+  // Share the pages with the image from now on and write-protect all of
+  // them. The first write to a page faults and marks it dirty.
+  if (tracker->owns_image && image_size > 0 &&
+      mmap(base, image_size, PROT_READ, MAP_PRIVATE | MAP_FIXED,
+           tracker->image->fd, 0) == MAP_FAILED) {
+    return -1;
+  }
+  wasmbox_trap_install_handlers();
+  wasmbox_memory_lock_trackers();
+  tracker->next = tracked_memories;
+  __atomic_store_n(&tracked_memories, tracker, __ATOMIC_RELEASE);
+  wasmbox_memory_unlock_trackers();
+  if (size > 0 && mprotect(base, size, PROT_READ) != 0) {
+    return -1;
+  }
+#endif
+  return 0;
+}
+
+#ifdef WASMBOX_MEMORY_USE_MEMFD_IMAGE
+// Runs in the fault handler, so the list is walked without the lock.
+int wasmbox_memory_handle_write_fault(void *addr) {
+  wasmbox_memory_tracker_t *tracker =
+      __atomic_load_n(&tracked_memories, __ATOMIC_ACQUIRE);
+  for (; tracker != NULL;
+       tracker = __atomic_load_n(&tracker->next, __ATOMIC_ACQUIRE)) {
+    wasm_u8_t *base = tracker->base;
+    wasm_u64_t offset = (wasm_u8_t *) addr - base;
+    if ((wasm_u8_t *) addr < base ||
+        offset >= (wasm_u64_t) WASMBOX_PAGE_SIZE * tracker->page_size) {
+      continue;
+    }
+    wasm_u64_t page = offset / tracker->host_page_size;
+    __atomic_fetch_or(&tracker->dirty[page / 32], (wasm_u32_t) 1 << (page % 32),
+                      __ATOMIC_RELAXED);
+    return mprotect(base + page * tracker->host_page_size,
+                    tracker->host_page_size, PROT_READ | PROT_WRITE) == 0;
+  }
+  return 0;
+}
+
+// Maps `count` host pages from `page` on back to the image, or to zero pages
+// past its end, write-protected again.
+static int wasmbox_memory_restore_pages(wasmbox_memory_tracker_t *tracker,
+                                        wasm_u8_t *base, wasm_u64_t page,
+                                        wasm_u64_t count) {
+  wasm_u64_t image_pages = (wasm_u64_t) WASMBOX_PAGE_SIZE *
+                           tracker->image->page_size / tracker->host_page_size;
+  wasm_u64_t host_page_size = tracker->host_page_size;
+  while (count > 0) {
+    wasm_u64_t n = count;
+    void *mem;
+    if (page < image_pages) {
+      n = page + n > image_pages ? image_pages - page : n;
+      mem = mmap(base + page * host_page_size, n * host_page_size, PROT_READ,
+                 MAP_PRIVATE | MAP_FIXED, tracker->image->fd,
+                 (off_t) (tracker->image->offset + page * host_page_size));
+    } else {
+      mem = mmap(base + page * host_page_size, n * host_page_size, PROT_READ,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+    }
+    if (mem == MAP_FAILED) {
+      return -1;
+    }
+    page += n;
+    count -= n;
+  }
+  return 0;
+}
+#endif
+
+int wasmbox_memory_reset(wasmbox_module_t *mod) {
+  wasmbox_memory_tracker_t *tracker = mod->memory_tracker;
+  if (tracker == NULL) {
+    return mod->memory_block == NULL ? 0 : -1;
+  }
+  wasm_u8_t *base = mod->memory_block->data;
+#ifdef WASMBOX_MEMORY_USE_RESERVATION
+  // Pages added by memory.grow are dropped as a whole.
+  if (mod->memory_block_size > tracker->page_size) {
+    wasmbox_memory_decommit(base + (size_t) WASMBOX_PAGE_SIZE *
+                                       tracker->page_size,
+                            mod->memory_block_size - tracker->page_size);
+  }
+#endif
+#ifdef WASMBOX_MEMORY_USE_MEMFD_IMAGE
+  // Runs of dirty pages are restored with one mapping each.
+  wasm_u64_t run = 0;
+  wasm_u64_t run_size = 0;
+  for (wasm_u64_t i = 0; i < tracker->dirty_words; ++i) {
+    wasm_u32_t bits = tracker->dirty[i];
+    tracker->dirty[i] = 0;
+    while (bits != 0) {
+      wasm_u64_t page = i * 32 + __builtin_ctz(bits);
+      bits &= bits - 1;
+      if (run_size > 0 && run + run_size == page) {
+        run_size++;
+        continue;
+      }
+      if (run_size > 0 &&
+          wasmbox_memory_restore_pages(tracker, base, run, run_size) != 0) {
+        return -1;
+      }
+      run = page;
+      run_size = 1;
+    }
+  }
+  if (run_size > 0 &&
+      wasmbox_memory_restore_pages(tracker, base, run, run_size) != 0) {
+    return -1;
+  }
+#else
+  size_t size = (size_t) WASMBOX_PAGE_SIZE * tracker->page_size;
+  size_t image_size = (size_t) WASMBOX_PAGE_SIZE * tracker->image->page_size;
+  memcpy(base, tracker->image->data, image_size);
+  memset(base + image_size, 0, size - image_size);
+#endif
+  if (mod->memory_block_size != tracker->page_size) {
+    mod->memory_block_size = tracker->page_size;
+    mod->memory_generation++;
+  }
+  return 0;
+}
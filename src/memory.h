@@ -0,0 +1,158 @@
+/*
+ * Copyright (C) 2021 Masahiro Ide
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef WASMBOX_MEMORY_H
+#define WASMBOX_MEMORY_H
+
+#include "wasmbox/wasmbox.h"
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* On 64-bit POSIX hosts the whole 32-bit index space is reserved up front,
+ * unless the build asks for explicit bounds checks. */
+#if defined(__unix__) && (defined(__x86_64__) || defined(__aarch64__)) && \
+    !defined(WASMBOX_MEMORY_NO_RESERVATION)
+#  define WASMBOX_MEMORY_USE_RESERVATION 1
+#endif
+
+/* Images are backed by a memfd, which instances map copy-on-write. */
+#if defined(WASMBOX_MEMORY_USE_RESERVATION) && defined(__linux__)
+#  define WASMBOX_MEMORY_USE_MEMFD_IMAGE 1
+#endif
+
+/* Pages are placed on NUMA nodes with the raw mbind syscall. */
+#if defined(WASMBOX_MEMORY_USE_RESERVATION) && defined(__linux__)
+#  define WASMBOX_MEMORY_USE_NUMA 1
+#endif
+
+/* Largest number of pages a 32-bit linear memory can have. */
+#define WASMBOX_MEMORY_MAX_PAGES (65536)
+/* Largest number of pages a memory64 can have, 1 TiB. With a reservation it
+ * reserves up to its maximum size and grows in place, and without one it is
+ * limited like a 32-bit memory. */
+#define WASMBOX_MEMORY64_MAX_PAGES (16777216)
+/* NUMA nodes which wasmbox_memory_bind can place pages on. */
+#define WASMBOX_MEMORY_MAX_NODES (1024)
+/**
+ * Inaccessible region after the 4 GiB index space. A 32-bit address plus a
+ * 32-bit static offset always lands inside the reservation, so an out-of-bounds
+ * access faults instead of touching another mapping.
+ */
+#define WASMBOX_MEMORY_GUARD_SIZE (4ULL * 1024 * 1024 * 1024)
+
+/**
+ * Creates the linear memory of `mod` with `min` accessible pages. With a
+ * reservation the base address never changes while the memory grows. If
+ * `mod->memory_image` is set the memory starts with its contents.
+ */
+int wasmbox_memory_init(wasmbox_module_t *mod, wasm_u32_t min, wasm_u32_t max);
+
+/**
+ * Makes the shared memory of `mod` the one in `mod->shared_memory`, which is
+ * created if it is not set yet, and takes a reference to it.
+ */
+int wasmbox_memory_init_shared(wasmbox_module_t *mod, wasm_u32_t min,
+                               wasm_u32_t max);
+
+int wasmbox_memory_is_shared(wasmbox_module_t *mod);
+
+/* Bytes of address space mapped for the linear memory of `mod`. */
+wasm_u64_t wasmbox_memory_reserved_size(wasmbox_module_t *mod);
+
+/* Returns the size in pages, which other modules may grow if it is shared. */
+wasm_u32_t wasmbox_memory_size(wasmbox_module_t *mod);
+
+/**
+ * Grows the memory by `delta` pages. Returns the previous size in pages, or
+ * WASM_U32_MAX (-1 in wasm) if the memory cannot grow that far.
+ */
+wasm_u32_t wasmbox_memory_grow(wasmbox_module_t *mod, wasm_u32_t delta);
+
+void wasmbox_memory_dispose(wasmbox_module_t *mod);
+
+/**
+ * Creates an image of `page_size` pages stored in `fp` from `offset` on, which
+ * must be a multiple of WASMBOX_PAGE_SIZE. The image keeps its own handle of
+ * the file.
+ */
+wasmbox_memory_image_t *wasmbox_memory_image_open(FILE *fp, wasm_u64_t offset,
+                                                  wasm_u32_t page_size);
+
+/**
+ * Allocates a value stack of `size` values. With a reservation its pages are
+ * committed on first use and an inaccessible page follows it, so a deep stack
+ * costs only the frames which are actually reached.
+ */
+wasmbox_value_t *wasmbox_stack_reserve(size_t size);
+void wasmbox_stack_unreserve(wasmbox_value_t *stack, size_t size);
+
+/**
+ * Prefers NUMA node `node` for the whole pages from `addr` to `addr + size`,
+ * and moves those already touched there. Remapping the pages, as a decommit
+ * does, drops the preference. Returns -1 if it is not supported.
+ */
+int wasmbox_memory_bind(void *addr, size_t size, wasm_u32_t node);
+
+/**
+ * Records the current memory of `mod` as the state wasmbox_memory_reset
+ * returns to. With a reservation the memory is write-protected, and each
+ * page is marked dirty by wasmbox_memory_handle_write_fault on its first
+ * write, so a reset only restores those pages.
+ */
+int wasmbox_memory_track_writes(wasmbox_module_t *mod);
+int wasmbox_memory_reset(wasmbox_module_t *mod);
+
+#ifdef WASMBOX_MEMORY_USE_RESERVATION
+/**
+ * Reserves the index space and the guard region of one memory, all
+ * inaccessible. Returns NULL on failure.
+ */
+wasm_u8_t *wasmbox_memory_reserve(int huge_page_aligned);
+void wasmbox_memory_unreserve(wasm_u8_t *base);
+/* Drops the first `page_size` pages of a reservation and protects them. */
+void wasmbox_memory_decommit(wasm_u8_t *base, wasm_u32_t page_size);
+
+#  ifdef WASMBOX_MEMORY_USE_MEMFD_IMAGE
+/**
+ * Returns 1 if `addr` is in a page of any tracked memory, which is marked
+ * dirty and made writable.
+ */
+int wasmbox_memory_handle_write_fault(void *addr);
+#  endif
+
+/* Returns 1 if `addr` lies in the reservation of `mod`, guard included. */
+int wasmbox_memory_contains(wasmbox_module_t *mod, const void *addr);
+
+/* Accesses are not checked. Out-of-bounds ones fault on the guard region. */
+#  define WASMBOX_MEMORY_CHECK(MOD, ADDR, SIZE) ((void) 0)
+#else
+#  define WASMBOX_MEMORY_CHECK(MOD, ADDR, SIZE)                        \
+    do {                                                               \
+      if ((ADDR) + (SIZE) >                                            \
+          (wasm_u64_t) (MOD)->memory_block_size * WASMBOX_PAGE_SIZE) { \
+        wasmbox_trap("out of bounds memory access");                   \
+      }                                                                \
+    } while (0)
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* end of include guard */
@@ -0,0 +1,258 @@
+/*
+ * Copyright (C) 2021 Masahiro Ide
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "opcode-profile.h"
+#include "allocator.h"
+#include "opcodes.h"
+
+#include <stdio.h>
+#include <stdlib.h> // qsort
+#include <string.h> // memset
+
+/* Width of the bar of the most run opcode in the report. */
+#define WASMBOX_OPCODE_PROFILE_BAR_WIDTH (40)
+
+/* Slots of the pair table at first. It doubles once half full. */
+#define WASMBOX_OPCODE_PROFILE_PAIR_SIZE (256)
+
+#define WASMBOX_OPCODE_PROFILE_NONE OPCODE_THREADED_CODE
+
+_Static_assert(sizeof(debug_opcodes) / sizeof(debug_opcodes[0]) ==
+                   WASMBOX_OPCODE_PROFILE_SIZE,
+               "every opcode should have a name");
+
+wasmbox_opcode_profile_t *wasmbox_opcode_profile_init(wasmbox_module_t *mod) {
+  wasmbox_opcode_profile_t *profile =
+      (wasmbox_opcode_profile_t *) wasmbox_malloc(sizeof(*profile));
+  memset(profile, 0, sizeof(*profile));
+  profile->previous = WASMBOX_OPCODE_PROFILE_NONE;
+  mod->opcode_profile = profile;
+  return profile;
+}
+
+void wasmbox_opcode_profile_dispose(wasmbox_module_t *mod) {
+  wasmbox_opcode_profile_t *profile = mod->opcode_profile;
+  if (profile != NULL) {
+    wasmbox_opcode_report_profile(mod, WASMBOX_OPCODE_PROFILE_TOP_PAIRS);
+    if (profile->pairs != NULL) {
+      wasmbox_free(profile->pairs);
+    }
+    wasmbox_free(profile);
+    mod->opcode_profile = NULL;
+  }
+}
+
+static wasmbox_opcode_pair_t *wasmbox_opcode_pair_find(
+    wasmbox_opcode_pair_t *pairs, wasm_u32_t size, wasm_u16_t previous,
+    wasm_u16_t current) {
+  wasm_u32_t key = ((wasm_u32_t) previous << 16) | current;
+  wasm_u32_t i = (key * 2654435761u) & (size - 1);
+  while (pairs[i].count != 0 &&
+         (pairs[i].previous != previous || pairs[i].current != current)) {
+    i = (i + 1) & (size - 1);
+  }
+  return &pairs[i];
+}
+
+static void wasmbox_opcode_pair_expand(wasmbox_opcode_profile_t *profile) {
+  wasm_u32_t size = profile->pair_size != 0
+                        ? profile->pair_size * 2
+                        : WASMBOX_OPCODE_PROFILE_PAIR_SIZE;
+  wasmbox_opcode_pair_t *pairs =
+      (wasmbox_opcode_pair_t *) wasmbox_malloc(sizeof(pairs[0]) * size);
+  memset(pairs, 0, sizeof(pairs[0]) * size);
+  for (wasm_u32_t i = 0; i < profile->pair_size; i++) {
+    wasmbox_opcode_pair_t *pair = &profile->pairs[i];
+    if (pair->count != 0) {
+      *wasmbox_opcode_pair_find(pairs, size, pair->previous, pair->current) =
+          *pair;
+    }
+  }
+  if (profile->pairs != NULL) {
+    wasmbox_free(profile->pairs);
+  }
+  profile->pairs = pairs;
+  profile->pair_size = size;
+}
+
+void wasmbox_opcode_profile_pair(wasmbox_opcode_profile_t *profile,
+                                 wasm_u16_t opcode, const wasmbox_code_t *code) {
+  if (profile->previous != WASMBOX_OPCODE_PROFILE_NONE) {
+    if (profile->pair_count * 2 >= profile->pair_size) {
+      wasmbox_opcode_pair_expand(profile);
+    }
+    wasmbox_opcode_pair_t *pair = wasmbox_opcode_pair_find(
+        profile->pairs, profile->pair_size, profile->previous, opcode);
+    if (pair->count++ == 0) {
+      pair->previous = profile->previous;
+      pair->current = opcode;
+      profile->pair_count++;
+    }
+    pair->op1_reads += code->op1.reg == profile->previous_op0;
+    pair->op2_reads += code->op2.reg == profile->previous_op0;
+  }
+  // The next run starts afresh.
+  profile->previous =
+      opcode != OPCODE_EXIT ? opcode : WASMBOX_OPCODE_PROFILE_NONE;
+  profile->previous_op0 = code->op0.reg;
+}
+
+/* Returns the opcode spelled `name` without the OPCODE_ prefix, or
+ * WASMBOX_OPCODE_PROFILE_NONE. */
+static wasm_u16_t wasmbox_opcode_profile_find(const char *name) {
+  for (wasm_u32_t i = 0; i < WASMBOX_OPCODE_PROFILE_NONE; i++) {
+    if (strcmp(debug_opcodes[i] + strlen("OPCODE_"), name) == 0) {
+      return (wasm_u16_t) i;
+    }
+  }
+  return WASMBOX_OPCODE_PROFILE_NONE;
+}
+
+wasm_u64_t wasmbox_opcode_profile_count(wasmbox_module_t *mod,
+                                        const char *name) {
+  wasm_u16_t opcode = wasmbox_opcode_profile_find(name);
+  if (mod->opcode_profile == NULL || opcode == WASMBOX_OPCODE_PROFILE_NONE) {
+    return 0;
+  }
+  return mod->opcode_profile->counts[opcode];
+}
+
+wasm_u64_t wasmbox_opcode_profile_pair_count(wasmbox_module_t *mod,
+                                             const char *previous,
+                                             const char *current) {
+  wasmbox_opcode_profile_t *profile = mod->opcode_profile;
+  wasm_u16_t x = wasmbox_opcode_profile_find(previous);
+  wasm_u16_t y = wasmbox_opcode_profile_find(current);
+  if (profile == NULL || profile->pairs == NULL ||
+      x == WASMBOX_OPCODE_PROFILE_NONE || y == WASMBOX_OPCODE_PROFILE_NONE) {
+    return 0;
+  }
+  return wasmbox_opcode_pair_find(profile->pairs, profile->pair_size, x, y)
+      ->count;
+}
+
+void wasmbox_opcode_profile_clear(wasmbox_module_t *mod) {
+  wasmbox_opcode_profile_t *profile = mod->opcode_profile;
+  if (profile != NULL) {
+    memset(profile->counts, 0, sizeof(profile->counts));
+    if (profile->pairs != NULL) {
+      memset(profile->pairs, 0, sizeof(profile->pairs[0]) * profile->pair_size);
+    }
+    profile->pair_count = 0;
+    profile->previous = WASMBOX_OPCODE_PROFILE_NONE;
+  }
+}
+
+static const wasm_u64_t *wasmbox_opcode_profile_sorted;
+
+/* Most run first, then in opcode order. */
+static int wasmbox_opcode_profile_compare(const void *a, const void *b) {
+  wasm_u16_t x = *(const wasm_u16_t *) a;
+  wasm_u16_t y = *(const wasm_u16_t *) b;
+  wasm_u64_t cx = wasmbox_opcode_profile_sorted[x];
+  wasm_u64_t cy = wasmbox_opcode_profile_sorted[y];
+  if (cx != cy) {
+    return cx > cy ? -1 : 1;
+  }
+  return x < y ? -1 : x > y;
+}
+
+/* Most run first, then by the opcodes. */
+static int wasmbox_opcode_pair_compare(const void *a, const void *b) {
+  const wasmbox_opcode_pair_t *x = (const wasmbox_opcode_pair_t *) a;
+  const wasmbox_opcode_pair_t *y = (const wasmbox_opcode_pair_t *) b;
+  if (x->count != y->count) {
+    return x->count > y->count ? -1 : 1;
+  }
+  if (x->previous != y->previous) {
+    return x->previous < y->previous ? -1 : 1;
+  }
+  return x->current < y->current ? -1 : x->current > y->current;
+}
+
+static double wasmbox_opcode_profile_percent(wasm_u64_t count,
+                                             wasm_u64_t total) {
+  return 100.0 * (double) count / (double) total;
+}
+
+static void wasmbox_opcode_report_pairs(wasmbox_opcode_profile_t *profile,
+                                        wasm_u32_t top_pairs) {
+  wasm_u32_t size = profile->pair_count;
+  if (size == 0 || top_pairs == 0) {
+    return;
+  }
+  wasmbox_opcode_pair_t *pairs =
+      (wasmbox_opcode_pair_t *) wasmbox_malloc(sizeof(pairs[0]) * size);
+  wasm_u64_t total = 0;
+  for (wasm_u32_t i = 0, j = 0; i < profile->pair_size; i++) {
+    if (profile->pairs[i].count != 0) {
+      pairs[j++] = profile->pairs[i];
+      total += profile->pairs[i].count;
+    }
+  }
+  qsort(pairs, size, sizeof(pairs[0]), wasmbox_opcode_pair_compare);
+  fprintf(stdout, "pairs: %llu, distinct: %u\n", (unsigned long long) total,
+          size);
+  // op1/op2 tell how often the second reads the op0 of the first.
+  for (wasm_u32_t i = 0; i < size && i < top_pairs; i++) {
+    wasmbox_opcode_pair_t *pair = &pairs[i];
+    fprintf(stdout, "%-24s %-24s %12llu %6.2f%% op1:%6.2f%% op2:%6.2f%%\n",
+            debug_opcodes[pair->previous] + strlen("OPCODE_"),
+            debug_opcodes[pair->current] + strlen("OPCODE_"),
+            (unsigned long long) pair->count,
+            wasmbox_opcode_profile_percent(pair->count, total),
+            wasmbox_opcode_profile_percent(pair->op1_reads, pair->count),
+            wasmbox_opcode_profile_percent(pair->op2_reads, pair->count));
+  }
+  wasmbox_free(pairs);
+}
+
+void wasmbox_opcode_report_profile(wasmbox_module_t *mod,
+                                   wasm_u32_t top_pairs) {
+  if (mod->opcode_profile == NULL) {
+    return;
+  }
+  const wasm_u64_t *counts = mod->opcode_profile->counts;
+  wasm_u16_t order[WASMBOX_OPCODE_PROFILE_SIZE];
+  wasm_u32_t size = 0;
+  wasm_u64_t total = 0;
+  for (wasm_u32_t i = 0; i < WASMBOX_OPCODE_PROFILE_SIZE; i++) {
+    if (counts[i] != 0) {
+      order[size++] = (wasm_u16_t) i;
+      total += counts[i];
+    }
+  }
+  if (size == 0) {
+    return;
+  }
+  // The report runs once per module, so a global comparison key is fine.
+  wasmbox_opcode_profile_sorted = counts;
+  qsort(order, size, sizeof(order[0]), wasmbox_opcode_profile_compare);
+  fprintf(stdout, "instructions: %llu, opcodes: %u\n",
+          (unsigned long long) total, size);
+  for (wasm_u32_t i = 0; i < size; i++) {
+    wasm_u64_t count = counts[order[i]];
+    wasm_u64_t hottest = counts[order[0]];
+    int width = (int) ((count * WASMBOX_OPCODE_PROFILE_BAR_WIDTH +
+                        hottest - 1) / hottest);
+    fprintf(stdout, "%-32s %12llu %6.2f%% %.*s\n",
+            debug_opcodes[order[i]] + strlen("OPCODE_"),
+            (unsigned long long) count,
+            wasmbox_opcode_profile_percent(count, total), width,
+            "########################################");
+  }
+  wasmbox_opcode_report_pairs(mod->opcode_profile, top_pairs);
+}
@@ -0,0 +1,81 @@
+/*
+ * Copyright (C) 2021 Masahiro Ide
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef WASMBOX_OPCODE_PROFILE_H
+#define WASMBOX_OPCODE_PROFILE_H
+
+#include "opcodes.h"
+#include "wasmbox/wasmbox.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifdef WASMBOX_VM_USE_OPCODE_PROFILE
+/* One counter per opcode, OPCODE_THREADED_CODE being the last. */
+#  define WASMBOX_OPCODE_PROFILE_SIZE (OPCODE_THREADED_CODE + 1)
+
+/* Runs of an opcode right after another. */
+typedef struct wasmbox_opcode_pair_t {
+  wasm_u16_t previous;
+  wasm_u16_t current;
+  wasm_u64_t count;
+  /* Runs where op1 or op2 of the current instruction is the op0 of the
+   * previous one, i.e. likely reads what it wrote. */
+  wasm_u64_t op1_reads;
+  wasm_u64_t op2_reads;
+} wasmbox_opcode_pair_t;
+
+struct wasmbox_opcode_profile_t {
+  wasm_u64_t counts[WASMBOX_OPCODE_PROFILE_SIZE];
+  /* The last instruction run, or OPCODE_THREADED_CODE at the start of a
+   * run. */
+  wasm_u16_t previous;
+  wasmbox_code_reg_t previous_op0;
+  /* Open addressing hash table of the pairs seen, of pair_size slots. */
+  wasm_u32_t pair_size;
+  wasm_u32_t pair_count;
+  wasmbox_opcode_pair_t *pairs;
+};
+
+wasmbox_opcode_profile_t *wasmbox_opcode_profile_init(wasmbox_module_t *mod);
+
+/* Counts CODE, run after the previous instruction, in the pairs. */
+void wasmbox_opcode_profile_pair(wasmbox_opcode_profile_t *profile,
+                                 wasm_u16_t opcode, const wasmbox_code_t *code);
+
+/* Prints the profile if anything ran, then frees it. */
+void wasmbox_opcode_profile_dispose(wasmbox_module_t *mod);
+
+/* Counts one run of the handler of OPCODE at CODE. */
+#  define WASMBOX_OPCODE_PROFILE(MOD, OPCODE, CODE)                  \
+    do {                                                             \
+      wasmbox_opcode_profile_t *profile = (MOD)->opcode_profile;     \
+      if (profile == NULL) {                                         \
+        profile = wasmbox_opcode_profile_init(MOD);                  \
+      }                                                              \
+      profile->counts[OPCODE]++;                                     \
+      wasmbox_opcode_profile_pair(profile, (OPCODE), (CODE));        \
+    } while (0)
+#else
+#  define WASMBOX_OPCODE_PROFILE(MOD, OPCODE, CODE) ((void) 0)
+#endif /* WASMBOX_VM_USE_OPCODE_PROFILE */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* end of include guard */
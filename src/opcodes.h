@@ -17,6 +17,7 @@
 #ifndef WASMBOX_COMPILER_H
 #define WASMBOX_COMPILER_H
 
+#include "allocator.h"
 #include "input-stream.h"
 #include "wasmbox/wasmbox.h"
 
@@ -24,7 +25,26 @@
 extern "C" {
 #endif
 
-#define WASMBOX_VM_USE_DIRECT_THREADED_CODE 1
+/* Direct threading unless another dispatch is asked for. */
+#if !defined(WASMBOX_VM_USE_TAIL_CALL_DISPATCH) && \
+    !defined(WASMBOX_VM_USE_SWITCH_DISPATCH)
+#  define WASMBOX_VM_USE_DIRECT_THREADED_CODE 1
+#endif
+
+/* Compact code has no room for label pointers. It dispatches via LABELS[]. */
+#if (defined(WASMBOX_VM_USE_DIRECT_THREADED_CODE) || \
+     defined(WASMBOX_VM_USE_TAIL_CALL_DISPATCH)) &&  \
+    !defined(WASMBOX_VM_USE_COMPACT_CODE)
+#  define WASMBOX_VM_USE_CODE_LABEL 1
+#endif
+
+#ifdef WASMBOX_VM_USE_ACCUMULATOR
+/* Bits of wasmbox_code_t::h.acc. An operand is only read from the
+ * accumulator right after the instruction in the same block which wrote it,
+ * so that no branch lands between them. */
+#  define WASMBOX_ACC_OP1 (1)
+#  define WASMBOX_ACC_OP2 (2)
+#endif
 
 typedef enum wasm_block_type_t {
   WASMBOX_BLOCK_TYPE_NONE = 0,
@@ -56,11 +76,74 @@ struct wasmbox_block_t {
   wasm_u32_t end;
   wasm_u16_t parent_id;
   wasm_u16_t next_id;
+  /* Block whose label a branch emitted in this block at depth 0 refers to.
+   * The code following a nested block belongs to the enclosing label. */
+  wasm_u16_t label_id;
+  /* Slots a branch to this block moves its values to: the results of a block
+   * or an if, or the parameters of a loop. */
+  wasm_s16_t value;
+  wasm_u16_t value_size;
+  /* Types of those values, with an entry per slot. */
+  const wasmbox_value_type_t *value_types;
   wasm_u8_t already_terminated;
+#ifdef WASMBOX_VM_USE_LAZY_COMPILE
+  /* Index of the loop whose body this block starts, or -1. */
+  wasm_s16_t loop;
+#endif
+#ifdef WASMBOX_VM_USE_SAMPLING_PROFILE
+  /* Offset in the code section of the wasm instruction each instruction of
+   * `code` was emitted for, with room for `code_capacity` of them. */
+  wasm_u32_t *offsets;
+#endif
 };
 
+/* FUEL instruction which the instructions being decoded are charged to. */
+typedef struct wasmbox_fuel_meter_t {
+  /* Block and index of the instruction, or -1 if it was not emitted. */
+  wasm_s16_t block_id;
+  wasm_u16_t index;
+  wasm_u32_t cost;
+} wasmbox_fuel_meter_t;
+
+/* Targets of a br_table while its function is decoded, by block id. */
+typedef struct wasmbox_table_t {
+  wasm_u32_t size;
+  wasm_u16_t block_ids[];
+} wasmbox_table_t;
+
+/**
+ * Target of a br_table. The targets of an OPCODE_JUMP_TABLE, whose op0 is
+ * their number, fill the slots of code right after it, so that the jump is
+ * a bounds check and a load. The label of the target is resolved in advance.
+ */
+typedef struct wasmbox_jump_target_t {
+#ifdef WASMBOX_VM_USE_COMPACT_CODE
+  /* Byte distance from the OPCODE_JUMP_TABLE. */
+  wasm_s32_t offset;
+#else
+#  ifdef WASMBOX_VM_USE_CODE_LABEL
+  void *label;
+#  endif
+  wasmbox_code_t *code;
+#endif
+} wasmbox_jump_target_t;
+
+/* Slots of code taken by the targets of an OPCODE_JUMP_TABLE. */
+#define WASMBOX_JUMP_TABLE_SLOTS(SIZE)                                  \
+  (((SIZE) * sizeof(wasmbox_jump_target_t) + sizeof(wasmbox_code_t) - 1) / \
+   sizeof(wasmbox_code_t))
+#define WASMBOX_JUMP_TABLE_TARGETS(CODE) ((wasmbox_jump_target_t *) ((CODE) + 1))
+#ifdef WASMBOX_VM_USE_COMPACT_CODE
+#  define WASMBOX_JUMP_TARGET_CODE(CODE, TARGET) \
+    ((wasmbox_code_t *) ((char *) (CODE) + (TARGET)->offset))
+#else
+#  define WASMBOX_JUMP_TARGET_CODE(CODE, TARGET) ((TARGET)->code)
+#endif
+
 typedef struct wasmbox_mutable_function_t {
   wasmbox_function_t base;
+  /* Holds the blocks, their code and the operand stack while compiling. */
+  wasmbox_arena_t *arena;
   wasm_s16_t current_block_id;
   wasmbox_block_t *blocks;
   wasm_u16_t block_size;
@@ -69,9 +152,93 @@ typedef struct wasmbox_mutable_function_t {
   wasm_s16_t stack_size;
   wasm_u16_t stack_capacity;
   wasm_s16_t *operand_stack;
+  /* The wasmbox_value_type_t of each entry of operand_stack. Both entries of
+   * a v128 are WASM_TYPE_V128. */
+  wasm_u8_t *operand_types;
+  /* Entries of operand_stack below the innermost block, which it may not
+   * pop while its code is reachable. */
+  wasm_s16_t stack_floor;
+  /* Number of the blocks enclosing the instruction being decoded, which a
+   * branch may target besides the function body. */
+  wasm_u16_t label_depth;
+  /* Set once the body is found invalid while it is decoded. */
+  wasm_u8_t invalid;
+  /* Slot of each local from the first argument, followed by the end of the
+   * locals. NULL unless a parameter or a local is a v128. */
+  wasm_u16_t *local_slots;
+  /* The wasmbox_value_type_t of each parameter and local. */
+  wasm_u8_t *local_types;
+  /* Number of the parameters and locals, which local indices are below. */
+  wasm_u32_t local_size;
+  /* Targets of the br_tables, referred to by the op0 of OPCODE_JUMP_TABLE
+   * until the function is frozen. */
   wasmbox_table_t **tables;
   wasm_s16_t table_size;
   wasm_u16_t table_capacity;
+  /* Set while a function of a metered module is compiled. */
+  wasmbox_fuel_meter_t *fuel_meter;
+  /* Set if the function is imported from a linked module. */
+  wasmbox_module_link_t *link;
+  /* Slot to which calls into linked modules save the running module, or -1
+   * if the module links no module. */
+  wasm_s16_t module_slot;
+  /* Set if the code is shared with other functions by wasmbox_code_share. */
+  wasm_u8_t deduplicated;
+  /* Set if other threads may grow the memory, whose size is then not
+   * invariant in a loop. */
+  wasm_u8_t shared_memory;
+#ifdef WASMBOX_VM_USE_COMPACT_CODE
+  wasmbox_code_constant_t *constants;
+  wasm_u16_t constant_size;
+  wasm_u16_t constant_capacity;
+  /* Constants which follow the frozen code. */
+  wasm_u16_t frozen_constant_size;
+  /* Index of the function in its module, by which compact code calls it. */
+  wasm_u32_t index;
+#endif
+#ifdef WASMBOX_VM_USE_LAZY_COMPILE
+  /* Byte range of the body in the module source, compiled on first call. */
+  wasm_u32_t body_offset;
+  wasm_u32_t body_size;
+  /* Set while the body is only decoded to validate it when the module is
+   * loaded. No code is kept. */
+  wasm_u8_t validating;
+  /* OPCODE_LAZY_COMPILE stub. Inline caches may still refer to it after the
+   * function is compiled, so it is kept until the module is disposed. */
+  wasmbox_code_t *stub;
+  /* The function whose body is compiled into this copy of it. */
+  struct wasmbox_mutable_function_t *origin;
+  /* Indirect call sites of `origin` speculated to call their last callee,
+   * while it is recompiled. */
+  wasmbox_call_cache_t **speculations;
+  wasm_u32_t speculation_size;
+  /* Set once the function is recompiled. Its previous code is kept until the
+   * module is disposed, as frames may still run it. */
+  wasm_u8_t speculated;
+  wasmbox_code_t *generic_code;
+  /* Set while the function is compiled for the first tier, cheaply and with
+   * OPCODE_HOTNESS counting its calls and loop iterations down from
+   * `hotness`. Its code of the first tier is kept like `generic_code` once it
+   * is recompiled. */
+  wasm_u8_t baseline;
+  wasm_s32_t hotness;
+  wasmbox_code_t *baseline_code;
+  /* Number of loops of the body. */
+  wasm_u16_t loop_size;
+  /* Offsets in the code where a frame of the first tier continues when it
+   * is recompiled: the start of the body, then the body of each loop, or
+   * UINT32_MAX if it cannot. Only filled while tiering up. */
+  wasm_u32_t *osr_entries;
+#endif
+#ifdef WASMBOX_VM_USE_SAMPLING_PROFILE
+  /* Offset in the code section of the wasm instruction being decoded, which
+   * the instructions emitted for it are attributed to. */
+  wasm_u32_t source_offset;
+  /* Offset in the code section of the instruction each slot of `base.code`
+   * was emitted for, or 0 if none, e.g. for the slots of jump tables. Kept
+   * aside, as it is only read once a sampling profile is written. */
+  wasm_u32_t *code_offsets;
+#endif
 } wasmbox_mutable_function_t;
 
 typedef int (*wasmbox_op_decode_func_t)(wasmbox_input_stream_t *ins,
@@ -290,6 +457,464 @@ typedef struct wasmbox_op_decorder_t {
   OP_INST_1(0xFC, 0x06, i64, trunc_sat_f64_s, OPCODE_I64_TRUNC_SAT_F64_S) \
   OP_INST_1(0xFC, 0x07, i64, trunc_sat_f64_u, OPCODE_I64_TRUNC_SAT_F64_U)
 
+#define BULK_MEMORY_INST_EACH(OP_INST_1)                      \
+  OP_INST_1(0xFC, 0x08, any, memory_init, OPCODE_MEMORY_INIT) \
+  OP_INST_1(0xFC, 0x09, any, data_drop, OPCODE_DATA_DROP)     \
+  OP_INST_1(0xFC, 0x0A, any, memory_copy, OPCODE_MEMORY_COPY) \
+  OP_INST_1(0xFC, 0x0B, any, memory_fill, OPCODE_MEMORY_FILL)
+
+/* Reference and table instructions, with a second opcode byte of 0x00 if
+ * they have no prefix. A funcref is the wasmbox_function_t*, or 0. */
+#define TABLE_INST_EACH(OP_INST_1)                          \
+  OP_INST_1(0xD2, 0x00, any, ref_func, OPCODE_REF_FUNC)     \
+  OP_INST_1(0x25, 0x00, any, table_get, OPCODE_TABLE_GET)   \
+  OP_INST_1(0x26, 0x00, any, table_set, OPCODE_TABLE_SET)   \
+  OP_INST_1(0xFC, 0x0F, any, table_grow, OPCODE_TABLE_GROW) \
+  OP_INST_1(0xFC, 0x10, any, table_size, OPCODE_TABLE_SIZE)
+
+// 0xFE prefixed instructions taking a memarg, by their second opcode byte:
+// (opcode, value type, type in memory, operands, vmopcode)
+#define ATOMIC_INST_EACH(OP_INST_1)                                            \
+  OP_INST_1(0x00, u32, wasm_u32_t, notify, OPCODE_MEMORY_ATOMIC_NOTIFY)        \
+  OP_INST_1(0x01, u32, wasm_u32_t, wait, OPCODE_MEMORY_ATOMIC_WAIT32)          \
+  OP_INST_1(0x02, u64, wasm_u64_t, wait, OPCODE_MEMORY_ATOMIC_WAIT64)          \
+  OP_INST_1(0x10, u32, wasm_u32_t, load, OPCODE_I32_ATOMIC_LOAD)               \
+  OP_INST_1(0x11, u64, wasm_u64_t, load, OPCODE_I64_ATOMIC_LOAD)               \
+  OP_INST_1(0x12, u32, wasm_u8_t, load, OPCODE_I32_ATOMIC_LOAD8_U)             \
+  OP_INST_1(0x13, u32, wasm_u16_t, load, OPCODE_I32_ATOMIC_LOAD16_U)           \
+  OP_INST_1(0x14, u64, wasm_u8_t, load, OPCODE_I64_ATOMIC_LOAD8_U)             \
+  OP_INST_1(0x15, u64, wasm_u16_t, load, OPCODE_I64_ATOMIC_LOAD16_U)           \
+  OP_INST_1(0x16, u64, wasm_u32_t, load, OPCODE_I64_ATOMIC_LOAD32_U)           \
+  OP_INST_1(0x17, u32, wasm_u32_t, store, OPCODE_I32_ATOMIC_STORE)             \
+  OP_INST_1(0x18, u64, wasm_u64_t, store, OPCODE_I64_ATOMIC_STORE)             \
+  OP_INST_1(0x19, u32, wasm_u8_t, store, OPCODE_I32_ATOMIC_STORE8)             \
+  OP_INST_1(0x1A, u32, wasm_u16_t, store, OPCODE_I32_ATOMIC_STORE16)           \
+  OP_INST_1(0x1B, u64, wasm_u8_t, store, OPCODE_I64_ATOMIC_STORE8)             \
+  OP_INST_1(0x1C, u64, wasm_u16_t, store, OPCODE_I64_ATOMIC_STORE16)           \
+  OP_INST_1(0x1D, u64, wasm_u32_t, store, OPCODE_I64_ATOMIC_STORE32)           \
+  OP_INST_1(0x1E, u32, wasm_u32_t, rmw, OPCODE_I32_ATOMIC_RMW_ADD)             \
+  OP_INST_1(0x1F, u64, wasm_u64_t, rmw, OPCODE_I64_ATOMIC_RMW_ADD)             \
+  OP_INST_1(0x20, u32, wasm_u8_t, rmw, OPCODE_I32_ATOMIC_RMW8_ADD_U)           \
+  OP_INST_1(0x21, u32, wasm_u16_t, rmw, OPCODE_I32_ATOMIC_RMW16_ADD_U)         \
+  OP_INST_1(0x22, u64, wasm_u8_t, rmw, OPCODE_I64_ATOMIC_RMW8_ADD_U)           \
+  OP_INST_1(0x23, u64, wasm_u16_t, rmw, OPCODE_I64_ATOMIC_RMW16_ADD_U)         \
+  OP_INST_1(0x24, u64, wasm_u32_t, rmw, OPCODE_I64_ATOMIC_RMW32_ADD_U)         \
+  OP_INST_1(0x25, u32, wasm_u32_t, rmw, OPCODE_I32_ATOMIC_RMW_SUB)             \
+  OP_INST_1(0x26, u64, wasm_u64_t, rmw, OPCODE_I64_ATOMIC_RMW_SUB)             \
+  OP_INST_1(0x27, u32, wasm_u8_t, rmw, OPCODE_I32_ATOMIC_RMW8_SUB_U)           \
+  OP_INST_1(0x28, u32, wasm_u16_t, rmw, OPCODE_I32_ATOMIC_RMW16_SUB_U)         \
+  OP_INST_1(0x29, u64, wasm_u8_t, rmw, OPCODE_I64_ATOMIC_RMW8_SUB_U)           \
+  OP_INST_1(0x2A, u64, wasm_u16_t, rmw, OPCODE_I64_ATOMIC_RMW16_SUB_U)         \
+  OP_INST_1(0x2B, u64, wasm_u32_t, rmw, OPCODE_I64_ATOMIC_RMW32_SUB_U)         \
+  OP_INST_1(0x2C, u32, wasm_u32_t, rmw, OPCODE_I32_ATOMIC_RMW_AND)             \
+  OP_INST_1(0x2D, u64, wasm_u64_t, rmw, OPCODE_I64_ATOMIC_RMW_AND)             \
+  OP_INST_1(0x2E, u32, wasm_u8_t, rmw, OPCODE_I32_ATOMIC_RMW8_AND_U)           \
+  OP_INST_1(0x2F, u32, wasm_u16_t, rmw, OPCODE_I32_ATOMIC_RMW16_AND_U)         \
+  OP_INST_1(0x30, u64, wasm_u8_t, rmw, OPCODE_I64_ATOMIC_RMW8_AND_U)           \
+  OP_INST_1(0x31, u64, wasm_u16_t, rmw, OPCODE_I64_ATOMIC_RMW16_AND_U)         \
+  OP_INST_1(0x32, u64, wasm_u32_t, rmw, OPCODE_I64_ATOMIC_RMW32_AND_U)         \
+  OP_INST_1(0x33, u32, wasm_u32_t, rmw, OPCODE_I32_ATOMIC_RMW_OR)              \
+  OP_INST_1(0x34, u64, wasm_u64_t, rmw, OPCODE_I64_ATOMIC_RMW_OR)              \
+  OP_INST_1(0x35, u32, wasm_u8_t, rmw, OPCODE_I32_ATOMIC_RMW8_OR_U)            \
+  OP_INST_1(0x36, u32, wasm_u16_t, rmw, OPCODE_I32_ATOMIC_RMW16_OR_U)          \
+  OP_INST_1(0x37, u64, wasm_u8_t, rmw, OPCODE_I64_ATOMIC_RMW8_OR_U)            \
+  OP_INST_1(0x38, u64, wasm_u16_t, rmw, OPCODE_I64_ATOMIC_RMW16_OR_U)          \
+  OP_INST_1(0x39, u64, wasm_u32_t, rmw, OPCODE_I64_ATOMIC_RMW32_OR_U)          \
+  OP_INST_1(0x3A, u32, wasm_u32_t, rmw, OPCODE_I32_ATOMIC_RMW_XOR)             \
+  OP_INST_1(0x3B, u64, wasm_u64_t, rmw, OPCODE_I64_ATOMIC_RMW_XOR)             \
+  OP_INST_1(0x3C, u32, wasm_u8_t, rmw, OPCODE_I32_ATOMIC_RMW8_XOR_U)           \
+  OP_INST_1(0x3D, u32, wasm_u16_t, rmw, OPCODE_I32_ATOMIC_RMW16_XOR_U)         \
+  OP_INST_1(0x3E, u64, wasm_u8_t, rmw, OPCODE_I64_ATOMIC_RMW8_XOR_U)           \
+  OP_INST_1(0x3F, u64, wasm_u16_t, rmw, OPCODE_I64_ATOMIC_RMW16_XOR_U)         \
+  OP_INST_1(0x40, u64, wasm_u32_t, rmw, OPCODE_I64_ATOMIC_RMW32_XOR_U)         \
+  OP_INST_1(0x41, u32, wasm_u32_t, rmw, OPCODE_I32_ATOMIC_RMW_XCHG)            \
+  OP_INST_1(0x42, u64, wasm_u64_t, rmw, OPCODE_I64_ATOMIC_RMW_XCHG)            \
+  OP_INST_1(0x43, u32, wasm_u8_t, rmw, OPCODE_I32_ATOMIC_RMW8_XCHG_U)          \
+  OP_INST_1(0x44, u32, wasm_u16_t, rmw, OPCODE_I32_ATOMIC_RMW16_XCHG_U)        \
+  OP_INST_1(0x45, u64, wasm_u8_t, rmw, OPCODE_I64_ATOMIC_RMW8_XCHG_U)          \
+  OP_INST_1(0x46, u64, wasm_u16_t, rmw, OPCODE_I64_ATOMIC_RMW16_XCHG_U)        \
+  OP_INST_1(0x47, u64, wasm_u32_t, rmw, OPCODE_I64_ATOMIC_RMW32_XCHG_U)        \
+  OP_INST_1(0x48, u32, wasm_u32_t, cmpxchg, OPCODE_I32_ATOMIC_RMW_CMPXCHG)     \
+  OP_INST_1(0x49, u64, wasm_u64_t, cmpxchg, OPCODE_I64_ATOMIC_RMW_CMPXCHG)     \
+  OP_INST_1(0x4A, u32, wasm_u8_t, cmpxchg, OPCODE_I32_ATOMIC_RMW8_CMPXCHG_U)   \
+  OP_INST_1(0x4B, u32, wasm_u16_t, cmpxchg, OPCODE_I32_ATOMIC_RMW16_CMPXCHG_U) \
+  OP_INST_1(0x4C, u64, wasm_u8_t, cmpxchg, OPCODE_I64_ATOMIC_RMW8_CMPXCHG_U)   \
+  OP_INST_1(0x4D, u64, wasm_u16_t, cmpxchg, OPCODE_I64_ATOMIC_RMW16_CMPXCHG_U) \
+  OP_INST_1(0x4E, u64, wasm_u32_t, cmpxchg, OPCODE_I64_ATOMIC_RMW32_CMPXCHG_U)
+
+/* 0xFD prefixed instructions, by their LEB128 encoded second opcode:
+ * (opcode, operands, rtype, atype, op, name). A v128 operand takes two
+ * consecutive slots. Each shape of operands reads its columns as below, where
+ * r, a, b and c are wasmbox_v128_t and `lane` is an immediate:
+ *   load       r = op(memory + address), reading rtype bytes
+ *   store      memory + address = a
+ *   shuffle    r = op(a, b, c), c holds the lane indices
+ *   splat      r.rtype[i] = scalar.atype
+ *   extract    scalar.rtype = a.atype[lane]
+ *   replace    r = a, r.atype[lane] = scalar.rtype
+ *   unary      r.rtype = op a.atype
+ *   unary_fn   r.rtype = op(a.atype)
+ *   binary     r.rtype = a.atype op b.atype
+ *   binary_fn  r.rtype = op(a.atype, b.atype)
+ *   ternary    r.rtype = op(a.atype, b.atype, c.atype)
+ *   shift      r.rtype = a.atype op (scalar.u32 % lane bits)
+ *   test       scalar.u32 = op(a.atype)
+ * v128.const is loaded by two LOAD_CONST_I64. */
+#define SIMD_INST_EACH(OP)                                                                        \
+  OP(0x00, load, 16, any, wasmbox_simd_load, V128_LOAD)                                           \
+  OP(0x01, load, 8, any, wasmbox_simd_load8x8_s, V128_LOAD8X8_S)                                  \
+  OP(0x02, load, 8, any, wasmbox_simd_load8x8_u, V128_LOAD8X8_U)                                  \
+  OP(0x03, load, 8, any, wasmbox_simd_load16x4_s, V128_LOAD16X4_S)                                \
+  OP(0x04, load, 8, any, wasmbox_simd_load16x4_u, V128_LOAD16X4_U)                                \
+  OP(0x05, load, 8, any, wasmbox_simd_load32x2_s, V128_LOAD32X2_S)                                \
+  OP(0x06, load, 8, any, wasmbox_simd_load32x2_u, V128_LOAD32X2_U)                                \
+  OP(0x07, load, 1, any, wasmbox_simd_load8_splat, V128_LOAD8_SPLAT)                              \
+  OP(0x08, load, 2, any, wasmbox_simd_load16_splat, V128_LOAD16_SPLAT)                            \
+  OP(0x09, load, 4, any, wasmbox_simd_load32_splat, V128_LOAD32_SPLAT)                            \
+  OP(0x0A, load, 8, any, wasmbox_simd_load64_splat, V128_LOAD64_SPLAT)                            \
+  OP(0x0B, store, 16, any, any, V128_STORE)                                                       \
+  OP(0x0D, shuffle, u8x16, u8x16, wasmbox_simd_shuffle, I8X16_SHUFFLE)                            \
+  OP(0x0E, binary_fn, u8x16, u8x16, wasmbox_simd_swizzle, I8X16_SWIZZLE)                          \
+  OP(0x0F, splat, u8x16, u32, any, I8X16_SPLAT)                                                   \
+  OP(0x10, splat, u16x8, u32, any, I16X8_SPLAT)                                                   \
+  OP(0x11, splat, u32x4, u32, any, I32X4_SPLAT)                                                   \
+  OP(0x12, splat, u64x2, u64, any, I64X2_SPLAT)                                                   \
+  OP(0x13, splat, f32x4, f32, any, F32X4_SPLAT)                                                   \
+  OP(0x14, splat, f64x2, f64, any, F64X2_SPLAT)                                                   \
+  OP(0x15, extract, s32, i8x16, any, I8X16_EXTRACT_LANE_S)                                        \
+  OP(0x16, extract, u32, u8x16, any, I8X16_EXTRACT_LANE_U)                                        \
+  OP(0x17, replace, u32, u8x16, any, I8X16_REPLACE_LANE)                                          \
+  OP(0x18, extract, s32, i16x8, any, I16X8_EXTRACT_LANE_S)                                        \
+  OP(0x19, extract, u32, u16x8, any, I16X8_EXTRACT_LANE_U)                                        \
+  OP(0x1A, replace, u32, u16x8, any, I16X8_REPLACE_LANE)                                          \
+  OP(0x1B, extract, u32, u32x4, any, I32X4_EXTRACT_LANE)                                          \
+  OP(0x1C, replace, u32, u32x4, any, I32X4_REPLACE_LANE)                                          \
+  OP(0x1D, extract, u64, u64x2, any, I64X2_EXTRACT_LANE)                                          \
+  OP(0x1E, replace, u64, u64x2, any, I64X2_REPLACE_LANE)                                          \
+  OP(0x1F, extract, f32, f32x4, any, F32X4_EXTRACT_LANE)                                          \
+  OP(0x20, replace, f32, f32x4, any, F32X4_REPLACE_LANE)                                          \
+  OP(0x21, extract, f64, f64x2, any, F64X2_EXTRACT_LANE)                                          \
+  OP(0x22, replace, f64, f64x2, any, F64X2_REPLACE_LANE)                                          \
+  OP(0x23, binary, i8x16, i8x16, ==, I8X16_EQ)                                                    \
+  OP(0x24, binary, i8x16, i8x16, !=, I8X16_NE)                                                    \
+  OP(0x25, binary, i8x16, i8x16, <, I8X16_LT_S)                                                   \
+  OP(0x26, binary, i8x16, u8x16, <, I8X16_LT_U)                                                   \
+  OP(0x27, binary, i8x16, i8x16, >, I8X16_GT_S)                                                   \
+  OP(0x28, binary, i8x16, u8x16, >, I8X16_GT_U)                                                   \
+  OP(0x29, binary, i8x16, i8x16, <=, I8X16_LE_S)                                                  \
+  OP(0x2A, binary, i8x16, u8x16, <=, I8X16_LE_U)                                                  \
+  OP(0x2B, binary, i8x16, i8x16, >=, I8X16_GE_S)                                                  \
+  OP(0x2C, binary, i8x16, u8x16, >=, I8X16_GE_U)                                                  \
+  OP(0x2D, binary, i16x8, i16x8, ==, I16X8_EQ)                                                    \
+  OP(0x2E, binary, i16x8, i16x8, !=, I16X8_NE)                                                    \
+  OP(0x2F, binary, i16x8, i16x8, <, I16X8_LT_S)                                                   \
+  OP(0x30, binary, i16x8, u16x8, <, I16X8_LT_U)                                                   \
+  OP(0x31, binary, i16x8, i16x8, >, I16X8_GT_S)                                                   \
+  OP(0x32, binary, i16x8, u16x8, >, I16X8_GT_U)                                                   \
+  OP(0x33, binary, i16x8, i16x8, <=, I16X8_LE_S)                                                  \
+  OP(0x34, binary, i16x8, u16x8, <=, I16X8_LE_U)                                                  \
+  OP(0x35, binary, i16x8, i16x8, >=, I16X8_GE_S)                                                  \
+  OP(0x36, binary, i16x8, u16x8, >=, I16X8_GE_U)                                                  \
+  OP(0x37, binary, i32x4, i32x4, ==, I32X4_EQ)                                                    \
+  OP(0x38, binary, i32x4, i32x4, !=, I32X4_NE)                                                    \
+  OP(0x39, binary, i32x4, i32x4, <, I32X4_LT_S)                                                   \
+  OP(0x3A, binary, i32x4, u32x4, <, I32X4_LT_U)                                                   \
+  OP(0x3B, binary, i32x4, i32x4, >, I32X4_GT_S)                                                   \
+  OP(0x3C, binary, i32x4, u32x4, >, I32X4_GT_U)                                                   \
+  OP(0x3D, binary, i32x4, i32x4, <=, I32X4_LE_S)                                                  \
+  OP(0x3E, binary, i32x4, u32x4, <=, I32X4_LE_U)                                                  \
+  OP(0x3F, binary, i32x4, i32x4, >=, I32X4_GE_S)                                                  \
+  OP(0x40, binary, i32x4, u32x4, >=, I32X4_GE_U)                                                  \
+  OP(0x41, binary, i32x4, f32x4, ==, F32X4_EQ)                                                    \
+  OP(0x42, binary, i32x4, f32x4, !=, F32X4_NE)                                                    \
+  OP(0x43, binary, i32x4, f32x4, <, F32X4_LT)                                                     \
+  OP(0x44, binary, i32x4, f32x4, >, F32X4_GT)                                                     \
+  OP(0x45, binary, i32x4, f32x4, <=, F32X4_LE)                                                    \
+  OP(0x46, binary, i32x4, f32x4, >=, F32X4_GE)                                                    \
+  OP(0x47, binary, i64x2, f64x2, ==, F64X2_EQ)                                                    \
+  OP(0x48, binary, i64x2, f64x2, !=, F64X2_NE)                                                    \
+  OP(0x49, binary, i64x2, f64x2, <, F64X2_LT)                                                     \
+  OP(0x4A, binary, i64x2, f64x2, >, F64X2_GT)                                                     \
+  OP(0x4B, binary, i64x2, f64x2, <=, F64X2_LE)                                                    \
+  OP(0x4C, binary, i64x2, f64x2, >=, F64X2_GE)                                                    \
+  OP(0x4D, unary, u64x2, u64x2, ~, V128_NOT)                                                      \
+  OP(0x4E, binary, u64x2, u64x2, &, V128_AND)                                                     \
+  OP(0x4F, binary_fn, u64x2, u64x2, wasmbox_simd_andnot, V128_ANDNOT)                             \
+  OP(0x50, binary, u64x2, u64x2, |, V128_OR)                                                      \
+  OP(0x51, binary, u64x2, u64x2, ^, V128_XOR)                                                     \
+  OP(0x52, ternary, u64x2, u64x2, wasmbox_simd_bitselect, V128_BITSELECT)                         \
+  OP(0x53, test, any, u64x2, wasmbox_simd_any_true, V128_ANY_TRUE)                                \
+  OP(0x5C, load, 4, any, wasmbox_simd_load32_zero, V128_LOAD32_ZERO)                              \
+  OP(0x5D, load, 8, any, wasmbox_simd_load64_zero, V128_LOAD64_ZERO)                              \
+  OP(0x5E, unary_fn, f32x4, f64x2, wasmbox_simd_demote, F32X4_DEMOTE_F64X2_ZERO)                  \
+  OP(0x5F, unary_fn, f64x2, f32x4, wasmbox_simd_promote_low, F64X2_PROMOTE_LOW_F32X4)             \
+  OP(0x60, unary_fn, u8x16, i8x16, wasmbox_simd_abs_s8, I8X16_ABS)                                \
+  OP(0x61, unary, u8x16, u8x16, -, I8X16_NEG)                                                     \
+  OP(0x62, unary_fn, u8x16, u8x16, wasmbox_simd_popcnt, I8X16_POPCNT)                             \
+  OP(0x63, test, any, u8x16, wasmbox_simd_all_true_8, I8X16_ALL_TRUE)                             \
+  OP(0x64, test, any, i8x16, wasmbox_simd_bitmask_8, I8X16_BITMASK)                               \
+  OP(0x65, binary_fn, i8x16, i16x8, wasmbox_simd_narrow_s8, I8X16_NARROW_I16X8_S)                 \
+  OP(0x66, binary_fn, u8x16, i16x8, wasmbox_simd_narrow_u8, I8X16_NARROW_I16X8_U)                 \
+  OP(0x67, unary_fn, f32x4, f32x4, wasmbox_simd_ceil_f32, F32X4_CEIL)                             \
+  OP(0x68, unary_fn, f32x4, f32x4, wasmbox_simd_floor_f32, F32X4_FLOOR)                           \
+  OP(0x69, unary_fn, f32x4, f32x4, wasmbox_simd_trunc_f32, F32X4_TRUNC)                           \
+  OP(0x6A, unary_fn, f32x4, f32x4, wasmbox_simd_nearest_f32, F32X4_NEAREST)                       \
+  OP(0x6B, shift, u8x16, u8x16, <<, I8X16_SHL)                                                    \
+  OP(0x6C, shift, i8x16, i8x16, >>, I8X16_SHR_S)                                                  \
+  OP(0x6D, shift, u8x16, u8x16, >>, I8X16_SHR_U)                                                  \
+  OP(0x6E, binary, u8x16, u8x16, +, I8X16_ADD)                                                    \
+  OP(0x6F, binary_fn, i8x16, i8x16, wasmbox_simd_add_sat_s8, I8X16_ADD_SAT_S)                     \
+  OP(0x70, binary_fn, u8x16, u8x16, wasmbox_simd_add_sat_u8, I8X16_ADD_SAT_U)                     \
+  OP(0x71, binary, u8x16, u8x16, -, I8X16_SUB)                                                    \
+  OP(0x72, binary_fn, i8x16, i8x16, wasmbox_simd_sub_sat_s8, I8X16_SUB_SAT_S)                     \
+  OP(0x73, binary_fn, u8x16, u8x16, wasmbox_simd_sub_sat_u8, I8X16_SUB_SAT_U)                     \
+  OP(0x74, unary_fn, f64x2, f64x2, wasmbox_simd_ceil_f64, F64X2_CEIL)                             \
+  OP(0x75, unary_fn, f64x2, f64x2, wasmbox_simd_floor_f64, F64X2_FLOOR)                           \
+  OP(0x76, binary_fn, i8x16, i8x16, wasmbox_simd_min_s8, I8X16_MIN_S)                             \
+  OP(0x77, binary_fn, u8x16, u8x16, wasmbox_simd_min_u8, I8X16_MIN_U)                             \
+  OP(0x78, binary_fn, i8x16, i8x16, wasmbox_simd_max_s8, I8X16_MAX_S)                             \
+  OP(0x79, binary_fn, u8x16, u8x16, wasmbox_simd_max_u8, I8X16_MAX_U)                             \
+  OP(0x7A, unary_fn, f64x2, f64x2, wasmbox_simd_trunc_f64, F64X2_TRUNC)                           \
+  OP(0x7B, binary_fn, u8x16, u8x16, wasmbox_simd_avgr_u8, I8X16_AVGR_U)                           \
+  OP(0x7C, unary_fn, i16x8, i8x16, wasmbox_simd_extadd_s8, I16X8_EXTADD_PAIRWISE_I8X16_S)         \
+  OP(0x7D, unary_fn, u16x8, u8x16, wasmbox_simd_extadd_u8, I16X8_EXTADD_PAIRWISE_I8X16_U)         \
+  OP(0x7E, unary_fn, i32x4, i16x8, wasmbox_simd_extadd_s16, I32X4_EXTADD_PAIRWISE_I16X8_S)        \
+  OP(0x7F, unary_fn, u32x4, u16x8, wasmbox_simd_extadd_u16, I32X4_EXTADD_PAIRWISE_I16X8_U)        \
+  OP(0x80, unary_fn, u16x8, i16x8, wasmbox_simd_abs_s16, I16X8_ABS)                               \
+  OP(0x81, unary, u16x8, u16x8, -, I16X8_NEG)                                                     \
+  OP(0x82, binary_fn, i16x8, i16x8, wasmbox_simd_q15mulr, I16X8_Q15MULR_SAT_S)                    \
+  OP(0x83, test, any, u16x8, wasmbox_simd_all_true_16, I16X8_ALL_TRUE)                            \
+  OP(0x84, test, any, i16x8, wasmbox_simd_bitmask_16, I16X8_BITMASK)                              \
+  OP(0x85, binary_fn, i16x8, i32x4, wasmbox_simd_narrow_s16, I16X8_NARROW_I32X4_S)                \
+  OP(0x86, binary_fn, u16x8, i32x4, wasmbox_simd_narrow_u16, I16X8_NARROW_I32X4_U)                \
+  OP(0x87, unary_fn, i16x8, i8x16, wasmbox_simd_extend_low_s8, I16X8_EXTEND_LOW_I8X16_S)          \
+  OP(0x88, unary_fn, i16x8, i8x16, wasmbox_simd_extend_high_s8, I16X8_EXTEND_HIGH_I8X16_S)        \
+  OP(0x89, unary_fn, u16x8, u8x16, wasmbox_simd_extend_low_u8, I16X8_EXTEND_LOW_I8X16_U)          \
+  OP(0x8A, unary_fn, u16x8, u8x16, wasmbox_simd_extend_high_u8, I16X8_EXTEND_HIGH_I8X16_U)        \
+  OP(0x8B, shift, u16x8, u16x8, <<, I16X8_SHL)                                                    \
+  OP(0x8C, shift, i16x8, i16x8, >>, I16X8_SHR_S)                                                  \
+  OP(0x8D, shift, u16x8, u16x8, >>, I16X8_SHR_U)                                                  \
+  OP(0x8E, binary, u16x8, u16x8, +, I16X8_ADD)                                                    \
+  OP(0x8F, binary_fn, i16x8, i16x8, wasmbox_simd_add_sat_s16, I16X8_ADD_SAT_S)                    \
+  OP(0x90, binary_fn, u16x8, u16x8, wasmbox_simd_add_sat_u16, I16X8_ADD_SAT_U)                    \
+  OP(0x91, binary, u16x8, u16x8, -, I16X8_SUB)                                                    \
+  OP(0x92, binary_fn, i16x8, i16x8, wasmbox_simd_sub_sat_s16, I16X8_SUB_SAT_S)                    \
+  OP(0x93, binary_fn, u16x8, u16x8, wasmbox_simd_sub_sat_u16, I16X8_SUB_SAT_U)                    \
+  OP(0x94, unary_fn, f64x2, f64x2, wasmbox_simd_nearest_f64, F64X2_NEAREST)                       \
+  OP(0x95, binary, u16x8, u16x8, *, I16X8_MUL)                                                    \
+  OP(0x96, binary_fn, i16x8, i16x8, wasmbox_simd_min_s16, I16X8_MIN_S)                            \
+  OP(0x97, binary_fn, u16x8, u16x8, wasmbox_simd_min_u16, I16X8_MIN_U)                            \
+  OP(0x98, binary_fn, i16x8, i16x8, wasmbox_simd_max_s16, I16X8_MAX_S)                            \
+  OP(0x99, binary_fn, u16x8, u16x8, wasmbox_simd_max_u16, I16X8_MAX_U)                            \
+  OP(0x9B, binary_fn, u16x8, u16x8, wasmbox_simd_avgr_u16, I16X8_AVGR_U)                          \
+  OP(0x9C, binary_fn, i16x8, i8x16, wasmbox_simd_extmul_low_s8, I16X8_EXTMUL_LOW_I8X16_S)         \
+  OP(0x9D, binary_fn, i16x8, i8x16, wasmbox_simd_extmul_high_s8, I16X8_EXTMUL_HIGH_I8X16_S)       \
+  OP(0x9E, binary_fn, u16x8, u8x16, wasmbox_simd_extmul_low_u8, I16X8_EXTMUL_LOW_I8X16_U)         \
+  OP(0x9F, binary_fn, u16x8, u8x16, wasmbox_simd_extmul_high_u8, I16X8_EXTMUL_HIGH_I8X16_U)       \
+  OP(0xA0, unary_fn, u32x4, i32x4, wasmbox_simd_abs_s32, I32X4_ABS)                               \
+  OP(0xA1, unary, u32x4, u32x4, -, I32X4_NEG)                                                     \
+  OP(0xA3, test, any, u32x4, wasmbox_simd_all_true_32, I32X4_ALL_TRUE)                            \
+  OP(0xA4, test, any, i32x4, wasmbox_simd_bitmask_32, I32X4_BITMASK)                              \
+  OP(0xA7, unary_fn, i32x4, i16x8, wasmbox_simd_extend_low_s16, I32X4_EXTEND_LOW_I16X8_S)         \
+  OP(0xA8, unary_fn, i32x4, i16x8, wasmbox_simd_extend_high_s16, I32X4_EXTEND_HIGH_I16X8_S)       \
+  OP(0xA9, unary_fn, u32x4, u16x8, wasmbox_simd_extend_low_u16, I32X4_EXTEND_LOW_I16X8_U)         \
+  OP(0xAA, unary_fn, u32x4, u16x8, wasmbox_simd_extend_high_u16, I32X4_EXTEND_HIGH_I16X8_U)       \
+  OP(0xAB, shift, u32x4, u32x4, <<, I32X4_SHL)                                                    \
+  OP(0xAC, shift, i32x4, i32x4, >>, I32X4_SHR_S)                                                  \
+  OP(0xAD, shift, u32x4, u32x4, >>, I32X4_SHR_U)                                                  \
+  OP(0xAE, binary, u32x4, u32x4, +, I32X4_ADD)                                                    \
+  OP(0xB1, binary, u32x4, u32x4, -, I32X4_SUB)                                                    \
+  OP(0xB5, binary, u32x4, u32x4, *, I32X4_MUL)                                                    \
+  OP(0xB6, binary_fn, i32x4, i32x4, wasmbox_simd_min_s32, I32X4_MIN_S)                            \
+  OP(0xB7, binary_fn, u32x4, u32x4, wasmbox_simd_min_u32, I32X4_MIN_U)                            \
+  OP(0xB8, binary_fn, i32x4, i32x4, wasmbox_simd_max_s32, I32X4_MAX_S)                            \
+  OP(0xB9, binary_fn, u32x4, u32x4, wasmbox_simd_max_u32, I32X4_MAX_U)                            \
+  OP(0xBA, binary_fn, i32x4, i16x8, wasmbox_simd_dot_s16, I32X4_DOT_I16X8_S)                      \
+  OP(0xBC, binary_fn, i32x4, i16x8, wasmbox_simd_extmul_low_s16, I32X4_EXTMUL_LOW_I16X8_S)        \
+  OP(0xBD, binary_fn, i32x4, i16x8, wasmbox_simd_extmul_high_s16, I32X4_EXTMUL_HIGH_I16X8_S)      \
+  OP(0xBE, binary_fn, u32x4, u16x8, wasmbox_simd_extmul_low_u16, I32X4_EXTMUL_LOW_I16X8_U)        \
+  OP(0xBF, binary_fn, u32x4, u16x8, wasmbox_simd_extmul_high_u16, I32X4_EXTMUL_HIGH_I16X8_U)      \
+  OP(0xC0, unary_fn, u64x2, i64x2, wasmbox_simd_abs_s64, I64X2_ABS)                               \
+  OP(0xC1, unary, u64x2, u64x2, -, I64X2_NEG)                                                     \
+  OP(0xC3, test, any, u64x2, wasmbox_simd_all_true_64, I64X2_ALL_TRUE)                            \
+  OP(0xC4, test, any, i64x2, wasmbox_simd_bitmask_64, I64X2_BITMASK)                              \
+  OP(0xC7, unary_fn, i64x2, i32x4, wasmbox_simd_extend_low_s32, I64X2_EXTEND_LOW_I32X4_S)         \
+  OP(0xC8, unary_fn, i64x2, i32x4, wasmbox_simd_extend_high_s32, I64X2_EXTEND_HIGH_I32X4_S)       \
+  OP(0xC9, unary_fn, u64x2, u32x4, wasmbox_simd_extend_low_u32, I64X2_EXTEND_LOW_I32X4_U)         \
+  OP(0xCA, unary_fn, u64x2, u32x4, wasmbox_simd_extend_high_u32, I64X2_EXTEND_HIGH_I32X4_U)       \
+  OP(0xCB, shift, u64x2, u64x2, <<, I64X2_SHL)                                                    \
+  OP(0xCC, shift, i64x2, i64x2, >>, I64X2_SHR_S)                                                  \
+  OP(0xCD, shift, u64x2, u64x2, >>, I64X2_SHR_U)                                                  \
+  OP(0xCE, binary, u64x2, u64x2, +, I64X2_ADD)                                                    \
+  OP(0xD1, binary, u64x2, u64x2, -, I64X2_SUB)                                                    \
+  OP(0xD5, binary, u64x2, u64x2, *, I64X2_MUL)                                                    \
+  OP(0xD6, binary, i64x2, i64x2, ==, I64X2_EQ)                                                    \
+  OP(0xD7, binary, i64x2, i64x2, !=, I64X2_NE)                                                    \
+  OP(0xD8, binary, i64x2, i64x2, <, I64X2_LT_S)                                                   \
+  OP(0xD9, binary, i64x2, i64x2, >, I64X2_GT_S)                                                   \
+  OP(0xDA, binary, i64x2, i64x2, <=, I64X2_LE_S)                                                  \
+  OP(0xDB, binary, i64x2, i64x2, >=, I64X2_GE_S)                                                  \
+  OP(0xDC, binary_fn, i64x2, i32x4, wasmbox_simd_extmul_low_s32, I64X2_EXTMUL_LOW_I32X4_S)        \
+  OP(0xDD, binary_fn, i64x2, i32x4, wasmbox_simd_extmul_high_s32, I64X2_EXTMUL_HIGH_I32X4_S)      \
+  OP(0xDE, binary_fn, u64x2, u32x4, wasmbox_simd_extmul_low_u32, I64X2_EXTMUL_LOW_I32X4_U)        \
+  OP(0xDF, binary_fn, u64x2, u32x4, wasmbox_simd_extmul_high_u32, I64X2_EXTMUL_HIGH_I32X4_U)      \
+  OP(0xE0, unary_fn, f32x4, f32x4, wasmbox_simd_abs_f32, F32X4_ABS)                               \
+  OP(0xE1, unary, f32x4, f32x4, -, F32X4_NEG)                                                     \
+  OP(0xE3, unary_fn, f32x4, f32x4, wasmbox_simd_sqrt_f32, F32X4_SQRT)                             \
+  OP(0xE4, binary, f32x4, f32x4, +, F32X4_ADD)                                                    \
+  OP(0xE5, binary, f32x4, f32x4, -, F32X4_SUB)                                                    \
+  OP(0xE6, binary, f32x4, f32x4, *, F32X4_MUL)                                                    \
+  OP(0xE7, binary, f32x4, f32x4, /, F32X4_DIV)                                                    \
+  OP(0xE8, binary_fn, f32x4, f32x4, wasmbox_simd_min_f32, F32X4_MIN)                              \
+  OP(0xE9, binary_fn, f32x4, f32x4, wasmbox_simd_max_f32, F32X4_MAX)                              \
+  OP(0xEA, binary_fn, f32x4, f32x4, wasmbox_simd_pmin_f32, F32X4_PMIN)                            \
+  OP(0xEB, binary_fn, f32x4, f32x4, wasmbox_simd_pmax_f32, F32X4_PMAX)                            \
+  OP(0xEC, unary_fn, f64x2, f64x2, wasmbox_simd_abs_f64, F64X2_ABS)                               \
+  OP(0xED, unary, f64x2, f64x2, -, F64X2_NEG)                                                     \
+  OP(0xEF, unary_fn, f64x2, f64x2, wasmbox_simd_sqrt_f64, F64X2_SQRT)                             \
+  OP(0xF0, binary, f64x2, f64x2, +, F64X2_ADD)                                                    \
+  OP(0xF1, binary, f64x2, f64x2, -, F64X2_SUB)                                                    \
+  OP(0xF2, binary, f64x2, f64x2, *, F64X2_MUL)                                                    \
+  OP(0xF3, binary, f64x2, f64x2, /, F64X2_DIV)                                                    \
+  OP(0xF4, binary_fn, f64x2, f64x2, wasmbox_simd_min_f64, F64X2_MIN)                              \
+  OP(0xF5, binary_fn, f64x2, f64x2, wasmbox_simd_max_f64, F64X2_MAX)                              \
+  OP(0xF6, binary_fn, f64x2, f64x2, wasmbox_simd_pmin_f64, F64X2_PMIN)                            \
+  OP(0xF7, binary_fn, f64x2, f64x2, wasmbox_simd_pmax_f64, F64X2_PMAX)                            \
+  OP(0xF8, unary_fn, i32x4, f32x4, wasmbox_simd_trunc_sat_s32, I32X4_TRUNC_SAT_F32X4_S)           \
+  OP(0xF9, unary_fn, u32x4, f32x4, wasmbox_simd_trunc_sat_u32, I32X4_TRUNC_SAT_F32X4_U)           \
+  OP(0xFA, unary_fn, f32x4, i32x4, wasmbox_simd_convert_s32, F32X4_CONVERT_I32X4_S)               \
+  OP(0xFB, unary_fn, f32x4, u32x4, wasmbox_simd_convert_u32, F32X4_CONVERT_I32X4_U)               \
+  OP(0xFC, unary_fn, i32x4, f64x2, wasmbox_simd_trunc_sat_zero_s32, I32X4_TRUNC_SAT_F64X2_S_ZERO) \
+  OP(0xFD, unary_fn, u32x4, f64x2, wasmbox_simd_trunc_sat_zero_u32, I32X4_TRUNC_SAT_F64X2_U_ZERO) \
+  OP(0xFE, unary_fn, f64x2, i32x4, wasmbox_simd_convert_low_s32, F64X2_CONVERT_LOW_I32X4_S)       \
+  OP(0xFF, unary_fn, f64x2, u32x4, wasmbox_simd_convert_low_u32, F64X2_CONVERT_LOW_I32X4_U)
+
+/* Fused compare-and-branch instructions (jump to op0 if op1 <cmp> op2) */
+#define COMPARE_AND_BRANCH_INST_EACH(OP_INST)                 \
+  OP_INST(unary, u32, ==, I32_EQZ, OPCODE_JUMP_IF_I32_EQZ)    \
+  OP_INST(binary, u32, ==, I32_EQ, OPCODE_JUMP_IF_I32_EQ)     \
+  OP_INST(binary, u32, !=, I32_NE, OPCODE_JUMP_IF_I32_NE)     \
+  OP_INST(binary, s32, <, I32_LT_S, OPCODE_JUMP_IF_I32_LT_S)  \
+  OP_INST(binary, u32, <, I32_LT_U, OPCODE_JUMP_IF_I32_LT_U)  \
+  OP_INST(binary, s32, >, I32_GT_S, OPCODE_JUMP_IF_I32_GT_S)  \
+  OP_INST(binary, u32, >, I32_GT_U, OPCODE_JUMP_IF_I32_GT_U)  \
+  OP_INST(binary, s32, <=, I32_LE_S, OPCODE_JUMP_IF_I32_LE_S) \
+  OP_INST(binary, u32, <=, I32_LE_U, OPCODE_JUMP_IF_I32_LE_U) \
+  OP_INST(binary, s32, >=, I32_GE_S, OPCODE_JUMP_IF_I32_GE_S) \
+  OP_INST(binary, u32, >=, I32_GE_U, OPCODE_JUMP_IF_I32_GE_U) \
+  OP_INST(unary, u64, ==, I64_EQZ, OPCODE_JUMP_IF_I64_EQZ)    \
+  OP_INST(binary, u64, ==, I64_EQ, OPCODE_JUMP_IF_I64_EQ)     \
+  OP_INST(binary, u64, !=, I64_NE, OPCODE_JUMP_IF_I64_NE)     \
+  OP_INST(binary, s64, <, I64_LT_S, OPCODE_JUMP_IF_I64_LT_S)  \
+  OP_INST(binary, u64, <, I64_LT_U, OPCODE_JUMP_IF_I64_LT_U)  \
+  OP_INST(binary, s64, >, I64_GT_S, OPCODE_JUMP_IF_I64_GT_S)  \
+  OP_INST(binary, u64, >, I64_GT_U, OPCODE_JUMP_IF_I64_GT_U)  \
+  OP_INST(binary, s64, <=, I64_LE_S, OPCODE_JUMP_IF_I64_LE_S) \
+  OP_INST(binary, u64, <=, I64_LE_U, OPCODE_JUMP_IF_I64_LE_U) \
+  OP_INST(binary, s64, >=, I64_GE_S, OPCODE_JUMP_IF_I64_GE_S) \
+  OP_INST(binary, u64, >=, I64_GE_U, OPCODE_JUMP_IF_I64_GE_U)
+
+/* Counted loop back-edges. op1 += step; if (op1 <cmp> op2.r.reg1) goto op0.
+ * The step is stored in op2.r.reg2 itself, it is not a slot. */
+#define LOOP_INC_INST_EACH(OP_INST)                   \
+  OP_INST(s32, <, I32_LT_S, OPCODE_LOOP_INC_I32_LT_S) \
+  OP_INST(u32, <, I32_LT_U, OPCODE_LOOP_INC_I32_LT_U) \
+  OP_INST(u32, !=, I32_NE, OPCODE_LOOP_INC_I32_NE)
+
+/* Loads and stores of a base plus a scaled index, whose address is
+ * op1.r.reg1 + (op1.r.reg2 << op0.r.reg2) + op2.index. op0.r.reg1 is the
+ * result of a load or the value of a store.
+ * (inst, type in memory, slot field, unfused instruction, vmopcode) */
+#define INDEXED_MEMORY_INST_EACH(OP_INST)                                   \
+  OP_INST(load, wasm_u32_t, u32, I32_LOAD, OPCODE_I32_LOAD_INDEXED)         \
+  OP_INST(load, wasm_u64_t, u64, I64_LOAD, OPCODE_I64_LOAD_INDEXED)         \
+  OP_INST(load, wasm_f32_t, f32, F32_LOAD, OPCODE_F32_LOAD_INDEXED)         \
+  OP_INST(load, wasm_f64_t, f64, F64_LOAD, OPCODE_F64_LOAD_INDEXED)         \
+  OP_INST(load, wasm_s8_t, s32, I32_LOAD8_S, OPCODE_I32_LOAD8_S_INDEXED)    \
+  OP_INST(load, wasm_u8_t, u32, I32_LOAD8_U, OPCODE_I32_LOAD8_U_INDEXED)    \
+  OP_INST(load, wasm_s16_t, s32, I32_LOAD16_S, OPCODE_I32_LOAD16_S_INDEXED) \
+  OP_INST(load, wasm_u16_t, u32, I32_LOAD16_U, OPCODE_I32_LOAD16_U_INDEXED) \
+  OP_INST(store, wasm_u32_t, u32, I32_STORE, OPCODE_I32_STORE_INDEXED)      \
+  OP_INST(store, wasm_u64_t, u64, I64_STORE, OPCODE_I64_STORE_INDEXED)      \
+  OP_INST(store, wasm_f32_t, f32, F32_STORE, OPCODE_F32_STORE_INDEXED)      \
+  OP_INST(store, wasm_f64_t, f64, F64_STORE, OPCODE_F64_STORE_INDEXED)      \
+  OP_INST(store, wasm_u8_t, u32, I32_STORE8, OPCODE_I32_STORE8_INDEXED)     \
+  OP_INST(store, wasm_u16_t, u32, I32_STORE16, OPCODE_I32_STORE16_INDEXED)
+
+/* Each indexed access also has an OPCODE_<unfused>_INDEXED_UNCHECKED
+ * variant, used in loops whose bounds a MEMORY_GUARD has checked. */
+
+/* Loads and stores of a memory64, with the operands of the unfused
+ * instruction. The address is the u64 of its slot and, as no guard region
+ * covers a 64-bit index space, is always checked against the memory size.
+ * (inst, type in memory, slot field, unfused instruction, vmopcode) */
+#define MEMORY64_INST_EACH(OP_INST)                                           \
+  OP_INST(load, wasm_u32_t, u32, I32_LOAD, OPCODE_I32_LOAD_MEMORY64)         \
+  OP_INST(load, wasm_u64_t, u64, I64_LOAD, OPCODE_I64_LOAD_MEMORY64)         \
+  OP_INST(load, wasm_f32_t, f32, F32_LOAD, OPCODE_F32_LOAD_MEMORY64)         \
+  OP_INST(load, wasm_f64_t, f64, F64_LOAD, OPCODE_F64_LOAD_MEMORY64)         \
+  OP_INST(load, wasm_s8_t, s32, I32_LOAD8_S, OPCODE_I32_LOAD8_S_MEMORY64)    \
+  OP_INST(load, wasm_u8_t, u32, I32_LOAD8_U, OPCODE_I32_LOAD8_U_MEMORY64)    \
+  OP_INST(load, wasm_s16_t, s32, I32_LOAD16_S, OPCODE_I32_LOAD16_S_MEMORY64) \
+  OP_INST(load, wasm_u16_t, u32, I32_LOAD16_U, OPCODE_I32_LOAD16_U_MEMORY64) \
+  OP_INST(load, wasm_s8_t, s64, I64_LOAD8_S, OPCODE_I64_LOAD8_S_MEMORY64)    \
+  OP_INST(load, wasm_u8_t, u64, I64_LOAD8_U, OPCODE_I64_LOAD8_U_MEMORY64)    \
+  OP_INST(load, wasm_s16_t, s64, I64_LOAD16_S, OPCODE_I64_LOAD16_S_MEMORY64) \
+  OP_INST(load, wasm_u16_t, u64, I64_LOAD16_U, OPCODE_I64_LOAD16_U_MEMORY64) \
+  OP_INST(load, wasm_s32_t, s64, I64_LOAD32_S, OPCODE_I64_LOAD32_S_MEMORY64) \
+  OP_INST(load, wasm_u32_t, u64, I64_LOAD32_U, OPCODE_I64_LOAD32_U_MEMORY64) \
+  OP_INST(store, wasm_u32_t, u32, I32_STORE, OPCODE_I32_STORE_MEMORY64)      \
+  OP_INST(store, wasm_u64_t, u64, I64_STORE, OPCODE_I64_STORE_MEMORY64)      \
+  OP_INST(store, wasm_f32_t, f32, F32_STORE, OPCODE_F32_STORE_MEMORY64)      \
+  OP_INST(store, wasm_f64_t, f64, F64_STORE, OPCODE_F64_STORE_MEMORY64)      \
+  OP_INST(store, wasm_u8_t, u32, I32_STORE8, OPCODE_I32_STORE8_MEMORY64)     \
+  OP_INST(store, wasm_u16_t, u32, I32_STORE16, OPCODE_I32_STORE16_MEMORY64)  \
+  OP_INST(store, wasm_u8_t, u64, I64_STORE8, OPCODE_I64_STORE8_MEMORY64)     \
+  OP_INST(store, wasm_u16_t, u64, I64_STORE16, OPCODE_I64_STORE16_MEMORY64)  \
+  OP_INST(store, wasm_u32_t, u64, I64_STORE32, OPCODE_I64_STORE32_MEMORY64)
+
+/* Bounds checks hoisted out of a loop whose index op1.r.reg1 counts up to
+ * op1.r.reg2. Falls through if the index is below the limit and every index
+ * below the limit, shifted by the shift, plus op2.index (base, offset and
+ * size of the access) is inside the memory. Jumps to op0 otherwise.
+ * (size of the element, shift, vmopcode) */
+#define MEMORY_GUARD_INST_EACH(OP_INST) \
+  OP_INST(1, 0, OPCODE_MEMORY_GUARD_1)  \
+  OP_INST(2, 1, OPCODE_MEMORY_GUARD_2)  \
+  OP_INST(4, 2, OPCODE_MEMORY_GUARD_4)  \
+  OP_INST(8, 3, OPCODE_MEMORY_GUARD_8)
+
+/* Binary arithmetic with an immediate rhs (op0 = op1 <op> op2.value) */
+#define IMMEDIATE_INST_EACH(OP_INST)                     \
+  OP_INST(i32, u32, +, I32_ADD, OPCODE_I32_ADD_IMM)      \
+  OP_INST(i32, u32, -, I32_SUB, OPCODE_I32_SUB_IMM)      \
+  OP_INST(i32, u32, *, I32_MUL, OPCODE_I32_MUL_IMM)      \
+  OP_INST(i32, u32, &, I32_AND, OPCODE_I32_AND_IMM)      \
+  OP_INST(i32, u32, |, I32_OR, OPCODE_I32_OR_IMM)        \
+  OP_INST(i32, u32, ^, I32_XOR, OPCODE_I32_XOR_IMM)      \
+  OP_INST(i32, u32, <<, I32_SHL, OPCODE_I32_SHL_IMM)     \
+  OP_INST(i32, s32, >>, I32_SHR_S, OPCODE_I32_SHR_S_IMM) \
+  OP_INST(i32, u32, >>, I32_SHR_U, OPCODE_I32_SHR_U_IMM) \
+  OP_INST(i64, s64, +, I64_ADD, OPCODE_I64_ADD_IMM)      \
+  OP_INST(i64, s64, -, I64_SUB, OPCODE_I64_SUB_IMM)      \
+  OP_INST(i64, s64, *, I64_MUL, OPCODE_I64_MUL_IMM)      \
+  OP_INST(i64, u64, &, I64_AND, OPCODE_I64_AND_IMM)      \
+  OP_INST(i64, u64, |, I64_OR, OPCODE_I64_OR_IMM)        \
+  OP_INST(i64, u64, ^, I64_XOR, OPCODE_I64_XOR_IMM)      \
+  OP_INST(i64, u64, <<, I64_SHL, OPCODE_I64_SHL_IMM)     \
+  OP_INST(i64, s64, >>, I64_SHR_S, OPCODE_I64_SHR_S_IMM) \
+  OP_INST(i64, u64, >>, I64_SHR_U, OPCODE_I64_SHR_U_IMM)
+
+/* i32 division and remainder by a constant d, which is neither 0 nor a power
+ * of two if unsigned, nor -1, 0 or 1 if signed, as a multiply-high sequence
+ * (op0 = op1 <op> d). op2.value has the magic number in its upper half and d
+ * in its lower one. (type, operand, inst, vmopcode) */
+#define DIVISION_MAGIC_INST_EACH(OP_INST)           \
+  OP_INST(u32, /, I32_DIV_U, OPCODE_I32_DIV_U_MAGIC) \
+  OP_INST(u32, %, I32_REM_U, OPCODE_I32_REM_U_MAGIC) \
+  OP_INST(s32, /, I32_DIV_S, OPCODE_I32_DIV_S_MAGIC) \
+  OP_INST(s32, %, I32_REM_S, OPCODE_I32_REM_S_MAGIC)
+
 enum wasmbox_opcode {
 #define FUNC4(opcode, type, inst, vmopcode) vmopcode,
   DUMMY_INST_EACH(FUNC4) PARAMETRIC_INST_EACH(FUNC4)
@@ -298,7 +923,12 @@ enum wasmbox_opcode {
       NUMERIC_INST_EACH(FUNC5) VARIABLE_INST_EACH(FUNC5) MEMORY_INST_EACH(FUNC5)
           MEMORY_OP_EACH(FUNC5) CONST_OP_EACH(FUNC5)
               SATURATING_TRUNCATION_INST_EACH(FUNC5)
+                  BULK_MEMORY_INST_EACH(FUNC5) TABLE_INST_EACH(FUNC5)
+                      ATOMIC_INST_EACH(FUNC5)
 #undef FUNC5
+#define FUNC6(opcode, operands, rtype, atype, op, name) OPCODE_##name,
+  SIMD_INST_EACH(FUNC6)
+#undef FUNC6
   /**
    * Exist from virtual machine.
    */
@@ -313,12 +943,170 @@ enum wasmbox_opcode {
   OPCODE_MOVE,
   OPCODE_DYNAMIC_CALL,
   OPCODE_STATIC_CALL,
+  /**
+   * Calls a function in the frame of the current function. The callee returns
+   * to the caller of the current function.
+   */
+  OPCODE_DYNAMIC_TAIL_CALL,
+  OPCODE_STATIC_TAIL_CALL,
+  /**
+   * Runs the native code of a function compiled by the JIT, then returns like
+   * OPCODE_RETURN. Replaces the first instruction of the function.
+   */
+  OPCODE_JIT_ENTRY,
+  /**
+   * Compiles the function in op1 on its first call and continues with the
+   * compiled code. It is the only instruction of a function not compiled yet.
+   */
+  OPCODE_LAZY_COMPILE,
+  /**
+   * atomic.fence, a full memory barrier.
+   */
+  OPCODE_ATOMIC_FENCE,
+  /**
+   * Return address of the calls of wasmbox_call_batch. Stores the results and
+   * calls the function again with the next arguments, or exits after the last.
+   */
+  OPCODE_BATCH_NEXT,
+  /**
+   * Calls the host function in op0 with the frame of the current function,
+   * then returns like OPCODE_RETURN. It is the only instruction of an
+   * imported function.
+   */
+  OPCODE_HOST_CALL,
+  /**
+   * Charges op0 instructions to the fuel of the module, or stops the VM at
+   * this instruction if there is not enough. Starts each function and loop
+   * body of a metered module.
+   */
+  OPCODE_FUEL,
+  /**
+   * Stops the VM at this instruction once the epoch of the module reaches
+   * its deadline. Starts each function and loop body of an interruptible
+   * module.
+   */
+  OPCODE_EPOCH,
+  /**
+   * Counts a call or a loop iteration of the function in op1, whose code is
+   * of the first tier, and has it recompiled with every optimization once it
+   * is hot. Starts each function and loop body of the first tier, op0 being
+   * 0 for the function and the index of the loop plus 1 for a loop. The frame
+   * which makes it hot continues there in the new code.
+   */
+  OPCODE_HOTNESS,
+#define FUNC5(param, type, operand, cmp, vmopcode) vmopcode,
+  COMPARE_AND_BRANCH_INST_EACH(FUNC5)
+#undef FUNC5
+#define FUNC5(wtype, type, operand, inst, vmopcode) vmopcode,
+  IMMEDIATE_INST_EACH(FUNC5)
+#undef FUNC5
+#define FUNC4(type, operand, inst, vmopcode) vmopcode,
+  DIVISION_MAGIC_INST_EACH(FUNC4)
+#undef FUNC4
+#define FUNC4(type, operand, cmp, vmopcode) vmopcode,
+  LOOP_INC_INST_EACH(FUNC4)
+#undef FUNC4
+#define FUNC5(inst, mtype, field, unfused, vmopcode) vmopcode,
+  INDEXED_MEMORY_INST_EACH(FUNC5)
+#undef FUNC5
+#define FUNC5(inst, mtype, field, unfused, vmopcode) \
+  OPCODE_##unfused##_INDEXED_UNCHECKED,
+  INDEXED_MEMORY_INST_EACH(FUNC5)
+#undef FUNC5
+#define FUNC3(size, shift, vmopcode) vmopcode,
+  MEMORY_GUARD_INST_EACH(FUNC3)
+#undef FUNC3
+#define FUNC5(inst, mtype, field, unfused, vmopcode) vmopcode,
+  MEMORY64_INST_EACH(FUNC5)
+#undef FUNC5
+  /**
+   * global.get and global.set of the stack pointer of the guest, the global
+   * in op1 and op0 being the one of mod->stack_pointer_global. The
+   * interpreter keeps it in a register, and stores to the global too. SET
+   * adds op2.index to the value of op1.
+   */
+  OPCODE_STACK_POINTER_GET,
+  OPCODE_STACK_POINTER_SET,
+  /**
+   * Adds op2.index to the stack pointer of the guest, whose global is op1,
+   * and stores the result to op0 too, as functions do to allocate a frame.
+   */
+  OPCODE_STACK_POINTER_ADD,
+  /**
+   * Zeroes the op1.index slots from op0 on, which are the locals the function
+   * may read before writing them. Starts the entry block.
+   */
+  OPCODE_ZERO_LOCALS,
+  /**
+   * Calls the function of another module which the import link in op1
+   * resolves to, like OPCODE_STATIC_CALL with the base of the frame in op0.
+   * Saves the current module to op2 and runs the callee with the memory and
+   * the globals of its own module.
+   */
+  OPCODE_MODULE_CALL,
+  /**
+   * Switches back to the module saved to op0 by the OPCODE_MODULE_CALL right
+   * before it, which the callee returns to.
+   */
+  OPCODE_MODULE_RESTORE,
   /**
    * Returns labels for each opcode.
    */
   OPCODE_THREADED_CODE,
 };
 
+/* Slots of code taken by `code`, which is 1 but for the targets of a
+ * br_table. */
+static inline wasm_u32_t wasmbox_code_length(const wasmbox_code_t *code) {
+  if (code->h.opcode == OPCODE_JUMP_TABLE) {
+    return 1 + WASMBOX_JUMP_TABLE_SLOTS(code->op0.index);
+  }
+  return 1;
+}
+
+/* Instructions which branch to `op0.code` when their condition holds. */
+static inline int wasmbox_is_compare_and_branch(wasm_u16_t opcode) {
+  switch (opcode) {
+#define FUNC(param, type, operand, cmp, vmopcode) case vmopcode:
+    COMPARE_AND_BRANCH_INST_EACH(FUNC)
+#undef FUNC
+#define FUNC(type, operand, cmp, vmopcode) case vmopcode:
+    LOOP_INC_INST_EACH(FUNC)
+#undef FUNC
+#define FUNC(size, shift, vmopcode) case vmopcode:
+    MEMORY_GUARD_INST_EACH(FUNC)
+#undef FUNC
+    return 1;
+    default:
+      return 0;
+  }
+}
+
+/* Moves the branch targets of code copied `delta` bytes away. Compact code
+ * branches by offsets, which stay the same. */
+static inline void wasmbox_code_relocate(wasmbox_code_t *code,
+                                         wasm_u32_t size, ptrdiff_t delta) {
+#ifdef WASMBOX_VM_USE_COMPACT_CODE
+  (void) code;
+  (void) size;
+  (void) delta;
+#else
+  for (wasm_u32_t i = 0; i < size; i += wasmbox_code_length(&code[i])) {
+    wasmbox_code_t *pc = &code[i];
+    if (pc->h.opcode == OPCODE_JUMP || pc->h.opcode == OPCODE_JUMP_IF ||
+        wasmbox_is_compare_and_branch(pc->h.opcode)) {
+      pc->op0.code = (wasmbox_code_t *) ((char *) pc->op0.code + delta);
+    } else if (pc->h.opcode == OPCODE_JUMP_TABLE) {
+      pc->op1.code = (wasmbox_code_t *) ((char *) pc->op1.code + delta);
+      wasmbox_jump_target_t *targets = WASMBOX_JUMP_TABLE_TARGETS(pc);
+      for (wasm_u32_t k = 0; k < pc->op0.index; k++) {
+        targets[k].code = (wasmbox_code_t *) ((char *) targets[k].code + delta);
+      }
+    }
+  }
+#endif
+}
+
 #define WASMBOX_VM_DEBUG 1
 #ifdef WASMBOX_VM_DEBUG
 static const char *debug_opcodes[] = {
@@ -329,7 +1117,12 @@ static const char *debug_opcodes[] = {
         NUMERIC_INST_EACH(FUNC5) VARIABLE_INST_EACH(FUNC5)
             MEMORY_INST_EACH(FUNC5) MEMORY_OP_EACH(FUNC5) CONST_OP_EACH(FUNC5)
                 SATURATING_TRUNCATION_INST_EACH(FUNC5)
+                    BULK_MEMORY_INST_EACH(FUNC5) TABLE_INST_EACH(FUNC5)
+                        ATOMIC_INST_EACH(FUNC5)
 #  undef FUNC5
+#  define FUNC6(opcode, operands, rtype, atype, op, name) "OPCODE_" #name,
+                        SIMD_INST_EACH(FUNC6)
+#  undef FUNC6
                     "OPCODE_EXIT",
     "OPCODE_RETURN",
     "OPCODE_JUMP",
@@ -338,6 +1131,47 @@ static const char *debug_opcodes[] = {
     "OPCODE_MOVE",
     "OPCODE_DYNAMIC_CALL",
     "OPCODE_STATIC_CALL",
+    "OPCODE_DYNAMIC_TAIL_CALL",
+    "OPCODE_STATIC_TAIL_CALL",
+    "OPCODE_JIT_ENTRY",
+    "OPCODE_LAZY_COMPILE",
+    "OPCODE_ATOMIC_FENCE",
+    "OPCODE_BATCH_NEXT",
+    "OPCODE_HOST_CALL",
+    "OPCODE_FUEL",
+    "OPCODE_EPOCH",
+    "OPCODE_HOTNESS",
+#  define FUNC5(param, type, operand, cmp, vmopcode) #  vmopcode,
+    COMPARE_AND_BRANCH_INST_EACH(FUNC5)
+#  undef FUNC5
+#  define FUNC5(wtype, type, operand, inst, vmopcode) #  vmopcode,
+    IMMEDIATE_INST_EACH(FUNC5)
+#  undef FUNC5
+#  define FUNC4(type, operand, inst, vmopcode) #  vmopcode,
+    DIVISION_MAGIC_INST_EACH(FUNC4)
+#  undef FUNC4
+#  define FUNC4(type, operand, cmp, vmopcode) #  vmopcode,
+    LOOP_INC_INST_EACH(FUNC4)
+#  undef FUNC4
+#  define FUNC5(inst, mtype, field, unfused, vmopcode) #  vmopcode,
+    INDEXED_MEMORY_INST_EACH(FUNC5)
+#  undef FUNC5
+#  define FUNC5(inst, mtype, field, unfused, vmopcode) \
+    "OPCODE_" #unfused "_INDEXED_UNCHECKED",
+    INDEXED_MEMORY_INST_EACH(FUNC5)
+#  undef FUNC5
+#  define FUNC3(size, shift, vmopcode) #  vmopcode,
+    MEMORY_GUARD_INST_EACH(FUNC3)
+#  undef FUNC3
+#  define FUNC5(inst, mtype, field, unfused, vmopcode) #  vmopcode,
+    MEMORY64_INST_EACH(FUNC5)
+#  undef FUNC5
+    "OPCODE_STACK_POINTER_GET",
+    "OPCODE_STACK_POINTER_SET",
+    "OPCODE_STACK_POINTER_ADD",
+    "OPCODE_ZERO_LOCALS",
+    "OPCODE_MODULE_CALL",
+    "OPCODE_MODULE_RESTORE",
     "OPCODE_THREADED_CODE",
 };
 #endif /* WASMBOX_VM_DEBUG */
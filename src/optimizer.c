@@ -0,0 +1,2037 @@
+/*
+ * Copyright (C) 2021 Masahiro Ide
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "optimizer.h"
+
+#include "allocator.h"
+#include "memory.h"
+#include "opcodes.h"
+
+#include <string.h>
+
+// Returns zeroed scratch memory, which is released with the arena of the
+// function being compiled.
+static void *wasmbox_function_scratch(wasmbox_mutable_function_t *func,
+                                      wasm_u32_t size) {
+  void *mem = wasmbox_arena_alloc(func->arena, size);
+  memset(mem, 0, size);
+  return mem;
+}
+
+/**
+ * Visitor for frame slots referred by an instruction. `operand` points to the
+ * operand holding `slot`, or NULL if the instruction accesses `slot`
+ * implicitly (e.g. call arguments) and the access cannot be rewritten.
+ */
+typedef void (*wasmbox_slot_visitor_t)(wasmbox_code_reg_t *operand,
+                                       wasm_s32_t slot, void *data);
+
+static wasmbox_function_t *
+wasmbox_code_get_callee(wasmbox_mutable_function_t *func,
+                        wasmbox_code_t *code) {
+#ifdef WASMBOX_VM_USE_COMPACT_CODE
+  return func->constants[code->op1.index].func;
+#else
+  return code->op1.func;
+#endif
+}
+
+static wasmbox_call_cache_t *
+wasmbox_code_get_call_cache(wasmbox_mutable_function_t *func,
+                            wasmbox_code_t *code) {
+#ifdef WASMBOX_VM_USE_COMPACT_CODE
+  return func->constants[code->op1.index].cache;
+#else
+  return code->op1.cache;
+#endif
+}
+
+static wasmbox_module_link_t *
+wasmbox_code_get_link(wasmbox_mutable_function_t *func, wasmbox_code_t *code) {
+#ifdef WASMBOX_VM_USE_COMPACT_CODE
+  return (wasmbox_module_link_t *) (uintptr_t) func->constants[code->op1.index]
+      .value.u64;
+#else
+  return (wasmbox_module_link_t *) (uintptr_t) code->op1.value.u64;
+#endif
+}
+
+// Returns the type of the callee of a call instruction.
+static wasmbox_type_t *wasmbox_code_get_call_type(
+    wasmbox_mutable_function_t *func, wasmbox_code_t *code) {
+  if (code->h.opcode == OPCODE_DYNAMIC_CALL ||
+      code->h.opcode == OPCODE_DYNAMIC_TAIL_CALL) {
+    return wasmbox_code_get_call_cache(func, code)->type;
+  }
+  if (code->h.opcode == OPCODE_MODULE_CALL) {
+    return wasmbox_code_get_link(func, code)->func->type;
+  }
+  return wasmbox_code_get_callee(func, code)->type;
+}
+
+static int wasmbox_code_is_call(wasmbox_code_t *code) {
+  return code->h.opcode == OPCODE_STATIC_CALL ||
+         code->h.opcode == OPCODE_DYNAMIC_CALL ||
+         code->h.opcode == OPCODE_MODULE_CALL;
+}
+
+static int wasmbox_code_is_branch(wasmbox_code_t *code) {
+  switch (code->h.opcode) {
+    case OPCODE_JUMP:
+    case OPCODE_JUMP_IF:
+    case OPCODE_JUMP_TABLE:
+    case OPCODE_RETURN:
+    case OPCODE_EXIT:
+    case OPCODE_UNREACHABLE:
+    case OPCODE_DYNAMIC_TAIL_CALL:
+    case OPCODE_STATIC_TAIL_CALL:
+#define FUNC(param, type, operand, cmp, vmopcode) case vmopcode:
+      COMPARE_AND_BRANCH_INST_EACH(FUNC)
+#undef FUNC
+#define FUNC(size, shift, vmopcode) case vmopcode:
+      MEMORY_GUARD_INST_EACH(FUNC)
+#undef FUNC
+      return 1;
+    default:
+      return 0;
+  }
+}
+
+#define VISIT_USES_unary(CODE, VISITOR, DATA) \
+  VISITOR(&(CODE)->op1.reg, (CODE)->op1.reg, DATA)
+#define VISIT_USES_binary(CODE, VISITOR, DATA)        \
+  do {                                                \
+    VISITOR(&(CODE)->op1.reg, (CODE)->op1.reg, DATA); \
+    VISITOR(&(CODE)->op2.reg, (CODE)->op2.reg, DATA); \
+  } while (0)
+#define VISIT_MEMORY_USES_load(CODE, VISITOR, DATA) \
+  VISITOR(&(CODE)->op1.reg, (CODE)->op1.reg, DATA)
+#define VISIT_MEMORY_USES_store(CODE, VISITOR, DATA)  \
+  VISITOR(&(CODE)->op0.reg, (CODE)->op0.reg, DATA); \
+  VISITOR(&(CODE)->op1.reg, (CODE)->op1.reg, DATA)
+#define VISIT_MEMORY_DEFS_load(CODE, VISITOR, DATA) \
+  VISITOR(&(CODE)->op0.reg, (CODE)->op0.reg, DATA)
+#define VISIT_MEMORY_DEFS_store(CODE, VISITOR, DATA)
+#define VISIT_MEMORY_USES_rmw(CODE, VISITOR, DATA)        \
+  VISITOR(&(CODE)->op1.r.reg1, (CODE)->op1.r.reg1, DATA); \
+  VISITOR(&(CODE)->op1.r.reg2, (CODE)->op1.r.reg2, DATA)
+#define VISIT_MEMORY_USES_notify VISIT_MEMORY_USES_rmw
+#define VISIT_MEMORY_USES_cmpxchg(CODE, VISITOR, DATA) \
+  VISIT_MEMORY_USES_rmw(CODE, VISITOR, DATA);          \
+  VISITOR(&(CODE)->op0.r.reg2, (CODE)->op0.r.reg2, DATA)
+#define VISIT_MEMORY_USES_wait   VISIT_MEMORY_USES_cmpxchg
+#define VISIT_MEMORY_DEFS_rmw    VISIT_MEMORY_DEFS_load
+#define VISIT_MEMORY_DEFS_notify VISIT_MEMORY_DEFS_load
+#define VISIT_MEMORY_DEFS_cmpxchg(CODE, VISITOR, DATA) \
+  VISITOR(&(CODE)->op0.r.reg1, (CODE)->op0.r.reg1, DATA)
+#define VISIT_MEMORY_DEFS_wait VISIT_MEMORY_DEFS_cmpxchg
+#define VISIT_INDEXED_USES_load(CODE, VISITOR, DATA)      \
+  VISITOR(&(CODE)->op1.r.reg1, (CODE)->op1.r.reg1, DATA); \
+  VISITOR(&(CODE)->op1.r.reg2, (CODE)->op1.r.reg2, DATA)
+#define VISIT_INDEXED_USES_store(CODE, VISITOR, DATA) \
+  VISIT_INDEXED_USES_load(CODE, VISITOR, DATA);       \
+  VISITOR(&(CODE)->op0.r.reg1, (CODE)->op0.r.reg1, DATA)
+#define VISIT_INDEXED_DEFS_load(CODE, VISITOR, DATA) \
+  VISITOR(&(CODE)->op0.r.reg1, (CODE)->op0.r.reg1, DATA)
+#define VISIT_INDEXED_DEFS_store(CODE, VISITOR, DATA)
+
+/**
+ * Calls `visitor` for each frame slot which `code` reads. Arguments of a call
+ * are read through the callee frame. Returns -1 if the operands of `code` are
+ * unknown.
+ */
+static int wasmbox_code_visit_uses(wasmbox_mutable_function_t *func,
+                                   wasmbox_code_t *code,
+                                   wasmbox_slot_visitor_t visitor,
+                                   void *data) {
+  wasmbox_type_t *type;
+  wasm_s32_t args;
+  switch (code->h.opcode) {
+    case OPCODE_UNREACHABLE:
+    case OPCODE_NOP:
+    case OPCODE_EXIT:
+    case OPCODE_RETURN:
+    case OPCODE_JUMP:
+    case OPCODE_GLOBAL_GET:
+    case OPCODE_STACK_POINTER_GET:
+    case OPCODE_STACK_POINTER_ADD:
+    case OPCODE_ZERO_LOCALS:
+    case OPCODE_MEMORY_SIZE:
+    case OPCODE_DATA_DROP:
+    case OPCODE_REF_FUNC:
+    case OPCODE_TABLE_SIZE:
+    case OPCODE_ATOMIC_FENCE:
+    case OPCODE_FUEL:
+    case OPCODE_EPOCH:
+    case OPCODE_HOTNESS:
+#define FUNC(opcode, type, inst, attr, vmopcode) case vmopcode:
+      CONST_OP_EACH(FUNC)
+#undef FUNC
+      return 0;
+#define FUNC(opcode, out_type, in_type, inst, vmopcode) \
+  case vmopcode:                                        \
+    VISIT_MEMORY_USES_##inst(code, visitor, data);      \
+    return 0;
+      MEMORY_INST_EACH(FUNC)
+#undef FUNC
+#define FUNC(inst, mtype, field, unfused, vmopcode) \
+  case vmopcode:                                    \
+    VISIT_MEMORY_USES_##inst(code, visitor, data);  \
+    return 0;
+      MEMORY64_INST_EACH(FUNC)
+#undef FUNC
+#define FUNC(opcode, type, mtype, operands, vmopcode)  \
+  case vmopcode:                                       \
+    VISIT_MEMORY_USES_##operands(code, visitor, data); \
+    return 0;
+      ATOMIC_INST_EACH(FUNC)
+#undef FUNC
+#define FUNC(inst, mtype, field, unfused, vmopcode) \
+  case vmopcode:                                    \
+  case OPCODE_##unfused##_INDEXED_UNCHECKED:        \
+    VISIT_INDEXED_USES_##inst(code, visitor, data); \
+    return 0;
+      INDEXED_MEMORY_INST_EACH(FUNC)
+#undef FUNC
+#define FUNC(size, shift, vmopcode) case vmopcode:
+      MEMORY_GUARD_INST_EACH(FUNC)
+#undef FUNC
+      visitor(&code->op1.r.reg1, code->op1.r.reg1, data);
+      visitor(&code->op1.r.reg2, code->op1.r.reg2, data);
+      return 0;
+    case OPCODE_SELECT:
+      visitor(&code->op1.reg, code->op1.reg, data);
+      visitor(&code->op2.r.reg1, code->op2.r.reg1, data);
+      visitor(&code->op2.r.reg2, code->op2.r.reg2, data);
+      return 0;
+    case OPCODE_MEMORY_INIT:
+      visitor(&code->op1.r.reg1, code->op1.r.reg1, data);
+      visitor(&code->op1.r.reg2, code->op1.r.reg2, data);
+      visitor(&code->op2.reg, code->op2.reg, data);
+      return 0;
+    case OPCODE_MEMORY_COPY:
+    case OPCODE_MEMORY_FILL:
+      visitor(&code->op0.reg, code->op0.reg, data);
+      visitor(&code->op1.reg, code->op1.reg, data);
+      visitor(&code->op2.reg, code->op2.reg, data);
+      return 0;
+    case OPCODE_TABLE_SET:
+      visitor(&code->op0.reg, code->op0.reg, data);
+      visitor(&code->op1.reg, code->op1.reg, data);
+      return 0;
+    case OPCODE_TABLE_GROW:
+      visitor(&code->op1.r.reg1, code->op1.r.reg1, data);
+      visitor(&code->op1.r.reg2, code->op1.r.reg2, data);
+      return 0;
+    case OPCODE_MOVE:
+    case OPCODE_JUMP_IF:
+    case OPCODE_GLOBAL_SET:
+    case OPCODE_STACK_POINTER_SET:
+    case OPCODE_MEMORY_GROW:
+    case OPCODE_TABLE_GET:
+#define FUNC(wtype, type, operand, inst, vmopcode) case vmopcode:
+      IMMEDIATE_INST_EACH(FUNC)
+#undef FUNC
+#define FUNC(type, operand, inst, vmopcode) case vmopcode:
+      DIVISION_MAGIC_INST_EACH(FUNC)
+#undef FUNC
+      visitor(&code->op1.reg, code->op1.reg, data);
+      return 0;
+    case OPCODE_JUMP_TABLE:
+      visitor(&code->op2.reg, code->op2.reg, data);
+      return 0;
+#define FUNC(opcode, param, type, inst, vmopcode) \
+  case vmopcode:                                  \
+    VISIT_USES_##param(code, visitor, data);      \
+    return 0;
+      NUMERIC_INST_EACH(FUNC)
+#undef FUNC
+#define FUNC(opcode0, opcode1, type, inst, vmopcode) case vmopcode:
+      SATURATING_TRUNCATION_INST_EACH(FUNC)
+#undef FUNC
+      VISIT_USES_unary(code, visitor, data);
+      return 0;
+#define FUNC(param, type, operand, cmp, vmopcode) \
+  case vmopcode:                                  \
+    VISIT_USES_##param(code, visitor, data);      \
+    return 0;
+      COMPARE_AND_BRANCH_INST_EACH(FUNC)
+#undef FUNC
+    case OPCODE_DYNAMIC_CALL:
+    case OPCODE_DYNAMIC_TAIL_CALL:
+      visitor(&code->op2.reg, code->op2.reg, data);
+      // fallthrough
+    case OPCODE_STATIC_CALL:
+    case OPCODE_STATIC_TAIL_CALL:
+    case OPCODE_MODULE_CALL:
+      type = wasmbox_code_get_call_type(func, code);
+      args = code->op0.reg + type->return_size + WASMBOX_FUNCTION_CALL_OFFSET;
+      for (wasm_s32_t i = 0; i < type->argument_size; ++i) {
+        visitor(NULL, args + i, data);
+      }
+      return 0;
+    case OPCODE_MODULE_RESTORE:
+      visitor(NULL, code->op0.reg, data);
+      return 0;
+    default:
+      return -1;
+  }
+}
+
+/**
+ * Calls `visitor` for each frame slot which `code` writes. Returns -1 if the
+ * operands of `code` are unknown. Calls also clobber the callee frame, which
+ * is not reported (see wasmbox_code_clobbers).
+ */
+static int wasmbox_code_visit_defs(wasmbox_mutable_function_t *func,
+                                   wasmbox_code_t *code,
+                                   wasmbox_slot_visitor_t visitor,
+                                   void *data) {
+  switch (code->h.opcode) {
+    case OPCODE_UNREACHABLE:
+    case OPCODE_NOP:
+    case OPCODE_EXIT:
+    case OPCODE_RETURN:
+    case OPCODE_JUMP:
+    case OPCODE_JUMP_IF:
+    case OPCODE_JUMP_TABLE:
+    case OPCODE_GLOBAL_SET:
+    case OPCODE_STACK_POINTER_SET:
+    case OPCODE_DYNAMIC_TAIL_CALL:
+    case OPCODE_STATIC_TAIL_CALL:
+    case OPCODE_ATOMIC_FENCE:
+    case OPCODE_FUEL:
+    case OPCODE_EPOCH:
+    case OPCODE_HOTNESS:
+    case OPCODE_TABLE_SET:
+#define FUNC(opcode0, opcode1, type, inst, vmopcode) case vmopcode:
+      BULK_MEMORY_INST_EACH(FUNC)
+#undef FUNC
+#define FUNC(param, type, operand, cmp, vmopcode) case vmopcode:
+      COMPARE_AND_BRANCH_INST_EACH(FUNC)
+#undef FUNC
+#define FUNC(size, shift, vmopcode) case vmopcode:
+      MEMORY_GUARD_INST_EACH(FUNC)
+#undef FUNC
+      return 0;
+#define FUNC(opcode, out_type, in_type, inst, vmopcode) \
+  case vmopcode:                                        \
+    VISIT_MEMORY_DEFS_##inst(code, visitor, data);      \
+    return 0;
+      MEMORY_INST_EACH(FUNC)
+#undef FUNC
+#define FUNC(inst, mtype, field, unfused, vmopcode) \
+  case vmopcode:                                    \
+    VISIT_MEMORY_DEFS_##inst(code, visitor, data);  \
+    return 0;
+      MEMORY64_INST_EACH(FUNC)
+#undef FUNC
+#define FUNC(opcode, type, mtype, operands, vmopcode)  \
+  case vmopcode:                                       \
+    VISIT_MEMORY_DEFS_##operands(code, visitor, data); \
+    return 0;
+      ATOMIC_INST_EACH(FUNC)
+#undef FUNC
+#define FUNC(inst, mtype, field, unfused, vmopcode) \
+  case vmopcode:                                    \
+  case OPCODE_##unfused##_INDEXED_UNCHECKED:        \
+    VISIT_INDEXED_DEFS_##inst(code, visitor, data); \
+    return 0;
+      INDEXED_MEMORY_INST_EACH(FUNC)
+#undef FUNC
+    case OPCODE_SELECT:
+    case OPCODE_MOVE:
+    case OPCODE_GLOBAL_GET:
+    case OPCODE_STACK_POINTER_GET:
+    case OPCODE_STACK_POINTER_ADD:
+    case OPCODE_MEMORY_SIZE:
+    case OPCODE_MEMORY_GROW:
+    case OPCODE_REF_FUNC:
+    case OPCODE_TABLE_GET:
+    case OPCODE_TABLE_GROW:
+    case OPCODE_TABLE_SIZE:
+#define FUNC(opcode, type, inst, attr, vmopcode) case vmopcode:
+      CONST_OP_EACH(FUNC)
+#undef FUNC
+#define FUNC(opcode, param, type, inst, vmopcode) case vmopcode:
+      NUMERIC_INST_EACH(FUNC)
+#undef FUNC
+#define FUNC(opcode0, opcode1, type, inst, vmopcode) case vmopcode:
+      SATURATING_TRUNCATION_INST_EACH(FUNC)
+#undef FUNC
+#define FUNC(wtype, type, operand, inst, vmopcode) case vmopcode:
+      IMMEDIATE_INST_EACH(FUNC)
+#undef FUNC
+#define FUNC(type, operand, inst, vmopcode) case vmopcode:
+      DIVISION_MAGIC_INST_EACH(FUNC)
+#undef FUNC
+      visitor(&code->op0.reg, code->op0.reg, data);
+      return 0;
+    case OPCODE_STATIC_CALL:
+    case OPCODE_DYNAMIC_CALL:
+    case OPCODE_MODULE_CALL: {
+      wasmbox_type_t *type = wasmbox_code_get_call_type(func, code);
+      for (wasm_u32_t i = 0; i < type->return_size; ++i) {
+        visitor(NULL, code->op0.reg + i, data);
+      }
+      if (code->h.opcode == OPCODE_MODULE_CALL) {
+        visitor(NULL, code->op2.reg, data);
+      }
+      return 0;
+    }
+    case OPCODE_MODULE_RESTORE:
+      return 0;
+    case OPCODE_ZERO_LOCALS:
+      for (wasm_u32_t i = 0; i < code->op1.index; ++i) {
+        visitor(NULL, code->op0.reg + i, data);
+      }
+      return 0;
+    default:
+      return -1;
+  }
+}
+
+/**
+ * Returns 1 if `code` may overwrite `slot` without reporting it as a def. A
+ * callee uses the frame above the base of the call for its own slots.
+ */
+static int wasmbox_code_clobbers(wasmbox_code_t *code, wasm_s32_t slot) {
+  return wasmbox_code_is_call(code) && slot >= code->op0.reg;
+}
+
+static int wasmbox_code_is_unconditional_branch(wasmbox_code_t *code) {
+  switch (code->h.opcode) {
+    case OPCODE_JUMP:
+    case OPCODE_JUMP_TABLE:
+    case OPCODE_RETURN:
+    case OPCODE_EXIT:
+    case OPCODE_UNREACHABLE:
+    case OPCODE_DYNAMIC_TAIL_CALL:
+    case OPCODE_STATIC_TAIL_CALL:
+      return 1;
+    default:
+      return 0;
+  }
+}
+
+static wasmbox_table_t *wasmbox_code_get_table(wasmbox_mutable_function_t *func,
+                                               wasmbox_code_t *code) {
+  return func->tables[code->op0.index];
+}
+
+typedef void (*wasmbox_block_visitor_t)(wasm_s32_t block_id, void *data);
+
+// Returns the block executed after jumping to `target`. Jumping to the tail
+// of a block continues to the next block.
+static wasm_s32_t wasmbox_jump_destination(wasmbox_mutable_function_t *func,
+                                           wasm_u32_t target,
+                                           enum wasm_jump_direction direction) {
+  if (direction == WASM_JUMP_DIRECTION_HEAD) {
+    return target;
+  }
+  return target + 1 < func->block_size ? (wasm_s32_t) target + 1 : -1;
+}
+
+/**
+ * Calls `visitor` for each block which `code` may jump to. Falling through to
+ * the next instruction is not reported.
+ */
+static void wasmbox_code_visit_targets(wasmbox_mutable_function_t *func,
+                                       wasmbox_code_t *code,
+                                       wasmbox_block_visitor_t visitor,
+                                       void *data) {
+  switch (code->h.opcode) {
+    case OPCODE_JUMP:
+    case OPCODE_JUMP_IF:
+      visitor(wasmbox_jump_destination(
+                  func, code->op0.index,
+                  (enum wasm_jump_direction) code->op2.index),
+              data);
+      break;
+    case OPCODE_JUMP_TABLE: {
+      wasmbox_table_t *table = wasmbox_code_get_table(func, code);
+      for (wasm_u32_t i = 0; i < table->size; ++i) {
+        wasmbox_block_t *target = &func->blocks[table->block_ids[i]];
+        visitor(wasmbox_jump_destination(func, target->id, target->direction),
+                data);
+      }
+      wasmbox_block_t *target = &func->blocks[code->op1.index];
+      visitor(wasmbox_jump_destination(func, target->id, target->direction),
+              data);
+      break;
+    }
+#define FUNC(param, type, operand, cmp, vmopcode) case vmopcode:
+      COMPARE_AND_BRANCH_INST_EACH(FUNC)
+#undef FUNC
+#define FUNC(size, shift, vmopcode) case vmopcode:
+      MEMORY_GUARD_INST_EACH(FUNC)
+#undef FUNC
+      {
+        wasmbox_block_t *target = &func->blocks[code->op0.index];
+        visitor(wasmbox_jump_destination(func, target->id, target->direction),
+                data);
+        break;
+      }
+    default:
+      break;
+  }
+}
+
+typedef struct wasmbox_copy_context_t {
+  wasmbox_mutable_function_t *func;
+  wasm_s32_t max_slot;
+  /* First slot of the operand stack. Former slots hold arguments and locals. */
+  wasm_s32_t first_temp;
+  /* live_in[id * (max_slot + 1) + slot] is 1 if the block `id` may read the
+   * slot before writing it. */
+  wasm_u8_t *live_in;
+  /* Slot searched by visitors and the operands found. */
+  wasm_s32_t target;
+  wasmbox_code_reg_t **found;
+  wasm_u32_t found_size;
+  wasm_u32_t found_capacity;
+  wasm_u8_t found_implicit;
+} wasmbox_copy_context_t;
+
+static wasm_u8_t *wasmbox_copy_context_live_in(wasmbox_copy_context_t *ctx,
+                                               wasm_s32_t block_id) {
+  if (block_id < 0 || block_id >= ctx->func->block_size) {
+    return NULL;
+  }
+  return ctx->live_in + block_id * (ctx->max_slot + 1);
+}
+
+static int wasmbox_copy_context_is_live_in(wasmbox_copy_context_t *ctx,
+                                           wasm_s32_t block_id,
+                                           wasm_s32_t slot) {
+  wasm_u8_t *live = wasmbox_copy_context_live_in(ctx, block_id);
+  if (live == NULL || slot < 0 || slot > ctx->max_slot) {
+    return 0;
+  }
+  return live[slot];
+}
+
+static void wasmbox_visit_max_slot(wasmbox_code_reg_t *operand,
+                                   wasm_s32_t slot, void *data) {
+  wasmbox_copy_context_t *ctx = (wasmbox_copy_context_t *) data;
+  if (slot > ctx->max_slot) {
+    ctx->max_slot = slot;
+  }
+}
+
+static void wasmbox_visit_find(wasmbox_code_reg_t *operand, wasm_s32_t slot,
+                               void *data) {
+  wasmbox_copy_context_t *ctx = (wasmbox_copy_context_t *) data;
+  if (slot != ctx->target) {
+    return;
+  }
+  if (operand == NULL) {
+    ctx->found_implicit = 1;
+    return;
+  }
+  if (ctx->found_size == ctx->found_capacity) {
+    // Found more operands than expected. Treat as if it can not be rewritten.
+    ctx->found_implicit = 1;
+    return;
+  }
+  ctx->found[ctx->found_size++] = operand;
+}
+
+static void wasmbox_copy_context_find_reset(wasmbox_copy_context_t *ctx,
+                                            wasm_s32_t target) {
+  ctx->target = target;
+  ctx->found_size = 0;
+  ctx->found_implicit = 0;
+}
+
+typedef struct wasmbox_slot_counter_t {
+  wasm_s32_t target;
+  wasm_u32_t count;
+} wasmbox_slot_counter_t;
+
+static void wasmbox_visit_count(wasmbox_code_reg_t *operand, wasm_s32_t slot,
+                                void *data) {
+  wasmbox_slot_counter_t *counter = (wasmbox_slot_counter_t *) data;
+  if (slot == counter->target) {
+    counter->count++;
+  }
+}
+
+// Returns 1 if `code` writes or clobbers `slot`.
+static int wasmbox_code_modifies(wasmbox_copy_context_t *ctx,
+                                 wasmbox_code_t *code, wasm_s32_t slot) {
+  wasmbox_slot_counter_t counter = {slot, 0};
+  wasmbox_code_visit_defs(ctx->func, code, wasmbox_visit_count, &counter);
+  return counter.count > 0 || wasmbox_code_clobbers(code, slot);
+}
+
+// Returns 1 if `code` reads `slot`.
+static int wasmbox_code_reads(wasmbox_copy_context_t *ctx,
+                              wasmbox_code_t *code, wasm_s32_t slot) {
+  wasmbox_slot_counter_t counter = {slot, 0};
+  wasmbox_code_visit_uses(ctx->func, code, wasmbox_visit_count,
+                          &counter);
+  return counter.count > 0;
+}
+
+typedef struct wasmbox_live_target_t {
+  wasmbox_copy_context_t *ctx;
+  wasm_s32_t slot;
+  wasm_u8_t live;
+} wasmbox_live_target_t;
+
+static void wasmbox_visit_live_target(wasm_s32_t block_id, void *data) {
+  wasmbox_live_target_t *target = (wasmbox_live_target_t *) data;
+  if (wasmbox_copy_context_is_live_in(target->ctx, block_id, target->slot)) {
+    target->live = 1;
+  }
+}
+
+// Returns 1 if a block which `code` may jump to reads `slot`.
+static int wasmbox_code_jumps_with(wasmbox_copy_context_t *ctx,
+                                   wasmbox_code_t *code, wasm_s32_t slot) {
+  wasmbox_live_target_t target = {ctx, slot, 0};
+  wasmbox_code_visit_targets(ctx->func, code, wasmbox_visit_live_target,
+                             &target);
+  return target.live;
+}
+
+// Returns 1 if `slot` may be read after `block->code[index]`.
+static int wasmbox_copy_context_is_live_after(wasmbox_copy_context_t *ctx,
+                                              wasmbox_block_t *block,
+                                              wasm_u16_t index,
+                                              wasm_s32_t slot) {
+  for (wasm_u16_t i = index + 1; i < block->code_size; ++i) {
+    wasmbox_code_t *code = &block->code[i];
+    if (wasmbox_code_reads(ctx, code, slot) ||
+        wasmbox_code_jumps_with(ctx, code, slot)) {
+      return 1;
+    }
+    if (wasmbox_code_is_unconditional_branch(code) ||
+        wasmbox_code_modifies(ctx, code, slot)) {
+      return 0;
+    }
+  }
+  return wasmbox_copy_context_is_live_in(ctx, block->id + 1, slot);
+}
+
+typedef struct wasmbox_live_set_t {
+  wasmbox_copy_context_t *ctx;
+  wasm_u8_t *live;
+} wasmbox_live_set_t;
+
+static void wasmbox_visit_live_union(wasm_s32_t block_id, void *data) {
+  wasmbox_live_set_t *set = (wasmbox_live_set_t *) data;
+  wasm_u8_t *live_in = wasmbox_copy_context_live_in(set->ctx, block_id);
+  if (live_in == NULL) {
+    return;
+  }
+  for (wasm_s32_t i = 0; i <= set->ctx->max_slot; ++i) {
+    set->live[i] |= live_in[i];
+  }
+}
+
+static void wasmbox_visit_live_kill(wasmbox_code_reg_t *operand,
+                                    wasm_s32_t slot, void *data) {
+  wasmbox_live_set_t *set = (wasmbox_live_set_t *) data;
+  if (0 <= slot && slot <= set->ctx->max_slot) {
+    set->live[slot] = 0;
+  }
+}
+
+static void wasmbox_visit_live_gen(wasmbox_code_reg_t *operand,
+                                   wasm_s32_t slot, void *data) {
+  wasmbox_live_set_t *set = (wasmbox_live_set_t *) data;
+  if (0 <= slot && slot <= set->ctx->max_slot) {
+    set->live[slot] = 1;
+  }
+}
+
+// Computes live_in of `block` from its successors. Returns 1 if it changed.
+static int wasmbox_block_update_liveness(wasmbox_copy_context_t *ctx,
+                                         wasmbox_block_t *block,
+                                         wasm_u8_t *live) {
+  wasm_u32_t size = ctx->max_slot + 1;
+  wasmbox_live_set_t set = {ctx, live};
+  bzero(live, size);
+  wasmbox_visit_live_union(block->id + 1, &set);
+  for (wasm_s32_t i = (wasm_s32_t) block->code_size - 1; i >= 0; --i) {
+    wasmbox_code_t *code = &block->code[i];
+    if (wasmbox_code_is_unconditional_branch(code)) {
+      bzero(live, size);
+    }
+    wasmbox_code_visit_targets(ctx->func, code, wasmbox_visit_live_union,
+                               &set);
+    wasmbox_code_visit_defs(ctx->func, code, wasmbox_visit_live_kill, &set);
+    wasmbox_code_visit_uses(ctx->func, code, wasmbox_visit_live_gen, &set);
+  }
+  wasm_u8_t *live_in = wasmbox_copy_context_live_in(ctx, block->id);
+  if (memcmp(live_in, live, size) == 0) {
+    return 0;
+  }
+  memcpy(live_in, live, size);
+  return 1;
+}
+
+static void wasmbox_copy_context_compute_liveness(wasmbox_copy_context_t *ctx) {
+  wasmbox_mutable_function_t *func = ctx->func;
+  wasm_u8_t *live =
+      (wasm_u8_t *) wasmbox_function_scratch(func, ctx->max_slot + 1);
+  int changed = 1;
+  while (changed) {
+    changed = 0;
+    for (wasm_s32_t i = func->block_size - 1; i >= 0; --i) {
+      changed |= wasmbox_block_update_liveness(ctx, &func->blocks[i], live);
+    }
+  }
+}
+
+static int wasmbox_copy_context_is_temp(wasmbox_copy_context_t *ctx,
+                                        wasm_s32_t slot) {
+  return ctx->first_temp <= slot && slot <= ctx->max_slot;
+}
+
+// Rewrites the reads of `from` following the MOVE at `index`, which makes
+// `from` and `to` equal, to read `to`. Returns -1 if a read cannot be
+// rewritten, e.g. `from` is still read after `to` is modified.
+static int wasmbox_rename_uses_after_move(wasmbox_copy_context_t *ctx,
+                                          wasmbox_block_t *block,
+                                          wasm_u16_t index, wasm_s32_t from,
+                                          wasm_s32_t to) {
+  wasmbox_copy_context_find_reset(ctx, from);
+  wasm_u16_t i;
+  for (i = index + 1; i < block->code_size; ++i) {
+    wasmbox_code_t *code = &block->code[i];
+    wasmbox_code_visit_uses(ctx->func, code, wasmbox_visit_find, ctx);
+    if (ctx->found_implicit || wasmbox_code_jumps_with(ctx, code, from)) {
+      return -1;
+    }
+    if (wasmbox_code_is_unconditional_branch(code) ||
+        wasmbox_code_modifies(ctx, code, from)) {
+      break;
+    }
+    // Uses are read before defs are written. Reads in the instruction which
+    // modifies `to` are still rewritable.
+    if (wasmbox_code_modifies(ctx, code, to)) {
+      if (wasmbox_copy_context_is_live_after(ctx, block, i, from)) {
+        return -1;
+      }
+      break;
+    }
+  }
+  if (i == block->code_size &&
+      wasmbox_copy_context_is_live_in(ctx, block->id + 1, from)) {
+    return -1;
+  }
+  for (wasm_u32_t j = 0; j < ctx->found_size; ++j) {
+    *ctx->found[j] = to;
+  }
+  return 0;
+}
+
+// Forward copy propagation. Consumers of a slot filled by MOVE (local.get,
+// block values, ...) read the source slot directly if it is not modified
+// until then.
+// MOVE r3 r2             |
+// I32_ADD r4 r3 r1       | I32_ADD r4 r2 r1
+// A temporary which is still read after it is moved to a local (local.tee)
+// is read from the local instead, so that the move can be coalesced.
+// I32_ADD_IMM r5 r3 1    | I32_ADD_IMM r5 r3 1
+// MOVE r3 r5             | MOVE r3 r5
+// I32_LT_S r6 r5 r2      | I32_LT_S r6 r3 r2
+static void wasmbox_propagate_move_source(wasmbox_copy_context_t *ctx,
+                                          wasmbox_block_t *block,
+                                          wasm_u16_t index) {
+  wasmbox_code_t *move = &block->code[index];
+  wasm_s32_t dst = move->op0.reg;
+  wasm_s32_t src = move->op1.reg;
+  if (src < 0 || src == dst) {
+    return;
+  }
+  if (wasmbox_copy_context_is_temp(ctx, dst)) {
+    if (wasmbox_rename_uses_after_move(ctx, block, index, dst, src) == 0) {
+      move->h.opcode = OPCODE_NOP;
+    }
+  } else if (dst >= 0 && wasmbox_copy_context_is_temp(ctx, src)) {
+    wasmbox_rename_uses_after_move(ctx, block, index, src, dst);
+  }
+}
+
+// Backward move coalescing. An instruction whose result is only moved to
+// another slot (local.set, block values, call arguments, ...) writes the
+// destination directly.
+// I32_ADD r4 r2 r1       | I32_ADD r2 r2 r1
+// MOVE r2 r4             |
+static void wasmbox_coalesce_move_destination(wasmbox_copy_context_t *ctx,
+                                              wasmbox_block_t *block,
+                                              wasm_u16_t index) {
+  wasmbox_code_t *move = &block->code[index];
+  wasm_s32_t dst = move->op0.reg;
+  wasm_s32_t src = move->op1.reg;
+  if (!wasmbox_copy_context_is_temp(ctx, src) || src == dst ||
+      wasmbox_copy_context_is_live_after(ctx, block, index, src)) {
+    return;
+  }
+  for (wasm_s32_t i = (wasm_s32_t) index - 1; i >= 0; --i) {
+    wasmbox_code_t *code = &block->code[i];
+    if (code->h.opcode == OPCODE_NOP) {
+      continue;
+    }
+    wasmbox_copy_context_find_reset(ctx, src);
+    wasmbox_code_visit_defs(ctx->func, code, wasmbox_visit_find, ctx);
+    if (ctx->found_implicit) {
+      return;
+    }
+    if (ctx->found_size == 1) {
+      *ctx->found[0] = dst;
+      move->h.opcode = OPCODE_NOP;
+      return;
+    }
+    // Writing `dst` earlier is visible to the instructions in between and to
+    // the code reached by a branch in between.
+    if (wasmbox_code_is_branch(code) || wasmbox_code_reads(ctx, code, src) ||
+        wasmbox_code_reads(ctx, code, dst) ||
+        wasmbox_code_modifies(ctx, code, dst)) {
+      return;
+    }
+  }
+}
+
+static void wasmbox_block_remove_nop(wasmbox_block_t *block) {
+  wasm_u16_t j = 0;
+  for (wasm_u16_t i = 0; i < block->code_size; ++i) {
+    if (block->code[i].h.opcode == OPCODE_NOP) {
+      continue;
+    }
+    if (i != j) {
+      block->code[j] = block->code[i];
+#ifdef WASMBOX_VM_USE_SAMPLING_PROFILE
+      block->offsets[j] = block->offsets[i];
+#endif
+    }
+    ++j;
+  }
+  block->code_size = j;
+}
+
+static int wasmbox_copy_context_init(wasmbox_copy_context_t *ctx,
+                                     wasmbox_mutable_function_t *func) {
+  ctx->func = func;
+  ctx->first_temp = WASMBOX_FUNCTION_CALL_OFFSET +
+                    func->base.type->argument_size + func->base.locals;
+  ctx->max_slot = func->base.frame_size;
+  wasm_u32_t max_code_size = 0;
+  for (wasm_u16_t i = 0; i < func->block_size; ++i) {
+    wasmbox_block_t *block = &func->blocks[i];
+    if (max_code_size < block->code_size) {
+      max_code_size = block->code_size;
+    }
+    for (wasm_u16_t j = 0; j < block->code_size; ++j) {
+      wasmbox_code_t *code = &block->code[j];
+      if (wasmbox_code_visit_uses(func, code, wasmbox_visit_max_slot, ctx) !=
+              0 ||
+          wasmbox_code_visit_defs(func, code, wasmbox_visit_max_slot, ctx) !=
+              0) {
+        // Give up to optimize function which has unknown instruction.
+        return -1;
+      }
+    }
+  }
+  ctx->live_in = (wasm_u8_t *) wasmbox_function_scratch(
+      func, func->block_size * (ctx->max_slot + 1));
+  // An instruction reads at most three slots explicitly.
+  ctx->found_capacity = max_code_size * 3 + 1;
+  ctx->found = (wasmbox_code_reg_t **) wasmbox_function_scratch(
+      func, sizeof(wasmbox_code_reg_t *) * ctx->found_capacity);
+  wasmbox_copy_context_compute_liveness(ctx);
+  return 0;
+}
+
+/**
+ * Removes MOVEs emitted for local.get/local.set/local.tee, block values and
+ * call arguments. Rewriting is done within a block as a block is entered only
+ * from its start. Values flowing into other blocks are tracked by liveness.
+ */
+static void wasmbox_eliminate_moves(wasmbox_mutable_function_t *func) {
+  wasmbox_copy_context_t ctx = {};
+  if (func->block_size == 0 || wasmbox_copy_context_init(&ctx, func) != 0) {
+    return;
+  }
+  for (wasm_u16_t i = 0; i < func->block_size; ++i) {
+    wasmbox_block_t *block = &func->blocks[i];
+    for (wasm_u16_t j = 0; j < block->code_size; ++j) {
+      if (block->code[j].h.opcode == OPCODE_MOVE) {
+        wasmbox_propagate_move_source(&ctx, block, j);
+      }
+    }
+    for (wasm_u16_t j = 0; j < block->code_size; ++j) {
+      if (block->code[j].h.opcode == OPCODE_MOVE) {
+        wasmbox_coalesce_move_destination(&ctx, block, j);
+      }
+    }
+    wasmbox_block_remove_nop(block);
+  }
+}
+
+/**
+ * Narrows the ZERO_LOCALS starting the entry block to the locals which may be
+ * read before they are written, i.e. are live when the function is entered,
+ * and removes it if there are none. The entry block is not a branch target.
+ * ZERO_LOCALS r3 3       | ZERO_LOCALS r5 1
+ * LOAD_CONST_I32 r3 1    | LOAD_CONST_I32 r3 1
+ * I32_ADD r4 r3 r5       | I32_ADD r4 r3 r5
+ */
+static void wasmbox_narrow_zero_locals(wasmbox_mutable_function_t *func) {
+  if (func->block_size == 0 || func->blocks[0].code_size == 0 ||
+      func->blocks[0].code[0].h.opcode != OPCODE_ZERO_LOCALS) {
+    return;
+  }
+  wasmbox_code_t *zero = &func->blocks[0].code[0];
+  wasm_s32_t first = zero->op0.reg;
+  wasm_s32_t end = first + (wasm_s32_t) zero->op1.index;
+  // Liveness is computed as if the locals were not zeroed.
+  zero->h.opcode = OPCODE_NOP;
+  wasmbox_copy_context_t ctx = {};
+  if (wasmbox_copy_context_init(&ctx, func) != 0) {
+    zero->h.opcode = OPCODE_ZERO_LOCALS;
+    return;
+  }
+  wasm_s32_t lo = end;
+  wasm_s32_t hi = first;
+  for (wasm_s32_t slot = first; slot < end; ++slot) {
+    if (wasmbox_copy_context_is_live_in(&ctx, 0, slot)) {
+      lo = lo < slot ? lo : slot;
+      hi = slot + 1;
+    }
+  }
+  if (lo >= hi) {
+    wasmbox_block_remove_nop(&func->blocks[0]);
+    return;
+  }
+  zero->h.opcode = OPCODE_ZERO_LOCALS;
+  zero->op0.reg = lo;
+  zero->op1.index = hi - lo;
+}
+
+static void wasmbox_visit_reachable(wasm_s32_t block_id, void *data) {
+  wasm_u8_t *reachable = (wasm_u8_t *) data;
+  if (block_id >= 0 && reachable[block_id] == 0) {
+    reachable[block_id] = 1;
+  }
+}
+
+/**
+ * Empties blocks which are never entered, e.g. the branch of a JUMP_IF folded
+ * on a constant condition, and drops code following an unconditional branch.
+ * Blocks are laid out in the order of their ids, so emptying a block does not
+ * change where the jumps into the remaining blocks land.
+ */
+static void wasmbox_remove_dead_blocks(wasmbox_mutable_function_t *func) {
+  if (func->block_size == 0) {
+    return;
+  }
+  // 0: unreachable, 1: reachable but not yet visited, 2: visited.
+  wasm_u8_t *reachable =
+      (wasm_u8_t *) wasmbox_function_scratch(func, func->block_size);
+  reachable[0] = 1;
+  int changed = 1;
+  while (changed) {
+    changed = 0;
+    for (wasm_u16_t i = 0; i < func->block_size; ++i) {
+      if (reachable[i] != 1) {
+        continue;
+      }
+      reachable[i] = 2;
+      changed = 1;
+      wasmbox_block_t *block = &func->blocks[i];
+      int falls_through = 1;
+      for (wasm_u16_t j = 0; j < block->code_size; ++j) {
+        wasmbox_code_t *code = &block->code[j];
+        wasmbox_code_visit_targets(func, code, wasmbox_visit_reachable,
+                                   reachable);
+        if (wasmbox_code_is_unconditional_branch(code)) {
+          block->code_size = j + 1;
+          falls_through = 0;
+          break;
+        }
+      }
+      if (falls_through && i + 1 < func->block_size) {
+        wasmbox_visit_reachable(i + 1, reachable);
+      }
+    }
+  }
+  for (wasm_u16_t i = 0; i < func->block_size; ++i) {
+    if (reachable[i] == 0) {
+      func->blocks[i].code_size = 0;
+    }
+  }
+}
+
+/**
+ * Returns the first block which executes code when `block_id` is entered.
+ * Empty blocks fall through to the next block and blocks starting with JUMP
+ * forward to its destination. Returns -1 if control leaves the function.
+ */
+static wasm_s32_t wasmbox_block_resolve(wasmbox_mutable_function_t *func,
+                                        wasm_s32_t block_id) {
+  // A chain of jumps longer than the number of blocks is an empty loop.
+  for (wasm_u16_t n = 0; block_id >= 0 && n < func->block_size; ++n) {
+    wasmbox_block_t *block = &func->blocks[block_id];
+    if (block->code_size == 0) {
+      block_id = block_id + 1 < func->block_size ? block_id + 1 : -1;
+    } else if (block->code[0].h.opcode == OPCODE_JUMP) {
+      block_id = wasmbox_jump_destination(
+          func, block->code[0].op0.index,
+          (enum wasm_jump_direction) block->code[0].op2.index);
+    } else {
+      break;
+    }
+  }
+  return block_id;
+}
+
+typedef struct wasmbox_layout_context_t {
+  wasmbox_mutable_function_t *func;
+  /* Resolved destination of a jump to the head of each block. */
+  wasm_s32_t *dest;
+  /* Blocks whose successors are laid out later, and the new order. */
+  wasm_u16_t *pending;
+  wasm_u16_t pending_size;
+  wasm_u16_t *order;
+  wasm_u16_t order_size;
+  wasm_u8_t *placed;
+  int failed;
+} wasmbox_layout_context_t;
+
+static wasm_s32_t wasmbox_layout_dest(wasmbox_layout_context_t *ctx,
+                                      wasm_u32_t block_id,
+                                      enum wasm_jump_direction direction) {
+  wasm_s32_t id = wasmbox_jump_destination(ctx->func, block_id, direction);
+  if (id < 0 || ctx->dest[id] < 0) {
+    ctx->failed = 1;
+    return 0;
+  }
+  return ctx->dest[id];
+}
+
+static void wasmbox_visit_pending(wasm_s32_t block_id, void *data) {
+  wasmbox_layout_context_t *ctx = (wasmbox_layout_context_t *) data;
+  if (!ctx->placed[block_id]) {
+    ctx->pending[ctx->pending_size++] = block_id;
+  }
+}
+
+static void wasmbox_block_add_jump(wasmbox_mutable_function_t *func,
+                                   wasmbox_block_t *block,
+                                   wasm_u32_t block_id) {
+  if (block->code_size + 1 > block->code_capacity) {
+    block->code = (wasmbox_code_t *) wasmbox_arena_realloc(
+        func->arena, block->code, sizeof(wasmbox_code_t) * block->code_capacity,
+        sizeof(wasmbox_code_t) * block->code_capacity * 2);
+#ifdef WASMBOX_VM_USE_SAMPLING_PROFILE
+    block->offsets = (wasm_u32_t *) wasmbox_arena_realloc(
+        func->arena, block->offsets, sizeof(wasm_u32_t) * block->code_capacity,
+        sizeof(wasm_u32_t) * block->code_capacity * 2);
+#endif
+    block->code_capacity *= 2;
+  }
+#ifdef WASMBOX_VM_USE_SAMPLING_PROFILE
+  // The fall-through it makes explicit belongs to the last instruction.
+  block->offsets[block->code_size] =
+      block->code_size > 0 ? block->offsets[block->code_size - 1] : 0;
+#endif
+  wasmbox_code_t *code = &block->code[block->code_size++];
+  code->h.opcode = OPCODE_JUMP;
+  code->op0.index = block_id;
+  code->op2.index = WASM_JUMP_DIRECTION_HEAD;
+}
+
+/**
+ * Makes every branch target the head of the block it effectively reaches.
+ * Jumps to a block which only jumps again are threaded to the final block,
+ * and fall-through is replaced by an explicit JUMP so that blocks can be
+ * reordered.
+ * BB0: JUMP BB1  | BB0: JUMP BB2
+ * BB1: JUMP BB2  | BB1: JUMP BB2
+ * BB2: ...       | BB2: ...
+ */
+static void wasmbox_layout_thread_jumps(wasmbox_layout_context_t *ctx) {
+  wasmbox_mutable_function_t *func = ctx->func;
+  // Check that all destinations are inside the function before rewriting.
+  for (int pass = 0; pass < 2; ++pass) {
+    for (wasm_u16_t i = 0; i < func->block_size; ++i) {
+      wasmbox_block_t *block = &func->blocks[i];
+      if (block->code_size == 0) {
+        continue;
+      }
+      for (wasm_u16_t j = 0; j < block->code_size; ++j) {
+        wasmbox_code_t *code = &block->code[j];
+        switch (code->h.opcode) {
+          case OPCODE_JUMP:
+          case OPCODE_JUMP_IF: {
+            wasm_s32_t dest = wasmbox_layout_dest(
+                ctx, code->op0.index,
+                (enum wasm_jump_direction) code->op2.index);
+            if (pass == 1) {
+              code->op0.index = dest;
+              code->op2.index = WASM_JUMP_DIRECTION_HEAD;
+            }
+            break;
+          }
+          case OPCODE_JUMP_TABLE: {
+            wasmbox_table_t *table = wasmbox_code_get_table(func, code);
+            for (wasm_u32_t k = 0; k < table->size; ++k) {
+              wasmbox_block_t *target = &func->blocks[table->block_ids[k]];
+              wasm_s32_t dest =
+                  wasmbox_layout_dest(ctx, target->id, target->direction);
+              if (pass == 1) {
+                table->block_ids[k] = dest;
+              }
+            }
+            wasmbox_block_t *target = &func->blocks[code->op1.index];
+            wasm_s32_t dest =
+                wasmbox_layout_dest(ctx, target->id, target->direction);
+            if (pass == 1) {
+              code->op1.index = dest;
+            }
+            break;
+          }
+          default:
+            break;
+        }
+      }
+      if (!wasmbox_code_is_unconditional_branch(
+              &block->code[block->code_size - 1])) {
+        wasm_s32_t dest = wasmbox_layout_dest(ctx, i, WASM_JUMP_DIRECTION_TAIL);
+        if (pass == 1) {
+          wasmbox_block_add_jump(func, block, dest);
+        }
+      }
+    }
+    if (ctx->failed) {
+      return;
+    }
+  }
+  for (wasm_u16_t i = 0; i < func->block_size; ++i) {
+    func->blocks[i].direction = WASM_JUMP_DIRECTION_HEAD;
+  }
+}
+
+/**
+ * Orders the blocks so that the destination of each JUMP follows it where
+ * possible, and the JUMP is removed when the blocks are linked. Conditional
+ * successors are laid out depth first after the chain ends, which keeps loop
+ * bodies contiguous. Blocks which are not reachable anymore are emptied and
+ * moved to the end.
+ */
+static void wasmbox_layout_order_blocks(wasmbox_layout_context_t *ctx) {
+  wasmbox_mutable_function_t *func = ctx->func;
+  // The function starts with the block reached from block 0.
+  ctx->pending[ctx->pending_size++] = ctx->dest[0];
+  while (ctx->pending_size > 0) {
+    wasm_s32_t id = ctx->pending[--ctx->pending_size];
+    while (id >= 0 && !ctx->placed[id]) {
+      ctx->placed[id] = 1;
+      ctx->order[ctx->order_size++] = id;
+      wasmbox_block_t *block = &func->blocks[id];
+      id = -1;
+      for (int j = block->code_size - 1; j >= 0; --j) {
+        wasmbox_code_t *code = &block->code[j];
+        if (j == block->code_size - 1 && code->h.opcode == OPCODE_JUMP) {
+          id = code->op0.index;
+          continue;
+        }
+        // Pushed in reverse, so the first branch is laid out first.
+        wasmbox_code_visit_targets(func, code, wasmbox_visit_pending, ctx);
+      }
+    }
+  }
+  wasm_u16_t *new_id = ctx->pending;
+  for (wasm_u16_t i = 0; i < func->block_size; ++i) {
+    if (!ctx->placed[i]) {
+      func->blocks[i].code_size = 0;
+      ctx->order[ctx->order_size++] = i;
+    }
+  }
+  for (wasm_u16_t i = 0; i < func->block_size; ++i) {
+    new_id[ctx->order[i]] = i;
+  }
+  wasmbox_block_t *blocks = (wasmbox_block_t *) wasmbox_arena_alloc(
+      func->arena, sizeof(wasmbox_block_t) * func->block_capacity);
+  for (wasm_u16_t i = 0; i < func->block_size; ++i) {
+    wasmbox_block_t *block = &blocks[i];
+    *block = func->blocks[ctx->order[i]];
+    block->id = i;
+    for (wasm_u16_t j = 0; j < block->code_size; ++j) {
+      wasmbox_code_t *code = &block->code[j];
+      switch (code->h.opcode) {
+        case OPCODE_JUMP:
+        case OPCODE_JUMP_IF:
+#define FUNC(size, shift, vmopcode) case vmopcode:
+          MEMORY_GUARD_INST_EACH(FUNC)
+#undef FUNC
+          code->op0.index = new_id[code->op0.index];
+          break;
+        case OPCODE_JUMP_TABLE: {
+          wasmbox_table_t *table = wasmbox_code_get_table(func, code);
+          for (wasm_u32_t k = 0; k < table->size; ++k) {
+            table->block_ids[k] = new_id[table->block_ids[k]];
+          }
+          code->op1.index = new_id[code->op1.index];
+          break;
+        }
+        default:
+          break;
+      }
+    }
+  }
+  func->blocks = blocks;
+}
+
+static int wasmbox_code_is_jump_to(wasmbox_code_t *code, wasm_u32_t block_id) {
+  return (code->h.opcode == OPCODE_JUMP || code->h.opcode == OPCODE_JUMP_IF) &&
+         code->op0.index == block_id;
+}
+
+// Appends a block which inherits the labels of `src`, with room for
+// `code_size` instructions.
+static wasm_u16_t wasmbox_block_add_copy(wasmbox_mutable_function_t *func,
+                                         wasm_u16_t src,
+                                         wasm_u16_t code_size) {
+  if (func->block_size + 1 > func->block_capacity) {
+    func->blocks = (wasmbox_block_t *) wasmbox_arena_realloc(
+        func->arena, func->blocks,
+        sizeof(wasmbox_block_t) * func->block_capacity,
+        sizeof(wasmbox_block_t) * func->block_capacity * 2);
+    func->block_capacity *= 2;
+  }
+  wasm_u16_t id = func->block_size++;
+  wasmbox_block_t *block = &func->blocks[id];
+  *block = func->blocks[src];
+  block->id = id;
+  block->code = (wasmbox_code_t *) wasmbox_arena_alloc(
+      func->arena, sizeof(wasmbox_code_t) * code_size);
+  block->code_size = 0;
+  block->code_capacity = code_size;
+#ifdef WASMBOX_VM_USE_SAMPLING_PROFILE
+  block->offsets = (wasm_u32_t *) wasmbox_arena_alloc(
+      func->arena, sizeof(wasm_u32_t) * code_size);
+#endif
+#ifdef WASMBOX_VM_USE_LAZY_COMPILE
+  // Frames of the first tier continue in `src`.
+  block->loop = -1;
+#endif
+  return id;
+}
+
+// Redirects the branches to `from` from the blocks before `end` but `from`
+// itself to `to`.
+static void wasmbox_layout_redirect(wasmbox_layout_context_t *ctx,
+                                    wasm_u16_t from, wasm_u16_t to,
+                                    wasm_u16_t end) {
+  wasmbox_mutable_function_t *func = ctx->func;
+  if (ctx->dest[0] == from) {
+    ctx->dest[0] = to;
+  }
+  for (wasm_u16_t i = 0; i < end; ++i) {
+    wasmbox_block_t *block = &func->blocks[i];
+    if (i == from) {
+      continue;
+    }
+    for (wasm_u16_t j = 0; j < block->code_size; ++j) {
+      wasmbox_code_t *code = &block->code[j];
+      if (wasmbox_code_is_jump_to(code, from)) {
+        code->op0.index = to;
+      } else if (code->h.opcode == OPCODE_JUMP_TABLE) {
+        wasmbox_table_t *table = wasmbox_code_get_table(func, code);
+        for (wasm_u32_t k = 0; k < table->size; ++k) {
+          if (table->block_ids[k] == from) {
+            table->block_ids[k] = to;
+          }
+        }
+        if (code->op1.index == from) {
+          code->op1.index = to;
+        }
+      }
+    }
+  }
+}
+
+/* Reads hoisted out of a loop at most, each to a slot of its own. */
+#define WASMBOX_LOOP_HOIST_MAX (8)
+
+/**
+ * Returns 1 if nothing changes globals or the size of memories and tables
+ * while the single-block loop `block` runs, but its own instructions: it
+ * neither calls a function nor gives control back to the host for fuel or
+ * an epoch, after which the host may have changed them.
+ */
+static int wasmbox_loop_is_closed(wasmbox_block_t *block) {
+  int loop = 0;
+  for (wasm_u16_t j = 0; j < block->code_size; ++j) {
+    wasmbox_code_t *code = &block->code[j];
+    if (wasmbox_code_is_call(code) || code->h.opcode == OPCODE_FUEL ||
+        code->h.opcode == OPCODE_EPOCH) {
+      return 0;
+    }
+    loop |= wasmbox_code_is_jump_to(code, block->id);
+  }
+  return loop;
+}
+
+// Returns 1 if `code` reads a value which no instruction of the closed loop
+// `block` changes: a global it does not set, or the size of a memory or a
+// table it does not grow.
+static int wasmbox_loop_is_invariant(wasmbox_mutable_function_t *func,
+                                     wasmbox_block_t *block,
+                                     wasmbox_code_t *code) {
+  if (code->h.opcode == OPCODE_MEMORY_SIZE && func->shared_memory) {
+    return 0;
+  }
+  for (wasm_u16_t j = 0; j < block->code_size; ++j) {
+    wasmbox_code_t *other = &block->code[j];
+    switch (code->h.opcode) {
+      case OPCODE_GLOBAL_GET:
+        if (other->h.opcode == OPCODE_GLOBAL_SET &&
+            other->op0.index == code->op1.index) {
+          return 0;
+        }
+        break;
+      case OPCODE_MEMORY_SIZE:
+        if (other->h.opcode == OPCODE_MEMORY_GROW) {
+          return 0;
+        }
+        break;
+      case OPCODE_TABLE_SIZE:
+        if (other->h.opcode == OPCODE_TABLE_GROW &&
+            other->op2.index == code->op2.index) {
+          return 0;
+        }
+        break;
+      default:
+        return 0;
+    }
+  }
+  return 1;
+}
+
+/**
+ * Moves the reads of globals and of the size of memories and tables, which a
+ * single-block loop does not change, to a block run once before it. Their
+ * results are kept in slots above the frame, which the reads of the results
+ * in the loop read instead. A result still read once the loop is left or on
+ * its next iteration stays in the loop. The slots are only live from that
+ * block to the end of the loop, so the loops of a function share them.
+ *                          | BB3: GLOBAL_GET r9 g1
+ *                          |      JUMP BB1
+ * BB1: GLOBAL_GET r5 g1    | BB1: I32_ADD r2 r2 r9
+ *      I32_ADD r2 r2 r5    |      ..
+ *      ..                  |      JUMP_IF BB1 r4
+ *      JUMP_IF BB1 r4      |
+ * Branches into the loop from other blocks go to the new block.
+ */
+static void wasmbox_layout_hoist_invariants(wasmbox_layout_context_t *ctx) {
+  wasmbox_mutable_function_t *func = ctx->func;
+  wasm_u16_t block_size = func->block_size;
+  wasmbox_copy_context_t copy = {};
+  // The reads of the results are renamed first, as the liveness is only
+  // known for the blocks which the function has so far.
+  wasm_u8_t **hoisted = NULL;
+  wasm_s32_t first_slot = 0;
+  wasm_u16_t loop_size = 0;
+  for (wasm_u16_t i = 0; i < block_size; ++i) {
+    wasmbox_block_t *block = &func->blocks[i];
+    if (block_size + loop_size + 1 > WASM_S16_MAX ||
+        !wasmbox_loop_is_closed(block)) {
+      continue;
+    }
+    wasm_u16_t size = 0;
+    for (wasm_u16_t j = 0; j < block->code_size; ++j) {
+      wasmbox_code_t *code = &block->code[j];
+      // Results of the function are read once it returns.
+      if (size == WASMBOX_LOOP_HOIST_MAX || code->op0.reg < 0 ||
+          !wasmbox_loop_is_invariant(func, block, code)) {
+        continue;
+      }
+      if (hoisted == NULL) {
+        if (wasmbox_copy_context_init(&copy, func) != 0 ||
+            copy.max_slot + 1 + WASMBOX_LOOP_HOIST_MAX > WASM_S16_MAX) {
+          return;
+        }
+        hoisted = (wasm_u8_t **) wasmbox_function_scratch(
+            func, sizeof(wasm_u8_t *) * block_size);
+        first_slot = copy.max_slot + 1;
+      }
+      if (wasmbox_rename_uses_after_move(&copy, block, j, code->op0.reg,
+                                         first_slot + size) != 0) {
+        continue;
+      }
+      if (hoisted[i] == NULL) {
+        hoisted[i] =
+            (wasm_u8_t *) wasmbox_function_scratch(func, block->code_size);
+        loop_size++;
+      }
+      hoisted[i][j] = 1;
+      size++;
+    }
+  }
+  for (wasm_u16_t i = 0; hoisted != NULL && i < block_size; ++i) {
+    if (hoisted[i] == NULL) {
+      continue;
+    }
+    wasm_u16_t size = 0;
+    for (wasm_u16_t j = 0; j < func->blocks[i].code_size; ++j) {
+      size += hoisted[i][j];
+    }
+    wasm_u16_t head_id = wasmbox_block_add_copy(func, i, size + 1);
+    wasmbox_block_t *block = &func->blocks[i];
+    wasmbox_block_t *head = &func->blocks[head_id];
+#ifdef WASMBOX_VM_USE_LAZY_COMPILE
+    // Frames of the first tier continue before the loop, to fill the slots.
+    head->loop = block->loop;
+    block->loop = -1;
+#endif
+    wasmbox_layout_redirect(ctx, i, head_id, head_id);
+    for (wasm_u16_t j = 0; j < block->code_size; ++j) {
+      if (!hoisted[i][j]) {
+        continue;
+      }
+#ifdef WASMBOX_VM_USE_SAMPLING_PROFILE
+      head->offsets[head->code_size] = block->offsets[j];
+#endif
+      wasmbox_code_t *code = &head->code[head->code_size];
+      *code = block->code[j];
+      code->op0.reg = first_slot + head->code_size++;
+      block->code[j].h.opcode = OPCODE_NOP;
+    }
+    if (func->base.frame_size < first_slot + size) {
+      func->base.frame_size = first_slot + size;
+    }
+    wasmbox_block_remove_nop(block);
+    wasmbox_block_add_jump(func, head, i);
+  }
+}
+
+#ifndef WASMBOX_MEMORY_USE_RESERVATION
+/* Loops whose accesses are checked once before them. A loop is copied, so
+ * only short ones are. */
+#  define WASMBOX_LOOP_GUARD_CODE_MAX (256)
+/* Bounds a loop is guarded by at most. Further accesses keep their checks. */
+#  define WASMBOX_LOOP_GUARD_MAX (4)
+
+/* Accesses indexed by `counter`, which is below `limit` wherever they run,
+ * with the bytes they touch ending `end` past the scaled index. */
+typedef struct wasmbox_loop_guard_t {
+  wasmbox_code_reg_t counter;
+  wasmbox_code_reg_t limit;
+  wasm_u16_t opcode;
+  wasm_u32_t end;
+} wasmbox_loop_guard_t;
+
+static wasmbox_value_t wasmbox_code_get_value(wasmbox_mutable_function_t *func,
+                                              union wasmbox_code_operands *op) {
+#  ifdef WASMBOX_VM_USE_COMPACT_CODE
+  return func->constants[op->index].value;
+#  else
+  (void) func;
+  return op->value;
+#  endif
+}
+
+// Returns 1 if an instruction of `block` in [from, to) may write `slot`.
+static int wasmbox_block_modifies(wasmbox_mutable_function_t *func,
+                                  wasmbox_block_t *block, wasm_s32_t from,
+                                  wasm_s32_t to, wasm_s32_t slot) {
+  for (wasm_s32_t j = from; j < to; ++j) {
+    wasmbox_code_t *code = &block->code[j];
+    wasmbox_slot_counter_t counter = {slot, 0};
+    if (wasmbox_code_visit_defs(func, code, wasmbox_visit_count, &counter) ||
+        counter.count > 0 || wasmbox_code_clobbers(code, slot)) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/**
+ * Finds the increment of a counted loop whose body repeats while the counter
+ * is below a limit, and returns its index in `block` or -1.
+ * I32_ADD_IMM r2 r2 1
+ * I32_LT_U r4 r2 r3
+ * JUMP_IF BB1 r4
+ * The counter is written there only, so before it the counter is either the
+ * one the loop is entered with or one which passed the test. Counting by one
+ * is required unless the test is unsigned, as the counter may pass the limit.
+ */
+static wasm_s32_t wasmbox_loop_find_increment(wasmbox_mutable_function_t *func,
+                                              wasmbox_block_t *block,
+                                              wasmbox_code_reg_t *counter,
+                                              wasmbox_code_reg_t *limit) {
+  for (wasm_s32_t k = 0; k + 2 < block->code_size; ++k) {
+    wasmbox_code_t *inc = &block->code[k];
+    wasmbox_code_t *cmp = &block->code[k + 1];
+    wasmbox_code_t *br = &block->code[k + 2];
+    wasmbox_code_reg_t reg = inc->op0.reg;
+    if (inc->h.opcode != OPCODE_I32_ADD_IMM || inc->op1.reg != reg ||
+        (cmp->h.opcode != OPCODE_I32_LT_U &&
+         cmp->h.opcode != OPCODE_I32_LT_S && cmp->h.opcode != OPCODE_I32_NE) ||
+        cmp->op1.reg != reg || cmp->op2.reg == reg || cmp->op0.reg == reg ||
+        !wasmbox_code_is_jump_to(br, block->id) ||
+        br->h.opcode != OPCODE_JUMP_IF || br->op1.reg != cmp->op0.reg) {
+      continue;
+    }
+    if (cmp->h.opcode != OPCODE_I32_LT_U &&
+        wasmbox_code_get_value(func, &inc->op2).u32 != 1) {
+      return -1;
+    }
+    if (wasmbox_block_modifies(func, block, 0, k, reg) ||
+        wasmbox_block_modifies(func, block, k + 1, block->code_size, reg)) {
+      return -1;
+    }
+    // Repeating after the test failed would run with an unchecked counter.
+    for (wasm_s32_t j = k + 3; j < block->code_size; ++j) {
+      if (wasmbox_code_is_jump_to(&block->code[j], block->id)) {
+        return -1;
+      }
+    }
+    *counter = reg;
+    *limit = cmp->op2.reg;
+    return k;
+  }
+  return -1;
+}
+
+/**
+ * Returns the slot which `counter` is below at the instruction `j` of
+ * `block`, tested by a branch leaving the loop before it, or -1.
+ * I32_GE_U r4 r2 r3
+ * JUMP_IF BB2 r4
+ */
+static wasm_s32_t wasmbox_loop_find_exit_test(wasmbox_mutable_function_t *func,
+                                              wasmbox_block_t *block,
+                                              wasm_s32_t j,
+                                              wasmbox_code_reg_t counter) {
+  for (wasm_s32_t q = j - 1; q > 0; --q) {
+    wasmbox_code_t *br = &block->code[q];
+    wasmbox_code_t *cmp = &block->code[q - 1];
+    if (br->h.opcode == OPCODE_JUMP_IF && cmp->op0.reg == br->op1.reg &&
+        cmp->op0.reg != counter) {
+      if (cmp->h.opcode == OPCODE_I32_GE_U && cmp->op1.reg == counter) {
+        return cmp->op2.reg;
+      }
+      if (cmp->h.opcode == OPCODE_I32_LE_U && cmp->op2.reg == counter) {
+        return cmp->op1.reg;
+      }
+    }
+    if (wasmbox_block_modifies(func, block, q, q + 1, counter)) {
+      return -1;
+    }
+  }
+  return -1;
+}
+
+// Returns the constant held by `slot` at the instruction `j` of `block`,
+// which is loaded before it in the block, or -1.
+static wasm_s64_t wasmbox_block_find_base(wasmbox_mutable_function_t *func,
+                                          wasmbox_block_t *block, wasm_s32_t j,
+                                          wasmbox_code_reg_t slot) {
+  for (wasm_s32_t q = j - 1; q >= 0; --q) {
+    wasmbox_code_t *code = &block->code[q];
+    if (code->h.opcode == OPCODE_LOAD_CONST_I32 && code->op0.reg == slot) {
+      return wasmbox_code_get_value(func, &code->op1).u32;
+    }
+    if (wasmbox_block_modifies(func, block, q, q + 1, slot)) {
+      return -1;
+    }
+  }
+  return -1;
+}
+
+static int wasmbox_indexed_unchecked_opcode(wasm_u16_t opcode,
+                                            wasm_u32_t *size) {
+  switch (opcode) {
+#  define FUNC(inst, mtype, field, unfused, vmopcode) \
+    case vmopcode:                                    \
+      *size = sizeof(mtype);                          \
+      return OPCODE_##unfused##_INDEXED_UNCHECKED;
+    INDEXED_MEMORY_INST_EACH(FUNC)
+#  undef FUNC
+    default:
+      return -1;
+  }
+}
+
+static int wasmbox_memory_guard_opcode(wasm_u32_t shift) {
+  switch (shift) {
+#  define FUNC(size, shift, vmopcode) \
+    case shift:                       \
+      return vmopcode;
+    MEMORY_GUARD_INST_EACH(FUNC)
+#  undef FUNC
+    default:
+      return -1;
+  }
+}
+
+/**
+ * Finds the indexed accesses of the loop `block` whose index is below a
+ * loop-invariant limit and whose base is a constant. Marks them in
+ * `unchecked` with their unchecked opcode and returns the number of guards
+ * they need.
+ */
+static wasm_u32_t wasmbox_loop_find_guards(wasmbox_mutable_function_t *func,
+                                           wasmbox_block_t *block,
+                                           wasmbox_loop_guard_t *guards,
+                                           wasm_u16_t *unchecked) {
+  wasm_u32_t guard_size = 0;
+  wasmbox_code_reg_t inc_counter = 0;
+  wasmbox_code_reg_t inc_limit = 0;
+  wasm_s32_t inc =
+      wasmbox_loop_find_increment(func, block, &inc_counter, &inc_limit);
+  for (wasm_s32_t j = 0; j < block->code_size; ++j) {
+    wasmbox_code_t *code = &block->code[j];
+    wasm_u32_t size;
+    int opcode = wasmbox_indexed_unchecked_opcode(code->h.opcode, &size);
+    int guard_opcode = wasmbox_memory_guard_opcode(code->op0.r.reg2);
+    wasmbox_code_reg_t counter = code->op1.r.reg2;
+    if (opcode < 0 || guard_opcode < 0 || code->op1.r.reg1 == counter) {
+      continue;
+    }
+    wasm_s32_t limit =
+        wasmbox_loop_find_exit_test(func, block, j, counter);
+    if (limit < 0 && j < inc && counter == inc_counter) {
+      limit = inc_limit;
+    }
+    if (limit < 0 || limit == counter ||
+        wasmbox_block_modifies(func, block, 0, block->code_size, limit)) {
+      continue;
+    }
+    wasm_s64_t base =
+        wasmbox_block_find_base(func, block, j, code->op1.r.reg1);
+    if (base < 0) {
+      continue;
+    }
+    wasm_u64_t end = (wasm_u64_t) base + code->op2.index + size;
+    if (end > UINT32_MAX) {
+      continue;
+    }
+    wasm_u32_t k = 0;
+    while (k < guard_size &&
+           (guards[k].counter != counter || guards[k].limit != limit ||
+            guards[k].opcode != guard_opcode)) {
+      ++k;
+    }
+    if (k == guard_size) {
+      if (guard_size == WASMBOX_LOOP_GUARD_MAX) {
+        continue;
+      }
+      guards[k].counter = counter;
+      guards[k].limit = (wasmbox_code_reg_t) limit;
+      guards[k].opcode = guard_opcode;
+      guards[k].end = 0;
+      guard_size++;
+    }
+    if (guards[k].end < end) {
+      guards[k].end = (wasm_u32_t) end;
+    }
+    unchecked[j] = opcode;
+  }
+  return guard_size;
+}
+
+/**
+ * Checks the bounds of the indexed accesses of a single-block loop once
+ * before it, where memory needs explicit checks. The memory never shrinks,
+ * so accesses proven in bounds on entry stay so. The loop is copied with
+ * unchecked accesses, and the guard enters the copy, or the original loop if
+ * an access might be out of bounds, which traps at the same point as before.
+ *                          | BB3: MEMORY_GUARD_4 BB1 r2 r3 28
+ *                          |      JUMP BB4
+ * BB1: I32_GE_U r4 r2 r3   | BB1: I32_GE_U r4 r2 r3
+ *      JUMP_IF BB2 r4      |      JUMP_IF BB2 r4
+ *      I32_LOAD_INDEXED .. |      I32_LOAD_INDEXED ..
+ *      JUMP BB1            |      JUMP BB1
+ *                          | BB4: (BB1 with unchecked accesses, to BB4)
+ * Branches into the loop from other blocks go to the guard.
+ */
+static void wasmbox_layout_guard_loops(wasmbox_layout_context_t *ctx) {
+  wasmbox_mutable_function_t *func = ctx->func;
+  wasm_u16_t block_size = func->block_size;
+  wasm_u16_t *unchecked = (wasm_u16_t *) wasmbox_function_scratch(
+      func, sizeof(wasm_u16_t) * WASMBOX_LOOP_GUARD_CODE_MAX);
+  for (wasm_u16_t i = 0; i < block_size; ++i) {
+    wasmbox_block_t *block = &func->blocks[i];
+    if (block->code_size == 0 ||
+        block->code_size > WASMBOX_LOOP_GUARD_CODE_MAX ||
+        func->block_size + 2 > WASM_S16_MAX) {
+      continue;
+    }
+    int loop = 0;
+    for (wasm_u16_t j = 0; j < block->code_size; ++j) {
+      wasmbox_code_t *code = &block->code[j];
+      wasmbox_slot_counter_t counter = {0, 0};
+      if (code->h.opcode == OPCODE_JUMP_TABLE ||
+          wasmbox_code_visit_defs(func, code, wasmbox_visit_count,
+                                  &counter)) {
+        loop = 0;
+        break;
+      }
+      loop |= wasmbox_code_is_jump_to(code, i);
+    }
+    if (!loop) {
+      continue;
+    }
+    wasmbox_loop_guard_t guards[WASMBOX_LOOP_GUARD_MAX];
+    memset(unchecked, 0, sizeof(wasm_u16_t) * block->code_size);
+    wasm_u32_t guard_size =
+        wasmbox_loop_find_guards(func, block, guards, unchecked);
+    if (guard_size == 0) {
+      continue;
+    }
+    wasm_u16_t copy_id = wasmbox_block_add_copy(func, i, block->code_size);
+    wasm_u16_t guard_id = wasmbox_block_add_copy(func, i, guard_size + 1);
+    block = &func->blocks[i];
+    wasmbox_block_t *copy = &func->blocks[copy_id];
+    wasmbox_block_t *guard = &func->blocks[guard_id];
+    wasmbox_layout_redirect(ctx, i, guard_id, copy_id);
+    for (wasm_u16_t j = 0; j < block->code_size; ++j) {
+#ifdef WASMBOX_VM_USE_SAMPLING_PROFILE
+      copy->offsets[copy->code_size] = block->offsets[j];
+#endif
+      wasmbox_code_t *code = &copy->code[copy->code_size++];
+      *code = block->code[j];
+      if (wasmbox_code_is_jump_to(code, i)) {
+        code->op0.index = copy_id;
+      } else if (unchecked[j] != 0) {
+        code->h.opcode = unchecked[j];
+      }
+    }
+    for (wasm_u32_t k = 0; k < guard_size; ++k) {
+#ifdef WASMBOX_VM_USE_SAMPLING_PROFILE
+      // The guards check the accesses of the loop on entering it.
+      guard->offsets[guard->code_size] = block->offsets[0];
+#endif
+      wasmbox_code_t *code = &guard->code[guard->code_size++];
+      code->h.opcode = guards[k].opcode;
+      code->op0.index = i;
+      code->op1.r.reg1 = guards[k].counter;
+      code->op1.r.reg2 = guards[k].limit;
+      code->op2.index = guards[k].end;
+    }
+    wasmbox_block_add_jump(func, guard, copy_id);
+  }
+}
+#endif /* WASMBOX_MEMORY_USE_RESERVATION */
+
+static void wasmbox_layout_blocks(wasmbox_mutable_function_t *func) {
+  if (func->block_size == 0) {
+    return;
+  }
+  wasmbox_layout_context_t ctx = {};
+  ctx.func = func;
+  ctx.dest = (wasm_s32_t *) wasmbox_function_scratch(
+      func, sizeof(wasm_s32_t) * func->block_size);
+  for (wasm_u16_t i = 0; i < func->block_size; ++i) {
+    ctx.dest[i] = wasmbox_block_resolve(func, i);
+  }
+  if (ctx.dest[0] >= 0) {
+    wasmbox_layout_thread_jumps(&ctx);
+  }
+  if (ctx.dest[0] >= 0 && !ctx.failed) {
+    wasmbox_layout_hoist_invariants(&ctx);
+#ifndef WASMBOX_MEMORY_USE_RESERVATION
+    wasmbox_layout_guard_loops(&ctx);
+#endif
+    // A block is pushed at most once per branch to it.
+    wasm_u32_t branches = 1;
+    for (wasm_u16_t i = 0; i < func->block_size; ++i) {
+      branches += func->blocks[i].code_size;
+      for (wasm_u16_t j = 0; j < func->blocks[i].code_size; ++j) {
+        wasmbox_code_t *code = &func->blocks[i].code[j];
+        if (code->h.opcode == OPCODE_JUMP_TABLE) {
+          branches += wasmbox_code_get_table(func, code)->size;
+        }
+      }
+    }
+    if (branches < func->block_size) {
+      branches = func->block_size;
+    }
+    ctx.pending = (wasm_u16_t *) wasmbox_function_scratch(
+        func, sizeof(wasm_u16_t) * branches);
+    ctx.order = (wasm_u16_t *) wasmbox_function_scratch(
+        func, sizeof(wasm_u16_t) * func->block_size);
+    ctx.placed = (wasm_u8_t *) wasmbox_function_scratch(func, func->block_size);
+    wasmbox_layout_order_blocks(&ctx);
+  }
+}
+
+/* Folds a binary instruction (r = a <op> b). */
+#define FOLD_BINARY_EACH(FOLD)                                   \
+  FOLD(I32_ADD, I32, u32, a.u32 + b.u32)                         \
+  FOLD(I32_SUB, I32, u32, a.u32 - b.u32)                         \
+  FOLD(I32_MUL, I32, u32, a.u32 * b.u32)                         \
+  FOLD(I32_AND, I32, u32, a.u32 & b.u32)                         \
+  FOLD(I32_OR, I32, u32, a.u32 | b.u32)                          \
+  FOLD(I32_XOR, I32, u32, a.u32 ^ b.u32)                         \
+  FOLD(I32_SHL, I32, u32, a.u32 << (b.u32 & 31))                 \
+  FOLD(I32_SHR_S, I32, s32, a.s32 >> (b.u32 & 31))               \
+  FOLD(I32_SHR_U, I32, u32, a.u32 >> (b.u32 & 31))               \
+  FOLD(I32_ROTL, I32, u32,                                       \
+       (a.u32 << (b.u32 & 31)) | (a.u32 >> ((32 - b.u32) & 31))) \
+  FOLD(I32_ROTR, I32, u32,                                       \
+       (a.u32 >> (b.u32 & 31)) | (a.u32 << ((32 - b.u32) & 31))) \
+  FOLD(I32_EQ, I32, u32, a.u32 == b.u32)                         \
+  FOLD(I32_NE, I32, u32, a.u32 != b.u32)                         \
+  FOLD(I32_LT_S, I32, u32, a.s32 < b.s32)                        \
+  FOLD(I32_LT_U, I32, u32, a.u32 < b.u32)                        \
+  FOLD(I32_GT_S, I32, u32, a.s32 > b.s32)                        \
+  FOLD(I32_GT_U, I32, u32, a.u32 > b.u32)                        \
+  FOLD(I32_LE_S, I32, u32, a.s32 <= b.s32)                       \
+  FOLD(I32_LE_U, I32, u32, a.u32 <= b.u32)                       \
+  FOLD(I32_GE_S, I32, u32, a.s32 >= b.s32)                       \
+  FOLD(I32_GE_U, I32, u32, a.u32 >= b.u32)                       \
+  FOLD(I64_ADD, I64, u64, a.u64 + b.u64)                         \
+  FOLD(I64_SUB, I64, u64, a.u64 - b.u64)                         \
+  FOLD(I64_MUL, I64, u64, a.u64 * b.u64)                         \
+  FOLD(I64_AND, I64, u64, a.u64 & b.u64)                         \
+  FOLD(I64_OR, I64, u64, a.u64 | b.u64)                          \
+  FOLD(I64_XOR, I64, u64, a.u64 ^ b.u64)                         \
+  FOLD(I64_SHL, I64, u64, a.u64 << (b.u64 & 63))                 \
+  FOLD(I64_SHR_S, I64, s64, a.s64 >> (b.u64 & 63))               \
+  FOLD(I64_SHR_U, I64, u64, a.u64 >> (b.u64 & 63))               \
+  FOLD(I64_ROTL, I64, u64,                                       \
+       (a.u64 << (b.u64 & 63)) | (a.u64 >> ((64 - b.u64) & 63))) \
+  FOLD(I64_ROTR, I64, u64,                                       \
+       (a.u64 >> (b.u64 & 63)) | (a.u64 << ((64 - b.u64) & 63))) \
+  FOLD(I64_EQ, I32, u32, a.u64 == b.u64)                         \
+  FOLD(I64_NE, I32, u32, a.u64 != b.u64)                         \
+  FOLD(I64_LT_S, I32, u32, a.s64 < b.s64)                        \
+  FOLD(I64_LT_U, I32, u32, a.u64 < b.u64)                        \
+  FOLD(I64_GT_S, I32, u32, a.s64 > b.s64)                        \
+  FOLD(I64_GT_U, I32, u32, a.u64 > b.u64)                        \
+  FOLD(I64_LE_S, I32, u32, a.s64 <= b.s64)                       \
+  FOLD(I64_LE_U, I32, u32, a.u64 <= b.u64)                       \
+  FOLD(I64_GE_S, I32, u32, a.s64 >= b.s64)                       \
+  FOLD(I64_GE_U, I32, u32, a.u64 >= b.u64)                       \
+  FOLD(F32_ADD, F32, f32, a.f32 + b.f32)                         \
+  FOLD(F32_SUB, F32, f32, a.f32 - b.f32)                         \
+  FOLD(F32_MUL, F32, f32, a.f32 * b.f32)                         \
+  FOLD(F32_DIV, F32, f32, a.f32 / b.f32)                         \
+  FOLD(F32_EQ, I32, u32, a.f32 == b.f32)                         \
+  FOLD(F32_NE, I32, u32, a.f32 != b.f32)                         \
+  FOLD(F32_LT, I32, u32, a.f32 < b.f32)                          \
+  FOLD(F32_GT, I32, u32, a.f32 > b.f32)                          \
+  FOLD(F32_LE, I32, u32, a.f32 <= b.f32)                         \
+  FOLD(F32_GE, I32, u32, a.f32 >= b.f32)                         \
+  FOLD(F64_ADD, F64, f64, a.f64 + b.f64)                         \
+  FOLD(F64_SUB, F64, f64, a.f64 - b.f64)                         \
+  FOLD(F64_MUL, F64, f64, a.f64 * b.f64)                         \
+  FOLD(F64_DIV, F64, f64, a.f64 / b.f64)                         \
+  FOLD(F64_EQ, I32, u32, a.f64 == b.f64)                         \
+  FOLD(F64_NE, I32, u32, a.f64 != b.f64)                         \
+  FOLD(F64_LT, I32, u32, a.f64 < b.f64)                          \
+  FOLD(F64_GT, I32, u32, a.f64 > b.f64)                          \
+  FOLD(F64_LE, I32, u32, a.f64 <= b.f64)                         \
+  FOLD(F64_GE, I32, u32, a.f64 >= b.f64)
+
+/* Folds a unary instruction (r = <op> a). */
+#define FOLD_UNARY_EACH(FOLD)                                  \
+  FOLD(I32_EQZ, I32, u32, a.u32 == 0)                          \
+  FOLD(I64_EQZ, I32, u32, a.u64 == 0)                          \
+  FOLD(WRAP_I64, I32, u32, (wasm_u32_t) a.u64)                 \
+  FOLD(I32_EXTEND8_S, I32, s32, (wasm_s8_t) a.u32)             \
+  FOLD(I32_EXTEND16_S, I32, s32, (wasm_s16_t) a.u32)           \
+  FOLD(I64_EXTEND8_S, I64, s64, (wasm_s8_t) a.u64)             \
+  FOLD(I64_EXTEND16_S, I64, s64, (wasm_s16_t) a.u64)           \
+  FOLD(I64_EXTEND32_S, I64, s64, (wasm_s32_t) a.u64)           \
+  FOLD(I64_EXTEND_I32_S, I64, s64, a.s32)                      \
+  FOLD(I64_EXTEND_I32_U, I64, u64, a.u32)                      \
+  FOLD(F32_DEMOTE_F64, F32, f32, (wasm_f32_t) a.f64)           \
+  FOLD(F64_PROMOTE_F32, F64, f64, a.f32)                       \
+  FOLD(I32_REINTERPRET_F32, I32, u32, a.u32)                   \
+  FOLD(I64_REINTERPRET_F64, I64, u64, a.u64)                   \
+  FOLD(F32_REINTERPRET_I32, F32, u32, a.u32)                   \
+  FOLD(F64_REINTERPRET_I64, F64, u64, a.u64)
+
+#define FOLD(INST, TYPE, FIELD, EXPR) \
+  case OPCODE_##INST:                 \
+    result->FIELD = (EXPR);           \
+    return OPCODE_LOAD_CONST_##TYPE;
+
+int wasmbox_fold_binary_op(int vmopcode, wasmbox_value_t a, wasmbox_value_t b,
+                           wasmbox_value_t *result) {
+  result->u64 = 0;
+  switch (vmopcode) {
+    FOLD_BINARY_EACH(FOLD)
+    // Division is folded only if it does not trap.
+    case OPCODE_I32_DIV_S:
+      if (b.s32 == 0 || (a.s32 == INT32_MIN && b.s32 == -1)) {
+        return -1;
+      }
+      result->s32 = a.s32 / b.s32;
+      return OPCODE_LOAD_CONST_I32;
+    case OPCODE_I32_REM_S:
+      if (b.s32 == 0) {
+        return -1;
+      }
+      // A remainder by -1 is 0, also of the minimum where C overflows.
+      result->s32 = b.s32 == -1 ? 0 : a.s32 % b.s32;
+      return OPCODE_LOAD_CONST_I32;
+    case OPCODE_I32_DIV_U:
+    case OPCODE_I32_REM_U:
+      if (b.u32 == 0) {
+        return -1;
+      }
+      result->u32 = vmopcode == OPCODE_I32_DIV_U ? a.u32 / b.u32 : a.u32 % b.u32;
+      return OPCODE_LOAD_CONST_I32;
+    case OPCODE_I64_DIV_S:
+      if (b.s64 == 0 || (a.s64 == INT64_MIN && b.s64 == -1)) {
+        return -1;
+      }
+      result->s64 = a.s64 / b.s64;
+      return OPCODE_LOAD_CONST_I64;
+    case OPCODE_I64_REM_S:
+      if (b.s64 == 0) {
+        return -1;
+      }
+      // A remainder by -1 is 0, also of the minimum where C overflows.
+      result->s64 = b.s64 == -1 ? 0 : a.s64 % b.s64;
+      return OPCODE_LOAD_CONST_I64;
+    case OPCODE_I64_DIV_U:
+    case OPCODE_I64_REM_U:
+      if (b.u64 == 0) {
+        return -1;
+      }
+      result->u64 = vmopcode == OPCODE_I64_DIV_U ? a.u64 / b.u64 : a.u64 % b.u64;
+      return OPCODE_LOAD_CONST_I64;
+    default:
+      return -1;
+  }
+}
+
+int wasmbox_fold_unary_op(int vmopcode, wasmbox_value_t a,
+                          wasmbox_value_t *result) {
+  result->u64 = 0;
+  switch (vmopcode) {
+    FOLD_UNARY_EACH(FOLD)
+    default:
+      return -1;
+  }
+}
+#undef FOLD
+
+typedef struct wasmbox_relocate_context_t {
+  wasm_s32_t from;
+  wasm_s32_t delta;
+} wasmbox_relocate_context_t;
+
+static void wasmbox_visit_relocate(wasmbox_code_reg_t *operand,
+                                   wasm_s32_t slot, void *data) {
+  wasmbox_relocate_context_t *ctx = (wasmbox_relocate_context_t *) data;
+  if (operand != NULL && slot >= ctx->from) {
+    *operand = slot + ctx->delta;
+  }
+}
+
+int wasmbox_code_relocate_slots(wasmbox_mutable_function_t *func,
+                                wasmbox_code_t *code, wasm_s32_t from,
+                                wasm_s32_t delta) {
+  if (wasmbox_code_is_call(code)) {
+    // Arguments are addressed relative to the frame of the callee.
+    return -1;
+  }
+  wasmbox_relocate_context_t ctx = {from, delta};
+  if (wasmbox_code_visit_uses(func, code, wasmbox_visit_relocate, &ctx) ||
+      wasmbox_code_visit_defs(func, code, wasmbox_visit_relocate, &ctx)) {
+    return -1;
+  }
+  return 0;
+}
+
+int wasmbox_block_reads_after(wasmbox_mutable_function_t *func,
+                              wasmbox_block_t *block, wasm_u16_t index,
+                              wasm_s32_t slot) {
+  for (wasm_u16_t i = index + 1; i < block->code_size; ++i) {
+    wasmbox_code_t *code = &block->code[i];
+    wasmbox_slot_counter_t uses = {slot, 0};
+    wasmbox_slot_counter_t defs = {slot, 0};
+    if (wasmbox_code_visit_uses(func, code, wasmbox_visit_count, &uses) ||
+        wasmbox_code_visit_defs(func, code, wasmbox_visit_count, &defs) ||
+        uses.count > 0) {
+      return 1;
+    }
+    if (wasmbox_code_is_unconditional_branch(code) || defs.count > 0 ||
+        wasmbox_code_clobbers(code, slot)) {
+      return 0;
+    }
+  }
+  return 0;
+}
+
+typedef struct wasmbox_def_check_context_t {
+  wasm_s32_t min_slot;
+  int ok;
+} wasmbox_def_check_context_t;
+
+static void wasmbox_visit_check_def(wasmbox_code_reg_t *operand,
+                                    wasm_s32_t slot, void *data) {
+  wasmbox_def_check_context_t *ctx = (wasmbox_def_check_context_t *) data;
+  if (slot < ctx->min_slot) {
+    ctx->ok = 0;
+  }
+}
+
+#define CASE_OF(INST, TYPE, FIELD, EXPR) case OPCODE_##INST:
+int wasmbox_code_is_speculatable(wasmbox_mutable_function_t *func,
+                                 wasmbox_code_t *code, wasm_s32_t min_slot) {
+  switch (code->h.opcode) {
+    case OPCODE_NOP:
+    case OPCODE_MOVE:
+    case OPCODE_SELECT:
+    case OPCODE_GLOBAL_GET:
+    case OPCODE_STACK_POINTER_GET:
+#define FUNC(opcode, type, inst, attr, vmopcode) case vmopcode:
+      CONST_OP_EACH(FUNC)
+#undef FUNC
+#define FUNC(wtype, type, operand, inst, vmopcode) case vmopcode:
+      IMMEDIATE_INST_EACH(FUNC)
+#undef FUNC
+#define FUNC(type, operand, inst, vmopcode) case vmopcode:
+      DIVISION_MAGIC_INST_EACH(FUNC)
+#undef FUNC
+      // Folded instructions neither trap nor touch memory.
+      FOLD_BINARY_EACH(CASE_OF)
+      FOLD_UNARY_EACH(CASE_OF)
+      break;
+    default:
+      return 0;
+  }
+  wasmbox_def_check_context_t ctx = {min_slot, 1};
+  wasmbox_code_visit_defs(func, code, wasmbox_visit_check_def, &ctx);
+  return ctx.ok;
+}
+#undef CASE_OF
+
+void wasmbox_optimize_function(wasmbox_mutable_function_t *func) {
+  if (func->base.type == NULL) {
+    // Constant expressions are evaluated only once.
+    return;
+  }
+  wasmbox_remove_dead_blocks(func);
+  wasmbox_eliminate_moves(func);
+  wasmbox_narrow_zero_locals(func);
+  wasmbox_layout_blocks(func);
+}
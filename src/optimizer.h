@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) 2021 Masahiro Ide
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef WASMBOX_OPTIMIZER_H
+#define WASMBOX_OPTIMIZER_H
+
+#include "opcodes.h"
+#include "wasmbox/wasmbox.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Rewrites the per-block code of `func` before it is linked. Instructions
+ * which become redundant are removed from the blocks.
+ */
+void wasmbox_optimize_function(wasmbox_mutable_function_t *func);
+
+/**
+ * Evaluates the instruction `vmopcode` on constant operands. Returns the
+ * OPCODE_LOAD_CONST_* instruction which loads `result`, or -1 if the
+ * instruction cannot be folded (e.g. a division which would trap).
+ */
+int wasmbox_fold_binary_op(int vmopcode, wasmbox_value_t a, wasmbox_value_t b,
+                           wasmbox_value_t *result);
+int wasmbox_fold_unary_op(int vmopcode, wasmbox_value_t a,
+                          wasmbox_value_t *result);
+
+/**
+ * Adds `delta` to every frame slot from `from` that `code` reads or writes.
+ * Returns -1 if the operands of `code` are unknown or include implicit slots
+ * (e.g. calls).
+ */
+int wasmbox_code_relocate_slots(wasmbox_mutable_function_t *func,
+                                wasmbox_code_t *code, wasm_s32_t from,
+                                wasm_s32_t delta);
+
+/**
+ * Returns 1 if an instruction of `block` after `index` may read `slot` before
+ * it is written again, or if the operands of one of them are unknown.
+ */
+int wasmbox_block_reads_after(wasmbox_mutable_function_t *func,
+                              wasmbox_block_t *block, wasm_u16_t index,
+                              wasm_s32_t slot);
+
+/**
+ * Returns 1 if `code` can be executed even when its result is not used: it
+ * neither traps nor has a side effect, and only writes slots from `min_slot`.
+ */
+int wasmbox_code_is_speculatable(wasmbox_mutable_function_t *func,
+                                 wasmbox_code_t *code, wasm_s32_t min_slot);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* end of include guard */
@@ -0,0 +1,186 @@
+/*
+ * Copyright (C) 2021 Masahiro Ide
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "perf-counters.h"
+#include "allocator.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <threads.h>
+
+#ifdef __linux__
+#  include <linux/perf_event.h>
+#  include <sys/syscall.h>
+#  include <unistd.h>
+#endif
+
+#define LOG(MSG) fprintf(stderr, "(%s:%d)" MSG, __FILE__, __LINE__)
+
+struct wasmbox_perf_counters_t {
+  /* The events of the group, the leader first, or -1 for those the host does
+   * not count. */
+  int fds[WASMBOX_PERF_EVENTS];
+  /* Where each event is in a read of the group, or -1. */
+  int slots[WASMBOX_PERF_EVENTS];
+  wasm_u32_t open_size;
+  /* The thread whose events are counted. */
+  thrd_t thread;
+  /* Indexed like the exports of the module. */
+  wasmbox_perf_counts_t *counts;
+  wasm_u32_t export_size;
+};
+
+#ifdef __linux__
+static const struct {
+  wasm_u32_t type;
+  wasm_u64_t config;
+} wasmbox_perf_events[WASMBOX_PERF_EVENTS] = {
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    {PERF_TYPE_HW_CACHE,
+     PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+         (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+};
+
+static int wasmbox_perf_event_open(int event, int group) {
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = wasmbox_perf_events[event].type;
+  attr.config = wasmbox_perf_events[event].config;
+  attr.read_format = PERF_FORMAT_GROUP;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  // The calling thread, on any CPU.
+  return (int) syscall(SYS_perf_event_open, &attr, 0, -1, group, 0);
+}
+
+int wasmbox_perf_counters_start(wasmbox_module_t *mod) {
+  if (mod->perf_counters != NULL) {
+    LOG("perf counters are running already\n");
+    return -1;
+  }
+  int leader = wasmbox_perf_event_open(0, -1);
+  if (leader < 0) {
+    LOG("cannot count cycles with perf_event_open\n");
+    return -1;
+  }
+  wasmbox_perf_counters_t *counters = (wasmbox_perf_counters_t *) wasmbox_malloc(
+      sizeof(wasmbox_perf_counters_t));
+  counters->fds[0] = leader;
+  counters->slots[0] = counters->open_size++;
+  // The other events are left out where the host lacks them.
+  for (int i = 1; i < WASMBOX_PERF_EVENTS; i++) {
+    counters->fds[i] = wasmbox_perf_event_open(i, leader);
+    counters->slots[i] = counters->fds[i] >= 0 ? counters->open_size++ : -1;
+  }
+  counters->thread = thrd_current();
+  counters->export_size = mod->export_size;
+  counters->counts = (wasmbox_perf_counts_t *) wasmbox_malloc(
+      sizeof(wasmbox_perf_counts_t) * mod->export_size);
+  mod->perf_counters = counters;
+  return 0;
+}
+
+void wasmbox_perf_counters_stop(wasmbox_module_t *mod) {
+  wasmbox_perf_counters_t *counters = mod->perf_counters;
+  if (counters == NULL) {
+    return;
+  }
+  // The group goes away with its leader, which is closed last.
+  for (int i = WASMBOX_PERF_EVENTS - 1; i >= 0; i--) {
+    if (counters->fds[i] >= 0) {
+      close(counters->fds[i]);
+    }
+  }
+  wasmbox_free(counters->counts);
+  wasmbox_free(counters);
+  mod->perf_counters = NULL;
+}
+
+int wasmbox_perf_counters_begin(wasmbox_module_t *mod,
+                                wasmbox_perf_reading_t *reading) {
+  wasmbox_perf_counters_t *counters = mod->perf_counters;
+  if (counters == NULL || !thrd_equal(counters->thread, thrd_current())) {
+    return -1;
+  }
+  struct {
+    wasm_u64_t size;
+    wasm_u64_t values[WASMBOX_PERF_EVENTS];
+  } group;
+  ssize_t expected = sizeof(wasm_u64_t) * (1 + counters->open_size);
+  if (read(counters->fds[0], &group, sizeof(group)) != expected) {
+    return -1;
+  }
+  for (int i = 0; i < WASMBOX_PERF_EVENTS; i++) {
+    int slot = counters->slots[i];
+    reading->values[i] = slot >= 0 ? group.values[slot] : 0;
+  }
+  return 0;
+}
+#else
+int wasmbox_perf_counters_start(wasmbox_module_t *mod) {
+  (void) mod;
+  LOG("perf counters need perf_event_open\n");
+  return -1;
+}
+
+void wasmbox_perf_counters_stop(wasmbox_module_t *mod) { (void) mod; }
+
+int wasmbox_perf_counters_begin(wasmbox_module_t *mod,
+                                wasmbox_perf_reading_t *reading) {
+  (void) mod;
+  (void) reading;
+  return -1;
+}
+#endif /* __linux__ */
+
+void wasmbox_perf_counters_end(wasmbox_module_t *mod,
+                               const wasmbox_export_t *export,
+                               const wasmbox_perf_reading_t *start,
+                               wasm_u64_t calls) {
+  wasmbox_perf_reading_t end;
+  if (wasmbox_perf_counters_begin(mod, &end) != 0) {
+    return;
+  }
+  wasmbox_perf_counters_t *counters = mod->perf_counters;
+  wasm_u64_t index = export - mod->exports;
+  if (export < mod->exports || index >= counters->export_size) {
+    return;
+  }
+  wasmbox_perf_counts_t *counts = &counters->counts[index];
+  counts->calls += calls;
+  counts->cycles += end.values[0] - start->values[0];
+  counts->instructions += end.values[1] - start->values[1];
+  counts->branch_misses += end.values[2] - start->values[2];
+  counts->l1d_misses += end.values[3] - start->values[3];
+  counts->llc_misses += end.values[4] - start->values[4];
+}
+
+int wasmbox_perf_counters_read(wasmbox_module_t *mod,
+                               const wasmbox_export_t *export,
+                               wasmbox_perf_counts_t *counts) {
+  wasmbox_perf_counters_t *counters = mod->perf_counters;
+  wasm_u64_t index = export - mod->exports;
+  if (counters == NULL || export < mod->exports ||
+      index >= counters->export_size) {
+    return -1;
+  }
+  *counts = counters->counts[index];
+  return 0;
+}
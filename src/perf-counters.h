@@ -0,0 +1,53 @@
+/*
+ * Copyright (C) 2021 Masahiro Ide
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef WASMBOX_PERF_COUNTERS_H
+#define WASMBOX_PERF_COUNTERS_H
+
+#include "wasmbox/wasmbox.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifdef WASMBOX_VM_USE_PERF_COUNTERS
+/* Cycles, instructions, branch misses, L1D read misses and LLC misses. */
+#  define WASMBOX_PERF_EVENTS (5)
+
+/* Values of the counters at one point of a thread. */
+typedef struct wasmbox_perf_reading_t {
+  wasm_u64_t values[WASMBOX_PERF_EVENTS];
+} wasmbox_perf_reading_t;
+
+/**
+ * Reads the counters of `mod` into `reading`. Returns -1 if they are not
+ * counting, or counting on another thread.
+ */
+int wasmbox_perf_counters_begin(wasmbox_module_t *mod,
+                                wasmbox_perf_reading_t *reading);
+
+/* Adds what was counted since `start` over `calls` calls to `export`. */
+void wasmbox_perf_counters_end(wasmbox_module_t *mod,
+                               const wasmbox_export_t *export,
+                               const wasmbox_perf_reading_t *start,
+                               wasm_u64_t calls);
+#endif /* WASMBOX_VM_USE_PERF_COUNTERS */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* end of include guard */
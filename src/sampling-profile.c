@@ -0,0 +1,393 @@
+/*
+ * Copyright (C) 2021 Masahiro Ide
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "sampling-profile.h"
+#include "allocator.h"
+#include "debug-line.h"
+#include "interpreter.h"
+#include "jit.h"
+#include "opcodes.h"
+
+#include <stdio.h>
+#include <stdlib.h> // qsort, bsearch
+#include <string.h> // memcmp, memset
+
+#ifdef __unix__
+#  include <signal.h>
+#  include <sys/time.h> // setitimer
+#  include <unistd.h> // getpid
+#endif
+
+#define LOG(MSG) fprintf(stderr, "(%s:%d)" MSG, __FILE__, __LINE__)
+
+/* Samples kept by a profile. Later ones are dropped. */
+#define WASMBOX_SAMPLING_PROFILE_SAMPLES (16384)
+
+/* Frames walked from the running one. Deeper callers are cut off. */
+#define WASMBOX_SAMPLING_PROFILE_DEPTH (64)
+
+_Thread_local wasmbox_sampling_state_t wasmbox_sampling_state;
+
+typedef struct wasmbox_sample_t {
+  wasm_u32_t depth;
+  /* The running instruction, then the call instruction of each caller. */
+  const wasmbox_code_t *code[WASMBOX_SAMPLING_PROFILE_DEPTH];
+} wasmbox_sample_t;
+
+struct wasmbox_sampling_profile_t {
+  wasmbox_sample_t *samples;
+  wasm_u32_t sample_size;
+  /* Samples taken outside of the VM, e.g. in host functions. */
+  wasm_u32_t host_samples;
+#ifdef __unix__
+  struct sigaction previous_action;
+  struct itimerval previous_timer;
+#endif
+};
+
+#ifdef __unix__
+/* The profile SIGPROF records into. */
+static wasmbox_sampling_profile_t *volatile wasmbox_sampling_active;
+
+// Runs on the thread the signal interrupted, so its state is consistent up to
+// the instruction it publishes. Frames are walked until one links to itself,
+// as the first frame of a run and the frames native code calls into do.
+static void wasmbox_sampling_profile_signal(int signo) {
+  (void) signo;
+  wasmbox_sampling_profile_t *profile = wasmbox_sampling_active;
+  wasmbox_code_t *code = wasmbox_sampling_state.code;
+  wasmbox_value_t *frame = wasmbox_sampling_state.stack;
+  if (profile == NULL) {
+    return;
+  }
+  if (code == NULL) {
+    __atomic_fetch_add(&profile->host_samples, 1, __ATOMIC_RELAXED);
+    return;
+  }
+  wasm_u32_t i =
+      __atomic_fetch_add(&profile->sample_size, 1, __ATOMIC_RELAXED);
+  if (i >= WASMBOX_SAMPLING_PROFILE_SAMPLES) {
+    return;
+  }
+  wasmbox_sample_t *sample = &profile->samples[i];
+  wasm_u32_t depth = 0;
+  sample->code[depth++] = code;
+  while (depth < WASMBOX_SAMPLING_PROFILE_DEPTH) {
+    wasmbox_value_t *caller = WASMBOX_FRAME_CALLER(frame);
+    if (caller >= frame) {
+      break;
+    }
+    // The return code follows the call.
+    sample->code[depth++] = WASMBOX_FRAME_RETURN_CODE(frame) - 1;
+    frame = caller;
+  }
+  sample->depth = depth;
+}
+
+int wasmbox_sampling_profile_start(wasmbox_module_t *mod,
+                                   wasm_u32_t interval_us) {
+  if (wasmbox_sampling_active != NULL) {
+    LOG("a sampling profile is already running\n");
+    return -1;
+  }
+  if (interval_us == 0) {
+    LOG("interval must not be 0\n");
+    return -1;
+  }
+  wasmbox_sampling_profile_t *profile =
+      (wasmbox_sampling_profile_t *) wasmbox_malloc(sizeof(*profile));
+  memset(profile, 0, sizeof(*profile));
+  profile->samples = (wasmbox_sample_t *) wasmbox_malloc(
+      sizeof(wasmbox_sample_t) * WASMBOX_SAMPLING_PROFILE_SAMPLES);
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = wasmbox_sampling_profile_signal;
+  action.sa_flags = SA_RESTART;
+  sigemptyset(&action.sa_mask);
+  struct itimerval timer;
+  timer.it_interval.tv_sec = interval_us / 1000000;
+  timer.it_interval.tv_usec = interval_us % 1000000;
+  timer.it_value = timer.it_interval;
+  wasmbox_sampling_active = profile;
+  if (sigaction(SIGPROF, &action, &profile->previous_action) != 0) {
+    LOG("failed to install the SIGPROF handler\n");
+    wasmbox_sampling_active = NULL;
+    wasmbox_free(profile->samples);
+    wasmbox_free(profile);
+    return -1;
+  }
+  if (setitimer(ITIMER_PROF, &timer, &profile->previous_timer) != 0) {
+    LOG("failed to start the profiling timer\n");
+    sigaction(SIGPROF, &profile->previous_action, NULL);
+    wasmbox_sampling_active = NULL;
+    wasmbox_free(profile->samples);
+    wasmbox_free(profile);
+    return -1;
+  }
+  mod->sampling_profile = profile;
+  return 0;
+}
+
+/* Code of a function, which samples are looked up in. */
+typedef struct wasmbox_code_range_t {
+  const wasmbox_code_t *start;
+  const wasmbox_code_t *end;
+  wasm_u32_t index;
+} wasmbox_code_range_t;
+
+static int wasmbox_code_range_compare(const void *a, const void *b) {
+  const wasmbox_code_range_t *x = (const wasmbox_code_range_t *) a;
+  const wasmbox_code_range_t *y = (const wasmbox_code_range_t *) b;
+  return x->start < y->start ? -1 : x->start > y->start;
+}
+
+static int wasmbox_code_range_find(const void *key, const void *range) {
+  const wasmbox_code_t *code = (const wasmbox_code_t *) key;
+  const wasmbox_code_range_t *r = (const wasmbox_code_range_t *) range;
+  return code < r->start ? -1 : code >= r->end;
+}
+
+/* A frame of a sample, and the source line it was at or 0 if unknown. */
+typedef struct wasmbox_sample_frame_t {
+  wasm_u32_t function;
+  wasm_u32_t file;
+  wasm_u32_t line;
+} wasmbox_sample_frame_t;
+
+/* A sample with its frames, outermost first. */
+typedef struct wasmbox_sample_stack_t {
+  wasm_u32_t depth;
+  wasmbox_sample_frame_t *frames;
+} wasmbox_sample_stack_t;
+
+static int wasmbox_sample_frame_compare(const wasmbox_sample_frame_t *x,
+                                        const wasmbox_sample_frame_t *y) {
+  if (x->function != y->function) {
+    return x->function < y->function ? -1 : 1;
+  }
+  if (x->file != y->file) {
+    return x->file < y->file ? -1 : 1;
+  }
+  return x->line < y->line ? -1 : x->line > y->line;
+}
+
+static int wasmbox_sample_stack_compare(const void *a, const void *b) {
+  const wasmbox_sample_stack_t *x = (const wasmbox_sample_stack_t *) a;
+  const wasmbox_sample_stack_t *y = (const wasmbox_sample_stack_t *) b;
+  wasm_u32_t depth = x->depth < y->depth ? x->depth : y->depth;
+  for (wasm_u32_t i = 0; i < depth; i++) {
+    int order = wasmbox_sample_frame_compare(&x->frames[i], &y->frames[i]);
+    if (order != 0) {
+      return order;
+    }
+  }
+  return x->depth < y->depth ? -1 : x->depth > y->depth;
+}
+
+// Functions not found, such as the shared exit code, are unknown.
+#  define WASMBOX_SAMPLING_UNKNOWN ((wasm_u32_t) -1)
+
+static void wasmbox_sampling_print_function(FILE *fp, wasmbox_module_t *mod,
+                                            wasm_u32_t index) {
+  if (index == WASMBOX_SAMPLING_UNKNOWN) {
+    fprintf(fp, "[unknown]");
+    return;
+  }
+  wasmbox_name_t *name = wasmbox_function_name(mod, index);
+  if (name != NULL) {
+    fprintf(fp, "%.*s", (int) name->len, (const char *) name->value);
+  } else {
+    fprintf(fp, "func%u", index);
+  }
+}
+
+// Finds the source line of `code`, an instruction of the function `range`,
+// from the offset in the code section it was emitted for.
+static void wasmbox_sampling_find_line(wasmbox_module_t *mod,
+                                       const wasmbox_line_table_t *lines,
+                                       const wasmbox_code_range_t *range,
+                                       const wasmbox_code_t *code,
+                                       wasmbox_sample_frame_t *frame) {
+  wasmbox_mutable_function_t *func =
+      (wasmbox_mutable_function_t *) mod->functions[range->index];
+  if (lines->row_size == 0 || func->code_offsets == NULL) {
+    return;
+  }
+  wasm_u32_t offset = func->code_offsets[code - range->start];
+  const wasmbox_line_row_t *row =
+      offset != 0 ? wasmbox_line_table_find(lines, offset) : NULL;
+  if (row != NULL) {
+    frame->file = row->file;
+    frame->line = row->line;
+  }
+}
+
+static void wasmbox_sampling_print_frame(FILE *fp, wasmbox_module_t *mod,
+                                         const wasmbox_line_table_t *lines,
+                                         const wasmbox_sample_frame_t *frame) {
+  wasmbox_sampling_print_function(fp, mod, frame->function);
+  if (frame->line == 0) {
+    return;
+  }
+  if (frame->file != WASMBOX_LINE_FILE_UNKNOWN) {
+    const wasmbox_name_t *file = &lines->files[frame->file];
+    fprintf(fp, " (%.*s:%u)", (int) file->len, (const char *) file->value,
+            frame->line);
+  } else {
+    fprintf(fp, " (?:%u)", frame->line);
+  }
+}
+
+// Writes a "[caller;]...callee count" line per distinct stack, the input of
+// flamegraph.pl. The line tables of the module, if it has any, are decoded
+// here rather than when it is loaded.
+static void wasmbox_sampling_write_stacks(wasmbox_module_t *mod,
+                                          wasmbox_sampling_profile_t *profile,
+                                          wasm_u32_t size, FILE *fp) {
+  wasmbox_line_table_t lines = {};
+  if (mod->debug_sections != NULL && mod->debug_sections->line != NULL) {
+    // Units decoded before a malformed one are still used.
+    wasmbox_line_table_init(&lines, mod->debug_sections);
+  }
+  wasmbox_code_range_t *ranges = (wasmbox_code_range_t *) wasmbox_malloc(
+      sizeof(wasmbox_code_range_t) * (mod->function_size + 1));
+  wasm_u32_t range_size = 0;
+  for (wasm_u32_t i = 0; i < mod->function_size; i++) {
+    wasmbox_function_t *func = mod->functions[i];
+    if (func->code != NULL && func->code_size > 0) {
+      ranges[range_size++] = (wasmbox_code_range_t){
+          func->code, func->code + func->code_size, i};
+    }
+  }
+  qsort(ranges, range_size, sizeof(ranges[0]), wasmbox_code_range_compare);
+
+  wasmbox_sample_stack_t *stacks = (wasmbox_sample_stack_t *) wasmbox_malloc(
+      sizeof(wasmbox_sample_stack_t) * (size + 1));
+  wasmbox_sample_frame_t *frames = (wasmbox_sample_frame_t *) wasmbox_malloc(
+      sizeof(wasmbox_sample_frame_t) * WASMBOX_SAMPLING_PROFILE_DEPTH *
+      (size + 1));
+  for (wasm_u32_t i = 0; i < size; i++) {
+    wasmbox_sample_t *sample = &profile->samples[i];
+    stacks[i].depth = sample->depth;
+    stacks[i].frames = &frames[i * WASMBOX_SAMPLING_PROFILE_DEPTH];
+    for (wasm_u32_t j = 0; j < sample->depth; j++) {
+      const wasmbox_code_range_t *range = (const wasmbox_code_range_t *)
+          bsearch(sample->code[j], ranges, range_size, sizeof(ranges[0]),
+                  wasmbox_code_range_find);
+      wasmbox_sample_frame_t *frame = &stacks[i].frames[sample->depth - 1 - j];
+      frame->function = WASMBOX_SAMPLING_UNKNOWN;
+      if (range != NULL) {
+        frame->function = range->index;
+        wasmbox_sampling_find_line(mod, &lines, range, sample->code[j], frame);
+      }
+    }
+  }
+  qsort(stacks, size, sizeof(stacks[0]), wasmbox_sample_stack_compare);
+  for (wasm_u32_t i = 0; i < size;) {
+    wasm_u32_t j = i + 1;
+    while (j < size && wasmbox_sample_stack_compare(&stacks[i], &stacks[j]) == 0) {
+      j++;
+    }
+    for (wasm_u32_t k = 0; k < stacks[i].depth; k++) {
+      if (k > 0) {
+        fputc(';', fp);
+      }
+      wasmbox_sampling_print_frame(fp, mod, &lines, &stacks[i].frames[k]);
+    }
+    fprintf(fp, " %u\n", j - i);
+    i = j;
+  }
+  if (profile->host_samples > 0) {
+    fprintf(fp, "[host] %u\n", profile->host_samples);
+  }
+  wasmbox_free(frames);
+  wasmbox_free(stacks);
+  wasmbox_free(ranges);
+  wasmbox_line_table_dispose(&lines);
+}
+
+#  ifdef WASMBOX_JIT_ENABLED
+// Appends the native code of the compiled functions to /tmp/perf-<pid>.map,
+// where perf looks up the symbols of code it did not load from a file.
+static void wasmbox_sampling_write_perf_map(wasmbox_module_t *mod) {
+  char path[64];
+  snprintf(path, sizeof(path), "/tmp/perf-%d.map", (int) getpid());
+  FILE *fp = fopen(path, "a");
+  if (fp == NULL) {
+    LOG("failed to open the perf map\n");
+    return;
+  }
+  for (wasm_u32_t i = 0; i < mod->function_size; i++) {
+    wasmbox_function_t *func = mod->functions[i];
+    if (func->code_size == 0 || func->code[0].h.opcode != OPCODE_JIT_ENTRY) {
+      continue;
+    }
+    fprintf(fp, "%llx %x ", (unsigned long long) func->code[0].op0.value.u64,
+            func->code[0].op1.index);
+    wasmbox_sampling_print_function(fp, mod, i);
+    fputc('\n', fp);
+  }
+  fclose(fp);
+}
+#  endif
+
+int wasmbox_sampling_profile_stop(wasmbox_module_t *mod,
+                                  const char *file_name) {
+  wasmbox_sampling_profile_t *profile = mod->sampling_profile;
+  if (profile == NULL) {
+    LOG("no sampling profile is running\n");
+    return -1;
+  }
+  setitimer(ITIMER_PROF, &profile->previous_timer, NULL);
+  sigaction(SIGPROF, &profile->previous_action, NULL);
+  wasmbox_sampling_active = NULL;
+  mod->sampling_profile = NULL;
+  wasm_u32_t size = profile->sample_size;
+  if (size > WASMBOX_SAMPLING_PROFILE_SAMPLES) {
+    size = WASMBOX_SAMPLING_PROFILE_SAMPLES;
+  }
+  int ret = (int) (size + profile->host_samples);
+  FILE *fp = file_name != NULL ? fopen(file_name, "w") : NULL;
+  if (file_name != NULL && fp == NULL) {
+    LOG("failed to open the profile\n");
+    ret = -1;
+  } else if (fp != NULL) {
+    wasmbox_sampling_write_stacks(mod, profile, size, fp);
+    fclose(fp);
+  }
+#  ifdef WASMBOX_JIT_ENABLED
+  wasmbox_sampling_write_perf_map(mod);
+#  endif
+  wasmbox_free(profile->samples);
+  wasmbox_free(profile);
+  return ret;
+}
+#else
+int wasmbox_sampling_profile_start(wasmbox_module_t *mod,
+                                   wasm_u32_t interval_us) {
+  (void) mod;
+  (void) interval_us;
+  LOG("sampling needs SIGPROF\n");
+  return -1;
+}
+
+int wasmbox_sampling_profile_stop(wasmbox_module_t *mod,
+                                  const char *file_name) {
+  (void) mod;
+  (void) file_name;
+  return -1;
+}
+#endif /* __unix__ */
@@ -0,0 +1,51 @@
+/*
+ * Copyright (C) 2021 Masahiro Ide
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef WASMBOX_SAMPLING_PROFILE_H
+#define WASMBOX_SAMPLING_PROFILE_H
+
+#include "wasmbox/wasmbox.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifdef WASMBOX_VM_USE_SAMPLING_PROFILE
+/* Where the interpreter of a thread is, for the SIGPROF handler. */
+typedef struct wasmbox_sampling_state_t {
+  /* The running instruction, or NULL outside of the VM. */
+  wasmbox_code_t *volatile code;
+  /* The frame of the running function. */
+  wasmbox_value_t *volatile stack;
+} wasmbox_sampling_state_t;
+
+extern _Thread_local wasmbox_sampling_state_t wasmbox_sampling_state;
+
+/* Publishes the instruction about to run and its frame. */
+#  define WASMBOX_SAMPLING_PROFILE(CODE, STACK)  \
+    do {                                         \
+      wasmbox_sampling_state.stack = (STACK);    \
+      wasmbox_sampling_state.code = (CODE);      \
+    } while (0)
+#else
+#  define WASMBOX_SAMPLING_PROFILE(CODE, STACK) ((void) 0)
+#endif /* WASMBOX_VM_USE_SAMPLING_PROFILE */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* end of include guard */
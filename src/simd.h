@@ -0,0 +1,581 @@
+/*
+ * Copyright (C) 2021 Masahiro Ide
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef WASMBOX_SIMD_H
+#define WASMBOX_SIMD_H
+
+#include "wasmbox/wasmbox.h"
+
+#include <string.h> // memcpy
+
+#if defined(__SSE2__)
+#  include <emmintrin.h>
+#endif
+#if defined(__SSSE3__)
+#  include <tmmintrin.h>
+#endif
+#if defined(__ARM_NEON) && defined(__aarch64__)
+#  include <arm_neon.h>
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * v128 values of the SIMD proposal. Lane-wise operations are written with
+ * GCC vector extensions, which the compiler lowers to SSE or NEON. Operations
+ * without a generic spelling use intrinsics when the target has them.
+ */
+#define WASMBOX_SIMD_VECTOR(type, size) type __attribute__((vector_size(size)))
+
+typedef WASMBOX_SIMD_VECTOR(wasm_s8_t, 16) wasmbox_i8x16_t;
+typedef WASMBOX_SIMD_VECTOR(wasm_u8_t, 16) wasmbox_u8x16_t;
+typedef WASMBOX_SIMD_VECTOR(wasm_s16_t, 16) wasmbox_i16x8_t;
+typedef WASMBOX_SIMD_VECTOR(wasm_u16_t, 16) wasmbox_u16x8_t;
+typedef WASMBOX_SIMD_VECTOR(wasm_s32_t, 16) wasmbox_i32x4_t;
+typedef WASMBOX_SIMD_VECTOR(wasm_u32_t, 16) wasmbox_u32x4_t;
+typedef WASMBOX_SIMD_VECTOR(wasm_s64_t, 16) wasmbox_i64x2_t;
+typedef WASMBOX_SIMD_VECTOR(wasm_u64_t, 16) wasmbox_u64x2_t;
+typedef WASMBOX_SIMD_VECTOR(wasm_f32_t, 16) wasmbox_f32x4_t;
+typedef WASMBOX_SIMD_VECTOR(wasm_f64_t, 16) wasmbox_f64x2_t;
+
+/* Halves, used by the extending and narrowing operations. */
+typedef WASMBOX_SIMD_VECTOR(wasm_s8_t, 8) wasmbox_i8x8_t;
+typedef WASMBOX_SIMD_VECTOR(wasm_u8_t, 8) wasmbox_u8x8_t;
+typedef WASMBOX_SIMD_VECTOR(wasm_s16_t, 8) wasmbox_i16x4_t;
+typedef WASMBOX_SIMD_VECTOR(wasm_u16_t, 8) wasmbox_u16x4_t;
+typedef WASMBOX_SIMD_VECTOR(wasm_s32_t, 8) wasmbox_i32x2_t;
+typedef WASMBOX_SIMD_VECTOR(wasm_u32_t, 8) wasmbox_u32x2_t;
+typedef WASMBOX_SIMD_VECTOR(wasm_f32_t, 8) wasmbox_f32x2_t;
+
+typedef union wasmbox_v128_t {
+  wasmbox_i8x16_t i8x16;
+  wasmbox_u8x16_t u8x16;
+  wasmbox_i16x8_t i16x8;
+  wasmbox_u16x8_t u16x8;
+  wasmbox_i32x4_t i32x4;
+  wasmbox_u32x4_t u32x4;
+  wasmbox_i64x2_t i64x2;
+  wasmbox_u64x2_t u64x2;
+  wasmbox_f32x4_t f32x4;
+  wasmbox_f64x2_t f64x2;
+  wasm_u8_t bytes[16];
+} wasmbox_v128_t;
+
+/* A v128 lives in the slots REG and REG + 1, low half first. */
+static inline wasmbox_v128_t wasmbox_v128_get(const wasmbox_value_t *stack,
+                                              int reg) {
+  wasmbox_v128_t v;
+  memcpy(&v, &stack[reg], sizeof(v));
+  return v;
+}
+
+static inline void wasmbox_v128_set(wasmbox_value_t *stack, int reg,
+                                    wasmbox_v128_t v) {
+  memcpy(&stack[reg], &v, sizeof(v));
+}
+
+#define WASMBOX_SIMD_LANES(field)              \
+  (sizeof(((wasmbox_v128_t *) 0)->field) / \
+   sizeof(((wasmbox_v128_t *) 0)->field[0]))
+
+/* Lane-wise (MASK ? A : B) for a compare result MASK. */
+#define WASMBOX_SIMD_SELECT(type, mask, a, b) \
+  (((type) (mask) & (a)) | (~(type) (mask) & (b)))
+
+/* Loads */
+static inline wasmbox_v128_t wasmbox_simd_load(const wasm_u8_t *p) {
+  wasmbox_v128_t r;
+  memcpy(&r, p, sizeof(r));
+  return r;
+}
+
+#define WASMBOX_SIMD_LOAD_EXTEND(name, rtype, htype, field)           \
+  static inline wasmbox_v128_t wasmbox_simd_##name(const wasm_u8_t *p) { \
+    htype h;                                                           \
+    wasmbox_v128_t r;                                                  \
+    memcpy(&h, p, sizeof(h));                                          \
+    r.field = __builtin_convertvector(h, rtype);                       \
+    return r;                                                          \
+  }
+WASMBOX_SIMD_LOAD_EXTEND(load8x8_s, wasmbox_i16x8_t, wasmbox_i8x8_t, i16x8)
+WASMBOX_SIMD_LOAD_EXTEND(load8x8_u, wasmbox_u16x8_t, wasmbox_u8x8_t, u16x8)
+WASMBOX_SIMD_LOAD_EXTEND(load16x4_s, wasmbox_i32x4_t, wasmbox_i16x4_t, i32x4)
+WASMBOX_SIMD_LOAD_EXTEND(load16x4_u, wasmbox_u32x4_t, wasmbox_u16x4_t, u32x4)
+WASMBOX_SIMD_LOAD_EXTEND(load32x2_s, wasmbox_i64x2_t, wasmbox_i32x2_t, i64x2)
+WASMBOX_SIMD_LOAD_EXTEND(load32x2_u, wasmbox_u64x2_t, wasmbox_u32x2_t, u64x2)
+#undef WASMBOX_SIMD_LOAD_EXTEND
+
+#define WASMBOX_SIMD_LOAD_SPLAT(name, type, field)                     \
+  static inline wasmbox_v128_t wasmbox_simd_##name(const wasm_u8_t *p) { \
+    type v;                                                            \
+    wasmbox_v128_t r;                                                  \
+    memcpy(&v, p, sizeof(v));                                          \
+    r.field = (__typeof__(r.field)){0} + v;                            \
+    return r;                                                          \
+  }
+WASMBOX_SIMD_LOAD_SPLAT(load8_splat, wasm_u8_t, u8x16)
+WASMBOX_SIMD_LOAD_SPLAT(load16_splat, wasm_u16_t, u16x8)
+WASMBOX_SIMD_LOAD_SPLAT(load32_splat, wasm_u32_t, u32x4)
+WASMBOX_SIMD_LOAD_SPLAT(load64_splat, wasm_u64_t, u64x2)
+#undef WASMBOX_SIMD_LOAD_SPLAT
+
+static inline wasmbox_v128_t wasmbox_simd_load32_zero(const wasm_u8_t *p) {
+  wasmbox_v128_t r = {0};
+  memcpy(&r, p, 4);
+  return r;
+}
+
+static inline wasmbox_v128_t wasmbox_simd_load64_zero(const wasm_u8_t *p) {
+  wasmbox_v128_t r = {0};
+  memcpy(&r, p, 8);
+  return r;
+}
+
+/* Shuffles. Shuffle lane indices are below 32, validated by the decoder. */
+static inline wasmbox_u8x16_t wasmbox_simd_shuffle(wasmbox_u8x16_t a,
+                                                   wasmbox_u8x16_t b,
+                                                   wasmbox_u8x16_t lanes) {
+#if defined(__GNUC__) && !defined(__clang__)
+  return __builtin_shuffle(a, b, lanes);
+#else
+  wasmbox_u8x16_t r;
+  for (int i = 0; i < 16; i++) {
+    r[i] = lanes[i] < 16 ? a[lanes[i]] : b[lanes[i] - 16];
+  }
+  return r;
+#endif
+}
+
+static inline wasmbox_u8x16_t wasmbox_simd_swizzle(wasmbox_u8x16_t a,
+                                                   wasmbox_u8x16_t lanes) {
+#if defined(__SSSE3__)
+  // pshufb zeroes lanes whose index has the top bit set.
+  __m128i index = _mm_adds_epu8((__m128i) lanes, _mm_set1_epi8(0x70));
+  return (wasmbox_u8x16_t) _mm_shuffle_epi8((__m128i) a, index);
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+  return (wasmbox_u8x16_t) vqtbl1q_u8((uint8x16_t) a, (uint8x16_t) lanes);
+#else
+  wasmbox_u8x16_t r;
+  for (int i = 0; i < 16; i++) {
+    r[i] = lanes[i] < 16 ? a[lanes[i]] : 0;
+  }
+  return r;
+#endif
+}
+
+/* Bitwise */
+static inline wasmbox_u64x2_t wasmbox_simd_andnot(wasmbox_u64x2_t a,
+                                                  wasmbox_u64x2_t b) {
+  return a & ~b;
+}
+
+static inline wasmbox_u64x2_t wasmbox_simd_bitselect(wasmbox_u64x2_t a,
+                                                     wasmbox_u64x2_t b,
+                                                     wasmbox_u64x2_t c) {
+  return (a & c) | (b & ~c);
+}
+
+static inline wasm_u32_t wasmbox_simd_any_true(wasmbox_u64x2_t a) {
+  return (a[0] | a[1]) != 0;
+}
+
+#define WASMBOX_SIMD_ALL_TRUE(bits, type)                                   \
+  static inline wasm_u32_t wasmbox_simd_all_true_##bits(type a) {           \
+    wasmbox_u64x2_t zero = (wasmbox_u64x2_t) (a == (type){0});              \
+    return (zero[0] | zero[1]) == 0;                                        \
+  }
+WASMBOX_SIMD_ALL_TRUE(8, wasmbox_u8x16_t)
+WASMBOX_SIMD_ALL_TRUE(16, wasmbox_u16x8_t)
+WASMBOX_SIMD_ALL_TRUE(32, wasmbox_u32x4_t)
+WASMBOX_SIMD_ALL_TRUE(64, wasmbox_u64x2_t)
+#undef WASMBOX_SIMD_ALL_TRUE
+
+static inline wasm_u32_t wasmbox_simd_bitmask_8(wasmbox_i8x16_t a) {
+#if defined(__SSE2__)
+  return (wasm_u32_t) _mm_movemask_epi8((__m128i) a);
+#else
+  wasm_u32_t r = 0;
+  for (int i = 0; i < 16; i++) {
+    r |= (wasm_u32_t) (a[i] < 0) << i;
+  }
+  return r;
+#endif
+}
+
+static inline wasm_u32_t wasmbox_simd_bitmask_16(wasmbox_i16x8_t a) {
+#if defined(__SSE2__)
+  __m128i packed = _mm_packs_epi16((__m128i) a, _mm_setzero_si128());
+  return (wasm_u32_t) _mm_movemask_epi8(packed);
+#else
+  wasm_u32_t r = 0;
+  for (int i = 0; i < 8; i++) {
+    r |= (wasm_u32_t) (a[i] < 0) << i;
+  }
+  return r;
+#endif
+}
+
+static inline wasm_u32_t wasmbox_simd_bitmask_32(wasmbox_i32x4_t a) {
+#if defined(__SSE2__)
+  return (wasm_u32_t) _mm_movemask_ps((__m128) a);
+#else
+  wasm_u32_t r = 0;
+  for (int i = 0; i < 4; i++) {
+    r |= (wasm_u32_t) (a[i] < 0) << i;
+  }
+  return r;
+#endif
+}
+
+static inline wasm_u32_t wasmbox_simd_bitmask_64(wasmbox_i64x2_t a) {
+  return (wasm_u32_t) (a[0] < 0) | (wasm_u32_t) (a[1] < 0) << 1;
+}
+
+/* Integer arithmetic */
+#define WASMBOX_SIMD_ABS(bits, stype, utype)                         \
+  static inline utype wasmbox_simd_abs_s##bits(stype a) {            \
+    return WASMBOX_SIMD_SELECT(utype, a < 0, -(utype) a, (utype) a); \
+  }
+WASMBOX_SIMD_ABS(8, wasmbox_i8x16_t, wasmbox_u8x16_t)
+WASMBOX_SIMD_ABS(16, wasmbox_i16x8_t, wasmbox_u16x8_t)
+WASMBOX_SIMD_ABS(32, wasmbox_i32x4_t, wasmbox_u32x4_t)
+WASMBOX_SIMD_ABS(64, wasmbox_i64x2_t, wasmbox_u64x2_t)
+#undef WASMBOX_SIMD_ABS
+
+#define WASMBOX_SIMD_MIN_MAX(name, type)                          \
+  static inline type wasmbox_simd_min_##name(type a, type b) {    \
+    return WASMBOX_SIMD_SELECT(type, a < b, a, b);                \
+  }                                                               \
+  static inline type wasmbox_simd_max_##name(type a, type b) {    \
+    return WASMBOX_SIMD_SELECT(type, a > b, a, b);                \
+  }
+WASMBOX_SIMD_MIN_MAX(s8, wasmbox_i8x16_t)
+WASMBOX_SIMD_MIN_MAX(u8, wasmbox_u8x16_t)
+WASMBOX_SIMD_MIN_MAX(s16, wasmbox_i16x8_t)
+WASMBOX_SIMD_MIN_MAX(u16, wasmbox_u16x8_t)
+WASMBOX_SIMD_MIN_MAX(s32, wasmbox_i32x4_t)
+WASMBOX_SIMD_MIN_MAX(u32, wasmbox_u32x4_t)
+#undef WASMBOX_SIMD_MIN_MAX
+
+#define WASMBOX_SIMD_AVGR(bits, type)                              \
+  static inline type wasmbox_simd_avgr_u##bits(type a, type b) {   \
+    return (a | b) - ((a ^ b) >> 1);                               \
+  }
+WASMBOX_SIMD_AVGR(8, wasmbox_u8x16_t)
+WASMBOX_SIMD_AVGR(16, wasmbox_u16x8_t)
+#undef WASMBOX_SIMD_AVGR
+
+static inline wasmbox_u8x16_t wasmbox_simd_popcnt(wasmbox_u8x16_t a) {
+#if defined(__ARM_NEON) && defined(__aarch64__)
+  return (wasmbox_u8x16_t) vcntq_u8((uint8x16_t) a);
+#else
+  wasmbox_u8x16_t r;
+  for (int i = 0; i < 16; i++) {
+    r[i] = (wasm_u8_t) __builtin_popcount(a[i]);
+  }
+  return r;
+#endif
+}
+
+/* Saturating arithmetic of the unsigned lanes is branch-free on any target. */
+#define WASMBOX_SIMD_SAT_U(bits, type)                                   \
+  static inline type wasmbox_simd_add_sat_u##bits(type a, type b) {      \
+    type r = a + b;                                                      \
+    return r | (type) (r < a);                                           \
+  }                                                                      \
+  static inline type wasmbox_simd_sub_sat_u##bits(type a, type b) {      \
+    return (a - b) & (type) (a >= b);                                    \
+  }
+WASMBOX_SIMD_SAT_U(8, wasmbox_u8x16_t)
+WASMBOX_SIMD_SAT_U(16, wasmbox_u16x8_t)
+#undef WASMBOX_SIMD_SAT_U
+
+#define WASMBOX_SIMD_SAT_S(name, bits, type, wide, min, max, sse, neon, ntype) \
+  static inline type wasmbox_simd_##name##_sat_s##bits(type a, type b) {        \
+    WASMBOX_SIMD_SAT_S_BODY(name, type, wide, min, max, sse, neon, ntype)       \
+  }
+#if defined(__SSE2__)
+#  define WASMBOX_SIMD_SAT_S_BODY(name, type, wide, min, max, sse, neon, ntype) \
+    return (type) sse((__m128i) a, (__m128i) b);
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#  define WASMBOX_SIMD_SAT_S_BODY(name, type, wide, min, max, sse, neon, ntype) \
+    return (type) neon((ntype) a, (ntype) b);
+#else
+#  define WASMBOX_SIMD_SAT_S_BODY(name, type, wide, min, max, sse, neon, ntype) \
+    type r;                                                              \
+    for (int i = 0; i < (int) (sizeof(type) / sizeof(a[0])); i++) {      \
+      wide v = (wide) a[i] WASMBOX_SIMD_SAT_##name (wide) b[i];          \
+      r[i] = v < (min) ? (min) : v > (max) ? (max) : v;                  \
+    }                                                                    \
+    return r;
+#  define WASMBOX_SIMD_SAT_add +
+#  define WASMBOX_SIMD_SAT_sub -
+#endif
+WASMBOX_SIMD_SAT_S(add, 8, wasmbox_i8x16_t, int, INT8_MIN, INT8_MAX,
+                   _mm_adds_epi8, vqaddq_s8, int8x16_t)
+WASMBOX_SIMD_SAT_S(sub, 8, wasmbox_i8x16_t, int, INT8_MIN, INT8_MAX,
+                   _mm_subs_epi8, vqsubq_s8, int8x16_t)
+WASMBOX_SIMD_SAT_S(add, 16, wasmbox_i16x8_t, int, INT16_MIN, INT16_MAX,
+                   _mm_adds_epi16, vqaddq_s16, int16x8_t)
+WASMBOX_SIMD_SAT_S(sub, 16, wasmbox_i16x8_t, int, INT16_MIN, INT16_MAX,
+                   _mm_subs_epi16, vqsubq_s16, int16x8_t)
+#undef WASMBOX_SIMD_SAT_S_BODY
+#undef WASMBOX_SIMD_SAT_S
+
+static inline wasmbox_i16x8_t wasmbox_simd_q15mulr(wasmbox_i16x8_t a,
+                                                   wasmbox_i16x8_t b) {
+  wasmbox_i16x8_t r;
+  for (int i = 0; i < 8; i++) {
+    wasm_s32_t v = ((wasm_s32_t) a[i] * b[i] + 0x4000) >> 15;
+    r[i] = (wasm_s16_t) (v > INT16_MAX ? INT16_MAX : v);
+  }
+  return r;
+}
+
+static inline wasmbox_i32x4_t wasmbox_simd_dot_s16(wasmbox_i16x8_t a,
+                                                   wasmbox_i16x8_t b) {
+#if defined(__SSE2__)
+  return (wasmbox_i32x4_t) _mm_madd_epi16((__m128i) a, (__m128i) b);
+#else
+  // Sign-extend the even and odd lanes in place.
+  wasmbox_i32x4_t ae = (wasmbox_i32x4_t) ((wasmbox_u32x4_t) a << 16) >> 16;
+  wasmbox_i32x4_t be = (wasmbox_i32x4_t) ((wasmbox_u32x4_t) b << 16) >> 16;
+  wasmbox_i32x4_t ao = (wasmbox_i32x4_t) a >> 16;
+  wasmbox_i32x4_t bo = (wasmbox_i32x4_t) b >> 16;
+  return (wasmbox_i32x4_t) ((wasmbox_u32x4_t) (ae * be) +
+                            (wasmbox_u32x4_t) (ao * bo));
+#endif
+}
+
+/* Narrowing with saturation. */
+#define WASMBOX_SIMD_NARROW(name, rtype, atype, lanes, min, max)        \
+  static inline rtype wasmbox_simd_narrow_##name(atype a, atype b) {    \
+    WASMBOX_SIMD_NARROW_BODY_##name(rtype, atype, lanes, min, max)      \
+  }
+#define WASMBOX_SIMD_NARROW_LOOP(rtype, atype, lanes, min, max)         \
+  rtype r;                                                              \
+  for (int i = 0; i < (lanes); i++) {                                   \
+    __typeof__(a[0]) v = i < (lanes) / 2 ? a[i] : b[i - (lanes) / 2];   \
+    r[i] = v < (min) ? (min) : v > (max) ? (max) : v;                   \
+  }                                                                     \
+  return r;
+#if defined(__SSE2__)
+#  define WASMBOX_SIMD_NARROW_BODY_s8(rtype, atype, lanes, min, max) \
+    return (rtype) _mm_packs_epi16((__m128i) a, (__m128i) b);
+#  define WASMBOX_SIMD_NARROW_BODY_u8(rtype, atype, lanes, min, max) \
+    return (rtype) _mm_packus_epi16((__m128i) a, (__m128i) b);
+#  define WASMBOX_SIMD_NARROW_BODY_s16(rtype, atype, lanes, min, max) \
+    return (rtype) _mm_packs_epi32((__m128i) a, (__m128i) b);
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#  define WASMBOX_SIMD_NARROW_BODY_s8(rtype, atype, lanes, min, max) \
+    return (rtype) vcombine_s8(vqmovn_s16((int16x8_t) a),                 \
+                               vqmovn_s16((int16x8_t) b));
+#  define WASMBOX_SIMD_NARROW_BODY_u8(rtype, atype, lanes, min, max) \
+    return (rtype) vcombine_u8(vqmovun_s16((int16x8_t) a),               \
+                               vqmovun_s16((int16x8_t) b));
+#  define WASMBOX_SIMD_NARROW_BODY_s16(rtype, atype, lanes, min, max) \
+    return (rtype) vcombine_s16(vqmovn_s32((int32x4_t) a),               \
+                                vqmovn_s32((int32x4_t) b));
+#else
+#  define WASMBOX_SIMD_NARROW_BODY_s8  WASMBOX_SIMD_NARROW_LOOP
+#  define WASMBOX_SIMD_NARROW_BODY_u8  WASMBOX_SIMD_NARROW_LOOP
+#  define WASMBOX_SIMD_NARROW_BODY_s16 WASMBOX_SIMD_NARROW_LOOP
+#endif
+#define WASMBOX_SIMD_NARROW_BODY_u16 WASMBOX_SIMD_NARROW_LOOP
+WASMBOX_SIMD_NARROW(s8, wasmbox_i8x16_t, wasmbox_i16x8_t, 16, INT8_MIN,
+                    INT8_MAX)
+WASMBOX_SIMD_NARROW(u8, wasmbox_u8x16_t, wasmbox_i16x8_t, 16, 0, UINT8_MAX)
+WASMBOX_SIMD_NARROW(s16, wasmbox_i16x8_t, wasmbox_i32x4_t, 8, INT16_MIN,
+                    INT16_MAX)
+WASMBOX_SIMD_NARROW(u16, wasmbox_u16x8_t, wasmbox_i32x4_t, 8, 0, UINT16_MAX)
+#undef WASMBOX_SIMD_NARROW_BODY_s8
+#undef WASMBOX_SIMD_NARROW_BODY_u8
+#undef WASMBOX_SIMD_NARROW_BODY_s16
+#undef WASMBOX_SIMD_NARROW_BODY_u16
+#undef WASMBOX_SIMD_NARROW_LOOP
+#undef WASMBOX_SIMD_NARROW
+
+/* Widening. OFFSET selects the low (0) or the high (8) half. */
+#define WASMBOX_SIMD_EXTEND(name, rtype, atype, htype, offset)      \
+  static inline rtype wasmbox_simd_extend_##name(atype a) {         \
+    htype h;                                                        \
+    memcpy(&h, (const char *) &a + (offset), sizeof(h));            \
+    return __builtin_convertvector(h, rtype);                       \
+  }
+#define WASMBOX_SIMD_EXTEND_EACH(bits, stype, utype, rstype, rutype, shtype, \
+                                 uhtype)                                     \
+  WASMBOX_SIMD_EXTEND(low_s##bits, rstype, stype, shtype, 0)                 \
+  WASMBOX_SIMD_EXTEND(high_s##bits, rstype, stype, shtype, 8)                \
+  WASMBOX_SIMD_EXTEND(low_u##bits, rutype, utype, uhtype, 0)                 \
+  WASMBOX_SIMD_EXTEND(high_u##bits, rutype, utype, uhtype, 8)                \
+  static inline rstype wasmbox_simd_extmul_low_s##bits(stype a, stype b) {   \
+    return wasmbox_simd_extend_low_s##bits(a) *                              \
+           wasmbox_simd_extend_low_s##bits(b);                               \
+  }                                                                          \
+  static inline rstype wasmbox_simd_extmul_high_s##bits(stype a, stype b) {  \
+    return wasmbox_simd_extend_high_s##bits(a) *                             \
+           wasmbox_simd_extend_high_s##bits(b);                              \
+  }                                                                          \
+  static inline rutype wasmbox_simd_extmul_low_u##bits(utype a, utype b) {   \
+    return wasmbox_simd_extend_low_u##bits(a) *                              \
+           wasmbox_simd_extend_low_u##bits(b);                               \
+  }                                                                          \
+  static inline rutype wasmbox_simd_extmul_high_u##bits(utype a, utype b) {  \
+    return wasmbox_simd_extend_high_u##bits(a) *                             \
+           wasmbox_simd_extend_high_u##bits(b);                              \
+  }
+WASMBOX_SIMD_EXTEND_EACH(8, wasmbox_i8x16_t, wasmbox_u8x16_t, wasmbox_i16x8_t,
+                         wasmbox_u16x8_t, wasmbox_i8x8_t, wasmbox_u8x8_t)
+WASMBOX_SIMD_EXTEND_EACH(16, wasmbox_i16x8_t, wasmbox_u16x8_t,
+                         wasmbox_i32x4_t, wasmbox_u32x4_t, wasmbox_i16x4_t,
+                         wasmbox_u16x4_t)
+WASMBOX_SIMD_EXTEND_EACH(32, wasmbox_i32x4_t, wasmbox_u32x4_t,
+                         wasmbox_i64x2_t, wasmbox_u64x2_t, wasmbox_i32x2_t,
+                         wasmbox_u32x2_t)
+#undef WASMBOX_SIMD_EXTEND_EACH
+#undef WASMBOX_SIMD_EXTEND
+
+/* Pairwise additions, on the even and odd lanes extended in place. */
+#define WASMBOX_SIMD_EXTADD(bits, rstype, rutype, stype, utype)              \
+  static inline rstype wasmbox_simd_extadd_s##bits(stype a) {                \
+    rstype odd = (rstype) a >> (bits);                                       \
+    rstype even = (rstype) ((rutype) a << (bits)) >> (bits);                 \
+    return even + odd;                                                       \
+  }                                                                          \
+  static inline rutype wasmbox_simd_extadd_u##bits(utype a) {                \
+    rutype odd = (rutype) a >> (bits);                                       \
+    rutype even = ((rutype) a << (bits)) >> (bits);                          \
+    return even + odd;                                                       \
+  }
+WASMBOX_SIMD_EXTADD(8, wasmbox_i16x8_t, wasmbox_u16x8_t, wasmbox_i8x16_t,
+                    wasmbox_u8x16_t)
+WASMBOX_SIMD_EXTADD(16, wasmbox_i32x4_t, wasmbox_u32x4_t, wasmbox_i16x8_t,
+                    wasmbox_u16x8_t)
+#undef WASMBOX_SIMD_EXTADD
+
+/* Floating point */
+#define WASMBOX_SIMD_FLOAT_EACH(bits, type, itype, lanes, sqrt, ceil, floor, \
+                                trunc, rint)                                 \
+  static inline type wasmbox_simd_abs_f##bits(type a) {                     \
+    return (type) ((itype) a & ~(itype) - (type){0});                        \
+  }                                                                          \
+  static inline type wasmbox_simd_min_f##bits(type a, type b) {              \
+    itype nan = (a != a) | (b != b);                                         \
+    /* -0 is less than +0, so equal lanes take the bitwise or. */            \
+    itype r = WASMBOX_SIMD_SELECT(itype, a == b, (itype) a | (itype) b,      \
+                                  WASMBOX_SIMD_SELECT(itype, a < b,          \
+                                                      (itype) a, (itype) b)); \
+    return (type) WASMBOX_SIMD_SELECT(itype, nan, (itype) (a + b), r);       \
+  }                                                                          \
+  static inline type wasmbox_simd_max_f##bits(type a, type b) {              \
+    itype nan = (a != a) | (b != b);                                         \
+    itype r = WASMBOX_SIMD_SELECT(itype, a == b, (itype) a & (itype) b,      \
+                                  WASMBOX_SIMD_SELECT(itype, a > b,          \
+                                                      (itype) a, (itype) b)); \
+    return (type) WASMBOX_SIMD_SELECT(itype, nan, (itype) (a + b), r);       \
+  }                                                                          \
+  static inline type wasmbox_simd_pmin_f##bits(type a, type b) {             \
+    return (type) WASMBOX_SIMD_SELECT(itype, b < a, (itype) b, (itype) a);   \
+  }                                                                          \
+  static inline type wasmbox_simd_pmax_f##bits(type a, type b) {             \
+    return (type) WASMBOX_SIMD_SELECT(itype, a < b, (itype) b, (itype) a);   \
+  }                                                                          \
+  WASMBOX_SIMD_FLOAT_UNARY(sqrt_f##bits, type, lanes, sqrt)                  \
+  WASMBOX_SIMD_FLOAT_UNARY(ceil_f##bits, type, lanes, ceil)                  \
+  WASMBOX_SIMD_FLOAT_UNARY(floor_f##bits, type, lanes, floor)                \
+  WASMBOX_SIMD_FLOAT_UNARY(trunc_f##bits, type, lanes, trunc)                \
+  WASMBOX_SIMD_FLOAT_UNARY(nearest_f##bits, type, lanes, rint)
+#define WASMBOX_SIMD_FLOAT_UNARY(name, type, lanes, func) \
+  static inline type wasmbox_simd_##name(type a) {        \
+    type r;                                               \
+    for (int i = 0; i < (lanes); i++) {                   \
+      r[i] = func(a[i]);                                  \
+    }                                                     \
+    return r;                                             \
+  }
+WASMBOX_SIMD_FLOAT_EACH(32, wasmbox_f32x4_t, wasmbox_i32x4_t, 4,
+                        __builtin_sqrtf, __builtin_ceilf, __builtin_floorf,
+                        __builtin_truncf, __builtin_rintf)
+WASMBOX_SIMD_FLOAT_EACH(64, wasmbox_f64x2_t, wasmbox_i64x2_t, 2,
+                        __builtin_sqrt, __builtin_ceil, __builtin_floor,
+                        __builtin_trunc, __builtin_rint)
+#undef WASMBOX_SIMD_FLOAT_UNARY
+#undef WASMBOX_SIMD_FLOAT_EACH
+
+/* Conversions */
+static inline wasmbox_f32x4_t wasmbox_simd_demote(wasmbox_f64x2_t a) {
+  wasmbox_v128_t r = {0};
+  wasmbox_f32x2_t lo = __builtin_convertvector(a, wasmbox_f32x2_t);
+  memcpy(&r, &lo, sizeof(lo));
+  return r.f32x4;
+}
+
+static inline wasmbox_f64x2_t wasmbox_simd_promote_low(wasmbox_f32x4_t a) {
+  wasmbox_f32x2_t lo;
+  memcpy(&lo, &a, sizeof(lo));
+  return __builtin_convertvector(lo, wasmbox_f64x2_t);
+}
+
+static inline wasmbox_f32x4_t wasmbox_simd_convert_s32(wasmbox_i32x4_t a) {
+  return __builtin_convertvector(a, wasmbox_f32x4_t);
+}
+
+static inline wasmbox_f32x4_t wasmbox_simd_convert_u32(wasmbox_u32x4_t a) {
+  return __builtin_convertvector(a, wasmbox_f32x4_t);
+}
+
+static inline wasmbox_f64x2_t wasmbox_simd_convert_low_s32(wasmbox_i32x4_t a) {
+  wasmbox_i32x2_t lo;
+  memcpy(&lo, &a, sizeof(lo));
+  return __builtin_convertvector(lo, wasmbox_f64x2_t);
+}
+
+static inline wasmbox_f64x2_t wasmbox_simd_convert_low_u32(wasmbox_u32x4_t a) {
+  wasmbox_u32x2_t lo;
+  memcpy(&lo, &a, sizeof(lo));
+  return __builtin_convertvector(lo, wasmbox_f64x2_t);
+}
+
+/* Out of range lanes saturate and NaN lanes become zero. */
+#define WASMBOX_SIMD_TRUNC_SAT(name, rtype, atype, lanes, fmin, fmax, imin, \
+                               imax)                                       \
+  static inline rtype wasmbox_simd_##name(atype a) {                       \
+    rtype r = {0};                                                         \
+    for (int i = 0; i < (lanes); i++) {                                    \
+      r[i] = a[i] != a[i] ? 0                                              \
+             : a[i] <= (fmin) ? (imin)                                     \
+             : a[i] >= (fmax) ? (imax)                                     \
+                              : (__typeof__(r[0])) a[i];                   \
+    }                                                                      \
+    return r;                                                              \
+  }
+WASMBOX_SIMD_TRUNC_SAT(trunc_sat_s32, wasmbox_i32x4_t, wasmbox_f32x4_t, 4,
+                       -2147483648.0f, 2147483648.0f, INT32_MIN, INT32_MAX)
+WASMBOX_SIMD_TRUNC_SAT(trunc_sat_u32, wasmbox_u32x4_t, wasmbox_f32x4_t, 4,
+                       0.0f, 4294967296.0f, 0, UINT32_MAX)
+WASMBOX_SIMD_TRUNC_SAT(trunc_sat_zero_s32, wasmbox_i32x4_t, wasmbox_f64x2_t,
+                       2, -2147483648.0, 2147483647.0, INT32_MIN, INT32_MAX)
+WASMBOX_SIMD_TRUNC_SAT(trunc_sat_zero_u32, wasmbox_u32x4_t, wasmbox_f64x2_t,
+                       2, 0.0, 4294967295.0, 0, UINT32_MAX)
+#undef WASMBOX_SIMD_TRUNC_SAT
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* WASMBOX_SIMD_H */
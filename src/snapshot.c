@@ -0,0 +1,138 @@
+/*
+ * Copyright (C) 2021 Masahiro Ide
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "snapshot.h"
+#include "memory.h"
+#include <string.h>
+
+#define LOG(MSG) fprintf(stderr, "(%s:%d)" MSG, __FILE__, __LINE__)
+
+#define WASMBOX_SNAPSHOT_MAGIC "WBSS"
+#define WASMBOX_SNAPSHOT_VERSION (2)
+
+/* All-zero parts of the memory are left as holes in the file. */
+#define WASMBOX_SNAPSHOT_CHUNK_SIZE (4096)
+
+static int wasmbox_snapshot_write_memory(FILE *fp, wasmbox_module_t *mod,
+                                         wasm_u64_t offset) {
+  const wasm_u8_t *data = mod->memory_block->data;
+  wasm_u64_t size = (wasm_u64_t) WASMBOX_PAGE_SIZE * mod->memory_block_size;
+  for (wasm_u64_t i = 0; i < size; i += WASMBOX_SNAPSHOT_CHUNK_SIZE) {
+    const wasm_u8_t *chunk = data + i;
+    // The last chunk is always written so that the file has its full size.
+    if (i + WASMBOX_SNAPSHOT_CHUNK_SIZE < size && chunk[0] == 0 &&
+        memcmp(chunk, chunk + 1, WASMBOX_SNAPSHOT_CHUNK_SIZE - 1) == 0) {
+      continue;
+    }
+    if (fseek(fp, (long) (offset + i), SEEK_SET) != 0 ||
+        fwrite(chunk, 1, WASMBOX_SNAPSHOT_CHUNK_SIZE, fp) !=
+            WASMBOX_SNAPSHOT_CHUNK_SIZE) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+int wasmbox_instance_snapshot(wasmbox_module_t *mod, const char *file_name) {
+  if (mod->tables_modified) {
+    LOG("tables were modified since instantiation");
+    return -1;
+  }
+  wasmbox_snapshot_header_t header = {};
+  memcpy(header.magic, WASMBOX_SNAPSHOT_MAGIC, sizeof(header.magic));
+  header.version = WASMBOX_SNAPSHOT_VERSION;
+  header.source_hash = mod->source_hash;
+  header.source_size = mod->source_size;
+  header.global_size = mod->global_size;
+  header.memory_page_size =
+      mod->memory_block != NULL ? mod->memory_block_size : 0;
+  wasm_u64_t end = sizeof(header) + sizeof(*mod->globals) * mod->global_size;
+  header.memory_offset =
+      (end + WASMBOX_PAGE_SIZE - 1) / WASMBOX_PAGE_SIZE * WASMBOX_PAGE_SIZE;
+
+  FILE *fp = fopen(file_name, "wb");
+  if (fp == NULL) {
+    LOG("failed to create snapshot");
+    return -1;
+  }
+  int ok = fwrite(&header, sizeof(header), 1, fp) == 1;
+  if (ok && mod->global_size > 0) {
+    ok = fwrite(mod->globals, sizeof(*mod->globals), mod->global_size, fp) ==
+         mod->global_size;
+  }
+  if (ok && header.memory_page_size > 0) {
+    ok = wasmbox_snapshot_write_memory(fp, mod, header.memory_offset) == 0;
+  }
+  if (fclose(fp) != 0 || !ok) {
+    LOG("failed to write snapshot");
+    return -1;
+  }
+  return 0;
+}
+
+int wasmbox_snapshot_open(wasmbox_snapshot_t *snapshot, wasmbox_module_t *mod) {
+  wasmbox_snapshot_header_t *header = &snapshot->header;
+  snapshot->fp = fopen(mod->snapshot_file, "rb");
+  if (snapshot->fp == NULL) {
+    LOG("failed to open snapshot");
+    return -1;
+  }
+  if (fread(header, sizeof(*header), 1, snapshot->fp) != 1 ||
+      memcmp(header->magic, WASMBOX_SNAPSHOT_MAGIC, sizeof(header->magic)) !=
+          0 ||
+      header->version != WASMBOX_SNAPSHOT_VERSION) {
+    LOG("not a snapshot");
+    return -1;
+  }
+  if (header->source_hash != mod->source_hash ||
+      header->source_size != mod->source_size) {
+    LOG("snapshot was taken from another module");
+    return -1;
+  }
+  if (header->memory_page_size > 0) {
+    mod->snapshot_image = wasmbox_memory_image_open(
+        snapshot->fp, header->memory_offset, header->memory_page_size);
+    if (mod->snapshot_image == NULL) {
+      return -1;
+    }
+    mod->memory_image = mod->snapshot_image;
+  }
+  return 0;
+}
+
+int wasmbox_snapshot_restore_globals(wasmbox_snapshot_t *snapshot,
+                                     wasmbox_module_t *mod) {
+  wasm_u32_t size = snapshot->header.global_size;
+  if (size != mod->global_size) {
+    LOG("snapshot was taken from another module");
+    return -1;
+  }
+  if (size > 0 &&
+      (fseek(snapshot->fp, sizeof(snapshot->header), SEEK_SET) != 0 ||
+       fread(mod->globals, sizeof(*mod->globals), size, snapshot->fp) !=
+           size)) {
+    LOG("failed to read snapshot");
+    return -1;
+  }
+  return 0;
+}
+
+void wasmbox_snapshot_close(wasmbox_snapshot_t *snapshot) {
+  if (snapshot->fp != NULL) {
+    fclose(snapshot->fp);
+    snapshot->fp = NULL;
+  }
+}
@@ -0,0 +1,65 @@
+/*
+ * Copyright (C) 2021 Masahiro Ide
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef WASMBOX_SNAPSHOT_H
+#define WASMBOX_SNAPSHOT_H
+
+#include "wasmbox/wasmbox.h"
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Layout of a snapshot file. The globals follow the header, and the memory
+ * starts at `memory_offset`, aligned to WASMBOX_PAGE_SIZE so it can be mapped.
+ */
+typedef struct wasmbox_snapshot_header_t {
+  char magic[4];
+  wasm_u32_t version;
+  /* Hash and size of the module binary the snapshot was taken from. */
+  wasm_u64_t source_hash;
+  wasm_u32_t source_size;
+  wasm_u32_t global_size;
+  wasm_u32_t memory_page_size;
+  wasm_u32_t padding;
+  wasm_u64_t memory_offset;
+} wasmbox_snapshot_header_t;
+
+typedef struct wasmbox_snapshot_t {
+  FILE *fp;
+  wasmbox_snapshot_header_t header;
+} wasmbox_snapshot_t;
+
+/**
+ * Opens `mod->snapshot_file`, which must have been taken from the binary of
+ * `source_hash` and `source_size`, and, if it has memory, makes it the memory
+ * image of `mod` so that the memory is mapped from the file.
+ */
+int wasmbox_snapshot_open(wasmbox_snapshot_t *snapshot, wasmbox_module_t *mod);
+
+/* Reads the globals, which the global section has allocated. */
+int wasmbox_snapshot_restore_globals(wasmbox_snapshot_t *snapshot,
+                                     wasmbox_module_t *mod);
+
+void wasmbox_snapshot_close(wasmbox_snapshot_t *snapshot);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* end of include guard */
@@ -0,0 +1,298 @@
+/*
+ * Copyright (C) 2021 Masahiro Ide
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "trace.h"
+#include "allocator.h"
+#include "opcodes.h"
+
+#include <stdio.h>
+#include <string.h> // memcmp, memset
+#include <time.h> // clock_gettime
+
+#ifdef __unix__
+#  include <fcntl.h> // open
+#  include <unistd.h> // write
+#endif
+
+#define LOG(MSG) fprintf(stderr, "(%s:%d)" MSG, __FILE__, __LINE__)
+
+/* Larger rings do not fit an allocation. */
+#define WASMBOX_TRACE_MAX_CAPACITY (1u << 26)
+
+#define WASMBOX_TRACE_MAGIC "WBTR"
+#define WASMBOX_TRACE_VERSION (1)
+
+/* A trace file is this header, the functions, each followed by its name, and
+ * then the records, oldest first. */
+typedef struct wasmbox_trace_header_t {
+  char magic[4];
+  wasm_u32_t version;
+  wasm_u32_t function_size;
+  wasm_u32_t record_size;
+  /* Events recorded, including those overwritten. */
+  wasm_u64_t events;
+} wasmbox_trace_header_t;
+
+typedef struct wasmbox_trace_function_t {
+  wasm_u64_t start;
+  wasm_u64_t end;
+  wasm_u32_t index;
+  wasm_u32_t name_size;
+} wasmbox_trace_function_t;
+
+_Thread_local wasmbox_trace_t *wasmbox_trace_active;
+
+/* The ring of the thread, kept while tracing is stopped. */
+static _Thread_local wasmbox_trace_t *wasmbox_trace_thread;
+
+static wasm_u64_t wasmbox_trace_now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (wasm_u64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void wasmbox_trace_push(wasmbox_trace_t *trace, wasm_u64_t value,
+                               wasm_u16_t opcode) {
+  wasmbox_trace_record_t *record = &trace->records[trace->size & trace->mask];
+  record->value = value;
+  record->opcode = opcode;
+  record->reserved = 0;
+  record->event = (wasm_u32_t) trace->events;
+  trace->size++;
+}
+
+void wasmbox_trace_record(wasmbox_trace_t *trace, wasm_u16_t opcode,
+                          const wasmbox_code_t *code) {
+  if (trace->timestamp_interval > 0 && trace->timestamp_countdown-- == 0) {
+    trace->timestamp_countdown = trace->timestamp_interval - 1;
+    wasmbox_trace_push(trace, wasmbox_trace_now_ns(), WASMBOX_TRACE_TIMESTAMP);
+  }
+  wasmbox_trace_push(trace, (wasm_u64_t) (uintptr_t) code, opcode);
+  trace->events++;
+}
+
+int wasmbox_trace_start(wasm_u32_t capacity, wasm_u32_t timestamp_interval) {
+  if (capacity == 0 || capacity > WASMBOX_TRACE_MAX_CAPACITY) {
+    LOG("capacity out of range\n");
+    return -1;
+  }
+  wasm_u32_t size = 1;
+  while (size < capacity) {
+    size <<= 1;
+  }
+  wasmbox_trace_t *trace = wasmbox_trace_thread;
+  if (trace != NULL && trace->mask + 1 != size) {
+    wasmbox_trace_dispose();
+    trace = NULL;
+  }
+  if (trace == NULL) {
+    trace = (wasmbox_trace_t *) wasmbox_malloc(sizeof(*trace));
+    memset(trace, 0, sizeof(*trace));
+    trace->records = (wasmbox_trace_record_t *) wasmbox_malloc(
+        sizeof(wasmbox_trace_record_t) * size);
+    trace->mask = size - 1;
+    wasmbox_trace_thread = trace;
+  }
+  trace->timestamp_interval = timestamp_interval;
+  trace->timestamp_countdown = 0;
+  wasmbox_trace_active = trace;
+  return 0;
+}
+
+void wasmbox_trace_stop(void) { wasmbox_trace_active = NULL; }
+
+void wasmbox_trace_dispose(void) {
+  wasmbox_trace_t *trace = wasmbox_trace_thread;
+  wasmbox_trace_active = NULL;
+  wasmbox_trace_thread = NULL;
+  if (trace != NULL) {
+    wasmbox_free(trace->records);
+    wasmbox_free(trace);
+  }
+}
+
+#ifdef __unix__
+static int wasmbox_trace_write_all(int fd, const void *data, size_t size) {
+  const char *p = (const char *) data;
+  while (size > 0) {
+    ssize_t n = write(fd, p, size);
+    if (n <= 0) {
+      return -1;
+    }
+    p += n;
+    size -= n;
+  }
+  return 0;
+}
+
+// Only calls async-signal-safe functions and allocates nothing, so a handler
+// of a crash can write the trace.
+int wasmbox_trace_write(wasmbox_module_t *mod, const char *file_name) {
+  wasmbox_trace_t *trace = wasmbox_trace_thread;
+  if (trace == NULL) {
+    return -1;
+  }
+  int fd = open(file_name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    return -1;
+  }
+  wasm_u64_t capacity = (wasm_u64_t) trace->mask + 1;
+  wasm_u64_t size = trace->size < capacity ? trace->size : capacity;
+  wasmbox_trace_header_t header;
+  memcpy(header.magic, WASMBOX_TRACE_MAGIC, sizeof(header.magic));
+  header.version = WASMBOX_TRACE_VERSION;
+  header.function_size = 0;
+  header.record_size = (wasm_u32_t) size;
+  header.events = trace->events;
+  for (wasm_u32_t i = 0; i < mod->function_size; i++) {
+    header.function_size += mod->functions[i]->code_size > 0;
+  }
+  int ret = wasmbox_trace_write_all(fd, &header, sizeof(header));
+  for (wasm_u32_t i = 0; ret == 0 && i < mod->function_size; i++) {
+    wasmbox_function_t *func = mod->functions[i];
+    if (func->code_size == 0) {
+      continue;
+    }
+    wasmbox_trace_function_t entry;
+    entry.start = (wasm_u64_t) (uintptr_t) func->code;
+    entry.end = (wasm_u64_t) (uintptr_t) (func->code + func->code_size);
+    entry.index = i;
+    wasmbox_name_t *name = wasmbox_function_name(mod, i);
+    entry.name_size = name != NULL ? name->len : 0;
+    ret = wasmbox_trace_write_all(fd, &entry, sizeof(entry));
+    if (ret == 0 && entry.name_size > 0) {
+      ret = wasmbox_trace_write_all(fd, name->value, entry.name_size);
+    }
+  }
+  // The oldest record follows the newest one in the ring once it wrapped.
+  wasm_u64_t first = (trace->size - size) & trace->mask;
+  wasm_u64_t tail = capacity - first < size ? capacity - first : size;
+  if (ret == 0) {
+    ret = wasmbox_trace_write_all(fd, &trace->records[first],
+                                  sizeof(wasmbox_trace_record_t) * tail);
+  }
+  if (ret == 0 && tail < size) {
+    ret = wasmbox_trace_write_all(
+        fd, trace->records, sizeof(wasmbox_trace_record_t) * (size - tail));
+  }
+  close(fd);
+  return ret == 0 ? (int) size : -1;
+}
+#else
+int wasmbox_trace_write(wasmbox_module_t *mod, const char *file_name) {
+  (void) mod;
+  (void) file_name;
+  LOG("writing a trace needs a unix\n");
+  return -1;
+}
+#endif /* __unix__ */
+
+static void wasmbox_trace_print_function(FILE *out,
+                                         wasmbox_trace_function_t *functions,
+                                         char **names, wasm_u32_t size,
+                                         wasm_u64_t code) {
+  for (wasm_u32_t i = 0; i < size; i++) {
+    if (functions[i].start <= code && code < functions[i].end) {
+      wasm_u64_t offset = (code - functions[i].start) / sizeof(wasmbox_code_t);
+      if (functions[i].name_size > 0) {
+        fprintf(out, "%.*s+%llu", (int) functions[i].name_size, names[i],
+                (unsigned long long) offset);
+      } else {
+        fprintf(out, "func%u+%llu", functions[i].index,
+                (unsigned long long) offset);
+      }
+      return;
+    }
+  }
+  fprintf(out, "[unknown]");
+}
+
+int wasmbox_trace_decode(const char *file_name, const char *output_file_name) {
+  FILE *in = fopen(file_name, "rb");
+  if (in == NULL) {
+    LOG("failed to open the trace\n");
+    return -1;
+  }
+  wasmbox_trace_header_t header;
+  if (fread(&header, sizeof(header), 1, in) != 1 ||
+      memcmp(header.magic, WASMBOX_TRACE_MAGIC, sizeof(header.magic)) != 0 ||
+      header.version != WASMBOX_TRACE_VERSION) {
+    LOG("not a trace\n");
+    fclose(in);
+    return -1;
+  }
+  wasmbox_trace_function_t *functions =
+      (wasmbox_trace_function_t *) wasmbox_malloc(
+          sizeof(wasmbox_trace_function_t) * (header.function_size + 1));
+  char **names =
+      (char **) wasmbox_malloc(sizeof(char *) * (header.function_size + 1));
+  int ret = 0;
+  for (wasm_u32_t i = 0; ret == 0 && i < header.function_size; i++) {
+    if (fread(&functions[i], sizeof(functions[i]), 1, in) != 1) {
+      ret = -1;
+      break;
+    }
+    names[i] = (char *) wasmbox_malloc(functions[i].name_size + 1);
+    if (fread(names[i], 1, functions[i].name_size, in) !=
+        functions[i].name_size) {
+      ret = -1;
+    }
+  }
+  FILE *out = output_file_name != NULL ? fopen(output_file_name, "w") : stdout;
+  if (out == NULL) {
+    LOG("failed to open the output\n");
+    ret = -1;
+  }
+  // Times are printed relative to the first one.
+  wasm_u64_t first_time = 0;
+  wasm_u32_t records = 0;
+  wasmbox_trace_record_t record;
+  while (ret == 0 && records < header.record_size &&
+         fread(&record, sizeof(record), 1, in) == 1) {
+    records++;
+    if (record.opcode == WASMBOX_TRACE_TIMESTAMP) {
+      if (first_time == 0) {
+        first_time = record.value;
+      }
+      fprintf(out, "%10u  time +%llu ns\n", record.event,
+              (unsigned long long) (record.value - first_time));
+      continue;
+    }
+    fprintf(out, "%10u  ", record.event);
+    wasmbox_trace_print_function(out, functions, names, header.function_size,
+                                 record.value);
+    fprintf(out, "  %s\n",
+            record.opcode <= OPCODE_THREADED_CODE
+                ? debug_opcodes[record.opcode] + strlen("OPCODE_")
+                : "?");
+  }
+  if (ret == 0 && records < header.record_size) {
+    LOG("the trace is cut off\n");
+  }
+  if (out != NULL && out != stdout) {
+    fclose(out);
+  }
+  for (wasm_u32_t i = 0; i < header.function_size; i++) {
+    if (names[i] != NULL) {
+      wasmbox_free(names[i]);
+    }
+  }
+  wasmbox_free(names);
+  wasmbox_free(functions);
+  fclose(in);
+  return ret == 0 ? (int) records : -1;
+}
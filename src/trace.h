@@ -0,0 +1,75 @@
+/*
+ * Copyright (C) 2021 Masahiro Ide
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef WASMBOX_TRACE_H
+#define WASMBOX_TRACE_H
+
+#include "wasmbox/wasmbox.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifdef WASMBOX_VM_USE_TRACE
+/* The opcode of a record which holds the time instead of an instruction. */
+#  define WASMBOX_TRACE_TIMESTAMP (0xffff)
+
+/* One event, as written to a trace file. */
+typedef struct wasmbox_trace_record_t {
+  /* The instruction run, or the CLOCK_MONOTONIC time in nanoseconds. */
+  wasm_u64_t value;
+  wasm_u16_t opcode;
+  wasm_u16_t reserved;
+  /* The low bits of the number of events before this one. */
+  wasm_u32_t event;
+} wasmbox_trace_record_t;
+
+/* The records of a thread, kept in a ring of a power of two. */
+typedef struct wasmbox_trace_t {
+  wasmbox_trace_record_t *records;
+  wasm_u32_t mask;
+  wasm_u32_t timestamp_interval;
+  /* Events left until the next timestamp. */
+  wasm_u32_t timestamp_countdown;
+  /* Records written so far, the oldest being overwritten. */
+  wasm_u64_t size;
+  wasm_u64_t events;
+} wasmbox_trace_t;
+
+/* The ring of the thread while tracing is on, NULL otherwise. */
+extern _Thread_local wasmbox_trace_t *wasmbox_trace_active;
+
+void wasmbox_trace_record(wasmbox_trace_t *trace, wasm_u16_t opcode,
+                          const wasmbox_code_t *code);
+
+/* Records CODE if the thread is tracing. */
+#  define WASMBOX_TRACE(OPCODE, CODE)                         \
+    do {                                                      \
+      wasmbox_trace_t *trace_ = wasmbox_trace_active;         \
+      if (__builtin_expect(trace_ != NULL, 0)) {              \
+        wasmbox_trace_record(trace_, (OPCODE), (CODE));       \
+      }                                                       \
+    } while (0)
+#else
+#  define WASMBOX_TRACE(OPCODE, CODE) ((void) 0)
+#endif /* WASMBOX_VM_USE_TRACE */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* end of include guard */
@@ -0,0 +1,110 @@
+/*
+ * Copyright (C) 2021 Masahiro Ide
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "trap.h"
+#include "memory.h"
+#include <stdio.h>
+#include <stdlib.h> // exit
+
+#ifdef WASMBOX_MEMORY_USE_RESERVATION
+#  include <signal.h>
+#endif
+
+#define LOG(MSG) fprintf(stderr, "(%s:%d)" MSG, __FILE__, __LINE__)
+
+static _Thread_local wasmbox_trap_context_t *current_context;
+
+#ifdef WASMBOX_MEMORY_USE_RESERVATION
+static struct sigaction previous_segv;
+static struct sigaction previous_bus;
+
+// Loads and stores are not bounds checked. An out-of-bounds access touches
+// the guard region of the running module, which is recognized here by the
+// faulting address and turned into a trap.
+static void wasmbox_trap_signal_handler(int sig, siginfo_t *info,
+                                        void *ucontext) {
+  (void) ucontext;
+  wasmbox_trap_context_t *ctx = current_context;
+  struct sigaction *previous = &previous_segv;
+  switch (sig) {
+    case SIGBUS:
+      previous = &previous_bus;
+      /* fallthrough */
+    case SIGSEGV:
+#  ifdef WASMBOX_MEMORY_USE_MEMFD_IMAGE
+      // The first write to a page of a resettable memory.
+      if (wasmbox_memory_handle_write_fault(info->si_addr)) {
+        return;
+      }
+#  endif
+      if (ctx != NULL && wasmbox_memory_contains(ctx->mod, info->si_addr)) {
+        ctx->message = "out of bounds memory access";
+        siglongjmp(ctx->env, 1);
+      }
+      break;
+  }
+  // Not raised by wasm code. Restore the previous handler, which sees the
+  // same fault once the instruction is restarted.
+  sigaction(sig, previous, NULL);
+}
+
+void wasmbox_trap_install_handlers(void) {
+  static char installed;
+  if (__atomic_test_and_set(&installed, __ATOMIC_ACQ_REL)) {
+    return;
+  }
+  struct sigaction action = {};
+  action.sa_sigaction = wasmbox_trap_signal_handler;
+  action.sa_flags = SA_SIGINFO;
+  sigemptyset(&action.sa_mask);
+  sigaction(SIGSEGV, &action, &previous_segv);
+  sigaction(SIGBUS, &action, &previous_bus);
+}
+#endif /* WASMBOX_MEMORY_USE_RESERVATION */
+
+void wasmbox_trap_enter(wasmbox_trap_context_t *ctx, wasmbox_module_t *mod) {
+#ifdef WASMBOX_MEMORY_USE_RESERVATION
+  wasmbox_trap_install_handlers();
+#endif
+  ctx->mod = mod;
+  ctx->message = NULL;
+  ctx->prev = current_context;
+  current_context = ctx;
+}
+
+void wasmbox_trap_leave(wasmbox_trap_context_t *ctx) {
+  current_context = ctx->prev;
+}
+
+void wasmbox_trap_switch_module(wasmbox_module_t *mod) {
+  if (current_context != NULL) {
+    current_context->mod = mod;
+  }
+}
+
+_Noreturn void wasmbox_trap(const char *message) {
+  wasmbox_trap_context_t *ctx = current_context;
+  if (ctx == NULL) {
+    fprintf(stderr, "trap: %s\n", message);
+    exit(-1);
+  }
+  ctx->message = message;
+#ifdef __unix__
+  siglongjmp(ctx->env, 1);
+#else
+  longjmp(ctx->env, 1);
+#endif
+}
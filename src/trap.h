@@ -0,0 +1,78 @@
+/*
+ * Copyright (C) 2021 Masahiro Ide
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef WASMBOX_TRAP_H
+#define WASMBOX_TRAP_H
+
+#include "memory.h"
+#include "wasmbox/wasmbox.h"
+#include <setjmp.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Where a trap raised while running wasm code lands. Contexts nest per thread,
+ * so a trap always unwinds to the innermost wasmbox_eval_module.
+ */
+typedef struct wasmbox_trap_context_t {
+#ifdef __unix__
+  sigjmp_buf env;
+#else
+  jmp_buf env;
+#endif
+  wasmbox_module_t *mod;
+  const char *message;
+  struct wasmbox_trap_context_t *prev;
+} wasmbox_trap_context_t;
+
+/* Evaluates to 0 when entered, and to non-zero when a trap unwinds to it. */
+#ifdef __unix__
+#  define WASMBOX_TRAP_CATCH(CTX) sigsetjmp((CTX)->env, 1)
+#else
+#  define WASMBOX_TRAP_CATCH(CTX) setjmp((CTX)->env)
+#endif
+
+/**
+ * Makes `ctx` the innermost trap context of this thread. Faults in the guard
+ * region of `mod` are turned into traps from now on.
+ */
+void wasmbox_trap_enter(wasmbox_trap_context_t *ctx, wasmbox_module_t *mod);
+void wasmbox_trap_leave(wasmbox_trap_context_t *ctx);
+
+/**
+ * Turns faults in the guard region of `mod` into traps of the innermost
+ * context instead, while a call runs the code of a linked module.
+ */
+void wasmbox_trap_switch_module(wasmbox_module_t *mod);
+
+#ifdef WASMBOX_MEMORY_USE_RESERVATION
+/* Installs the fault handlers. wasmbox_trap_enter does it on first use. */
+void wasmbox_trap_install_handlers(void);
+#endif
+
+/**
+ * Unwinds to the innermost trap context. Exits the process if no wasm code is
+ * running on this thread.
+ */
+_Noreturn void wasmbox_trap(const char *message);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* end of include guard */
@@ -0,0 +1,116 @@
+/*
+ * Copyright (C) 2021 Masahiro Ide
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "type-registry.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* The signatures interned so far, hashed by open addressing. They are kept
+ * for the lifetime of the process, outside of any module allocator. */
+typedef struct wasmbox_type_registry_entry_t {
+  wasm_u32_t hash;
+  wasm_u32_t id;
+  wasmbox_type_t *type;
+} wasmbox_type_registry_entry_t;
+
+static struct {
+  wasmbox_type_registry_entry_t *entries;
+  wasm_u32_t size;
+  wasm_u32_t capacity;
+  char lock;
+} registry;
+
+#define WASMBOX_TYPE_REGISTRY_INIT_SIZE (64)
+
+static wasm_u32_t wasmbox_type_size(const wasmbox_type_t *type) {
+  return sizeof(wasmbox_type_t) +
+         sizeof(type->args[0]) * (type->argument_size + type->return_size);
+}
+
+static wasm_u32_t wasmbox_type_hash(const wasmbox_type_t *type) {
+  // FNV-1a over the parameter and result counts and types.
+  wasm_u32_t hash = 2166136261u;
+  hash = (hash ^ type->argument_size) * 16777619u;
+  hash = (hash ^ type->return_size) * 16777619u;
+  for (wasm_u32_t i = 0; i < type->argument_size + type->return_size; ++i) {
+    hash = (hash ^ (wasm_u32_t) type->args[i]) * 16777619u;
+  }
+  return hash;
+}
+
+static int wasmbox_type_equals(const wasmbox_type_t *t1,
+                               const wasmbox_type_t *t2) {
+  return t1->argument_size == t2->argument_size &&
+         t1->return_size == t2->return_size &&
+         memcmp(t1->args, t2->args,
+                sizeof(t1->args[0]) *
+                    (t1->argument_size + t1->return_size)) == 0;
+}
+
+static wasmbox_type_registry_entry_t *
+wasmbox_type_registry_find(wasmbox_type_registry_entry_t *entries,
+                           wasm_u32_t capacity, wasm_u32_t hash,
+                           const wasmbox_type_t *type) {
+  wasm_u32_t mask = capacity - 1;
+  for (wasm_u32_t i = hash & mask;; i = (i + 1) & mask) {
+    wasmbox_type_registry_entry_t *entry = &entries[i];
+    if (entry->type == NULL ||
+        (entry->hash == hash && wasmbox_type_equals(entry->type, type))) {
+      return entry;
+    }
+  }
+}
+
+// Doubles the table, keeping it at most half full.
+static void wasmbox_type_registry_grow(void) {
+  wasm_u32_t capacity = registry.capacity == 0
+                            ? WASMBOX_TYPE_REGISTRY_INIT_SIZE
+                            : registry.capacity * 2;
+  wasmbox_type_registry_entry_t *entries =
+      (wasmbox_type_registry_entry_t *) calloc(capacity, sizeof(*entries));
+  for (wasm_u32_t i = 0; i < registry.capacity; ++i) {
+    wasmbox_type_registry_entry_t *entry = &registry.entries[i];
+    if (entry->type != NULL) {
+      *wasmbox_type_registry_find(entries, capacity, entry->hash,
+                                  entry->type) = *entry;
+    }
+  }
+  free(registry.entries);
+  registry.entries = entries;
+  registry.capacity = capacity;
+}
+
+wasm_u32_t wasmbox_type_intern(const wasmbox_type_t *type) {
+  wasm_u32_t hash = wasmbox_type_hash(type);
+  while (__atomic_test_and_set(&registry.lock, __ATOMIC_ACQUIRE)) {
+  }
+  if ((registry.size + 1) * 2 > registry.capacity) {
+    wasmbox_type_registry_grow();
+  }
+  wasmbox_type_registry_entry_t *entry = wasmbox_type_registry_find(
+      registry.entries, registry.capacity, hash, type);
+  if (entry->type == NULL) {
+    wasm_u32_t size = wasmbox_type_size(type);
+    entry->type = (wasmbox_type_t *) malloc(size);
+    memcpy(entry->type, type, size);
+    entry->hash = hash;
+    entry->id = registry.size++;
+  }
+  wasm_u32_t id = entry->id;
+  __atomic_clear(&registry.lock, __ATOMIC_RELEASE);
+  return id;
+}
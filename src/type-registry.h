@@ -0,0 +1,37 @@
+/*
+ * Copyright (C) 2021 Masahiro Ide
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef WASMBOX_TYPE_REGISTRY_H
+#define WASMBOX_TYPE_REGISTRY_H
+
+#include "wasmbox/wasmbox.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Returns the canonical id of the signature of `type`. Equal signatures have
+ * the same id in every module of the process, so an indirect call checks the
+ * type of its callee with a single compare. Ids are never reused.
+ */
+wasm_u32_t wasmbox_type_intern(const wasmbox_type_t *type);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* end of include guard */
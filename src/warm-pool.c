@@ -0,0 +1,202 @@
+/*
+ * Copyright (C) 2021 Masahiro Ide
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "allocator.h"
+#include "wasmbox/wasmbox.h"
+
+#include <pthread.h>
+#include <stdio.h>
+
+#define LOG(MSG) fprintf(stderr, "(%s:%d)" MSG, __FILE__, __LINE__)
+
+#define WASMBOX_WARM_POOL_RELEASED_INIT_SIZE (4)
+
+struct wasmbox_warm_pool_t {
+  wasmbox_compiled_module_t *compiled;
+  /* The options of the instances, see wasmbox_instance_init. */
+  wasmbox_instance_t options;
+  pthread_t thread;
+  /* Guards the fields below. */
+  pthread_mutex_t lock;
+  /* Signalled when an instance is taken or released, or on dispose. */
+  pthread_cond_t refill;
+  /* Ready instances, the last one handed out first. */
+  wasmbox_instance_t **ready;
+  wasm_u32_t ready_size;
+  wasm_u32_t size;
+  /* Instances given back, which the thread disposes or resets. */
+  wasmbox_instance_t **released;
+  wasm_u32_t released_size;
+  wasm_u32_t released_capacity;
+  /* Set once an instance could not be initialized, so the thread waits for
+   * the next take or release instead of trying again at once. */
+  wasm_u8_t failed;
+  wasm_u8_t stopping;
+  wasmbox_warm_pool_stats_t stats;
+};
+
+static wasmbox_instance_t *wasmbox_warm_pool_new(wasmbox_warm_pool_t *pool) {
+  wasmbox_instance_t *instance =
+      (wasmbox_instance_t *) wasmbox_malloc(sizeof(wasmbox_instance_t));
+  instance->allocator = pool->options.allocator;
+  instance->instance_pool = pool->options.instance_pool;
+  instance->use_huge_pages = pool->options.use_huge_pages;
+  instance->resettable = pool->options.resettable;
+  instance->memory_image = pool->options.memory_image;
+  instance->shared_memory = pool->options.shared_memory;
+  if (wasmbox_instance_init(instance, pool->compiled) != 0) {
+    LOG("failed to initialize instance");
+    wasmbox_module_dispose(instance);
+    wasmbox_free(instance);
+    return NULL;
+  }
+  return instance;
+}
+
+static void wasmbox_warm_pool_free(wasmbox_instance_t *instance) {
+  wasmbox_module_dispose(instance);
+  wasmbox_free(instance);
+}
+
+// Disposes or resets the released instances, and initializes instances until
+// `size` of them are ready. Initializing runs without the lock, so takes go
+// on meanwhile.
+static void *wasmbox_warm_pool_fill(void *data) {
+  wasmbox_warm_pool_t *pool = (wasmbox_warm_pool_t *) data;
+  pthread_mutex_lock(&pool->lock);
+  while (!pool->stopping) {
+    if (pool->released_size > 0) {
+      wasmbox_instance_t *instance = pool->released[--pool->released_size];
+      int keep = instance->resettable && pool->ready_size < pool->size;
+      pthread_mutex_unlock(&pool->lock);
+      if (keep && wasmbox_instance_reset(instance) != 0) {
+        keep = 0;
+      }
+      if (!keep) {
+        wasmbox_warm_pool_free(instance);
+      }
+      pthread_mutex_lock(&pool->lock);
+      // Only this thread adds ready instances, so there is still room.
+      if (keep) {
+        pool->ready[pool->ready_size++] = instance;
+        pool->stats.reuses++;
+      }
+      continue;
+    }
+    if (pool->ready_size < pool->size && !pool->failed) {
+      pthread_mutex_unlock(&pool->lock);
+      wasmbox_instance_t *instance = wasmbox_warm_pool_new(pool);
+      pthread_mutex_lock(&pool->lock);
+      if (instance != NULL) {
+        pool->ready[pool->ready_size++] = instance;
+      } else {
+        pool->failed = 1;
+      }
+      continue;
+    }
+    pthread_cond_wait(&pool->refill, &pool->lock);
+  }
+  pthread_mutex_unlock(&pool->lock);
+  return NULL;
+}
+
+wasmbox_warm_pool_t *
+wasmbox_warm_pool_create(wasmbox_compiled_module_t *compiled, wasm_u32_t size,
+                         const wasmbox_instance_t *options) {
+  wasmbox_warm_pool_t *pool =
+      (wasmbox_warm_pool_t *) wasmbox_malloc(sizeof(wasmbox_warm_pool_t));
+  pool->compiled = compiled;
+  if (options != NULL) {
+    pool->options = *options;
+  }
+  pool->size = size;
+  pool->ready = (wasmbox_instance_t **) wasmbox_malloc(
+      sizeof(wasmbox_instance_t *) * (size > 0 ? size : 1));
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->refill, NULL);
+  if (pthread_create(&pool->thread, NULL, wasmbox_warm_pool_fill, pool) != 0) {
+    LOG("failed to start thread");
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->refill);
+    wasmbox_free(pool->ready);
+    wasmbox_free(pool);
+    return NULL;
+  }
+  return pool;
+}
+
+wasmbox_instance_t *wasmbox_warm_pool_take(wasmbox_warm_pool_t *pool) {
+  wasmbox_instance_t *instance = NULL;
+  pthread_mutex_lock(&pool->lock);
+  if (pool->ready_size > 0) {
+    instance = pool->ready[--pool->ready_size];
+    pool->stats.hits++;
+  } else {
+    pool->stats.misses++;
+  }
+  pool->failed = 0;
+  pthread_cond_signal(&pool->refill);
+  pthread_mutex_unlock(&pool->lock);
+  return instance != NULL ? instance : wasmbox_warm_pool_new(pool);
+}
+
+void wasmbox_warm_pool_release(wasmbox_warm_pool_t *pool,
+                               wasmbox_instance_t *instance) {
+  pthread_mutex_lock(&pool->lock);
+  if (pool->released == NULL) {
+    pool->released_capacity = WASMBOX_WARM_POOL_RELEASED_INIT_SIZE;
+    pool->released = (wasmbox_instance_t **) wasmbox_malloc(
+        sizeof(wasmbox_instance_t *) * pool->released_capacity);
+  } else if (pool->released_size == pool->released_capacity) {
+    pool->released_capacity *= 2;
+    pool->released = (wasmbox_instance_t **) wasmbox_realloc(
+        pool->released, sizeof(wasmbox_instance_t *) * pool->released_capacity);
+  }
+  pool->released[pool->released_size++] = instance;
+  pool->failed = 0;
+  pthread_cond_signal(&pool->refill);
+  pthread_mutex_unlock(&pool->lock);
+}
+
+void wasmbox_warm_pool_stats(wasmbox_warm_pool_t *pool,
+                             wasmbox_warm_pool_stats_t *stats) {
+  pthread_mutex_lock(&pool->lock);
+  *stats = pool->stats;
+  stats->ready = pool->ready_size;
+  pthread_mutex_unlock(&pool->lock);
+}
+
+void wasmbox_warm_pool_dispose(wasmbox_warm_pool_t *pool) {
+  pthread_mutex_lock(&pool->lock);
+  pool->stopping = 1;
+  pthread_cond_signal(&pool->refill);
+  pthread_mutex_unlock(&pool->lock);
+  pthread_join(pool->thread, NULL);
+  for (wasm_u32_t i = 0; i < pool->ready_size; i++) {
+    wasmbox_warm_pool_free(pool->ready[i]);
+  }
+  for (wasm_u32_t i = 0; i < pool->released_size; i++) {
+    wasmbox_warm_pool_free(pool->released[i]);
+  }
+  if (pool->released != NULL) {
+    wasmbox_free(pool->released);
+  }
+  wasmbox_free(pool->ready);
+  pthread_mutex_destroy(&pool->lock);
+  pthread_cond_destroy(&pool->refill);
+  wasmbox_free(pool);
+}
@@ -0,0 +1,303 @@
+/*
+ * Copyright (C) 2021 Masahiro Ide
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifdef __linux__
+#  define _GNU_SOURCE // preadv, pwritev
+#endif
+
+#include "allocator.h"
+#include "memory.h"
+#include "wasmbox/wasmbox.h"
+
+#include <errno.h>
+#include <stdint.h> // INT64_MAX
+#include <string.h> // memcpy
+
+#ifdef __unix__
+#  include <sys/uio.h> // readv, writev
+#  include <unistd.h>
+#endif
+
+/* Errors of WASI preview1 returned by the calls. */
+#define WASMBOX_WASI_SUCCESS  (0)
+#define WASMBOX_WASI_EACCES   (2)
+#define WASMBOX_WASI_EAGAIN   (6)
+#define WASMBOX_WASI_EBADF    (8)
+#define WASMBOX_WASI_EDQUOT   (19)
+#define WASMBOX_WASI_EFAULT   (21)
+#define WASMBOX_WASI_EFBIG    (22)
+#define WASMBOX_WASI_EINTR    (27)
+#define WASMBOX_WASI_EINVAL   (28)
+#define WASMBOX_WASI_EIO      (29)
+#define WASMBOX_WASI_EISDIR   (31)
+#define WASMBOX_WASI_ENOSPC   (51)
+#define WASMBOX_WASI_ENOSYS   (52)
+#define WASMBOX_WASI_ENXIO    (60)
+#define WASMBOX_WASI_EOVERFLOW (61)
+#define WASMBOX_WASI_EPERM    (63)
+#define WASMBOX_WASI_EPIPE    (64)
+#define WASMBOX_WASI_ESPIPE   (70)
+
+/* Iovecs passed to the host per call. A longer list is a short read or write,
+ * which the guest continues as for any other. */
+#define WASMBOX_WASI_MAX_IOVS (64)
+
+#define WASMBOX_WASI_FD_INIT_SIZE (8)
+#define WASMBOX_WASI_MAX_FDS      (65536)
+
+#define WASMBOX_WASI_FUNCTION_SIZE (4)
+
+struct wasmbox_wasi_t {
+  wasmbox_host_function_t functions[WASMBOX_WASI_FUNCTION_SIZE];
+  /* Host file descriptor per guest one, or -1. */
+  int *fds;
+  wasm_u32_t fd_size;
+};
+
+static int wasmbox_wasi_host_fd(wasmbox_wasi_t *wasi, wasm_u32_t fd) {
+  return fd < wasi->fd_size ? wasi->fds[fd] : -1;
+}
+
+#ifdef __unix__
+static wasm_u32_t wasmbox_wasi_errno(int error) {
+  switch (error) {
+    case EACCES:
+      return WASMBOX_WASI_EACCES;
+    case EAGAIN:
+      return WASMBOX_WASI_EAGAIN;
+    case EBADF:
+      return WASMBOX_WASI_EBADF;
+    case EDQUOT:
+      return WASMBOX_WASI_EDQUOT;
+    case EFAULT:
+      return WASMBOX_WASI_EFAULT;
+    case EFBIG:
+      return WASMBOX_WASI_EFBIG;
+    case EINTR:
+      return WASMBOX_WASI_EINTR;
+    case EINVAL:
+      return WASMBOX_WASI_EINVAL;
+    case EISDIR:
+      return WASMBOX_WASI_EISDIR;
+    case ENOSPC:
+      return WASMBOX_WASI_ENOSPC;
+    case ENXIO:
+      return WASMBOX_WASI_ENXIO;
+    case EOVERFLOW:
+      return WASMBOX_WASI_EOVERFLOW;
+    case EPERM:
+      return WASMBOX_WASI_EPERM;
+    case EPIPE:
+      return WASMBOX_WASI_EPIPE;
+    case ESPIPE:
+      return WASMBOX_WASI_ESPIPE;
+    default:
+      return WASMBOX_WASI_EIO;
+  }
+}
+
+// Points `iov` at the buffers which the `size` iovecs at `addr` give in the
+// linear memory of `mod`, and stores how many there are in `count`. Returns
+// a WASI error if one of them is out of bounds.
+static wasm_u32_t wasmbox_wasi_iovecs(wasmbox_module_t *mod, wasm_u32_t addr,
+                                      wasm_u32_t size, struct iovec *iov,
+                                      int *count) {
+  if (mod->memory_block == NULL) {
+    return WASMBOX_WASI_EFAULT;
+  }
+  wasm_u8_t *memory = mod->memory_block->data;
+  wasm_u64_t memory_size =
+      (wasm_u64_t) WASMBOX_PAGE_SIZE * wasmbox_memory_size(mod);
+  if (size > WASMBOX_WASI_MAX_IOVS) {
+    size = WASMBOX_WASI_MAX_IOVS;
+  }
+  if ((wasm_u64_t) addr + 8 * (wasm_u64_t) size > memory_size) {
+    return WASMBOX_WASI_EFAULT;
+  }
+  for (wasm_u32_t i = 0; i < size; i++) {
+    wasm_u32_t buf, len;
+    memcpy(&buf, memory + addr + 8 * i, sizeof(buf));
+    memcpy(&len, memory + addr + 8 * i + 4, sizeof(len));
+    if ((wasm_u64_t) buf + len > memory_size) {
+      return WASMBOX_WASI_EFAULT;
+    }
+    iov[i].iov_base = memory + buf;
+    iov[i].iov_len = len;
+  }
+  *count = (int) size;
+  return WASMBOX_WASI_SUCCESS;
+}
+
+// Stores the result of a call in the u32 at `addr`.
+static wasm_u32_t wasmbox_wasi_store_size(wasmbox_module_t *mod,
+                                          wasm_u32_t addr, ssize_t value) {
+  if (value < 0) {
+    return wasmbox_wasi_errno(errno);
+  }
+  wasm_u64_t memory_size =
+      (wasm_u64_t) WASMBOX_PAGE_SIZE * wasmbox_memory_size(mod);
+  if ((wasm_u64_t) addr + 4 > memory_size) {
+    return WASMBOX_WASI_EFAULT;
+  }
+  wasm_u32_t size = (wasm_u32_t) value;
+  memcpy(mod->memory_block->data + addr, &size, sizeof(size));
+  return WASMBOX_WASI_SUCCESS;
+}
+
+// Runs an I/O call with arguments (fd, iovs, iovs_len, [offset,] result),
+// where `offset` is there only if `positioned` is set.
+static wasm_u32_t wasmbox_wasi_io(wasmbox_module_t *mod,
+                                  const wasmbox_value_t *args,
+                                  wasmbox_wasi_t *wasi, int write,
+                                  int positioned) {
+  int fd = wasmbox_wasi_host_fd(wasi, args[0].u32);
+  if (fd < 0) {
+    return WASMBOX_WASI_EBADF;
+  }
+  struct iovec iov[WASMBOX_WASI_MAX_IOVS];
+  int count = 0;
+  wasm_u32_t error =
+      wasmbox_wasi_iovecs(mod, args[1].u32, args[2].u32, iov, &count);
+  if (error != WASMBOX_WASI_SUCCESS) {
+    return error;
+  }
+  ssize_t ret;
+  if (positioned) {
+    if (args[3].u64 > (wasm_u64_t) INT64_MAX) {
+      return WASMBOX_WASI_EINVAL;
+    }
+    off_t offset = (off_t) args[3].u64;
+    ret = write ? pwritev(fd, iov, count, offset)
+                : preadv(fd, iov, count, offset);
+  } else {
+    ret = write ? writev(fd, iov, count) : readv(fd, iov, count);
+  }
+  return wasmbox_wasi_store_size(mod, args[positioned ? 4 : 3].u32, ret);
+}
+#else
+static wasm_u32_t wasmbox_wasi_io(wasmbox_module_t *mod,
+                                  const wasmbox_value_t *args,
+                                  wasmbox_wasi_t *wasi, int write,
+                                  int positioned) {
+  (void) mod;
+  (void) write;
+  (void) positioned;
+  return wasmbox_wasi_host_fd(wasi, args[0].u32) < 0 ? WASMBOX_WASI_EBADF
+                                                     : WASMBOX_WASI_ENOSYS;
+}
+#endif
+
+static void wasmbox_wasi_fd_read(wasmbox_module_t *mod,
+                                 const wasmbox_value_t *args,
+                                 wasmbox_value_t *results, void *data) {
+  results[0].u32 = wasmbox_wasi_io(mod, args, (wasmbox_wasi_t *) data, 0, 0);
+}
+
+static void wasmbox_wasi_fd_write(wasmbox_module_t *mod,
+                                  const wasmbox_value_t *args,
+                                  wasmbox_value_t *results, void *data) {
+  results[0].u32 = wasmbox_wasi_io(mod, args, (wasmbox_wasi_t *) data, 1, 0);
+}
+
+static void wasmbox_wasi_fd_pread(wasmbox_module_t *mod,
+                                  const wasmbox_value_t *args,
+                                  wasmbox_value_t *results, void *data) {
+  results[0].u32 = wasmbox_wasi_io(mod, args, (wasmbox_wasi_t *) data, 0, 1);
+}
+
+static void wasmbox_wasi_fd_pwrite(wasmbox_module_t *mod,
+                                   const wasmbox_value_t *args,
+                                   wasmbox_value_t *results, void *data) {
+  results[0].u32 = wasmbox_wasi_io(mod, args, (wasmbox_wasi_t *) data, 1, 1);
+}
+
+// (fd, iovs, iovs_len, result) -> errno
+static const wasmbox_value_type_t wasmbox_wasi_io_types[] = {
+    WASM_TYPE_I32, WASM_TYPE_I32, WASM_TYPE_I32, WASM_TYPE_I32, WASM_TYPE_I32};
+// (fd, iovs, iovs_len, offset, result) -> errno
+static const wasmbox_value_type_t wasmbox_wasi_positioned_io_types[] = {
+    WASM_TYPE_I32, WASM_TYPE_I32, WASM_TYPE_I32,
+    WASM_TYPE_I64, WASM_TYPE_I32, WASM_TYPE_I32};
+
+wasmbox_wasi_t *wasmbox_wasi_create(void) {
+  wasmbox_wasi_t *wasi = (wasmbox_wasi_t *) wasmbox_malloc(sizeof(*wasi));
+  static const struct {
+    const char *name;
+    void (*entry)(wasmbox_module_t *mod, const wasmbox_value_t *args,
+                  wasmbox_value_t *results, void *data);
+    const wasmbox_value_type_t *types;
+    wasm_u16_t param_size;
+  } functions[WASMBOX_WASI_FUNCTION_SIZE] = {
+      {"fd_read", wasmbox_wasi_fd_read, wasmbox_wasi_io_types, 4},
+      {"fd_write", wasmbox_wasi_fd_write, wasmbox_wasi_io_types, 4},
+      {"fd_pread", wasmbox_wasi_fd_pread, wasmbox_wasi_positioned_io_types, 5},
+      {"fd_pwrite", wasmbox_wasi_fd_pwrite, wasmbox_wasi_positioned_io_types,
+       5},
+  };
+  for (wasm_u32_t i = 0; i < WASMBOX_WASI_FUNCTION_SIZE; i++) {
+    wasmbox_host_function_t *host = &wasi->functions[i];
+    host->module = "wasi_snapshot_preview1";
+    host->name = functions[i].name;
+    host->kind = WASMBOX_HOST_FRAME;
+    host->entry.frame = functions[i].entry;
+    host->data = wasi;
+    // The calls read their arguments and write their result blindly, so
+    // only the preview1 signatures are accepted.
+    host->types = functions[i].types;
+    host->param_size = functions[i].param_size;
+    host->result_size = 1;
+  }
+  wasi->fd_size = WASMBOX_WASI_FD_INIT_SIZE;
+  wasi->fds = (int *) wasmbox_malloc(sizeof(int) * wasi->fd_size);
+  for (wasm_u32_t i = 0; i < wasi->fd_size; i++) {
+    wasi->fds[i] = i <= 2 ? (int) i : -1;
+  }
+  return wasi;
+}
+
+int wasmbox_wasi_map_fd(wasmbox_wasi_t *wasi, wasm_u32_t fd, int host_fd) {
+  if (fd >= WASMBOX_WASI_MAX_FDS) {
+    return -1;
+  }
+  if (fd >= wasi->fd_size) {
+    if (host_fd < 0) {
+      return 0;
+    }
+    wasm_u32_t size = wasi->fd_size;
+    while (size <= fd) {
+      size *= 2;
+    }
+    wasi->fds = (int *) wasmbox_realloc(wasi->fds, sizeof(int) * size);
+    for (wasm_u32_t i = wasi->fd_size; i < size; i++) {
+      wasi->fds[i] = -1;
+    }
+    wasi->fd_size = size;
+  }
+  wasi->fds[fd] = host_fd < 0 ? -1 : host_fd;
+  return 0;
+}
+
+const wasmbox_host_function_t *wasmbox_wasi_functions(wasmbox_wasi_t *wasi,
+                                                      wasm_u32_t *size) {
+  *size = WASMBOX_WASI_FUNCTION_SIZE;
+  return wasi->functions;
+}
+
+void wasmbox_wasi_dispose(wasmbox_wasi_t *wasi) {
+  wasmbox_free(wasi->fds);
+  wasmbox_free(wasi);
+}
@@ -17,17 +17,61 @@
 #include "wasmbox/wasmbox.h"
 
 #include "allocator.h"
+#include "aot.h"
+#include "code-cache.h"
+#include "code-share.h"
+#include "debug-line.h"
 #include "input-stream.h"
+#include "instance-pool.h"
 #include "interpreter.h"
+#include "jit.h"
 #include "leb128.h"
+#include "memory.h"
+#include "memory-profile.h"
+#include "opcode-profile.h"
 #include "opcodes.h"
+#include "optimizer.h"
+#include "simd.h"
+#include "snapshot.h"
+#include "type-registry.h"
 
 #include <assert.h>
+#include <stdarg.h>
 #include <stdio.h>
+#include <stdlib.h> // qsort, bsearch
 #include <string.h>
+#include <time.h> // clock_gettime
+
+/* Lazily compiled bodies are not compiled while the module is loaded. */
+#if defined(WASMBOX_VM_USE_PARALLEL_COMPILE) && \
+    !defined(WASMBOX_VM_USE_LAZY_COMPILE)
+#  define WASMBOX_PARALLEL_COMPILE_ENABLED 1
+#  include <pthread.h>
+#  include <unistd.h> // sysconf
+#endif
 
 #define LOG(MSG) fprintf(stderr, "(%s:%d)" MSG, __FILE__, __LINE__)
 
+/* Default of wasmbox_module_t::inline_threshold. */
+#define WASMBOX_INLINE_THRESHOLD (8)
+/* Maximum number of instructions of an arm of an if/else lowered to SELECT. */
+#define WASMBOX_IF_CONVERSION_LIMIT (4)
+/* Maximum number of entries of a table, whatever its limits say. */
+#define WASMBOX_TABLE_SIZE_LIMIT (1 << 24)
+/* Functions laid out together start on a 16-byte boundary. */
+#define WASMBOX_CODE_LAYOUT_ALIGN(SIZE) (((SIZE) + 15) & ~(wasm_u64_t) 15)
+
+struct wasmbox_compiled_module_t {
+  /* Loaded and never run. Its state is the initial state of the instances. */
+  wasmbox_module_t mod;
+  wasmbox_memory_image_t *memory_image;
+};
+
+// Returns the module which owns the code `mod` runs.
+static wasmbox_module_t *wasmbox_module_code_owner(wasmbox_module_t *mod) {
+  return mod->compiled != NULL ? &mod->compiled->mod : mod;
+}
+
 /* Module API */
 #define MODULE_TYPES_INIT_SIZE 4
 static void wasmbox_module_register_new_type(wasmbox_module_t *mod,
@@ -43,6 +87,8 @@ static void wasmbox_module_register_new_type(wasmbox_module_t *mod,
     mod->types = (wasmbox_type_t **) wasmbox_realloc(
         mod->types, sizeof(mod->types) * mod->type_capacity);
   }
+  // Equal types share an id, so an indirect call compares the ids only.
+  func_type->id = wasmbox_type_intern(func_type);
   mod->types[mod->type_size++] = func_type;
 }
 
@@ -62,6 +108,9 @@ wasmbox_module_register_new_function(wasmbox_module_t *mod,
         mod->functions,
         sizeof(wasmbox_mutable_function_t) * mod->function_capacity);
   }
+#ifdef WASMBOX_VM_USE_COMPACT_CODE
+  func->index = mod->function_size;
+#endif
   mod->functions[mod->function_size++] = (wasmbox_function_t *) func;
 }
 
@@ -75,31 +124,335 @@ static int wasmbox_module_add_memory_page(wasmbox_module_t *mod,
     LOG("not supported");
     return -1;
   }
-  wasm_u32_t block_size = WASMBOX_PAGE_SIZE * memory_size->min;
-  mod->memory_block = (wasmbox_memory_block_t *) wasmbox_malloc(
-      sizeof(*mod->memory_block) + block_size);
-  mod->memory_block_size = memory_size->min;
-  mod->memory_block_capacity = memory_size->max;
-  return 0;
+  mod->memory64 = memory_size->memory64;
+  if (memory_size->shared) {
+    return wasmbox_memory_init_shared(mod, memory_size->min, memory_size->max);
+  }
+  return wasmbox_memory_init(mod, memory_size->min, memory_size->max);
 }
 
-static void wasmbox_function_add_table(wasmbox_mutable_function_t *func,
-                                       wasmbox_table_t *table) {
+static wasm_u32_t wasmbox_function_add_table(wasmbox_mutable_function_t *func,
+                                             wasmbox_table_t *table) {
   if (func->tables == NULL) {
-    func->tables =
-        (wasmbox_table_t **) wasmbox_malloc(sizeof(wasmbox_table_t *));
+    func->tables = (wasmbox_table_t **) wasmbox_arena_alloc(
+        func->arena, sizeof(wasmbox_table_t *));
     func->table_size = 0;
     func->table_capacity = 1;
   }
-  if (func->table_size + 1 == func->table_capacity) {
+  if (func->table_size == func->table_capacity) {
+    func->tables = (wasmbox_table_t **) wasmbox_arena_realloc(
+        func->arena, func->tables,
+        sizeof(wasmbox_table_t *) * func->table_capacity,
+        sizeof(wasmbox_table_t *) * func->table_capacity * 2);
     func->table_capacity *= 2;
-    func->tables = (wasmbox_table_t **) wasmbox_realloc(
-        func->tables, sizeof(wasmbox_table_t *) * func->table_capacity);
-    bzero(func->tables + func->table_size,
-          (func->table_capacity - func->table_size) *
-              sizeof(wasmbox_table_t *));
   }
-  func->tables[func->table_size++] = table;
+  func->tables[func->table_size] = table;
+  return func->table_size++;
+}
+
+wasmbox_call_cache_t *wasmbox_module_add_call_cache(wasmbox_module_t *mod,
+                                                    wasmbox_type_t *type,
+                                                    wasm_u32_t tableidx) {
+  wasmbox_call_cache_t *cache =
+      (wasmbox_call_cache_t *) wasmbox_malloc(sizeof(wasmbox_call_cache_t));
+  cache->type = type;
+  cache->type_id = type->id;
+  cache->tableidx = tableidx;
+#ifdef WASMBOX_VM_USE_PARALLEL_COMPILE
+  // Call sites are decoded by several threads.
+  cache->next = __atomic_load_n(&mod->call_caches, __ATOMIC_RELAXED);
+  while (!__atomic_compare_exchange_n(&mod->call_caches, &cache->next, cache,
+                                      1, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+  }
+#else
+  cache->next = mod->call_caches;
+  mod->call_caches = cache;
+#endif
+  return cache;
+}
+
+void wasmbox_table_entry_set(wasmbox_ref_table_t *table,
+                             wasmbox_table_entry_t *entry, wasm_u64_t ref) {
+  entry->ref = ref;
+  entry->code = NULL;
+  entry->type_id = WASMBOX_TABLE_ENTRY_EMPTY;
+  entry->frame_size = 0;
+  if (ref != 0 && table->type == WASM_TYPE_FUNCREF) {
+    wasmbox_function_t *func = (wasmbox_function_t *) (uintptr_t) ref;
+    // A function not compiled yet is called through its stub, which checks
+    // the frame again once its size is known.
+    entry->code = __atomic_load_n(&func->code, __ATOMIC_ACQUIRE);
+    entry->type_id = func->type->id;
+    entry->frame_size = func->frame_size;
+  }
+}
+
+wasm_s32_t wasmbox_table_grow(wasmbox_ref_table_t *table, wasm_u32_t delta,
+                              wasm_u64_t ref) {
+  wasm_u32_t size = table->size;
+  wasm_u32_t max =
+      table->max < WASMBOX_TABLE_SIZE_LIMIT ? table->max
+                                            : WASMBOX_TABLE_SIZE_LIMIT;
+  if (delta > max - size) {
+    return -1;
+  }
+  if (size + delta > table->capacity) {
+    wasm_u32_t capacity = table->capacity * 2;
+    if (capacity < size + delta) {
+      capacity = size + delta;
+    }
+    if (capacity > max) {
+      capacity = max;
+    }
+    wasm_u32_t bytes = sizeof(wasmbox_table_entry_t) * capacity;
+    table->entries = (wasmbox_table_entry_t *) (
+        table->entries == NULL ? wasmbox_malloc(bytes)
+                               : wasmbox_realloc(table->entries, bytes));
+    table->capacity = capacity;
+  }
+  for (wasm_u32_t i = size; i < size + delta; ++i) {
+    wasmbox_table_entry_set(table, &table->entries[i], ref);
+  }
+  table->size = size + delta;
+  return size;
+}
+
+static int wasmbox_module_add_table(wasmbox_module_t *mod,
+                                    wasmbox_value_type_t type,
+                                    wasmbox_limit_t *limit) {
+  if (limit->min > WASMBOX_TABLE_SIZE_LIMIT || limit->min > limit->max) {
+    LOG("table too large");
+    return -1;
+  }
+  wasm_u32_t bytes = sizeof(wasmbox_ref_table_t) * (mod->table_size + 1);
+  mod->tables = (wasmbox_ref_table_t *) (
+      mod->tables == NULL ? wasmbox_malloc(bytes)
+                          : wasmbox_realloc(mod->tables, bytes));
+  wasmbox_ref_table_t *table = &mod->tables[mod->table_size++];
+  table->type = type;
+  table->size = 0;
+  table->max = limit->max;
+  table->capacity = 0;
+  table->entries = NULL;
+  wasmbox_table_grow(table, limit->min, 0);
+  return 0;
+}
+
+// Fills the entries of functions in, once the code of every function is set.
+static void wasmbox_module_link_tables(wasmbox_module_t *mod) {
+  for (wasm_u32_t i = 0; i < mod->table_size; ++i) {
+    wasmbox_ref_table_t *table = &mod->tables[i];
+    for (wasm_u32_t j = 0; j < table->size; ++j) {
+      wasmbox_table_entry_set(table, &table->entries[j],
+                              table->entries[j].ref);
+    }
+  }
+}
+
+static wasmbox_ref_table_t *wasmbox_tables_copy(wasmbox_ref_table_t *tables,
+                                                wasm_u32_t size) {
+  if (size == 0) {
+    return NULL;
+  }
+  wasmbox_ref_table_t *copy = (wasmbox_ref_table_t *) wasmbox_malloc(
+      sizeof(wasmbox_ref_table_t) * size);
+  for (wasm_u32_t i = 0; i < size; ++i) {
+    copy[i] = tables[i];
+    copy[i].capacity = tables[i].size;
+    copy[i].entries = NULL;
+    if (tables[i].size > 0) {
+      copy[i].entries = (wasmbox_table_entry_t *) wasmbox_malloc(
+          sizeof(wasmbox_table_entry_t) * tables[i].size);
+      memcpy(copy[i].entries, tables[i].entries,
+             sizeof(wasmbox_table_entry_t) * tables[i].size);
+    }
+  }
+  return copy;
+}
+
+static void wasmbox_tables_dispose(wasmbox_ref_table_t *tables,
+                                   wasm_u32_t size) {
+  if (tables == NULL) {
+    return;
+  }
+  for (wasm_u32_t i = 0; i < size; ++i) {
+    if (tables[i].entries != NULL) {
+      wasmbox_free(tables[i].entries);
+    }
+  }
+  wasmbox_free(tables);
+}
+
+#ifdef WASMBOX_VM_USE_COMPACT_CODE
+#  define CONSTANT_INIT_SIZE 4
+static wasm_u32_t
+wasmbox_function_add_constant(wasmbox_mutable_function_t *func,
+                              wasmbox_code_constant_t constant) {
+  if (func->constants == NULL) {
+    func->constants = (wasmbox_code_constant_t *) wasmbox_arena_alloc(
+        func->arena, sizeof(wasmbox_code_constant_t) * CONSTANT_INIT_SIZE);
+    func->constant_size = 0;
+    func->constant_capacity = CONSTANT_INIT_SIZE;
+  }
+  if (func->constant_size == func->constant_capacity) {
+    func->constants = (wasmbox_code_constant_t *) wasmbox_arena_realloc(
+        func->arena, func->constants,
+        sizeof(wasmbox_code_constant_t) * func->constant_capacity,
+        sizeof(wasmbox_code_constant_t) * func->constant_capacity * 2);
+    func->constant_capacity *= 2;
+  }
+  func->constants[func->constant_size] = constant;
+  return func->constant_size++;
+}
+
+// Returns the operand of `code` which holds the index of a constant until
+// the function is frozen, or NULL.
+static union wasmbox_code_operands *
+wasmbox_code_constant_operand(wasmbox_code_t *code) {
+  switch (code->h.opcode) {
+#  define FUNC(opcode, type, inst, attr, vmopcode) case vmopcode:
+    CONST_OP_EACH(FUNC)
+#  undef FUNC
+    case OPCODE_STATIC_CALL:
+    case OPCODE_STATIC_TAIL_CALL:
+    case OPCODE_DYNAMIC_CALL:
+    case OPCODE_DYNAMIC_TAIL_CALL:
+    case OPCODE_REF_FUNC:
+    case OPCODE_HOTNESS:
+    case OPCODE_MODULE_CALL:
+      return &code->op1;
+#  define FUNC(wtype, type, operand, inst, vmopcode) case vmopcode:
+      IMMEDIATE_INST_EACH(FUNC)
+#  undef FUNC
+#  define FUNC(type, operand, inst, vmopcode) case vmopcode:
+      DIVISION_MAGIC_INST_EACH(FUNC)
+#  undef FUNC
+      return &code->op2;
+    default:
+      return NULL;
+  }
+}
+
+// Returns 1 if the constant of `code` is a function, which frozen code
+// refers to by its index in the module instead.
+static int wasmbox_code_refers_function(wasmbox_code_t *code) {
+  switch (code->h.opcode) {
+    case OPCODE_STATIC_CALL:
+    case OPCODE_STATIC_TAIL_CALL:
+    case OPCODE_REF_FUNC:
+    case OPCODE_HOTNESS:
+      return 1;
+    default:
+      return 0;
+  }
+}
+
+// Replaces the functions in the code of `func` by their indices and keeps
+// only the constants which the code still refers to, in the order of their
+// first use.
+static void wasmbox_function_pack_constants(wasmbox_mutable_function_t *func) {
+  if (func->constant_size == 0) {
+    return;
+  }
+  wasm_u16_t *map = (wasm_u16_t *) wasmbox_arena_alloc(
+      func->arena, sizeof(wasm_u16_t) * func->constant_size);
+  memset(map, 0xff, sizeof(wasm_u16_t) * func->constant_size);
+  wasmbox_code_constant_t *constants =
+      (wasmbox_code_constant_t *) wasmbox_arena_alloc(
+          func->arena, sizeof(wasmbox_code_constant_t) * func->constant_size);
+  wasm_u16_t size = 0;
+  for (wasm_u16_t i = 0; i < func->block_size; ++i) {
+    wasmbox_block_t *block = &func->blocks[i];
+    for (int j = 0; j < block->code_size; ++j) {
+      wasmbox_code_t *code = &block->code[j];
+      union wasmbox_code_operands *op = wasmbox_code_constant_operand(code);
+      if (op == NULL) {
+        continue;
+      }
+      wasmbox_code_constant_t *constant = &func->constants[op->index];
+      if (wasmbox_code_refers_function(code)) {
+        op->index = ((wasmbox_mutable_function_t *) constant->func)->index;
+        continue;
+      }
+      if (map[op->index] == UINT16_MAX) {
+        constants[size] = *constant;
+        map[op->index] = size++;
+      }
+      op->index = map[op->index];
+    }
+  }
+  func->constants = constants;
+  func->constant_size = size;
+  func->constant_capacity = func->constant_size;
+}
+
+// Converts constant pool index `op` to the offset from `code`, which is placed
+// in the final code buffer.
+static void wasmbox_code_link_constant(wasmbox_mutable_function_t *func,
+                                       union wasmbox_code_operands *op,
+                                       wasmbox_code_t *code) {
+  wasmbox_code_constant_t *constants =
+      (wasmbox_code_constant_t *) (func->base.code + func->base.code_size);
+  op->offset = (wasm_s32_t) ((char *) &constants[op->index] - (char *) code);
+}
+#endif /* WASMBOX_VM_USE_COMPACT_CODE */
+
+// Operand accessors to hide the difference of the instruction encoding until
+// the function is linked.
+static void wasmbox_code_set_value(wasmbox_mutable_function_t *func,
+                                   union wasmbox_code_operands *op,
+                                   wasmbox_value_t v) {
+#ifdef WASMBOX_VM_USE_COMPACT_CODE
+  wasmbox_code_constant_t constant;
+  constant.value = v;
+  op->index = wasmbox_function_add_constant(func, constant);
+#else
+  op->value = v;
+#endif
+}
+
+static wasmbox_value_t
+wasmbox_code_get_value(wasmbox_mutable_function_t *func,
+                       union wasmbox_code_operands *op) {
+#ifdef WASMBOX_VM_USE_COMPACT_CODE
+  return func->constants[op->index].value;
+#else
+  return op->value;
+#endif
+}
+
+static void wasmbox_code_set_func(wasmbox_mutable_function_t *func,
+                                  union wasmbox_code_operands *op,
+                                  wasmbox_function_t *callee) {
+#ifdef WASMBOX_VM_USE_COMPACT_CODE
+  wasmbox_code_constant_t constant;
+  constant.func = callee;
+  op->index = wasmbox_function_add_constant(func, constant);
+#else
+  op->func = callee;
+#endif
+}
+
+static void wasmbox_code_set_cache(wasmbox_mutable_function_t *func,
+                                   union wasmbox_code_operands *op,
+                                   wasmbox_call_cache_t *cache) {
+#ifdef WASMBOX_VM_USE_COMPACT_CODE
+  wasmbox_code_constant_t constant;
+  constant.cache = cache;
+  op->index = wasmbox_function_add_constant(func, constant);
+#else
+  op->cache = cache;
+#endif
+}
+
+static void wasmbox_code_set_target(union wasmbox_code_operands *op,
+                                    wasmbox_code_t *code,
+                                    wasmbox_code_t *target) {
+#ifdef WASMBOX_VM_USE_COMPACT_CODE
+  op->offset = (wasm_s32_t) ((char *) target - (char *) code);
+#else
+  op->code = target;
+#endif
 }
 
 #define STACK_INIT_SIZE 4
@@ -107,50 +460,400 @@ static void wasmbox_function_add_table(wasmbox_mutable_function_t *func,
 static void
 wasmbox_function_stack_expand_if_needed(wasmbox_mutable_function_t *func) {
   if (func->operand_stack == NULL) {
-    func->operand_stack = (wasm_s16_t *) wasmbox_malloc(
-        sizeof(*func->operand_stack) * STACK_INIT_SIZE);
+    func->operand_stack = (wasm_s16_t *) wasmbox_arena_alloc(
+        func->arena, sizeof(*func->operand_stack) * STACK_INIT_SIZE);
+    func->operand_types = (wasm_u8_t *) wasmbox_arena_alloc(
+        func->arena, sizeof(*func->operand_types) * STACK_INIT_SIZE);
     func->stack_size = 0;
     func->stack_capacity = STACK_INIT_SIZE;
   }
   if (func->stack_size + 1 == func->stack_capacity) {
+    func->operand_stack = (wasm_s16_t *) wasmbox_arena_realloc(
+        func->arena, func->operand_stack,
+        sizeof(*func->operand_stack) * func->stack_capacity,
+        sizeof(*func->operand_stack) * func->stack_capacity * 2);
+    func->operand_types = (wasm_u8_t *) wasmbox_arena_realloc(
+        func->arena, func->operand_types,
+        sizeof(*func->operand_types) * func->stack_capacity,
+        sizeof(*func->operand_types) * func->stack_capacity * 2);
     func->stack_capacity *= 2;
-    func->operand_stack = (wasm_s16_t *) wasmbox_realloc(
-        func->operand_stack,
-        sizeof(*func->operand_stack) * func->stack_capacity);
-    bzero(func->operand_stack + func->stack_size,
-          (func->stack_capacity - func->stack_size) * sizeof(wasm_s16_t));
   }
 }
 
+static void wasmbox_function_reserve_frame(wasmbox_mutable_function_t *func,
+                                           wasm_u32_t size) {
+  if (func->base.frame_size < size) {
+    func->base.frame_size = size;
+  }
+}
+
+// Code after a branch is unreachable, where the operand stack is
+// polymorphic: its instructions may pop values nothing pushed.
+static int wasmbox_function_is_reachable(wasmbox_mutable_function_t *func) {
+  return func->current_block_id < 0 ||
+         !func->blocks[func->current_block_id].already_terminated;
+}
+
+// Returns 0 if the innermost block has `size` values on the operand stack.
+// Marks the body invalid if it has not and its code is reachable.
+static int wasmbox_function_check_stack(wasmbox_mutable_function_t *func,
+                                        wasm_u32_t size) {
+  if (func->stack_size - func->stack_floor >= (wasm_s32_t) size) {
+    return 0;
+  }
+  if (wasmbox_function_is_reachable(func)) {
+    LOG("operand stack underflow");
+    func->invalid = 1;
+  }
+  return -1;
+}
+
+static int wasmbox_value_type_is_reference(wasmbox_value_type_t type) {
+  return type == WASM_TYPE_FUNCREF || type == WASM_TYPE_EXTERNREF;
+}
+
+// Returns 0 if the `size` values on the top of the operand stack have
+// `types`, with an entry per slot. WASM_TYPE_UNDEFINED matches any type.
+// Marks the body invalid if they have not and its code is reachable.
+static int wasmbox_function_check_values(wasmbox_mutable_function_t *func,
+                                         const wasmbox_value_type_t *types,
+                                         wasm_u32_t size) {
+  if (wasmbox_function_check_stack(func, size) != 0) {
+    return -1;
+  }
+  wasm_s32_t first = func->stack_size - size;
+  for (wasm_u32_t i = 0; i < size; ++i) {
+    wasmbox_value_type_t type = func->operand_types[first + i];
+    if (type != types[i] && type != WASM_TYPE_UNDEFINED &&
+        types[i] != WASM_TYPE_UNDEFINED) {
+      if (wasmbox_function_is_reachable(func)) {
+        LOG("type mismatch");
+        func->invalid = 1;
+      }
+      return -1;
+    }
+  }
+  return 0;
+}
+
+// Returns the type of the value on the top of the operand stack, or
+// WASM_TYPE_UNDEFINED if the innermost block has none.
+static wasmbox_value_type_t
+wasmbox_function_top_type(wasmbox_mutable_function_t *func) {
+  if (func->stack_size <= func->stack_floor) {
+    return WASM_TYPE_UNDEFINED;
+  }
+  return (wasmbox_value_type_t) func->operand_types[func->stack_size - 1];
+}
+
 static wasm_s16_t
-wasmbox_function_push_stack(wasmbox_mutable_function_t *func) {
+wasmbox_function_push_stack(wasmbox_mutable_function_t *func,
+                            wasmbox_value_type_t type) {
   wasmbox_function_stack_expand_if_needed(func);
+  if (func->stack_top >= WASM_S16_MAX) {
+    LOG("too many slots");
+    func->invalid = 1;
+  }
   wasm_s16_t reg = func->stack_top++;
+  func->operand_types[func->stack_size] = type;
   func->operand_stack[func->stack_size++] = reg;
+  wasmbox_function_reserve_frame(func, func->stack_top);
   return reg;
 }
 
+// Only unreachable code, for which no code is emitted, peeks into an empty
+// operand stack without making the body invalid.
 static wasm_s16_t
 wasmbox_function_peek_stack(wasmbox_mutable_function_t *func) {
-  if (func->stack_size == 0) {
-    LOG("empty stack");
+  if (wasmbox_function_check_stack(func, 1) != 0 && func->stack_size == 0) {
     return -1000;
   }
   return func->operand_stack[func->stack_size - 1];
 }
 
-static wasm_s16_t wasmbox_function_pop_stack(wasmbox_mutable_function_t *func) {
-  wasm_s16_t reg = wasmbox_function_peek_stack(func);
-  --func->stack_size;
+// Pops a value of `type`, or of any type if it is WASM_TYPE_UNDEFINED, like
+// wasmbox_function_peek_stack.
+static wasm_s16_t wasmbox_function_pop_stack(wasmbox_mutable_function_t *func,
+                                             wasmbox_value_type_t type) {
+  if (wasmbox_function_check_values(func, &type, 1) != 0 &&
+      func->stack_size == 0) {
+    return -1000;
+  }
+  wasm_s16_t reg = func->operand_stack[--func->stack_size];
+  if (reg == func->stack_top - 1) {
+    // Slots are allocated in the order of the operand stack. Give the slot
+    // back so that the next push reuses it.
+    func->stack_top = reg;
+  }
+  return reg;
+}
+
+// A v128 takes two consecutive slots. Returns the slot of the low half.
+static wasm_s16_t wasmbox_function_push_v128(wasmbox_mutable_function_t *func) {
+  wasm_s16_t reg = wasmbox_function_push_stack(func, WASM_TYPE_V128);
+  wasmbox_function_push_stack(func, WASM_TYPE_V128);
   return reg;
 }
 
-static void wasmbox_block_link(wasmbox_mutable_function_t *func) {
+static wasm_s16_t wasmbox_function_pop_v128(wasmbox_mutable_function_t *func) {
+  wasmbox_function_pop_stack(func, WASM_TYPE_V128);
+  return wasmbox_function_pop_stack(func, WASM_TYPE_V128);
+}
+
+static int wasmbox_function_top_is_v128(wasmbox_mutable_function_t *func) {
+  return func->stack_size > 0 &&
+         func->operand_types[func->stack_size - 1] == WASM_TYPE_V128;
+}
+
+// Pushes the values of `types`, which has an entry per slot. Returns the slot
+// of the first value, which the others follow.
+static wasm_s16_t
+wasmbox_function_push_values(wasmbox_mutable_function_t *func,
+                             const wasmbox_value_type_t *types,
+                             wasm_u32_t size) {
+  wasm_s16_t first = func->stack_top;
+  for (wasm_u32_t i = 0; i < size; ++i) {
+    wasmbox_function_push_stack(func, types[i]);
+  }
+  return size > 0 ? first : -1;
+}
+
+static int wasmbox_compare_and_branch_opcode(wasm_u16_t opcode) {
+  switch (opcode) {
+#define FUNC(param, type, operand, cmp, vmopcode) \
+  case OPCODE_##cmp:                              \
+    return vmopcode;
+    COMPARE_AND_BRANCH_INST_EACH(FUNC)
+#undef FUNC
+    default:
+      return -1;
+  }
+}
+
+static int wasmbox_loop_inc_opcode(wasm_u16_t opcode) {
+  switch (opcode) {
+#define FUNC(type, operand, cmp, vmopcode) \
+  case OPCODE_JUMP_IF_##cmp:               \
+    return vmopcode;
+    LOOP_INC_INST_EACH(FUNC)
+#undef FUNC
+    default:
+      return -1;
+  }
+}
+
+// Returns 1 if `func` is compiled for the first tier, which skips the
+// optimizations and counts its calls and loop iterations instead.
+static int wasmbox_function_is_baseline(wasmbox_mutable_function_t *func) {
+#ifdef WASMBOX_VM_USE_LAZY_COMPILE
+  return func->baseline;
+#else
+  (void) func;
+  return 0;
+#endif
+}
+
+// Fuse the increment of a loop counter with the back-edge which tests it.
+// BB1: I32_ADD_IMM r2 r2 1        | BB1: LOOP_INC_I32_LT_S BB1 r2 r3 1
+//      JUMP_IF_I32_LT_S BB1 r2 r3 |
+// `code` is the compare-and-branch and `prev` the instruction before it.
+static int wasmbox_code_fuse_loop_inc(wasmbox_mutable_function_t *func,
+                                      wasm_u16_t block_id,
+                                      wasmbox_code_t *prev,
+                                      wasmbox_code_t *code) {
+  int fused = wasmbox_loop_inc_opcode(code->h.opcode);
+  wasm_s32_t counter = code->op1.reg;
+  if (fused < 0 || code->op0.index > block_id ||
+      prev->h.opcode != OPCODE_I32_ADD_IMM || prev->op0.reg != counter ||
+      prev->op1.reg != counter || code->op2.r.reg1 == counter) {
+    return -1;
+  }
+  wasm_s32_t step = (wasm_s32_t) wasmbox_code_get_value(func, &prev->op2).u32;
+  wasmbox_code_reg_t reg = (wasmbox_code_reg_t) step;
+  if (reg != step) {
+    return -1;
+  }
+  wasmbox_code_reg_t limit = code->op2.r.reg1;
+  prev->h.opcode = fused;
+  prev->op0.index = code->op0.index;
+  prev->op1.reg = counter;
+  prev->op2.r.reg1 = limit;
+  prev->op2.r.reg2 = reg;
+  return 0;
+}
+
+// Fuse a comparison with the conditional jump consuming its result.
+// BB0: I32_LT_S r2 r0 r1  | BB0: JUMP_IF_I32_LT_S BB1 r0 r1
+//      JUMP_IF BB1 r2     |
+// The fused instruction drops the result, so the comparison must write a
+// temporary which only the JUMP_IF reads. Copy propagation lets it write a
+// local instead (local.tee, or local.set and local.get), which may be read
+// after the jump.
+static void wasmbox_block_fuse_compare_and_branch(
+    wasmbox_mutable_function_t *func, wasmbox_block_t *block) {
+  if (func->base.type == NULL) {
+    // Constant expressions do not branch.
+    return;
+  }
+  wasm_s32_t first_temp = WASMBOX_FUNCTION_CALL_OFFSET +
+                          func->base.type->argument_size + func->base.locals;
+  wasm_u16_t j = 0;
+  for (wasm_u16_t i = 0; i < block->code_size; ++i) {
+    wasmbox_code_t *code = &block->code[i];
+    if (j > 0 && code->h.opcode == OPCODE_JUMP_IF) {
+      wasmbox_code_t *prev = &block->code[j - 1];
+      int fused = wasmbox_compare_and_branch_opcode(prev->h.opcode);
+      if (fused >= 0 && prev->op0.reg == code->op1.reg &&
+          prev->op0.reg >= first_temp &&
+          !wasmbox_block_reads_after(func, block, i, prev->op0.reg)) {
+        prev->h.opcode = fused;
+        prev->op0.index = code->op0.index;
+        if (j > 1 && wasmbox_code_fuse_loop_inc(func, block->id,
+                                                &block->code[j - 2],
+                                                prev) == 0) {
+          --j;
+        }
+        continue;
+      }
+    }
+    if (i != j) {
+      block->code[j] = *code;
+#ifdef WASMBOX_VM_USE_SAMPLING_PROFILE
+      block->offsets[j] = block->offsets[i];
+#endif
+    }
+    ++j;
+  }
+  block->code_size = j;
+}
+
+// Frozen code lives in the code region of the module if it has one, e.g.
+// to back it with huge pages, or else on the heap.
+static wasmbox_code_t *wasmbox_module_alloc_code(wasmbox_module_t *mod,
+                                                 wasm_u32_t size) {
+  if (mod->code_region != NULL) {
+    void *code = wasmbox_code_region_alloc(mod->code_region, size);
+    if (code != NULL) {
+      return (wasmbox_code_t *) code;
+    }
+  }
+  return (wasmbox_code_t *) wasmbox_malloc_uninit(size);
+}
+
+static wasmbox_code_t *wasmbox_module_realloc_code(wasmbox_module_t *mod,
+                                                   wasmbox_code_t *code,
+                                                   wasm_u32_t old_size,
+                                                   wasm_u32_t size) {
+  if (mod->code_region == NULL ||
+      !wasmbox_code_region_contains(mod->code_region, code)) {
+    return (wasmbox_code_t *) wasmbox_realloc(code, size);
+  }
+  wasmbox_code_t *new_code = wasmbox_module_alloc_code(mod, size);
+  memcpy(new_code, code, old_size);
+  return new_code;
+}
+
+static void wasmbox_module_free_code(wasmbox_module_t *mod,
+                                     wasmbox_code_t *code) {
+  // Bodies of a module which failed to load may not be compiled.
+  if (code == NULL || (mod->code_region != NULL &&
+                       wasmbox_code_region_contains(mod->code_region, code))) {
+    return;
+  }
+  if (mod->code_arena != NULL && (char *) code >= (char *) mod->code_arena &&
+      (char *) code < (char *) mod->code_arena + mod->code_arena_size) {
+    return;
+  }
+#ifdef WASMBOX_CODE_CACHE_ENABLED
+  if (wasmbox_code_cache_contains(mod->code_cache, code)) {
+    return;
+  }
+#endif
+  wasmbox_free(code);
+}
+
+#ifdef WASMBOX_VM_USE_ACCUMULATOR
+/* Operands of the numeric instructions read from the accumulator. Only the
+ * binary operators take part, and keep their results in it. */
+#  define WASMBOX_ACC_NUMERIC_unary  (0)
+#  define WASMBOX_ACC_NUMERIC_binary (WASMBOX_ACC_OP1 | WASMBOX_ACC_OP2)
+/* Operands of the compare-and-branch instructions read from it. */
+#  define WASMBOX_ACC_BRANCH_unary  (WASMBOX_ACC_OP1)
+#  define WASMBOX_ACC_BRANCH_binary (WASMBOX_ACC_OP1 | WASMBOX_ACC_OP2)
+
+// Returns 1 if the interpreter keeps the result of `code` in the accumulator.
+static int wasmbox_code_writes_accumulator(wasmbox_code_t *code) {
+  switch (code->h.opcode) {
+#  define FUNC(opcode, type, inst, attr, vmopcode) case vmopcode:
+    CONST_OP_EACH(FUNC)
+#  undef FUNC
+#  define FUNC(wtype, type, operand, inst, vmopcode) case vmopcode:
+    IMMEDIATE_INST_EACH(FUNC)
+#  undef FUNC
+#  define FUNC(type, operand, inst, vmopcode) case vmopcode:
+    DIVISION_MAGIC_INST_EACH(FUNC)
+#  undef FUNC
+    return 1;
+#  define FUNC(opcode, param, type, inst, vmopcode) \
+    case vmopcode:                                  \
+      return WASMBOX_ACC_NUMERIC_##param != 0;
+    NUMERIC_INST_EACH(FUNC)
+#  undef FUNC
+    default:
+      return 0;
+  }
+}
+
+// Returns the operands of `code` which the interpreter can read from the
+// accumulator.
+static wasm_u8_t wasmbox_code_reads_accumulator(wasmbox_code_t *code) {
+  switch (code->h.opcode) {
+    case OPCODE_JUMP_IF:
+#  define FUNC(wtype, type, operand, inst, vmopcode) case vmopcode:
+    IMMEDIATE_INST_EACH(FUNC)
+#  undef FUNC
+#  define FUNC(type, operand, inst, vmopcode) case vmopcode:
+    DIVISION_MAGIC_INST_EACH(FUNC)
+#  undef FUNC
+    return WASMBOX_ACC_OP1;
+#  define FUNC(param, type, operand, cmp, vmopcode) \
+    case vmopcode:                                  \
+      return WASMBOX_ACC_BRANCH_##param;
+    COMPARE_AND_BRANCH_INST_EACH(FUNC)
+#  undef FUNC
+#  define FUNC(opcode, param, type, inst, vmopcode) \
+    case vmopcode:                                  \
+      return WASMBOX_ACC_NUMERIC_##param;
+    NUMERIC_INST_EACH(FUNC)
+#  undef FUNC
+    default:
+      return 0;
+  }
+}
+#endif
+
+/**
+ * Lays the blocks out into `func->base.code`. Each instruction is written to
+ * its final location exactly once, with its branch targets, constant offsets
+ * and threaded-code label resolved on the way. Only the labels of br_table
+ * targets are resolved once every instruction is in place.
+ */
+static void wasmbox_block_link(wasmbox_module_t *mod,
+                               wasmbox_mutable_function_t *func) {
   wasm_u32_t code_size = 0;
+#ifdef WASMBOX_VM_USE_CODE_LABEL
+  void **labels = (void **) mod->shared_code[0].op0.value.u64;
+#else
+  (void) mod;
+#endif
 
   for (wasm_u16_t i = 0; i < func->block_size; ++i) {
     wasmbox_block_t *block = &func->blocks[i];
-    // Rewrite explicit jump if target block is next block.
+    if (!wasmbox_function_is_baseline(func)) {
+      wasmbox_block_fuse_compare_and_branch(func, block);
+    }
+    // Rewrite explicit jump if target block is next block. Blocks emptied by
+    // the optimizer in between are skipped.
     // BB0: ...            | BB0: ...
     //      JUMP BB1       |      nop
     // BB1: do something   | BB1: do something
@@ -158,8 +861,17 @@ static void wasmbox_block_link(wasmbox_mutable_function_t *func) {
     if (block->code_size > 0 &&
         block->code[block->code_size - 1].h.opcode == OPCODE_JUMP) {
       wasmbox_code_t *code = &block->code[block->code_size - 1];
-      wasmbox_block_t *target = &func->blocks[code->op0.index];
-      if (i + 1 < func->block_size && target == &func->blocks[i + 1]) {
+      // Jumping to the tail of a block continues to the next block.
+      wasm_u32_t dest = code->op0.index;
+      if ((enum wasm_jump_direction) code->op2.index ==
+          WASM_JUMP_DIRECTION_TAIL) {
+        dest += 1;
+      }
+      wasm_u32_t next = i + 1;
+      while (next < dest && func->blocks[next].code_size == 0) {
+        ++next;
+      }
+      if (next < func->block_size && dest == next) {
         code->h.opcode = OPCODE_NOP;
         block->code_size -= 1;
       }
@@ -169,101 +881,299 @@ static void wasmbox_block_link(wasmbox_mutable_function_t *func) {
     wasmbox_block_t *block = &func->blocks[i];
     block->start = code_size;
     code_size += block->code_size;
+    for (int j = 0; j < block->code_size; ++j) {
+      if (block->code[j].h.opcode == OPCODE_JUMP_TABLE) {
+        wasmbox_table_t *table = func->tables[block->code[j].op0.index];
+        code_size += WASMBOX_JUMP_TABLE_SLOTS(table->size);
+      }
+    }
     block->end = code_size;
   }
+#ifdef WASMBOX_VM_USE_LAZY_COMPILE
+  if (func->osr_entries != NULL) {
+    func->osr_entries[0] = 0;
+    for (wasm_u16_t i = 0; i < func->loop_size; ++i) {
+      func->osr_entries[i + 1] = UINT32_MAX;
+    }
+    // A loop whose body the optimizer emptied or merged cannot be entered.
+    for (wasm_u16_t i = 0; i < func->block_size; ++i) {
+      wasmbox_block_t *block = &func->blocks[i];
+      if (block->loop >= 0 && block->code_size > 0) {
+        func->osr_entries[block->loop + 1] = block->start;
+      }
+    }
+  }
+#endif
+  wasm_u32_t constant_size = 0;
+#ifdef WASMBOX_VM_USE_COMPACT_CODE
+  wasmbox_function_pack_constants(func);
+  constant_size = sizeof(wasmbox_code_constant_t) * func->constant_size;
+  func->frozen_constant_size = func->constant_size;
+#endif
   if (func->base.code_size > 0) {
+    wasm_u32_t old_size = sizeof(wasmbox_code_t) * func->base.code_size;
     func->base.code_size += code_size;
-    func->base.code = (wasmbox_code_t *) wasmbox_realloc(
-        func->base.code, sizeof(wasmbox_code_t) * func->base.code_size);
+    func->base.code = wasmbox_module_realloc_code(
+        mod, func->base.code, old_size,
+        sizeof(wasmbox_code_t) * func->base.code_size + constant_size);
   } else {
     func->base.code_size = code_size;
-    func->base.code =
-        (wasmbox_code_t *) wasmbox_malloc(sizeof(wasmbox_code_t) * code_size);
+    func->base.code = wasmbox_module_alloc_code(
+        mod, sizeof(wasmbox_code_t) * code_size + constant_size);
+  }
+#ifdef WASMBOX_VM_USE_COMPACT_CODE
+  if (constant_size > 0) {
+    memcpy(func->base.code + func->base.code_size, func->constants,
+           constant_size);
   }
+#endif
+#ifdef WASMBOX_VM_USE_SAMPLING_PROFILE
+  if (func->code_offsets != NULL) {
+    wasmbox_free(func->code_offsets);
+  }
+  func->code_offsets = (wasm_u32_t *) wasmbox_malloc(
+      sizeof(wasm_u32_t) *
+      (func->base.code_size > 0 ? func->base.code_size : 1));
+#endif
+#ifdef WASMBOX_VM_USE_CODE_LABEL
+  // Where the JUMP_TABLEs are, to resolve the labels of their targets.
+  wasm_u32_t *jump_tables = NULL;
+  wasm_u32_t jump_table_size = 0;
+  if (func->table_size > 0) {
+    jump_tables = (wasm_u32_t *) wasmbox_arena_alloc(
+        func->arena, sizeof(wasm_u32_t) * func->table_size);
+  }
+#endif
   for (wasm_u16_t i = 0; i < func->block_size; ++i) {
     wasmbox_block_t *block = &func->blocks[i];
+    wasmbox_code_t *next = func->base.code + block->start;
     for (int j = 0; j < block->code_size; ++j) {
-      wasmbox_code_t *code = &block->code[j];
+      wasmbox_code_t *pc = next++;
+      *pc = block->code[j];
+      wasmbox_code_t *code = pc;
+#ifdef WASMBOX_VM_USE_SAMPLING_PROFILE
+      func->code_offsets[pc - func->base.code] = block->offsets[j];
+#endif
+#ifdef WASMBOX_VM_USE_CODE_LABEL
+      code->h.label = labels[code->h.opcode];
+#endif
+#ifdef WASMBOX_VM_USE_ACCUMULATOR
+      // Mark the operands which the previous instruction has just written.
+      code->h.acc = 0;
+      if (j > 0 && wasmbox_code_writes_accumulator(&block->code[j - 1])) {
+        wasmbox_code_reg_t result = block->code[j - 1].op0.reg;
+        wasm_u8_t reads = wasmbox_code_reads_accumulator(code);
+        if ((reads & WASMBOX_ACC_OP1) && code->op1.reg == result) {
+          code->h.acc |= WASMBOX_ACC_OP1;
+        }
+        if ((reads & WASMBOX_ACC_OP2) && code->op2.reg == result) {
+          code->h.acc |= WASMBOX_ACC_OP2;
+        }
+      }
+#endif
       enum wasm_jump_direction direction =
           (enum wasm_jump_direction) code->op2.index;
       if (code->h.opcode == OPCODE_JUMP) {
         wasmbox_block_t *target = &func->blocks[code->op0.index];
         wasm_u32_t offset =
             direction == WASM_JUMP_DIRECTION_HEAD ? target->start : target->end;
-        code->op0.code = func->base.code + offset;
+        wasmbox_code_set_target(&code->op0, pc, func->base.code + offset);
       } else if (code->h.opcode == OPCODE_JUMP_IF) {
         wasmbox_block_t *target = &func->blocks[code->op0.index];
         wasm_u32_t offset =
             direction == WASM_JUMP_DIRECTION_HEAD ? target->start : target->end;
-        code->op0.code = func->base.code + offset;
+        wasmbox_code_set_target(&code->op0, pc, func->base.code + offset);
       } else if (code->h.opcode == OPCODE_JUMP_TABLE) {
-        wasm_u32_t offset;
-        wasmbox_block_t *target;
-        wasmbox_table_t *table = code->op0.table;
-        for (int k = 0; k < table->size; ++k) {
-          target = &func->blocks[table->labels[k].block_id];
-          offset = target->direction == WASM_JUMP_DIRECTION_HEAD ? target->start
-                                                                 : target->end;
-          table->labels[k].code = func->base.code + offset;
+        wasmbox_table_t *table = func->tables[code->op0.index];
+        wasmbox_jump_target_t *targets = WASMBOX_JUMP_TABLE_TARGETS(pc);
+        for (wasm_u32_t k = 0; k < table->size; ++k) {
+          wasmbox_block_t *target = &func->blocks[table->block_ids[k]];
+          wasm_u32_t offset = target->direction == WASM_JUMP_DIRECTION_HEAD
+                                  ? target->start
+                                  : target->end;
+#ifdef WASMBOX_VM_USE_COMPACT_CODE
+          targets[k].offset = (wasm_s32_t) sizeof(wasmbox_code_t) *
+                              (wasm_s32_t) (offset - (pc - func->base.code));
+#else
+          targets[k].code = func->base.code + offset;
+#endif
         }
-        target = &func->blocks[code->op1.index];
-        offset = target->direction == WASM_JUMP_DIRECTION_HEAD ? target->start
-                                                               : target->end;
-        code->op1.code = func->base.code + offset;
+        code->op0.index = table->size;
+        next += WASMBOX_JUMP_TABLE_SLOTS(table->size);
+#ifdef WASMBOX_VM_USE_CODE_LABEL
+        jump_tables[jump_table_size++] = pc - func->base.code;
+#endif
+        wasmbox_block_t *target = &func->blocks[code->op1.index];
+        wasm_u32_t offset = target->direction == WASM_JUMP_DIRECTION_HEAD
+                                ? target->start
+                                : target->end;
+        wasmbox_code_set_target(&code->op1, pc, func->base.code + offset);
+      } else if (wasmbox_is_compare_and_branch(code->h.opcode)) {
+        wasmbox_block_t *target = &func->blocks[code->op0.index];
+        wasm_u32_t offset = target->direction == WASM_JUMP_DIRECTION_HEAD
+                                ? target->start
+                                : target->end;
+        wasmbox_code_set_target(&code->op0, pc, func->base.code + offset);
+      }
+#ifdef WASMBOX_VM_USE_COMPACT_CODE
+      union wasmbox_code_operands *op = wasmbox_code_constant_operand(code);
+      if (op != NULL && !wasmbox_code_refers_function(code)) {
+        wasmbox_code_link_constant(func, op, pc);
       }
+#endif
     }
-
-    if (block->code_size > 0) {
-      memcpy(func->base.code + block->start, block->code,
-             sizeof(wasmbox_code_t) * block->code_size);
+  }
+#ifdef WASMBOX_VM_USE_CODE_LABEL
+  for (wasm_u32_t i = 0; i < jump_table_size; ++i) {
+    wasmbox_code_t *code = func->base.code + jump_tables[i];
+    wasmbox_jump_target_t *targets = WASMBOX_JUMP_TABLE_TARGETS(code);
+    for (wasm_u32_t k = 0; k < code->op0.index; ++k) {
+      targets[k].label = targets[k].code->h.label;
     }
   }
+#endif
 }
 
-static int wasmbox_function_freeze(wasmbox_module_t *mod,
-                                   wasmbox_mutable_function_t *func) {
-  wasmbox_block_link(func);
-  for (wasm_u16_t i = 0; i < func->block_size; ++i) {
-    wasmbox_block_t *block = &func->blocks[i];
-    if (block->code_capacity > 0) {
-      wasmbox_free(block->code);
-    }
-  }
-  wasmbox_free(func->blocks);
-  if (func->stack_capacity > 0) {
-    wasmbox_free(func->operand_stack);
-  }
-#ifdef WASMBOX_VM_USE_DIRECT_THREADED_CODE
-  void **labels = (void **) mod->shared_code[0].op0.value.u64;
-  for (int i = 0; i < func->base.code_size; ++i) {
-    func->base.code[i].h.label = labels[func->base.code[i].h.opcode];
-  }
+/**
+ * Drops the per-block code and the operand stack which are only needed while
+ * the function is being decoded. They are allocated from `func->arena`, which
+ * is reset by the caller once the function is frozen.
+ */
+static void wasmbox_function_release_blocks(wasmbox_mutable_function_t *func) {
+  func->blocks = NULL;
+  func->block_size = func->block_capacity = 0;
+#ifdef WASMBOX_VM_USE_COMPACT_CODE
+  func->constants = NULL;
+  func->constant_size = func->constant_capacity = 0;
 #endif
+  func->tables = NULL;
+  func->table_size = func->table_capacity = 0;
   func->operand_stack = NULL;
+  func->operand_types = NULL;
+  func->local_slots = NULL;
+  func->local_types = NULL;
+  func->stack_size = func->stack_capacity = 0;
   func->stack_top = -1;
   func->current_block_id = -1;
+}
+
+// Returns 1 if a call of the module can be suspended by a host function.
+static int wasmbox_module_imports_async(wasmbox_module_t *mod) {
+  for (wasm_u32_t i = 0; i < mod->import_function_size; i++) {
+    wasmbox_code_t *code = mod->functions[i]->code;
+    if (code->h.opcode == OPCODE_HOST_CALL &&
+        code->op1.index == WASMBOX_HOST_ASYNC) {
+      return 1;
+    }
+  }
   return 0;
 }
 
-static wasm_s16_t wasmbox_block_add(wasmbox_mutable_function_t *func) {
-  if (func->blocks == NULL) {
-    func->blocks = (wasmbox_block_t *) wasmbox_malloc(sizeof(wasmbox_block_t));
-    func->block_size = 0;
-    func->block_capacity = 1;
+static wasm_u64_t wasmbox_now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (wasm_u64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Adds the time since `start` to `phase` if load stats are recorded.
+static void wasmbox_load_phase_add(wasmbox_load_phase_t *phase,
+                                   wasm_u64_t start) {
+  phase->ns += wasmbox_now_ns() - start;
+  phase->count++;
+}
+
+// Returns where the load stats of the function `funcindex` of the code
+// section go, or NULL if they are not recorded.
+static wasmbox_function_load_stats_t *
+wasmbox_function_load_stats(wasmbox_module_t *mod, wasm_u32_t funcindex) {
+  if (mod->load_stats == NULL || mod->load_stats->functions == NULL) {
+    return NULL;
   }
-  if (func->block_size + 1 > func->block_capacity) {
-    func->block_capacity *= 2;
-    func->blocks = (wasmbox_block_t *) wasmbox_realloc(
-        func->blocks, sizeof(wasmbox_block_t) * func->block_capacity);
+  return (wasmbox_function_load_stats_t *) &mod->load_stats
+      ->functions[mod->import_function_size + funcindex];
+}
+
+static void wasmbox_function_count_instructions(
+    wasmbox_mutable_function_t *func, wasmbox_function_load_stats_t *stats) {
+  wasmbox_code_t *code = func->base.code;
+  for (wasm_u32_t i = 0; i < func->base.code_size;
+       i += wasmbox_code_length(&code[i])) {
+    stats->instructions++;
+    stats->moves += code[i].h.opcode == OPCODE_MOVE;
+    stats->nops += code[i].h.opcode == OPCODE_NOP;
+    stats->jumps += code[i].h.opcode == OPCODE_JUMP;
   }
-  wasm_s16_t block_index = func->block_size++;
-  wasmbox_block_t *block = &func->blocks[block_index];
+}
+
+// Turns the blocks of `func` into its code. `stats` is NULL unless load stats
+// are recorded for it.
+static int wasmbox_function_freeze(wasmbox_module_t *mod,
+                                   wasmbox_mutable_function_t *func,
+                                   wasmbox_function_load_stats_t *stats) {
+  wasm_u64_t start = stats != NULL ? wasmbox_now_ns() : 0;
+  if (!wasmbox_function_is_baseline(func)) {
+    func->shared_memory = wasmbox_memory_is_shared(mod);
+    wasmbox_optimize_function(func);
+  }
+  wasm_u64_t link_start = stats != NULL ? wasmbox_now_ns() : 0;
+  wasmbox_block_link(mod, func);
+  if (stats != NULL) {
+    stats->link_ns = wasmbox_now_ns() - link_start;
+    // Counted before native code replaces the first instruction.
+    wasmbox_function_count_instructions(func, stats);
+  }
+  wasmbox_function_release_blocks(func);
+#ifdef WASMBOX_JIT_ENABLED
+  // Falls back to the interpreter if the function cannot be compiled.
+  if (!wasmbox_function_is_baseline(func) &&
+      !wasmbox_module_imports_async(mod) &&
+      wasmbox_jit_compile_function(mod, &func->base) == 0) {
+#  ifdef WASMBOX_VM_USE_CODE_LABEL
+    void **labels = (void **) mod->shared_code[0].op0.value.u64;
+    func->base.code[0].h.label = labels[OPCODE_JIT_ENTRY];
+#  endif
+  }
+#endif
+  if (stats != NULL) {
+    stats->freeze_ns = wasmbox_now_ns() - start;
+  }
+  return 0;
+}
+
+static wasm_s16_t wasmbox_block_add(wasmbox_mutable_function_t *func) {
+  if (func->blocks == NULL) {
+    func->blocks = (wasmbox_block_t *) wasmbox_arena_alloc(
+        func->arena, sizeof(wasmbox_block_t));
+    func->block_size = 0;
+    func->block_capacity = 1;
+  }
+  if (func->block_size >= WASM_S16_MAX) {
+    // The body is rejected before the last block is used by the rest.
+    LOG("too many blocks");
+    func->invalid = 1;
+    return func->block_size - 1;
+  }
+  if (func->block_size + 1 > func->block_capacity) {
+    func->blocks = (wasmbox_block_t *) wasmbox_arena_realloc(
+        func->arena, func->blocks,
+        sizeof(wasmbox_block_t) * func->block_capacity,
+        sizeof(wasmbox_block_t) * func->block_capacity * 2);
+    func->block_capacity *= 2;
+  }
+  wasm_s16_t block_index = func->block_size++;
+  wasmbox_block_t *block = &func->blocks[block_index];
   memset(block, -1, sizeof(wasmbox_block_t));
   block->type.type = WASMBOX_BLOCK_TYPE_NONE;
   block->id = block_index;
   block->code = NULL;
   block->code_size = 0;
   block->code_capacity = 0;
+#ifdef WASMBOX_VM_USE_SAMPLING_PROFILE
+  block->offsets = NULL;
+#endif
+  block->label_id = block_index;
+  block->value = -1;
+  block->value_size = 0;
   block->already_terminated = 0;
   return block_index;
 }
@@ -279,6 +1189,14 @@ static void wasmbox_block_link_next(wasmbox_mutable_function_t *func,
   block->next_id = func->current_block_id;
 }
 
+static void wasmbox_block_inherit_label(wasmbox_mutable_function_t *func,
+                                        wasm_s16_t block_index) {
+  if (block_index >= 0) {
+    wasmbox_block_t *current = &func->blocks[func->current_block_id];
+    current->label_id = func->blocks[block_index].label_id;
+  }
+}
+
 static void wasmbox_block_link_parent(wasmbox_mutable_function_t *func,
                                       wasm_u16_t parent_id) {
   wasmbox_block_t *current = &func->blocks[func->current_block_id];
@@ -297,105 +1215,618 @@ static void wasmbox_code_add(wasmbox_mutable_function_t *func,
     return;
   }
   if (block->code == NULL) {
-    block->code = (wasmbox_code_t *) wasmbox_malloc(sizeof(wasmbox_code_t) *
-                                                    MODULE_CODE_INIT_SIZE);
+    block->code = (wasmbox_code_t *) wasmbox_arena_alloc(
+        func->arena, sizeof(wasmbox_code_t) * MODULE_CODE_INIT_SIZE);
     block->code_size = 0;
     block->code_capacity = MODULE_CODE_INIT_SIZE;
+#ifdef WASMBOX_VM_USE_SAMPLING_PROFILE
+    block->offsets = (wasm_u32_t *) wasmbox_arena_alloc(
+        func->arena, sizeof(wasm_u32_t) * MODULE_CODE_INIT_SIZE);
+#endif
   }
   if (block->code_size + 1 > block->code_capacity) {
+    block->code = (wasmbox_code_t *) wasmbox_arena_realloc(
+        func->arena, block->code, sizeof(wasmbox_code_t) * block->code_capacity,
+        sizeof(wasmbox_code_t) * block->code_capacity * 2);
+#ifdef WASMBOX_VM_USE_SAMPLING_PROFILE
+    block->offsets = (wasm_u32_t *) wasmbox_arena_realloc(
+        func->arena, block->offsets, sizeof(wasm_u32_t) * block->code_capacity,
+        sizeof(wasm_u32_t) * block->code_capacity * 2);
+#endif
     block->code_capacity *= 2;
-    block->code = (wasmbox_code_t *) wasmbox_realloc(
-        block->code, sizeof(wasmbox_code_t) * block->code_capacity);
   }
+#ifdef WASMBOX_VM_USE_SAMPLING_PROFILE
+  block->offsets[block->code_size] = func->source_offset;
+#endif
   memcpy(&block->code[block->code_size++], code, sizeof(*code));
 }
 
 static void wasmbox_code_add_const(wasmbox_mutable_function_t *func,
-                                   int vmopcode, wasmbox_value_t v) {
-  wasmbox_code_t code;
+                                   int vmopcode, wasmbox_value_type_t type,
+                                   wasmbox_value_t v) {
+  wasmbox_code_t code = {};
   code.h.opcode = vmopcode;
-  code.op0.reg = wasmbox_function_push_stack(func);
-  code.op1.value = v;
+  code.op0.reg = wasmbox_function_push_stack(func, type);
+  wasmbox_code_set_value(func, &code.op1, v);
   wasmbox_code_add(func, &code);
 }
 
-static void wasmbox_code_add_global(wasmbox_mutable_function_t *func,
-                                    int vmopcode, wasm_u32_t index) {
-  wasmbox_code_t code;
-  code.h.opcode = vmopcode;
-  code.op0.reg = wasmbox_function_push_stack(func);
+static void wasmbox_code_add_move(wasmbox_mutable_function_t *func,
+                                  wasm_s32_t from, wasm_s32_t to) {
+  wasmbox_code_t code = {};
+  code.h.opcode = OPCODE_MOVE;
+  code.op0.reg = to;
+  code.op1.reg = from;
+  wasmbox_code_add(func, &code);
+}
+
+static void wasmbox_code_add_global_get(wasmbox_module_t *mod,
+                                        wasmbox_mutable_function_t *func,
+                                        wasm_u32_t index) {
+  wasmbox_value_type_t type = (wasmbox_value_type_t) mod->global_types[index];
+  if (mod->global_constants[index] != 0) {
+    // Immutable globals are loaded as constants so they can be folded.
+    wasmbox_code_add_const(func, mod->global_constants[index], type,
+                           mod->globals[index]);
+    return;
+  }
+  wasmbox_code_t code = {};
+  code.h.opcode = index + 1 == mod->stack_pointer_global
+                      ? OPCODE_STACK_POINTER_GET
+                      : OPCODE_GLOBAL_GET;
+  code.op0.reg = wasmbox_function_push_stack(func, type);
   code.op1.index = index;
   wasmbox_code_add(func, &code);
 }
 
+
+static int wasmbox_immediate_opcode(int vmopcode) {
+  switch (vmopcode) {
+#define FUNC(wtype, type, operand, inst, imm_vmopcode) \
+  case OPCODE_##inst:                                  \
+    return imm_vmopcode;
+    IMMEDIATE_INST_EACH(FUNC)
+#undef FUNC
+    default:
+      return -1;
+  }
+}
+
+/**
+ * Returns the opcode which applies `vmopcode` to the constant rhs `v` by a
+ * shift, a mask or a multiply-high instead of a multiply or a divide, and sets
+ * its immediate into `v`, or returns -1. Divisors which trap are left alone.
+ */
+static int wasmbox_reduce_strength(int vmopcode, wasmbox_value_t *v) {
+  wasm_u64_t d = vmopcode == OPCODE_I64_MUL || vmopcode == OPCODE_I64_DIV_U ||
+                         vmopcode == OPCODE_I64_REM_U
+                     ? v->u64
+                     : v->u32;
+  if (d != 0 && (d & (d - 1)) == 0) {
+    wasm_u64_t shift = __builtin_ctzll(d);
+    switch (vmopcode) {
+#define REDUCE(inst, imm, reduced_vmopcode) \
+  case OPCODE_##inst:                       \
+    v->u64 = (imm);                         \
+    return reduced_vmopcode;
+      REDUCE(I32_MUL, shift, OPCODE_I32_SHL_IMM)
+      REDUCE(I64_MUL, shift, OPCODE_I64_SHL_IMM)
+      REDUCE(I32_DIV_U, shift, OPCODE_I32_SHR_U_IMM)
+      REDUCE(I64_DIV_U, shift, OPCODE_I64_SHR_U_IMM)
+      REDUCE(I32_REM_U, d - 1, OPCODE_I32_AND_IMM)
+      REDUCE(I64_REM_U, d - 1, OPCODE_I64_AND_IMM)
+#undef REDUCE
+      default:
+        break;
+    }
+  }
+  // Magic numbers of Granlund and Montgomery, "Division by Invariant Integers
+  // using Multiplication", whose shift the interpreter derives from d.
+  wasm_u64_t magic;
+  switch (vmopcode) {
+    case OPCODE_I32_DIV_U:
+    case OPCODE_I32_REM_U: {
+      if (d == 0) {
+        return -1;
+      }
+      wasm_u32_t l = 32 - __builtin_clz((wasm_u32_t) d - 1);
+      magic = ((((wasm_u64_t) 1 << l) - d) << 32) / d + 1;
+      break;
+    }
+    case OPCODE_I32_DIV_S:
+    case OPCODE_I32_REM_S: {
+      wasm_s32_t sd = v->s32;
+      if (sd == 0 || sd == 1 || sd == -1) {
+        return -1;
+      }
+      wasm_u32_t abs = sd < 0 ? -(wasm_u32_t) sd : (wasm_u32_t) sd;
+      wasm_u32_t l = 32 - __builtin_clz(abs - 1);
+      magic = ((wasm_u64_t) 1 << (31 + l)) / abs + 1;
+      break;
+    }
+    default:
+      return -1;
+  }
+  v->u64 = (magic << 32) | (wasm_u32_t) d;
+  switch (vmopcode) {
+#define FUNC(type, operand, inst, magic_vmopcode) \
+  case OPCODE_##inst:                             \
+    return magic_vmopcode;
+    DIVISION_MAGIC_INST_EACH(FUNC)
+#undef FUNC
+    default:
+      return -1;
+  }
+}
+
+static int wasmbox_code_is_const(wasmbox_code_t *code) {
+  switch (code->h.opcode) {
+    case OPCODE_LOAD_CONST_I32:
+    case OPCODE_LOAD_CONST_I64:
+    case OPCODE_LOAD_CONST_F32:
+    case OPCODE_LOAD_CONST_F64:
+      return 1;
+    default:
+      return 0;
+  }
+}
+
+/**
+ * Returns the `n`-th last instruction of the current block (0 is the last one),
+ * or NULL if there is none.
+ */
+static wasmbox_code_t *wasmbox_code_find_last(wasmbox_mutable_function_t *func,
+                                              wasm_u16_t n) {
+  if (func->current_block_id == -1) {
+    return NULL;
+  }
+  wasmbox_block_t *block = &func->blocks[func->current_block_id];
+  if (block->already_terminated != 0 || block->code_size <= n) {
+    return NULL;
+  }
+  return &block->code[block->code_size - 1 - n];
+}
+
+/**
+ * Returns the `n`-th last instruction of the current block if it loads a
+ * constant into `reg`, or NULL otherwise. Operand stack slots are written
+ * once, so the constant is still in `reg` when a later instruction consumes
+ * it.
+ */
+static wasmbox_code_t *
+wasmbox_code_find_last_const(wasmbox_mutable_function_t *func, wasm_s16_t reg,
+                             wasm_u16_t n) {
+  wasmbox_code_t *code = wasmbox_code_find_last(func, n);
+  if (code == NULL || !wasmbox_code_is_const(code) || code->op0.reg != reg) {
+    return NULL;
+  }
+  return code;
+}
+
+/**
+ * Removes the last `n` instructions of the current block, found by
+ * wasmbox_code_find_last, and the constants they added last to the pool.
+ */
+static void wasmbox_code_remove_last(wasmbox_mutable_function_t *func,
+                                     wasm_u16_t n) {
+  wasmbox_block_t *block = &func->blocks[func->current_block_id];
+  for (wasm_u16_t i = 0; i < n; ++i) {
+    block->code_size -= 1;
+#ifdef WASMBOX_VM_USE_COMPACT_CODE
+    wasmbox_code_t *last = &block->code[block->code_size];
+    union wasmbox_code_operands *op = wasmbox_code_constant_operand(last);
+    if (op != NULL && op->index == func->constant_size - 1) {
+      func->constant_size -= 1;
+    }
+#endif
+  }
+}
+
+/**
+ * Returns the constant loaded into `reg` by the last instruction of the
+ * current block, and removes that instruction, if any.
+ */
+static int wasmbox_code_take_last_const(wasmbox_mutable_function_t *func,
+                                        wasm_s16_t reg, wasmbox_value_t *v) {
+  wasmbox_code_t *last = wasmbox_code_find_last_const(func, reg, 0);
+  if (last == NULL) {
+    return -1;
+  }
+  *v = wasmbox_code_get_value(func, &last->op1);
+  wasmbox_code_remove_last(func, 1);
+  return 0;
+}
+
 static int wasmbox_code_add_unary_op(wasmbox_mutable_function_t *func,
-                                     int vmopcode) {
-  wasmbox_code_t code;
+                                     int vmopcode, wasmbox_value_type_t type,
+                                     wasmbox_value_type_t result) {
+  wasmbox_code_t code = {};
   code.h.opcode = vmopcode;
-  code.op1.reg = wasmbox_function_pop_stack(func);
-  code.op0.reg = wasmbox_function_push_stack(func);
+  code.op1.reg = wasmbox_function_pop_stack(func, type);
+  // Fold the instruction if its operand is a constant.
+  // LOAD_CONST_I32 r0 1  | LOAD_CONST_I32 r0 0
+  // I32_EQZ r0 r0        |
+  wasmbox_code_t *operand = wasmbox_code_find_last_const(func, code.op1.reg, 0);
+  if (operand != NULL) {
+    wasmbox_value_t v = {};
+    int const_vmopcode = wasmbox_fold_unary_op(
+        vmopcode, wasmbox_code_get_value(func, &operand->op1), &v);
+    if (const_vmopcode >= 0) {
+      wasmbox_code_remove_last(func, 1);
+      wasmbox_code_add_const(func, const_vmopcode, result, v);
+      return 0;
+    }
+  }
+  code.op0.reg = wasmbox_function_push_stack(func, result);
   wasmbox_code_add(func, &code);
   return 0;
 }
 
 static int wasmbox_code_add_binary_op(wasmbox_mutable_function_t *func,
-                                      int vmopcode) {
-  wasmbox_code_t code;
+                                      int vmopcode, wasmbox_value_type_t type,
+                                      wasmbox_value_type_t result) {
+  wasmbox_code_t code = {};
   code.h.opcode = vmopcode;
-  code.op2.reg = wasmbox_function_pop_stack(func);
-  code.op1.reg = wasmbox_function_pop_stack(func);
-  code.op0.reg = wasmbox_function_push_stack(func);
+  code.op2.reg = wasmbox_function_pop_stack(func, type);
+  code.op1.reg = wasmbox_function_pop_stack(func, type);
+  // Fold the instruction if both operands are constants.
+  // LOAD_CONST_I32 r0 10 | LOAD_CONST_I32 r0 30
+  // LOAD_CONST_I32 r1 20 |
+  // I32_ADD r0 r0 r1     |
+  wasmbox_code_t *rhs = wasmbox_code_find_last_const(func, code.op2.reg, 0);
+  wasmbox_code_t *lhs = wasmbox_code_find_last_const(func, code.op1.reg, 1);
+  if (rhs != NULL && lhs != NULL) {
+    wasmbox_value_t v = {};
+    int const_vmopcode = wasmbox_fold_binary_op(
+        vmopcode, wasmbox_code_get_value(func, &lhs->op1),
+        wasmbox_code_get_value(func, &rhs->op1), &v);
+    if (const_vmopcode >= 0) {
+      wasmbox_code_remove_last(func, 2);
+      wasmbox_code_add_const(func, const_vmopcode, result, v);
+      return 0;
+    }
+  }
+  // A signed division by 1 is its dividend and a signed remainder by 1 or -1
+  // is 0. A division by -1 stays a division, which traps for the minimum.
+  // LOAD_CONST_I32 r1 1  | MOVE r2 r0
+  // I32_DIV_S r2 r0 r1   |
+  // LOAD_CONST_I32 r1 -1 | LOAD_CONST_I32 r2 0
+  // I32_REM_S r2 r0 r1   |
+  if (rhs != NULL && (vmopcode == OPCODE_I32_DIV_S ||
+                      vmopcode == OPCODE_I32_REM_S ||
+                      vmopcode == OPCODE_I64_DIV_S ||
+                      vmopcode == OPCODE_I64_REM_S)) {
+    wasmbox_value_t v = wasmbox_code_get_value(func, &rhs->op1);
+    wasm_s64_t d = type == WASM_TYPE_I64 ? v.s64 : v.s32;
+    int is_rem = vmopcode == OPCODE_I32_REM_S || vmopcode == OPCODE_I64_REM_S;
+    if (is_rem && (d == 1 || d == -1)) {
+      wasmbox_code_remove_last(func, 1);
+      wasmbox_code_add_const(func,
+                             type == WASM_TYPE_I64 ? OPCODE_LOAD_CONST_I64
+                                                   : OPCODE_LOAD_CONST_I32,
+                             result, (wasmbox_value_t){});
+      return 0;
+    }
+    if (!is_rem && d == 1) {
+      wasmbox_code_remove_last(func, 1);
+      wasm_s16_t to = wasmbox_function_push_stack(func, result);
+      if (to != code.op1.reg) {
+        wasmbox_code_add_move(func, code.op1.reg, to);
+      }
+      return 0;
+    }
+  }
+  // Use immediate operand form if rhs was just produced by a constant load,
+  // and shifts, masks or multiplies for multiplies and divides by it.
+  // LOAD_CONST_I32 r1 10   | I32_ADD_IMM r2 r0 10
+  // I32_ADD r2 r0 r1       |
+  // LOAD_CONST_I32 r1 8    | I32_SHR_U_IMM r2 r0 3
+  // I32_DIV_U r2 r0 r1     |
+  if (rhs != NULL) {
+    wasmbox_value_t v = wasmbox_code_get_value(func, &rhs->op1);
+    int imm_vmopcode = wasmbox_reduce_strength(vmopcode, &v);
+    if (imm_vmopcode < 0) {
+      imm_vmopcode = wasmbox_immediate_opcode(vmopcode);
+    }
+    if (imm_vmopcode >= 0) {
+      wasmbox_code_remove_last(func, 1);
+      code.h.opcode = imm_vmopcode;
+      wasmbox_code_set_value(func, &code.op2, v);
+    }
+  }
+  code.op0.reg = wasmbox_function_push_stack(func, result);
   wasmbox_code_add(func, &code);
   return 0;
 }
 
-static void wasmbox_code_add_move(wasmbox_mutable_function_t *func,
-                                  wasm_s32_t from, wasm_s32_t to) {
-  wasmbox_code_t code;
-  code.h.opcode = OPCODE_MOVE;
-  code.op0.reg = to;
-  code.op1.reg = from;
+// Fuse the adjustment by which a function allocates or frees its frame on the
+// stack of the guest into the STACK_POINTER_SET `code` which stores it.
+// STACK_POINTER_GET r5  | STACK_POINTER_ADD r5 -16
+// I32_SUB_IMM r5 r5 16  | MOVE r3 r5
+// MOVE r3 r5            |
+// STACK_POINTER_SET r5  |
+// I32_ADD_IMM r5 r3 16  | STACK_POINTER_SET r3 16
+// STACK_POINTER_SET r5  |
+// The value was just popped, so no one else reads it if its slot is given
+// back. Returns 0 if `code` is folded into the STACK_POINTER_GET, and is not
+// to be added.
+static int wasmbox_code_fuse_stack_pointer(wasmbox_mutable_function_t *func,
+                                           wasmbox_code_t *code) {
+  wasmbox_code_reg_t value = code->op1.reg;
+  if (value != func->stack_top) {
+    return -1;
+  }
+  wasmbox_code_t *last = wasmbox_code_find_last(func, 0);
+  wasm_u16_t tee = last != NULL && last->h.opcode == OPCODE_MOVE &&
+                   last->op1.reg == value && last->op0.reg != value;
+  wasmbox_code_t *sum = wasmbox_code_find_last(func, tee);
+  if (sum == NULL || sum->op0.reg != value ||
+      (sum->h.opcode != OPCODE_I32_ADD_IMM &&
+       sum->h.opcode != OPCODE_I32_SUB_IMM)) {
+    return -1;
+  }
+  wasm_u32_t addend = wasmbox_code_get_value(func, &sum->op2).u32;
+  if (sum->h.opcode == OPCODE_I32_SUB_IMM) {
+    addend = -addend;
+  }
+  wasmbox_code_t *get = wasmbox_code_find_last(func, tee + 1);
+  if (get != NULL && get->h.opcode == OPCODE_STACK_POINTER_GET &&
+      get->op0.reg == value && sum->op1.reg == value) {
+    get->h.opcode = OPCODE_STACK_POINTER_ADD;
+    get->op2.index = addend;
+    wasmbox_code_reg_t to = tee ? last->op0.reg : 0;
+    wasmbox_code_remove_last(func, tee + 1);
+    if (tee) {
+      wasmbox_code_add_move(func, value, to);
+    }
+    return 0;
+  }
+  if (tee) {
+    return -1;
+  }
+  code->op1.reg = sum->op1.reg;
+  code->op2.index = addend;
+  wasmbox_code_remove_last(func, 1);
+  return -1;
+}
+
+static void wasmbox_code_add_global_set(wasmbox_module_t *mod,
+                                        wasmbox_mutable_function_t *func,
+                                        wasm_u32_t index) {
+  wasmbox_code_t code = {};
+  code.h.opcode = OPCODE_GLOBAL_SET;
+  code.op0.index = index;
+  code.op1.reg = wasmbox_function_pop_stack(
+      func, (wasmbox_value_type_t) mod->global_types[index]);
+  if (index + 1 == mod->stack_pointer_global) {
+    code.h.opcode = OPCODE_STACK_POINTER_SET;
+    code.op2.index = 0;
+    if (wasmbox_code_fuse_stack_pointer(func, &code) == 0) {
+      return;
+    }
+  }
   wasmbox_code_add(func, &code);
 }
 
 static void wasmbox_code_add_return(wasmbox_mutable_function_t *func) {
-  wasmbox_code_t code;
+  wasmbox_code_t code = {};
   code.h.opcode = OPCODE_RETURN;
   wasmbox_code_add(func, &code);
 }
 
+// Returns the load or store of a memory64 which replaces `vmopcode`.
+static int wasmbox_memory64_opcode(int vmopcode) {
+  switch (vmopcode) {
+#define FUNC(inst, mtype, field, unfused, vmopcode) \
+  case OPCODE_##unfused:                            \
+    return vmopcode;
+    MEMORY64_INST_EACH(FUNC)
+#undef FUNC
+    default:
+      return -1;
+  }
+}
+
+static int wasmbox_indexed_opcode(int vmopcode) {
+  switch (vmopcode) {
+#define FUNC(inst, mtype, field, unfused, vmopcode) \
+  case OPCODE_##unfused:                            \
+    return vmopcode;
+    INDEXED_MEMORY_INST_EACH(FUNC)
+#undef FUNC
+    default:
+      return -1;
+  }
+}
+
+// Returns the shift by which `code` scales `reg` in place, or -1.
+static int wasmbox_code_scale_shift(wasmbox_mutable_function_t *func,
+                                    wasmbox_code_t *code,
+                                    wasmbox_code_reg_t reg) {
+  if (code == NULL || code->op0.reg != reg || code->op1.reg != reg) {
+    return -1;
+  }
+  wasm_u32_t v;
+  switch (code->h.opcode) {
+    case OPCODE_I32_SHL_IMM:
+      return wasmbox_code_get_value(func, &code->op2).u32 & 31;
+    case OPCODE_I32_MUL_IMM:
+      v = wasmbox_code_get_value(func, &code->op2).u32;
+      return v != 0 && (v & (v - 1)) == 0 ? __builtin_ctz(v) : -1;
+    default:
+      return -1;
+  }
+}
+
+// Fuse the address computation of an access to memory into it when the
+// address is a base plus an index scaled by a power of two.
+// I32_SHL_IMM r2 r2 2   | I32_LOAD_INDEXED r1 r1 r2 2 8
+// I32_ADD r1 r1 r2      |
+// I32_LOAD r1 r1 8      |
+// The last `skip` instructions, between the sum and the access, are removed
+// too for the caller to fold them into the access. Slots above `addr` are
+// operand stack slots popped by the access, so no one else reads the index.
+static int wasmbox_code_fuse_indexed(wasmbox_mutable_function_t *func,
+                                     wasmbox_code_t *code,
+                                     wasmbox_code_reg_t addr,
+                                     wasm_u16_t skip) {
+  int fused = wasmbox_indexed_opcode(code->h.opcode);
+  wasmbox_code_t *sum = wasmbox_code_find_last(func, skip);
+  if (fused < 0 || sum == NULL || sum->h.opcode != OPCODE_I32_ADD ||
+      sum->op0.reg != addr || sum->op2.reg <= addr ||
+      sum->op1.reg == sum->op2.reg) {
+    return -1;
+  }
+  wasmbox_code_reg_t base = sum->op1.reg;
+  wasmbox_code_reg_t index = sum->op2.reg;
+  int shift = wasmbox_code_scale_shift(
+      func, wasmbox_code_find_last(func, skip + 1), index);
+  code->h.opcode = fused;
+  code->op1.r.reg1 = base;
+  code->op1.r.reg2 = index;
+  code->op0.r.reg2 = shift < 0 ? 0 : shift;
+  wasmbox_code_remove_last(func, skip + (shift < 0 ? 1 : 2));
+  return 0;
+}
+
+// The type of the addresses and sizes of the memory of `mod`.
+static wasmbox_value_type_t wasmbox_module_address_type(wasmbox_module_t *mod) {
+  return mod->memory64 ? WASM_TYPE_I64 : WASM_TYPE_I32;
+}
+
+// Returns the type of the address of the access `vmopcode`, an i64 for the
+// accesses to a memory64.
+static wasmbox_value_type_t wasmbox_address_type(int vmopcode) {
+  switch (vmopcode) {
+#define FUNC(inst, mtype, field, unfused, vmopcode) case vmopcode:
+    MEMORY64_INST_EACH(FUNC)
+#undef FUNC
+      return WASM_TYPE_I64;
+    default:
+      return WASM_TYPE_I32;
+  }
+}
+
+// Loads and stores move a value of `type`.
 static void wasmbox_code_add_load(wasmbox_mutable_function_t *func,
-                                  int vmopcode, wasm_u32_t offset) {
-  wasmbox_code_t code;
+                                  int vmopcode, wasm_u32_t offset,
+                                  wasmbox_value_type_t type) {
+  wasmbox_code_t code = {};
   code.h.opcode = vmopcode;
-  code.op0.reg = wasmbox_function_push_stack(func);
-  code.op1.index = offset;
+  code.op1.reg =
+      wasmbox_function_pop_stack(func, wasmbox_address_type(vmopcode));
+  code.op2.index = offset;
+  wasmbox_code_reg_t addr = code.op1.reg;
+  if (wasmbox_code_fuse_indexed(func, &code, addr, 0) == 0) {
+    code.op0.r.reg1 = wasmbox_function_push_stack(func, type);
+  } else {
+    code.op0.reg = wasmbox_function_push_stack(func, type);
+  }
   wasmbox_code_add(func, &code);
 }
 
 static void wasmbox_code_add_store(wasmbox_mutable_function_t *func,
-                                   int vmopcode, wasm_u32_t offset) {
-  wasmbox_code_t code;
+                                   int vmopcode, wasm_u32_t offset,
+                                   wasmbox_value_type_t type) {
+  wasmbox_code_t code = {};
+  code.h.opcode = vmopcode;
+  code.op1.reg = wasmbox_function_pop_stack(func, type);
+  code.op0.reg =
+      wasmbox_function_pop_stack(func, wasmbox_address_type(vmopcode));
+  code.op2.index = offset;
+  // The value is pushed after the address, so it is computed between the sum
+  // and the store. Only the move of a local is fused, the store reading the
+  // local itself.
+  // I32_SHL_IMM r2 r2 2   | I32_STORE_INDEXED r0 r1 r2 2 8
+  // I32_ADD r1 r1 r2      |
+  // MOVE r2 r0            |
+  // I32_STORE r1 r2 8     |
+  wasmbox_code_t *value = wasmbox_code_find_last(func, 0);
+  if (value != NULL && value->h.opcode == OPCODE_MOVE &&
+      value->op0.reg == code.op1.reg && value->op1.reg < code.op0.reg) {
+    wasmbox_code_reg_t local = value->op1.reg;
+    if (wasmbox_code_fuse_indexed(func, &code, code.op0.reg, 1) == 0) {
+      code.op0.r.reg1 = local;
+    }
+  }
+  wasmbox_code_add(func, &code);
+}
+
+// Atomic read-modify-write instructions pop (address, value) into op1 and
+// notify pops (address, count) the same way. The value and the result have
+// `type`, an i32 for notify.
+static void wasmbox_code_add_rmw(wasmbox_mutable_function_t *func,
+                                 int vmopcode, wasm_u32_t offset,
+                                 wasmbox_value_type_t type) {
+  wasmbox_code_t code = {};
+  code.h.opcode = vmopcode;
+  code.op1.r.reg2 = wasmbox_function_pop_stack(func, type);
+  code.op1.r.reg1 = wasmbox_function_pop_stack(func, WASM_TYPE_I32);
+  code.op0.reg = wasmbox_function_push_stack(func, type);
+  code.op2.index = offset;
+  wasmbox_code_add(func, &code);
+}
+
+static void wasmbox_code_add_notify(wasmbox_mutable_function_t *func,
+                                    int vmopcode, wasm_u32_t offset,
+                                    wasmbox_value_type_t type) {
+  wasmbox_code_add_rmw(func, vmopcode, offset, type);
+}
+
+// cmpxchg pops (address, expected, replacement) and wait pops (address,
+// expected, timeout). The last operand shares op0 with the result.
+static void wasmbox_code_add_compare(wasmbox_mutable_function_t *func,
+                                     int vmopcode, wasm_u32_t offset,
+                                     wasmbox_value_type_t expected,
+                                     wasmbox_value_type_t last,
+                                     wasmbox_value_type_t result) {
+  wasmbox_code_t code = {};
   code.h.opcode = vmopcode;
-  code.op0.index = offset;
-  code.op1.reg = wasmbox_function_pop_stack(func);
+  code.op0.r.reg2 = wasmbox_function_pop_stack(func, last);
+  code.op1.r.reg2 = wasmbox_function_pop_stack(func, expected);
+  code.op1.r.reg1 = wasmbox_function_pop_stack(func, WASM_TYPE_I32);
+  code.op0.r.reg1 = wasmbox_function_push_stack(func, result);
+  code.op2.index = offset;
   wasmbox_code_add(func, &code);
 }
 
+static void wasmbox_code_add_cmpxchg(wasmbox_mutable_function_t *func,
+                                     int vmopcode, wasm_u32_t offset,
+                                     wasmbox_value_type_t type) {
+  wasmbox_code_add_compare(func, vmopcode, offset, type, type, type);
+}
+
+// The timeout is an i64 in nanoseconds and the result an i32.
+static void wasmbox_code_add_wait(wasmbox_mutable_function_t *func,
+                                  int vmopcode, wasm_u32_t offset,
+                                  wasmbox_value_type_t type) {
+  wasmbox_code_add_compare(func, vmopcode, offset, type, WASM_TYPE_I64,
+                           WASM_TYPE_I32);
+}
+
 static void wasmbox_code_add_exit(wasmbox_mutable_function_t *func) {
-  wasmbox_code_t code;
+  wasmbox_code_t code = {};
   code.h.opcode = OPCODE_EXIT;
   wasmbox_code_add(func, &code);
 }
 
-static void wasmbox_code_add_jump(wasmbox_mutable_function_t *func,
-                                  int vmopcode, wasm_u32_t blockindex,
-                                  enum wasm_jump_direction direction) {
-  wasmbox_code_t code;
+static void wasmbox_code_add_branch(wasmbox_mutable_function_t *func,
+                                    int vmopcode, wasm_s16_t cond,
+                                    wasm_u32_t blockindex,
+                                    enum wasm_jump_direction direction) {
+  wasmbox_code_t code = {};
   code.h.opcode = vmopcode;
   code.op0.index = blockindex;
   if (vmopcode == OPCODE_JUMP_IF) {
-    code.op1.reg = wasmbox_function_pop_stack(func);
+    code.op1.reg = cond;
+    // A branch on a constant condition is either never taken or always taken.
+    wasmbox_value_t cond = {};
+    if (wasmbox_code_take_last_const(func, code.op1.reg, &cond) == 0) {
+      if (cond.u32 == 0) {
+        return;
+      }
+      vmopcode = code.h.opcode = OPCODE_JUMP;
+    }
   }
   code.op2.index = (wasm_u32_t) direction;
   wasmbox_code_add(func, &code);
@@ -405,14 +1836,34 @@ static void wasmbox_code_add_jump(wasmbox_mutable_function_t *func,
   }
 }
 
+static void wasmbox_code_add_jump(wasmbox_mutable_function_t *func,
+                                  int vmopcode, wasm_u32_t blockindex,
+                                  enum wasm_jump_direction direction) {
+  wasm_s16_t cond = -1;
+  if (vmopcode == OPCODE_JUMP_IF) {
+    cond = wasmbox_function_pop_stack(func, WASM_TYPE_I32);
+  }
+  wasmbox_code_add_branch(func, vmopcode, cond, blockindex, direction);
+}
+
 #define TYPE_EACH(FUNC)                  \
   FUNC(0x7f, WASM_TYPE_I32, I32)         \
   FUNC(0x7e, WASM_TYPE_I64, I64)         \
   FUNC(0x7d, WASM_TYPE_F32, F32)         \
   FUNC(0x7c, WASM_TYPE_F64, F64)         \
+  FUNC(0x7b, WASM_TYPE_V128, V128)       \
   FUNC(0x70, WASM_TYPE_FUNCREF, FUNCREF) \
   FUNC(0x6f, WASM_TYPE_EXTERNREF, EXTERNREF)
 
+// The value types of the type names in the instruction tables.
+#define WASMBOX_VALUE_TYPE_i32 WASM_TYPE_I32
+#define WASMBOX_VALUE_TYPE_s32 WASM_TYPE_I32
+#define WASMBOX_VALUE_TYPE_u32 WASM_TYPE_I32
+#define WASMBOX_VALUE_TYPE_i64 WASM_TYPE_I64
+#define WASMBOX_VALUE_TYPE_u64 WASM_TYPE_I64
+#define WASMBOX_VALUE_TYPE_f32 WASM_TYPE_F32
+#define WASMBOX_VALUE_TYPE_f64 WASM_TYPE_F64
+
 static const char *value_type_to_string(wasmbox_value_type_t type) {
   switch (type) {
 #define FUNC(opcode, type_enum, type_name) \
@@ -425,66 +1876,101 @@ static const char *value_type_to_string(wasmbox_value_type_t type) {
   }
 }
 
-static int print_function_type(wasmbox_type_t *func_type) {
-  fprintf(stdout, "function-type: (");
+static int wasmbox_log_enabled(wasmbox_module_t *mod, int level) {
+  return mod->log_callback != NULL && mod->log_level >= level;
+}
+
+static void wasmbox_log(wasmbox_module_t *mod, int level, const char *fmt,
+                        ...) {
+  if (!wasmbox_log_enabled(mod, level)) {
+    return;
+  }
+  char message[256];
+  va_list ap;
+  va_start(ap, fmt);
+  vsnprintf(message, sizeof(message), fmt, ap);
+  va_end(ap);
+  mod->log_callback(mod->log_data, level, message);
+}
+
+// Opens a stream collecting a message of several lines, or returns NULL if
+// `level` is not logged.
+static FILE *wasmbox_log_open(wasmbox_module_t *mod, int level, char **buf,
+                              size_t *size) {
+  if (!wasmbox_log_enabled(mod, level)) {
+    return NULL;
+  }
+  return open_memstream(buf, size);
+}
+
+// `buf` is only set once the stream is closed.
+static void wasmbox_log_close(wasmbox_module_t *mod, int level, FILE *out,
+                              char **buf) {
+  fclose(out);
+  mod->log_callback(mod->log_data, level, *buf);
+  free(*buf); // allocated by open_memstream
+}
+
+static int print_function_type(FILE *out, wasmbox_type_t *func_type) {
+  fprintf(out, "function-type: (");
   for (wasm_u32_t i = 0; i < func_type->argument_size; i++) {
     if (i != 0) {
-      fprintf(stdout, ", ");
+      fprintf(out, ", ");
     }
-    fprintf(stdout, "%s", value_type_to_string(func_type->args[i]));
+    fprintf(out, "%s", value_type_to_string(func_type->args[i]));
   }
-  fprintf(stdout, ") -> (");
+  fprintf(out, ") -> (");
   for (wasm_u32_t i = 0; i < func_type->return_size; i++) {
     if (i != 0) {
-      fprintf(stdout, ", ");
+      fprintf(out, ", ");
     }
     fprintf(
-        stdout, "%s",
+        out, "%s",
         value_type_to_string(func_type->args[func_type->argument_size + i]));
   }
-  fprintf(stdout, ")");
+  fprintf(out, ")");
   return 0;
 }
 
-static int print_function(wasmbox_function_t *func, wasm_u32_t index) {
-  if (func->name != NULL) {
-    fprintf(stdout, "function %.*s:", func->name->len, func->name->value);
+static int print_function(FILE *out, wasmbox_function_t *func,
+                          wasmbox_name_t *name, wasm_u32_t index) {
+  if (name != NULL) {
+    fprintf(out, "function %.*s:", name->len, name->value);
   } else {
-    fprintf(stdout, "function func%u:", index);
+    fprintf(out, "function func%u:", index);
   }
   if (func->type) {
-    print_function_type(func->type);
+    print_function_type(out, func->type);
   }
   return 0;
 }
 
+// Both are read as little-endian words.
 static int parse_magic(wasmbox_input_stream_t *ins) {
-  return wasmbox_input_stream_read_u32(ins) == 0x0061736d /* 00 'a' 's' 'm' */;
+  return wasmbox_input_stream_read_u32(ins) == 0x6d736100 /* 00 'a' 's' 'm' */
+             ? 0
+             : -1;
 }
 
 static int parse_version(wasmbox_input_stream_t *ins) {
-  return wasmbox_input_stream_read_u32(ins) == 0x01000000;
+  return wasmbox_input_stream_read_u32(ins) == 0x00000001 ? 0 : -1;
 }
 
-static int dump_binary(wasmbox_input_stream_t *ins, wasm_u64_t size) {
+static void dump_binary(wasmbox_input_stream_t *ins, wasmbox_module_t *mod,
+                        wasm_u64_t size) {
+  char *buf;
+  size_t buf_size;
+  FILE *out = wasmbox_log_open(mod, WASMBOX_LOG_DEBUG, &buf, &buf_size);
+  if (out == NULL) {
+    return;
+  }
   for (wasm_u64_t i = 0; i < size; i++) {
-    fprintf(stdout, "%02x", ins->data[ins->index + i]);
+    fprintf(out, "%02x", ins->data[ins->index + i]);
     if (i % 16 == 15) {
-      fprintf(stdout, "\n");
+      fprintf(out, "\n");
     }
   }
-  fprintf(stdout, "\n");
-  return 0;
-}
-
-static int parse_custom_section(wasmbox_input_stream_t *ins,
-                                wasm_u64_t section_size,
-                                wasmbox_module_t *mod) {
-  // XXX Current we just skip custom section since it would not affect to other
-  // sections.
-  dump_binary(ins, section_size);
-  ins->index += section_size;
-  return 0;
+  wasmbox_log_close(mod, WASMBOX_LOG_DEBUG, out, &buf);
 }
 
 static int parse_value_type(wasmbox_input_stream_t *ins,
@@ -504,19 +1990,38 @@ static int parse_value_type(wasmbox_input_stream_t *ins,
   }
 }
 
+// Reads `len` types into an entry per slot, so a v128 is stored twice.
 static int parse_type_vector(wasmbox_input_stream_t *ins, wasm_u32_t len,
                              wasmbox_value_type_t *type) {
   for (wasm_u32_t i = 0; i < len; i++) {
-    if (parse_value_type(ins, &type[i]) != 0) {
+    if (parse_value_type(ins, type) != 0) {
       return -1;
     }
+    if (*type == WASM_TYPE_V128) {
+      *++type = WASM_TYPE_V128;
+    }
+    type++;
   }
   return 0;
 }
 
-static wasmbox_type_t *parse_function_type(wasmbox_input_stream_t *ins) {
+// Returns the number of slots taken by the `len` value types at `pos`.
+static wasm_u32_t count_type_slots(wasmbox_input_stream_t *ins,
+                                   wasm_u32_t pos, wasm_u32_t len) {
+  wasm_u32_t slots = len;
+  for (wasm_u32_t i = pos; i < pos + len && i < ins->length; i++) {
+    slots += ins->data[i] == 0x7b;
+  }
+  return slots;
+}
+
+static wasmbox_type_t *parse_function_type(wasmbox_input_stream_t *ins,
+                                           wasmbox_module_t *mod) {
   wasm_u8_t ch = wasmbox_input_stream_read_u8(ins);
-  assert(ch == 0x60);
+  if (ch != 0x60) {
+    LOG("not a function type");
+    return NULL;
+  }
   wasm_u32_t args_size = wasmbox_parse_unsigned_leb128(
       ins->data + ins->index, &ins->index, ins->length);
 
@@ -526,11 +2031,18 @@ static wasmbox_type_t *parse_function_type(wasmbox_input_stream_t *ins) {
 
   wasm_u32_t ret_size = wasmbox_parse_unsigned_leb128(ins->data + ins->index,
                                                       &ins->index, ins->length);
-  wasmbox_type_t *func_type = (wasmbox_type_t *) wasmbox_malloc(
-      sizeof(*func_type) +
-      sizeof(wasmbox_value_type_t *) * (args_size + ret_size));
-  func_type->argument_size = args_size;
-  func_type->return_size = ret_size;
+  // The sizes are counted in slots.
+  wasm_u32_t arg_slots = count_type_slots(ins, current_pos, args_size);
+  wasm_u32_t ret_slots = count_type_slots(ins, ins->index, ret_size);
+  if (arg_slots > WASM_S16_MAX || ret_slots > WASM_S16_MAX) {
+    LOG("too many parameters or results");
+    return NULL;
+  }
+  wasmbox_type_t *func_type = (wasmbox_type_t *) wasmbox_slab_alloc(
+      mod->metadata, sizeof(*func_type) +
+      sizeof(wasmbox_value_type_t *) * (arg_slots + ret_slots));
+  func_type->argument_size = arg_slots;
+  func_type->return_size = ret_slots;
 
   wasm_u32_t after_return_size = ins->index;
   ins->index = current_pos;
@@ -539,8 +2051,7 @@ static wasmbox_type_t *parse_function_type(wasmbox_input_stream_t *ins) {
   }
 
   ins->index = after_return_size;
-  if (parse_type_vector(ins, func_type->return_size,
-                        func_type->args + args_size) != 0) {
+  if (parse_type_vector(ins, ret_size, func_type->args + arg_slots) != 0) {
     return NULL;
   }
   return func_type;
@@ -559,6 +2070,7 @@ static int parse_blocktype(wasmbox_input_stream_t *ins,
     case 0x7e:
     case 0x7d:
     case 0x7c:
+    case 0x7b:
       type->type = WASMBOX_BLOCK_TYPE_VAL;
       return parse_value_type(ins, &type->v.t);
     default:
@@ -587,181 +2099,696 @@ static int parse_expression(wasmbox_input_stream_t *ins, wasmbox_module_t *mod,
   return 0;
 }
 
+// Evaluates a constant expression whose value is of `type`.
 static int eval_expression(wasmbox_input_stream_t *ins, wasmbox_module_t *mod,
-                           wasmbox_value_t *result) {
+                           wasmbox_value_type_t type, wasmbox_value_t *result) {
   wasmbox_value_t stack[8];
+  wasmbox_arena_t arena = {};
   wasmbox_mutable_function_t func = {};
+  func.arena = &arena;
   func.current_block_id = -1;
   if (parse_expression(ins, mod, &func) < 0) {
+    wasmbox_arena_dispose(&arena);
     return -1;
   }
-  wasmbox_code_add_move(&func, wasmbox_function_pop_stack(&func), -1);
+  wasm_s16_t reg = wasmbox_function_pop_stack(&func, type);
+  if (func.invalid) {
+    wasmbox_arena_dispose(&arena);
+    return -1;
+  }
+  // Most expressions are folded into a single constant load, which needs no
+  // VM to be evaluated.
+  if (func.block_size == 1 && func.blocks[0].code_size == 1 &&
+      wasmbox_code_find_last_const(&func, reg, 0) != NULL) {
+    *result = wasmbox_code_get_value(&func, &func.blocks[0].code[0].op1);
+    wasmbox_arena_dispose(&arena);
+    return 0;
+  }
+  wasmbox_code_add_move(&func, reg, -1);
   wasmbox_code_add_exit(&func);
-  wasmbox_function_freeze(mod, &func);
+  wasmbox_function_freeze(mod, &func, NULL);
+  wasmbox_arena_dispose(&arena);
   wasmbox_eval_function(mod, func.base.code, stack + 1);
   *result = stack[0];
   if (func.base.code_size > 0) {
-    wasmbox_free(func.base.code);
+    wasmbox_module_free_code(mod, func.base.code);
   }
+#ifdef WASMBOX_VM_USE_SAMPLING_PROFILE
+  if (func.code_offsets != NULL) {
+    wasmbox_free(func.code_offsets);
+  }
+#endif
   return 0;
 }
 
-static void print_block_type(const char *prefix, wasmbox_blocktype_t *type) {
+static void print_block_type(wasmbox_module_t *mod, const char *prefix,
+                             wasmbox_blocktype_t *type) {
   switch (type->type) {
     case WASMBOX_BLOCK_TYPE_NONE:
       break;
     case WASMBOX_BLOCK_TYPE_VAL:
-      fprintf(stdout, "%s (type: %s)\n", prefix,
-              value_type_to_string(type->v.t));
+      wasmbox_log(mod, WASMBOX_LOG_DEBUG, "%s (type: %s)", prefix,
+                  value_type_to_string(type->v.t));
       break;
     case WASMBOX_BLOCK_TYPE_INDEX:
-      fprintf(stdout, "%s (index: %lld)\n", prefix, type->v.x);
+      wasmbox_log(mod, WASMBOX_LOG_DEBUG, "%s (index: %lld)", prefix,
+                  type->v.x);
       break;
   }
 }
 
-// INST(0x02 bt:blocktype (in:instr)* 0x0B, block bt in* end)
-// INST(0x03 bt:blocktype (in:instr)* 0x0B, loop bt in* end)
-static int decode_block(wasmbox_input_stream_t *ins, wasmbox_module_t *mod,
-                        wasmbox_mutable_function_t *func, wasm_u8_t op) {
-  wasmbox_blocktype_t blocktype;
-  if (parse_blocktype(ins, &blocktype)) {
-    return -1;
+// Emits the check of the epoch deadline a function or loop body starts with,
+// and the count of its hotness in the first tier.
+static void wasmbox_code_add_body_checks(wasmbox_module_t *mod,
+                                         wasmbox_mutable_function_t *func) {
+  wasmbox_code_t code = {};
+  if (mod->epoch_interruption) {
+    code.h.opcode = OPCODE_EPOCH;
+    wasmbox_code_add(func, &code);
   }
-  enum wasm_jump_direction direction;
-  switch (op) {
-    case 0x02:
-      print_block_type("block", &blocktype);
-      direction = WASM_JUMP_DIRECTION_TAIL;
-      break;
-    case 0x03:
-      print_block_type("loop", &blocktype);
-      direction = WASM_JUMP_DIRECTION_HEAD;
-      break;
-    default:
-      return -1;
+#ifdef WASMBOX_VM_USE_LAZY_COMPILE
+  if (func->baseline) {
+    code.h.opcode = OPCODE_HOTNESS;
+    code.op0.index = func->blocks[func->current_block_id].loop + 1;
+    wasmbox_code_set_func(func, &code.op1, &func->origin->base);
+    wasmbox_code_add(func, &code);
   }
-  wasm_s16_t current_block = func->current_block_id;
-  wasm_s16_t block_body = wasmbox_block_add(func);
-  wasmbox_block_t *body = &func->blocks[block_body];
-  body->direction = direction;
-  wasm_s16_t block_then = wasmbox_block_add(func);
-
-  wasm_s16_t block_value = -1;
-  if (blocktype.type == WASMBOX_BLOCK_TYPE_VAL) {
-    block_value = wasmbox_function_push_stack(func);
+#endif
+}
+
+// Zeroes the locals, which start at zero in wasm, at the entry of a function.
+// Unless the function is baseline code, the optimizer narrows it down to the
+// locals which may be read before they are written.
+static void wasmbox_code_add_zero_locals(wasmbox_mutable_function_t *func) {
+  if (func->base.locals == 0) {
+    return;
+  }
+  wasmbox_code_t code = {};
+  code.h.opcode = OPCODE_ZERO_LOCALS;
+  code.op0.reg = WASMBOX_FUNCTION_CALL_OFFSET + func->base.type->argument_size;
+  code.op1.index = func->base.locals;
+  wasmbox_code_add(func, &code);
+}
+
+// Emits a FUEL instruction in the current block, which every instruction
+// decoded until wasmbox_fuel_meter_finish is charged to.
+static void wasmbox_fuel_meter_start(wasmbox_mutable_function_t *func,
+                                     wasmbox_fuel_meter_t *meter) {
+  wasmbox_code_t code = {};
+  code.h.opcode = OPCODE_FUEL;
+  code.op0.index = 0;
+  wasmbox_code_add(func, &code);
+  wasmbox_block_t *block = &func->blocks[func->current_block_id];
+  meter->block_id = func->current_block_id;
+  meter->index = block->code_size - 1;
+  meter->cost = 0;
+  if (block->already_terminated != 0) {
+    meter->block_id = -1;
+  }
+  func->fuel_meter = meter;
+}
+
+static void wasmbox_fuel_meter_finish(wasmbox_mutable_function_t *func,
+                                      wasmbox_fuel_meter_t *meter,
+                                      wasmbox_fuel_meter_t *outer) {
+  if (meter->block_id >= 0) {
+    func->blocks[meter->block_id].code[meter->index].op0.index = meter->cost;
+  }
+  func->fuel_meter = outer;
+}
+
+// The types of the slots of a value, by its wasmbox_value_type_t. A v128
+// takes two slots.
+static const wasmbox_value_type_t wasmbox_value_slots[] = {
+    WASM_TYPE_UNDEFINED, WASM_TYPE_I32,       WASM_TYPE_I64,
+    WASM_TYPE_F32,       WASM_TYPE_F64,       WASM_TYPE_FUNCREF,
+    WASM_TYPE_EXTERNREF, WASM_TYPE_V128,      WASM_TYPE_V128};
+
+// Parameters and results of a block, with an entry per slot.
+typedef struct wasmbox_block_signature_t {
+  const wasmbox_value_type_t *params;
+  const wasmbox_value_type_t *results;
+  wasm_u16_t param_size;
+  wasm_u16_t result_size;
+} wasmbox_block_signature_t;
+
+static int wasmbox_block_signature(wasmbox_module_t *mod,
+                                   wasmbox_blocktype_t *blocktype,
+                                   wasmbox_block_signature_t *sig) {
+  wasmbox_type_t *type;
+  memset(sig, 0, sizeof(*sig));
+  switch (blocktype->type) {
+    case WASMBOX_BLOCK_TYPE_NONE:
+      return 0;
+    case WASMBOX_BLOCK_TYPE_VAL:
+      sig->results = &wasmbox_value_slots[blocktype->v.t];
+      sig->result_size = blocktype->v.t == WASM_TYPE_V128 ? 2 : 1;
+      return 0;
+    case WASMBOX_BLOCK_TYPE_INDEX:
+      if (blocktype->v.x < 0 || blocktype->v.x >= mod->type_size) {
+        LOG("undefined block type");
+        return -1;
+      }
+      type = mod->types[blocktype->v.x];
+      sig->params = type->args;
+      sig->param_size = type->argument_size;
+      sig->results = type->args + type->argument_size;
+      sig->result_size = type->return_size;
+      return 0;
+  }
+  return -1;
+}
+
+// Slots of the values of a block, and the operand stack its end resets to.
+typedef struct wasmbox_block_values_t {
+  wasm_s16_t results;
+  wasm_u16_t result_size;
+  wasm_s16_t params;
+  wasm_u16_t param_size;
+  wasm_s16_t stack_size;
+  wasm_s16_t stack_top;
+  /* stack_floor of the enclosing block. */
+  wasm_s16_t stack_floor;
+  /* Slots of the parameters before the block. */
+  wasm_s16_t *sources;
+  const wasmbox_value_type_t *param_types;
+  const wasmbox_value_type_t *result_types;
+} wasmbox_block_values_t;
+
+// Moves the `size` values on the top of the operand stack to the slots from
+// `to`, which are below them or the same. The values stay on the stack.
+static void wasmbox_code_add_values(wasmbox_mutable_function_t *func,
+                                    wasm_s16_t to, wasm_u16_t size) {
+  wasm_s32_t first = func->stack_size - size;
+  if (first < 0) {
+    return;
+  }
+  for (wasm_u16_t i = 0; i < size; ++i) {
+    wasm_s16_t from = func->operand_stack[first + i];
+    if (from != to + i) {
+      wasmbox_code_add_move(func, from, to + i);
+    }
+  }
+}
+
+// Enters a block: pops its parameters and reserves the slots of its results.
+// wasmbox_function_push_params pushes the parameters back right above them.
+static void wasmbox_function_enter_block(wasmbox_mutable_function_t *func,
+                                         wasmbox_block_signature_t *sig,
+                                         wasmbox_block_values_t *values) {
+  values->sources = NULL;
+  wasmbox_function_check_values(func, sig->params, sig->param_size);
+  if (sig->param_size > 0 && func->stack_size >= sig->param_size) {
+    values->sources = (wasm_s16_t *) wasmbox_arena_alloc(
+        func->arena, sizeof(wasm_s16_t) * sig->param_size);
+    memcpy(values->sources,
+           func->operand_stack + func->stack_size - sig->param_size,
+           sizeof(wasm_s16_t) * sig->param_size);
+  }
+  for (wasm_u16_t i = 0; i < sig->param_size; ++i) {
+    wasmbox_function_pop_stack(func, WASM_TYPE_UNDEFINED);
+  }
+  values->result_size = sig->result_size;
+  values->result_types = sig->results;
+  values->results =
+      wasmbox_function_push_values(func, sig->results, sig->result_size);
+  values->stack_size = func->stack_size;
+  values->stack_top = func->stack_top;
+  values->stack_floor = func->stack_floor;
+  func->stack_floor = func->stack_size;
+  values->param_size = sig->param_size;
+  values->param_types = sig->params;
+  values->params = -1;
+}
+
+// Pushes the parameters of a block and moves them to their new slots. The
+// moves are coalesced with the producers of the parameters by the optimizer.
+static void wasmbox_function_push_params(wasmbox_mutable_function_t *func,
+                                         wasmbox_block_values_t *values) {
+  values->params = wasmbox_function_push_values(func, values->param_types,
+                                                values->param_size);
+  if (values->sources == NULL) {
+    return;
+  }
+  // The parameters only move up, so the last one is moved first.
+  for (wasm_s32_t i = values->param_size - 1; i >= 0; --i) {
+    if (values->sources[i] != values->params + i) {
+      wasmbox_code_add_move(func, values->sources[i], values->params + i);
+    }
+  }
+}
+
+// Moves the values on the top of the operand stack to the results of a block
+// at its end, and drops the rest of its operand stack. A reachable end must
+// find exactly the results there.
+static void wasmbox_function_leave_block(wasmbox_mutable_function_t *func,
+                                         wasmbox_block_values_t *values) {
+  if (wasmbox_function_is_reachable(func) &&
+      func->stack_size != values->stack_size + values->result_size) {
+    LOG("wrong number of block results");
+    func->invalid = 1;
+  }
+  wasmbox_function_check_values(func, values->result_types,
+                                values->result_size);
+  wasmbox_code_add_values(func, values->results, values->result_size);
+  func->stack_size = values->stack_size;
+  func->stack_top = values->stack_top;
+}
+
+// Moves the results on the top of the operand stack to the result area,
+// which ends right below the frame.
+static void wasmbox_code_add_results(wasmbox_mutable_function_t *func) {
+  wasmbox_block_t *block = &func->blocks[func->current_block_id];
+  if (block->already_terminated) {
+    return;
+  }
+  wasmbox_type_t *type = func->base.type;
+  wasmbox_function_check_values(func, type->args + type->argument_size,
+                                type->return_size);
+  for (wasm_s32_t i = 0; i < type->return_size; ++i) {
+    wasmbox_code_add_move(
+        func, wasmbox_function_pop_stack(func, WASM_TYPE_UNDEFINED), -1 - i);
+  }
+}
+
+// INST(0x02 bt:blocktype (in:instr)* 0x0B, block bt in* end)
+// INST(0x03 bt:blocktype (in:instr)* 0x0B, loop bt in* end)
+static int decode_block(wasmbox_input_stream_t *ins, wasmbox_module_t *mod,
+                        wasmbox_mutable_function_t *func, wasm_u8_t op) {
+  wasmbox_blocktype_t blocktype;
+  wasmbox_block_signature_t sig;
+  if (parse_blocktype(ins, &blocktype) ||
+      wasmbox_block_signature(mod, &blocktype, &sig)) {
+    return -1;
+  }
+  enum wasm_jump_direction direction;
+  switch (op) {
+    case 0x02:
+      print_block_type(mod, "block", &blocktype);
+      direction = WASM_JUMP_DIRECTION_TAIL;
+      break;
+    case 0x03:
+      print_block_type(mod, "loop", &blocktype);
+      direction = WASM_JUMP_DIRECTION_HEAD;
+      break;
+    default:
+      return -1;
+  }
+  wasm_s16_t current_block = func->current_block_id;
+  wasm_s16_t block_body = wasmbox_block_add(func);
+  wasm_s16_t block_then = wasmbox_block_add(func);
+  wasmbox_block_values_t values;
+  wasmbox_function_enter_block(func, &sig, &values);
+  wasmbox_function_push_params(func, &values);
+  wasmbox_block_t *body = &func->blocks[block_body];
+  body->direction = direction;
+  // A branch to a block leaves it with its results and a branch to a loop
+  // starts it over with its parameters.
+  if (direction == WASM_JUMP_DIRECTION_TAIL) {
+    body->value = values.results;
+    body->value_size = values.result_size;
+    body->value_types = values.result_types;
+  } else {
+    body->value = values.params;
+    body->value_size = values.param_size;
+    body->value_types = values.param_types;
   }
 
   wasmbox_code_add_jump(func, OPCODE_JUMP, block_body,
                         WASM_JUMP_DIRECTION_HEAD);
   wasmbox_block_switch(func, block_body);
   wasmbox_block_link_parent(func, current_block);
+  // The branches back to a loop check the epoch, count its hotness and are
+  // charged for its body.
+  if (direction == WASM_JUMP_DIRECTION_HEAD) {
+#ifdef WASMBOX_VM_USE_LAZY_COMPILE
+    body->loop = func->loop_size++;
+#endif
+    wasmbox_code_add_body_checks(mod, func);
+  }
+  wasmbox_fuel_meter_t *outer = func->fuel_meter;
+  wasmbox_fuel_meter_t meter;
+  if (outer != NULL && direction == WASM_JUMP_DIRECTION_HEAD) {
+    wasmbox_fuel_meter_start(func, &meter);
+  }
+  func->label_depth++;
   int parsed = parse_expression(ins, mod, func);
-  if (blocktype.type == WASMBOX_BLOCK_TYPE_VAL) {
-    wasmbox_code_add_move(func, wasmbox_function_pop_stack(func), block_value);
+  func->label_depth--;
+  if (outer != NULL && direction == WASM_JUMP_DIRECTION_HEAD) {
+    wasmbox_fuel_meter_finish(func, &meter, outer);
   }
+  wasmbox_function_leave_block(func, &values);
+  func->stack_floor = values.stack_floor;
   wasmbox_code_add_jump(func, OPCODE_JUMP, block_then,
                         WASM_JUMP_DIRECTION_HEAD);
   wasmbox_block_switch(func, block_then);
   wasmbox_block_link_next(func, current_block);
+  wasmbox_block_inherit_label(func, current_block);
   return parsed;
 }
 
 // INST(0x05, end)
+// The end of the function body, which must be its last instruction and find
+// exactly the results on the operand stack.
 static int decode_block_end(wasmbox_input_stream_t *in, wasmbox_module_t *mod,
                             wasmbox_mutable_function_t *func, wasm_u8_t op) {
-  wasmbox_block_t *block = &func->blocks[func->current_block_id];
-  if (func->base.type->return_size > 0 && block->already_terminated == 0) {
-    wasmbox_code_add_move(func, wasmbox_function_pop_stack(func), -1);
+  if (func->base.type == NULL || in->index != in->length) {
+    LOG("unexpected end");
+    return -1;
+  }
+  if (wasmbox_function_is_reachable(func) &&
+      func->stack_size != func->base.type->return_size) {
+    LOG("wrong number of function results");
+    return -1;
   }
+  wasmbox_code_add_results(func);
   wasmbox_code_add_return(func);
 
   return 0;
 }
 
+// Returns the number of speculatable instructions an arm of an if/else
+// starts with, or -1 if the arm does not end with the move of its value
+// to `block_value` and the jump to `block_cont`.
+static wasm_s32_t wasmbox_block_arm_size(wasmbox_mutable_function_t *func,
+                                         wasm_s16_t block_id,
+                                         wasm_s16_t block_value,
+                                         wasm_s16_t block_cont) {
+  wasmbox_block_t *block = &func->blocks[block_id];
+  wasm_s32_t size = block->code_size - 2;
+  if (size < 0 || size > WASMBOX_IF_CONVERSION_LIMIT) {
+    return -1;
+  }
+  wasmbox_code_t *move = &block->code[size];
+  wasmbox_code_t *jump = &block->code[size + 1];
+  if (move->h.opcode != OPCODE_MOVE || move->op0.reg != block_value ||
+      jump->h.opcode != OPCODE_JUMP || block_cont < 0 ||
+      jump->op0.index != (wasm_u32_t) block_cont) {
+    return -1;
+  }
+  for (wasm_s32_t i = 0; i < size; ++i) {
+    if (!wasmbox_code_is_speculatable(func, &block->code[i], block_value + 1)) {
+      return -1;
+    }
+  }
+  return size;
+}
+
+// Lowers an if/else whose arms only compute a value to a SELECT. Both arms
+// are executed unconditionally, so the condition is not mispredicted.
+//   JUMP_IF then r0      | I32_ADD_IMM r2 r1 1
+//   JUMP else            | I32_SUB_IMM r4 r1 1
+// then:                  | SELECT r0 r0 r2 r4
+//   I32_ADD_IMM r2 r1 1  | JUMP cont
+//   MOVE r0 r2           |
+//   JUMP cont            |
+// else:                  |
+//   I32_SUB_IMM r2 r1 1  |
+//   MOVE r0 r2           |
+//   JUMP cont            |
+// The temporaries of the else arm are moved above the ones of the then arm,
+// which uses the slots from block_value + 1 to `then_top`.
+static int wasmbox_code_add_if_select(wasmbox_mutable_function_t *func,
+                                      wasm_s16_t cond, wasm_s16_t block_then,
+                                      wasm_s16_t block_else,
+                                      wasm_s16_t block_cont,
+                                      wasm_s16_t block_value,
+                                      wasm_s32_t then_top) {
+  wasm_s32_t then_size =
+      wasmbox_block_arm_size(func, block_then, block_value, block_cont);
+  wasm_s32_t else_size =
+      wasmbox_block_arm_size(func, block_else, block_value, block_cont);
+  if (then_size < 0 || else_size < 0) {
+    return -1;
+  }
+  wasmbox_block_t *then_block = &func->blocks[block_then];
+  wasmbox_block_t *else_block = &func->blocks[block_else];
+  wasm_s32_t delta = then_top - (block_value + 1);
+  wasmbox_code_t code = {};
+  code.h.opcode = OPCODE_SELECT;
+  code.op0.reg = block_value;
+  code.op1.reg = cond;
+  code.op2.r.reg1 = then_block->code[then_size].op1.reg;
+  code.op2.r.reg2 = else_block->code[else_size].op1.reg;
+  for (wasm_s32_t i = 0; i < then_size; ++i) {
+    wasmbox_code_add(func, &then_block->code[i]);
+  }
+  for (wasm_s32_t i = 0; i < else_size; ++i) {
+    wasmbox_code_t relocated = else_block->code[i];
+    wasmbox_code_relocate_slots(func, &relocated, block_value + 1, delta);
+    wasmbox_code_add(func, &relocated);
+  }
+  if (code.op2.r.reg2 > block_value) {
+    code.op2.r.reg2 += delta;
+  }
+  wasmbox_code_add(func, &code);
+  then_block->code_size = 0;
+  else_block->code_size = 0;
+  wasmbox_code_add_jump(func, OPCODE_JUMP, block_cont,
+                        WASM_JUMP_DIRECTION_HEAD);
+  return 0;
+}
+
 // INST(0x04 bt:blocktype (in:instr)* 0x0B, if bt in* end)
 // INST(0x04 bt:blocktype (in:instr)* 0x05 (in2:instr)* 0x0B, if bt in1* else
 // in2* end)
+// The branch on the condition is emitted once both arms are decoded, so that
+// diamonds which only compute a value can be lowered to a SELECT instead.
+// Branches in the arms continue at the head of `block_cont`.
 static int decode_if(wasmbox_input_stream_t *ins, wasmbox_module_t *mod,
                      wasmbox_mutable_function_t *func, wasm_u8_t op) {
   wasmbox_blocktype_t blocktype;
-  if (parse_blocktype(ins, &blocktype)) {
+  wasmbox_block_signature_t sig;
+  if (parse_blocktype(ins, &blocktype) ||
+      wasmbox_block_signature(mod, &blocktype, &sig)) {
     return -1;
   }
-  print_block_type("if", &blocktype);
-  wasmbox_code_t code;
+  print_block_type(mod, "if", &blocktype);
   wasm_s16_t current_block = func->current_block_id;
+  wasm_s16_t cond = wasmbox_function_pop_stack(func, WASM_TYPE_I32);
   wasm_s16_t block_then = wasmbox_block_add(func);
   wasm_s16_t block_else = wasmbox_block_add(func);
   wasm_s16_t block_cont = wasmbox_block_add(func);
+  // The parameters are moved in each arm, after the branch on `cond`.
+  wasmbox_block_values_t values;
+  wasmbox_function_enter_block(func, &sig, &values);
+  wasmbox_block_t *cont = &func->blocks[block_cont];
+  cont->direction = WASM_JUMP_DIRECTION_HEAD;
+  cont->parent_id = current_block;
+  cont->value = values.results;
+  cont->value_size = values.result_size;
+  cont->value_types = values.result_types;
 
   wasmbox_block_switch(func, block_then);
   wasmbox_block_link_parent(func, current_block);
-  wasm_s16_t block_value = -1;
-  if (blocktype.type == WASMBOX_BLOCK_TYPE_VAL) {
-    block_value = wasmbox_function_push_stack(func);
-  }
+  func->blocks[block_then].label_id = block_cont;
+  wasmbox_function_push_params(func, &values);
+  // The frame size is tracked per arm to find the temporaries of each arm.
+  wasm_u16_t frame_size = func->base.frame_size;
+  func->base.frame_size = func->stack_top;
+  wasm_s32_t then_top = -1;
+  wasm_s16_t then_end = -1;
+  func->label_depth++;
   while (1) {
     wasm_u8_t next = wasmbox_input_stream_peek_u8(ins);
     if (next == 0x05) { // else
       wasmbox_input_stream_read_u8(ins);
-      if (blocktype.type == WASMBOX_BLOCK_TYPE_VAL) {
-        wasmbox_code_add_move(func, wasmbox_function_pop_stack(func),
-                              block_value);
-      }
+      wasmbox_function_leave_block(func, &values);
       wasmbox_code_add_jump(func, OPCODE_JUMP, block_cont,
                             WASM_JUMP_DIRECTION_HEAD);
+      then_end = func->current_block_id;
+      then_top = func->base.frame_size;
+      func->base.frame_size = func->stack_top;
       wasmbox_block_switch(func, block_else);
       wasmbox_block_link_parent(func, current_block);
+      func->blocks[block_else].label_id = block_cont;
+      wasmbox_function_push_params(func, &values);
       continue;
     }
     if (next == 0x0B) { // endif
       wasmbox_input_stream_read_u8(ins);
-      if (blocktype.type == WASMBOX_BLOCK_TYPE_VAL) {
-        wasmbox_code_add_move(func, wasmbox_function_pop_stack(func),
-                              block_value);
-      }
+      wasmbox_function_leave_block(func, &values);
       wasmbox_code_add_jump(func, OPCODE_JUMP, block_cont,
                             WASM_JUMP_DIRECTION_HEAD);
-      wasmbox_block_switch(func, block_cont);
-      wasmbox_block_link_next(func, current_block);
       break;
     }
     if (parse_instruction(ins, mod, func)) {
       return -1;
     }
   }
+  func->label_depth--;
+  if (then_end < 0 && values.param_size != values.result_size) {
+    LOG("if without else must return its parameters");
+    return -1;
+  }
+  // Without an else, the parameters are the results of the if.
+  if (then_end < 0 && values.param_size > 0) {
+    then_end = func->current_block_id;
+    then_top = func->base.frame_size;
+    func->base.frame_size = func->stack_top;
+    wasmbox_block_switch(func, block_else);
+    wasmbox_block_link_parent(func, current_block);
+    wasmbox_function_push_params(func, &values);
+    wasmbox_function_leave_block(func, &values);
+    wasmbox_code_add_jump(func, OPCODE_JUMP, block_cont,
+                          WASM_JUMP_DIRECTION_HEAD);
+  }
+  func->stack_floor = values.stack_floor;
+  wasm_s16_t else_end = func->current_block_id;
+  wasm_s32_t else_top = func->base.frame_size;
+  if (then_top < 0) {
+    then_top = else_top;
+    else_top = 0;
+  }
+  func->base.frame_size = frame_size;
+  wasmbox_function_reserve_frame(func, then_top);
+
+  wasmbox_block_switch(func, current_block);
+  wasm_s16_t block_value = values.results;
+  int lowered = -1;
+  if (values.result_size == 1 && values.param_size == 0 &&
+      then_end == block_then && else_end == block_else &&
+      wasmbox_code_find_last_const(func, cond, 0) == NULL) {
+    lowered = wasmbox_code_add_if_select(func, cond, block_then, block_else,
+                                         block_cont, block_value, then_top);
+  }
+  if (lowered == 0) {
+    // The temporaries of the else arm are moved right above the then arm.
+    wasmbox_function_reserve_frame(func,
+                                   else_top + then_top - (block_value + 1));
+  } else {
+    wasmbox_function_reserve_frame(func, else_top);
+    wasmbox_code_add_branch(func, OPCODE_JUMP_IF, cond, block_then,
+                            WASM_JUMP_DIRECTION_HEAD);
+    wasmbox_code_add_jump(func, OPCODE_JUMP,
+                          then_end >= 0 ? block_else : block_cont,
+                          WASM_JUMP_DIRECTION_HEAD);
+  }
+  wasmbox_block_switch(func, block_cont);
+  wasmbox_block_link_next(func, current_block);
+  wasmbox_block_inherit_label(func, current_block);
   return 0;
 }
 
+// Returns NULL if the label is not defined, which only a function body has.
 static wasmbox_block_t *resolve_target_block(wasmbox_mutable_function_t *func,
                                              wasm_u64_t label) {
-  wasmbox_block_t *block = &func->blocks[func->current_block_id];
+  if (func->base.type == NULL || label > func->label_depth) {
+    LOG("undefined label");
+    return NULL;
+  }
+  wasmbox_block_t *current = &func->blocks[func->current_block_id];
+  wasmbox_block_t *block = &func->blocks[current->label_id];
   for (wasm_u64_t i = 0; i < label; ++i) {
     wasm_u16_t parent = block->parent_id;
-    block = &func->blocks[parent];
+    block = &func->blocks[func->blocks[parent].label_id];
   }
-  assert(block != NULL);
   return block;
 }
 
+// Returns the number of the values a branch to `target` moves.
+static wasm_u16_t wasmbox_block_branch_size(wasmbox_mutable_function_t *func,
+                                            wasm_s16_t target) {
+  if (target == 0) {
+    return func->base.type->return_size;
+  }
+  return func->blocks[target].value_size;
+}
+
+// Returns the types of the values a branch to `target` moves.
+static const wasmbox_value_type_t *
+wasmbox_block_branch_types(wasmbox_mutable_function_t *func,
+                           wasm_s16_t target) {
+  if (target == 0) {
+    return func->base.type->args + func->base.type->argument_size;
+  }
+  return func->blocks[target].value_types;
+}
+
+// Checks the values a branch to `target` moves, like
+// wasmbox_function_check_values.
+static int wasmbox_function_check_branch(wasmbox_mutable_function_t *func,
+                                         wasm_s16_t target) {
+  return wasmbox_function_check_values(
+      func, wasmbox_block_branch_types(func, target),
+      wasmbox_block_branch_size(func, target));
+}
+
+// Moves the values of a branch to the slots of its target and jumps there.
+// The label of the function body is block 0, so a branch to it returns.
+static void wasmbox_code_add_branch_values(wasmbox_mutable_function_t *func,
+                                           wasm_s16_t target) {
+  if (target == 0) {
+    wasm_u16_t size = func->base.type->return_size;
+    wasmbox_code_add_values(func, -size, size);
+    wasmbox_code_add_return(func);
+    return;
+  }
+  wasmbox_block_t *block = &func->blocks[target];
+  wasmbox_code_add_values(func, block->value, block->value_size);
+  wasmbox_code_add_jump(func, OPCODE_JUMP, target, block->direction);
+}
+
+// Returns the block a conditional branch to `target` jumps to: the target
+// itself, or a block moving the values of the branch first when it has any.
+static wasm_s16_t wasmbox_block_add_branch_target(
+    wasmbox_mutable_function_t *func, wasm_s16_t target) {
+  if (target != 0 && func->blocks[target].value_size == 0) {
+    return target;
+  }
+  wasm_s16_t current_block = func->current_block_id;
+  wasm_s16_t block_id = wasmbox_block_add(func);
+  func->blocks[block_id].direction = WASM_JUMP_DIRECTION_HEAD;
+  wasmbox_block_switch(func, block_id);
+  wasmbox_block_link_parent(func, current_block);
+  wasmbox_code_add_branch_values(func, target);
+  wasmbox_block_switch(func, current_block);
+  return block_id;
+}
+
 // INST(0x0C l:labelidx, br l)
 static int decode_br(wasmbox_input_stream_t *ins, wasmbox_module_t *mod,
                      wasmbox_mutable_function_t *func, wasm_u8_t op) {
   wasm_u64_t labelidx = wasmbox_parse_unsigned_leb128(ins->data + ins->index,
                                                       &ins->index, ins->length);
   wasmbox_block_t *block = resolve_target_block(func, labelidx);
-  wasmbox_code_add_jump(func, OPCODE_JUMP, block->id, block->direction);
+  if (block == NULL) {
+    return -1;
+  }
+  wasmbox_function_check_branch(func, block->id);
+  wasmbox_code_add_branch_values(func, block->id);
   return 0;
 }
 
 // INST(0x0D l:labelidx, br_if l)
+// A branch with values jumps to a block moving them, so the values are only
+// moved when it is taken.
 static int decode_br_if(wasmbox_input_stream_t *ins, wasmbox_module_t *mod,
                         wasmbox_mutable_function_t *func, wasm_u8_t op) {
   wasm_u64_t labelidx = wasmbox_parse_unsigned_leb128(ins->data + ins->index,
                                                       &ins->index, ins->length);
   wasmbox_block_t *block = resolve_target_block(func, labelidx);
-  wasmbox_code_add_jump(func, OPCODE_JUMP_IF, block->id, block->direction);
+  if (block == NULL) {
+    return -1;
+  }
+  if (block->id != 0 && block->value_size == 0) {
+    wasmbox_code_add_jump(func, OPCODE_JUMP_IF, block->id, block->direction);
+    return 0;
+  }
+  wasm_s16_t current_block = func->current_block_id;
+  wasm_s16_t cond = wasmbox_function_pop_stack(func, WASM_TYPE_I32);
+  wasmbox_function_check_branch(func, block->id);
+  wasm_s16_t block_taken = wasmbox_block_add_branch_target(func, block->id);
+  wasm_s16_t block_cont = wasmbox_block_add(func);
+  func->blocks[block_cont].direction = WASM_JUMP_DIRECTION_HEAD;
+  func->blocks[block_cont].parent_id = current_block;
+  wasmbox_code_add_branch(func, OPCODE_JUMP_IF, cond, block_taken,
+                          WASM_JUMP_DIRECTION_HEAD);
+  wasmbox_code_add_jump(func, OPCODE_JUMP, block_cont,
+                        WASM_JUMP_DIRECTION_HEAD);
+  wasmbox_block_switch(func, block_cont);
+  wasmbox_block_link_next(func, current_block);
+  wasmbox_block_inherit_label(func, current_block);
   return 0;
 }
 
@@ -770,26 +2797,50 @@ static int decode_br_table(wasmbox_input_stream_t *ins, wasmbox_module_t *mod,
                            wasmbox_mutable_function_t *func, wasm_u8_t op) {
   wasm_u64_t len = wasmbox_parse_unsigned_leb128(ins->data + ins->index,
                                                  &ins->index, ins->length);
-  wasmbox_table_t *table = (wasmbox_table_t *) wasmbox_malloc(
-      sizeof(wasmbox_table_t) + sizeof(wasmbox_code_t *) * len);
+  // Each label takes a byte at least.
+  if (len >= ins->length - ins->index) {
+    LOG("too many labels");
+    return -1;
+  }
+  wasmbox_table_t *table = (wasmbox_table_t *) wasmbox_arena_alloc(
+      func->arena, sizeof(wasmbox_table_t) + sizeof(wasm_u16_t) * len);
   table->size = len;
-  wasmbox_function_add_table(func, table);
+  wasm_u32_t tableidx = wasmbox_function_add_table(func, table);
 
-  for (wasm_u64_t i = 0; i < len; i++) {
+  wasm_s16_t index = wasmbox_function_pop_stack(func, WASM_TYPE_I32);
+  // The targets share the values of the branch, so each distinct target gets
+  // one block moving them.
+  wasm_s16_t *targets = (wasm_s16_t *) wasmbox_arena_alloc(
+      func->arena, sizeof(wasm_s16_t) * (len + 1));
+  wasm_s16_t block_id = -1;
+  for (wasm_u64_t i = 0; i <= len; i++) {
     wasm_u64_t labelidx = wasmbox_parse_unsigned_leb128(
         ins->data + ins->index, &ins->index, ins->length);
-    wasmbox_block_t *block = resolve_target_block(func, labelidx);
-    table->labels[i].block_id = block->id;
+    wasmbox_block_t *target = resolve_target_block(func, labelidx);
+    if (target == NULL) {
+      return -1;
+    }
+    targets[i] = target->id;
+    wasmbox_function_check_branch(func, targets[i]);
+    block_id = -1;
+    for (wasm_u64_t j = 0; j < i && block_id < 0; ++j) {
+      if (targets[j] == targets[i]) {
+        block_id = table->block_ids[j];
+      }
+    }
+    if (block_id < 0) {
+      block_id = wasmbox_block_add_branch_target(func, targets[i]);
+    }
+    if (i < len) {
+      table->block_ids[i] = block_id;
+    }
   }
-  wasm_u64_t default_label = wasmbox_parse_unsigned_leb128(
-      ins->data + ins->index, &ins->index, ins->length);
-  wasmbox_block_t *default_block = resolve_target_block(func, default_label);
 
-  wasmbox_code_t code;
+  wasmbox_code_t code = {};
   code.h.opcode = OPCODE_JUMP_TABLE;
-  code.op0.table = table;
-  code.op1.index = default_block->id;
-  code.op2.reg = wasmbox_function_pop_stack(func);
+  code.op0.index = tableidx;
+  code.op1.index = block_id;
+  code.op2.reg = index;
   wasmbox_code_add(func, &code);
   return 0;
 }
@@ -797,70 +2848,432 @@ static int decode_br_table(wasmbox_input_stream_t *ins, wasmbox_module_t *mod,
 // INST(0x0F, return)
 static int decode_return(wasmbox_input_stream_t *ins, wasmbox_module_t *mod,
                          wasmbox_mutable_function_t *func, wasm_u8_t op) {
-  wasmbox_block_t *block = &func->blocks[func->current_block_id];
-  if (func->base.type->return_size > 0 && block->already_terminated == 0) {
-    wasmbox_code_add_move(func, wasmbox_function_pop_stack(func), -1);
+  if (func->base.type == NULL) {
+    return -1;
   }
+  wasmbox_code_add_results(func);
   wasmbox_code_add_return(func);
   return 0;
 }
 
+// Move the arguments on the top of the operand stack to the argument area of
+// the callee frame. The frame starts right above the live values of the
+// caller and reuses the slots of the arguments themselves.
+// The moves are coalesced with the producers of the arguments by the
+// optimizer, so an argument computed on the stack is written to the callee
+// frame directly.
+// I32_ADD_IMM r4 r2 1    | I32_ADD_IMM r7 r2 1
+// MOVE r7 r4             | STATIC_CALL r4 func0 1
+// STATIC_CALL r4 func0 1 |
+// If `index` is not NULL, the slot of the element index of an indirect call
+// is moved right above the argument area, where no argument move overwrites
+// it, and `index` is updated to the new slot.
 static wasm_u16_t setup_params(wasmbox_mutable_function_t *func,
-                               wasmbox_type_t *type) {
+                               wasmbox_type_t *type, wasm_s16_t *index) {
+  wasm_u16_t size = type->argument_size;
+  if (wasmbox_function_check_values(func, type->args, size) != 0 &&
+      func->stack_size < size) {
+    // Neither unreachable code nor an invalid body emits the moves.
+    size = func->stack_size;
+  }
+  wasm_u16_t first = func->stack_size - size;
+  for (int i = 0; i < size; ++i) {
+    wasmbox_function_pop_stack(func, WASM_TYPE_UNDEFINED);
+  }
   wasm_u16_t stack_top = func->stack_top;
+  if ((wasm_u32_t) stack_top + type->return_size +
+          WASMBOX_FUNCTION_CALL_OFFSET + type->argument_size >=
+      WASM_S16_MAX) {
+    LOG("too many slots");
+    func->invalid = 1;
+  }
   wasm_u16_t argument_to =
       stack_top + type->return_size + WASMBOX_FUNCTION_CALL_OFFSET;
-  for (int i = 0; i < type->argument_size; ++i) {
-    wasmbox_code_add_move(func, wasmbox_function_pop_stack(func),
+  wasm_u16_t argument_end = argument_to + type->argument_size;
+  wasmbox_function_reserve_frame(func, argument_end);
+  if (index != NULL) {
+    wasmbox_function_reserve_frame(func, argument_end + 1);
+    wasmbox_code_add_move(func, *index, argument_end);
+    *index = argument_end;
+  }
+  // The argument area is above every released argument slot. Moving the last
+  // argument first never overwrites an argument which is not moved yet.
+  for (int i = size - 1; i >= 0; --i) {
+    wasmbox_code_add_move(func, func->operand_stack[first + i],
                           argument_to + i);
   }
   return stack_top;
 }
 
-// BLOCK_INST(0x11, x:typeidx 0x00, call_indirect x)
+// Finish the current block with a tail call. The callee takes over the frame
+// of the caller and returns to the caller of the current function, so the
+// results of both functions must match.
+static int wasmbox_code_add_tail_call(wasmbox_mutable_function_t *func,
+                                      wasmbox_code_t *code,
+                                      wasmbox_type_t *type) {
+  wasmbox_type_t *caller = func->base.type;
+  if (caller->return_size != type->return_size ||
+      memcmp(caller->args + caller->argument_size,
+             type->args + type->argument_size,
+             sizeof(*type->args) * type->return_size) != 0) {
+    LOG("Type mismatch of tail call\n");
+    return -1;
+  }
+  wasmbox_code_add(func, code);
+  wasmbox_block_t *block = &func->blocks[func->current_block_id];
+  block->already_terminated = 1;
+  return 0;
+}
+
+// INST(0x10 x:funcidx, call x)
+// INST(0x12 x:funcidx, return_call x)
+static int wasmbox_code_is_inlinable(wasmbox_code_t *code) {
+  switch (code->h.opcode) {
+    case OPCODE_NOP:
+    case OPCODE_MOVE:
+    case OPCODE_SELECT:
+    case OPCODE_GLOBAL_GET:
+    case OPCODE_GLOBAL_SET:
+    case OPCODE_STACK_POINTER_GET:
+    case OPCODE_STACK_POINTER_SET:
+    case OPCODE_STACK_POINTER_ADD:
+#define FUNC(opcode, type, inst, attr, vmopcode) case vmopcode:
+      CONST_OP_EACH(FUNC)
+#undef FUNC
+#define FUNC(opcode, param, type, inst, vmopcode) case vmopcode:
+      NUMERIC_INST_EACH(FUNC)
+#undef FUNC
+#define FUNC(wtype, type, operand, inst, vmopcode) case vmopcode:
+      IMMEDIATE_INST_EACH(FUNC)
+#undef FUNC
+#define FUNC(type, operand, inst, vmopcode) case vmopcode:
+      DIVISION_MAGIC_INST_EACH(FUNC)
+#undef FUNC
+#define FUNC(opcode, out_type, in_type, inst, vmopcode) case vmopcode:
+      MEMORY_INST_EACH(FUNC)
+#undef FUNC
+#define FUNC(inst, mtype, field, unfused, vmopcode) case vmopcode:
+      INDEXED_MEMORY_INST_EACH(FUNC)
+      MEMORY64_INST_EACH(FUNC)
+#undef FUNC
+      return 1;
+    default:
+      return 0;
+  }
+}
+
+// Returns 1 if calls to `callee` should be replaced by its body. Only
+// straight-line leaf functions which are already compiled are inlined, so
+// the callee cannot be recursive.
+static int wasmbox_function_is_inlinable(wasmbox_module_t *mod,
+                                         wasmbox_mutable_function_t *func,
+                                         wasmbox_function_t *callee) {
+#ifdef WASMBOX_PARALLEL_COMPILE_ENABLED
+  // The callee may be compiled by another thread.
+  return 0;
+#endif
+  if (wasmbox_function_is_baseline(func)) {
+    return 0;
+  }
+  wasm_s32_t threshold = mod->inline_threshold;
+  if (threshold == 0) {
+    threshold = WASMBOX_INLINE_THRESHOLD;
+  }
+  // The trailing RETURN is not counted.
+  if (threshold < 0 || callee->code == NULL || callee->code_size == 0 ||
+      callee->code_size > (wasm_u32_t) threshold + 1) {
+    return 0;
+  }
+  if (callee->code[callee->code_size - 1].h.opcode != OPCODE_RETURN) {
+    return 0;
+  }
+  for (wasm_u32_t i = 0; i + 1 < callee->code_size; ++i) {
+    if (!wasmbox_code_is_inlinable(&callee->code[i])) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+// Copies the body of `callee` into the current block in place of a call
+// whose frame starts at `frame`. The slots of the callee are renumbered to
+// the slots of the frame, whose argument area has already been filled.
+//   LOAD_CONST_I32 r2 3   | LOAD_CONST_I32 r2 3
+//   STATIC_CALL r2 f 1    | I32_ADD_IMM r2 r5 1
+// f: I32_ADD_IMM r-1 r2 1 |
+//    RETURN               |
+static void wasmbox_code_add_inline(wasmbox_mutable_function_t *func,
+                                    wasmbox_function_t *callee,
+                                    wasm_s32_t frame) {
+  wasmbox_function_reserve_frame(func, frame + callee->frame_size);
+  for (wasm_u32_t i = 0; i + 1 < callee->code_size; ++i) {
+    wasmbox_code_t *src = &callee->code[i];
+    wasmbox_code_t code = *src;
+    switch (code.h.opcode) {
+      case OPCODE_NOP:
+        continue;
+#define FUNC(opcode, type, inst, attr, vmopcode) case vmopcode:
+        CONST_OP_EACH(FUNC)
+#undef FUNC
+        wasmbox_code_set_value(func, &code.op1, WASMBOX_CODE_VALUE(src, op1));
+        break;
+#define FUNC(wtype, type, operand, inst, vmopcode) case vmopcode:
+        IMMEDIATE_INST_EACH(FUNC)
+#undef FUNC
+#define FUNC(type, operand, inst, vmopcode) case vmopcode:
+        DIVISION_MAGIC_INST_EACH(FUNC)
+#undef FUNC
+        wasmbox_code_set_value(func, &code.op2, WASMBOX_CODE_VALUE(src, op2));
+        break;
+      default:
+        break;
+    }
+    wasmbox_code_relocate_slots(func, &code, -callee->type->return_size,
+                                frame);
+    wasmbox_code_add(func, &code);
+  }
+}
+
+// Calls the function of a linked module which `link` resolves an import to,
+// with the frame at `stack_top`, like STATIC_CALL. The running module is
+// saved to a slot of the function meanwhile.
+//   MODULE_CALL r4 link r3
+//   MODULE_RESTORE r3
+static void wasmbox_code_add_module_call(wasmbox_mutable_function_t *func,
+                                         wasmbox_module_link_t *link,
+                                         wasm_s16_t stack_top) {
+  wasmbox_code_t code = {};
+  code.h.opcode = OPCODE_MODULE_CALL;
+  code.op0.reg = stack_top;
+  wasmbox_value_t v = {};
+  v.u64 = (wasm_u64_t) (uintptr_t) link;
+  wasmbox_code_set_value(func, &code.op1, v);
+  code.op2.reg = func->module_slot;
+  wasmbox_code_add(func, &code);
+  code.h.opcode = OPCODE_MODULE_RESTORE;
+  code.op0.reg = func->module_slot;
+  wasmbox_code_add(func, &code);
+}
+
 static int decode_call(wasmbox_input_stream_t *ins, wasmbox_module_t *mod,
                        wasmbox_mutable_function_t *func, wasm_u8_t op) {
   wasm_u64_t funcidx = wasmbox_parse_unsigned_leb128(ins->data + ins->index,
                                                      &ins->index, ins->length);
-  wasmbox_function_t *call = mod->functions[funcidx];
+  wasmbox_function_t *call =
+      funcidx < mod->function_size ? mod->functions[funcidx] : NULL;
   if (call == NULL) {
     LOG("Failed to find function\n");
     return -1;
   }
-  wasm_u16_t stack_top = setup_params(func, call->type);
-  wasmbox_code_t code;
+  wasm_u16_t stack_top = setup_params(func, call->type, NULL);
+  wasmbox_value_type_t *results = call->type->args + call->type->argument_size;
+  if (op == 0x10 && wasmbox_function_is_inlinable(mod, func, call)) {
+    wasmbox_function_push_values(func, results, call->type->return_size);
+    wasmbox_code_add_inline(func, call, stack_top + call->type->return_size);
+    return 0;
+  }
+  wasmbox_module_link_t *link = ((wasmbox_mutable_function_t *) call)->link;
+  if (op == 0x10 && link != NULL) {
+    wasmbox_function_push_values(func, results, call->type->return_size);
+    wasmbox_code_add_module_call(func, link, stack_top);
+    return 0;
+  }
+  wasmbox_code_t code = {};
   code.h.opcode = OPCODE_STATIC_CALL;
   code.op0.reg = stack_top;
-  for (int i = 0; i < call->type->return_size; ++i) {
-    wasmbox_function_push_stack(func);
-  }
-  code.op1.func = mod->functions[funcidx];
+  wasmbox_code_set_func(func, &code.op1, mod->functions[funcidx]);
   code.op2.index = call->type->return_size;
+  if (op == 0x12) {
+    code.h.opcode = OPCODE_STATIC_TAIL_CALL;
+    return wasmbox_code_add_tail_call(func, &code, call->type);
+  }
+  wasmbox_function_push_values(func, results, call->type->return_size);
   wasmbox_code_add(func, &code);
   return 0;
 }
 
-// INST(0x11 x:tableidx, y:typeidx call_indirect x)
+#ifdef WASMBOX_VM_USE_LAZY_COMPILE
+static wasm_s32_t wasmbox_module_speculation_threshold(wasmbox_module_t *mod) {
+  wasm_s32_t threshold = mod->speculation_threshold;
+  return threshold == 0 ? WASMBOX_SPECULATION_THRESHOLD : threshold;
+}
+
+// Returns 1 if the indirect call site `cache` has called one callee at least
+// `threshold` times in a row.
+static int wasmbox_call_cache_is_stable(wasmbox_call_cache_t *cache,
+                                        wasm_s32_t threshold) {
+  return __atomic_load_n(&cache->hits, __ATOMIC_RELAXED) >=
+             (wasm_u32_t) threshold &&
+         __atomic_load_n(&cache->target, __ATOMIC_RELAXED) != 0;
+}
+
+// Profiles the indirect call site `cache` of a function compiled from the
+// module source, unless the function has been recompiled already.
+static void wasmbox_call_cache_profile(wasmbox_module_t *mod,
+                                       wasmbox_mutable_function_t *func,
+                                       wasmbox_call_cache_t *cache,
+                                       wasm_u32_t site) {
+  if (func->origin != NULL && !func->origin->speculated &&
+      wasmbox_module_speculation_threshold(mod) >= 0) {
+    cache->caller = &func->origin->base;
+    cache->site = site;
+  }
+}
+
+// Returns the callee which the site at `site` is speculated to call while
+// its function is recompiled, or NULL.
+static wasmbox_function_t *
+wasmbox_function_speculated_callee(wasmbox_mutable_function_t *func,
+                                   wasm_u32_t site) {
+  for (wasm_u32_t i = 0; i < func->speculation_size; i++) {
+    wasmbox_call_cache_t *cache = func->speculations[i];
+    if (cache->site == site) {
+      return (wasmbox_function_t *) (uintptr_t) __atomic_load_n(
+          &cache->target, __ATOMIC_RELAXED);
+    }
+  }
+  return NULL;
+}
+
+// Replaces an indirect call by a direct call to `callee`, or by its body if
+// it is small, guarded by a check that the table entry still holds it. The
+// guard reads the entry with table.get, which traps on an index out of
+// bounds as the call would.
+//   MOVE r4 r1             | MOVE r4 r1
+//   DYNAMIC_CALL r2 c r4   | TABLE_GET r5 r4 t0
+//                          | LOAD_CONST_I64 r6 callee
+//                          | JUMP_IF_I64_EQ fast r5 r6
+//                          | DYNAMIC_CALL r2 c r4
+//                          | JUMP cont
+//                          | fast:
+//                          | STATIC_CALL r2 callee 1
+//                          | cont:
+static void wasmbox_code_add_guarded_call(wasmbox_module_t *mod,
+                                          wasmbox_mutable_function_t *func,
+                                          wasmbox_code_t *call,
+                                          wasmbox_function_t *callee,
+                                          wasm_u32_t tableidx) {
+  // The element index is right above the argument area (see setup_params).
+  wasm_s16_t index = call->op2.reg;
+  wasm_s16_t stack_top = call->op0.reg;
+  wasmbox_function_reserve_frame(func, index + 3);
+  wasmbox_code_t code = {};
+  code.h.opcode = OPCODE_TABLE_GET;
+  code.op0.reg = index + 1;
+  code.op1.reg = index;
+  code.op2.index = tableidx;
+  wasmbox_code_add(func, &code);
+  wasmbox_value_t expected = {};
+  expected.u64 = (wasm_u64_t) (uintptr_t) callee;
+  code.h.opcode = OPCODE_LOAD_CONST_I64;
+  code.op0.reg = index + 2;
+  wasmbox_code_set_value(func, &code.op1, expected);
+  wasmbox_code_add(func, &code);
+  code.h.opcode = OPCODE_I64_EQ;
+  code.op0.reg = index + 1;
+  code.op1.reg = index + 1;
+  code.op2.reg = index + 2;
+  wasmbox_code_add(func, &code);
+
+  wasm_s16_t current_block = func->current_block_id;
+  wasm_s16_t block_fast = wasmbox_block_add(func);
+  wasm_s16_t block_cont = wasmbox_block_add(func);
+  func->blocks[block_fast].direction = WASM_JUMP_DIRECTION_HEAD;
+  func->blocks[block_cont].direction = WASM_JUMP_DIRECTION_HEAD;
+  func->blocks[block_cont].parent_id = current_block;
+  wasmbox_code_add_branch(func, OPCODE_JUMP_IF, index + 1, block_fast,
+                          WASM_JUMP_DIRECTION_HEAD);
+  wasmbox_code_add(func, call);
+  wasmbox_code_add_jump(func, OPCODE_JUMP, block_cont,
+                        WASM_JUMP_DIRECTION_HEAD);
+
+  wasmbox_block_switch(func, block_fast);
+  wasmbox_block_link_parent(func, current_block);
+  if (wasmbox_function_is_inlinable(mod, func, callee)) {
+    wasmbox_code_add_inline(func, callee,
+                            stack_top + callee->type->return_size);
+  } else {
+    code.h.opcode = OPCODE_STATIC_CALL;
+    code.op0.reg = stack_top;
+    wasmbox_code_set_func(func, &code.op1, callee);
+    code.op2.index = callee->type->return_size;
+    wasmbox_code_add(func, &code);
+  }
+  wasmbox_code_add_jump(func, OPCODE_JUMP, block_cont,
+                        WASM_JUMP_DIRECTION_HEAD);
+  wasmbox_block_switch(func, block_cont);
+  wasmbox_block_link_next(func, current_block);
+  wasmbox_block_inherit_label(func, current_block);
+}
+#endif /* WASMBOX_VM_USE_LAZY_COMPILE */
+
+// INST(0x11 y:typeidx x:tableidx, call_indirect x y)
+// INST(0x13 y:typeidx x:tableidx, return_call_indirect x y)
 static int decode_call_indirect(wasmbox_input_stream_t *ins,
                                 wasmbox_module_t *mod,
                                 wasmbox_mutable_function_t *func,
                                 wasm_u8_t op) {
+  wasm_u32_t site = (wasm_u32_t) ins->index;
   wasm_u64_t typeidx = wasmbox_parse_unsigned_leb128(ins->data + ins->index,
                                                      &ins->index, ins->length);
   wasm_u64_t tableidx = wasmbox_parse_unsigned_leb128(ins->data + ins->index,
                                                       &ins->index, ins->length);
+  if (typeidx >= mod->type_size || tableidx >= mod->table_size) {
+    LOG("undefined type or table");
+    return -1;
+  }
+  if (mod->tables[tableidx].type != WASM_TYPE_FUNCREF) {
+    LOG("call_indirect through a table of externrefs");
+    return -1;
+  }
   wasmbox_type_t *type = mod->types[typeidx];
-  wasm_u16_t stack_top = setup_params(func, type);
+  wasm_s16_t index = wasmbox_function_pop_stack(func, WASM_TYPE_I32);
+  wasm_u16_t stack_top = setup_params(func, type, &index);
 
-  wasmbox_code_t code;
+#ifdef WASMBOX_VM_USE_LAZY_COMPILE
+  // The code decoded to validate a body is dropped, so is its call site.
+  wasmbox_call_cache_t *cache =
+      func->validating ? NULL
+                       : wasmbox_module_add_call_cache(mod, type, tableidx);
+#else
+  wasmbox_call_cache_t *cache =
+      wasmbox_module_add_call_cache(mod, type, tableidx);
+#endif
+  wasmbox_code_t code = {};
   code.h.opcode = OPCODE_DYNAMIC_CALL;
   code.op0.reg = stack_top;
-  for (int i = 0; i < type->return_size; ++i) {
-    wasmbox_function_push_stack(func);
+  wasmbox_code_set_cache(func, &code.op1, cache);
+  code.op2.reg = index;
+  if (op == 0x13) {
+    code.h.opcode = OPCODE_DYNAMIC_TAIL_CALL;
+    return wasmbox_code_add_tail_call(func, &code, type);
+  }
+#ifdef WASMBOX_VM_USE_LAZY_COMPILE
+  wasmbox_function_t *callee = wasmbox_function_speculated_callee(func, site);
+#  ifdef WASMBOX_VM_USE_COMPACT_CODE
+  // Compact code calls a function by its index, so a function of another
+  // module is not called directly.
+  if (callee != NULL) {
+    wasm_u32_t index = ((wasmbox_mutable_function_t *) callee)->index;
+    if (index >= mod->function_size || mod->functions[index] != callee) {
+      callee = NULL;
+    }
+  }
+#  endif
+  if (callee != NULL) {
+    wasmbox_code_add_guarded_call(mod, func, &code, callee, tableidx);
+  } else {
+    if (cache != NULL) {
+      wasmbox_call_cache_profile(mod, func, cache, site);
+    }
+    wasmbox_code_add(func, &code);
   }
-  code.op1.index = tableidx;
-  code.op2.index = type->return_size;
+#else
+  (void) site;
   wasmbox_code_add(func, &code);
+#endif
+  wasmbox_function_push_values(func, type->args + type->argument_size,
+                               type->return_size);
   return 0;
 }
 
@@ -870,25 +3283,66 @@ static int decode_variable_inst(wasmbox_input_stream_t *ins,
                                 wasm_u8_t op) {
   wasm_u64_t idx = wasmbox_parse_unsigned_leb128(ins->data + ins->index,
                                                  &ins->index, ins->length);
-  wasm_s16_t reg;
+  if (op <= 0x22 ? idx >= func->local_size : idx >= mod->global_size) {
+    LOG("undefined local or global");
+    return -1;
+  }
+  wasm_s16_t reg;
+  wasm_s32_t slot = WASMBOX_FUNCTION_CALL_OFFSET + idx;
+  if (op <= 0x22 && func->local_slots != NULL) {
+    slot = WASMBOX_FUNCTION_CALL_OFFSET + func->local_slots[idx];
+    if (func->local_slots[idx + 1] - func->local_slots[idx] == 2) {
+      // v128 local: a move per half.
+      switch (op) {
+        case 0x20: // local.get
+          reg = wasmbox_function_push_v128(func);
+          break;
+        case 0x21: // local.set
+          reg = wasmbox_function_pop_v128(func);
+          break;
+        default: // local.tee
+          if (wasmbox_function_check_values(
+                  func, wasmbox_value_slots + WASM_TYPE_V128, 2) != 0) {
+            return func->invalid ? -1 : 0;
+          }
+          reg = func->operand_stack[func->stack_size - 2];
+          break;
+      }
+      wasm_s32_t from = op == 0x20 ? slot : reg;
+      wasm_s32_t to = op == 0x20 ? reg : slot;
+      wasmbox_code_add_move(func, from, to);
+      wasmbox_code_add_move(func, from + 1, to + 1);
+      return 0;
+    }
+  }
+  wasmbox_value_type_t type =
+      op <= 0x22 ? (wasmbox_value_type_t) func->local_types[idx]
+                 : WASM_TYPE_UNDEFINED;
   switch (op) {
     case 0x20: // local.get
-      wasmbox_code_add_move(func, WASMBOX_FUNCTION_CALL_OFFSET + idx,
-                            wasmbox_function_push_stack(func));
+      wasmbox_code_add_move(func, slot,
+                            wasmbox_function_push_stack(func, type));
       return 0;
     case 0x21: // local.set
-      wasmbox_code_add_move(func, wasmbox_function_pop_stack(func),
-                            WASMBOX_FUNCTION_CALL_OFFSET + idx);
+      wasmbox_code_add_move(func, wasmbox_function_pop_stack(func, type),
+                            slot);
       return 0;
     case 0x22: // local.tee
-      wasmbox_code_add_move(func, wasmbox_function_peek_stack(func),
-                            WASMBOX_FUNCTION_CALL_OFFSET + idx);
+      if (wasmbox_function_check_values(func, &type, 1) != 0 &&
+          func->invalid) {
+        return -1;
+      }
+      wasmbox_code_add_move(func, wasmbox_function_peek_stack(func), slot);
       return 0;
     case 0x23: // global.get
-      wasmbox_code_add_global(func, OPCODE_GLOBAL_GET, idx);
+      wasmbox_code_add_global_get(mod, func, idx);
       return 0;
     case 0x24: // global.set
-      wasmbox_code_add_global(func, OPCODE_GLOBAL_SET, idx);
+      if (mod->global_constants[idx] != 0) {
+        LOG("immutable global");
+        return -1;
+      }
+      wasmbox_code_add_global_set(mod, func, idx);
       return 0;
     default:
       return -1;
@@ -896,25 +3350,128 @@ static int decode_variable_inst(wasmbox_input_stream_t *ins,
   return -1;
 }
 
+// table.get and table.set, and table.grow and table.size after 0xFC. The
+// table index is kept in op2.
 static int decode_table_inst(wasmbox_input_stream_t *ins, wasmbox_module_t *mod,
                              wasmbox_mutable_function_t *func, wasm_u8_t op) {
   wasm_u32_t tableidx = wasmbox_parse_unsigned_leb128(ins->data + ins->index,
                                                       &ins->index, ins->length);
+  if (tableidx >= mod->table_size) {
+    LOG("undefined table");
+    return -1;
+  }
+  // The references are of the element type of the table.
+  wasmbox_value_type_t type = mod->tables[tableidx].type;
+  wasmbox_code_t code = {};
+  code.op2.index = tableidx;
   switch (op) {
     case 0x25: // table.get x
+      code.h.opcode = OPCODE_TABLE_GET;
+      code.op1.reg = wasmbox_function_pop_stack(func, WASM_TYPE_I32);
+      code.op0.reg = wasmbox_function_push_stack(func, type);
       break;
     case 0x26: // table.set x
+      code.h.opcode = OPCODE_TABLE_SET;
+      code.op1.reg = wasmbox_function_pop_stack(func, type);
+      code.op0.reg = wasmbox_function_pop_stack(func, WASM_TYPE_I32);
+      break;
+    case 0x0F: // table.grow x
+      code.h.opcode = OPCODE_TABLE_GROW;
+      code.op1.r.reg2 = wasmbox_function_pop_stack(func, WASM_TYPE_I32);
+      code.op1.r.reg1 = wasmbox_function_pop_stack(func, type);
+      code.op0.reg = wasmbox_function_push_stack(func, WASM_TYPE_I32);
       break;
+    case 0x10: // table.size x
+      code.h.opcode = OPCODE_TABLE_SIZE;
+      code.op0.reg = wasmbox_function_push_stack(func, WASM_TYPE_I32);
+      break;
+    default:
+      return -1;
   }
-  return -1;
+  wasmbox_code_add(func, &code);
+  return 0;
+}
+
+// A null reference is 0 and a funcref is the wasmbox_function_t*.
+static int decode_reference_inst(wasmbox_input_stream_t *ins,
+                                 wasmbox_module_t *mod,
+                                 wasmbox_mutable_function_t *func,
+                                 wasm_u8_t op) {
+  wasmbox_value_type_t type;
+  wasmbox_value_t v = {};
+  wasmbox_code_t code = {};
+  switch (op) {
+    case 0xD0: // ref.null t
+      if (parse_value_type(ins, &type) != 0) {
+        return -1;
+      }
+      if (!wasmbox_value_type_is_reference(type)) {
+        LOG("ref.null of a non-reference type");
+        return -1;
+      }
+      v.u64 = 0;
+      wasmbox_code_add_const(func, OPCODE_LOAD_CONST_I64, type, v);
+      return 0;
+    case 0xD1: // ref.is_null
+      type = wasmbox_function_top_type(func);
+      if (!wasmbox_value_type_is_reference(type)) {
+        // Let the pop report the mismatch.
+        type = WASM_TYPE_FUNCREF;
+      }
+      return wasmbox_code_add_unary_op(func, OPCODE_I64_EQZ, type,
+                                       WASM_TYPE_I32);
+    case 0xD2: { // ref.func x
+      wasm_u64_t funcidx = wasmbox_parse_unsigned_leb128(
+          ins->data + ins->index, &ins->index, ins->length);
+      if (funcidx >= mod->function_size) {
+        LOG("undefined function");
+        return -1;
+      }
+      code.h.opcode = OPCODE_REF_FUNC;
+      code.op0.reg = wasmbox_function_push_stack(func, WASM_TYPE_FUNCREF);
+      wasmbox_code_set_func(func, &code.op1, mod->functions[funcidx]);
+      wasmbox_code_add(func, &code);
+      return 0;
+    }
+    default:
+      return -1;
+  }
+}
+
+// Memory instructions are only valid in a module with a memory.
+static int wasmbox_module_check_memory(wasmbox_module_t *mod) {
+  if (mod->memory_block == NULL) {
+    LOG("undefined memory");
+    return -1;
+  }
+  return 0;
+}
+
+// Atomic and SIMD accesses take 32-bit addresses only.
+static int wasmbox_module_check_memory32(wasmbox_module_t *mod) {
+  if (wasmbox_module_check_memory(mod) != 0) {
+    return -1;
+  }
+  if (mod->memory64) {
+    LOG("instruction is not supported on memory64");
+    return -1;
+  }
+  return 0;
 }
 
 static int parse_memarg(wasmbox_input_stream_t *ins, wasm_u32_t *align,
                         wasm_u32_t *offset) {
   *align = wasmbox_parse_unsigned_leb128(ins->data + ins->index, &ins->index,
                                          ins->length);
-  *offset = wasmbox_parse_unsigned_leb128(ins->data + ins->index, &ins->index,
-                                          ins->length);
+  wasm_u64_t value = wasmbox_parse_unsigned_leb128(
+      ins->data + ins->index, &ins->index, ins->length);
+  // Only a memory64 could take a larger offset, which the code has no room
+  // for.
+  if (value > WASM_U32_MAX) {
+    LOG("offset is too large");
+    return -1;
+  }
+  *offset = (wasm_u32_t) value;
   return 0;
 }
 
@@ -923,14 +3480,16 @@ static int decode_memory_inst(wasmbox_input_stream_t *ins,
                               wasmbox_mutable_function_t *func, wasm_u8_t op) {
   wasm_u32_t align;
   wasm_u32_t offset;
-  if (parse_memarg(ins, &align, &offset)) {
+  if (wasmbox_module_check_memory(mod) || parse_memarg(ins, &align, &offset)) {
     return -1;
   }
   switch (op) {
-#define FUNC(opcode, out_type, in_type, inst, vmopcode) \
-  case (opcode): {                                      \
-    wasmbox_code_add_##inst(func, vmopcode, offset);    \
-    break;                                              \
+#define FUNC(opcode, out_type, in_type, inst, vmopcode)                    \
+  case (opcode): {                                                         \
+    wasmbox_code_add_##inst(                                               \
+        func, mod->memory64 ? wasmbox_memory64_opcode(vmopcode) : vmopcode, \
+        offset, WASMBOX_VALUE_TYPE_##out_type);                            \
+    break;                                                                 \
   }
     MEMORY_INST_EACH(FUNC)
 #undef FUNC
@@ -944,22 +3503,25 @@ static int decode_memory_size_and_grow(wasmbox_input_stream_t *ins,
                                        wasmbox_module_t *mod,
                                        wasmbox_mutable_function_t *func,
                                        wasm_u8_t op) {
-  if (wasmbox_input_stream_read_u8(ins) != 0x00) {
+  if (wasmbox_module_check_memory(mod) ||
+      wasmbox_input_stream_read_u8(ins) != 0x00) {
     return -1;
   }
-  wasmbox_code_t code;
+  wasmbox_code_t code = {};
   switch (op) {
     case 0x3F: // memory.size
       code.h.opcode = OPCODE_MEMORY_SIZE;
       break;
     case 0x40: // memory.grow
-      code.h.opcode = OPCODE_MEMORY_SIZE;
-      code.op1.reg = wasmbox_function_pop_stack(func);
+      code.h.opcode = OPCODE_MEMORY_GROW;
+      code.op1.reg =
+          wasmbox_function_pop_stack(func, wasmbox_module_address_type(mod));
       break;
     default:
       return -1;
   }
-  code.op0.reg = wasmbox_function_push_stack(func);
+  code.op0.reg =
+      wasmbox_function_push_stack(func, wasmbox_module_address_type(mod));
   wasmbox_code_add(func, &code);
   return 0;
 }
@@ -989,13 +3551,13 @@ static int decode_constant_inst(wasmbox_input_stream_t *ins,
                                 wasmbox_module_t *mod,
                                 wasmbox_mutable_function_t *func,
                                 wasm_u8_t op) {
-  wasmbox_value_t v;
+  wasmbox_value_t v = {};
   switch (op) {
-#define FUNC(opcode, type, inst, attr, vmopcode) \
-  case (opcode): {                               \
-    parse_##inst(ins, &v);                       \
-    wasmbox_code_add_const(func, vmopcode, v);   \
-    return 0;                                    \
+#define FUNC(opcode, type, inst, attr, vmopcode)                          \
+  case (opcode): {                                                        \
+    parse_##inst(ins, &v);                                                \
+    wasmbox_code_add_const(func, vmopcode, WASMBOX_VALUE_TYPE_##type, v); \
+    return 0;                                                             \
   }
     CONST_OP_EACH(FUNC)
 #undef FUNC
@@ -1005,9 +3567,88 @@ static int decode_constant_inst(wasmbox_input_stream_t *ins,
   return -1;
 }
 
+// select pops (lhs, rhs, cond) of `type`, or of the type of the operands if
+// it is WASM_TYPE_UNDEFINED. A v128 is selected by a SELECT per half.
+static int wasmbox_code_add_select(wasmbox_mutable_function_t *func,
+                                   wasmbox_value_type_t type) {
+  wasmbox_code_t code = {};
+  code.h.opcode = OPCODE_SELECT;
+  code.op1.reg = wasmbox_function_pop_stack(func, WASM_TYPE_I32);
+  if (type == WASM_TYPE_UNDEFINED) {
+    type = wasmbox_function_top_type(func);
+    if (wasmbox_value_type_is_reference(type)) {
+      LOG("select of references without their type");
+      return -1;
+    }
+  }
+  if (type == WASM_TYPE_V128) {
+    code.op2.r.reg2 = wasmbox_function_pop_v128(func);
+    code.op2.r.reg1 = wasmbox_function_pop_v128(func);
+    code.op0.reg = wasmbox_function_push_v128(func);
+    wasmbox_code_add(func, &code);
+    code.op0.reg++;
+    code.op2.r.reg1++;
+    code.op2.r.reg2++;
+    wasmbox_code_add(func, &code);
+    return 0;
+  }
+  code.op2.r.reg2 = wasmbox_function_pop_stack(func, type);
+  code.op2.r.reg1 = wasmbox_function_pop_stack(func, type);
+  code.op0.reg = wasmbox_function_push_stack(func, type);
+  wasmbox_value_t cond = {};
+  if (wasmbox_code_take_last_const(func, code.op1.reg, &cond) == 0) {
+    // Only the selected operand is kept.
+    // LOAD_CONST_I32 r0 10 | LOAD_CONST_I32 r0 10
+    // LOAD_CONST_I32 r1 20 |
+    // LOAD_CONST_I32 r2 1  |
+    // SELECT r0 r2 r0 r1   |
+    wasm_s16_t selected = code.op2.r.reg2;
+    if (cond.u32 != 0) {
+      selected = code.op2.r.reg1;
+      if (wasmbox_code_find_last_const(func, code.op2.r.reg2, 0)) {
+        wasmbox_code_remove_last(func, 1);
+      }
+    }
+    if (selected != code.op0.reg) {
+      wasmbox_code_add_move(func, selected, code.op0.reg);
+    }
+    return 0;
+  }
+  wasmbox_code_add(func, &code);
+  return 0;
+}
+
+// Returns the type of the operands of the numeric instruction `op`, which
+// NUMERIC_INST_EACH only tells for the comparisons and basic operators.
+static wasmbox_value_type_t wasmbox_numeric_operand_type(wasm_u8_t op) {
+  static const wasm_u8_t conversions[] = {
+      WASM_TYPE_I64, WASM_TYPE_F32, WASM_TYPE_F32, WASM_TYPE_F64,
+      WASM_TYPE_F64, WASM_TYPE_I32, WASM_TYPE_I32, WASM_TYPE_F32,
+      WASM_TYPE_F32, WASM_TYPE_F64, WASM_TYPE_F64, WASM_TYPE_I32,
+      WASM_TYPE_I32, WASM_TYPE_I64, WASM_TYPE_I64, WASM_TYPE_F64,
+      WASM_TYPE_I32, WASM_TYPE_I32, WASM_TYPE_I64, WASM_TYPE_I64,
+      WASM_TYPE_F32, WASM_TYPE_F32, WASM_TYPE_F64, WASM_TYPE_I32,
+      WASM_TYPE_I64, WASM_TYPE_I32, WASM_TYPE_I32, WASM_TYPE_I64,
+      WASM_TYPE_I64, WASM_TYPE_I64,
+  };
+  if (op >= 0xA7) { // wrap_i64 .. i64.extend32_s
+    return (wasmbox_value_type_t) conversions[op - 0xA7];
+  }
+  if (op <= 0x4F || (op >= 0x67 && op <= 0x78)) {
+    return WASM_TYPE_I32;
+  }
+  if (op <= 0x5A || (op >= 0x79 && op <= 0x8A)) {
+    return WASM_TYPE_I64;
+  }
+  if (op <= 0x60 || (op >= 0x8B && op <= 0x98)) {
+    return WASM_TYPE_F32;
+  }
+  return WASM_TYPE_F64;
+}
+
 static int decode_op0_inst(wasmbox_input_stream_t *ins, wasmbox_module_t *mod,
                            wasmbox_mutable_function_t *func, wasm_u8_t op) {
-  wasmbox_code_t code;
+  wasmbox_code_t code = {};
   switch (op) {
     case 0x00: // unreachable
       code.h.opcode = OPCODE_UNREACHABLE;
@@ -1018,21 +3659,31 @@ static int decode_op0_inst(wasmbox_input_stream_t *ins, wasmbox_module_t *mod,
     case 0x01: // nop
       return 0;
     case 0x1A: // drop
-      // Just pop single operand without emitting code.
-      wasmbox_function_pop_stack(func);
+      // Just pop the operand without emitting code.
+      if (wasmbox_function_top_is_v128(func)) {
+        wasmbox_function_pop_v128(func);
+      } else {
+        wasmbox_function_pop_stack(func, WASM_TYPE_UNDEFINED);
+      }
       return 0;
     case 0x1B: // select
-      code.h.opcode = OPCODE_SELECT;
-      code.op1.reg = wasmbox_function_pop_stack(func);
-      code.op2.r.reg2 = wasmbox_function_pop_stack(func);
-      code.op2.r.reg1 = wasmbox_function_pop_stack(func);
-      code.op0.reg = wasmbox_function_push_stack(func);
-      wasmbox_code_add(func, &code);
-      return 0;
+      return wasmbox_code_add_select(func, WASM_TYPE_UNDEFINED);
+    case 0x1C: { // select t*
+      wasm_u64_t len = wasmbox_parse_unsigned_leb128(
+          ins->data + ins->index, &ins->index, ins->length);
+      wasmbox_value_type_t type;
+      if (len != 1 || parse_value_type(ins, &type) != 0) {
+        LOG("select must have a single type");
+        return -1;
+      }
+      return wasmbox_code_add_select(func, type);
+    }
 
-#define FUNC(op, param, type, inst, vmopcode) \
-  case (op):                                  \
-    return wasmbox_code_add_##param##_op(func, vmopcode);
+#define FUNC(op, param, type, inst, vmopcode)             \
+  case (op):                                              \
+    return wasmbox_code_add_##param##_op(                 \
+        func, vmopcode, wasmbox_numeric_operand_type(op), \
+        (op) <= 0x66 ? WASM_TYPE_I32 : WASMBOX_VALUE_TYPE_##type);
       NUMERIC_INST_EACH(FUNC)
 #undef FUNC
     default:
@@ -1041,25 +3692,366 @@ static int decode_op0_inst(wasmbox_input_stream_t *ins, wasmbox_module_t *mod,
   return -1;
 }
 
+// memory.init, memory.copy and memory.fill pop (dst, src or value, size).
+// memory.init keeps the data index in op0 and its operands in op1 and op2.
+static int decode_bulk_memory_inst(wasmbox_input_stream_t *ins,
+                                   wasmbox_module_t *mod,
+                                   wasmbox_mutable_function_t *func,
+                                   wasm_u8_t op) {
+  wasmbox_code_t code = {};
+  wasm_u32_t index = 0;
+  if (op == 0x08 || op == 0x09) {
+    index = wasmbox_parse_unsigned_leb128(ins->data + ins->index, &ins->index,
+                                          ins->length);
+    if (index >= mod->data_segment_size) {
+      LOG("undefined data segment");
+      return -1;
+    }
+  }
+  // Memory indices, which must be 0 until multiple memories are supported.
+  wasm_u32_t memories = op == 0x09 ? 0 : op == 0x0A ? 2 : 1;
+  if (memories > 0 && wasmbox_module_check_memory(mod)) {
+    return -1;
+  }
+  for (wasm_u32_t i = 0; i < memories; i++) {
+    if (wasmbox_input_stream_read_u8(ins) != 0x00) {
+      return -1;
+    }
+  }
+  switch (op) {
+    case 0x08:
+      code.h.opcode = OPCODE_MEMORY_INIT;
+      code.op0.index = index;
+      code.op2.reg = wasmbox_function_pop_stack(func, WASM_TYPE_I32);
+      code.op1.r.reg2 = wasmbox_function_pop_stack(func, WASM_TYPE_I32);
+      code.op1.r.reg1 =
+          wasmbox_function_pop_stack(func, wasmbox_module_address_type(mod));
+      break;
+    case 0x09:
+      code.h.opcode = OPCODE_DATA_DROP;
+      code.op0.index = index;
+      break;
+    default:
+      code.h.opcode = op == 0x0A ? OPCODE_MEMORY_COPY : OPCODE_MEMORY_FILL;
+      code.op2.reg =
+          wasmbox_function_pop_stack(func, wasmbox_module_address_type(mod));
+      code.op1.reg = wasmbox_function_pop_stack(
+          func, op == 0x0A ? wasmbox_module_address_type(mod) : WASM_TYPE_I32);
+      code.op0.reg =
+          wasmbox_function_pop_stack(func, wasmbox_module_address_type(mod));
+      break;
+  }
+  wasmbox_code_add(func, &code);
+  return 0;
+}
+
 static int decode_truncation_inst(wasmbox_input_stream_t *ins,
                                   wasmbox_module_t *mod,
                                   wasmbox_mutable_function_t *func,
                                   wasm_u8_t op) {
   wasm_u8_t op1 = wasmbox_input_stream_read_u8(ins);
   switch (op1) {
-#define FUNC(opcode0, opcode1, type, inst, vmopcode) \
-  case opcode1: {                                    \
-    fprintf(stdout, "" #type "." #inst "\n");        \
-    return 0;                                        \
-  }
+#define FUNC(opcode0, opcode1, type, inst, vmopcode)                   \
+  case opcode1:                                                        \
+    return wasmbox_code_add_unary_op(                                  \
+        func, vmopcode, (opcode1) & 2 ? WASM_TYPE_F64 : WASM_TYPE_F32, \
+        WASMBOX_VALUE_TYPE_##type);
     SATURATING_TRUNCATION_INST_EACH(FUNC)
 #undef FUNC
+    case 0x08: // memory.init x:dataidx
+    case 0x09: // data.drop x:dataidx
+    case 0x0A: // memory.copy
+    case 0x0B: // memory.fill
+      return decode_bulk_memory_inst(ins, mod, func, op1);
+    case 0x0F: // table.grow x
+    case 0x10: // table.size x
+      return decode_table_inst(ins, mod, func, op1);
     default:
       return -1;
   }
   return -1;
 }
 
+static int decode_atomic_inst(wasmbox_input_stream_t *ins,
+                              wasmbox_module_t *mod,
+                              wasmbox_mutable_function_t *func, wasm_u8_t op) {
+  wasm_u8_t op1 = wasmbox_input_stream_read_u8(ins);
+  wasm_u32_t align;
+  wasm_u32_t offset;
+  if (op1 == 0x03) { // atomic.fence
+    if (wasmbox_input_stream_read_u8(ins) != 0x00) {
+      return -1;
+    }
+    wasmbox_code_t code = {};
+    code.h.opcode = OPCODE_ATOMIC_FENCE;
+    wasmbox_code_add(func, &code);
+    return 0;
+  }
+  if (wasmbox_module_check_memory32(mod) ||
+      parse_memarg(ins, &align, &offset)) {
+    return -1;
+  }
+  switch (op1) {
+#define FUNC(opcode, type, mtype, operands, vmopcode)       \
+  case (opcode): {                                          \
+    wasmbox_code_add_##operands(func, vmopcode, offset,     \
+                                WASMBOX_VALUE_TYPE_##type); \
+    return 0;                                               \
+  }
+    ATOMIC_INST_EACH(FUNC)
+#undef FUNC
+    default:
+      return -1;
+  }
+}
+
+// SIMD instructions. v128 operands are popped and pushed as pairs of slots
+// and the instructions refer to the slot of the low half.
+static wasm_s16_t wasmbox_code_add_v128_const(wasmbox_mutable_function_t *func,
+                                              wasmbox_input_stream_t *ins) {
+  wasmbox_value_t lo = {};
+  wasmbox_value_t hi = {};
+  if (ins->index + 16 > ins->length) {
+    return -1;
+  }
+  memcpy(&lo.u64, ins->data + ins->index, sizeof(lo.u64));
+  memcpy(&hi.u64, ins->data + ins->index + 8, sizeof(hi.u64));
+  ins->index += 16;
+  wasmbox_code_add_const(func, OPCODE_LOAD_CONST_I64, WASM_TYPE_V128, lo);
+  wasmbox_code_add_const(func, OPCODE_LOAD_CONST_I64, WASM_TYPE_V128, hi);
+  return func->operand_stack[func->stack_size - 2];
+}
+
+static int wasmbox_code_add_simd_load(wasmbox_input_stream_t *ins,
+                                      wasmbox_mutable_function_t *func,
+                                      int vmopcode) {
+  wasm_u32_t align;
+  wasm_u32_t offset;
+  if (parse_memarg(ins, &align, &offset)) {
+    return -1;
+  }
+  wasmbox_code_t code = {};
+  code.h.opcode = vmopcode;
+  code.op1.reg = wasmbox_function_pop_stack(func, WASM_TYPE_I32);
+  code.op0.reg = wasmbox_function_push_v128(func);
+  code.op2.index = offset;
+  wasmbox_code_add(func, &code);
+  return 0;
+}
+
+static int wasmbox_code_add_simd_store(wasmbox_input_stream_t *ins,
+                                       wasmbox_mutable_function_t *func,
+                                       int vmopcode) {
+  wasm_u32_t align;
+  wasm_u32_t offset;
+  if (parse_memarg(ins, &align, &offset)) {
+    return -1;
+  }
+  wasmbox_code_t code = {};
+  code.h.opcode = vmopcode;
+  code.op1.reg = wasmbox_function_pop_v128(func);
+  code.op0.reg = wasmbox_function_pop_stack(func, WASM_TYPE_I32);
+  code.op2.index = offset;
+  wasmbox_code_add(func, &code);
+  return 0;
+}
+
+// The lane indices are loaded as a v128 constant above both operands.
+static int wasmbox_code_add_simd_shuffle(wasmbox_input_stream_t *ins,
+                                         wasmbox_mutable_function_t *func,
+                                         int vmopcode) {
+  for (wasm_u32_t i = 0; i < 16; i++) {
+    if (ins->index + i >= ins->length || ins->data[ins->index + i] >= 32) {
+      LOG("invalid lane index");
+      return -1;
+    }
+  }
+  if (wasmbox_code_add_v128_const(func, ins) < 0) {
+    return -1;
+  }
+  wasmbox_code_t code = {};
+  code.h.opcode = vmopcode;
+  code.op2.r.reg2 = wasmbox_function_pop_v128(func);
+  code.op2.r.reg1 = wasmbox_function_pop_v128(func);
+  code.op1.reg = wasmbox_function_pop_v128(func);
+  code.op0.reg = wasmbox_function_push_v128(func);
+  wasmbox_code_add(func, &code);
+  return 0;
+}
+
+// splat, extract and replace take or give a scalar of `type`.
+static int wasmbox_code_add_simd_splat(wasmbox_input_stream_t *ins,
+                                       wasmbox_mutable_function_t *func,
+                                       int vmopcode,
+                                       wasmbox_value_type_t type) {
+  wasmbox_code_t code = {};
+  code.h.opcode = vmopcode;
+  code.op1.reg = wasmbox_function_pop_stack(func, type);
+  code.op0.reg = wasmbox_function_push_v128(func);
+  wasmbox_code_add(func, &code);
+  return 0;
+}
+
+static int wasmbox_simd_read_lane(wasmbox_input_stream_t *ins,
+                                  wasm_u32_t lanes, wasm_u32_t *lane) {
+  if (ins->index >= ins->length) {
+    return -1;
+  }
+  *lane = wasmbox_input_stream_read_u8(ins);
+  if (*lane >= lanes) {
+    LOG("invalid lane index");
+    return -1;
+  }
+  return 0;
+}
+
+static int wasmbox_code_add_simd_extract(wasmbox_input_stream_t *ins,
+                                         wasmbox_mutable_function_t *func,
+                                         int vmopcode, wasm_u32_t lanes,
+                                         wasmbox_value_type_t type) {
+  wasmbox_code_t code = {};
+  code.h.opcode = vmopcode;
+  if (wasmbox_simd_read_lane(ins, lanes, &code.op2.index)) {
+    return -1;
+  }
+  code.op1.reg = wasmbox_function_pop_v128(func);
+  code.op0.reg = wasmbox_function_push_stack(func, type);
+  wasmbox_code_add(func, &code);
+  return 0;
+}
+
+static int wasmbox_code_add_simd_replace(wasmbox_input_stream_t *ins,
+                                         wasmbox_mutable_function_t *func,
+                                         int vmopcode, wasm_u32_t lanes,
+                                         wasmbox_value_type_t type) {
+  wasmbox_code_t code = {};
+  wasm_u32_t lane;
+  code.h.opcode = vmopcode;
+  if (wasmbox_simd_read_lane(ins, lanes, &lane)) {
+    return -1;
+  }
+  code.op2.r.reg1 = wasmbox_function_pop_stack(func, type);
+  code.op2.r.reg2 = lane;
+  code.op1.reg = wasmbox_function_pop_v128(func);
+  code.op0.reg = wasmbox_function_push_v128(func);
+  wasmbox_code_add(func, &code);
+  return 0;
+}
+
+static int wasmbox_code_add_simd_unary(wasmbox_input_stream_t *ins,
+                                       wasmbox_mutable_function_t *func,
+                                       int vmopcode) {
+  wasmbox_code_t code = {};
+  code.h.opcode = vmopcode;
+  code.op1.reg = wasmbox_function_pop_v128(func);
+  code.op0.reg = wasmbox_function_push_v128(func);
+  wasmbox_code_add(func, &code);
+  return 0;
+}
+
+static int wasmbox_code_add_simd_binary(wasmbox_input_stream_t *ins,
+                                        wasmbox_mutable_function_t *func,
+                                        int vmopcode) {
+  wasmbox_code_t code = {};
+  code.h.opcode = vmopcode;
+  code.op2.reg = wasmbox_function_pop_v128(func);
+  code.op1.reg = wasmbox_function_pop_v128(func);
+  code.op0.reg = wasmbox_function_push_v128(func);
+  wasmbox_code_add(func, &code);
+  return 0;
+}
+
+static int wasmbox_code_add_simd_ternary(wasmbox_input_stream_t *ins,
+                                         wasmbox_mutable_function_t *func,
+                                         int vmopcode) {
+  wasmbox_code_t code = {};
+  code.h.opcode = vmopcode;
+  code.op2.r.reg2 = wasmbox_function_pop_v128(func);
+  code.op2.r.reg1 = wasmbox_function_pop_v128(func);
+  code.op1.reg = wasmbox_function_pop_v128(func);
+  code.op0.reg = wasmbox_function_push_v128(func);
+  wasmbox_code_add(func, &code);
+  return 0;
+}
+
+static int wasmbox_code_add_simd_shift(wasmbox_input_stream_t *ins,
+                                       wasmbox_mutable_function_t *func,
+                                       int vmopcode) {
+  wasmbox_code_t code = {};
+  code.h.opcode = vmopcode;
+  code.op2.reg = wasmbox_function_pop_stack(func, WASM_TYPE_I32);
+  code.op1.reg = wasmbox_function_pop_v128(func);
+  code.op0.reg = wasmbox_function_push_v128(func);
+  wasmbox_code_add(func, &code);
+  return 0;
+}
+
+static int wasmbox_code_add_simd_test(wasmbox_input_stream_t *ins,
+                                      wasmbox_mutable_function_t *func,
+                                      int vmopcode) {
+  wasmbox_code_t code = {};
+  code.h.opcode = vmopcode;
+  code.op1.reg = wasmbox_function_pop_v128(func);
+  code.op0.reg = wasmbox_function_push_stack(func, WASM_TYPE_I32);
+  wasmbox_code_add(func, &code);
+  return 0;
+}
+
+#define SIMD_DECODE_load      wasmbox_code_add_simd_load
+#define SIMD_DECODE_store     wasmbox_code_add_simd_store
+#define SIMD_DECODE_shuffle   wasmbox_code_add_simd_shuffle
+#define SIMD_DECODE_splat     wasmbox_code_add_simd_splat
+#define SIMD_DECODE_unary     wasmbox_code_add_simd_unary
+#define SIMD_DECODE_unary_fn  wasmbox_code_add_simd_unary
+#define SIMD_DECODE_binary    wasmbox_code_add_simd_binary
+#define SIMD_DECODE_binary_fn wasmbox_code_add_simd_binary
+#define SIMD_DECODE_ternary   wasmbox_code_add_simd_ternary
+#define SIMD_DECODE_shift     wasmbox_code_add_simd_shift
+#define SIMD_DECODE_test      wasmbox_code_add_simd_test
+#define SIMD_DECODE_ARGS_load(rtype, atype)
+#define SIMD_DECODE_ARGS_store(rtype, atype)
+#define SIMD_DECODE_ARGS_shuffle(rtype, atype)
+#define SIMD_DECODE_ARGS_unary(rtype, atype)
+#define SIMD_DECODE_ARGS_unary_fn(rtype, atype)
+#define SIMD_DECODE_ARGS_binary(rtype, atype)
+#define SIMD_DECODE_ARGS_binary_fn(rtype, atype)
+#define SIMD_DECODE_ARGS_ternary(rtype, atype)
+#define SIMD_DECODE_ARGS_shift(rtype, atype)
+#define SIMD_DECODE_ARGS_test(rtype, atype)
+// splat takes the type of its scalar, and lane instructions the number of
+// lanes of the vector and the type of their scalar.
+#define SIMD_DECODE_ARGS_splat(rtype, atype) , WASMBOX_VALUE_TYPE_##atype
+#define SIMD_DECODE_extract wasmbox_code_add_simd_extract
+#define SIMD_DECODE_replace wasmbox_code_add_simd_replace
+#define SIMD_DECODE_ARGS_extract(rtype, atype) \
+  , WASMBOX_SIMD_LANES(atype), WASMBOX_VALUE_TYPE_##rtype
+#define SIMD_DECODE_ARGS_replace(rtype, atype) \
+  , WASMBOX_SIMD_LANES(atype), WASMBOX_VALUE_TYPE_##rtype
+
+static int decode_simd_inst(wasmbox_input_stream_t *ins, wasmbox_module_t *mod,
+                            wasmbox_mutable_function_t *func, wasm_u8_t op) {
+  wasm_u32_t op1 = wasmbox_parse_unsigned_leb128(ins->data + ins->index,
+                                                 &ins->index, ins->length);
+  // Loads and stores.
+  int accesses_memory = op1 <= 0x0B || (op1 >= 0x54 && op1 <= 0x5D);
+  if (accesses_memory && wasmbox_module_check_memory32(mod)) {
+    return -1;
+  }
+  switch (op1) {
+    case 0x0C: // v128.const
+      return wasmbox_code_add_v128_const(func, ins) < 0 ? -1 : 0;
+#define FUNC(opcode, operands, rtype, atype, op, name) \
+  case (opcode):                                       \
+    return SIMD_DECODE_##operands(                     \
+        ins, func, OPCODE_##name SIMD_DECODE_ARGS_##operands(rtype, atype));
+    SIMD_INST_EACH(FUNC)
+#undef FUNC
+    default:
+      LOG("unsupported SIMD instruction");
+      return -1;
+  }
+}
+
 static int decode_undefined_op(wasmbox_input_stream_t *ins,
                                wasmbox_module_t *mod,
                                wasmbox_mutable_function_t *func, wasm_u8_t op) {
@@ -1068,9 +4060,9 @@ static int decode_undefined_op(wasmbox_input_stream_t *ins,
 }
 
 static const wasm_u8_t decoder_table[] = {
-    1,  1,  2,  2,  3,  0,  0,  0,  0,  0,  0,  4,  5,  6,  7,  8,  9,  10, 0,
-    0,  0,  0,  0,  0,  0,  0,  11, 11, 0,  0,  0,  0,  12, 12, 12, 12, 12, 0,
-    0,  0,  13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13,
+    1,  1,  2,  2,  3,  0,  0,  0,  0,  0,  0,  4,  5,  6,  7,  8,  9,  10, 9,
+    10, 0,  0,  0,  0,  0,  0,  11, 11, 11, 0,  0,  0,  12, 12, 12, 12, 12, 20,
+    20, 0,  13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13,
     13, 13, 13, 13, 13, 13, 14, 14, 15, 15, 15, 15, 16, 16, 16, 16, 16, 16, 16,
     16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16,
     16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16,
@@ -1078,10 +4070,10 @@ static const wasm_u8_t decoder_table[] = {
     16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16,
     16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16,
     16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16,
-    16, 16, 16, 16, 16, 16, 16, 0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
-    0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+    16, 16, 16, 16, 16, 16, 16, 0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  21,
+    21, 21, 0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
-    0,  0,  0,  0,  0,  17, 0,  0,  0,
+    0,  0,  0,  0,  0,  17, 19, 18, 0,
 };
 
 static const wasmbox_op_decode_func_t decode_funcs[] = {
@@ -1102,24 +4094,53 @@ static const wasmbox_op_decode_func_t decode_funcs[] = {
     decode_memory_size_and_grow,
     decode_constant_inst,
     decode_op0_inst,
-    decode_truncation_inst};
+    decode_truncation_inst,
+    decode_atomic_inst,
+    decode_simd_inst,
+    decode_table_inst,
+    decode_reference_inst};
 
 static int parse_instruction(wasmbox_input_stream_t *ins, wasmbox_module_t *mod,
                              wasmbox_mutable_function_t *func) {
+#ifdef WASMBOX_VM_USE_SAMPLING_PROFILE
+  func->source_offset = ins->index - mod->code_section_offset;
+#endif
   wasm_u8_t op = wasmbox_input_stream_read_u8(ins);
+  if (func->fuel_meter != NULL) {
+    func->fuel_meter->cost++;
+  }
   const wasmbox_op_decode_func_t decorder = decode_funcs[decoder_table[op]];
-  return decorder(ins, mod, func, op);
+  if (decorder(ins, mod, func, op) != 0 || func->invalid) {
+    return -1;
+  }
+  return 0;
 }
 
+// The body is validated while it is decoded, so its code refers only to the
+// slots of its frame and to what the module defines, which the interpreter
+// uses without checking. The stream ends with the body meanwhile, so that
+// nothing is read past it.
 static int parse_code(wasmbox_input_stream_t *ins, wasmbox_module_t *mod,
                       wasmbox_mutable_function_t *func, wasm_u64_t codelen) {
   wasm_u64_t end = ins->index + codelen;
-  while (ins->index < end) {
-    if (parse_instruction(ins, mod, func)) {
-      return -1;
-    }
+  wasm_u32_t length = ins->length;
+  if (end > length) {
+    LOG("truncated function body");
+    return -1;
   }
-  return 0;
+  ins->length = end;
+  int parsed = 0;
+  wasm_u32_t last = ins->index;
+  while (parsed == 0 && ins->index < end) {
+    last = ins->index;
+    parsed = parse_instruction(ins, mod, func);
+  }
+  ins->length = length;
+  if (parsed == 0 && (codelen == 0 || ins->data[last] != 0x0B)) {
+    LOG("function body without end");
+    return -1;
+  }
+  return parsed;
 }
 
 static int parse_local_variable(wasmbox_input_stream_t *ins, wasm_u64_t *index,
@@ -1129,53 +4150,393 @@ static int parse_local_variable(wasmbox_input_stream_t *ins, wasm_u64_t *index,
   return parse_value_type(ins, valtype);
 }
 
+// Builds the types of the parameters and locals, and their slots if a v128
+// parameter or local is found. The `len` local declarations starting at
+// `decls` are read again.
+static void wasmbox_function_map_locals(wasmbox_input_stream_t *ins,
+                                        wasmbox_mutable_function_t *func,
+                                        wasm_u32_t decls, wasm_u64_t len,
+                                        int has_v128) {
+  wasmbox_type_t *type = func->base.type;
+  wasm_u32_t end = ins->index;
+  wasm_u32_t params = 0;
+  for (wasm_u32_t slot = 0; slot < type->argument_size; params++) {
+    slot += type->args[slot] == WASM_TYPE_V128 ? 2 : 1;
+  }
+  wasm_u32_t size = params + func->base.locals;
+  func->local_size = size;
+  func->local_types = (wasm_u8_t *) wasmbox_arena_alloc(
+      func->arena, sizeof(*func->local_types) * (size + 1));
+  func->local_slots =
+      has_v128 ? (wasm_u16_t *) wasmbox_arena_alloc(
+                     func->arena, sizeof(*func->local_slots) * (size + 1))
+               : NULL;
+  wasm_u32_t local = 0;
+  wasm_u32_t slot = 0;
+  while (slot < type->argument_size) {
+    if (has_v128) {
+      func->local_slots[local] = slot;
+    }
+    func->local_types[local++] = type->args[slot];
+    slot += type->args[slot] == WASM_TYPE_V128 ? 2 : 1;
+  }
+  ins->index = decls;
+  for (wasm_u64_t i = 0; i < len; i++) {
+    wasm_u64_t count;
+    wasmbox_value_type_t valtype;
+    parse_local_variable(ins, &count, &valtype);
+    for (wasm_u64_t j = 0; j < count && local < size; j++) {
+      if (has_v128) {
+        func->local_slots[local] = slot;
+      }
+      func->local_types[local++] = valtype;
+      slot += valtype == WASM_TYPE_V128 ? 2 : 1;
+    }
+  }
+  if (has_v128) {
+    func->local_slots[local] = slot;
+  }
+  ins->index = end;
+}
+
 static int parse_local_variables(wasmbox_input_stream_t *ins,
                                  wasmbox_mutable_function_t *func) {
   wasm_u64_t len = wasmbox_parse_unsigned_leb128(ins->data + ins->index,
                                                  &ins->index, ins->length);
+  wasm_u32_t decls = ins->index;
+  wasm_u64_t slots = 0;
+  int has_v128 = 0;
+  for (wasm_u32_t i = 0; i < func->base.type->argument_size; i++) {
+    has_v128 |= func->base.type->args[i] == WASM_TYPE_V128;
+  }
   for (wasm_u64_t i = 0; i < len; i++) {
     wasm_u64_t localidx;
     wasmbox_value_type_t type;
     if (parse_local_variable(ins, &localidx, &type)) {
       return -1;
     }
+    // A v128 local takes two slots.
+    slots += type == WASM_TYPE_V128 ? 2 * localidx : localidx;
+    // The slots of the frame are addressed with 16 bits.
+    if (localidx > WASM_S16_MAX ||
+        slots + WASMBOX_FUNCTION_CALL_OFFSET + func->base.type->argument_size >
+            (wasm_u64_t) WASM_S16_MAX) {
+      LOG("too many locals");
+      return -1;
+    }
     func->base.locals += localidx;
+    has_v128 |= type == WASM_TYPE_V128;
+  }
+  wasmbox_function_map_locals(ins, func, decls, len, has_v128);
+  if (has_v128) {
+    func->base.locals = slots;
   }
   func->stack_top += func->base.locals;
+  wasmbox_function_reserve_frame(func, func->stack_top);
   return 0;
 }
 
-static int parse_function(wasmbox_input_stream_t *ins, wasmbox_module_t *mod,
-                          wasm_u32_t funcindex) {
-  wasmbox_mutable_function_t *func =
-      (wasmbox_mutable_function_t *) mod->functions[funcindex];
-  wasm_u64_t size = wasmbox_parse_unsigned_leb128(ins->data + ins->index,
-                                                  &ins->index, ins->length);
+// Compiles a function body. Scratch data is allocated from `arena`, which is
+// reset afterwards to be reused for the next function.
+static int parse_function_body(wasmbox_input_stream_t *ins,
+                               wasmbox_module_t *mod,
+                               wasmbox_mutable_function_t *func,
+                               wasm_u64_t size, wasmbox_arena_t *arena,
+                               wasmbox_function_load_stats_t *stats) {
+  wasm_u64_t start = stats != NULL ? wasmbox_now_ns() : 0;
+  func->arena = arena;
   wasm_u64_t index = ins->index;
+#ifdef WASMBOX_VM_USE_SAMPLING_PROFILE
+  // The checks of the prologue are attributed to the start of the body.
+  func->source_offset = ins->index - mod->code_section_offset;
+#endif
 #if 0
-  fprintf(stdout, "code(size:%llu)\n", size);
-    dump_binary(ins, size);
+  wasmbox_log(mod, WASMBOX_LOG_DEBUG, "code(size:%llu)", size);
+  dump_binary(ins, mod, size);
 #endif
+  func->stack_floor = 0;
+  func->label_depth = 0;
+  func->invalid = 0;
   if (parse_local_variables(ins, func)) {
+    func->arena = NULL;
     return -1;
   }
+  func->module_slot = -1;
+  if (mod->linked_module_size > 0) {
+    // A local of its own, which calls into linked modules save the module to.
+    func->module_slot = func->stack_top++;
+    func->base.locals++;
+    wasmbox_function_reserve_frame(func, func->stack_top);
+  }
   size -= ins->index - index;
   // Create entry block.
   wasmbox_block_switch(func, wasmbox_block_add(func));
+  wasmbox_fuel_meter_t meter;
+  if (func->base.type != NULL) {
+    wasmbox_code_add_zero_locals(func);
+    wasmbox_code_add_body_checks(mod, func);
+    if (mod->fuel_metering) {
+      wasmbox_fuel_meter_start(func, &meter);
+    }
+  }
   int parsed = parse_code(ins, mod, func, size);
-  if (parsed == 0) {
-    wasmbox_function_freeze(mod, func);
+  if (func->fuel_meter != NULL) {
+    wasmbox_fuel_meter_finish(func, &meter, NULL);
+  }
+  if (stats != NULL) {
+    stats->decode_ns = wasmbox_now_ns() - start;
+  }
+  int keep = parsed == 0;
+#ifdef WASMBOX_VM_USE_LAZY_COMPILE
+  keep &= !func->validating;
+#endif
+  if (keep) {
+    wasmbox_function_freeze(mod, func, stats);
+  }
+  func->arena = NULL;
+  wasmbox_arena_reset(arena);
+  return parsed;
+}
+
+#ifdef WASMBOX_VM_USE_LAZY_COMPILE
+// Installs the code of a function which is compiled on its first call.
+// Callers read `code` of the callee on every call, so they run the compiled
+// code from then on.
+static void wasmbox_function_install_stub(wasmbox_module_t *mod,
+                                          wasmbox_mutable_function_t *func) {
+  wasmbox_code_t *stub =
+      (wasmbox_code_t *) wasmbox_malloc(sizeof(wasmbox_code_t));
+  stub->h.opcode = OPCODE_LAZY_COMPILE;
+#  ifdef WASMBOX_VM_USE_COMPACT_CODE
+  stub->op1.index = func->index;
+#  else
+  stub->op1.func = &func->base;
+#  endif
+#  ifdef WASMBOX_VM_USE_CODE_LABEL
+  void **labels = (void **) mod->shared_code[0].op0.value.u64;
+  stub->h.label = labels[OPCODE_LAZY_COMPILE];
+#  endif
+  func->stub = stub;
+  func->base.code = stub;
+  func->base.code_size = 1;
+}
+
+// Parses the body of `func` from the module source into `compiled`, a copy
+// of it, and replaces the code of `func` once it is complete. Called with the
+// compile lock held.
+static int wasmbox_function_compile_source(wasmbox_module_t *mod,
+                                           wasmbox_mutable_function_t *func,
+                                           wasmbox_mutable_function_t *compiled) {
+  compiled->base.code = NULL;
+  compiled->base.code_size = 0;
+#  ifdef WASMBOX_VM_USE_SAMPLING_PROFILE
+  compiled->code_offsets = NULL;
+#  endif
+  compiled->origin = func;
+  // Recompiling lays the frame out again the same way.
+  compiled->base.locals = 0;
+  compiled->loop_size = 0;
+  wasmbox_input_stream_t stream = {};
+  stream.data = mod->source;
+  stream.index = func->body_offset;
+  stream.length = func->body_offset + func->body_size;
+  wasmbox_arena_t arena = {};
+  int parsed =
+      parse_function_body(&stream, mod, compiled, func->body_size, &arena,
+                          NULL);
+  wasmbox_arena_dispose(&arena);
+  if (mod->code_region != NULL) {
+    mod->huge_pages |= wasmbox_code_region_huge_pages(mod->code_region);
+  }
+  if (parsed != 0) {
+    wasmbox_module_free_code(mod, compiled->base.code);
+#  ifdef WASMBOX_VM_USE_SAMPLING_PROFILE
+    if (compiled->code_offsets != NULL) {
+      wasmbox_free(compiled->code_offsets);
+    }
+#  endif
+    return parsed;
+  }
+  func->base.locals = compiled->base.locals;
+  func->loop_size = compiled->loop_size;
+  func->base.code_size = compiled->base.code_size;
+  func->base.frame_size = compiled->base.frame_size;
+#  ifdef WASMBOX_VM_USE_COMPACT_CODE
+  func->constants = compiled->constants;
+  func->constant_size = compiled->constant_size;
+  func->constant_capacity = compiled->constant_capacity;
+#  endif
+#  ifdef WASMBOX_VM_USE_SAMPLING_PROFILE
+  // Samples of the code it replaces are no longer looked up.
+  if (func->code_offsets != NULL) {
+    wasmbox_free(func->code_offsets);
+  }
+  func->code_offsets = compiled->code_offsets;
+#  endif
+  __atomic_store_n(&func->base.code, compiled->base.code, __ATOMIC_RELEASE);
+  return 0;
+}
+
+int wasmbox_module_compile_function(wasmbox_module_t *mod,
+                                    wasmbox_function_t *base) {
+  wasmbox_mutable_function_t *func = (wasmbox_mutable_function_t *) base;
+  if (__atomic_load_n(&func->base.code, __ATOMIC_ACQUIRE) != func->stub) {
+    return 0;
+  }
+  // The code is shared by every instance, so it is put in the owner's region
+  // and its call caches on the owner's list. Threads running instances of it
+  // compile one function at a time.
+  mod = wasmbox_module_code_owner(mod);
+  while (__atomic_test_and_set(&mod->compile_lock, __ATOMIC_ACQUIRE)) {
+  }
+  int parsed = 0;
+  if (func->base.code == func->stub) {
+    // Functions start in the first tier unless tiering is disabled.
+    wasm_s32_t threshold = mod->tier_up_threshold;
+    func->baseline = threshold >= 0;
+    func->hotness = threshold == 0 ? WASMBOX_TIER_UP_THRESHOLD : threshold;
+    // Other threads keep calling the stub until the code is complete.
+    wasmbox_mutable_function_t compiled = *func;
+    parsed = wasmbox_function_compile_source(mod, func, &compiled);
+  }
+  __atomic_clear(&mod->compile_lock, __ATOMIC_RELEASE);
+  return parsed;
+}
+
+// Has `compiled`, a copy of the function `base`, call the callees its stable
+// indirect call sites are speculated to call.
+static void wasmbox_function_collect_speculations(
+    wasmbox_module_t *mod, wasmbox_function_t *base,
+    wasmbox_mutable_function_t *compiled) {
+  wasm_s32_t threshold = wasmbox_module_speculation_threshold(mod);
+  compiled->speculation_size = 0;
+  for (wasmbox_call_cache_t *cache = mod->call_caches; cache != NULL;
+       cache = cache->next) {
+    if (cache->caller == base &&
+        wasmbox_call_cache_is_stable(cache, threshold)) {
+      compiled->speculation_size++;
+    }
+  }
+  compiled->speculations = (wasmbox_call_cache_t **) wasmbox_malloc(
+      sizeof(wasmbox_call_cache_t *) * (compiled->speculation_size + 1));
+  compiled->speculation_size = 0;
+  for (wasmbox_call_cache_t *cache = mod->call_caches; cache != NULL;
+       cache = cache->next) {
+    if (cache->caller == base &&
+        wasmbox_call_cache_is_stable(cache, threshold)) {
+      compiled->speculations[compiled->speculation_size++] = cache;
+    }
+  }
+}
+
+int wasmbox_module_speculate(wasmbox_module_t *mod, wasmbox_function_t *base) {
+  wasmbox_mutable_function_t *func = (wasmbox_mutable_function_t *) base;
+  mod = wasmbox_module_code_owner(mod);
+  while (__atomic_test_and_set(&mod->compile_lock, __ATOMIC_ACQUIRE)) {
+  }
+  int parsed = 0;
+  if (!func->speculated && func->stub != NULL &&
+      func->base.code != func->stub) {
+    // Sites found stable later are not profiled again. The function stays in
+    // its tier.
+    func->speculated = 1;
+    wasmbox_mutable_function_t compiled = *func;
+    wasmbox_function_collect_speculations(mod, base, &compiled);
+    wasmbox_code_t *generic_code = func->base.code;
+    parsed = wasmbox_function_compile_source(mod, func, &compiled);
+    if (parsed == 0) {
+      func->generic_code = generic_code;
+    }
+    wasmbox_free(compiled.speculations);
   }
+  __atomic_clear(&mod->compile_lock, __ATOMIC_RELEASE);
   return parsed;
 }
 
+wasmbox_code_t *wasmbox_module_tier_up(wasmbox_module_t *mod,
+                                       wasmbox_function_t *base,
+                                       wasm_u32_t entry) {
+  wasmbox_mutable_function_t *func = (wasmbox_mutable_function_t *) base;
+  mod = wasmbox_module_code_owner(mod);
+  while (__atomic_test_and_set(&mod->compile_lock, __ATOMIC_ACQUIRE)) {
+  }
+  wasmbox_code_t *resume = NULL;
+  if (func->baseline && func->base.code != func->stub) {
+    // Frames still running the first tier count down slowly from here, so
+    // they do not come back.
+    __atomic_store_n(&func->hotness, INT32_MAX, __ATOMIC_RELAXED);
+    func->baseline = 0;
+    wasmbox_mutable_function_t compiled = *func;
+    compiled.speculations = NULL;
+    if (func->speculated) {
+      wasmbox_function_collect_speculations(mod, base, &compiled);
+    }
+    compiled.osr_entries = (wasm_u32_t *) wasmbox_malloc(
+        sizeof(wasm_u32_t) * (func->loop_size + 1));
+    wasmbox_code_t *baseline_code = func->base.code;
+    if (wasmbox_function_compile_source(mod, func, &compiled) == 0) {
+      func->baseline_code = baseline_code;
+      wasm_u32_t offset = compiled.osr_entries[entry];
+      // Native code replaces the first instruction, and starts the function
+      // over.
+      if (offset != UINT32_MAX &&
+          (entry == 0 || offset > 0 ||
+           func->base.code[0].h.opcode != OPCODE_JIT_ENTRY)) {
+        resume = func->base.code + offset;
+      }
+    }
+    wasmbox_free(compiled.osr_entries);
+    if (compiled.speculations != NULL) {
+      wasmbox_free(compiled.speculations);
+    }
+  }
+  __atomic_clear(&mod->compile_lock, __ATOMIC_RELEASE);
+  return resume;
+}
+#endif /* WASMBOX_VM_USE_LAZY_COMPILE */
+
+#ifndef WASMBOX_PARALLEL_COMPILE_ENABLED
+static int parse_function(wasmbox_input_stream_t *ins, wasmbox_module_t *mod,
+                          wasm_u32_t funcindex, wasmbox_arena_t *arena) {
+  wasmbox_mutable_function_t *func =
+      (wasmbox_mutable_function_t *)
+          mod->functions[mod->import_function_size + funcindex];
+  wasm_u64_t size = wasmbox_parse_unsigned_leb128(ins->data + ins->index,
+                                                  &ins->index, ins->length);
+  if (size > ins->length - ins->index) {
+    LOG("truncated function body");
+    return -1;
+  }
+#ifdef WASMBOX_VM_USE_LAZY_COMPILE
+  // Only remember where the body is. It is compiled on the first call, but
+  // validated now so that an invalid module fails to load as it would
+  // otherwise. The code of the first tier decoded to validate it is dropped.
+  func->body_offset = ins->index;
+  func->body_size = size;
+  wasmbox_mutable_function_t validated = *func;
+  validated.validating = 1;
+  validated.baseline = 1;
+  validated.origin = func;
+  if (parse_function_body(ins, mod, &validated, size, arena, NULL) != 0) {
+    return -1;
+  }
+  ins->index = func->body_offset + size;
+  wasmbox_function_install_stub(mod, func);
+  return 0;
+#else
+  return parse_function_body(ins, mod, func, size, arena,
+                             wasmbox_function_load_stats(mod, funcindex));
+#endif
+}
+#endif /* WASMBOX_PARALLEL_COMPILE_ENABLED */
+
 static int parse_type_section(wasmbox_input_stream_t *ins,
                               wasm_u64_t section_size, wasmbox_module_t *mod) {
   wasm_u64_t len = wasmbox_parse_unsigned_leb128(ins->data + ins->index,
                                                  &ins->index, ins->length);
   for (wasm_u64_t i = 0; i < len; i++) {
     wasmbox_type_t *func_type = NULL;
-    if ((func_type = parse_function_type(ins)) == NULL) {
+    if ((func_type = parse_function_type(ins, mod)) == NULL) {
       return -1;
     }
     wasmbox_module_register_new_type(mod, func_type);
@@ -1183,55 +4544,351 @@ static int parse_type_section(wasmbox_input_stream_t *ins,
   return 0;
 }
 
-static int parse_name(wasmbox_input_stream_t *ins, wasmbox_name_t **name) {
+static wasmbox_name_t *wasmbox_name_new(wasmbox_module_t *mod,
+                                        const wasm_u8_t *value,
+                                        wasm_u32_t len, int borrow) {
+  wasmbox_name_t *name = (wasmbox_name_t *) wasmbox_slab_alloc(
+      mod->metadata, sizeof(wasmbox_name_t) + (borrow ? 0 : len));
+  name->len = len;
+  if (borrow) {
+    name->value = (wasm_u8_t *) value;
+  } else {
+    name->value = (wasm_u8_t *) (name + 1);
+    memcpy(name->value, value, len);
+  }
+  return name;
+}
+
+static int parse_name(wasmbox_input_stream_t *ins, wasmbox_module_t *mod,
+                      wasmbox_name_t **name) {
   wasm_u64_t len = wasmbox_parse_unsigned_leb128(ins->data + ins->index,
                                                  &ins->index, ins->length);
-  wasmbox_name_t *n =
-      (wasmbox_name_t *) wasmbox_malloc(sizeof(wasmbox_name_t) + len);
-  n->len = len;
-  for (wasm_u64_t i = 0; i < len; i++) {
-    n->value[i] = wasmbox_input_stream_read_u8(ins);
+  if (ins->index + len > ins->length) {
+    LOG("name out of bounds");
+    return -1;
   }
-  *name = n;
+  int borrow = ins->kind == WASMBOX_INPUT_STREAM_BORROWED && mod->borrow_source;
+  *name = wasmbox_name_new(mod, ins->data + ins->index, (wasm_u32_t) len, borrow);
+  ins->index += len;
   return 0;
 }
 
 static int parse_limit(wasmbox_input_stream_t *ins, wasmbox_limit_t *limit) {
-  wasm_u8_t has_upper_limit = wasmbox_input_stream_read_u8(ins);
-  limit->min = wasmbox_parse_unsigned_leb128(ins->data + ins->index,
-                                             &ins->index, ins->length);
+  // Bit 0 tells if there is an upper limit, bit 1 if the memory is shared
+  // and bit 2 if it is a memory64.
+  wasm_u8_t flags = wasmbox_input_stream_read_u8(ins);
+  wasm_u8_t has_upper_limit = flags & 0x01;
+  limit->shared = (flags & 0x02) != 0;
+  limit->memory64 = (flags & 0x04) != 0;
+  // The limits of a memory64 are 64-bit, but no memory has 2^32 pages.
+  wasm_u64_t min = wasmbox_parse_unsigned_leb128(ins->data + ins->index,
+                                                 &ins->index, ins->length);
+  limit->min = min > WASM_U32_MAX ? WASM_U32_MAX : (wasm_u32_t) min;
+  limit->max = WASM_U32_MAX;
   if (has_upper_limit) {
-    limit->max = wasmbox_parse_unsigned_leb128(ins->data + ins->index,
-                                               &ins->index, ins->length);
-  } else {
-    limit->max = WASM_U32_MAX;
+    wasm_u64_t max = wasmbox_parse_unsigned_leb128(ins->data + ins->index,
+                                                   &ins->index, ins->length);
+    if (max < WASM_U32_MAX) {
+      limit->max = (wasm_u32_t) max;
+    }
   }
   return 0;
 }
 
+static int wasmbox_name_equals(wasmbox_name_t *name, const char *str) {
+  size_t len = strlen(str);
+  return name->len == len && memcmp(name->value, str, len) == 0;
+}
+
+// Tells if the types of `host`, which reads and writes the frame of its
+// calls as they lay it out, are those of `type`.
+static int wasmbox_host_function_has_type(const wasmbox_host_function_t *host,
+                                          wasmbox_type_t *type) {
+  if (type->argument_size != host->param_size ||
+      type->return_size != host->result_size) {
+    return 0;
+  }
+  for (wasm_u32_t i = 0; i < host->param_size + host->result_size; i++) {
+    if (type->args[i] != host->types[i]) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+// Tells if `host` can be called as a function of `type`.
+static int wasmbox_host_function_accepts(const wasmbox_host_function_t *host,
+                                         wasmbox_type_t *type) {
+  wasmbox_value_type_t arg = WASM_TYPE_I32;
+  wasm_u16_t argument_size = 1;
+  switch (host->kind) {
+    case WASMBOX_HOST_FRAME:
+      return host->entry.frame != NULL &&
+             wasmbox_host_function_has_type(host, type);
+    case WASMBOX_HOST_ASYNC:
+      return host->entry.async != NULL &&
+             wasmbox_host_function_has_type(host, type);
+    case WASMBOX_HOST_I32_I32:
+      break;
+    case WASMBOX_HOST_I32_I32_I32:
+      argument_size = 2;
+      break;
+    case WASMBOX_HOST_I64_I64:
+      arg = WASM_TYPE_I64;
+      break;
+    default:
+      return 0;
+  }
+  if (type->argument_size != argument_size || type->return_size != 1) {
+    return 0;
+  }
+  for (wasm_u16_t i = 0; i <= argument_size; i++) {
+    if (type->args[i] != arg) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+// Adds a function whose only instruction calls `host` and returns.
+static void
+wasmbox_module_import_function(wasmbox_module_t *mod, wasmbox_type_t *type,
+                               const wasmbox_host_function_t *host) {
+  wasmbox_mutable_function_t *func =
+      (wasmbox_mutable_function_t *) wasmbox_slab_alloc(mod->metadata,
+                                                         sizeof(*func));
+  wasm_u32_t constant_size = 0;
+#ifdef WASMBOX_VM_USE_COMPACT_CODE
+  constant_size = sizeof(wasmbox_code_constant_t);
+#endif
+  wasmbox_code_t *code = (wasmbox_code_t *) wasmbox_malloc(
+      sizeof(wasmbox_code_t) + constant_size);
+  code->h.opcode = OPCODE_HOST_CALL;
+#ifdef WASMBOX_VM_USE_COMPACT_CODE
+  wasmbox_code_constant_t *constant = (wasmbox_code_constant_t *) (code + 1);
+  constant->value.u64 = (wasm_u64_t) (uintptr_t) host;
+  code->op0.offset = (char *) constant - (char *) code;
+#else
+  code->op0.value.u64 = (wasm_u64_t) (uintptr_t) host;
+#endif
+  code->op1.index = host->kind;
+  code->op2.index = type->return_size;
+#ifdef WASMBOX_VM_USE_CODE_LABEL
+  void **labels = (void **) mod->shared_code[0].op0.value.u64;
+  code->h.label = labels[OPCODE_HOST_CALL];
+#endif
+  func->base.type = type;
+  func->base.code = code;
+  func->base.code_size = 1;
+  func->base.frame_size = WASMBOX_FUNCTION_CALL_OFFSET + type->argument_size;
+  func->current_block_id = -1;
+#ifdef WASMBOX_VM_USE_LAZY_COMPILE
+  func->stub = code;
+#endif
+  wasmbox_module_register_new_function(mod, func);
+  mod->import_function_size++;
+}
+
+static wasm_u32_t wasmbox_export_hash(const wasm_u8_t *name, wasm_u32_t len) {
+  // FNV-1a
+  wasm_u32_t hash = 2166136261u;
+  for (wasm_u32_t i = 0; i < len; i++) {
+    hash = (hash ^ name[i]) * 16777619u;
+  }
+  return hash;
+}
+
+static const wasmbox_export_t *
+wasmbox_module_find_export(wasmbox_module_t *mod, const wasm_u8_t *name,
+                           wasm_u32_t len) {
+  if (mod->export_bucket_size == 0) {
+    return NULL;
+  }
+  wasm_u32_t mask = mod->export_bucket_size - 1;
+  wasm_u32_t i = wasmbox_export_hash(name, len) & mask;
+  for (; mod->export_buckets[i] != 0; i = (i + 1) & mask) {
+    const wasmbox_export_t *export = &mod->exports[mod->export_buckets[i] - 1];
+    if (export->name->len == len &&
+        memcmp(export->name->value, name, len) == 0) {
+      return export;
+    }
+  }
+  return NULL;
+}
+
+// Returns 1 if a call of `mod` may stop the VM, which the module calling into
+// it would not see.
+static int wasmbox_module_may_stop(wasmbox_module_t *mod) {
+  return mod->fuel_metering || mod->epoch_interruption ||
+         wasmbox_module_imports_async(mod);
+}
+
+// Adds a function which calls `link` from a frame of its own, for the calls
+// which do not go through a call instruction of the module: tables,
+// references and exports. Call instructions use OPCODE_MODULE_CALL directly.
+//   MOVE r7 r2             ; arguments
+//   MODULE_CALL r4 link r3
+//   MODULE_RESTORE r3
+//   MOVE r-1 r4            ; results
+//   RETURN
+static void wasmbox_module_link_function(wasmbox_module_t *mod,
+                                         wasmbox_type_t *type,
+                                         wasmbox_module_link_t *link) {
+  wasmbox_mutable_function_t *func =
+      (wasmbox_mutable_function_t *) wasmbox_slab_alloc(mod->metadata,
+                                                         sizeof(*func));
+  wasm_u16_t args = WASMBOX_FUNCTION_CALL_OFFSET;
+  wasm_u16_t saved = args + type->argument_size;
+  wasm_u16_t base = saved + 1;
+  wasm_u16_t callee_args =
+      base + type->return_size + WASMBOX_FUNCTION_CALL_OFFSET;
+  wasm_u32_t code_size = type->argument_size + type->return_size + 3;
+  wasm_u32_t constant_size = 0;
+#ifdef WASMBOX_VM_USE_COMPACT_CODE
+  constant_size = sizeof(wasmbox_code_constant_t);
+#endif
+  wasmbox_code_t *code = (wasmbox_code_t *) wasmbox_malloc(
+      sizeof(wasmbox_code_t) * code_size + constant_size);
+  wasmbox_code_t *c = code;
+  for (wasm_u16_t i = 0; i < type->argument_size; i++, c++) {
+    c->h.opcode = OPCODE_MOVE;
+    c->op0.reg = callee_args + i;
+    c->op1.reg = args + i;
+  }
+  c->h.opcode = OPCODE_MODULE_CALL;
+  c->op0.reg = base;
+#ifdef WASMBOX_VM_USE_COMPACT_CODE
+  wasmbox_code_constant_t *constant =
+      (wasmbox_code_constant_t *) (code + code_size);
+  constant->value.u64 = (wasm_u64_t) (uintptr_t) link;
+  c->op1.offset = (char *) constant - (char *) c;
+#else
+  c->op1.value.u64 = (wasm_u64_t) (uintptr_t) link;
+#endif
+  c->op2.reg = saved;
+  c++;
+  c->h.opcode = OPCODE_MODULE_RESTORE;
+  c->op0.reg = saved;
+  c++;
+  for (wasm_u16_t i = 0; i < type->return_size; i++, c++) {
+    c->h.opcode = OPCODE_MOVE;
+    c->op0.reg = i - type->return_size;
+    c->op1.reg = base + i;
+  }
+  c->h.opcode = OPCODE_RETURN;
+#ifdef WASMBOX_VM_USE_CODE_LABEL
+  void **labels = (void **) mod->shared_code[0].op0.value.u64;
+  for (wasm_u32_t i = 0; i < code_size; i++) {
+    code[i].h.label = labels[code[i].h.opcode];
+  }
+#endif
+  func->base.type = type;
+  func->base.code = code;
+  func->base.code_size = code_size;
+  func->base.frame_size = callee_args + type->argument_size;
+  func->current_block_id = -1;
+  func->link = link;
+#ifdef WASMBOX_VM_USE_LAZY_COMPILE
+  func->stub = code;
+#endif
+  wasmbox_module_register_new_function(mod, func);
+  mod->import_function_size++;
+}
+
+// Resolves an imported function among `mod->host_functions`, then among the
+// exports of `mod->linked_modules`.
+static int parse_import_function(wasmbox_input_stream_t *ins,
+                                 wasmbox_module_t *mod,
+                                 wasmbox_name_t *module_name,
+                                 wasmbox_name_t *name) {
+  wasm_u32_t typeidx = wasmbox_parse_unsigned_leb128(
+      ins->data + ins->index, &ins->index, ins->length);
+  if (typeidx >= mod->type_size) {
+    LOG("unknown type");
+    return -1;
+  }
+  if (mod->function_size != mod->import_function_size) {
+    LOG("function imported after the function section");
+    return -1;
+  }
+  for (wasm_u32_t i = 0; i < mod->host_function_size; i++) {
+    const wasmbox_host_function_t *host = &mod->host_functions[i];
+    if (wasmbox_name_equals(module_name, host->module) &&
+        wasmbox_name_equals(name, host->name)) {
+      if (!wasmbox_host_function_accepts(host, mod->types[typeidx])) {
+        LOG("host function type mismatch");
+        return -1;
+      }
+      wasmbox_module_import_function(mod, mod->types[typeidx], host);
+      return 0;
+    }
+  }
+  for (wasm_u32_t i = 0; i < mod->linked_module_size; i++) {
+    const wasmbox_linked_module_t *linked = &mod->linked_modules[i];
+    if (!wasmbox_name_equals(module_name, linked->name)) {
+      continue;
+    }
+    const wasmbox_export_t *export =
+        wasmbox_module_find_export(linked->module, name->value, name->len);
+    if (export == NULL) {
+      continue;
+    }
+    if (export->kind != WASMBOX_EXPORT_FUNCTION ||
+        export->func->type->id != mod->types[typeidx]->id) {
+      LOG("linked function type mismatch");
+      return -1;
+    }
+    if (wasmbox_module_may_stop(linked->module)) {
+      LOG("linked module may stop calls");
+      return -1;
+    }
+    wasmbox_module_link_t *link = (wasmbox_module_link_t *) wasmbox_slab_alloc(
+        mod->metadata, sizeof(*link));
+    link->module = linked->module;
+    link->func = export->func;
+    wasmbox_module_link_function(mod, mod->types[typeidx], link);
+    return 0;
+  }
+  LOG("unknown import");
+  return -1;
+}
+
 static int parse_import_description(wasmbox_input_stream_t *ins,
-                                    wasmbox_module_t *mod) {
+                                    wasmbox_module_t *mod,
+                                    wasmbox_name_t *module_name,
+                                    wasmbox_name_t *name) {
   wasm_u8_t type = wasmbox_input_stream_read_u8(ins);
-  wasm_u32_t v;
   wasmbox_limit_t limit;
   wasmbox_value_type_t value_type;
   switch (type) {
     case 0x00: // func x:typeidx
-      v = wasmbox_parse_unsigned_leb128(ins->data + ins->index, &ins->index,
-                                        ins->length);
-      return 0;
+      return parse_import_function(ins, mod, module_name, name);
     case 0x01: // table x:tabletype
-      assert(wasmbox_input_stream_read_u8(ins) == 0x70);
-      return parse_limit(ins, &limit);
+      if (parse_value_type(ins, &value_type) != 0 ||
+          parse_limit(ins, &limit) != 0) {
+        return -1;
+      }
+      // The host gives no table, so an imported table starts out empty.
+      return wasmbox_module_add_table(mod, value_type, &limit);
     case 0x02: // mem x:memtype
-      return parse_limit(ins, &limit);
+      if (parse_limit(ins, &limit) != 0) {
+        return -1;
+      }
+      // Only a shared memory given by the host is imported.
+      if (limit.shared && mod->shared_memory != NULL) {
+        return wasmbox_module_add_memory_page(mod, &limit);
+      }
+      return 0;
     case 0x03: // global x:globaltype
       if (parse_value_type(ins, &value_type)) {
         return -1;
       }
       type = wasmbox_input_stream_read_u8(ins);
-      assert(type == 0x00 /* const */ || type == 0x01 /* var */ ||
-             type == 0x02 /* mutable */);
+      if (type != 0x00 /* const */ && type != 0x01 /* var */ &&
+          type != 0x02 /* mutable */) {
+        LOG("unknown mutability");
+        return -1;
+      }
       return 0;
     default:
       return -1;
@@ -1241,20 +4898,16 @@ static int parse_import_description(wasmbox_input_stream_t *ins,
 static int parse_import(wasmbox_input_stream_t *ins, wasmbox_module_t *mod) {
   wasmbox_name_t *module_name;
   wasmbox_name_t *ns_name;
-  if (parse_name(ins, &module_name)) {
-    return -1;
-  }
-  if (parse_name(ins, &ns_name)) {
+  if (parse_name(ins, mod, &module_name)) {
     return -1;
   }
-  if (parse_import_description(ins, mod)) {
+  if (parse_name(ins, mod, &ns_name)) {
     return -1;
   }
-  fprintf(stdout, "import(%.*s:%.*s)\n", module_name->len, module_name->value,
-          ns_name->len, ns_name->value);
-  wasmbox_free(module_name);
-  wasmbox_free(ns_name);
-  return 0;
+  int parsed = parse_import_description(ins, mod, module_name, ns_name);
+  wasmbox_log(mod, WASMBOX_LOG_INFO, "import(%.*s:%.*s)", module_name->len,
+              module_name->value, ns_name->len, ns_name->value);
+  return parsed;
 }
 
 static int parse_import_section(wasmbox_input_stream_t *ins,
@@ -1262,7 +4915,7 @@ static int parse_import_section(wasmbox_input_stream_t *ins,
                                 wasmbox_module_t *mod) {
   wasm_u64_t len = wasmbox_parse_unsigned_leb128(ins->data + ins->index,
                                                  &ins->index, ins->length);
-  fprintf(stdout, "import(num:%llu)\n", len);
+  wasmbox_log(mod, WASMBOX_LOG_INFO, "import(num:%llu)", len);
   for (wasm_u64_t i = 0; i < len; i++) {
     if (parse_import(ins, mod)) {
       return -1;
@@ -1279,14 +4932,27 @@ static int parse_function_section(wasmbox_input_stream_t *ins,
   for (wasm_u64_t i = 0; i < len; i++) {
     wasm_u32_t v = wasmbox_parse_unsigned_leb128(ins->data + ins->index,
                                                  &ins->index, ins->length);
+    if (v >= mod->type_size) {
+      LOG("unknown type");
+      return -1;
+    }
     wasmbox_mutable_function_t *func =
-        (wasmbox_mutable_function_t *) wasmbox_malloc(sizeof(*func));
+        (wasmbox_mutable_function_t *) wasmbox_slab_alloc(mod->metadata,
+                                                           sizeof(*func));
     func->base.type = mod->types[v];
     func->stack_top =
         WASMBOX_FUNCTION_CALL_OFFSET + func->base.type->argument_size;
     func->current_block_id = -1;
     wasmbox_module_register_new_function(mod, func);
   }
+  if (mod->load_stats != NULL && mod->load_stats->functions == NULL) {
+    mod->load_stats->functions = (wasmbox_function_load_stats_t *)
+        wasmbox_malloc(sizeof(wasmbox_function_load_stats_t) *
+                       mod->function_size);
+    memset((void *) mod->load_stats->functions, 0,
+           sizeof(wasmbox_function_load_stats_t) * mod->function_size);
+    mod->load_stats->function_size = mod->function_size;
+  }
   return 0;
 }
 
@@ -1303,10 +4969,10 @@ static int parse_table_section(wasmbox_input_stream_t *ins,
     if (parse_limit(ins, &limit) != 0) {
       return -1;
     }
+    if (wasmbox_module_add_table(mod, type, &limit) != 0) {
+      return -1;
+    }
   }
-  mod->table_size = len;
-  mod->tables =
-      (wasmbox_table_t **) wasmbox_malloc(sizeof(wasmbox_table_t *) * len);
   return 0;
 }
 
@@ -1329,21 +4995,44 @@ static int parse_memory_section(wasmbox_input_stream_t *ins,
 
 static int parse_global_variable(wasmbox_input_stream_t *ins,
                                  wasmbox_module_t *mod,
-                                 wasmbox_mutable_function_t *global) {
+                                 wasmbox_mutable_function_t *global,
+                                 wasm_u32_t index) {
   wasmbox_value_type_t valtype;
   if (parse_value_type(ins, &valtype) != 0) {
     return -1;
   }
+  if (valtype == WASM_TYPE_V128) {
+    // A global holds a single slot.
+    LOG("v128 global is not supported");
+    return -1;
+  }
   wasm_u8_t mut = wasmbox_input_stream_read_u8(ins);
-  int is_const = mut == 0x01;
+  int is_const = mut == 0x00;
   if (mut != 0x00 /*const*/ && mut != 0x01 /*var*/) {
     LOG("unreachable");
     return -1;
   }
+  if (!is_const && valtype == WASM_TYPE_I32 &&
+      mod->stack_pointer_global == 0) {
+    mod->stack_pointer_global = index + 1;
+  }
+  mod->global_types[index] = valtype;
 
-  if (parse_expression(ins, mod, global) < 0) {
+  if (parse_expression(ins, mod, global) < 0 ||
+      wasmbox_function_check_values(global, &valtype, 1) != 0) {
     return -1;
   }
+  // The global function still stores the initial value when the module is
+  // loaded. Recording it here lets function bodies use it as a constant.
+  wasm_s16_t reg = wasmbox_function_peek_stack(global);
+  if (global->invalid) {
+    return -1;
+  }
+  wasmbox_code_t *code = wasmbox_code_find_last_const(global, reg, 0);
+  if (is_const && code != NULL) {
+    mod->globals[index] = wasmbox_code_get_value(global, &code->op1);
+    mod->global_constants[index] = code->h.opcode;
+  }
   return 0;
 }
 
@@ -1353,7 +5042,15 @@ static int parse_global_section(wasmbox_input_stream_t *ins,
   wasm_u64_t len = wasmbox_parse_unsigned_leb128(ins->data + ins->index,
                                                  &ins->index, ins->length);
   if (len > 0) {
-    mod->globals = wasmbox_malloc(sizeof(*mod->globals) * len);
+    if (mod->instance_slot != NULL) {
+      mod->globals = wasmbox_instance_slot_globals(mod->instance_slot, len);
+    }
+    if (mod->globals == NULL) {
+      mod->globals = wasmbox_malloc(sizeof(*mod->globals) * len);
+    }
+    mod->global_constants =
+        wasmbox_malloc(sizeof(*mod->global_constants) * len);
+    mod->global_types = wasmbox_malloc(sizeof(*mod->global_types) * len);
     mod->global_size = len;
   }
   wasmbox_mutable_function_t *global =
@@ -1361,61 +5058,79 @@ static int parse_global_section(wasmbox_input_stream_t *ins,
   if (global == NULL) {
     static const char global_name[] = "__global__";
     static const wasm_u32_t global_name_len = 10;
-    global = (wasmbox_mutable_function_t *) wasmbox_malloc(
-        sizeof(wasmbox_mutable_function_t));
+    global = (wasmbox_mutable_function_t *) wasmbox_slab_alloc(
+        mod->metadata, sizeof(wasmbox_mutable_function_t));
     global->current_block_id = -1;
-    global->base.name = (wasmbox_name_t *) wasmbox_malloc(
-        sizeof(wasmbox_name_t) + global_name_len);
-    global->base.name->len = global_name_len;
-    memcpy(global->base.name->value, global_name, global_name_len);
+    global->base.name = wasmbox_name_new(mod, (const wasm_u8_t *) global_name,
+                                         global_name_len, 1);
 
     mod->global_function = &global->base;
   }
+  wasmbox_arena_t arena = {};
+  global->arena = &arena;
   for (wasm_u64_t i = 0; i < len; i++) {
-    if (parse_global_variable(ins, mod, global) != 0) {
+    if (parse_global_variable(ins, mod, global, i) != 0) {
+      global->arena = NULL;
+      wasmbox_arena_dispose(&arena);
       return -1;
     }
   }
   wasmbox_code_add_exit(global);
-  wasmbox_function_freeze(mod, global);
+  wasmbox_function_freeze(mod, global, NULL);
+  global->arena = NULL;
+  wasmbox_arena_dispose(&arena);
   return 0;
 }
 
+static void wasmbox_module_index_export(wasmbox_module_t *mod,
+                                        wasm_u32_t index) {
+  wasmbox_name_t *name = mod->exports[index].name;
+  wasm_u32_t mask = mod->export_bucket_size - 1;
+  wasm_u32_t i = wasmbox_export_hash(name->value, name->len) & mask;
+  while (mod->export_buckets[i] != 0) {
+    i = (i + 1) & mask;
+  }
+  mod->export_buckets[i] = index + 1;
+}
+
+const wasmbox_export_t *wasmbox_lookup_export(wasmbox_module_t *mod,
+                                              const char *name) {
+  return wasmbox_module_find_export(mod, (const wasm_u8_t *) name,
+                                    strlen(name));
+}
+
 static int parse_export_entry(wasmbox_input_stream_t *ins,
                               wasmbox_module_t *mod) {
-  wasmbox_name_t *name;
-  if (parse_name(ins, &name)) {
+  wasmbox_export_t *export = &mod->exports[mod->export_size];
+  if (parse_name(ins, mod, &export->name)) {
     return -1;
   }
-  wasm_u8_t type = wasmbox_input_stream_read_u8(ins);
-  const char *debug_name;
-  switch (type) {
-    case 0x00: // function
-      debug_name = "func";
-      break;
-    case 0x01: // table
-      debug_name = "table";
-      break;
-    case 0x02: // memory
-      debug_name = "memory";
+  // Counted first, so that dispose frees the name.
+  mod->export_size++;
+  export->kind = wasmbox_input_stream_read_u8(ins);
+  export->index = wasmbox_parse_unsigned_leb128(ins->data + ins->index,
+                                                &ins->index, ins->length);
+  switch (export->kind) {
+    case WASMBOX_EXPORT_FUNCTION:
+      if (export->index >= mod->function_size) {
+        LOG("exported function out of range");
+        return -1;
+      }
+      export->func = mod->functions[export->index];
+      // Functions are printed with the first name they are exported as.
+      if (export->func->name == NULL) {
+        export->func->name = export->name;
+      }
       break;
-    case 0x03: // global
-      debug_name = "global";
+    case WASMBOX_EXPORT_TABLE:
+    case WASMBOX_EXPORT_MEMORY:
+    case WASMBOX_EXPORT_GLOBAL:
       break;
     default:
       LOG("unreachable");
       return -1;
   }
-  wasm_u32_t index = wasmbox_parse_unsigned_leb128(ins->data + ins->index,
-                                                   &ins->index, ins->length);
-  if (type != 0x00) {
-#if 0
-    fprintf(stdout, "- export '%.*s' %s(%d)\n", name->len, name->value, debug_name, index);
-#endif
-    wasmbox_free(name);
-  } else {
-    mod->functions[index]->name = name;
-  }
+  wasmbox_module_index_export(mod, mod->export_size - 1);
   return 0;
 }
 
@@ -1424,6 +5139,22 @@ static int parse_export_section(wasmbox_input_stream_t *ins,
                                 wasmbox_module_t *mod) {
   wasm_u64_t len = wasmbox_parse_unsigned_leb128(ins->data + ins->index,
                                                  &ins->index, ins->length);
+  if (len == 0) {
+    return 0;
+  }
+  if (mod->exports != NULL || len > section_size) {
+    LOG("malformed export section");
+    return -1;
+  }
+  mod->exports =
+      (wasmbox_export_t *) wasmbox_malloc(sizeof(wasmbox_export_t) * len);
+  // Keep the table at most half full.
+  mod->export_bucket_size = 4;
+  while (mod->export_bucket_size < len * 2) {
+    mod->export_bucket_size *= 2;
+  }
+  mod->export_buckets = (wasm_u32_t *) wasmbox_malloc(
+      sizeof(wasm_u32_t) * mod->export_bucket_size);
   for (wasm_u64_t i = 0; i < len; i++) {
     if (parse_export_entry(ins, mod) != 0) {
       return -1;
@@ -1432,150 +5163,469 @@ static int parse_export_section(wasmbox_input_stream_t *ins,
   return 0;
 }
 
-static int parse_start_section(wasmbox_input_stream_t *ins,
-                               wasm_u64_t section_size, wasmbox_module_t *mod) {
-  fprintf(stdout, "start\n");
-  dump_binary(ins, section_size);
-  ins->index += section_size;
-  return 0;
+// Tells if the binary which `ins` reads stays with `mod` once it is loaded,
+// where it can be read again by its offsets.
+static int wasmbox_module_keeps_source(wasmbox_module_t *mod,
+                                       wasmbox_input_stream_t *ins) {
+  return ins->kind == WASMBOX_INPUT_STREAM_MAPPED ||
+         (ins->kind == WASMBOX_INPUT_STREAM_BORROWED && mod->borrow_source);
 }
 
-static int parse_func_index_vector(wasmbox_input_stream_t *ins,
-                                   wasmbox_module_t *mod, wasm_u32_t tableidx,
-                                   wasm_u32_t offset) {
-  wasm_u32_t len = wasmbox_parse_unsigned_leb128(ins->data + ins->index,
-                                                 &ins->index, ins->length);
-  assert(tableidx < mod->table_size);
-  wasmbox_table_t *table = mod->tables[tableidx];
-  if (table == NULL) {
-    table = (wasmbox_table_t *) wasmbox_malloc(sizeof(wasmbox_table_t) +
-                                               sizeof(wasmbox_code_t *) * len);
-    mod->tables[tableidx] = table;
-  }
-  for (wasm_u32_t i = 0; i < len; i++) {
-    wasm_u32_t funcidx = wasmbox_parse_unsigned_leb128(
-        ins->data + ins->index, &ins->index, ins->length);
-    if (funcidx > mod->function_size) {
-      LOG("table: out of index");
-      return -1;
+// Names the functions which have no name yet from the function names of a
+// name section, which ends at `end`. Exports named them first.
+static void parse_function_names(wasmbox_input_stream_t *ins, wasm_u32_t end,
+                                 wasmbox_module_t *mod) {
+  wasm_u64_t len = wasmbox_parse_unsigned_leb128(ins->data + ins->index,
+                                                 &ins->index, end);
+  for (wasm_u64_t i = 0; i < len && ins->index < end; i++) {
+    wasm_u64_t index = wasmbox_parse_unsigned_leb128(ins->data + ins->index,
+                                                     &ins->index, end);
+    wasmbox_name_t *name;
+    if (parse_name(ins, mod, &name) != 0 || ins->index > end) {
+      return;
+    }
+    if (index < mod->function_size && mod->functions[index]->name == NULL) {
+      mod->functions[index]->name = name;
     }
-    table->labels[i].func = mod->functions[funcidx];
   }
-  return 0;
 }
 
-static int parse_element(wasmbox_input_stream_t *ins, wasmbox_module_t *mod,
-                         wasm_u32_t id) {
-  wasm_u8_t type = wasmbox_input_stream_read_u8(ins);
-  uint8_t elemkind = -1;
-  wasm_u32_t tableidx = 0;
-  enum table_mode { TABLE_ACTIVE, TABLE_DECLARATIVE, TABLE_PASSIVE } mode;
-  wasmbox_value_t offset;
-  offset.u32 = 0;
-  switch (type) {
-    case 0x00:
-      // e:expr y*:vec(funcidx)
-      // {type funcref, init ((ref.func y) end)*, mode active
-      //   {table 0, offset e}}
-      if (eval_expression(ins, mod, &offset) < 0) {
-        return -1;
-      }
-      return parse_func_index_vector(ins, mod, tableidx, offset.u32);
-    case 0x01:
-      // et: elemkind y*:vec(funcidx)
-      // {type et, init ((ref.func y) end)*, mode passive}
-      elemkind = wasmbox_input_stream_read_u8(ins);
-      assert(elemkind == 0);
-      return parse_func_index_vector(ins, mod, tableidx, 0);
-    case 0x02:
-      // x:tableidx e:expr et : elemkind y*:vec(funcidx)
-      // {type et, init ((ref.func y) end)*, mode active {table x, offset e}}
-      tableidx = wasmbox_parse_unsigned_leb128(ins->data + ins->index,
-                                               &ins->index, ins->length);
-      if (eval_expression(ins, mod, &offset) < 0) {
-        return -1;
+static int parse_custom_section(wasmbox_input_stream_t *ins,
+                                wasm_u64_t section_size,
+                                wasmbox_module_t *mod) {
+  if (section_size > ins->length - ins->index) {
+    LOG("custom section out of bounds");
+    return -1;
+  }
+  wasm_u32_t end = ins->index + (wasm_u32_t) section_size;
+  dump_binary(ins, mod, section_size);
+  // Other custom sections do not affect the module. A malformed name section
+  // is ignored, as the spec asks.
+  wasm_u64_t len = wasmbox_parse_unsigned_leb128(ins->data + ins->index,
+                                                 &ins->index, end);
+  if (len == 4 && ins->index + len <= end &&
+      memcmp(ins->data + ins->index, "name", 4) == 0) {
+    ins->index += len;
+    while (ins->index < end) {
+      wasm_u8_t id = wasmbox_input_stream_read_u8(ins);
+      wasm_u64_t size = wasmbox_parse_unsigned_leb128(ins->data + ins->index,
+                                                      &ins->index, end);
+      if (ins->index > end || size > end - ins->index) {
+        break;
       }
-      elemkind = wasmbox_input_stream_read_u8(ins);
-      assert(elemkind == 0);
-      return parse_func_index_vector(ins, mod, tableidx, offset.u32);
-    case 0x03:
-      // et: elemkind y*:vec(funcidx)
-      // {type et, init ((ref.func 𝑦) end)*, mode declarative}
-      elemkind = wasmbox_input_stream_read_u8(ins);
-      assert(elemkind == 0);
-      return parse_func_index_vector(ins, mod, tableidx, offset.u32);
-    case 0x04:
-      // e:expr el* :vec(expr)
-      // {type funcref, init el*, mode active {table 0, offset e}}
-      if (eval_expression(ins, mod, &offset) < 0) {
-        return -1;
+      wasm_u32_t next = ins->index + (wasm_u32_t) size;
+      if (id == 1 /* function names */) {
+        if (wasmbox_module_keeps_source(mod, ins) && size > 0) {
+          // Decoded by wasmbox_function_name once a name is asked for.
+          mod->name_offset = ins->index;
+          mod->name_size = (wasm_u32_t) size;
+          mod->source = ins->data;
+          mod->source_kind = ins->kind;
+        } else {
+          parse_function_names(ins, next, mod);
+        }
       }
-      // return parse_expression_vector();
-    case 0x05:
-      // et: reftype el*:vec(expr)
-      // {type et, init el*, mode passive}
-    case 0x06:
-      // x:tableidx e:expr et: reftype el* :vec(expr)
-      // {type et, init el*, mode active {table x, offset e}}
-    case 0x07:
-      // et : reftype e * :vec(expr)
-      break;
-    default:
-      return -1;
+      ins->index = next;
+    }
   }
-  return -1;
-}
-
-static int parse_element_section(wasmbox_input_stream_t *ins,
-                                 wasm_u64_t section_size,
-                                 wasmbox_module_t *mod) {
-  wasm_u32_t len = wasmbox_parse_unsigned_leb128(ins->data + ins->index,
-                                                 &ins->index, ins->length);
-  for (wasm_u32_t i = 0; i < len; i++) {
-    if (parse_element(ins, mod, i)) {
-      return -1;
+#ifdef WASMBOX_VM_USE_SAMPLING_PROFILE
+  // The DWARF line tables are only decoded once a profile is written.
+  if (ins->index < end && ins->index + len <= end) {
+    int borrow = wasmbox_module_keeps_source(mod, ins);
+    wasmbox_debug_sections_add(mod, ins->data + ins->index, (wasm_u32_t) len,
+                               ins->data + ins->index + len,
+                               end - ins->index - (wasm_u32_t) len, borrow);
+    if (borrow && mod->debug_sections != NULL) {
+      mod->source = ins->data;
+      mod->source_kind = ins->kind;
     }
   }
+#endif
+  ins->index = end;
   return 0;
 }
 
-static int parse_code_section(wasmbox_input_stream_t *ins,
-                              wasm_u64_t section_size, wasmbox_module_t *mod) {
+// Names the functions from the name section which parse_custom_section left
+// in the source, once.
+static void wasmbox_module_decode_names(wasmbox_module_t *mod) {
+  if (__atomic_load_n(&mod->name_size, __ATOMIC_ACQUIRE) == 0) {
+    return;
+  }
+  while (__atomic_test_and_set(&mod->name_lock, __ATOMIC_ACQUIRE)) {
+  }
+  if (mod->name_size != 0) {
+    const wasmbox_allocator_t *previous =
+        wasmbox_allocator_enter(mod->allocator);
+    wasmbox_input_stream_t stream = {};
+    stream.data = mod->source;
+    stream.index = mod->name_offset;
+    stream.length = mod->name_offset + mod->name_size;
+    stream.kind = mod->source_kind;
+    parse_function_names(&stream, stream.length, mod);
+    wasmbox_allocator_leave(previous);
+    __atomic_store_n(&mod->name_size, 0, __ATOMIC_RELEASE);
+  }
+  __atomic_clear(&mod->name_lock, __ATOMIC_RELEASE);
+}
+
+wasmbox_name_t *wasmbox_function_name(wasmbox_module_t *mod,
+                                      wasm_u32_t index) {
+  if (index >= mod->function_size) {
+    return NULL;
+  }
+  wasmbox_function_t *func = mod->functions[index];
+  if (func->name == NULL) {
+    wasmbox_module_decode_names(mod);
+  }
+  return func->name;
+}
+
+static int parse_start_section(wasmbox_input_stream_t *ins,
+                               wasm_u64_t section_size, wasmbox_module_t *mod) {
+  wasmbox_log(mod, WASMBOX_LOG_INFO, "start");
+  dump_binary(ins, mod, section_size);
+  ins->index += section_size;
+  return 0;
+}
+
+// Reads an element of a segment, either a funcidx or a constant expression
+// (ref.func x or ref.null t).
+static int parse_element_init(wasmbox_input_stream_t *ins,
+                              wasmbox_module_t *mod, wasm_u8_t is_expr,
+                              wasm_u64_t *ref) {
+  wasm_u8_t op = 0xD2;
+  if (is_expr) {
+    op = wasmbox_input_stream_read_u8(ins);
+  }
+  wasmbox_value_type_t type;
+  switch (op) {
+    case 0xD0: // ref.null t
+      if (parse_value_type(ins, &type) != 0) {
+        return -1;
+      }
+      *ref = 0;
+      break;
+    case 0xD2: { // ref.func x
+      wasm_u64_t funcidx = wasmbox_parse_unsigned_leb128(
+          ins->data + ins->index, &ins->index, ins->length);
+      if (funcidx >= mod->function_size) {
+        LOG("element: undefined function");
+        return -1;
+      }
+      *ref = (wasm_u64_t) (uintptr_t) mod->functions[funcidx];
+      break;
+    }
+    default:
+      LOG("element: unsupported expression");
+      return -1;
+  }
+  if (is_expr && wasmbox_input_stream_read_u8(ins) != 0x0B) {
+    return -1;
+  }
+  return 0;
+}
+
+static int parse_element(wasmbox_input_stream_t *ins, wasmbox_module_t *mod,
+                         wasm_u32_t id) {
+  // Bit 0 tells if the segment is passive or declarative (instead of active),
+  // bit 1 if it has a table index (or is declarative when passive) and bit 2
+  // if its elements are expressions instead of funcidx.
+  wasm_u8_t flags = wasmbox_input_stream_read_u8(ins);
+  if (flags > 0x07) {
+    return -1;
+  }
+  wasm_u8_t is_active = (flags & 0x01) == 0;
+  wasm_u8_t is_expr = (flags & 0x04) != 0;
+  wasm_u32_t tableidx = 0;
+  wasmbox_value_t offset = {};
+  offset.u32 = 0;
+  if (is_active) {
+    if (flags & 0x02) {
+      tableidx = wasmbox_parse_unsigned_leb128(ins->data + ins->index,
+                                               &ins->index, ins->length);
+    }
+    if (eval_expression(ins, mod, WASM_TYPE_I32, &offset) < 0) {
+      return -1;
+    }
+  }
+  if (flags & 0x03) {
+    // elemkind (0x00 for funcref) or reftype
+    wasmbox_input_stream_read_u8(ins);
+  }
   wasm_u32_t len = wasmbox_parse_unsigned_leb128(ins->data + ins->index,
                                                  &ins->index, ins->length);
+  wasmbox_ref_table_t *table = NULL;
+  if (is_active) {
+    if (tableidx >= mod->table_size) {
+      LOG("element: undefined table");
+      return -1;
+    }
+    table = &mod->tables[tableidx];
+    if (offset.u32 > table->size || len > table->size - offset.u32) {
+      LOG("element: out of bounds table access");
+      return -1;
+    }
+  }
   for (wasm_u32_t i = 0; i < len; i++) {
-    if (parse_function(ins, mod, i)) {
+    wasm_u64_t ref;
+    if (parse_element_init(ins, mod, is_expr, &ref) != 0) {
       return -1;
     }
+    // The code of a function is linked at the end of the load.
+    if (table != NULL) {
+      table->entries[offset.u32 + i].ref = ref;
+    }
   }
   return 0;
 }
 
-static int parse_data(wasmbox_input_stream_t *ins, wasmbox_module_t *mod) {
+static int parse_element_section(wasmbox_input_stream_t *ins,
+                                 wasm_u64_t section_size,
+                                 wasmbox_module_t *mod) {
+  wasm_u32_t len = wasmbox_parse_unsigned_leb128(ins->data + ins->index,
+                                                 &ins->index, ins->length);
+  for (wasm_u32_t i = 0; i < len; i++) {
+    if (parse_element(ins, mod, i)) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+#ifdef WASMBOX_PARALLEL_COMPILE_ENABLED
+typedef struct wasmbox_compile_task_t {
+  wasmbox_module_t *mod;
+  /* Module binary, which must not move while the workers run. */
+  wasm_u8_t *data;
+  wasm_u32_t length;
+  /* Start of each body, right after its size. */
+  wasm_u32_t *offsets;
+  wasm_u32_t *sizes;
+  wasm_u32_t size;
+  /* Bodies whose bytes are available, which grows while a module is being
+   * streamed in. */
+  wasm_u32_t ready;
+  /* Next function to be compiled by a worker. */
+  wasm_u32_t next;
+  int failed;
+  pthread_mutex_t lock;
+  pthread_cond_t available;
+  pthread_t *workers;
+  wasm_u32_t started;
+} wasmbox_compile_task_t;
+
+// Returns 0 once every body has been taken by a worker, waiting for bodies
+// which have not arrived yet.
+static int wasmbox_compile_task_take(wasmbox_compile_task_t *task,
+                                     wasm_u32_t *index) {
+  pthread_mutex_lock(&task->lock);
+  while (task->next >= task->ready && task->ready < task->size) {
+    pthread_cond_wait(&task->available, &task->lock);
+  }
+  int taken = task->next < task->size;
+  if (taken) {
+    *index = task->next++;
+  }
+  pthread_mutex_unlock(&task->lock);
+  return taken;
+}
+
+// Compiles function bodies until every body has been taken by a worker. The
+// bodies only share read-only module state, except for the call caches and
+// the allocator statistics which are updated atomically.
+static void *wasmbox_compile_worker(void *data) {
+  wasmbox_compile_task_t *task = (wasmbox_compile_task_t *) data;
+  const wasmbox_allocator_t *previous =
+      wasmbox_allocator_enter(task->mod->allocator);
+  wasmbox_arena_t arena = {};
+  wasm_u32_t i;
+  while (wasmbox_compile_task_take(task, &i)) {
+    wasmbox_input_stream_t stream = {};
+    stream.data = task->data;
+    stream.length = task->length;
+    stream.index = task->offsets[i];
+    wasmbox_mutable_function_t *func =
+        (wasmbox_mutable_function_t *)
+            task->mod->functions[task->mod->import_function_size + i];
+    if (parse_function_body(&stream, task->mod, func, task->sizes[i], &arena,
+                            wasmbox_function_load_stats(task->mod, i)) != 0) {
+      __atomic_store_n(&task->failed, 1, __ATOMIC_RELAXED);
+    }
+  }
+  wasmbox_arena_dispose(&arena);
+  wasmbox_allocator_leave(previous);
+  return NULL;
+}
+
+static wasm_u32_t wasmbox_compile_thread_count(wasmbox_module_t *mod,
+                                               wasm_u32_t bodies) {
+  wasm_u32_t threads = mod->compile_threads;
+  if (threads == 0) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    threads = cpus > 0 ? (wasm_u32_t) cpus : 1;
+  }
+  return threads < bodies ? threads : bodies;
+}
+
+// Starts the workers for `size` bodies in the first `length` bytes of `data`.
+static void wasmbox_compile_task_start(wasmbox_compile_task_t *task,
+                                       wasmbox_module_t *mod, wasm_u8_t *data,
+                                       wasm_u32_t length, wasm_u32_t size) {
+  memset(task, 0, sizeof(*task));
+  task->mod = mod;
+  task->data = data;
+  task->length = length;
+  task->size = size;
+  task->offsets = (wasm_u32_t *) wasmbox_malloc(sizeof(wasm_u32_t) * size);
+  task->sizes = (wasm_u32_t *) wasmbox_malloc(sizeof(wasm_u32_t) * size);
+  pthread_mutex_init(&task->lock, NULL);
+  pthread_cond_init(&task->available, NULL);
+  wasm_u32_t threads = wasmbox_compile_thread_count(mod, size);
+  task->workers = (pthread_t *) wasmbox_malloc(sizeof(pthread_t) * threads);
+  // The loading thread is one of the workers, once every body is added.
+  task->started = 1;
+  for (; task->started < threads; ++task->started) {
+    if (pthread_create(&task->workers[task->started], NULL,
+                       wasmbox_compile_worker, task) != 0) {
+      break;
+    }
+  }
+}
+
+static void wasmbox_compile_task_add(wasmbox_compile_task_t *task,
+                                     wasm_u32_t offset, wasm_u32_t size) {
+  pthread_mutex_lock(&task->lock);
+  task->offsets[task->ready] = offset;
+  task->sizes[task->ready] = size;
+  task->ready++;
+  pthread_cond_signal(&task->available);
+  pthread_mutex_unlock(&task->lock);
+}
+
+// Compiles the remaining bodies and waits for the workers. Bodies which were
+// never added are dropped.
+static int wasmbox_compile_task_finish(wasmbox_compile_task_t *task) {
+  pthread_mutex_lock(&task->lock);
+  task->size = task->ready;
+  pthread_cond_broadcast(&task->available);
+  pthread_mutex_unlock(&task->lock);
+  wasmbox_compile_worker(task);
+  for (wasm_u32_t i = 1; i < task->started; ++i) {
+    pthread_join(task->workers[i], NULL);
+  }
+  pthread_mutex_destroy(&task->lock);
+  pthread_cond_destroy(&task->available);
+  wasmbox_free(task->workers);
+  wasmbox_free(task->offsets);
+  wasmbox_free(task->sizes);
+  return task->failed ? -1 : 0;
+}
+
+static int parse_code_section(wasmbox_input_stream_t *ins,
+                              wasm_u64_t section_size, wasmbox_module_t *mod) {
+#ifdef WASMBOX_CODE_CACHE_ENABLED
+  if (mod->code_cache != NULL) {
+    return wasmbox_code_cache_install(mod, ins, section_size);
+  }
+#endif
+  wasm_u32_t len = wasmbox_parse_unsigned_leb128(ins->data + ins->index,
+                                                 &ins->index, ins->length);
+  if (len == 0) {
+    return 0;
+  }
+  // Find every body first, then compile them on the worker threads.
+  wasmbox_compile_task_t task;
+  wasmbox_compile_task_start(&task, mod, ins->data, ins->length, len);
+  for (wasm_u32_t i = 0; i < len; i++) {
+    wasm_u32_t size = wasmbox_parse_unsigned_leb128(ins->data + ins->index,
+                                                    &ins->index, ins->length);
+    wasmbox_compile_task_add(&task, ins->index, size);
+    ins->index += size;
+  }
+  return wasmbox_compile_task_finish(&task);
+}
+#else  /* WASMBOX_PARALLEL_COMPILE_ENABLED */
+static int parse_code_section(wasmbox_input_stream_t *ins,
+                              wasm_u64_t section_size, wasmbox_module_t *mod) {
+#ifdef WASMBOX_CODE_CACHE_ENABLED
+  if (mod->code_cache != NULL) {
+    return wasmbox_code_cache_install(mod, ins, section_size);
+  }
+#endif
+  wasm_u32_t len = wasmbox_parse_unsigned_leb128(ins->data + ins->index,
+                                                 &ins->index, ins->length);
+  wasmbox_arena_t arena = {};
+  int parsed = 0;
+  for (wasm_u32_t i = 0; i < len && parsed == 0; i++) {
+    parsed = parse_function(ins, mod, i, &arena);
+  }
+  wasmbox_arena_dispose(&arena);
+  return parsed;
+}
+#endif /* WASMBOX_PARALLEL_COMPILE_ENABLED */
+
+static int parse_data(wasmbox_input_stream_t *ins, wasmbox_module_t *mod,
+                      wasm_u32_t segment_index) {
   wasm_u8_t type = wasmbox_input_stream_read_u8(ins);
   wasm_u32_t index = 0;
   wasm_u32_t len = 0;
-  assert(mod->memory_block_size > 0);
-  wasmbox_mutable_function_t func = {};
-  func.current_block_id = -1;
+  if (type != 0x01 && wasmbox_module_check_memory(mod)) {
+    return -1;
+  }
 
-  wasmbox_value_t offset;
+  wasmbox_value_t offset = {};
   offset.u32 = 0;
+  wasm_u64_t addr = 0;
+  wasm_u64_t limit = 0;
+  wasm_u64_t start = 0;
   switch (type) {
     case 0x02: // active with memory index
       index = wasmbox_parse_unsigned_leb128(ins->data + ins->index, &ins->index,
                                             ins->length);
-      assert(index == 0);
+      if (index != 0) {
+        LOG("undefined memory");
+        return -1;
+      }
       /* fallthrough */
     case 0x00: // active without memory index
-      if (eval_expression(ins, mod, &offset) < 0) {
+      if (eval_expression(ins, mod, wasmbox_module_address_type(mod),
+                          &offset) < 0) {
         return -1;
       }
       /* fallthrough */
     case 0x01: // passive
       len = wasmbox_parse_unsigned_leb128(ins->data + ins->index, &ins->index,
                                           ins->length);
-      memcpy(mod->memory_block->data + offset.u32, ins->data + ins->index, len);
+      // The offset of a memory64 is an i64.
+      addr = mod->memory64 ? offset.u64 : offset.u32;
+      limit = (wasm_u64_t) WASMBOX_PAGE_SIZE * mod->memory_block_size;
+      if (len > ins->length - ins->index ||
+          (type != 0x01 && (addr > limit || len > limit - addr))) {
+        LOG("data segment out of bounds");
+        return -1;
+      }
+      start = mod->load_stats != NULL ? wasmbox_now_ns() : 0;
+      if (type == 0x01) {
+        wasmbox_data_segment_t *segment = &mod->data_segments[segment_index];
+        segment->size = segment->length = len;
+        // The bytes of a mapped file or a lent buffer are read where they are
+        // once memory.init runs, and only then brought into memory.
+        if (wasmbox_module_keeps_source(mod, ins)) {
+          segment->data = ins->data + ins->index;
+          segment->borrowed = 1;
+          mod->source = ins->data;
+          mod->source_kind = ins->kind;
+        } else {
+          segment->data = (wasm_u8_t *) wasmbox_malloc_uninit(len);
+          memcpy(segment->data, ins->data + ins->index, len);
+        }
+      } else if (mod->memory_image == NULL) {
+        // The memory image already holds the data of every active segment.
+        memcpy(mod->memory_block->data + addr, ins->data + ins->index, len);
+      }
+      if (mod->load_stats != NULL) {
+        wasmbox_load_phase_add(&mod->load_stats->data_init, start);
+      }
       ins->index += len;
       break;
     default:
@@ -1584,12 +5634,37 @@ static int parse_data(wasmbox_input_stream_t *ins, wasmbox_module_t *mod) {
   return 0;
 }
 
+static int wasmbox_module_alloc_data_segments(wasmbox_module_t *mod,
+                                              wasm_u32_t size) {
+  if (mod->data_segments != NULL) {
+    return mod->data_segment_size == size ? 0 : -1;
+  }
+  if (size > 0) {
+    mod->data_segments = (wasmbox_data_segment_t *) wasmbox_malloc(
+        sizeof(wasmbox_data_segment_t) * size);
+  }
+  mod->data_segment_size = size;
+  return 0;
+}
+
+static int parse_data_count_section(wasmbox_input_stream_t *ins,
+                                    wasm_u64_t section_size,
+                                    wasmbox_module_t *mod) {
+  wasm_u32_t len = wasmbox_parse_unsigned_leb128(ins->data + ins->index,
+                                                 &ins->index, ins->length);
+  return wasmbox_module_alloc_data_segments(mod, len);
+}
+
 static int parse_data_section(wasmbox_input_stream_t *ins,
                               wasm_u64_t section_size, wasmbox_module_t *mod) {
   wasm_u32_t len = wasmbox_parse_unsigned_leb128(ins->data + ins->index,
                                                  &ins->index, ins->length);
+  if (wasmbox_module_alloc_data_segments(mod, len)) {
+    LOG("data count mismatch");
+    return -1;
+  }
   for (wasm_u32_t i = 0; i < len; i++) {
-    if (parse_data(ins, mod)) {
+    if (parse_data(ins, mod, i)) {
       return -1;
     }
   }
@@ -1612,17 +5687,40 @@ static const struct section_parser section_parser[] = {
     {"global", parse_global_section}, {"export", parse_export_section},
     {"start", parse_start_section},   {"element", parse_element_section},
     {"code", parse_code_section},     {"data", parse_data_section},
+    {"datacount", parse_data_count_section},
 };
 
+// Runs the parser of a section, timing it if load stats are recorded.
+static int wasmbox_parse_section_body(wasmbox_input_stream_t *ins,
+                                      wasm_u8_t section_type,
+                                      wasm_u64_t section_size,
+                                      wasmbox_module_t *mod) {
+#ifdef WASMBOX_VM_USE_SAMPLING_PROFILE
+  if (section_type == 10 /* code */) {
+    mod->code_section_offset = ins->index;
+  }
+#endif
+  if (mod->load_stats == NULL) {
+    return section_parser[section_type].func(ins, section_size, mod);
+  }
+  wasm_u64_t start = wasmbox_now_ns();
+  int parsed = section_parser[section_type].func(ins, section_size, mod);
+  wasmbox_load_phase_add(&mod->load_stats->sections[section_type], start);
+  return parsed;
+}
+
 static int parse_section(wasmbox_input_stream_t *ins, wasmbox_module_t *mod) {
   wasm_u8_t section_type = wasmbox_input_stream_read_u8(ins);
-  assert(0 <= section_type && section_type <= 11);
+  if (section_type > 12) {
+    LOG("unknown section");
+    return -1;
+  }
   wasm_u64_t section_size = wasmbox_parse_unsigned_leb128(
       ins->data + ins->index, &ins->index, ins->length);
 #if 0
   fprintf(stdout, "type=%d(%s), section_size=%llu\n", section_type, section_parser[section_type].name, section_size);
 #endif
-  return section_parser[section_type].func(ins, section_size, mod);
+  return wasmbox_parse_section_body(ins, section_type, section_size, mod);
 }
 
 static int parse_module(wasmbox_input_stream_t *ins, wasmbox_module_t *module) {
@@ -1643,87 +5741,1080 @@ static int parse_module(wasmbox_input_stream_t *ins, wasmbox_module_t *module) {
 }
 
 static void wasmbox_module_dump(wasmbox_module_t *mod) {
-  fprintf(stdout, "module %p {\n", mod);
+  char *buf;
+  size_t buf_size;
+  FILE *out = wasmbox_log_open(mod, WASMBOX_LOG_DEBUG, &buf, &buf_size);
+  if (out == NULL) {
+    return;
+  }
+  fprintf(out, "module %p {\n", mod);
   if (mod->memory_block_size > 0) {
-    fprintf(stdout, "  mem(%p, current=%u, max=%u)\n", mod->memory_block,
+    fprintf(out, "  mem(%p, current=%u, max=%u)\n", mod->memory_block,
             mod->memory_block_size, mod->memory_block_capacity);
   }
   if (mod->global_function) {
-    print_function(mod->global_function, 0);
-    fprintf(stdout, "\n");
+    print_function(out, mod->global_function, mod->global_function->name, 0);
+    fprintf(out, "\n");
   }
   if (mod->global_size) {
-    fprintf(stdout, "global variables: %d\n", mod->global_size);
+    fprintf(out, "global variables: %d\n", mod->global_size);
   }
   for (wasm_u32_t i = 0; i < mod->function_size; ++i) {
     wasmbox_function_t *f = mod->functions[i];
-    print_function(f, i);
-    fprintf(stdout, " {\n");
-    wasmbox_dump_function(f->code, f->code + f->code_size, "  ");
-    fprintf(stdout, "}\n");
+    print_function(out, f, wasmbox_function_name(mod, i), i);
+    fprintf(out, " {\n");
+    wasmbox_dump_function(out, mod, f->code, f->code + f->code_size, "  ");
+    fprintf(out, "}\n");
+  }
+  fprintf(out, "}\n");
+  wasmbox_log_close(mod, WASMBOX_LOG_DEBUG, out, &buf);
+}
+
+static int wasmbox_module_record_initial_state(wasmbox_module_t *mod) {
+  if (mod->global_size > 0) {
+    mod->initial_globals =
+        wasmbox_malloc(sizeof(*mod->globals) * mod->global_size);
+    memcpy(mod->initial_globals, mod->globals,
+           sizeof(*mod->globals) * mod->global_size);
+  }
+  mod->initial_tables = wasmbox_tables_copy(mod->tables, mod->table_size);
+  if (wasmbox_memory_track_writes(mod) != 0) {
+    LOG("failed to track memory writes");
+    return -1;
+  }
+  return 0;
+}
+
+// Epoch of the modules which do not have their own.
+static wasm_u64_t wasmbox_epoch;
+
+void wasmbox_epoch_increment(void) {
+  __atomic_fetch_add(&wasmbox_epoch, 1, __ATOMIC_RELAXED);
+}
+
+void wasmbox_set_epoch_deadline(wasmbox_instance_t *instance,
+                                wasm_u64_t ticks) {
+  instance->epoch_deadline =
+      __atomic_load_n(instance->epoch, __ATOMIC_RELAXED) + ticks;
+}
+
+// Prepares `mod` for its sections to be parsed.
+static int wasmbox_module_load_begin(wasmbox_module_t *mod) {
+  if (mod->instance_pool != NULL && mod->instance_slot == NULL) {
+    mod->instance_slot = wasmbox_instance_pool_acquire(mod->instance_pool);
+    if (mod->instance_slot == NULL) {
+      LOG("no free instance slot");
+      return -1;
+    }
+  }
+  wasmbox_virtual_machine_init(mod);
+  if (mod->epoch == NULL) {
+    mod->epoch = &wasmbox_epoch;
+  }
+  if (mod->use_huge_pages && mod->code_region == NULL) {
+    mod->code_region = wasmbox_code_region_create();
+  }
+  // Instances share the metadata of their compiled module.
+  if (mod->compiled == NULL && mod->metadata == NULL) {
+    mod->metadata = wasmbox_slab_create();
+  }
+  if (mod->record_load_stats && mod->load_stats == NULL) {
+    mod->load_stats =
+        (wasmbox_load_stats_t *) wasmbox_malloc(sizeof(wasmbox_load_stats_t));
+    memset(mod->load_stats, 0, sizeof(wasmbox_load_stats_t));
+  }
+  return 0;
+}
+
+#ifndef WASMBOX_VM_USE_LAZY_COMPILE
+typedef struct wasmbox_layout_callee_t {
+  wasmbox_function_t *func;
+  wasm_u32_t index;
+} wasmbox_layout_callee_t;
+
+static int wasmbox_layout_compare_callee(const void *a, const void *b) {
+  uintptr_t x = (uintptr_t) ((const wasmbox_layout_callee_t *) a)->func;
+  uintptr_t y = (uintptr_t) ((const wasmbox_layout_callee_t *) b)->func;
+  return x < y ? -1 : x > y;
+}
+
+// Bytes of the frozen code of `func`, with its constant pool.
+static wasm_u64_t
+wasmbox_function_code_bytes(wasmbox_mutable_function_t *func) {
+  wasm_u64_t size = sizeof(wasmbox_code_t) * func->base.code_size;
+#  ifdef WASMBOX_VM_USE_COMPACT_CODE
+  size += sizeof(wasmbox_code_constant_t) * func->frozen_constant_size;
+#  endif
+  return size;
+}
+
+// Pushes the functions defined by the module which `code` calls directly, the
+// last call first so that the first one is laid out next.
+static wasm_u32_t wasmbox_layout_push_callees(
+    wasmbox_module_t *mod, wasmbox_function_t *func,
+    wasmbox_layout_callee_t *callees, wasm_u8_t *visited, wasm_u32_t *stack,
+    wasm_u32_t top) {
+  wasm_u32_t first = top;
+  for (wasm_u32_t i = 0; i < func->code_size;
+       i += wasmbox_code_length(&func->code[i])) {
+    wasmbox_code_t *code = &func->code[i];
+    if (code->h.opcode != OPCODE_STATIC_CALL &&
+        code->h.opcode != OPCODE_STATIC_TAIL_CALL) {
+      continue;
+    }
+    wasmbox_layout_callee_t key = {WASMBOX_CODE_FUNC(mod, code, op1), 0};
+    wasmbox_layout_callee_t *found = (wasmbox_layout_callee_t *) bsearch(
+        &key, callees, mod->function_size, sizeof(key),
+        wasmbox_layout_compare_callee);
+    if (found != NULL && found->index >= mod->import_function_size &&
+        !visited[found->index]) {
+      visited[found->index] = 1;
+      stack[top++] = found->index;
+    }
+  }
+  for (wasm_u32_t i = first, j = top; i + 1 < j; i++, j--) {
+    wasm_u32_t tmp = stack[i];
+    stack[i] = stack[j - 1];
+    stack[j - 1] = tmp;
   }
-  fprintf(stdout, "}\n");
+  return top;
+}
+
+// Lists the functions defined by `mod` by walking the direct calls depth
+// first from the exports, then from the rest in index order, so that most
+// callees follow their caller.
+static void wasmbox_module_layout_order(wasmbox_module_t *mod,
+                                        wasm_u32_t *order) {
+  wasmbox_layout_callee_t *callees = (wasmbox_layout_callee_t *) wasmbox_malloc(
+      sizeof(wasmbox_layout_callee_t) * mod->function_size);
+  for (wasm_u32_t i = 0; i < mod->function_size; i++) {
+    callees[i].func = mod->functions[i];
+    callees[i].index = i;
+  }
+  qsort(callees, mod->function_size, sizeof(*callees),
+        wasmbox_layout_compare_callee);
+  wasm_u8_t *visited = (wasm_u8_t *) wasmbox_malloc(mod->function_size);
+  wasm_u32_t *stack =
+      (wasm_u32_t *) wasmbox_malloc(sizeof(wasm_u32_t) * mod->function_size);
+  wasm_u32_t size = 0;
+  for (wasm_u32_t i = 0; i < mod->export_size + mod->function_size; i++) {
+    wasm_u32_t root = i - mod->export_size;
+    if (i < mod->export_size) {
+      if (mod->exports[i].kind != WASMBOX_EXPORT_FUNCTION) {
+        continue;
+      }
+      root = mod->exports[i].index;
+    }
+    if (root < mod->import_function_size || visited[root]) {
+      continue;
+    }
+    visited[root] = 1;
+    wasm_u32_t top = 0;
+    stack[top++] = root;
+    while (top > 0) {
+      wasm_u32_t index = stack[--top];
+      order[size++] = index;
+      top = wasmbox_layout_push_callees(mod, mod->functions[index], callees,
+                                        visited, stack, top);
+    }
+  }
+  wasmbox_free(stack);
+  wasmbox_free(visited);
+  wasmbox_free(callees);
+}
+
+// Has the functions of `mod` run the code shared by the modules which
+// compiled equal bodies. Native code belongs to one function and is not
+// shared.
+static void wasmbox_module_deduplicate_code(wasmbox_module_t *mod) {
+  for (wasm_u32_t i = mod->import_function_size; i < mod->function_size; i++) {
+    wasmbox_mutable_function_t *func =
+        (wasmbox_mutable_function_t *) mod->functions[i];
+    if (func->base.code_size == 0 ||
+        func->base.code[0].h.opcode == OPCODE_JIT_ENTRY) {
+      continue;
+    }
+    wasmbox_code_t *code =
+        wasmbox_code_share(func->base.code, func->base.code_size,
+                           wasmbox_function_code_bytes(func));
+    if (code != NULL) {
+      wasmbox_module_free_code(mod, func->base.code);
+      func->base.code = code;
+      func->deduplicated = 1;
+    }
+  }
+}
+
+// Moves the code of the functions of `mod` into one piece of memory in call
+// order, where callers and callees share pages and cache lines. Code from
+// the code cache stays where it is mapped, and shared code where it is.
+static void wasmbox_module_layout_code(wasmbox_module_t *mod) {
+#  ifdef WASMBOX_CODE_CACHE_ENABLED
+  if (mod->code_cache != NULL) {
+    return;
+  }
+#  endif
+  wasm_u32_t defined = mod->function_size - mod->import_function_size;
+  if (defined == 0) {
+    return;
+  }
+  if (mod->deduplicate_code && mod->allocator == NULL &&
+      mod->code_region == NULL) {
+    wasmbox_module_deduplicate_code(mod);
+  }
+  wasm_u64_t total = 0;
+  for (wasm_u32_t i = mod->import_function_size; i < mod->function_size; i++) {
+    wasmbox_mutable_function_t *func =
+        (wasmbox_mutable_function_t *) mod->functions[i];
+    if (!func->deduplicated) {
+      total += WASMBOX_CODE_LAYOUT_ALIGN(wasmbox_function_code_bytes(func));
+    }
+  }
+  if (total == 0) {
+    return;
+  }
+  char *arena = NULL;
+  if (mod->code_region != NULL) {
+    arena = (char *) wasmbox_code_region_alloc(mod->code_region, total);
+  } else {
+    arena = (char *) wasmbox_code_arena_map(total);
+  }
+  if (arena == NULL) {
+    return;
+  }
+  wasm_u32_t *order =
+      (wasm_u32_t *) wasmbox_malloc(sizeof(wasm_u32_t) * defined);
+  wasmbox_module_layout_order(mod, order);
+  char *next = arena;
+  for (wasm_u32_t i = 0; i < defined; i++) {
+    wasmbox_mutable_function_t *func =
+        (wasmbox_mutable_function_t *) mod->functions[order[i]];
+    if (func->deduplicated) {
+      continue;
+    }
+    wasm_u64_t size = wasmbox_function_code_bytes(func);
+    wasmbox_code_t *code = (wasmbox_code_t *) next;
+    memcpy(code, func->base.code, size);
+    wasmbox_code_relocate(code, func->base.code_size,
+                          (char *) code - (char *) func->base.code);
+    wasmbox_module_free_code(mod, func->base.code);
+    func->base.code = code;
+    next += WASMBOX_CODE_LAYOUT_ALIGN(size);
+  }
+  wasmbox_free(order);
+  if (mod->code_region == NULL) {
+    wasmbox_code_arena_seal(arena, total);
+    mod->code_arena = arena;
+    mod->code_arena_size = total;
+  }
+}
+#endif /* WASMBOX_VM_USE_LAZY_COMPILE */
+
+#ifdef WASMBOX_AOT_ENABLED
+// Has the functions `mod->aot` translated run their native code. An entry
+// which does not match its function is ignored.
+static void wasmbox_module_install_aot(wasmbox_module_t *mod) {
+  const wasmbox_aot_module_t *aot = mod->aot;
+  if (aot == NULL || mod->fuel_metering || mod->epoch_interruption ||
+      wasmbox_module_imports_async(mod)) {
+    return;
+  }
+  for (wasm_u32_t i = 0; i < aot->function_size; i++) {
+    const wasmbox_aot_function_t *entry = &aot->functions[i];
+    if (entry->index < mod->import_function_size ||
+        entry->index >= mod->function_size) {
+      continue;
+    }
+    wasmbox_function_t *func = mod->functions[entry->index];
+    if (func->code_size == 0 ||
+        func->type->argument_size != entry->argument_size ||
+        func->type->return_size != entry->return_size ||
+        func->frame_size < entry->frame_size) {
+      continue;
+    }
+    func->code[0].h.opcode = OPCODE_JIT_ENTRY;
+    func->code[0].op0.value.u64 = (wasm_u64_t) (uintptr_t) entry->entry;
+    func->code[0].op1.index = 0;
+#  ifdef WASMBOX_VM_USE_CODE_LABEL
+    void **labels = (void **) mod->shared_code[0].op0.value.u64;
+    func->code[0].h.label = labels[OPCODE_JIT_ENTRY];
+#  endif
+  }
+}
+#endif
+
+// Initializes the globals once every section is parsed, and closes
+// `snapshot`.
+static int wasmbox_module_load_end(wasmbox_module_t *mod, int parsed,
+                                   wasmbox_snapshot_t *snapshot) {
+  if (mod->code_region != NULL) {
+    mod->huge_pages |= wasmbox_code_region_huge_pages(mod->code_region);
+  }
+  if (parsed == 0) {
+#ifdef WASMBOX_AOT_ENABLED
+    wasmbox_module_install_aot(mod);
+#endif
+#ifndef WASMBOX_VM_USE_LAZY_COMPILE
+    wasmbox_module_layout_code(mod);
+#endif
+    wasmbox_module_link_tables(mod);
+    wasmbox_module_dump(mod);
+    if (mod->snapshot_file != NULL) {
+      parsed = wasmbox_snapshot_restore_globals(snapshot, mod);
+    } else if (mod->global_function != NULL &&
+               mod->global_function->code != NULL) {
+      wasm_u64_t start = mod->load_stats != NULL ? wasmbox_now_ns() : 0;
+      wasmbox_eval_function(mod, mod->global_function->code, mod->globals);
+      if (mod->load_stats != NULL) {
+        wasmbox_load_phase_add(&mod->load_stats->global_init, start);
+      }
+    }
+  }
+  wasmbox_snapshot_close(snapshot);
+  if (parsed == 0 && mod->resettable) {
+    parsed = wasmbox_module_record_initial_state(mod);
+  }
+  return parsed;
+}
+
+// Keeps the binary for lazy compilation or for the passive data segments
+// which point into it if `mod` was loaded, or closes it.
+static void wasmbox_module_keep_source(wasmbox_module_t *mod, int parsed,
+                                       wasmbox_input_stream_t *ins) {
+  if (parsed == 0) {
+#ifdef WASMBOX_VM_USE_LAZY_COMPILE
+    // Function bodies are parsed from the source when they are first called.
+    if (ins->kind == WASMBOX_INPUT_STREAM_BORROWED && !mod->borrow_source) {
+      wasm_u8_t *copy = (wasm_u8_t *) wasmbox_malloc_uninit(ins->length);
+      memcpy(copy, ins->data, ins->length);
+      ins->data = copy;
+      ins->kind = WASMBOX_INPUT_STREAM_HEAP;
+    }
+    mod->source = ins->data;
+    mod->source_kind = ins->kind;
+    return;
+#else
+    if (mod->source != NULL) {
+      return;
+    }
+#endif
+  }
+  mod->source = NULL;
+  mod->name_size = 0;
+  wasmbox_input_stream_close(ins);
+}
+
+static int wasmbox_load_module_in_scope(wasmbox_module_t *mod,
+                                        wasmbox_input_stream_t *ins) {
+  if (wasmbox_module_load_begin(mod) != 0) {
+    wasmbox_input_stream_close(ins);
+    return -1;
+  }
+  mod->source_size = ins->length;
+  mod->source_hash = wasmbox_code_cache_hash(ins->data, ins->length);
+  wasmbox_snapshot_t snapshot = {};
+  if (mod->snapshot_file != NULL &&
+      wasmbox_snapshot_open(&snapshot, mod) != 0) {
+    wasmbox_snapshot_close(&snapshot);
+    wasmbox_input_stream_close(ins);
+    return -1;
+  }
+#ifdef WASMBOX_CODE_CACHE_ENABLED
+  if (mod->code_cache_dir != NULL) {
+    wasmbox_code_cache_open(mod, mod->source_hash);
+  }
+#endif
+  int parsed = parse_module(ins, mod);
+#ifdef WASMBOX_CODE_CACHE_ENABLED
+  // A cache which cannot be written only costs the next load a compilation.
+  if (parsed == 0 && mod->code_cache_dir != NULL && mod->code_cache == NULL) {
+    wasmbox_code_cache_save(mod, mod->source_hash);
+  }
+#endif
+  parsed = wasmbox_module_load_end(mod, parsed, &snapshot);
+  wasmbox_module_keep_source(mod, parsed, ins);
+  return parsed;
+}
+
+// `start` is when the load started, before the file was read if there is
+// one.
+static int wasmbox_load_module_from_stream(wasmbox_module_t *mod,
+                                           wasmbox_input_stream_t *ins,
+                                           wasm_u64_t start) {
+  const wasmbox_allocator_t *previous = wasmbox_allocator_enter(mod->allocator);
+  int parsed = wasmbox_load_module_in_scope(mod, ins);
+  wasmbox_allocator_leave(previous);
+  if (mod->load_stats != NULL) {
+    wasmbox_load_phase_add(&mod->load_stats->total, start);
+  }
+  return parsed;
 }
 
 int wasmbox_load_module(wasmbox_module_t *mod, const char *file_name,
                         wasm_u16_t file_name_len) {
+  // The binary is read into memory of the allocator of the module.
+  wasm_u64_t start = mod->record_load_stats ? wasmbox_now_ns() : 0;
+  const wasmbox_allocator_t *previous = wasmbox_allocator_enter(mod->allocator);
   wasmbox_input_stream_t stream = {};
   wasmbox_input_stream_t *ins = wasmbox_input_stream_open(&stream, file_name);
+  wasmbox_allocator_leave(previous);
   if (ins == NULL) {
     LOG("Failed to load file");
     return -1;
   }
-  wasmbox_virtual_machine_init(mod);
-  int parsed = parse_module(ins, mod);
-  if (parsed == 0) {
-    wasmbox_module_dump(mod);
-    if (mod->global_function != NULL && mod->global_function->code != NULL) {
-      wasmbox_eval_function(mod, mod->global_function->code, mod->globals);
+  wasm_u64_t read_ns = mod->record_load_stats ? wasmbox_now_ns() - start : 0;
+  int parsed = wasmbox_load_module_from_stream(mod, ins, start);
+  if (mod->load_stats != NULL) {
+    mod->load_stats->file_read.ns += read_ns;
+    mod->load_stats->file_read.count++;
+  }
+  return parsed;
+}
+
+int wasmbox_load_module_from_buffer(wasmbox_module_t *mod,
+                                    const wasm_u8_t *data, size_t len) {
+  if (len > WASM_U32_MAX) {
+    LOG("module too large");
+    return -1;
+  }
+  wasmbox_input_stream_t stream = {};
+  wasm_u64_t start = mod->record_load_stats ? wasmbox_now_ns() : 0;
+  wasmbox_input_stream_open_buffer(&stream, data, (wasm_u32_t) len);
+  return wasmbox_load_module_from_stream(mod, &stream, start);
+}
+
+#define WASMBOX_STREAM_HEADER  (0) /* magic and version */
+#define WASMBOX_STREAM_SECTION (1) /* start of a section */
+#define WASMBOX_STREAM_CODE    (2) /* a function body of the code section */
+#define WASMBOX_STREAM_FAILED  (3)
+
+#define WASMBOX_STREAM_MIN_CAPACITY (4096)
+
+struct wasmbox_stream_t {
+  wasmbox_module_t *mod;
+  /* Bytes received so far. `index` is where parsing resumes. */
+  wasmbox_input_stream_t ins;
+  wasm_u32_t capacity;
+  wasm_u8_t state;
+  /* End of the code section and the bodies compiled so far. */
+  wasm_u32_t code_end;
+  wasm_u32_t body_size;
+  wasm_u32_t body_index;
+#ifdef WASMBOX_PARALLEL_COMPILE_ENABLED
+  /* Running while the code section is received. The buffer is grown to hold
+   * the whole section before it starts, so it does not move under it. */
+  wasmbox_compile_task_t task;
+  wasm_u8_t task_started;
+#else
+  wasmbox_arena_t arena;
+#endif
+};
+
+// Sets `end` past the LEB128 number at `pos` if all of its bytes arrived.
+static int wasmbox_stream_has_leb128(wasmbox_stream_t *stream, wasm_u32_t pos,
+                                     wasm_u32_t *end) {
+  for (wasm_u32_t i = pos; i < stream->ins.length && i < pos + 10; i++) {
+    if ((stream->ins.data[i] & 0x80) == 0) {
+      *end = i + 1;
+      return 1;
     }
   }
-  wasmbox_input_stream_close(ins);
+  return 0;
+}
+
+static void wasmbox_stream_reserve(wasmbox_stream_t *stream,
+                                   wasm_u32_t capacity) {
+  if (capacity <= stream->capacity) {
+    return;
+  }
+  wasm_u32_t new_capacity = stream->capacity * 2;
+  if (new_capacity < WASMBOX_STREAM_MIN_CAPACITY) {
+    new_capacity = WASMBOX_STREAM_MIN_CAPACITY;
+  }
+  if (new_capacity < capacity || new_capacity < stream->capacity) {
+    new_capacity = capacity;
+  }
+  stream->ins.data =
+      stream->ins.data != NULL
+          ? (wasm_u8_t *) wasmbox_realloc(stream->ins.data, new_capacity)
+          : (wasm_u8_t *) wasmbox_malloc_uninit(new_capacity);
+  stream->capacity = new_capacity;
+}
+
+static int wasmbox_stream_end_code(wasmbox_stream_t *stream) {
+#ifdef WASMBOX_PARALLEL_COMPILE_ENABLED
+  if (stream->task_started) {
+    stream->task_started = 0;
+    return wasmbox_compile_task_finish(&stream->task);
+  }
+#endif
+  return 0;
+}
+
+// Compiles the bodies whose bytes are all there.
+static int wasmbox_stream_parse_bodies(wasmbox_stream_t *stream) {
+  wasmbox_input_stream_t *ins = &stream->ins;
+  while (stream->body_index < stream->body_size) {
+    wasm_u32_t start;
+    if (!wasmbox_stream_has_leb128(stream, ins->index, &start)) {
+      return ins->length >= stream->code_end ? -1 : 0;
+    }
+    wasm_u32_t index = ins->index;
+    wasm_u64_t size =
+        wasmbox_parse_unsigned_leb128(ins->data + index, &index, ins->length);
+    if (start + size > stream->code_end) {
+      LOG("function body out of the code section");
+      return -1;
+    }
+    if (start + size > ins->length) {
+      return 0;
+    }
+#ifdef WASMBOX_PARALLEL_COMPILE_ENABLED
+    wasmbox_compile_task_add(&stream->task, start, (wasm_u32_t) size);
+#else
+    if (parse_function(ins, stream->mod, stream->body_index, &stream->arena) !=
+        0) {
+      return -1;
+    }
+#endif
+    ins->index = start + size;
+    stream->body_index++;
+  }
+  ins->index = stream->code_end;
+  stream->state = WASMBOX_STREAM_SECTION;
+  return wasmbox_stream_end_code(stream);
+}
+
+// Parses the next complete section, or the header. Returns 1 if more bytes
+// are needed to make progress.
+static int wasmbox_stream_parse_next(wasmbox_stream_t *stream) {
+  wasmbox_input_stream_t *ins = &stream->ins;
+  wasm_u32_t start, end;
+  switch (stream->state) {
+    case WASMBOX_STREAM_HEADER:
+      if (ins->length < 8) {
+        return 1;
+      }
+      if (parse_magic(ins) != 0 || parse_version(ins) != 0) {
+        LOG("Invalid magic or version number");
+        return -1;
+      }
+      stream->state = WASMBOX_STREAM_SECTION;
+      return 0;
+    case WASMBOX_STREAM_CODE:
+      if (wasmbox_stream_parse_bodies(stream) != 0) {
+        return -1;
+      }
+      return stream->state == WASMBOX_STREAM_CODE;
+    case WASMBOX_STREAM_SECTION:
+      break;
+    default:
+      return -1;
+  }
+  if (ins->index >= ins->length ||
+      !wasmbox_stream_has_leb128(stream, ins->index + 1, &start)) {
+    return 1;
+  }
+  wasm_u8_t section_type = ins->data[ins->index];
+  if (section_type > 12) {
+    LOG("unknown section");
+    return -1;
+  }
+  wasm_u32_t index = ins->index + 1;
+  wasm_u64_t section_size =
+      wasmbox_parse_unsigned_leb128(ins->data + index, &index, ins->length);
+  if (start + section_size > WASM_U32_MAX) {
+    LOG("section too large");
+    return -1;
+  }
+  end = (wasm_u32_t) (start + section_size);
+  if (section_type == 10 /* code */) {
+    wasm_u32_t bodies;
+    if (!wasmbox_stream_has_leb128(stream, start, &bodies)) {
+      return 1;
+    }
+    ins->index = start;
+#ifdef WASMBOX_VM_USE_SAMPLING_PROFILE
+    stream->mod->code_section_offset = start;
+#endif
+    stream->body_size = wasmbox_parse_unsigned_leb128(ins->data + ins->index,
+                                                      &ins->index, ins->length);
+    stream->body_index = 0;
+    stream->code_end = end;
+    stream->state = WASMBOX_STREAM_CODE;
+#ifdef WASMBOX_PARALLEL_COMPILE_ENABLED
+    if (stream->body_size > 0) {
+      wasmbox_stream_reserve(stream, end);
+      wasmbox_compile_task_start(&stream->task, stream->mod, ins->data, end,
+                                 stream->body_size);
+      stream->task_started = 1;
+    }
+#endif
+    return 0;
+  }
+  if (end > ins->length) {
+    return 1;
+  }
+  ins->index = start;
+  if (wasmbox_parse_section_body(ins, section_type, section_size,
+                                 stream->mod) != 0) {
+    return -1;
+  }
+  ins->index = end;
+  return 0;
+}
+
+wasmbox_stream_t *wasmbox_stream_create(wasmbox_module_t *mod) {
+  if (mod->snapshot_file != NULL) {
+    // A snapshot is checked against the hash of the whole module binary.
+    LOG("snapshots need the whole module");
+    return NULL;
+  }
+  const wasmbox_allocator_t *previous = wasmbox_allocator_enter(mod->allocator);
+  wasmbox_stream_t *stream = NULL;
+  if (wasmbox_module_load_begin(mod) == 0) {
+    stream = (wasmbox_stream_t *) wasmbox_malloc(sizeof(wasmbox_stream_t));
+    stream->mod = mod;
+    stream->ins.kind = WASMBOX_INPUT_STREAM_HEAP;
+    stream->state = WASMBOX_STREAM_HEADER;
+  }
+  wasmbox_allocator_leave(previous);
+  return stream;
+}
+
+int wasmbox_stream_feed(wasmbox_stream_t *stream, const wasm_u8_t *bytes,
+                        size_t len) {
+  const wasmbox_allocator_t *previous =
+      wasmbox_allocator_enter(stream->mod->allocator);
+  while (len > 0 && stream->state != WASMBOX_STREAM_FAILED) {
+    size_t room = WASM_U32_MAX - stream->ins.length;
+    if (len > room) {
+      LOG("module too large");
+      stream->state = WASMBOX_STREAM_FAILED;
+      break;
+    }
+    size_t size = len;
+    if (stream->state == WASMBOX_STREAM_CODE &&
+        stream->ins.length + size > stream->code_end) {
+      // Finish the code section before the buffer may move.
+      size = stream->code_end - stream->ins.length;
+    }
+    wasmbox_stream_reserve(stream, stream->ins.length + (wasm_u32_t) size);
+    memcpy(stream->ins.data + stream->ins.length, bytes, size);
+    stream->ins.length += (wasm_u32_t) size;
+    bytes += size;
+    len -= size;
+    int progress;
+    while ((progress = wasmbox_stream_parse_next(stream)) == 0) {
+    }
+    if (progress < 0) {
+      stream->state = WASMBOX_STREAM_FAILED;
+    }
+  }
+  wasmbox_allocator_leave(previous);
+  return stream->state == WASMBOX_STREAM_FAILED ? -1 : 0;
+}
+
+int wasmbox_stream_finish(wasmbox_stream_t *stream) {
+  wasmbox_module_t *mod = stream->mod;
+  const wasmbox_allocator_t *previous = wasmbox_allocator_enter(mod->allocator);
+  int parsed = 0;
+  if (stream->state != WASMBOX_STREAM_SECTION ||
+      stream->ins.index != stream->ins.length) {
+    LOG("truncated module");
+    parsed = -1;
+  }
+  if (wasmbox_stream_end_code(stream) != 0) {
+    parsed = -1;
+  }
+#ifndef WASMBOX_PARALLEL_COMPILE_ENABLED
+  wasmbox_arena_dispose(&stream->arena);
+#endif
+  mod->source_size = stream->ins.length;
+  mod->source_hash =
+      wasmbox_code_cache_hash(stream->ins.data, stream->ins.length);
+  wasmbox_snapshot_t snapshot = {};
+  parsed = wasmbox_module_load_end(mod, parsed, &snapshot);
+  wasmbox_module_keep_source(mod, parsed, &stream->ins);
+  wasmbox_free(stream);
+  wasmbox_allocator_leave(previous);
   return parsed;
 }
 
-int wasmbox_module_dispose(wasmbox_module_t *mod) {
+int wasmbox_instance_reset(wasmbox_module_t *mod) {
+  if (!mod->resettable) {
+    return -1;
+  }
+  if (wasmbox_memory_reset(mod) != 0) {
+    LOG("failed to reset memory");
+    return -1;
+  }
+  if (mod->global_size > 0) {
+    memcpy(mod->globals, mod->initial_globals,
+           sizeof(*mod->globals) * mod->global_size);
+  }
+  for (wasm_u32_t i = 0; i < mod->table_size; ++i) {
+    wasmbox_ref_table_t *table = &mod->tables[i];
+    wasmbox_ref_table_t *initial = &mod->initial_tables[i];
+    // A table only grows, so its entries always have room for the initial ones.
+    table->size = initial->size;
+    memcpy(table->entries, initial->entries,
+           sizeof(wasmbox_table_entry_t) * initial->size);
+  }
+  mod->tables_modified = 0;
+  for (wasm_u32_t i = 0; i < mod->data_segment_size; ++i) {
+    mod->data_segments[i].size = mod->data_segments[i].length;
+  }
+  return 0;
+}
+
+wasmbox_compiled_module_t *
+wasmbox_compiled_module_create(wasmbox_module_t *mod) {
+  // Slots and write tracking are tied to the address of the module.
+  if (mod->instance_slot != NULL || mod->resettable) {
+    LOG("module cannot be shared by instances");
+    return NULL;
+  }
+  // Instances share the functions, which are named before.
+  wasmbox_module_decode_names(mod);
+  wasmbox_memory_image_t *image = NULL;
+  if (mod->memory_block != NULL && !wasmbox_memory_is_shared(mod)) {
+    image = wasmbox_memory_image_create(mod);
+    if (image == NULL) {
+      return NULL;
+    }
+  }
+  const wasmbox_allocator_t *previous = wasmbox_allocator_enter(mod->allocator);
+  wasmbox_compiled_module_t *compiled =
+      (wasmbox_compiled_module_t *) wasmbox_malloc(sizeof(*compiled));
+  wasmbox_allocator_leave(previous);
+  compiled->mod = *mod;
+  compiled->memory_image = image;
+  memset(mod, 0, sizeof(*mod));
+  return compiled;
+}
+
+static int wasmbox_instance_init_memory(wasmbox_instance_t *instance,
+                                        wasmbox_compiled_module_t *compiled) {
+  wasmbox_module_t *mod = &compiled->mod;
+  if (mod->memory_block == NULL) {
+    return 0;
+  }
+  instance->memory64 = mod->memory64;
+  if (wasmbox_memory_is_shared(mod)) {
+    // Instances import the shared memory of the compiled module by default.
+    if (instance->shared_memory == NULL) {
+      instance->shared_memory = mod->shared_memory;
+    }
+    return wasmbox_memory_init_shared(instance, mod->memory_block_size,
+                                      mod->memory_block_capacity);
+  }
+  if (instance->memory_image == NULL) {
+    instance->memory_image = compiled->memory_image;
+  }
+  return wasmbox_memory_init(instance, mod->memory_block_size,
+                             mod->memory_block_capacity);
+}
+
+static int wasmbox_instance_init_in_scope(wasmbox_instance_t *instance,
+                                          wasmbox_compiled_module_t *compiled) {
+  wasmbox_module_t *mod = &compiled->mod;
+  instance->compiled = compiled;
+  if (wasmbox_module_load_begin(instance) != 0) {
+    return -1;
+  }
+  instance->functions = mod->functions;
+  instance->function_size = mod->function_size;
+  instance->import_function_size = mod->import_function_size;
+  instance->types = mod->types;
+  instance->type_size = mod->type_size;
+  instance->tables = wasmbox_tables_copy(mod->tables, mod->table_size);
+  instance->table_size = mod->table_size;
+  instance->exports = mod->exports;
+  instance->export_size = mod->export_size;
+  instance->export_buckets = mod->export_buckets;
+  instance->export_bucket_size = mod->export_bucket_size;
+  instance->global_function = mod->global_function;
+  instance->global_constants = mod->global_constants;
+  instance->global_types = mod->global_types;
+  instance->stack_pointer_global = mod->stack_pointer_global;
+  instance->inline_threshold = mod->inline_threshold;
+#ifdef WASMBOX_VM_USE_LAZY_COMPILE
+  instance->speculation_threshold = mod->speculation_threshold;
+#endif
+  instance->fuel_metering = mod->fuel_metering;
+  instance->epoch_interruption = mod->epoch_interruption;
+  instance->source_size = mod->source_size;
+  instance->source_hash = mod->source_hash;
+  instance->source = mod->source;
+  instance->source_kind = mod->source_kind;
+#ifdef WASMBOX_VM_USE_SAMPLING_PROFILE
+  instance->debug_sections = mod->debug_sections;
+  instance->code_section_offset = mod->code_section_offset;
+#endif
+  if (mod->global_size > 0) {
+    if (instance->instance_slot != NULL) {
+      instance->globals = wasmbox_instance_slot_globals(instance->instance_slot,
+                                                        mod->global_size);
+    }
+    if (instance->globals == NULL) {
+      instance->globals =
+          wasmbox_malloc(sizeof(*instance->globals) * mod->global_size);
+    }
+    memcpy(instance->globals, mod->globals,
+           sizeof(*mod->globals) * mod->global_size);
+    instance->global_size = mod->global_size;
+  }
+  if (mod->data_segment_size > 0) {
+    // The bytes are shared. Only the sizes change with data.drop.
+    instance->data_segments = (wasmbox_data_segment_t *) wasmbox_malloc(
+        sizeof(wasmbox_data_segment_t) * mod->data_segment_size);
+    memcpy(instance->data_segments, mod->data_segments,
+           sizeof(wasmbox_data_segment_t) * mod->data_segment_size);
+    instance->data_segment_size = mod->data_segment_size;
+  }
+  if (wasmbox_instance_init_memory(instance, compiled) != 0) {
+    return -1;
+  }
+  if (instance->resettable) {
+    return wasmbox_module_record_initial_state(instance);
+  }
+  return 0;
+}
+
+int wasmbox_instance_init(wasmbox_instance_t *instance,
+                          wasmbox_compiled_module_t *compiled) {
+  if (instance->allocator == NULL) {
+    instance->allocator = compiled->mod.allocator;
+  }
+  const wasmbox_allocator_t *previous =
+      wasmbox_allocator_enter(instance->allocator);
+  int ret = wasmbox_instance_init_in_scope(instance, compiled);
+  wasmbox_allocator_leave(previous);
+  return ret;
+}
+
+void wasmbox_compiled_module_dispose(wasmbox_compiled_module_t *compiled) {
+  wasmbox_module_dispose(&compiled->mod);
+  if (compiled->memory_image != NULL) {
+    wasmbox_memory_image_dispose(compiled->memory_image);
+  }
+  wasmbox_free(compiled);
+}
+
+int wasmbox_module_load_stats(wasmbox_module_t *mod,
+                              wasmbox_load_stats_t *stats) {
+  if (mod->load_stats == NULL) {
+    return -1;
+  }
+  *stats = *mod->load_stats;
+  for (wasm_u32_t i = 0; i < stats->function_size; i++) {
+    const wasmbox_function_load_stats_t *func = &stats->functions[i];
+    if (func->instructions == 0) {
+      continue;
+    }
+    stats->decode.ns += func->decode_ns;
+    stats->decode.count++;
+    stats->freeze.ns += func->freeze_ns;
+    stats->freeze.count++;
+    stats->link.ns += func->link_ns;
+    stats->link.count++;
+    stats->instructions += func->instructions;
+    stats->moves += func->moves;
+    stats->nops += func->nops;
+    stats->jumps += func->jumps;
+  }
+  return 0;
+}
+
+void wasmbox_module_memory_usage(wasmbox_module_t *mod,
+                                 wasmbox_memory_usage_t *usage) {
+  *usage = (wasmbox_memory_usage_t){};
+  usage->globals = sizeof(*mod->globals) * mod->global_size;
+  for (wasm_u32_t i = 0; i < mod->table_size; ++i) {
+    usage->ref_tables += sizeof(wasmbox_ref_table_t) +
+                         sizeof(wasmbox_table_entry_t) * mod->tables[i].capacity;
+  }
+  usage->memory_committed =
+      (wasm_u64_t) WASMBOX_PAGE_SIZE * wasmbox_memory_size(mod);
+  usage->memory_reserved = wasmbox_memory_reserved_size(mod);
+  usage->stack_high_water = mod->stack_high_water;
+  mod = wasmbox_module_code_owner(mod);
+  for (wasm_u32_t i = 0; i <= mod->function_size; ++i) {
+    wasmbox_mutable_function_t *func =
+        (wasmbox_mutable_function_t *) (i < mod->function_size
+                                            ? mod->functions[i]
+                                            : mod->global_function);
+    if (func == NULL) {
+      continue;
+    }
+    usage->code += sizeof(wasmbox_code_t) * func->base.code_size;
+#ifdef WASMBOX_VM_USE_COMPACT_CODE
+    usage->code +=
+        sizeof(wasmbox_code_constant_t) * func->frozen_constant_size;
+#endif
+  }
   for (wasm_u32_t i = 0; i < mod->type_size; ++i) {
-    wasmbox_free(mod->types[i]);
+    wasmbox_type_t *type = mod->types[i];
+    usage->types +=
+        sizeof(wasmbox_type_t) + sizeof(wasmbox_value_type_t) *
+                                     (type->argument_size + type->return_size);
+  }
+  for (wasm_u32_t i = 0; i < mod->export_size; ++i) {
+    wasmbox_name_t *name = mod->exports[i].name;
+    usage->names += sizeof(wasmbox_name_t);
+    if (name->value == (wasm_u8_t *) (name + 1)) {
+      usage->names += name->len;
+    }
+  }
+}
+
+// Frees what an instance borrows from its compiled module.
+static void wasmbox_module_dispose_code(wasmbox_module_t *mod) {
+  if (mod->types != NULL) {
+    wasmbox_free(mod->types);
   }
-  wasmbox_free(mod->types);
   for (wasm_u32_t i = 0; i < mod->function_size; ++i) {
     wasmbox_mutable_function_t *func =
         (wasmbox_mutable_function_t *) mod->functions[i];
-    if (func->base.name != NULL) {
-      wasmbox_free(func->base.name);
+#ifdef WASMBOX_JIT_ENABLED
+    wasmbox_jit_release_function(&func->base);
+#endif
+#ifdef WASMBOX_VM_USE_LAZY_COMPILE
+    if (func->base.code != func->stub) {
+      wasmbox_free(func->stub);
     }
-    wasmbox_free(func->base.code);
-    for (int j = 0; j < func->table_size; ++j) {
-      wasmbox_free(func->tables[j]);
+    if (func->generic_code != NULL) {
+      wasmbox_module_free_code(mod, func->generic_code);
     }
-    if (func->table_size > 0) {
-      wasmbox_free(func->tables);
+    if (func->baseline_code != NULL) {
+      wasmbox_module_free_code(mod, func->baseline_code);
     }
-    wasmbox_free(func);
-  }
-  wasmbox_free(mod->functions);
-  if (mod->table_size > 0) {
-    for (int i = 0; i < mod->table_size; ++i) {
-      wasmbox_free(mod->tables[i]);
+#endif
+    if (func->deduplicated) {
+      wasmbox_code_unshare(func->base.code);
+    } else {
+      wasmbox_module_free_code(mod, func->base.code);
     }
-    wasmbox_free(mod->tables);
+#ifdef WASMBOX_VM_USE_SAMPLING_PROFILE
+    if (func->code_offsets != NULL) {
+      wasmbox_free(func->code_offsets);
+    }
+#endif
+  }
+  if (mod->functions != NULL) {
+    wasmbox_free(mod->functions);
+  }
+  if (mod->exports != NULL) {
+    wasmbox_free(mod->exports);
+    wasmbox_free(mod->export_buckets);
+  }
+  while (mod->call_caches != NULL) {
+    wasmbox_call_cache_t *cache = mod->call_caches;
+    mod->call_caches = cache->next;
+    wasmbox_free(cache);
   }
   if (mod->global_function) {
     wasmbox_mutable_function_t *func =
         (wasmbox_mutable_function_t *) mod->global_function;
-    wasmbox_free(func->base.name);
-    wasmbox_free(func->base.code);
-    wasmbox_free(func);
+    wasmbox_module_free_code(mod, func->base.code);
+#ifdef WASMBOX_VM_USE_SAMPLING_PROFILE
+    if (func->code_offsets != NULL) {
+      wasmbox_free(func->code_offsets);
+    }
+#endif
+  }
+  if (mod->code_arena != NULL) {
+    wasmbox_code_arena_unmap(mod->code_arena, mod->code_arena_size);
+    mod->code_arena = NULL;
+  }
+  if (mod->load_stats != NULL) {
+    if (mod->load_stats->functions != NULL) {
+      wasmbox_free((void *) mod->load_stats->functions);
+    }
+    wasmbox_free(mod->load_stats);
+    mod->load_stats = NULL;
+  }
+  if (mod->metadata != NULL) {
+    wasmbox_slab_dispose(mod->metadata);
+    mod->metadata = NULL;
+  }
+}
+
+int wasmbox_module_dispose(wasmbox_module_t *mod) {
+  if (mod->compiled == NULL) {
+    wasmbox_module_dispose_code(mod);
   }
   if (mod->global_size > 0) {
-    wasmbox_free(mod->globals);
+    if (mod->instance_slot == NULL ||
+        mod->globals != wasmbox_instance_slot_globals(mod->instance_slot, 0)) {
+      wasmbox_free(mod->globals);
+    }
+    if (mod->compiled == NULL) {
+      wasmbox_free(mod->global_constants);
+      wasmbox_free(mod->global_types);
+    }
+    if (mod->initial_globals != NULL) {
+      wasmbox_free(mod->initial_globals);
+    }
+  }
+  wasmbox_tables_dispose(mod->tables, mod->table_size);
+  wasmbox_tables_dispose(mod->initial_tables, mod->table_size);
+  wasmbox_memory_dispose(mod);
+#ifdef WASMBOX_VM_USE_MEMORY_PROFILE
+  wasmbox_memory_profile_dispose(mod);
+#endif
+#ifdef WASMBOX_VM_USE_OPCODE_PROFILE
+  wasmbox_opcode_profile_dispose(mod);
+#endif
+#ifdef WASMBOX_VM_USE_SAMPLING_PROFILE
+  if (mod->sampling_profile != NULL) {
+    wasmbox_sampling_profile_stop(mod, NULL);
+  }
+#endif
+#ifdef WASMBOX_VM_USE_PERF_COUNTERS
+  wasmbox_perf_counters_stop(mod);
+#endif
+#ifdef WASMBOX_VM_USE_LATENCY_HISTOGRAM
+  wasmbox_latency_histograms_stop(mod);
+#endif
+  if (mod->snapshot_image != NULL) {
+    wasmbox_memory_image_dispose(mod->snapshot_image);
+    mod->memory_image = mod->snapshot_image = NULL;
+  }
+  if (mod->code_region != NULL) {
+    wasmbox_code_region_dispose(mod->code_region);
+    mod->code_region = NULL;
   }
-  if (mod->memory_block) {
-    wasmbox_free(mod->memory_block);
+#ifdef WASMBOX_CODE_CACHE_ENABLED
+  wasmbox_code_cache_dispose(mod);
+#endif
+  if (mod->instance_slot != NULL) {
+    wasmbox_instance_pool_release(mod->instance_slot);
+    mod->instance_slot = NULL;
+  }
+  for (wasm_u32_t i = 0; i < mod->data_segment_size && !mod->compiled; i++) {
+    if (mod->data_segments[i].data != NULL &&
+        !mod->data_segments[i].borrowed) {
+      wasmbox_free(mod->data_segments[i].data);
+    }
+  }
+  if (mod->data_segments != NULL) {
+    wasmbox_free(mod->data_segments);
+  }
+#ifdef WASMBOX_VM_USE_SAMPLING_PROFILE
+  if (mod->debug_sections != NULL && mod->compiled == NULL) {
+    wasmbox_debug_sections_dispose(mod->debug_sections);
+  }
+  mod->debug_sections = NULL;
+#endif
+  if (mod->source != NULL && mod->compiled == NULL) {
+    wasmbox_input_stream_t stream = {};
+    stream.data = mod->source;
+    stream.length = mod->source_size;
+    stream.kind = mod->source_kind;
+    wasmbox_input_stream_close(&stream);
+    mod->source = NULL;
   }
   return 0;
 }
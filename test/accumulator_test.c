@@ -0,0 +1,72 @@
+/*
+ * Copyright (C) 2021 Masahiro Ide
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "wasmbox/wasmbox.h"
+#include "opcodes.h"
+
+#include <assert.h>
+
+#ifdef WASMBOX_VM_USE_ACCUMULATOR
+/*
+ * (func (export "f") (param i32 i32) (result i32)
+ *   (i32.sub (i32.mul (i32.add (local.get 0) (local.get 1)) (i32.const 3))
+ *            (local.get 0)))
+ */
+static const wasm_u8_t module_binary[] = {
+    0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00, 0x01, 0x07, 0x01, 0x60,
+    0x02, 0x7f, 0x7f, 0x01, 0x7f, 0x03, 0x02, 0x01, 0x00, 0x07, 0x05, 0x01,
+    0x01, 0x66, 0x00, 0x00, 0x0a, 0x0f, 0x01, 0x0d, 0x00, 0x20, 0x00, 0x20,
+    0x01, 0x6a, 0x41, 0x03, 0x6c, 0x20, 0x00, 0x6b, 0x0b};
+
+static wasm_s32_t f(wasmbox_module_t *mod, const wasmbox_export_t *export,
+                    wasm_s32_t a, wasm_s32_t b) {
+  wasmbox_value_t args[2] = {{.s32 = a}, {.s32 = b}};
+  wasmbox_value_t result = {};
+  assert(wasmbox_call(mod, export, args, &result) == 0);
+  return result.s32;
+}
+#endif
+
+int main() {
+#ifdef WASMBOX_VM_USE_ACCUMULATOR
+  wasmbox_module_t mod = {};
+  assert(wasmbox_load_module_from_buffer(&mod, module_binary,
+                                         sizeof(module_binary)) == 0);
+  const wasmbox_export_t *export = wasmbox_lookup_export(&mod, "f");
+  assert(f(&mod, export, 5, 7) == 31);
+#  ifndef WASMBOX_VM_USE_JIT
+  // The add leaves its result in the accumulator for the mul next to it.
+  wasmbox_function_t *func = export->func;
+  int marked = 0;
+  for (wasm_u16_t i = 0; i < func->code_size; i++) {
+    if (func->code[i].h.acc & WASMBOX_ACC_OP1) {
+      assert(i > 0);
+      assert(func->code[i].op1.reg == func->code[i - 1].op0.reg);
+      marked++;
+    }
+  }
+  assert(marked > 0);
+#  endif
+  for (wasm_s32_t a = -10; a < 10; a++) {
+    for (wasm_s32_t b = -10; b < 10; b++) {
+      assert(f(&mod, export, a, b) == (a + b) * 3 - a);
+    }
+  }
+  wasmbox_module_dispose(&mod);
+#endif
+  return 0;
+}
@@ -15,12 +15,145 @@
  */
 
 #include "allocator.h"
+#include "wasmbox/wasmbox.h"
 
 #include <assert.h>
+#include <stdlib.h>
+
+typedef struct counter_t {
+  int mallocs;
+  int frees;
+} counter_t;
+
+static void *counting_malloc(void *ctx, size_t size) {
+  ((counter_t *) ctx)->mallocs++;
+  return malloc(size);
+}
+
+static void *counting_realloc(void *ctx, void *ptr, size_t size) {
+  (void) ctx;
+  return realloc(ptr, size);
+}
+
+static void counting_free(void *ctx, void *ptr, size_t size) {
+  assert(size > 0);
+  ((counter_t *) ctx)->frees++;
+  free(ptr);
+}
+
+/*
+ * (func (export "sum") (param i32) (result i32) (local i32)
+ *   (local.set 1 (i32.const 0))
+ *   (block
+ *     (loop
+ *       (br_if 1 (i32.eqz (local.get 0)))
+ *       (local.set 1 (i32.add (local.get 1) (local.get 0)))
+ *       (local.set 0 (i32.sub (local.get 0) (i32.const 1)))
+ *       (br 0)))
+ *   (local.get 1))
+ */
+static const wasm_u8_t module_binary[] = {
+    0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00, 0x01, 0x06, 0x01, 0x60,
+    0x01, 0x7f, 0x01, 0x7f, 0x03, 0x02, 0x01, 0x00, 0x07, 0x07, 0x01, 0x03,
+    0x73, 0x75, 0x6d, 0x00, 0x00, 0x0a, 0x27, 0x01, 0x25, 0x01, 0x01, 0x7f,
+    0x41, 0x00, 0x21, 0x01, 0x02, 0x40, 0x03, 0x40, 0x20, 0x00, 0x45, 0x0d,
+    0x01, 0x20, 0x01, 0x20, 0x00, 0x6a, 0x21, 0x01, 0x20, 0x00, 0x41, 0x01,
+    0x6b, 0x21, 0x00, 0x0c, 0x00, 0x0b, 0x0b, 0x20, 0x01, 0x0b};
+
+static void test_module_allocator() {
+  counter_t counter = {};
+  wasmbox_allocator_t allocator = {counting_malloc, counting_realloc,
+                                   counting_free, &counter};
+  wasmbox_module_t mod = {};
+  mod.allocator = &allocator;
+  assert(wasmbox_load_module_from_buffer(&mod, module_binary,
+                                         sizeof(module_binary)) == 0);
+  assert(counter.mallocs > 0);
+  const wasmbox_export_t *sum = wasmbox_lookup_export(&mod, "sum");
+  wasmbox_value_t args[1] = {{.s32 = 100}};
+  wasmbox_value_t result = {};
+  assert(wasmbox_call(&mod, sum, args, &result) == 0);
+  assert(result.s32 == 5050);
+  wasmbox_module_dispose(&mod);
+  assert(counter.mallocs == counter.frees);
+
+  // Blocks allocated outside of a module go back to libc.
+  void *ptr = wasmbox_malloc(16);
+  assert(counter.mallocs == counter.frees);
+  wasmbox_free(ptr);
+  assert(counter.mallocs == counter.frees);
+}
+
+static void test_stats() {
+  wasmbox_allocation_stats_t before, after;
+  wasmbox_allocation_stats(&before);
+  wasmbox_allocation_sites_enable(1);
+  void *ptr = wasmbox_malloc(1000);
+  ptr = wasmbox_realloc(ptr, 3000);
+  wasmbox_allocation_sites_enable(0);
+  wasmbox_allocation_stats(&after);
+  assert(after.allocations == before.allocations + 1);
+  assert(after.allocated == before.allocated + 3000);
+
+  wasmbox_allocation_site_t sites[4];
+  assert(wasmbox_allocation_sites(sites, 4) == 1);
+  assert(sites[0].caller != NULL && sites[0].count == 1);
+  assert(sites[0].bytes == 3000 && sites[0].live == 3000);
+  // Still counted against its site after tracking is turned off.
+  wasmbox_free(ptr);
+  assert(wasmbox_allocation_sites(sites, 4) == 1);
+  assert(sites[0].live == 0 && sites[0].peak == 3000);
+  wasmbox_allocation_stats(&after);
+  assert(after.frees == before.frees + 1);
+  assert(after.allocated - after.freed == before.allocated - before.freed);
+}
 
 int main() {
+  test_stats();
+  test_module_allocator();
+
   void *ptr = wasmbox_malloc(128);
-  assert(ptr != NULL);
+  assert(ptr != NULL && ((uintptr_t) ptr & 15) == 0);
+  assert(((char *) ptr)[127] == 0);
+  wasmbox_free(ptr);
+  ptr = wasmbox_malloc_uninit(24);
+  assert(ptr != NULL && ((uintptr_t) ptr & 15) == 0);
   wasmbox_free(ptr);
+
+  wasmbox_arena_t arena = {};
+  char *a = (char *) wasmbox_arena_alloc(&arena, 10);
+  memset(a, 'a', 10);
+  // The last allocation grows in place.
+  assert(wasmbox_arena_realloc(&arena, a, 10, 100) == a);
+  char *b = (char *) wasmbox_arena_alloc(&arena, 8);
+  assert(((uintptr_t) b & 7) == 0);
+  // Others are copied.
+  char *c = (char *) wasmbox_arena_realloc(&arena, a, 100, 200);
+  assert(c != a && c[9] == 'a');
+  // Larger than a chunk.
+  assert(wasmbox_arena_alloc(&arena, 1024 * 1024) != NULL);
+  wasmbox_arena_reset(&arena);
+  assert(wasmbox_arena_alloc(&arena, 10) != NULL);
+  wasmbox_arena_dispose(&arena);
+  assert(arena.chunk == NULL);
+
+  wasmbox_slab_t *slab = wasmbox_slab_create();
+  char *s = (char *) wasmbox_slab_alloc(slab, 3);
+  char *t = (char *) wasmbox_slab_alloc(slab, 100000);
+  assert(s[0] == 0 && t[99999] == 0 && ((uintptr_t) t & 7) == 0);
+  wasmbox_slab_dispose(slab);
+
+  wasmbox_code_region_t *region = wasmbox_code_region_create();
+  if (region != NULL) {
+    char *x = (char *) wasmbox_code_region_alloc(region, 10);
+    char *y = (char *) wasmbox_code_region_alloc(region, 10);
+    assert(x != NULL && y == x + 64);
+    assert(x[0] == 0 && wasmbox_code_region_contains(region, y));
+    assert(!wasmbox_code_region_contains(region, &arena));
+    // Larger than a huge page.
+    char *z = (char *) wasmbox_code_region_alloc(region, 3 * 1024 * 1024);
+    assert(z != NULL && wasmbox_code_region_contains(region, z));
+    wasmbox_code_region_dispose(region);
+  }
   return 0;
 }
@@ -0,0 +1,92 @@
+/*
+ * Copyright (C) 2021 Masahiro Ide
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "opcodes.h"
+#include "wasmbox/wasmbox.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifndef WASMBOX_BENCH_DIR
+#  define WASMBOX_BENCH_DIR "bench"
+#endif
+
+/* Translated by WasmBoxAot from the benchmark workloads. */
+extern const wasmbox_aot_module_t wasmbox_aot_fib;
+extern const wasmbox_aot_module_t wasmbox_aot_gemm;
+extern const wasmbox_aot_module_t wasmbox_aot_sha256;
+extern const wasmbox_aot_module_t wasmbox_aot_json_scan;
+
+typedef struct aot_workload_t {
+  const char *name;
+  const wasmbox_aot_module_t *aot;
+  wasm_s32_t arguments[4];
+} aot_workload_t;
+
+static const aot_workload_t workloads[] = {
+    {"fib", &wasmbox_aot_fib, {0, 1, 2, 20}},
+    {"gemm", &wasmbox_aot_gemm, {1, 3, 8, 16}},
+    {"sha256", &wasmbox_aot_sha256, {0, 1, 63, 100}},
+    {"json_scan", &wasmbox_aot_json_scan, {0, 1, 7, 20}},
+};
+
+static int load(wasmbox_module_t *mod, const char *name,
+                const wasmbox_aot_module_t *aot) {
+  char path[1024];
+  snprintf(path, sizeof(path), "%s/%s.wat.wasm", WASMBOX_BENCH_DIR, name);
+  mod->aot = aot;
+  return wasmbox_load_module(mod, path, strlen(path));
+}
+
+// Runs `run` of each workload both interpreted and translated, which must
+// agree.
+int main() {
+  for (size_t i = 0; i < sizeof(workloads) / sizeof(workloads[0]); i++) {
+    const aot_workload_t *w = &workloads[i];
+    wasmbox_module_t interpreted = {};
+    wasmbox_module_t translated = {};
+    assert(load(&interpreted, w->name, NULL) == 0);
+    assert(load(&translated, w->name, w->aot) == 0);
+    assert(w->aot->function_size > 0);
+    int native = 0;
+    for (wasm_u32_t f = 0; f < translated.function_size; f++) {
+      wasmbox_function_t *func = translated.functions[f];
+      native |= func->code_size > 0 &&
+                func->code[0].h.opcode == OPCODE_JIT_ENTRY;
+    }
+    assert(native);
+    const wasmbox_export_t *run =
+        wasmbox_lookup_export(&interpreted, "run");
+    const wasmbox_export_t *aot_run =
+        wasmbox_lookup_export(&translated, "run");
+    assert(run != NULL && aot_run != NULL);
+    for (int k = 0; k < 4; k++) {
+      wasmbox_value_t arg = {.s32 = w->arguments[k]};
+      wasmbox_value_t expected = {}, result = {};
+      assert(wasmbox_call(&interpreted, run, &arg, &expected) == 0);
+      assert(wasmbox_call(&translated, aot_run, &arg, &result) == 0);
+      if (result.s32 != expected.s32) {
+        fprintf(stderr, "%s(%d): expected %d but got %d\n", w->name,
+                arg.s32, expected.s32, result.s32);
+        return 1;
+      }
+    }
+    wasmbox_module_dispose(&interpreted);
+    wasmbox_module_dispose(&translated);
+  }
+  return 0;
+}
@@ -0,0 +1,113 @@
+/*
+ * Copyright (C) 2021 Masahiro Ide
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "wasmbox/wasmbox.h"
+
+#include <assert.h>
+#include <pthread.h>
+
+#ifdef WASMBOX_VM_USE_ASYNC_COMPILE
+/*
+ * (memory 1) (global $g (mut i32) (i32.const 0)) (data (i32.const 0) "\2a")
+ * (func (export "_start") (result i32)
+ *   ;; $g += 1; mem[16] += 1; $g * 100 + mem8[0] + mem[16] * 10000
+ */
+static const wasm_u8_t module_binary[] = {
+    0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00, 0x01, 0x05, 0x01, 0x60,
+    0x00, 0x01, 0x7f, 0x03, 0x02, 0x01, 0x00, 0x05, 0x03, 0x01, 0x00, 0x01,
+    0x06, 0x06, 0x01, 0x7f, 0x01, 0x41, 0x00, 0x0b, 0x07, 0x0a, 0x01, 0x06,
+    0x5f, 0x73, 0x74, 0x61, 0x72, 0x74, 0x00, 0x00, 0x0a, 0x2f, 0x01, 0x2d,
+    0x00, 0x23, 0x00, 0x41, 0x01, 0x6a, 0x24, 0x00, 0x41, 0x10, 0x41, 0x10,
+    0x28, 0x02, 0x00, 0x41, 0x01, 0x6a, 0x36, 0x02, 0x00, 0x23, 0x00, 0x41,
+    0xe4, 0x00, 0x6c, 0x41, 0x00, 0x2d, 0x00, 0x00, 0x6a, 0x41, 0x10, 0x28,
+    0x02, 0x00, 0x41, 0x90, 0xce, 0x00, 0x6c, 0x6a, 0x0b, 0x0b, 0x07, 0x01,
+    0x00, 0x41, 0x00, 0x0b, 0x01, 0x2a};
+
+// Truncated in the middle of the code section.
+static const wasm_u8_t malformed_binary[] = {
+    0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00, 0x01, 0x05, 0x01,
+    0x60, 0x00, 0x01, 0x7f, 0x03, 0x02, 0x01, 0x00, 0x0a, 0x2f, 0x01};
+
+#  define JOBS (8)
+
+typedef struct result_t {
+  pthread_mutex_t lock;
+  pthread_cond_t done;
+  wasm_u32_t count;
+  wasmbox_compiled_module_t *compiled[JOBS + 1];
+} result_t;
+
+static result_t results = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER};
+
+static void on_compiled(void *data, wasmbox_compiled_module_t *compiled) {
+  pthread_mutex_lock(&results.lock);
+  results.compiled[(wasm_u32_t) (uintptr_t) data] = compiled;
+  results.count++;
+  pthread_cond_signal(&results.done);
+  pthread_mutex_unlock(&results.lock);
+}
+
+static wasm_s32_t run(wasmbox_compiled_module_t *compiled) {
+  wasmbox_instance_t instance = {};
+  assert(wasmbox_instance_init(&instance, compiled) == 0);
+  wasmbox_value_t stack[1024] = {};
+  assert(wasmbox_eval_module(&instance, stack) == 0);
+  wasmbox_module_dispose(&instance);
+  return stack[0].s32;
+}
+#endif
+
+int main() {
+#ifdef WASMBOX_VM_USE_ASYNC_COMPILE
+  wasmbox_compiler_t *compiler = wasmbox_compiler_create(2);
+  assert(compiler != NULL);
+  for (uintptr_t i = 0; i < JOBS; i++) {
+    assert(wasmbox_compile_async(compiler, module_binary, sizeof(module_binary),
+                                 NULL, on_compiled, (void *) i) == 0);
+  }
+  assert(wasmbox_compile_async(compiler, malformed_binary,
+                               sizeof(malformed_binary), NULL, on_compiled,
+                               (void *) (uintptr_t) JOBS) == 0);
+
+  // The caller goes on while the modules compile, and picks them up once
+  // the callbacks ran.
+  pthread_mutex_lock(&results.lock);
+  while (results.count < JOBS + 1) {
+    pthread_cond_wait(&results.done, &results.lock);
+  }
+  pthread_mutex_unlock(&results.lock);
+  for (int i = 0; i < JOBS; i++) {
+    assert(results.compiled[i] != NULL);
+    assert(run(results.compiled[i]) == 10142);
+    assert(run(results.compiled[i]) == 10142);
+    wasmbox_compiled_module_dispose(results.compiled[i]);
+  }
+  assert(results.compiled[JOBS] == NULL);
+
+  // Disposing finishes the queued binaries first.
+  results.count = 0;
+  wasmbox_module_t options = {};
+  options.inline_threshold = -1;
+  assert(wasmbox_compile_async(compiler, module_binary, sizeof(module_binary),
+                               &options, on_compiled, (void *) 0) == 0);
+  wasmbox_compiler_dispose(compiler);
+  assert(results.count == 1 && results.compiled[0] != NULL);
+  assert(run(results.compiled[0]) == 10142);
+  wasmbox_compiled_module_dispose(results.compiled[0]);
+#endif
+  return 0;
+}
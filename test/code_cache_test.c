@@ -0,0 +1,99 @@
+/*
+ * Copyright (C) 2021 Masahiro Ide
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "code-cache.h"
+#include "wasmbox/wasmbox.h"
+
+#include <assert.h>
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h> // mkdtemp
+#include <unistd.h>
+
+/*
+ * (type $t (func (param i32) (result i32)))
+ * (table 2 funcref) (elem (i32.const 0) $double $inc)
+ * (func $double (type $t) ...) (func $inc (type $t) ...)
+ * (func $select (param i32) (result i32)  ;; br_table to 10, 20 or 30
+ * (func (export "_start") (result i32)
+ *   ;; sums call_indirect (i & 1) (i) and $select (i & 1) for i in [0, 8)
+ */
+static const wasm_u8_t module_binary[] = {
+    0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00, 0x01, 0x0a, 0x02, 0x60,
+    0x01, 0x7f, 0x01, 0x7f, 0x60, 0x00, 0x01, 0x7f, 0x03, 0x05, 0x04, 0x00,
+    0x00, 0x00, 0x01, 0x04, 0x04, 0x01, 0x70, 0x00, 0x02, 0x07, 0x0a, 0x01,
+    0x06, 0x5f, 0x73, 0x74, 0x61, 0x72, 0x74, 0x00, 0x03, 0x09, 0x08, 0x01,
+    0x00, 0x41, 0x00, 0x0b, 0x02, 0x00, 0x01, 0x0a, 0x59, 0x04, 0x07, 0x00,
+    0x20, 0x00, 0x41, 0x02, 0x6c, 0x0b, 0x07, 0x00, 0x20, 0x00, 0x41, 0x01,
+    0x6a, 0x0b, 0x1a, 0x00, 0x02, 0x40, 0x02, 0x40, 0x02, 0x40, 0x20, 0x00,
+    0x0e, 0x02, 0x00, 0x01, 0x02, 0x0b, 0x41, 0x0a, 0x0f, 0x0b, 0x41, 0x14,
+    0x0f, 0x0b, 0x41, 0x1e, 0x0b, 0x2c, 0x01, 0x02, 0x7f, 0x03, 0x40, 0x20,
+    0x01, 0x20, 0x00, 0x20, 0x00, 0x41, 0x01, 0x71, 0x11, 0x00, 0x00, 0x6a,
+    0x20, 0x00, 0x41, 0x01, 0x71, 0x10, 0x02, 0x6a, 0x21, 0x01, 0x20, 0x00,
+    0x41, 0x01, 0x6a, 0x22, 0x00, 0x41, 0x08, 0x49, 0x0d, 0x00, 0x0b, 0x20,
+    0x01, 0x0b};
+
+// Loads the module and returns whether its code came from the cache. The
+// result must not depend on where the code came from.
+static int load_and_run(const char *dir, wasm_s32_t inline_threshold,
+                        wasm_s32_t *result) {
+  wasmbox_module_t mod = {};
+  mod.code_cache_dir = dir;
+  mod.inline_threshold = inline_threshold;
+  assert(wasmbox_load_module_from_buffer(&mod, module_binary,
+                                         sizeof(module_binary)) == 0);
+  int cached = mod.code_cache != NULL;
+  wasmbox_value_t stack[1024] = {};
+  assert(wasmbox_eval_module(&mod, stack) == 0);
+  if (!cached) {
+    *result = stack[0].s32;
+  }
+  assert(stack[0].s32 == *result);
+  wasmbox_module_dispose(&mod);
+  return cached;
+}
+
+static void remove_dir(const char *dir) {
+  DIR *d = opendir(dir);
+  struct dirent *entry;
+  while ((entry = readdir(d)) != NULL) {
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+    unlink(path);
+  }
+  closedir(d);
+  rmdir(dir);
+}
+
+int main() {
+  char dir[] = "/tmp/wasmbox-code-cache-XXXXXX";
+  assert(mkdtemp(dir) != NULL);
+#ifdef WASMBOX_CODE_CACHE_ENABLED
+  const int enabled = 1;
+#else
+  const int enabled = 0;
+#endif
+  wasm_s32_t result = 0;
+  // Calls are kept out of line so that every kind of relocation is used.
+  assert(load_and_run(dir, -1, &result) == 0);
+  assert(load_and_run(dir, -1, &result) == enabled);
+  assert(load_and_run(dir, -1, &result) == enabled);
+  // Code compiled with other options is compiled again and replaced.
+  assert(load_and_run(dir, 0, &result) == 0);
+  assert(load_and_run(dir, 0, &result) == enabled);
+  remove_dir(dir);
+  return 0;
+}
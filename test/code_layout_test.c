@@ -0,0 +1,64 @@
+/*
+ * Copyright (C) 2021 Masahiro Ide
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "wasmbox/wasmbox.h"
+
+#include <assert.h>
+
+/*
+ * (func $f0 (export "_start") (result i32) call $f2 i32.const 2 i32.mul)
+ * (func $f1 (result i32) i32.const 0)
+ * (func $f2 (result i32) call $f3 i32.const 1 i32.add)
+ * (func $f3 (result i32) i32.const 5)
+ */
+static const wasm_u8_t module_binary[] = {
+    0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00, 0x01, 0x05, 0x01, 0x60,
+    0x00, 0x01, 0x7f, 0x03, 0x05, 0x04, 0x00, 0x00, 0x00, 0x00, 0x07, 0x0a,
+    0x01, 0x06, 0x5f, 0x73, 0x74, 0x61, 0x72, 0x74, 0x00, 0x00, 0x0a, 0x1b,
+    0x04, 0x07, 0x00, 0x10, 0x02, 0x41, 0x02, 0x6c, 0x0b, 0x04, 0x00, 0x41,
+    0x00, 0x0b, 0x07, 0x00, 0x10, 0x03, 0x41, 0x01, 0x6a, 0x0b, 0x04, 0x00,
+    0x41, 0x05, 0x0b};
+
+int main() {
+  wasmbox_module_t mod = {};
+  // Keep the calls, which inlining would remove.
+  mod.inline_threshold = -1;
+  assert(wasmbox_load_module_from_buffer(&mod, module_binary,
+                                         sizeof(module_binary)) == 0);
+#ifndef WASMBOX_VM_USE_LAZY_COMPILE
+  char *arena = (char *) mod.code_arena;
+  assert(arena != NULL);
+  for (int i = 0; i < 4; i++) {
+    char *code = (char *) mod.functions[i]->code;
+    assert(code >= arena && code < arena + mod.code_arena_size);
+  }
+#  ifndef WASMBOX_VM_USE_JIT
+  // Each callee follows its caller, and functions nothing calls come last.
+  // Native code hides the calls of the functions it runs.
+  char *f0 = (char *) mod.functions[0]->code;
+  char *f1 = (char *) mod.functions[1]->code;
+  char *f2 = (char *) mod.functions[2]->code;
+  char *f3 = (char *) mod.functions[3]->code;
+  assert(f0 == arena);
+  assert(f0 < f2 && f2 < f3 && f3 < f1);
+#  endif
+#endif
+  wasmbox_value_t stack[1024] = {};
+  assert(wasmbox_eval_module(&mod, stack) == 0);
+  assert(stack[0].s32 == 12);
+  wasmbox_module_dispose(&mod);
+  return 0;
+}
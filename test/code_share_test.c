@@ -0,0 +1,85 @@
+/*
+ * Copyright (C) 2021 Masahiro Ide
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "wasmbox/wasmbox.h"
+
+#include <assert.h>
+
+/*
+ * (func $sum (export "sum") (param i32) (result i32) (local i32)
+ *   (block (loop
+ *     (br_if 1 (i32.eqz (local.get 0)))
+ *     (local.set 1 (i32.add (local.get 1) (local.get 0)))
+ *     (local.set 0 (i32.sub (local.get 0) (i32.const 1)))
+ *     (br 0)))
+ *   (local.get 1))
+ * (func $sum2 (export "sum2") ...the body of $sum...)
+ * (func (export "scale") (param i32) (result i32)
+ *   (i32.mul (local.get 0) (i32.const 3)))
+ */
+static const wasm_u8_t module_binary[] = {
+    0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00, 0x01, 0x06, 0x01, 0x60,
+    0x01, 0x7f, 0x01, 0x7f, 0x03, 0x04, 0x03, 0x00, 0x00, 0x00, 0x07, 0x16,
+    0x03, 0x03, 0x73, 0x75, 0x6d, 0x00, 0x00, 0x04, 0x73, 0x75, 0x6d, 0x32,
+    0x00, 0x01, 0x05, 0x73, 0x63, 0x61, 0x6c, 0x65, 0x00, 0x02, 0x0a, 0x4d,
+    0x03, 0x21, 0x01, 0x01, 0x7f, 0x02, 0x40, 0x03, 0x40, 0x20, 0x00, 0x45,
+    0x0d, 0x01, 0x20, 0x01, 0x20, 0x00, 0x6a, 0x21, 0x01, 0x20, 0x00, 0x41,
+    0x01, 0x6b, 0x21, 0x00, 0x0c, 0x00, 0x0b, 0x0b, 0x20, 0x01, 0x0b, 0x21,
+    0x01, 0x01, 0x7f, 0x02, 0x40, 0x03, 0x40, 0x20, 0x00, 0x45, 0x0d, 0x01,
+    0x20, 0x01, 0x20, 0x00, 0x6a, 0x21, 0x01, 0x20, 0x00, 0x41, 0x01, 0x6b,
+    0x21, 0x00, 0x0c, 0x00, 0x0b, 0x0b, 0x20, 0x01, 0x0b, 0x07, 0x00, 0x20,
+    0x00, 0x41, 0x03, 0x6c, 0x0b,
+};
+
+static wasm_s32_t call(wasmbox_module_t *mod, const char *name,
+                       wasm_s32_t value) {
+  wasmbox_value_t arg = {.s32 = value}, result = {};
+  assert(wasmbox_call(mod, wasmbox_lookup_export(mod, name), &arg, &result) ==
+         0);
+  return result.s32;
+}
+
+static void load(wasmbox_module_t *mod, wasm_u8_t deduplicate) {
+  mod->deduplicate_code = deduplicate;
+  assert(wasmbox_load_module_from_buffer(mod, module_binary,
+                                         sizeof(module_binary)) == 0);
+}
+
+int main() {
+  wasmbox_module_t a = {}, b = {}, c = {};
+  load(&a, 1);
+  load(&b, 1);
+  load(&c, 0);
+#if !defined(WASMBOX_VM_USE_LAZY_COMPILE) && !defined(WASMBOX_VM_USE_JIT)
+  // Equal bodies run one copy, within a module and across modules, while
+  // the modules which do not ask for it keep their own.
+  assert(a.functions[0]->code == a.functions[1]->code);
+  assert(a.functions[0]->code == b.functions[1]->code);
+  assert(a.functions[2]->code == b.functions[2]->code);
+  assert(a.functions[0]->code != a.functions[2]->code);
+  assert(c.functions[0]->code != a.functions[0]->code);
+  assert(c.functions[0]->code != c.functions[1]->code);
+#endif
+  assert(call(&a, "sum", 10) == 55);
+  assert(call(&b, "scale", 7) == 21);
+  // The shared code outlives the module which compiled it first.
+  wasmbox_module_dispose(&a);
+  assert(call(&b, "sum2", 100) == 5050);
+  assert(call(&c, "sum", 4) == 10);
+  wasmbox_module_dispose(&b);
+  wasmbox_module_dispose(&c);
+  return 0;
+}
@@ -0,0 +1,121 @@
+/*
+ * Copyright (C) 2021 Masahiro Ide
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "wasmbox/wasmbox.h"
+
+#include <assert.h>
+
+/*
+ * (import "env" "read" (func $read (param i32) (result i32)))
+ * (func (export "run") (param i32) (result i32)
+ *   (i32.add (call $read (local.get 0)) (i32.const 1)))
+ * (func (export "add") (param i32 i32) (result i32)
+ *   (i32.add (local.get 0) (local.get 1)))
+ */
+static const wasm_u8_t module_binary[] = {
+    0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00, 0x01, 0x0c, 0x02, 0x60,
+    0x01, 0x7f, 0x01, 0x7f, 0x60, 0x02, 0x7f, 0x7f, 0x01, 0x7f, 0x02, 0x0c,
+    0x01, 0x03, 0x65, 0x6e, 0x76, 0x04, 0x72, 0x65, 0x61, 0x64, 0x00, 0x00,
+    0x03, 0x03, 0x02, 0x00, 0x01, 0x07, 0x0d, 0x02, 0x03, 0x72, 0x75, 0x6e,
+    0x00, 0x01, 0x03, 0x61, 0x64, 0x64, 0x00, 0x02, 0x0a, 0x13, 0x02, 0x09,
+    0x00, 0x20, 0x00, 0x10, 0x00, 0x41, 0x01, 0x6a, 0x0b, 0x07, 0x00, 0x20,
+    0x00, 0x20, 0x01, 0x6a, 0x0b};
+
+#define READERS 3
+
+// Reads which are waiting for their value, like requests in an event loop.
+typedef struct pending_t {
+  wasm_s32_t key;
+  wasmbox_value_t *results;
+} pending_t;
+
+typedef struct loop_t {
+  pending_t pending[READERS];
+  int size;
+} loop_t;
+
+static int read_async(wasmbox_module_t *mod, const wasmbox_value_t *args,
+                      wasmbox_value_t *results, void *data) {
+  loop_t *loop = (loop_t *) data;
+  if (args[0].s32 < 0) {
+    // Answered right away.
+    results[0].s32 = 0;
+    return 0;
+  }
+  loop->pending[loop->size].key = args[0].s32;
+  loop->pending[loop->size].results = results;
+  loop->size++;
+  return 1;
+}
+
+int main() {
+  static const wasmbox_value_type_t read_types[] = {WASM_TYPE_I32,
+                                                    WASM_TYPE_I32};
+  loop_t loop = {};
+  wasmbox_host_function_t host = {};
+  host.module = "env";
+  host.name = "read";
+  host.kind = WASMBOX_HOST_ASYNC;
+  host.entry.async = read_async;
+  host.types = read_types;
+  host.param_size = 1;
+  host.result_size = 1;
+  host.data = &loop;
+
+  wasmbox_module_t mod = {};
+  mod.host_functions = &host;
+  mod.host_function_size = 1;
+  assert(wasmbox_load_module_from_buffer(&mod, module_binary,
+                                         sizeof(module_binary)) == 0);
+  const wasmbox_export_t *run = wasmbox_lookup_export(&mod, "run");
+  const wasmbox_export_t *add = wasmbox_lookup_export(&mod, "add");
+
+  wasmbox_context_t *contexts[READERS];
+  wasmbox_value_t results[READERS] = {};
+  for (int i = 0; i < READERS; i++) {
+    contexts[i] = wasmbox_context_create(&mod, 1024);
+    wasmbox_value_t arg = {.s32 = i};
+    assert(wasmbox_context_call(contexts[i], run, &arg, &results[i]) ==
+           WASMBOX_SUSPENDED);
+    assert(wasmbox_context_call(contexts[i], run, &arg, &results[i]) == -1);
+  }
+  assert(loop.size == READERS);
+
+  // The instance still runs calls of its own while the others wait.
+  wasmbox_value_t args[2] = {{.s32 = 3}, {.s32 = 4}};
+  wasmbox_value_t result = {};
+  assert(wasmbox_call(&mod, add, args, &result) == 0 && result.s32 == 7);
+  args[0].s32 = -1;
+  assert(wasmbox_call(&mod, run, args, &result) == 0 && result.s32 == 1);
+  assert(wasmbox_resume(&mod, &result) == -1);
+
+  for (int i = READERS - 1; i >= 0; i--) {
+    loop.pending[i].results[0].s32 = loop.pending[i].key * 10;
+    assert(wasmbox_context_resume(contexts[i], &results[i]) == 0);
+    assert(results[i].s32 == i * 10 + 1);
+    assert(wasmbox_context_resume(contexts[i], &results[i]) == -1);
+  }
+
+  // A context runs one call after another.
+  args[0].s32 = 5;
+  assert(wasmbox_context_call(contexts[0], add, args, &result) == 0);
+  assert(result.s32 == 9);
+  for (int i = 0; i < READERS; i++) {
+    wasmbox_context_dispose(contexts[i]);
+  }
+  wasmbox_module_dispose(&mod);
+  return 0;
+}
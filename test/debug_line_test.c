@@ -0,0 +1,122 @@
+/*
+ * Copyright (C) 2021 Masahiro Ide
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "debug-line.h"
+#include "wasmbox/wasmbox.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef WASMBOX_VM_USE_SAMPLING_PROFILE
+/*
+ * The fib module of sampling_profile_test, and a .debug_line section of
+ * DWARF 4 which puts it in fib.c:
+ *   line 10: _start           line 5: n < 2: return n
+ *   line 3:  fib prologue     line 6: return fib(n - 1) + fib(n - 2)
+ *   line 4:  if (n < 2)       line 7: }
+ * and a sequence of line 99 at address 0, of a function the linker dropped.
+ */
+static const wasm_u8_t module_binary[] = {
+    0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00, 0x01, 0x0a, 0x02, 0x60,
+    0x00, 0x01, 0x7f, 0x60, 0x01, 0x7f, 0x01, 0x7f, 0x03, 0x03, 0x02, 0x00,
+    0x01, 0x07, 0x0a, 0x01, 0x06, 0x5f, 0x73, 0x74, 0x61, 0x72, 0x74, 0x00,
+    0x00, 0x0a, 0x25, 0x02, 0x06, 0x00, 0x41, 0x1e, 0x10, 0x01, 0x0b, 0x1c,
+    0x00, 0x20, 0x00, 0x41, 0x02, 0x49, 0x04, 0x7f, 0x20, 0x00, 0x05, 0x20,
+    0x00, 0x41, 0x01, 0x6b, 0x10, 0x01, 0x20, 0x00, 0x41, 0x02, 0x6b, 0x10,
+    0x01, 0x6a, 0x0b, 0x0b, 0x00, 0x0d, 0x04, 0x6e, 0x61, 0x6d, 0x65, 0x01,
+    0x06, 0x01, 0x01, 0x03, 0x66, 0x69, 0x62, 0x00, 0x6b, 0x0b, 0x2e, 0x64,
+    0x65, 0x62, 0x75, 0x67, 0x5f, 0x6c, 0x69, 0x6e, 0x65, 0x5b, 0x00, 0x00,
+    0x00, 0x04, 0x00, 0x1d, 0x00, 0x00, 0x00, 0x01, 0x01, 0x01, 0xfb, 0x0e,
+    0x0d, 0x00, 0x01, 0x01, 0x01, 0x01, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00,
+    0x01, 0x00, 0x66, 0x69, 0x62, 0x2e, 0x63, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x05, 0x02, 0x00, 0x00, 0x00, 0x00, 0x03, 0xe2, 0x00, 0x01, 0x02,
+    0x28, 0x00, 0x01, 0x01, 0x00, 0x05, 0x02, 0x01, 0x00, 0x00, 0x00, 0x03,
+    0x09, 0x01, 0x02, 0x07, 0x03, 0x79, 0x01, 0x02, 0x02, 0x03, 0x01, 0x01,
+    0x02, 0x07, 0x03, 0x01, 0x01, 0x02, 0x03, 0x03, 0x01, 0x01, 0x02, 0x0f,
+    0x03, 0x01, 0x01, 0x02, 0x02, 0x00, 0x01, 0x01};
+
+// Returns the line of `address` in the code section, or 0.
+static wasm_u32_t line_at(const wasmbox_line_table_t *lines,
+                          wasm_u32_t address) {
+  const wasmbox_line_row_t *row = wasmbox_line_table_find(lines, address);
+  if (row == NULL) {
+    return 0;
+  }
+  const wasmbox_name_t *file = &lines->files[row->file];
+  assert(file->len == 5 && memcmp(file->value, "fib.c", 5) == 0);
+  return row->line;
+}
+#endif
+
+int main() {
+#ifdef WASMBOX_VM_USE_SAMPLING_PROFILE
+  wasmbox_module_t mod = {};
+  assert(wasmbox_load_module_from_buffer(&mod, module_binary,
+                                         sizeof(module_binary)) == 0);
+  assert(mod.debug_sections != NULL && mod.debug_sections->line_size == 0x5f);
+
+  wasmbox_line_table_t lines;
+  assert(wasmbox_line_table_init(&lines, mod.debug_sections) == 0);
+  assert(line_at(&lines, 0) == 0);
+  assert(line_at(&lines, 1) == 10 && line_at(&lines, 7) == 10);
+  assert(line_at(&lines, 8) == 3 && line_at(&lines, 10) == 4);
+  assert(line_at(&lines, 17) == 5 && line_at(&lines, 25) == 6);
+  assert(line_at(&lines, 36) == 7 && line_at(&lines, 37) == 0);
+  wasmbox_line_table_dispose(&lines);
+
+  // A lent binary is not copied.
+  wasmbox_module_t borrowed = {};
+  borrowed.borrow_source = 1;
+  assert(wasmbox_load_module_from_buffer(&borrowed, module_binary,
+                                         sizeof(module_binary)) == 0);
+  assert(borrowed.debug_sections->borrowed &&
+         borrowed.debug_sections->line > module_binary &&
+         borrowed.debug_sections->line < module_binary + sizeof(module_binary));
+  wasmbox_module_dispose(&borrowed);
+
+  const char *file_name = "debug_line_test.folded";
+  assert(wasmbox_sampling_profile_start(&mod, 1000) == 0);
+  wasmbox_value_t stack[1024] = {};
+  assert(wasmbox_eval_module(&mod, stack) == 0);
+  assert(stack[0].s32 == 832040);
+  int samples = wasmbox_sampling_profile_stop(&mod, file_name);
+  assert(samples > 0);
+  FILE *fp = fopen(file_name, "r");
+  assert(fp != NULL);
+  char line[4096];
+  int total = 0, recursive = 0;
+  while (fgets(line, sizeof(line), fp) != NULL) {
+    char *count = strrchr(line, ' ');
+    assert(count != NULL);
+    total += atoi(count + 1);
+    // Callers are at their call, on the line of the recursive calls. Frames
+    // still in code a function was recompiled from are unknown.
+    recursive |= strncmp(line, "_start (fib.c:10);", 18) == 0 &&
+                 strstr(line, ";fib (fib.c:6);fib") != NULL;
+    assert(strstr(line, ":99") == NULL);
+  }
+  fclose(fp);
+  remove(file_name);
+  assert(total == samples);
+#  ifndef WASMBOX_VM_USE_JIT
+  assert(recursive);
+#  endif
+  wasmbox_module_dispose(&mod);
+#endif
+  return 0;
+}
@@ -0,0 +1,87 @@
+/*
+ * Copyright (C) 2021 Masahiro Ide
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "wasmbox/wasmbox.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <time.h>
+
+/*
+ * (func (export "spin") (loop (br 0)))
+ * (func (export "sum") (param i32) (result i32) (local i32)
+ *   (local.set 1 (i32.const 0))
+ *   (block
+ *     (loop
+ *       (br_if 1 (i32.eqz (local.get 0)))
+ *       (local.set 1 (i32.add (local.get 1) (local.get 0)))
+ *       (local.set 0 (i32.sub (local.get 0) (i32.const 1)))
+ *       (br 0)))
+ *   (local.get 1))
+ */
+static const wasm_u8_t module_binary[] = {
+    0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00, 0x01, 0x09, 0x02, 0x60,
+    0x00, 0x00, 0x60, 0x01, 0x7f, 0x01, 0x7f, 0x03, 0x03, 0x02, 0x00, 0x01,
+    0x07, 0x0e, 0x02, 0x04, 0x73, 0x70, 0x69, 0x6e, 0x00, 0x00, 0x03, 0x73,
+    0x75, 0x6d, 0x00, 0x01, 0x0a, 0x2f, 0x02, 0x07, 0x00, 0x03, 0x40, 0x0c,
+    0x00, 0x0b, 0x0b, 0x25, 0x01, 0x01, 0x7f, 0x41, 0x00, 0x21, 0x01, 0x02,
+    0x40, 0x03, 0x40, 0x20, 0x00, 0x45, 0x0d, 0x01, 0x20, 0x01, 0x20, 0x00,
+    0x6a, 0x21, 0x01, 0x20, 0x00, 0x41, 0x01, 0x6b, 0x21, 0x00, 0x0c, 0x00,
+    0x0b, 0x0b, 0x20, 0x01, 0x0b};
+
+// Ticks the epoch of the process like a timer.
+static void *tick(void *arg) {
+  (void) arg;
+  struct timespec delay = {0, 10 * 1000 * 1000};
+  nanosleep(&delay, NULL);
+  wasmbox_epoch_increment();
+  return NULL;
+}
+
+int main() {
+  wasmbox_module_t mod = {};
+  mod.epoch_interruption = 1;
+  assert(wasmbox_load_module_from_buffer(&mod, module_binary,
+                                         sizeof(module_binary)) == 0);
+  const wasmbox_export_t *spin = wasmbox_lookup_export(&mod, "spin");
+  const wasmbox_export_t *sum = wasmbox_lookup_export(&mod, "sum");
+
+  // A runaway loop is stopped by the timer.
+  wasmbox_set_epoch_deadline(&mod, 1);
+  pthread_t timer;
+  assert(pthread_create(&timer, NULL, tick, NULL) == 0);
+  assert(wasmbox_call(&mod, spin, NULL, NULL) == WASMBOX_INTERRUPTED);
+  assert(pthread_join(timer, NULL) == 0);
+
+  // A module can have its own epoch, and resumes once it has time again.
+  wasm_u64_t epoch = 5;
+  mod.epoch = &epoch;
+  wasmbox_value_t args[1] = {{.s32 = 100}};
+  wasmbox_value_t result = {};
+  wasmbox_set_epoch_deadline(&mod, 1);
+  assert(mod.epoch_deadline == 6);
+  assert(wasmbox_call(&mod, sum, args, &result) == 0);
+  assert(result.s32 == 5050);
+  epoch = 6;
+  result.s32 = 0;
+  assert(wasmbox_call(&mod, sum, args, &result) == WASMBOX_INTERRUPTED);
+  assert(wasmbox_resume(&mod, &result) == WASMBOX_INTERRUPTED);
+  wasmbox_set_epoch_deadline(&mod, 1);
+  assert(wasmbox_resume(&mod, &result) == 0);
+  assert(result.s32 == 5050);
+  wasmbox_module_dispose(&mod);
+  return 0;
+}
@@ -0,0 +1,161 @@
+/*
+ * Copyright (C) 2021 Masahiro Ide
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "memory.h"
+#include "wasmbox/wasmbox.h"
+
+#include <assert.h>
+
+#ifdef WASMBOX_VM_USE_EXECUTOR
+/*
+ * (func (export "sum") (param i32) (result i32) (local i32)
+ *   (local.set 1 (i32.const 0))
+ *   (block
+ *     (loop
+ *       (br_if 1 (i32.eqz (local.get 0)))
+ *       (local.set 1 (i32.add (local.get 1) (local.get 0)))
+ *       (local.set 0 (i32.sub (local.get 0) (i32.const 1)))
+ *       (br 0)))
+ *   (local.get 1))
+ */
+static const wasm_u8_t module_binary[] = {
+    0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00, 0x01, 0x06, 0x01, 0x60,
+    0x01, 0x7f, 0x01, 0x7f, 0x03, 0x02, 0x01, 0x00, 0x07, 0x07, 0x01, 0x03,
+    0x73, 0x75, 0x6d, 0x00, 0x00, 0x0a, 0x27, 0x01, 0x25, 0x01, 0x01, 0x7f,
+    0x41, 0x00, 0x21, 0x01, 0x02, 0x40, 0x03, 0x40, 0x20, 0x00, 0x45, 0x0d,
+    0x01, 0x20, 0x01, 0x20, 0x00, 0x6a, 0x21, 0x01, 0x20, 0x00, 0x41, 0x01,
+    0x6b, 0x21, 0x00, 0x0c, 0x00, 0x0b, 0x0b, 0x20, 0x01, 0x0b};
+
+#  define WORKERS   (4)
+#  define INSTANCES (32)
+#  define CHAIN     (100)
+
+typedef struct chain_t {
+  wasmbox_executor_t *executor;
+  wasmbox_value_t args[1];
+  wasmbox_value_t results[1];
+  int runs;
+} chain_t;
+
+// Submits the job again from its worker until it has run CHAIN times.
+static void chain_done(wasmbox_job_t *job) {
+  chain_t *chain = (chain_t *) job->data;
+  assert(job->status == 0 && chain->results[0].s32 == 55);
+  if (++chain->runs < CHAIN) {
+    chain->results[0].s32 = 0;
+    assert(wasmbox_executor_submit(chain->executor, job) == 0);
+  }
+}
+#endif
+
+int main() {
+#ifdef WASMBOX_VM_USE_EXECUTOR
+  wasmbox_module_t mod = {};
+  mod.fuel_metering = 1;
+  assert(wasmbox_load_module_from_buffer(&mod, module_binary,
+                                         sizeof(module_binary)) == 0);
+  wasmbox_compiled_module_t *compiled = wasmbox_compiled_module_create(&mod);
+  assert(compiled != NULL);
+  static wasmbox_instance_t instances[INSTANCES];
+  for (int i = 0; i < INSTANCES; i++) {
+    assert(wasmbox_instance_init(&instances[i], compiled) == 0);
+  }
+  const wasmbox_export_t *sum = wasmbox_lookup_export(&instances[0], "sum");
+
+  // Long jobs yield every slice of fuel, and run to the end.
+  wasmbox_executor_t *executor = wasmbox_executor_create(WORKERS, 50);
+  assert(executor != NULL);
+  static wasmbox_job_t jobs[INSTANCES];
+  wasmbox_value_t args[INSTANCES];
+  wasmbox_value_t results[INSTANCES];
+  for (int i = 0; i < INSTANCES; i++) {
+    args[i].s32 = 1000 + i;
+    jobs[i] = (wasmbox_job_t){&instances[i], sum, &args[i], &results[i]};
+    assert(wasmbox_executor_submit(executor, &jobs[i]) == 0);
+  }
+  wasmbox_executor_wait(executor);
+  wasmbox_executor_stats_t stats;
+  wasmbox_executor_stats(executor, &stats);
+  for (int i = 0; i < INSTANCES; i++) {
+    wasm_s32_t n = 1000 + i;
+    assert(jobs[i].status == 0 && results[i].s32 == n * (n + 1) / 2);
+    assert(jobs[i].yields > 0 && jobs[i].context == NULL);
+  }
+  assert(stats.jobs == INSTANCES && stats.yields > 0);
+  assert(stats.runs == stats.jobs + stats.yields);
+
+  // A job submitted from a worker runs there unless it is stolen.
+  chain_t chain = {executor, {{.s32 = 10}}, {{.s32 = 0}}, 0};
+  wasmbox_job_t job = {&instances[0], sum, chain.args, chain.results,
+                       chain_done, &chain};
+  assert(wasmbox_executor_submit(executor, &job) == 0);
+  wasmbox_executor_wait(executor);
+  assert(chain.runs == CHAIN);
+  wasmbox_executor_stats(executor, &stats);
+  assert(stats.jobs == INSTANCES + CHAIN);
+
+  // Placed instances run on the workers of their node, which is the only one
+  // here.
+  for (int i = 0; i < INSTANCES; i++) {
+    wasm_u32_t node = wasmbox_executor_place(executor, &instances[i]);
+    assert(instances[i].home_node == node + 1);
+    results[i].s32 = 0;
+    assert(wasmbox_executor_submit(executor, &jobs[i]) == 0);
+  }
+  wasmbox_executor_wait(executor);
+  for (int i = 0; i < INSTANCES; i++) {
+    wasm_s32_t n = 1000 + i;
+    assert(jobs[i].status == 0 && results[i].s32 == n * (n + 1) / 2);
+  }
+#  ifdef WASMBOX_MEMORY_USE_NUMA
+  wasmbox_value_t *stack = wasmbox_stack_reserve(4096);
+  assert(stack != NULL);
+  stack[0].s32 = 1;
+  assert(wasmbox_memory_bind(stack, sizeof(wasmbox_value_t) * 4096, 0) == 0);
+  assert(stack[0].s32 == 1);
+  wasmbox_stack_unreserve(stack, 4096);
+#  endif
+
+  wasmbox_export_t table = {};
+  table.kind = WASMBOX_EXPORT_TABLE;
+  job.function = &table;
+  assert(wasmbox_executor_submit(executor, &job) == -1);
+  wasmbox_executor_dispose(executor);
+
+  // Without a slice, a job which runs out of fuel is done, and continues
+  // when it is submitted again.
+  executor = wasmbox_executor_create(1, 0);
+  assert(executor != NULL);
+  instances[0].fuel = 10;
+  jobs[0].yields = 0;
+  results[0].s32 = 0;
+  assert(wasmbox_executor_submit(executor, &jobs[0]) == 0);
+  wasmbox_executor_wait(executor);
+  assert(jobs[0].status == WASMBOX_OUT_OF_FUEL && jobs[0].context != NULL);
+  instances[0].fuel = 1 << 20;
+  assert(wasmbox_executor_submit(executor, &jobs[0]) == 0);
+  wasmbox_executor_wait(executor);
+  assert(jobs[0].status == 0 && results[0].s32 == 1000 * 1001 / 2);
+  assert(jobs[0].yields == 0 && jobs[0].context == NULL);
+  wasmbox_executor_dispose(executor);
+
+  for (int i = 0; i < INSTANCES; i++) {
+    wasmbox_module_dispose(&instances[i]);
+  }
+  wasmbox_compiled_module_dispose(compiled);
+#endif
+  return 0;
+}
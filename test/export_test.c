@@ -0,0 +1,92 @@
+/*
+ * Copyright (C) 2021 Masahiro Ide
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "wasmbox/wasmbox.h"
+
+#include <assert.h>
+
+/*
+ * (memory 1) (global $g i32 (i32.const 7))
+ * (export "mem" (memory 0)) (export "g" (global $g))
+ * (func (export "_start") (result i32) i32.const 1)
+ * (func (export "add") (export "plus") (param i32 i32) (result i32) ...)
+ */
+static const wasm_u8_t module_binary[] = {
+    0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00, 0x01, 0x0b, 0x02, 0x60,
+    0x00, 0x01, 0x7f, 0x60, 0x02, 0x7f, 0x7f, 0x01, 0x7f, 0x03, 0x03, 0x02,
+    0x00, 0x01, 0x05, 0x03, 0x01, 0x00, 0x01, 0x06, 0x06, 0x01, 0x7f, 0x00,
+    0x41, 0x07, 0x0b, 0x07, 0x21, 0x05, 0x03, 0x6d, 0x65, 0x6d, 0x02, 0x00,
+    0x01, 0x67, 0x03, 0x00, 0x06, 0x5f, 0x73, 0x74, 0x61, 0x72, 0x74, 0x00,
+    0x00, 0x03, 0x61, 0x64, 0x64, 0x00, 0x01, 0x04, 0x70, 0x6c, 0x75, 0x73,
+    0x00, 0x01, 0x0a, 0x0e, 0x02, 0x04, 0x00, 0x41, 0x01, 0x0b, 0x07, 0x00,
+    0x20, 0x00, 0x20, 0x01, 0x6a, 0x0b};
+
+int main() {
+  wasmbox_module_t mod = {};
+  assert(wasmbox_load_module_from_buffer(&mod, module_binary,
+                                         sizeof(module_binary)) == 0);
+  assert(mod.export_size == 5);
+
+  const wasmbox_export_t *memory = wasmbox_lookup_export(&mod, "mem");
+  assert(memory != NULL && memory->kind == WASMBOX_EXPORT_MEMORY);
+  const wasmbox_export_t *global = wasmbox_lookup_export(&mod, "g");
+  assert(global != NULL && global->kind == WASMBOX_EXPORT_GLOBAL);
+  assert(global->index == 0);
+  assert(wasmbox_lookup_export(&mod, "ad") == NULL);
+  assert(wasmbox_lookup_export(&mod, "adds") == NULL);
+
+  const wasmbox_export_t *add = wasmbox_lookup_export(&mod, "add");
+  const wasmbox_export_t *plus = wasmbox_lookup_export(&mod, "plus");
+  assert(add != NULL && add->kind == WASMBOX_EXPORT_FUNCTION);
+  assert(add != plus && add->func == plus->func && add->index == 1);
+  for (int i = 0; i < 3; i++) {
+    wasmbox_value_t stack[1024] = {};
+    WASMBOX_ADD_ARGUMENT(stack, 0, s32, 40);
+    WASMBOX_ADD_ARGUMENT(stack, 1, s32, i);
+    assert(wasmbox_eval_export(&mod, add, stack) == 0);
+    assert(stack[0].s32 == 40 + i);
+  }
+  wasmbox_value_t args[2] = {{.s32 = 3}, {.s32 = 4}};
+  wasmbox_value_t result = {};
+  assert(wasmbox_call(&mod, plus, args, &result) == 0);
+  assert(result.s32 == 7);
+  args[1].s32 = -3;
+  assert(wasmbox_call(&mod, add, args, &result) == 0);
+  assert(result.s32 == 0);
+  assert(wasmbox_call(&mod, global, args, &result) != 0);
+
+  wasmbox_value_t batch_args[16], batch_results[8] = {};
+  for (int i = 0; i < 8; i++) {
+    batch_args[2 * i].s32 = i;
+    batch_args[2 * i + 1].s32 = 100 * i;
+  }
+  assert(wasmbox_call_batch(&mod, add, batch_args, batch_results, 8) == 0);
+  for (int i = 0; i < 8; i++) {
+    assert(batch_results[i].s32 == 101 * i);
+  }
+  const wasmbox_export_t *start = wasmbox_lookup_export(&mod, "_start");
+  assert(wasmbox_call_batch(&mod, start, NULL, batch_results, 3) == 0);
+  assert(batch_results[2].s32 == 1 && batch_results[3].s32 == 303);
+  assert(wasmbox_call_batch(&mod, add, batch_args, batch_results, 0) == 0);
+  assert(wasmbox_call_batch(&mod, global, args, &result, 1) != 0);
+
+  wasmbox_value_t stack[1024] = {};
+  assert(wasmbox_eval_export(&mod, memory, stack) != 0);
+  assert(wasmbox_eval_module(&mod, stack) == 0);
+  assert(stack[0].s32 == 1);
+  wasmbox_module_dispose(&mod);
+  return 0;
+}
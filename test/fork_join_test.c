@@ -0,0 +1,131 @@
+/*
+ * Copyright (C) 2021 Masahiro Ide
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "wasmbox/wasmbox.h"
+
+#include <assert.h>
+
+#ifdef WASMBOX_VM_USE_EXECUTOR
+/*
+ * Adds up the bytes of the range, and increments each of them in place.
+ * (memory 1)
+ * (func (export "process") (param $p i32) (param $n i32) (result i32)
+ *   (local $sum i32) (local $end i32)
+ *   (local.set $end (i32.add (local.get $p) (local.get $n)))
+ *   (block
+ *     (loop
+ *       (br_if 1 (i32.ge_u (local.get $p) (local.get $end)))
+ *       (local.set $sum
+ *         (i32.add (local.get $sum) (i32.load8_u (local.get $p))))
+ *       (i32.store8 (local.get $p)
+ *         (i32.add (i32.load8_u (local.get $p)) (i32.const 1)))
+ *       (local.set $p (i32.add (local.get $p) (i32.const 1)))
+ *       (br 0)))
+ *   (local.get $sum))
+ */
+static const wasm_u8_t module_binary[] = {
+    0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00, 0x01, 0x07, 0x01, 0x60,
+    0x02, 0x7f, 0x7f, 0x01, 0x7f, 0x03, 0x02, 0x01, 0x00, 0x05, 0x03, 0x01,
+    0x00, 0x01, 0x07, 0x0b, 0x01, 0x07, 0x70, 0x72, 0x6f, 0x63, 0x65, 0x73,
+    0x73, 0x00, 0x00, 0x0a, 0x3c, 0x01, 0x3a, 0x01, 0x02, 0x7f, 0x20, 0x00,
+    0x20, 0x01, 0x6a, 0x21, 0x03, 0x02, 0x40, 0x03, 0x40, 0x20, 0x00, 0x20,
+    0x03, 0x4f, 0x0d, 0x01, 0x20, 0x02, 0x20, 0x00, 0x2d, 0x00, 0x00, 0x6a,
+    0x21, 0x02, 0x20, 0x00, 0x20, 0x00, 0x2d, 0x00, 0x00, 0x41, 0x01, 0x6a,
+    0x3a, 0x00, 0x00, 0x20, 0x00, 0x41, 0x01, 0x6a, 0x21, 0x00, 0x0c, 0x00,
+    0x0b, 0x0b, 0x20, 0x02, 0x0b};
+
+#  define OFFSET (1024)
+#  define SIZE   (60000)
+#  define SHARDS (7)
+#endif
+
+int main() {
+#ifdef WASMBOX_VM_USE_EXECUTOR
+  wasmbox_module_t mod = {};
+  assert(wasmbox_load_module_from_buffer(&mod, module_binary,
+                                         sizeof(module_binary)) == 0);
+  const wasmbox_export_t *process = wasmbox_lookup_export(&mod, "process");
+  wasmbox_executor_t *executor = wasmbox_executor_create(4, 0);
+  assert(executor != NULL);
+  wasmbox_shard_t shards[SHARDS];
+  wasmbox_shards_split(shards, SHARDS, OFFSET, SIZE, 16);
+  // Only instances of compiled modules fork.
+  assert(wasmbox_executor_fork_join(executor, &mod, process, shards, SHARDS,
+                                    0) == -1);
+
+  wasmbox_compiled_module_t *compiled = wasmbox_compiled_module_create(&mod);
+  assert(compiled != NULL);
+  wasmbox_instance_t instance = {};
+  assert(wasmbox_instance_init(&instance, compiled) == 0);
+  process = wasmbox_lookup_export(&instance, "process");
+  wasmbox_memory_view_t view;
+  wasmbox_memory_view(&instance, &view);
+  wasm_s32_t expected = 0;
+  for (int i = 0; i < SIZE; i++) {
+    view.base[OFFSET + i] = (wasm_u8_t) (i % 251);
+    expected += i % 251;
+  }
+
+  // The shards cover the range in order, cut at multiples of 16 bytes.
+  wasm_u32_t next = OFFSET;
+  for (int i = 0; i < SHARDS; i++) {
+    assert(shards[i].offset == next && shards[i].size > 0);
+    assert((shards[i].offset - OFFSET) % 16 == 0);
+    next += shards[i].size;
+  }
+  assert(next == OFFSET + SIZE);
+
+  // The stores of the clones stay in their copies of the memory.
+  assert(wasmbox_executor_fork_join(executor, &instance, process, shards,
+                                    SHARDS, 0) == 0);
+  wasm_s32_t sum = 0;
+  for (int i = 0; i < SHARDS; i++) {
+    assert(shards[i].status == 0);
+    sum += shards[i].result.s32;
+  }
+  assert(sum == expected);
+  assert(view.base[OFFSET] == 0 && view.base[OFFSET + 1] == 1);
+
+  // With write back, each range comes back with its stores, and nothing else.
+  assert(wasmbox_executor_fork_join(executor, &instance, process, shards,
+                                    SHARDS, 1) == 0);
+  sum = 0;
+  for (int i = 0; i < SHARDS; i++) {
+    sum += shards[i].result.s32;
+  }
+  assert(sum == expected);
+  for (int i = 0; i < SIZE; i++) {
+    assert(view.base[OFFSET + i] == (wasm_u8_t) (i % 251 + 1));
+  }
+  assert(view.base[OFFSET - 1] == 0 && view.base[OFFSET + SIZE] == 0);
+
+  // The instance itself is left as it was.
+  wasmbox_value_t args[2] = {{.u32 = OFFSET}, {.u32 = 2}};
+  wasmbox_value_t result = {};
+  assert(wasmbox_call(&instance, process, args, &result) == 0);
+  assert(result.s32 == 1 + 2);
+
+  // Shards lie in the memory.
+  shards[SHARDS - 1].size = (wasm_u32_t) view.length;
+  assert(wasmbox_executor_fork_join(executor, &instance, process, shards,
+                                    SHARDS, 0) == -1);
+
+  wasmbox_executor_dispose(executor);
+  wasmbox_module_dispose(&instance);
+  wasmbox_compiled_module_dispose(compiled);
+#endif
+  return 0;
+}
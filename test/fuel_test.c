@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2021 Masahiro Ide
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "wasmbox/wasmbox.h"
+
+#include <assert.h>
+
+/*
+ * (func (export "sum") (param i32) (result i32) (local i32)
+ *   (local.set 1 (i32.const 0))
+ *   (block
+ *     (loop
+ *       (br_if 1 (i32.eqz (local.get 0)))
+ *       (local.set 1 (i32.add (local.get 1) (local.get 0)))
+ *       (local.set 0 (i32.sub (local.get 0) (i32.const 1)))
+ *       (br 0)))
+ *   (local.get 1))
+ */
+static const wasm_u8_t module_binary[] = {
+    0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00, 0x01, 0x06, 0x01, 0x60,
+    0x01, 0x7f, 0x01, 0x7f, 0x03, 0x02, 0x01, 0x00, 0x07, 0x07, 0x01, 0x03,
+    0x73, 0x75, 0x6d, 0x00, 0x00, 0x0a, 0x27, 0x01, 0x25, 0x01, 0x01, 0x7f,
+    0x41, 0x00, 0x21, 0x01, 0x02, 0x40, 0x03, 0x40, 0x20, 0x00, 0x45, 0x0d,
+    0x01, 0x20, 0x01, 0x20, 0x00, 0x6a, 0x21, 0x01, 0x20, 0x00, 0x41, 0x01,
+    0x6b, 0x21, 0x00, 0x0c, 0x00, 0x0b, 0x0b, 0x20, 0x01, 0x0b};
+
+int main() {
+  wasmbox_module_t mod = {};
+  mod.fuel_metering = 1;
+  assert(wasmbox_load_module_from_buffer(&mod, module_binary,
+                                         sizeof(module_binary)) == 0);
+  const wasmbox_export_t *sum = wasmbox_lookup_export(&mod, "sum");
+  wasmbox_value_t args[1] = {{.s32 = 100}};
+  wasmbox_value_t result = {};
+  assert(wasmbox_resume(&mod, &result) == -1);
+
+  // Every iteration of the loop costs the same.
+  mod.fuel = 1 << 20;
+  assert(wasmbox_call(&mod, sum, args, &result) == 0);
+  assert(result.s32 == 5050);
+  wasm_s64_t cost100 = (1 << 20) - mod.fuel;
+  mod.fuel = 1 << 20;
+  args[0].s32 = 101;
+  assert(wasmbox_call(&mod, sum, args, &result) == 0);
+  assert(result.s32 == 5151);
+  wasm_s64_t iteration = (1 << 20) - mod.fuel - cost100;
+  assert(iteration > 0 && cost100 > 100 * iteration);
+
+  // Runs out in the middle of the loop, and picks up where it stopped.
+  args[0].s32 = 100;
+  mod.fuel = cost100 / 3;
+  result.s32 = 0;
+  assert(wasmbox_call(&mod, sum, args, &result) == WASMBOX_OUT_OF_FUEL);
+  assert(mod.fuel >= 0 && mod.fuel < iteration);
+  assert(wasmbox_resume(&mod, &result) == WASMBOX_OUT_OF_FUEL);
+  int stops = 1;
+  while (mod.fuel = iteration * 10,
+         wasmbox_resume(&mod, &result) == WASMBOX_OUT_OF_FUEL) {
+    stops++;
+  }
+  assert(result.s32 == 5050 && stops >= 5);
+  assert(wasmbox_resume(&mod, &result) == -1);
+
+  // The results stay on the stack given to wasmbox_eval_export.
+  wasmbox_value_t stack[64] = {};
+  WASMBOX_ADD_ARGUMENT(stack, 0, s32, 10);
+  mod.fuel = 0;
+  assert(wasmbox_eval_export(&mod, sum, stack) == WASMBOX_OUT_OF_FUEL);
+  mod.fuel = cost100;
+  assert(wasmbox_resume(&mod, NULL) == 0);
+  assert(stack[0].s32 == 55);
+
+  wasmbox_value_t batch_args[2] = {{.s32 = 100}, {.s32 = 100}};
+  wasmbox_value_t batch_results[2] = {};
+  mod.fuel = cost100 + iteration;
+  assert(wasmbox_call_batch(&mod, sum, batch_args, batch_results, 2) ==
+         WASMBOX_OUT_OF_FUEL);
+  assert(batch_results[0].s32 == 5050);
+  assert(wasmbox_resume(&mod, NULL) == -1);
+  wasmbox_module_dispose(&mod);
+  return 0;
+}
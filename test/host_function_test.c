@@ -0,0 +1,112 @@
+/*
+ * Copyright (C) 2021 Masahiro Ide
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "wasmbox/wasmbox.h"
+
+#include <assert.h>
+
+/*
+ * (import "env" "twice" (func $twice (param i32) (result i32)))
+ * (import "env" "sum3" (func $sum3 (param i32 i64 i32) (result i64)))
+ * (export "twice" (func $twice))
+ * (func (export "run") (param i32) (result i32)
+ *   (i32.add (call $twice (local.get 0)) (i32.const 1)))
+ * (func (export "mix") (param i32) (result i64)
+ *   (call $sum3 (local.get 0) (i64.const 10) (i32.const 100)))
+ */
+static const wasm_u8_t module_binary[] = {
+    0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00, 0x01, 0x12, 0x03, 0x60,
+    0x01, 0x7f, 0x01, 0x7f, 0x60, 0x03, 0x7f, 0x7e, 0x7f, 0x01, 0x7e, 0x60,
+    0x01, 0x7f, 0x01, 0x7e, 0x02, 0x18, 0x02, 0x03, 0x65, 0x6e, 0x76, 0x05,
+    0x74, 0x77, 0x69, 0x63, 0x65, 0x00, 0x00, 0x03, 0x65, 0x6e, 0x76, 0x04,
+    0x73, 0x75, 0x6d, 0x33, 0x00, 0x01, 0x03, 0x03, 0x02, 0x00, 0x02, 0x07,
+    0x15, 0x03, 0x05, 0x74, 0x77, 0x69, 0x63, 0x65, 0x00, 0x00, 0x03, 0x72,
+    0x75, 0x6e, 0x00, 0x02, 0x03, 0x6d, 0x69, 0x78, 0x00, 0x03, 0x0a, 0x17,
+    0x02, 0x09, 0x00, 0x20, 0x00, 0x10, 0x00, 0x41, 0x01, 0x6a, 0x0b, 0x0b,
+    0x00, 0x20, 0x00, 0x42, 0x0a, 0x41, 0xe4, 0x00, 0x10, 0x01, 0x0b};
+
+static wasm_s32_t twice(void *data, wasm_s32_t a) {
+  (*(int *) data)++;
+  return a * 2;
+}
+
+static void sum3(wasmbox_module_t *mod, const wasmbox_value_t *args,
+                 wasmbox_value_t *results, void *data) {
+  results[0].s64 = args[0].s32 + args[1].s64 + args[2].s32;
+}
+
+static int load(wasmbox_module_t *mod, const wasmbox_host_function_t *hosts,
+                wasm_u32_t size) {
+  mod->host_functions = hosts;
+  mod->host_function_size = size;
+  return wasmbox_load_module_from_buffer(mod, module_binary,
+                                         sizeof(module_binary));
+}
+
+static const wasmbox_value_type_t sum3_types[] = {
+    WASM_TYPE_I32, WASM_TYPE_I64, WASM_TYPE_I32, WASM_TYPE_I64};
+
+int main() {
+  int calls = 0;
+  wasmbox_host_function_t hosts[2] = {};
+  hosts[0].module = "env";
+  hosts[0].name = "twice";
+  hosts[0].kind = WASMBOX_HOST_I32_I32;
+  hosts[0].entry.i32_i32 = twice;
+  hosts[0].data = &calls;
+  hosts[1].module = "env";
+  hosts[1].name = "sum3";
+  hosts[1].kind = WASMBOX_HOST_FRAME;
+  hosts[1].entry.frame = sum3;
+  hosts[1].types = sum3_types;
+  hosts[1].param_size = 3;
+  hosts[1].result_size = 1;
+
+  wasmbox_module_t mod = {};
+  assert(load(&mod, hosts, 2) == 0);
+  assert(mod.import_function_size == 2 && mod.function_size == 4);
+  wasmbox_value_t arg = {.s32 = 20}, result = {};
+  assert(wasmbox_call(&mod, wasmbox_lookup_export(&mod, "run"), &arg,
+                      &result) == 0);
+  assert(result.s32 == 41 && calls == 1);
+  assert(wasmbox_call(&mod, wasmbox_lookup_export(&mod, "twice"), &arg,
+                      &result) == 0);
+  assert(result.s32 == 40 && calls == 2);
+  arg.s32 = -1;
+  assert(wasmbox_call(&mod, wasmbox_lookup_export(&mod, "mix"), &arg,
+                      &result) == 0);
+  assert(result.s64 == 109);
+  wasmbox_module_dispose(&mod);
+
+  // Every import must be given, with a signature matching its type.
+  wasmbox_module_t missing = {};
+  assert(load(&missing, hosts, 1) != 0);
+  wasmbox_module_dispose(&missing);
+  hosts[1].param_size = 2;
+  wasmbox_module_t fewer = {};
+  assert(load(&fewer, hosts, 2) != 0);
+  wasmbox_module_dispose(&fewer);
+  hosts[1].param_size = 3;
+  hosts[1].types = sum3_types + 1;
+  wasmbox_module_t retyped = {};
+  assert(load(&retyped, hosts, 2) != 0);
+  wasmbox_module_dispose(&retyped);
+  hosts[1].kind = WASMBOX_HOST_I64_I64;
+  wasmbox_module_t mismatch = {};
+  assert(load(&mismatch, hosts, 2) != 0);
+  wasmbox_module_dispose(&mismatch);
+  return 0;
+}
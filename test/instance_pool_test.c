@@ -0,0 +1,64 @@
+/*
+ * Copyright (C) 2021 Masahiro Ide
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "instance-pool.h"
+#include "memory.h"
+
+#include <assert.h>
+#include <stddef.h>
+
+int main() {
+  wasmbox_instance_pool_t *pool = wasmbox_instance_pool_create(2, 4, 128);
+  if (pool == NULL) {
+    return 0; // not supported on this host
+  }
+  wasmbox_instance_slot_t *a = wasmbox_instance_pool_acquire(pool);
+  wasmbox_instance_slot_t *b = wasmbox_instance_pool_acquire(pool);
+  assert(a != NULL && b != NULL && a != b);
+  assert(wasmbox_instance_pool_acquire(pool) == NULL);
+  assert(wasmbox_instance_slot_globals(a, 4) != NULL);
+  assert(wasmbox_instance_slot_globals(a, 5) == NULL);
+  wasmbox_instance_pool_release(b);
+
+  wasmbox_module_t mod = {};
+  mod.instance_slot = a;
+  assert(wasmbox_memory_init(&mod, 1, 2) == 0);
+  wasm_u8_t *base = mod.memory_block->data;
+  assert(base == wasmbox_instance_slot_memory(a));
+  assert(wasmbox_memory_grow(&mod, 1) == 1);
+  base[2 * 65536 - 1] = 1;
+  wasmbox_instance_slot_globals(a, 1)[0].u64 = 42;
+  assert(wasmbox_module_stack(&mod) != NULL);
+  wasmbox_module_stack(&mod)[127].u64 = 42;
+  wasmbox_memory_dispose(&mod);
+  wasmbox_instance_pool_release(a);
+
+  // A recycled slot keeps its memory but none of its contents.
+  wasmbox_instance_slot_t *c = wasmbox_instance_pool_acquire(pool);
+  wasmbox_instance_slot_t *d = wasmbox_instance_pool_acquire(pool);
+  wasmbox_instance_slot_t *recycled = c == a ? c : d;
+  assert(recycled == a);
+  mod.instance_slot = recycled;
+  assert(wasmbox_memory_init(&mod, 2, 2) == 0);
+  assert(mod.memory_block->data == base && base[2 * 65536 - 1] == 0);
+  assert(wasmbox_instance_slot_globals(a, 1)[0].u64 == 0);
+  assert(wasmbox_module_stack(&mod)[127].u64 == 0);
+  wasmbox_memory_dispose(&mod);
+  wasmbox_instance_pool_release(c);
+  wasmbox_instance_pool_release(d);
+  wasmbox_instance_pool_dispose(pool);
+  return 0;
+}
@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) 2021 Masahiro Ide
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "memory.h"
+
+#include <assert.h>
+#include <string.h>
+
+int main() {
+  wasmbox_module_t mod = {};
+  wasmbox_value_t globals[2] = {};
+  wasmbox_value_t initial_globals[2] = {};
+  wasm_u8_t segment_data[3] = {1, 2, 3};
+  wasmbox_data_segment_t segment = {segment_data, 3, 3};
+  assert(wasmbox_instance_reset(&mod) == -1);
+
+  assert(wasmbox_memory_init(&mod, 2, 4) == 0);
+  memcpy(mod.memory_block->data + 100, "hello", 5);
+  initial_globals[0].u32 = 7;
+  globals[0].u32 = 7;
+  mod.resettable = 1;
+  mod.globals = globals;
+  mod.initial_globals = initial_globals;
+  mod.global_size = 2;
+  mod.data_segments = &segment;
+  mod.data_segment_size = 1;
+  assert(wasmbox_memory_track_writes(&mod) == 0);
+
+  for (int round = 0; round < 2; round++) {
+    // Tracked pages stay readable and become writable on the first write.
+    assert(memcmp(mod.memory_block->data + 100, "hello", 5) == 0);
+    mod.memory_block->data[100] = 'j';
+    mod.memory_block->data[WASMBOX_PAGE_SIZE + 9] = 42;
+    assert(mod.memory_block->data[100] == 'j');
+    assert(wasmbox_memory_grow(&mod, 1) == 2);
+    mod.memory_block->data[2 * WASMBOX_PAGE_SIZE] = 1;
+    globals[0].u32 = 8;
+    globals[1].u32 = 9;
+    segment.size = 0;
+
+    assert(wasmbox_instance_reset(&mod) == 0);
+    assert(mod.memory_block_size == 2);
+    assert(memcmp(mod.memory_block->data + 100, "hello", 5) == 0);
+    assert(mod.memory_block->data[WASMBOX_PAGE_SIZE + 9] == 0);
+    assert(globals[0].u32 == 7 && globals[1].u32 == 0);
+    assert(segment.size == 3);
+  }
+  // Pages dropped by the reset come back zeroed.
+  assert(wasmbox_memory_grow(&mod, 1) == 2);
+  assert(mod.memory_block->data[2 * WASMBOX_PAGE_SIZE] == 0);
+  mod.initial_globals = NULL;
+  wasmbox_memory_dispose(&mod);
+  return 0;
+}
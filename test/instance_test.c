@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2021 Masahiro Ide
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "wasmbox/wasmbox.h"
+
+#include <assert.h>
+#include <string.h>
+
+/*
+ * (memory 1) (global $g (mut i32) (i32.const 0)) (data (i32.const 0) "\2a")
+ * (func (export "_start") (result i32)
+ *   ;; $g += 1; mem[16] += 1; $g * 100 + mem8[0] + mem[16] * 10000
+ */
+static const wasm_u8_t module_binary[] = {
+    0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00, 0x01, 0x05, 0x01, 0x60,
+    0x00, 0x01, 0x7f, 0x03, 0x02, 0x01, 0x00, 0x05, 0x03, 0x01, 0x00, 0x01,
+    0x06, 0x06, 0x01, 0x7f, 0x01, 0x41, 0x00, 0x0b, 0x07, 0x0a, 0x01, 0x06,
+    0x5f, 0x73, 0x74, 0x61, 0x72, 0x74, 0x00, 0x00, 0x0a, 0x2f, 0x01, 0x2d,
+    0x00, 0x23, 0x00, 0x41, 0x01, 0x6a, 0x24, 0x00, 0x41, 0x10, 0x41, 0x10,
+    0x28, 0x02, 0x00, 0x41, 0x01, 0x6a, 0x36, 0x02, 0x00, 0x23, 0x00, 0x41,
+    0xe4, 0x00, 0x6c, 0x41, 0x00, 0x2d, 0x00, 0x00, 0x6a, 0x41, 0x10, 0x28,
+    0x02, 0x00, 0x41, 0x90, 0xce, 0x00, 0x6c, 0x6a, 0x0b, 0x0b, 0x07, 0x01,
+    0x00, 0x41, 0x00, 0x0b, 0x01, 0x2a};
+
+static wasm_s32_t run(wasmbox_instance_t *instance) {
+  wasmbox_value_t stack[1024] = {};
+  assert(wasmbox_eval_module(instance, stack) == 0);
+  return stack[0].s32;
+}
+
+int main() {
+  wasmbox_module_t mod = {};
+  assert(wasmbox_load_module_from_buffer(&mod, module_binary,
+                                         sizeof(module_binary)) == 0);
+  wasmbox_compiled_module_t *compiled = wasmbox_compiled_module_create(&mod);
+  assert(compiled != NULL);
+  assert(mod.functions == NULL);
+
+  wasmbox_instance_t a = {};
+  wasmbox_instance_t b = {};
+  assert(wasmbox_instance_init(&a, compiled) == 0);
+  assert(wasmbox_instance_init(&b, compiled) == 0);
+  // The code is shared, and the state is not.
+  assert(a.functions == b.functions);
+  assert(a.memory_block != b.memory_block && a.globals != b.globals);
+  assert(run(&a) == 10142);
+  assert(run(&a) == 20242);
+  assert(run(&b) == 10142);
+  wasmbox_module_dispose(&a);
+
+  // Instances made after others ran start from the initial state too.
+  wasmbox_instance_t c = {};
+  c.resettable = 1;
+  assert(wasmbox_instance_init(&c, compiled) == 0);
+  assert(run(&c) == 10142);
+  assert(wasmbox_instance_reset(&c) == 0);
+  assert(run(&c) == 10142);
+  assert(run(&b) == 20242);
+  wasmbox_module_dispose(&b);
+  wasmbox_module_dispose(&c);
+  wasmbox_compiled_module_dispose(compiled);
+  return 0;
+}
@@ -0,0 +1,117 @@
+/*
+ * Copyright (C) 2021 Masahiro Ide
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "wasmbox/wasmbox.h"
+
+#include <assert.h>
+
+#ifdef WASMBOX_VM_USE_LATENCY_HISTOGRAM
+/*
+ * (func (export "spin") (loop (br 0)))
+ * (func (export "sum") (param i32) (result i32) (local i32)
+ *   (local.set 1 (i32.const 0))
+ *   (block
+ *     (loop
+ *       (br_if 1 (i32.eqz (local.get 0)))
+ *       (local.set 1 (i32.add (local.get 1) (local.get 0)))
+ *       (local.set 0 (i32.sub (local.get 0) (i32.const 1)))
+ *       (br 0)))
+ *   (local.get 1))
+ */
+static const wasm_u8_t module_binary[] = {
+    0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00, 0x01, 0x09, 0x02, 0x60,
+    0x00, 0x00, 0x60, 0x01, 0x7f, 0x01, 0x7f, 0x03, 0x03, 0x02, 0x00, 0x01,
+    0x07, 0x0e, 0x02, 0x04, 0x73, 0x70, 0x69, 0x6e, 0x00, 0x00, 0x03, 0x73,
+    0x75, 0x6d, 0x00, 0x01, 0x0a, 0x2f, 0x02, 0x07, 0x00, 0x03, 0x40, 0x0c,
+    0x00, 0x0b, 0x0b, 0x25, 0x01, 0x01, 0x7f, 0x41, 0x00, 0x21, 0x01, 0x02,
+    0x40, 0x03, 0x40, 0x20, 0x00, 0x45, 0x0d, 0x01, 0x20, 0x01, 0x20, 0x00,
+    0x6a, 0x21, 0x01, 0x20, 0x00, 0x41, 0x01, 0x6b, 0x21, 0x00, 0x0c, 0x00,
+    0x0b, 0x0b, 0x20, 0x01, 0x0b};
+
+static wasm_u64_t bucket_total(const wasmbox_latency_histogram_t *histogram) {
+  wasm_u64_t total = 0;
+  for (int i = 0; i < WASMBOX_LATENCY_BUCKETS; i++) {
+    total += histogram->counts[i];
+  }
+  return total;
+}
+
+#endif
+
+int main() {
+#ifdef WASMBOX_VM_USE_LATENCY_HISTOGRAM
+  wasmbox_module_t mod = {};
+  mod.fuel_metering = 1;
+  mod.epoch_interruption = 1;
+  assert(wasmbox_load_module_from_buffer(&mod, module_binary,
+                                         sizeof(module_binary)) == 0);
+  const wasmbox_export_t *spin = wasmbox_lookup_export(&mod, "spin");
+  const wasmbox_export_t *sum = wasmbox_lookup_export(&mod, "sum");
+  static wasmbox_latency_histogram_t histogram;
+  assert(wasmbox_latency_histogram_snapshot(&mod, sum, &histogram, 0) == -1);
+  assert(wasmbox_latency_histograms_start(&mod) == 0);
+  assert(wasmbox_latency_histograms_start(&mod) == -1);
+
+  wasm_u64_t epoch = 0;
+  mod.epoch = &epoch;
+  wasmbox_set_epoch_deadline(&mod, 1);
+  mod.fuel = 1 << 30;
+  wasmbox_value_t args[4] = {{.s32 = 10}, {.s32 = 100}, {.s32 = 1000},
+                             {.s32 = 10000}};
+  wasmbox_value_t results[4] = {};
+  for (int i = 0; i < 4; i++) {
+    assert(wasmbox_call(&mod, sum, &args[i], &results[i]) == 0);
+  }
+  assert(wasmbox_call_batch(&mod, sum, args, results, 4) == 0);
+  assert(results[3].s32 == 50005000);
+
+  // Calls which stop are counted apart, and their resumption is not timed.
+  mod.fuel = 10;
+  assert(wasmbox_call(&mod, sum, &args[3], &results[0]) ==
+         WASMBOX_OUT_OF_FUEL);
+  mod.fuel = 1 << 30;
+  assert(wasmbox_resume(&mod, &results[0]) == 0);
+  epoch = 1;
+  assert(wasmbox_call(&mod, sum, &args[3], &results[0]) ==
+         WASMBOX_INTERRUPTED);
+  assert(wasmbox_call(&mod, spin, NULL, NULL) == WASMBOX_INTERRUPTED);
+
+  assert(wasmbox_latency_histogram_snapshot(&mod, sum, &histogram, 1) == 0);
+  assert(histogram.calls == 8 && bucket_total(&histogram) == 8);
+  assert(histogram.traps == 0);
+  assert(histogram.fuel_interruptions == 1);
+  assert(histogram.epoch_interruptions == 1);
+  assert(histogram.max_ns > 0 && histogram.total_ns >= histogram.max_ns);
+  wasm_u64_t median = wasmbox_latency_percentile(&histogram, 50);
+  wasm_u64_t p99 = wasmbox_latency_percentile(&histogram, 99);
+  assert(median <= p99 && p99 <= histogram.max_ns);
+  assert(wasmbox_latency_percentile(&histogram, 100) == histogram.max_ns);
+
+  assert(wasmbox_latency_histogram_snapshot(&mod, spin, &histogram, 0) == 0);
+  assert(histogram.calls == 0 && histogram.epoch_interruptions == 1);
+
+  // The reset emptied the histogram of sum.
+  assert(wasmbox_latency_histogram_snapshot(&mod, sum, &histogram, 0) == 0);
+  assert(histogram.calls == 0 && bucket_total(&histogram) == 0);
+  assert(histogram.max_ns == 0 && histogram.epoch_interruptions == 0);
+  assert(wasmbox_latency_percentile(&histogram, 50) == 0);
+
+  wasmbox_latency_histograms_stop(&mod);
+  assert(wasmbox_latency_histogram_snapshot(&mod, sum, &histogram, 0) == -1);
+  wasmbox_module_dispose(&mod);
+#endif
+  return 0;
+}
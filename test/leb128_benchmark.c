@@ -0,0 +1,100 @@
+/*
+ * Copyright (C) 2021 Masahiro Ide
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "leb128.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define NUMBERS (1 << 20)
+#define ROUNDS  (20)
+
+// The byte-at-a-time decoder the word decoder is compared against.
+static wasm_u64_t reference_unsigned_leb128(const wasm_u8_t *p,
+                                            wasm_u32_t *idx, wasm_u32_t len) {
+  wasm_u64_t result = 0;
+  unsigned shift = 0;
+  while (*idx < len) {
+    wasm_u64_t v = *p++;
+    *idx += 1;
+    result |= (v & 0x7f) << shift;
+    if ((v & 0x80) == 0) {
+      break;
+    }
+    shift += 7;
+  }
+  return result;
+}
+
+static wasm_u32_t encode(wasm_u8_t *p, wasm_u64_t v) {
+  wasm_u32_t size = 0;
+  do {
+    wasm_u8_t byte = v & 0x7f;
+    v >>= 7;
+    p[size++] = byte | (v != 0 ? 0x80 : 0);
+  } while (v != 0);
+  return size;
+}
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+typedef wasm_u64_t (*decoder_t)(const wasm_u8_t *p, wasm_u32_t *idx,
+                                wasm_u32_t len);
+
+static double run(decoder_t decode, const wasm_u8_t *data, wasm_u32_t len,
+                  wasm_u64_t expected) {
+  double start = now();
+  for (int round = 0; round < ROUNDS; round++) {
+    wasm_u64_t sum = 0;
+    wasm_u32_t idx = 0;
+    for (int i = 0; i < NUMBERS; i++) {
+      sum += decode(data + idx, &idx, len);
+    }
+    if (sum != expected) {
+      fprintf(stderr, "wrong result\n");
+      exit(1);
+    }
+  }
+  return (now() - start) * 1e9 / ((double) NUMBERS * ROUNDS);
+}
+
+// Usage: Leb128Benchmark [maximum bits of the numbers, 7 by default]
+int main(int argc, char const *argv[]) {
+  int bits = argc > 1 ? atoi(argv[1]) : 7;
+  wasm_u8_t *data = (wasm_u8_t *) malloc(NUMBERS * 10);
+  wasm_u32_t len = 0;
+  wasm_u64_t sum = 0;
+  srand(42);
+  for (int i = 0; i < NUMBERS; i++) {
+    // Immediates are mostly small: pick the width first.
+    int width = 1 + rand() % bits;
+    wasm_u64_t v = ((wasm_u64_t) rand() << 31 | rand()) &
+                   ((width >= 64 ? 0 : 1ULL << width) - 1);
+    sum += v;
+    len += encode(data + len, v);
+  }
+  double reference = run(reference_unsigned_leb128, data, len, sum);
+  double word = run(wasmbox_parse_unsigned_leb128, data, len, sum);
+  fprintf(stdout, "up to %d bits: byte loop %.2f ns, wasmbox %.2f ns (%.2fx)\n",
+          bits, reference, word, reference / word);
+  free(data);
+  return 0;
+}
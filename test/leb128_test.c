@@ -36,5 +36,29 @@ int main(int argc, char const *argv[]) {
   assert(wasmbox_parse_signed_leb128(d4, &idx, 5) == 0xdeadbeaf);
   idx = 0;
   assert(wasmbox_parse_unsigned_leb128(d4, &idx, 5) == 0xdeadbeaf);
+
+  // Numbers which are followed by enough bytes are decoded a word at a time.
+  const wasm_u8_t d5[] = {0xaf, 0xfd, 0xb6, 0xf5, 0x0d, 0x7f, 0x00, 0x00,
+                          0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
+  idx = 0;
+  assert(wasmbox_parse_unsigned_leb128(d5, &idx, 16) == 0xdeadbeaf);
+  assert(idx == 5);
+  assert(wasmbox_parse_signed_leb128(d5 + idx, &idx, 16) == -1);
+  assert(idx == 6);
+  const wasm_u8_t d6[] = {0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80,
+                          0x80, 0x7f, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
+  idx = 0;
+  assert(wasmbox_parse_signed_leb128(d6, &idx, 16) == INT64_MIN);
+  assert(idx == 10);
+  idx = 0;
+  assert(wasmbox_parse_unsigned_leb128(d6, &idx, 16) == 1ULL << 63);
+  const wasm_u8_t d7[] = {0xc0, 0xbb, 0x78, 0x00, 0x00, 0x00, 0x00, 0x00};
+  idx = 0;
+  assert(wasmbox_parse_signed_leb128(d7, &idx, 8) == -123456);
+  assert(idx == 3);
+  // -2^31 as the 5-byte encoding of an i32.const.
+  const wasm_u8_t d8[] = {0x80, 0x80, 0x80, 0x80, 0x78, 0x00, 0x00, 0x00};
+  idx = 0;
+  assert(wasmbox_parse_signed_leb128(d8, &idx, 8) == INT32_MIN);
   return 0;
 }
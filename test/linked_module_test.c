@@ -0,0 +1,122 @@
+/*
+ * Copyright (C) 2021 Masahiro Ide
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "wasmbox/wasmbox.h"
+
+#include <assert.h>
+
+/*
+ * lib:
+ * (memory 1)
+ * (global $g (mut i32) (i32.const 100))
+ * (func (export "add") (param i32 i32) (result i32)
+ *   (global.set $g (i32.add (global.get $g) (i32.const 1)))
+ *   (i32.add (i32.add (local.get 0) (local.get 1)) (global.get $g)))
+ * (func (export "store") (param i32) (i32.store (i32.const 0) (local.get 0)))
+ * (func (export "load") (result i32) (i32.load (i32.const 0)))
+ * (func (export "oob") (result i32) (i32.load (i32.const -1)))
+ *
+ * app:
+ * (import "lib" "add" (func $add (param i32 i32) (result i32)))
+ * (import "lib" "store" (func $store (param i32)))
+ * (import "lib" "oob" (func $oob (result i32)))
+ * (memory 1)
+ * (func (export "run") (param i32) (result i32)
+ *   (call $store (local.get 0))
+ *   (i32.store (i32.const 0) (i32.const 7))
+ *   (i32.add (call $add (local.get 0) (i32.const 1))
+ *            (i32.load (i32.const 0))))
+ * (export "add" (func $add))
+ * (func (export "fault") (result i32) (call $oob))
+ */
+static const wasm_u8_t lib_binary[] = {
+    0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00, 0x01, 0x0f, 0x03, 0x60,
+    0x02, 0x7f, 0x7f, 0x01, 0x7f, 0x60, 0x01, 0x7f, 0x00, 0x60, 0x00, 0x01,
+    0x7f, 0x03, 0x05, 0x04, 0x00, 0x01, 0x02, 0x02, 0x05, 0x03, 0x01, 0x00,
+    0x01, 0x06, 0x07, 0x01, 0x7f, 0x01, 0x41, 0xe4, 0x00, 0x0b, 0x07, 0x1c,
+    0x04, 0x03, 0x61, 0x64, 0x64, 0x00, 0x00, 0x05, 0x73, 0x74, 0x6f, 0x72,
+    0x65, 0x00, 0x01, 0x04, 0x6c, 0x6f, 0x61, 0x64, 0x00, 0x02, 0x03, 0x6f,
+    0x6f, 0x62, 0x00, 0x03, 0x0a, 0x2d, 0x04, 0x11, 0x00, 0x23, 0x00, 0x41,
+    0x01, 0x6a, 0x24, 0x00, 0x20, 0x00, 0x20, 0x01, 0x6a, 0x23, 0x00, 0x6a,
+    0x0b, 0x09, 0x00, 0x41, 0x00, 0x20, 0x00, 0x36, 0x02, 0x00, 0x0b, 0x07,
+    0x00, 0x41, 0x00, 0x28, 0x02, 0x00, 0x0b, 0x07, 0x00, 0x41, 0x7f, 0x28,
+    0x02, 0x00, 0x0b};
+
+static const wasm_u8_t app_binary[] = {
+    0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00, 0x01, 0x14, 0x04, 0x60,
+    0x02, 0x7f, 0x7f, 0x01, 0x7f, 0x60, 0x01, 0x7f, 0x00, 0x60, 0x00, 0x01,
+    0x7f, 0x60, 0x01, 0x7f, 0x01, 0x7f, 0x02, 0x21, 0x03, 0x03, 0x6c, 0x69,
+    0x62, 0x03, 0x61, 0x64, 0x64, 0x00, 0x00, 0x03, 0x6c, 0x69, 0x62, 0x05,
+    0x73, 0x74, 0x6f, 0x72, 0x65, 0x00, 0x01, 0x03, 0x6c, 0x69, 0x62, 0x03,
+    0x6f, 0x6f, 0x62, 0x00, 0x02, 0x03, 0x03, 0x02, 0x03, 0x02, 0x05, 0x03,
+    0x01, 0x00, 0x01, 0x07, 0x15, 0x03, 0x03, 0x72, 0x75, 0x6e, 0x00, 0x03,
+    0x03, 0x61, 0x64, 0x64, 0x00, 0x00, 0x05, 0x66, 0x61, 0x75, 0x6c, 0x74,
+    0x00, 0x04, 0x0a, 0x20, 0x02, 0x19, 0x00, 0x20, 0x00, 0x10, 0x01, 0x41,
+    0x00, 0x41, 0x07, 0x36, 0x02, 0x00, 0x20, 0x00, 0x41, 0x01, 0x10, 0x00,
+    0x41, 0x00, 0x28, 0x02, 0x00, 0x6a, 0x0b, 0x04, 0x00, 0x10, 0x02, 0x0b};
+
+static int load_app(wasmbox_module_t *app, wasmbox_linked_module_t *linked) {
+  app->linked_modules = linked;
+  app->linked_module_size = 1;
+  return wasmbox_load_module_from_buffer(app, app_binary, sizeof(app_binary));
+}
+
+int main() {
+  wasmbox_module_t lib = {};
+  assert(wasmbox_load_module_from_buffer(&lib, lib_binary,
+                                         sizeof(lib_binary)) == 0);
+  wasmbox_linked_module_t linked = {"lib", &lib};
+  wasmbox_module_t app = {};
+  assert(load_app(&app, &linked) == 0);
+  assert(app.import_function_size == 3);
+
+  // The callee runs with the memory and the globals of its own module, and
+  // the caller with its own again once it returns.
+  wasmbox_value_t arg = {.s32 = 5}, result = {};
+  assert(wasmbox_call(&app, wasmbox_lookup_export(&app, "run"), &arg,
+                      &result) == 0);
+  assert(result.s32 == 5 + 1 + 101 + 7);
+  assert(lib.globals[0].s32 == 101);
+  assert(wasmbox_call(&lib, wasmbox_lookup_export(&lib, "load"), NULL,
+                      &result) == 0);
+  assert(result.s32 == 5);
+
+  // An exported import is called through a function of its own.
+  wasmbox_value_t args[2] = {{.s32 = 2}, {.s32 = 3}};
+  assert(wasmbox_call(&app, wasmbox_lookup_export(&app, "add"), args,
+                      &result) == 0);
+  assert(result.s32 == 2 + 3 + 102);
+
+  // A trap in the linked module unwinds the call of the caller.
+  assert(wasmbox_call(&app, wasmbox_lookup_export(&app, "fault"), NULL,
+                      &result) != 0);
+  assert(wasmbox_call(&app, wasmbox_lookup_export(&app, "run"), &arg,
+                      &result) == 0);
+  assert(result.s32 == 5 + 1 + 103 + 7);
+  wasmbox_module_dispose(&app);
+
+  // Every import must be found among the linked modules.
+  wasmbox_module_t unlinked = {};
+  assert(wasmbox_load_module_from_buffer(&unlinked, app_binary,
+                                         sizeof(app_binary)) != 0);
+  wasmbox_module_dispose(&unlinked);
+  linked.name = "env";
+  wasmbox_module_t missing = {};
+  assert(load_app(&missing, &linked) != 0);
+  wasmbox_module_dispose(&missing);
+  wasmbox_module_dispose(&lib);
+  return 0;
+}
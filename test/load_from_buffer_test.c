@@ -0,0 +1,59 @@
+/*
+ * Copyright (C) 2021 Masahiro Ide
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "wasmbox/wasmbox.h"
+
+#include <assert.h>
+#include <string.h>
+
+/* (func (export "_start") (result i32) i32.const 42) */
+static const wasm_u8_t module_binary[] = {
+    0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00, 0x01, 0x05,
+    0x01, 0x60, 0x00, 0x01, 0x7f, 0x03, 0x02, 0x01, 0x00, 0x07,
+    0x0a, 0x01, 0x06, 0x5f, 0x73, 0x74, 0x61, 0x72, 0x74, 0x00,
+    0x00, 0x0a, 0x06, 0x01, 0x04, 0x00, 0x41, 0x2a, 0x0b};
+
+static const wasm_u8_t *find_name(const wasm_u8_t *data, wasm_u32_t len) {
+  for (wasm_u32_t i = 0; i + 6 <= len; i++) {
+    if (memcmp(data + i, "_start", 6) == 0) {
+      return data + i;
+    }
+  }
+  return NULL;
+}
+
+int main() {
+  for (int borrow = 0; borrow < 2; borrow++) {
+    wasm_u8_t buffer[sizeof(module_binary)];
+    memcpy(buffer, module_binary, sizeof(buffer));
+    wasmbox_module_t mod = {};
+    mod.borrow_source = borrow;
+    assert(wasmbox_load_module_from_buffer(&mod, buffer, sizeof(buffer)) == 0);
+    wasmbox_name_t *name = mod.functions[0]->name;
+    assert(name->len == 6 && memcmp(name->value, "_start", 6) == 0);
+    // Names are only borrowed from the buffer when it is promised to live.
+    assert((name->value == find_name(buffer, sizeof(buffer))) == borrow);
+    wasmbox_value_t stack[1024] = {};
+    assert(wasmbox_eval_module(&mod, stack) == 0);
+    assert(stack[0].s32 == 42);
+    wasmbox_module_dispose(&mod);
+  }
+
+  wasmbox_module_t mod = {};
+  assert(wasmbox_load_module_from_buffer(&mod, module_binary, 6) != 0);
+  wasmbox_module_dispose(&mod);
+  return 0;
+}
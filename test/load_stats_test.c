@@ -0,0 +1,72 @@
+/*
+ * Copyright (C) 2021 Masahiro Ide
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "wasmbox/wasmbox.h"
+
+#include <assert.h>
+
+/*
+ * (global i32 (i32.const 7))
+ * (func $f0 (export "_start") (result i32) call $f2 i32.const 2 i32.mul)
+ * (func $f1 (result i32) i32.const 0)
+ * (func $f2 (result i32) call $f3 i32.const 1 i32.add)
+ * (func $f3 (result i32) i32.const 5)
+ */
+static const wasm_u8_t module_binary[] = {
+    0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00, 0x01, 0x05, 0x01, 0x60,
+    0x00, 0x01, 0x7f, 0x03, 0x05, 0x04, 0x00, 0x00, 0x00, 0x00, 0x06, 0x06,
+    0x01, 0x7f, 0x00, 0x41, 0x07, 0x0b, 0x07, 0x0a, 0x01, 0x06, 0x5f, 0x73,
+    0x74, 0x61, 0x72, 0x74, 0x00, 0x00, 0x0a, 0x1b, 0x04, 0x07, 0x00, 0x10,
+    0x02, 0x41, 0x02, 0x6c, 0x0b, 0x04, 0x00, 0x41, 0x00, 0x0b, 0x07, 0x00,
+    0x10, 0x03, 0x41, 0x01, 0x6a, 0x0b, 0x04, 0x00, 0x41, 0x05, 0x0b};
+
+int main() {
+  wasmbox_load_stats_t stats;
+  wasmbox_module_t mod = {};
+  assert(wasmbox_load_module_from_buffer(&mod, module_binary,
+                                         sizeof(module_binary)) == 0);
+  assert(wasmbox_module_load_stats(&mod, &stats) == -1);
+  wasmbox_module_dispose(&mod);
+
+  mod = (wasmbox_module_t){};
+  mod.record_load_stats = 1;
+  mod.inline_threshold = -1;
+  assert(wasmbox_load_module_from_buffer(&mod, module_binary,
+                                         sizeof(module_binary)) == 0);
+  assert(wasmbox_module_load_stats(&mod, &stats) == 0);
+  assert(stats.total.count == 1 && stats.total.ns > 0);
+  assert(stats.file_read.count == 0);
+  // type, function, global, export and code.
+  assert(stats.sections[1].count == 1 && stats.sections[3].count == 1);
+  assert(stats.sections[6].count == 1 && stats.sections[10].count == 1);
+  assert(stats.sections[11].count == 0);
+  assert(stats.total.ns >= stats.sections[10].ns);
+  assert(stats.global_init.count == 1);
+  assert(stats.data_init.count == 0);
+  assert(stats.function_size == 4);
+#ifndef WASMBOX_VM_USE_LAZY_COMPILE
+  assert(stats.decode.count == 4 && stats.freeze.count == 4);
+  assert(stats.freeze.ns >= stats.link.ns);
+  wasm_u64_t instructions = 0;
+  for (wasm_u32_t i = 0; i < stats.function_size; i++) {
+    assert(stats.functions[i].instructions > 0);
+    instructions += stats.functions[i].instructions;
+  }
+  assert(stats.instructions == instructions);
+#endif
+  wasmbox_module_dispose(&mod);
+  return 0;
+}
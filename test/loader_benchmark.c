@@ -0,0 +1,334 @@
+/*
+ * Copyright (C) 2021 Masahiro Ide
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "input-stream.h"
+#include "leb128.h"
+#include "wasmbox/wasmbox.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* Numbers decoded or read per round. */
+#define NUMBERS (1 << 20)
+#define ROUNDS  (20)
+
+/* Types of the type section benchmark, about as many as a large module. */
+#define TYPES (1000)
+/* Repetitions of the pattern of the function body, about 4500 instructions. */
+#define BODY_PATTERNS (1000)
+#define LOADS (50)
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void report(const char *name, double ns, long long iterations) {
+  fprintf(stdout, "%-32s %10.2f ns %12lld\n", name, ns, iterations);
+}
+
+/* A growing buffer a module is written into. */
+typedef struct buffer_t {
+  wasm_u8_t *data;
+  wasm_u32_t size;
+  wasm_u32_t capacity;
+} buffer_t;
+
+static void put_u8(buffer_t *buf, wasm_u8_t v) {
+  if (buf->size == buf->capacity) {
+    buf->capacity = buf->capacity == 0 ? 256 : buf->capacity * 2;
+    buf->data = (wasm_u8_t *) realloc(buf->data, buf->capacity);
+  }
+  buf->data[buf->size++] = v;
+}
+
+static void put_unsigned(buffer_t *buf, wasm_u64_t v) {
+  do {
+    wasm_u8_t byte = v & 0x7f;
+    v >>= 7;
+    put_u8(buf, byte | (v != 0 ? 0x80 : 0));
+  } while (v != 0);
+}
+
+static void put_signed(buffer_t *buf, wasm_s64_t v) {
+  for (;;) {
+    wasm_u8_t byte = v & 0x7f;
+    v >>= 7;
+    if ((v == 0 && (byte & 0x40) == 0) || (v == -1 && (byte & 0x40) != 0)) {
+      put_u8(buf, byte);
+      return;
+    }
+    put_u8(buf, byte | 0x80);
+  }
+}
+
+static void put_section(buffer_t *buf, wasm_u8_t id, buffer_t *body) {
+  put_u8(buf, id);
+  put_unsigned(buf, body->size);
+  for (wasm_u32_t i = 0; i < body->size; i++) {
+    put_u8(buf, body->data[i]);
+  }
+  body->size = 0;
+}
+
+static void put_header(buffer_t *buf) {
+  static const wasm_u8_t header[] = {0x00, 0x61, 0x73, 0x6d,
+                                     0x01, 0x00, 0x00, 0x00};
+  for (size_t i = 0; i < sizeof(header); i++) {
+    put_u8(buf, header[i]);
+  }
+}
+
+// Immediates are mostly small: pick the width first.
+static wasm_u64_t random_number(int bits) {
+  int width = 1 + rand() % bits;
+  return ((wasm_u64_t) rand() << 31 | rand()) &
+         ((width >= 64 ? 0 : 1ULL << width) - 1);
+}
+
+static void bench_unsigned_leb128(void) {
+  buffer_t buf = {};
+  wasm_u64_t sum = 0;
+  for (int i = 0; i < NUMBERS; i++) {
+    wasm_u64_t v = random_number(32);
+    sum += v;
+    put_unsigned(&buf, v);
+  }
+  double start = now();
+  for (int round = 0; round < ROUNDS; round++) {
+    wasm_u64_t result = 0;
+    wasm_u32_t idx = 0;
+    for (int i = 0; i < NUMBERS; i++) {
+      result += wasmbox_parse_unsigned_leb128(buf.data + idx, &idx, buf.size);
+    }
+    if (result != sum) {
+      fprintf(stderr, "wrong result\n");
+      exit(1);
+    }
+  }
+  report("BM_ParseUnsignedLeb128", (now() - start) * 1e9 / NUMBERS / ROUNDS,
+         (long long) NUMBERS * ROUNDS);
+  free(buf.data);
+}
+
+static void bench_signed_leb128(void) {
+  buffer_t buf = {};
+  wasm_s64_t sum = 0;
+  for (int i = 0; i < NUMBERS; i++) {
+    wasm_s64_t v = (wasm_s64_t) random_number(32);
+    v = rand() % 2 ? -v : v;
+    sum += v;
+    put_signed(&buf, v);
+  }
+  double start = now();
+  for (int round = 0; round < ROUNDS; round++) {
+    wasm_s64_t result = 0;
+    wasm_u32_t idx = 0;
+    for (int i = 0; i < NUMBERS; i++) {
+      result += wasmbox_parse_signed_leb128(buf.data + idx, &idx, buf.size);
+    }
+    if (result != sum) {
+      fprintf(stderr, "wrong result\n");
+      exit(1);
+    }
+  }
+  report("BM_ParseSignedLeb128", (now() - start) * 1e9 / NUMBERS / ROUNDS,
+         (long long) NUMBERS * ROUNDS);
+  free(buf.data);
+}
+
+static void bench_input_stream(void) {
+  wasm_u8_t *data = (wasm_u8_t *) malloc(NUMBERS * 4);
+  wasm_u64_t sum = 0;
+  for (int i = 0; i < NUMBERS * 4; i++) {
+    data[i] = (wasm_u8_t) rand();
+    sum += data[i];
+  }
+  wasmbox_input_stream_t stream;
+  double start = now();
+  for (int round = 0; round < ROUNDS; round++) {
+    wasmbox_input_stream_t *ins =
+        wasmbox_input_stream_open_buffer(&stream, data, NUMBERS * 4);
+    wasm_u64_t result = 0;
+    while (!wasmbox_input_stream_is_end_of_stream(ins)) {
+      result += wasmbox_input_stream_read_u8(ins);
+    }
+    wasmbox_input_stream_close(ins);
+    if (result != sum) {
+      fprintf(stderr, "wrong result\n");
+      exit(1);
+    }
+  }
+  report("BM_InputStreamReadU8", (now() - start) * 1e9 / NUMBERS / 4 / ROUNDS,
+         (long long) NUMBERS * 4 * ROUNDS);
+  start = now();
+  for (int round = 0; round < ROUNDS; round++) {
+    wasmbox_input_stream_t *ins =
+        wasmbox_input_stream_open_buffer(&stream, data, NUMBERS * 4);
+    wasm_u64_t result = 0;
+    for (int i = 0; i < NUMBERS; i++) {
+      wasm_u32_t v = wasmbox_input_stream_read_u32(ins);
+      result += (v & 0xff) + (v >> 8 & 0xff) + (v >> 16 & 0xff) + (v >> 24);
+    }
+    wasmbox_input_stream_close(ins);
+    if (result != sum) {
+      fprintf(stderr, "wrong result\n");
+      exit(1);
+    }
+  }
+  report("BM_InputStreamReadU32", (now() - start) * 1e9 / NUMBERS / ROUNDS,
+         (long long) NUMBERS * ROUNDS);
+  free(data);
+}
+
+static int compare_double(const void *a, const void *b) {
+  double x = *(const double *) a;
+  double y = *(const double *) b;
+  return x < y ? -1 : x > y;
+}
+
+// Loads `module` LOADS times and returns the median of `phase`, which picks
+// the time of one phase out of the load stats.
+static double median_load(buffer_t *module,
+                          double (*phase)(const wasmbox_load_stats_t *)) {
+  double samples[LOADS];
+  for (int i = 0; i < LOADS; i++) {
+    wasmbox_module_t mod = {};
+    mod.record_load_stats = 1;
+    if (wasmbox_load_module_from_buffer(&mod, module->data, module->size) !=
+        0) {
+      fprintf(stderr, "cannot load the module\n");
+      exit(1);
+    }
+    wasmbox_load_stats_t stats;
+    wasmbox_module_load_stats(&mod, &stats);
+    samples[i] = phase(&stats);
+    wasmbox_module_dispose(&mod);
+  }
+  qsort(samples, LOADS, sizeof(double), compare_double);
+  return samples[LOADS / 2];
+}
+
+static double type_section_ns(const wasmbox_load_stats_t *stats) {
+  return (double) stats->sections[1].ns;
+}
+
+// Function types of zero to five parameters of every number type.
+static void bench_function_types(void) {
+  static const wasm_u8_t types[] = {0x7f, 0x7e, 0x7d, 0x7c};
+  buffer_t module = {};
+  buffer_t body = {};
+  put_header(&module);
+  put_unsigned(&body, TYPES);
+  for (int i = 0; i < TYPES; i++) {
+    put_u8(&body, 0x60);
+    int params = i % 6;
+    put_unsigned(&body, params);
+    for (int j = 0; j < params; j++) {
+      put_u8(&body, types[(i + j) % 4]);
+    }
+    put_unsigned(&body, i % 2);
+    if (i % 2) {
+      put_u8(&body, types[i % 4]);
+    }
+  }
+  put_section(&module, 1, &body);
+  report("BM_ParseFunctionType",
+         median_load(&module, type_section_ns) / TYPES, TYPES * LOADS);
+  free(body.data);
+  free(module.data);
+}
+
+static double compile_ns(const wasmbox_load_stats_t *stats) {
+  return (double) (stats->decode.ns + stats->freeze.ns);
+}
+
+// One function of eight locals adding them up, with a block and a branch
+// every few instructions.
+static void bench_parse_function(void) {
+  buffer_t module = {};
+  buffer_t section = {};
+  buffer_t body = {};
+  put_header(&module);
+  // (type (func (param i32) (result i32)))
+  static const wasm_u8_t type[] = {0x01, 0x60, 0x01, 0x7f, 0x01, 0x7f};
+  for (size_t i = 0; i < sizeof(type); i++) {
+    put_u8(&section, type[i]);
+  }
+  put_section(&module, 1, &section);
+  put_u8(&section, 0x01);
+  put_u8(&section, 0x00);
+  put_section(&module, 3, &section);
+
+  put_u8(&body, 0x01); // 8 locals of i32
+  put_u8(&body, 0x08);
+  put_u8(&body, 0x7f);
+  for (int i = 0; i < BODY_PATTERNS; i++) {
+    put_u8(&body, 0x20); // local.get
+    put_u8(&body, i % 9);
+    put_u8(&body, 0x41); // i32.const
+    put_signed(&body, i);
+    put_u8(&body, 0x6a); // i32.add
+    put_u8(&body, 0x21); // local.set
+    put_u8(&body, 1 + (i % 8));
+    if (i % 8 == 7) {
+      put_u8(&body, 0x02); // block
+      put_u8(&body, 0x40);
+      put_u8(&body, 0x20); // local.get 0
+      put_u8(&body, 0x00);
+      put_u8(&body, 0x0d); // br_if 0
+      put_u8(&body, 0x00);
+      put_u8(&body, 0x0b); // end
+    }
+  }
+  put_u8(&body, 0x20); // local.get 1
+  put_u8(&body, 0x01);
+  put_u8(&body, 0x0b); // end
+  put_u8(&section, 0x01);
+  put_unsigned(&section, body.size);
+  for (wasm_u32_t i = 0; i < body.size; i++) {
+    put_u8(&section, body.data[i]);
+  }
+  put_section(&module, 10, &section);
+  double ns = median_load(&module, compile_ns);
+  if (ns == 0) {
+    // Lazy compilation leaves the body for the first call.
+    fprintf(stdout, "%-32s %13s\n", "BM_ParseFunction", "(lazy)");
+  } else {
+    report("BM_ParseFunction", ns, LOADS);
+  }
+  free(body.data);
+  free(section.data);
+  free(module.data);
+}
+
+// Usage: LoaderBenchmark
+// Prints the time per operation of each loader primitive, its median over
+// loads for the parsers, and the number of operations it was measured over.
+int main() {
+  srand(42);
+  fprintf(stdout, "%-32s %13s %12s\n", "Benchmark", "Time", "Iterations");
+  bench_unsigned_leb128();
+  bench_signed_leb128();
+  bench_input_stream();
+  bench_function_types();
+  bench_parse_function();
+  return 0;
+}
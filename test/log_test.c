@@ -0,0 +1,90 @@
+/*
+ * Copyright (C) 2021 Masahiro Ide
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "wasmbox/wasmbox.h"
+
+#include <assert.h>
+#include <string.h>
+
+/*
+ * (import "env" "f" (func $f (param i32) (result i32)))
+ * (func (export "run") (param i32) (result i32) (call $f (local.get 0)))
+ */
+static const wasm_u8_t module_binary[] = {
+    0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00, 0x01, 0x06, 0x01,
+    0x60, 0x01, 0x7f, 0x01, 0x7f, 0x02, 0x09, 0x01, 0x03, 0x65, 0x6e,
+    0x76, 0x01, 0x66, 0x00, 0x00, 0x03, 0x02, 0x01, 0x00, 0x07, 0x07,
+    0x01, 0x03, 0x72, 0x75, 0x6e, 0x00, 0x01, 0x0a, 0x08, 0x01, 0x06,
+    0x00, 0x20, 0x00, 0x10, 0x00, 0x0b};
+
+typedef struct log_t {
+  int messages[WASMBOX_LOG_DEBUG + 1];
+  int imports;
+  int dumps;
+} log_t;
+
+static void collect(void *data, int level, const char *message) {
+  log_t *log = (log_t *) data;
+  log->messages[level]++;
+  log->imports += strcmp(message, "import(env:f)") == 0;
+  log->dumps += strncmp(message, "module ", 7) == 0;
+}
+
+static wasm_s32_t f(void *data, wasm_s32_t a) { return a + 1; }
+
+static void load(int level, log_t *log) {
+  wasmbox_host_function_t host = {};
+  host.module = "env";
+  host.name = "f";
+  host.kind = WASMBOX_HOST_I32_I32;
+  host.entry.i32_i32 = f;
+  wasmbox_module_t mod = {};
+  mod.host_functions = &host;
+  mod.host_function_size = 1;
+  if (log != NULL) {
+    mod.log_callback = collect;
+    mod.log_data = log;
+    mod.log_level = level;
+  }
+  assert(wasmbox_load_module_from_buffer(&mod, module_binary,
+                                         sizeof(module_binary)) == 0);
+  wasmbox_value_t arg = {.s32 = 1}, result = {};
+  assert(wasmbox_call(&mod, wasmbox_lookup_export(&mod, "run"), &arg,
+                      &result) == 0);
+  assert(result.s32 == 2);
+  wasmbox_module_dispose(&mod);
+}
+
+int main() {
+  load(WASMBOX_LOG_NONE, NULL);
+
+  log_t none = {};
+  load(WASMBOX_LOG_NONE, &none);
+  assert(none.messages[WASMBOX_LOG_INFO] == 0);
+  assert(none.messages[WASMBOX_LOG_DEBUG] == 0);
+
+  log_t info = {};
+  load(WASMBOX_LOG_INFO, &info);
+  assert(info.imports == 1);
+  assert(info.messages[WASMBOX_LOG_DEBUG] == 0);
+
+  log_t debug = {};
+  load(WASMBOX_LOG_DEBUG, &debug);
+  assert(debug.imports == 1);
+  assert(debug.dumps == 1);
+  return 0;
+}
@@ -0,0 +1,144 @@
+/*
+ * Copyright (C) 2021 Masahiro Ide
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "memory.h"
+#include "wasmbox/wasmbox.h"
+
+#include <assert.h>
+#include <string.h>
+
+/*
+ * (memory i64 1 70000)
+ * (data (i64.const 16) "wasm64")
+ * (func (export "load") (param i64) (result i64)
+ *   (i64.load offset=8 (local.get 0)))
+ * (func (export "store") (param i64 i64)
+ *   (i64.store offset=8 (local.get 0) (local.get 1)))
+ * (func (export "load8") (param i64) (result i32)
+ *   (i32.load8_u (local.get 0)))
+ * (func (export "size") (result i64) (memory.size))
+ * (func (export "grow") (param i64) (result i64)
+ *   (memory.grow (local.get 0)))
+ * (func (export "fill") (param i64 i32 i64)
+ *   (memory.fill (local.get 0) (local.get 1) (local.get 2)))
+ */
+static const wasm_u8_t module_binary[] = {
+    0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00, 0x01, 0x1a, 0x05, 0x60,
+    0x01, 0x7e, 0x01, 0x7e, 0x60, 0x02, 0x7e, 0x7e, 0x00, 0x60, 0x01, 0x7e,
+    0x01, 0x7f, 0x60, 0x00, 0x01, 0x7e, 0x60, 0x03, 0x7e, 0x7f, 0x7e, 0x00,
+    0x03, 0x07, 0x06, 0x00, 0x01, 0x02, 0x03, 0x00, 0x04, 0x05, 0x06, 0x01,
+    0x05, 0x01, 0xf0, 0xa2, 0x04, 0x07, 0x2d, 0x06, 0x04, 0x6c, 0x6f, 0x61,
+    0x64, 0x00, 0x00, 0x05, 0x73, 0x74, 0x6f, 0x72, 0x65, 0x00, 0x01, 0x05,
+    0x6c, 0x6f, 0x61, 0x64, 0x38, 0x00, 0x02, 0x04, 0x73, 0x69, 0x7a, 0x65,
+    0x00, 0x03, 0x04, 0x67, 0x72, 0x6f, 0x77, 0x00, 0x04, 0x04, 0x66, 0x69,
+    0x6c, 0x6c, 0x00, 0x05, 0x0a, 0x33, 0x06, 0x07, 0x00, 0x20, 0x00, 0x29,
+    0x03, 0x08, 0x0b, 0x09, 0x00, 0x20, 0x00, 0x20, 0x01, 0x37, 0x03, 0x08,
+    0x0b, 0x07, 0x00, 0x20, 0x00, 0x2d, 0x00, 0x00, 0x0b, 0x04, 0x00, 0x3f,
+    0x00, 0x0b, 0x06, 0x00, 0x20, 0x00, 0x40, 0x00, 0x0b, 0x0b, 0x00, 0x20,
+    0x00, 0x20, 0x01, 0x20, 0x02, 0xfc, 0x0b, 0x00, 0x0b, 0x0b, 0x0c, 0x01,
+    0x00, 0x42, 0x10, 0x0b, 0x06, 0x77, 0x61, 0x73, 0x6d, 0x36, 0x34};
+
+static int call(wasmbox_module_t *mod, const char *name, wasmbox_value_t *args,
+                wasmbox_value_t *result) {
+  return wasmbox_call(mod, wasmbox_lookup_export(mod, name), args, result);
+}
+
+static wasm_u64_t load(wasmbox_module_t *mod, wasm_u64_t addr) {
+  wasmbox_value_t arg = {.u64 = addr};
+  wasmbox_value_t result = {};
+  assert(call(mod, "load", &arg, &result) == 0);
+  return result.u64;
+}
+
+static void store(wasmbox_module_t *mod, wasm_u64_t addr, wasm_u64_t value) {
+  wasmbox_value_t args[2] = {{.u64 = addr}, {.u64 = value}};
+  assert(call(mod, "store", args, NULL) == 0);
+}
+
+static wasm_u64_t grow(wasmbox_module_t *mod, wasm_u64_t delta) {
+  wasmbox_value_t arg = {.u64 = delta};
+  wasmbox_value_t result = {.u64 = 1234};
+  assert(call(mod, "grow", &arg, &result) == 0);
+  return result.u64;
+}
+
+static wasm_u64_t size(wasmbox_module_t *mod) {
+  wasmbox_value_t result = {.u64 = WASM_U64_MAX};
+  assert(call(mod, "size", NULL, &result) == 0);
+  return result.u64;
+}
+
+int main() {
+  wasmbox_module_t mod = {};
+  assert(wasmbox_load_module_from_buffer(&mod, module_binary,
+                                         sizeof(module_binary)) == 0);
+  assert(mod.memory64);
+  assert(size(&mod) == 1);
+
+  // The data segment is placed by an i64 offset.
+  wasmbox_value_t arg = {.u64 = 16};
+  wasmbox_value_t result = {};
+  assert(call(&mod, "load8", &arg, &result) == 0 && result.u32 == 'w');
+  store(&mod, 0, 0x0123456789abcdefULL);
+  assert(load(&mod, 0) == 0x0123456789abcdefULL);
+  assert(load(&mod, WASMBOX_PAGE_SIZE - 16) == 0);
+
+  // Every access is checked, whatever the upper half of the address.
+  arg.u64 = WASMBOX_PAGE_SIZE - 8;
+  assert(call(&mod, "load", &arg, &result) != 0);
+  arg.u64 = 0x100000000ULL;
+  assert(call(&mod, "load", &arg, &result) != 0);
+  arg.u64 = WASM_U64_MAX - 4;
+  assert(call(&mod, "load", &arg, &result) != 0);
+
+  // memory.grow takes and returns i64 values, -1 on failure.
+  assert(grow(&mod, 1) == 1);
+  assert(size(&mod) == 2);
+  assert(grow(&mod, 70000) == WASM_U64_MAX);
+  assert(grow(&mod, 0x100000001ULL) == WASM_U64_MAX);
+  assert(size(&mod) == 2);
+
+  wasmbox_value_t fill[3] = {{.u64 = 100}, {.u32 = 7}, {.u64 = 10}};
+  assert(call(&mod, "fill", fill, NULL) == 0);
+  wasmbox_memory_view_t view;
+  wasmbox_memory_view(&mod, &view);
+  assert(view.base[99] == 0 && view.base[100] == 7 && view.base[109] == 7 &&
+         view.base[110] == 0);
+  fill[0].u64 = 2 * WASMBOX_PAGE_SIZE - 5;
+  assert(call(&mod, "fill", fill, NULL) != 0);
+  fill[0].u64 = 0x100000000ULL;
+  fill[2].u64 = 1;
+  assert(call(&mod, "fill", fill, NULL) != 0);
+
+#ifdef WASMBOX_MEMORY_USE_RESERVATION
+  // The memory grows past 4 GiB in place, and only touched pages are used.
+  assert(grow(&mod, WASMBOX_MEMORY_MAX_PAGES) == 2);
+  wasmbox_memory_view(&mod, &view);
+  assert(view.length ==
+         (wasm_u64_t) WASMBOX_PAGE_SIZE * (WASMBOX_MEMORY_MAX_PAGES + 2));
+  store(&mod, 0x100000000ULL, 42);
+  assert(load(&mod, 0x100000000ULL) == 42);
+  assert(view.base[0x100000008ULL] == 42);
+  assert(load(&mod, 0) == 0x0123456789abcdefULL);
+  arg.u64 = view.length - 8;
+  assert(call(&mod, "load", &arg, &result) != 0);
+  assert(wasmbox_memory_reserved_size(&mod) ==
+         (wasm_u64_t) WASMBOX_PAGE_SIZE * 70000);
+#endif
+  wasmbox_module_dispose(&mod);
+  return 0;
+}
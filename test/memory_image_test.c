@@ -0,0 +1,52 @@
+/*
+ * Copyright (C) 2021 Masahiro Ide
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "memory.h"
+
+#include <assert.h>
+#include <string.h>
+
+int main() {
+  wasmbox_module_t src = {};
+  assert(wasmbox_memory_init(&src, 2, 4) == 0);
+  memcpy(src.memory_block->data + 100, "hello", 5);
+  src.memory_block->data[WASMBOX_PAGE_SIZE + 7] = 42;
+  wasmbox_memory_image_t *image = wasmbox_memory_image_create(&src);
+  assert(image != NULL);
+  wasmbox_memory_dispose(&src);
+
+  wasmbox_module_t a = {};
+  wasmbox_module_t b = {};
+  a.memory_image = image;
+  b.memory_image = image;
+  // The memory is at least as large as the image.
+  assert(wasmbox_memory_init(&a, 1, 4) == 0);
+  assert(wasmbox_memory_init(&b, 2, 4) == 0);
+  assert(a.memory_block_size == 2);
+  assert(memcmp(a.memory_block->data + 100, "hello", 5) == 0);
+  assert(a.memory_block->data[WASMBOX_PAGE_SIZE + 7] == 42);
+  // Writes stay private to each instance.
+  a.memory_block->data[100] = 'j';
+  assert(b.memory_block->data[100] == 'h');
+  // Pages past the image start zeroed.
+  assert(wasmbox_memory_grow(&a, 1) == 2);
+  assert(a.memory_block->data[2 * WASMBOX_PAGE_SIZE] == 0);
+  assert(wasmbox_memory_grow(&a, 2) == WASM_U32_MAX);
+  wasmbox_memory_dispose(&a);
+  wasmbox_memory_dispose(&b);
+  wasmbox_memory_image_dispose(image);
+  return 0;
+}
@@ -0,0 +1,94 @@
+/*
+ * Copyright (C) 2021 Masahiro Ide
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "memory.h"
+#include "wasmbox/wasmbox.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+/*
+ * (memory 1) (global $g (mut i32) (i32.const 0)) (data (i32.const 0) "\2a")
+ * (func (export "_start") (result i32)
+ *   ;; $g += 1; mem[16] += 1; $g * 100 + mem8[0] + mem[16] * 10000
+ */
+static const wasm_u8_t module_binary[] = {
+    0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00, 0x01, 0x05, 0x01, 0x60,
+    0x00, 0x01, 0x7f, 0x03, 0x02, 0x01, 0x00, 0x05, 0x03, 0x01, 0x00, 0x01,
+    0x06, 0x06, 0x01, 0x7f, 0x01, 0x41, 0x00, 0x0b, 0x07, 0x0a, 0x01, 0x06,
+    0x5f, 0x73, 0x74, 0x61, 0x72, 0x74, 0x00, 0x00, 0x0a, 0x2f, 0x01, 0x2d,
+    0x00, 0x23, 0x00, 0x41, 0x01, 0x6a, 0x24, 0x00, 0x41, 0x10, 0x41, 0x10,
+    0x28, 0x02, 0x00, 0x41, 0x01, 0x6a, 0x36, 0x02, 0x00, 0x23, 0x00, 0x41,
+    0xe4, 0x00, 0x6c, 0x41, 0x00, 0x2d, 0x00, 0x00, 0x6a, 0x41, 0x10, 0x28,
+    0x02, 0x00, 0x41, 0x90, 0xce, 0x00, 0x6c, 0x6a, 0x0b, 0x0b, 0x07, 0x01,
+    0x00, 0x41, 0x00, 0x0b, 0x01, 0x2a};
+
+static int run(wasmbox_module_t *mod, wasm_s32_t *result) {
+  wasmbox_value_t stack[1024] = {};
+  int ret = wasmbox_eval_module(mod, stack);
+  *result = stack[0].s32;
+  return ret;
+}
+
+int main() {
+#ifdef WASMBOX_MEMORY_USE_RESERVATION
+  // A file whose first bytes are 7 and, at 16, the i32 5.
+  FILE *file = tmpfile();
+  assert(file != NULL);
+  wasm_u8_t bytes[100] = {7};
+  bytes[16] = 5;
+  assert(fwrite(bytes, 1, sizeof(bytes), file) == sizeof(bytes));
+  fflush(file);
+  int fd = fileno(file);
+
+  wasmbox_module_t mod = {};
+  assert(wasmbox_load_module_from_buffer(&mod, module_binary,
+                                         sizeof(module_binary)) == 0);
+  wasm_s32_t result;
+  assert(run(&mod, &result) == 0 && result == 10142);
+
+  // Copy-on-write: the guest sees the file, and its stores stay private.
+  assert(wasmbox_memory_map(&mod, 0, fd, 0, sizeof(bytes),
+                            WASMBOX_MAP_COPY_ON_WRITE) == 0);
+  assert(mod.memory_block->data[200] == 0);
+  assert(run(&mod, &result) == 0 && result == 200 + 7 + 60000);
+  wasm_u8_t read_back[17];
+  assert(pread(fd, read_back, sizeof(read_back), 0) == sizeof(read_back));
+  assert(read_back[0] == 7 && read_back[16] == 5);
+
+  // Read-only: the store to 16 traps.
+  assert(wasmbox_memory_map(&mod, 0, fd, 0, sizeof(bytes),
+                            WASMBOX_MAP_READ_ONLY) == 0);
+  assert(mod.memory_block->data[16] == 5);
+  assert(run(&mod, &result) == -1);
+
+  assert(wasmbox_memory_unmap(&mod, 0, sizeof(bytes)) == 0);
+  assert(mod.memory_block->data[0] == 0 && mod.memory_block->data[16] == 0);
+
+  // Unaligned offsets and ranges past the memory are refused.
+  assert(wasmbox_memory_map(&mod, 1, fd, 0, 1, WASMBOX_MAP_READ_ONLY) == -1);
+  assert(wasmbox_memory_map(&mod, 0, fd, 0, WASMBOX_PAGE_SIZE + 1,
+                            WASMBOX_MAP_READ_ONLY) == -1);
+  assert(wasmbox_memory_map(&mod, 0, fd, 0, (wasm_u64_t) -4096,
+                            WASMBOX_MAP_READ_ONLY) == -1);
+  wasmbox_module_dispose(&mod);
+  fclose(file);
+#endif
+  return 0;
+}
@@ -0,0 +1,55 @@
+/*
+ * Copyright (C) 2021 Masahiro Ide
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "memory.h"
+#include "memory-profile.h"
+
+#include <assert.h>
+
+int main() {
+#ifdef WASMBOX_VM_USE_MEMORY_PROFILE
+  wasmbox_module_t mod = {};
+  wasmbox_memory_page_count_t pages[48];
+  assert(wasmbox_memory_init(&mod, 2, 4) == 0);
+  assert(wasmbox_memory_profile_pages(&mod, 4096, pages, 48) == 32);
+  assert(pages[0].reads == 0 && pages[31].writes == 0);
+
+  WASMBOX_MEMORY_PROFILE(&mod, 0, reads);
+  WASMBOX_MEMORY_PROFILE(&mod, 4095, reads);
+  WASMBOX_MEMORY_PROFILE(&mod, 4096, writes);
+  WASMBOX_MEMORY_PROFILE(&mod, WASMBOX_PAGE_SIZE + 8, writes);
+  assert(wasmbox_memory_profile_pages(&mod, 4096, pages, 48) == 32);
+  assert(pages[0].reads == 2 && pages[0].writes == 0);
+  assert(pages[1].writes == 1 && pages[16].writes == 1);
+  assert(wasmbox_memory_profile_pages(&mod, WASMBOX_PAGE_SIZE, pages, 1) == 2);
+  assert(pages[0].reads == 2 && pages[0].writes == 1);
+  assert(wasmbox_memory_profile_pages(&mod, 1000, pages, 48) == 0);
+
+  // Pages added by memory.grow are counted as well.
+  assert(wasmbox_memory_grow(&mod, 1) == 2);
+  WASMBOX_MEMORY_PROFILE(&mod, 2 * WASMBOX_PAGE_SIZE, reads);
+  assert(wasmbox_memory_profile_pages(&mod, WASMBOX_PAGE_SIZE, pages, 48) == 3);
+  assert(pages[1].writes == 1 && pages[2].reads == 1);
+  wasmbox_memory_report_profile(&mod);
+
+  wasmbox_memory_profile_clear(&mod);
+  wasmbox_memory_profile_pages(&mod, WASMBOX_PAGE_SIZE, pages, 3);
+  assert(pages[0].reads == 0 && pages[2].reads == 0);
+  wasmbox_memory_profile_dispose(&mod);
+  wasmbox_memory_dispose(&mod);
+#endif
+  return 0;
+}
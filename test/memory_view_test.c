@@ -0,0 +1,90 @@
+/*
+ * Copyright (C) 2021 Masahiro Ide
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "wasmbox/wasmbox.h"
+
+#include <assert.h>
+#include <string.h>
+
+/*
+ * (memory 1 4)
+ * (func (export "grow") (param i32) (result i32)
+ *   (memory.grow (local.get 0)))
+ */
+static const wasm_u8_t module_binary[] = {
+    0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00, 0x01, 0x06, 0x01, 0x60,
+    0x01, 0x7f, 0x01, 0x7f, 0x03, 0x02, 0x01, 0x00, 0x05, 0x04, 0x01, 0x01,
+    0x01, 0x04, 0x07, 0x08, 0x01, 0x04, 0x67, 0x72, 0x6f, 0x77, 0x00, 0x00,
+    0x0a, 0x08, 0x01, 0x06, 0x00, 0x20, 0x00, 0x40, 0x00, 0x0b};
+
+typedef struct grown_t {
+  int calls;
+  wasmbox_memory_view_t view;
+} grown_t;
+
+static void on_grow(void *data, wasmbox_module_t *mod,
+                    const wasmbox_memory_view_t *view) {
+  grown_t *grown = (grown_t *) data;
+  (void) mod;
+  grown->calls++;
+  grown->view = *view;
+}
+
+static wasm_s32_t grow(wasmbox_module_t *mod, wasm_s32_t delta) {
+  const wasmbox_export_t *f = wasmbox_lookup_export(mod, "grow");
+  wasmbox_value_t arg = {.s32 = delta};
+  wasmbox_value_t result = {};
+  assert(wasmbox_call(mod, f, &arg, &result) == 0);
+  return result.s32;
+}
+
+int main() {
+  wasmbox_module_t empty = {};
+  wasmbox_memory_view_t view;
+  wasmbox_memory_view(&empty, &view);
+  assert(view.base == NULL && view.length == 0);
+
+  wasmbox_module_t mod = {};
+  assert(wasmbox_load_module_from_buffer(&mod, module_binary,
+                                         sizeof(module_binary)) == 0);
+  grown_t grown = {};
+  mod.memory_grow_callback = on_grow;
+  mod.memory_grow_data = &grown;
+  wasmbox_memory_view(&mod, &view);
+  assert(view.base != NULL && view.length == WASMBOX_PAGE_SIZE);
+  view.base[10] = 42;
+
+  // The view stays valid until the generation changes.
+  wasmbox_memory_view_t same;
+  assert(grow(&mod, 0) == 1 && grown.calls == 0);
+  wasmbox_memory_view(&mod, &same);
+  assert(memcmp(&same, &view, sizeof(view)) == 0);
+
+  assert(grow(&mod, 2) == 1 && grown.calls == 1);
+  assert(grown.view.length == 3 * WASMBOX_PAGE_SIZE);
+  assert(grown.view.generation != view.generation);
+  assert(grown.view.base[10] == 42);
+  wasmbox_memory_view(&mod, &same);
+  assert(memcmp(&same, &grown.view, sizeof(view)) == 0);
+
+  // A failed grow changes nothing.
+  assert(grow(&mod, 2) == -1 && grown.calls == 1);
+  wasmbox_memory_view(&mod, &same);
+  assert(same.generation == grown.view.generation);
+  wasmbox_module_dispose(&mod);
+  return 0;
+}
@@ -0,0 +1,62 @@
+/*
+ * Copyright (C) 2021 Masahiro Ide
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "wasmbox/wasmbox.h"
+
+#include <assert.h>
+#include <string.h>
+
+/*
+ * (func (export "_start") (result i32) i32.const 30 call $fib)
+ * (func $fib (param i32) (result i32) ...) ;; named by the name section only
+ */
+static const wasm_u8_t module_binary[] = {
+    0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00, 0x01, 0x0a, 0x02, 0x60,
+    0x00, 0x01, 0x7f, 0x60, 0x01, 0x7f, 0x01, 0x7f, 0x03, 0x03, 0x02, 0x00,
+    0x01, 0x07, 0x0a, 0x01, 0x06, 0x5f, 0x73, 0x74, 0x61, 0x72, 0x74, 0x00,
+    0x00, 0x0a, 0x25, 0x02, 0x06, 0x00, 0x41, 0x1e, 0x10, 0x01, 0x0b, 0x1c,
+    0x00, 0x20, 0x00, 0x41, 0x02, 0x49, 0x04, 0x7f, 0x20, 0x00, 0x05, 0x20,
+    0x00, 0x41, 0x01, 0x6b, 0x10, 0x01, 0x20, 0x00, 0x41, 0x02, 0x6b, 0x10,
+    0x01, 0x6a, 0x0b, 0x0b, 0x00, 0x0d, 0x04, 0x6e, 0x61, 0x6d, 0x65, 0x01,
+    0x06, 0x01, 0x01, 0x03, 0x66, 0x69, 0x62};
+
+static int is_named(wasmbox_name_t *name, const char *value) {
+  return name != NULL && name->len == strlen(value) &&
+         memcmp(name->value, value, name->len) == 0;
+}
+
+int main() {
+  for (int borrow = 0; borrow < 2; borrow++) {
+    wasm_u8_t buffer[sizeof(module_binary)];
+    memcpy(buffer, module_binary, sizeof(buffer));
+    wasmbox_module_t mod = {};
+    mod.borrow_source = borrow;
+    assert(wasmbox_load_module_from_buffer(&mod, buffer, sizeof(buffer)) == 0);
+    // The name section of a buffer which outlives the module is decoded once
+    // a name is asked for.
+    assert((mod.functions[1]->name == NULL) == borrow);
+    assert(is_named(wasmbox_function_name(&mod, 0), "_start"));
+    assert(is_named(wasmbox_function_name(&mod, 1), "fib"));
+    assert(mod.name_size == 0);
+    assert(mod.functions[1]->name == wasmbox_function_name(&mod, 1));
+    assert(wasmbox_function_name(&mod, 2) == NULL);
+    wasmbox_value_t stack[1024] = {};
+    assert(wasmbox_eval_module(&mod, stack) == 0);
+    assert(stack[0].s32 == 832040);
+    wasmbox_module_dispose(&mod);
+  }
+  return 0;
+}
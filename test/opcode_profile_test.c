@@ -0,0 +1,65 @@
+/*
+ * Copyright (C) 2021 Masahiro Ide
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "wasmbox/wasmbox.h"
+
+#include <assert.h>
+
+#ifdef WASMBOX_VM_USE_OPCODE_PROFILE
+/*
+ * (func $f0 (export "_start") (result i32) call $f2 i32.const 2 i32.mul)
+ * (func $f1 (result i32) i32.const 0)
+ * (func $f2 (result i32) call $f3 i32.const 1 i32.add)
+ * (func $f3 (result i32) i32.const 5)
+ */
+static const wasm_u8_t module_binary[] = {
+    0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00, 0x01, 0x05, 0x01, 0x60,
+    0x00, 0x01, 0x7f, 0x03, 0x05, 0x04, 0x00, 0x00, 0x00, 0x00, 0x07, 0x0a,
+    0x01, 0x06, 0x5f, 0x73, 0x74, 0x61, 0x72, 0x74, 0x00, 0x00, 0x0a, 0x1b,
+    0x04, 0x07, 0x00, 0x10, 0x02, 0x41, 0x02, 0x6c, 0x0b, 0x04, 0x00, 0x41,
+    0x00, 0x0b, 0x07, 0x00, 0x10, 0x03, 0x41, 0x01, 0x6a, 0x0b, 0x04, 0x00,
+    0x41, 0x05, 0x0b};
+#endif
+
+int main() {
+#ifdef WASMBOX_VM_USE_OPCODE_PROFILE
+  wasmbox_module_t mod = {};
+  // Keep the calls, which inlining would remove.
+  mod.inline_threshold = -1;
+  assert(wasmbox_load_module_from_buffer(&mod, module_binary,
+                                         sizeof(module_binary)) == 0);
+  assert(wasmbox_opcode_profile_count(&mod, "STATIC_CALL") == 0);
+  wasmbox_value_t stack[1024] = {};
+  assert(wasmbox_eval_module(&mod, stack) == 0);
+  assert(stack[0].s32 == 12);
+#  ifndef WASMBOX_VM_USE_JIT
+  assert(wasmbox_opcode_profile_count(&mod, "STATIC_CALL") == 2);
+  assert(wasmbox_opcode_profile_count(&mod, "RETURN") >= 2);
+  // $f0 calls $f2, which starts with the call of $f3.
+  assert(wasmbox_opcode_profile_pair_count(&mod, "STATIC_CALL",
+                                           "STATIC_CALL") == 1);
+#  endif
+  assert(wasmbox_opcode_profile_count(&mod, "NO_SUCH_OPCODE") == 0);
+  wasmbox_opcode_report_profile(&mod, 10);
+
+  wasmbox_opcode_profile_clear(&mod);
+  assert(wasmbox_opcode_profile_count(&mod, "STATIC_CALL") == 0);
+  assert(wasmbox_opcode_profile_pair_count(&mod, "STATIC_CALL",
+                                           "STATIC_CALL") == 0);
+  wasmbox_module_dispose(&mod);
+#endif
+  return 0;
+}
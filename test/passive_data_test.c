@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) 2021 Masahiro Ide
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "wasmbox/wasmbox.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/*
+ * (memory 1)
+ * (func (export "init") (param i32) (result i32)
+ *   (memory.init 0 (local.get 0) (i32.const 0) (i32.const 5))
+ *   (i32.load8_u offset=4 (local.get 0)))
+ * (func (export "drop") (data.drop 0))
+ * (data "hello")
+ */
+static const wasm_u8_t module_binary[] = {
+    0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00, 0x01, 0x09, 0x02, 0x60,
+    0x01, 0x7f, 0x01, 0x7f, 0x60, 0x00, 0x00, 0x03, 0x03, 0x02, 0x00, 0x01,
+    0x05, 0x03, 0x01, 0x00, 0x01, 0x07, 0x0f, 0x02, 0x04, 0x69, 0x6e, 0x69,
+    0x74, 0x00, 0x00, 0x04, 0x64, 0x72, 0x6f, 0x70, 0x00, 0x01, 0x0c, 0x01,
+    0x01, 0x0a, 0x19, 0x02, 0x11, 0x00, 0x20, 0x00, 0x41, 0x00, 0x41, 0x05,
+    0xfc, 0x08, 0x00, 0x00, 0x20, 0x00, 0x2d, 0x00, 0x04, 0x0b, 0x05, 0x00,
+    0xfc, 0x09, 0x00, 0x0b, 0x0b, 0x08, 0x01, 0x01, 0x05, 0x68, 0x65, 0x6c,
+    0x6c, 0x6f,
+};
+
+static void check_segment(wasmbox_module_t *mod) {
+  wasmbox_value_t arg = {.s32 = 16}, result = {};
+  assert(wasmbox_call(mod, wasmbox_lookup_export(mod, "init"), &arg,
+                      &result) == 0);
+  assert(result.s32 == 'o');
+  assert(memcmp(mod->memory_block->data + 16, "hello", 5) == 0);
+  assert(wasmbox_call(mod, wasmbox_lookup_export(mod, "drop"), NULL,
+                      &result) == 0);
+  assert(wasmbox_call(mod, wasmbox_lookup_export(mod, "init"), &arg,
+                      &result) != 0);
+}
+
+int main() {
+  for (int borrow = 0; borrow < 2; borrow++) {
+    wasm_u8_t buffer[sizeof(module_binary)];
+    memcpy(buffer, module_binary, sizeof(buffer));
+    wasmbox_module_t mod = {};
+    mod.borrow_source = borrow;
+    assert(wasmbox_load_module_from_buffer(&mod, buffer, sizeof(buffer)) == 0);
+    // The bytes stay in a buffer which is promised to live.
+    wasmbox_data_segment_t *segment = &mod.data_segments[0];
+    assert(segment->borrowed == borrow);
+    assert((segment->data == buffer + sizeof(buffer) - 5) == borrow);
+    check_segment(&mod);
+    wasmbox_module_dispose(&mod);
+  }
+
+  // And in the mapping of a file, which the module keeps.
+  char path[] = "/tmp/wasmbox_passive_data_XXXXXX";
+  int fd = mkstemp(path);
+  assert(fd >= 0);
+  assert(write(fd, module_binary, sizeof(module_binary)) ==
+         (ssize_t) sizeof(module_binary));
+  close(fd);
+  wasmbox_module_t mod = {};
+  assert(wasmbox_load_module(&mod, path, strlen(path)) == 0);
+  unlink(path);
+  assert(mod.data_segments[0].borrowed);
+  assert(memcmp(mod.data_segments[0].data, "hello", 5) == 0);
+  check_segment(&mod);
+  wasmbox_module_dispose(&mod);
+  return 0;
+}
@@ -21,6 +21,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 static int compare_float(float x, float y) {
   float diff = x > y ? (x - y) : (y - x);
@@ -67,18 +68,84 @@ static int check_result(int result_length, wasmbox_value_t stack[],
   return !equal;
 }
 
+static wasm_u64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (wasm_u64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int compare_u64(const void *a, const void *b) {
+  wasm_u64_t x = *(const wasm_u64_t *) a;
+  wasm_u64_t y = *(const wasm_u64_t *) b;
+  return x < y ? -1 : x > y;
+}
+
+// Sorts `size` samples and prints their min, median and p99.
+static void report_latency(const char *name, wasm_u64_t *samples, int size) {
+  qsort(samples, size, sizeof(wasm_u64_t), compare_u64);
+  fprintf(stdout, "%s: runs=%d min=%llu ns median=%llu ns p99=%llu ns\n", name,
+          size, (unsigned long long) samples[0],
+          (unsigned long long) samples[size / 2],
+          (unsigned long long) samples[(size * 99) / 100]);
+}
+
+// Loads the module `runs` times, disposing it each time, and reports how
+// long loading took.
+static int time_load(const char *file_name, int runs) {
+  wasm_u64_t *samples = (wasm_u64_t *) malloc(sizeof(wasm_u64_t) * runs);
+  for (int i = 0; i < runs; i++) {
+    wasmbox_module_t mod = {};
+    wasm_u64_t start = now_ns();
+    if (wasmbox_load_module(&mod, file_name, strlen(file_name)) != 0) {
+      fprintf(stdout, "Failed to load a module(%s).\n", file_name);
+      free(samples);
+      return -1;
+    }
+    samples[i] = now_ns() - start;
+    wasmbox_module_dispose(&mod);
+  }
+  report_latency("load", samples, runs);
+  free(samples);
+  return 0;
+}
+
+// Usage: TestRunner [-n runs] [-w warmup] [-l loads] a.wasm a.wasm.result
+// With -n, _start runs `warmup` times, 3 by default, then `runs` times more,
+// each from the state right after loading, and the latency of the timed runs
+// is reported. With -l, loading is timed over `loads` loads first.
 int main(int argc, char const *argv[]) {
-  if (argc <= 2) {
-    fprintf(stdout, "usage: %s a.wasm a.wasm.result\n", argv[0]);
+  int runs = 0;
+  int warmup = 3;
+  int loads = 0;
+  int arg = 1;
+  while (arg + 1 < argc && argv[arg][0] == '-') {
+    if (strcmp(argv[arg], "-n") == 0) {
+      runs = atoi(argv[arg + 1]);
+    } else if (strcmp(argv[arg], "-w") == 0) {
+      warmup = atoi(argv[arg + 1]);
+    } else if (strcmp(argv[arg], "-l") == 0) {
+      loads = atoi(argv[arg + 1]);
+    } else {
+      break;
+    }
+    arg += 2;
+  }
+  if (argc - arg < 2) {
+    fprintf(stdout,
+            "usage: %s [-n runs] [-w warmup] [-l loads] a.wasm a.wasm.result\n",
+            argv[0]);
     return 0;
   }
-  FILE *fp = fopen(argv[2], "r");
+  const char *wasm_file = argv[arg];
+  FILE *fp = fopen(argv[arg + 1], "r");
   wasmbox_module_t mod = {};
   int stack_index = 0;
   wasmbox_value_t stack[1024] = {};
+  mod.stack_size = sizeof(stack) / sizeof(stack[0]);
   int expected_index = 0;
   wasmbox_value_t expected[10] = {};
   wasmbox_value_type_t expected_type[10] = {};
+  int expect_trap = 0;
 
   for (int i = 0; i < 10; ++i) {
     int io = fgetc(fp);
@@ -93,6 +160,10 @@ int main(int argc, char const *argv[]) {
       buf[j++] = (char) ch;
       ch = fgetc(fp);
     }
+    if (io == '!') { // the module is expected to trap
+      expect_trap = 1;
+      continue;
+    }
     wasmbox_value_t v;
     wasmbox_value_type_t type;
     switch (value_type) {
@@ -127,15 +198,70 @@ int main(int argc, char const *argv[]) {
     }
   }
 
-  if (wasmbox_load_module(&mod, argv[1], strlen(argv[1])) != 0) {
-    fprintf(stdout, "Failed to load a module(%s).\n", argv[1]);
+  if (loads > 0 && time_load(wasm_file, loads) != 0) {
+    return -1;
+  }
+  // Every run starts from the same state and arguments.
+  mod.resettable = runs > 0;
+  wasmbox_value_t arguments[sizeof(stack) / sizeof(stack[0])];
+  memcpy(arguments, stack, sizeof(stack));
+  int loaded = wasmbox_load_module(&mod, wasm_file, strlen(wasm_file));
+  if (loaded != 0 && mod.resettable) {
+    // Shared memory cannot be reset, so the runs share its state.
+    wasmbox_module_dispose(&mod);
+    mod = (wasmbox_module_t){};
+    mod.stack_size = sizeof(stack) / sizeof(stack[0]);
+    loaded = wasmbox_load_module(&mod, wasm_file, strlen(wasm_file));
+  }
+  if (loaded != 0) {
+    fprintf(stdout, "Failed to load a module(%s).\n", wasm_file);
     return -1;
   }
-  if (wasmbox_eval_module(&mod, stack) < 0) {
-    fprintf(stdout, "Failed to evaluate a module(%s).\n", argv[1]);
+  int total = runs > 0 ? warmup + runs : 1;
+  wasm_u64_t *samples = (wasm_u64_t *) malloc(sizeof(wasm_u64_t) * total);
+  for (int i = 0; i < total; i++) {
+    if (i > 0) {
+      if (mod.resettable) {
+        wasmbox_instance_reset(&mod);
+      }
+      memcpy(stack, arguments, sizeof(stack));
+    }
+    wasm_u64_t start = now_ns();
+    int ret = wasmbox_eval_module(&mod, stack);
+    samples[i] = now_ns() - start;
+    if (ret < 0) {
+      free(samples);
+      if (expect_trap) {
+        wasmbox_module_dispose(&mod);
+        return 0;
+      }
+      fprintf(stdout, "Failed to evaluate a module(%s).\n", wasm_file);
+      return -1;
+    }
+  }
+  if (runs > 0) {
+    report_latency("eval", samples + warmup, runs);
+  }
+  free(samples);
+  if (expect_trap) {
+    fprintf(stdout, "expected a trap(%s).\n", wasm_file);
     return -1;
   }
+#ifdef WASMBOX_VM_USE_MEMORY_PROFILE
+  wasmbox_memory_report_profile(&mod);
+#endif
   wasmbox_module_dispose(&mod);
-  wasmbox_allocator_report_statics();
+  wasmbox_allocation_stats_t stats;
+  wasmbox_allocation_stats(&stats);
+  fprintf(stdout, "allocated: %llu byte (%llu KB)\n",
+          (unsigned long long) stats.allocated,
+          (unsigned long long) stats.allocated / 1024);
+  fprintf(stdout, "freed:     %llu byte (%llu KB)\n",
+          (unsigned long long) stats.freed,
+          (unsigned long long) stats.freed / 1024);
+  if (stats.allocated != stats.freed) {
+    fprintf(stdout, "allocated != freed\n");
+    return -1;
+  }
   return check_result(expected_index, stack, expected, expected_type);
 }
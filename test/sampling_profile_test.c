@@ -0,0 +1,75 @@
+/*
+ * Copyright (C) 2021 Masahiro Ide
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "wasmbox/wasmbox.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * (func (export "_start") (result i32) i32.const 30 call $fib)
+ * (func $fib (param i32) (result i32) ...) ;; recursive, named by the name
+ *                                         ;; section only
+ */
+static const wasm_u8_t module_binary[] = {
+    0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00, 0x01, 0x0a, 0x02, 0x60,
+    0x00, 0x01, 0x7f, 0x60, 0x01, 0x7f, 0x01, 0x7f, 0x03, 0x03, 0x02, 0x00,
+    0x01, 0x07, 0x0a, 0x01, 0x06, 0x5f, 0x73, 0x74, 0x61, 0x72, 0x74, 0x00,
+    0x00, 0x0a, 0x25, 0x02, 0x06, 0x00, 0x41, 0x1e, 0x10, 0x01, 0x0b, 0x1c,
+    0x00, 0x20, 0x00, 0x41, 0x02, 0x49, 0x04, 0x7f, 0x20, 0x00, 0x05, 0x20,
+    0x00, 0x41, 0x01, 0x6b, 0x10, 0x01, 0x20, 0x00, 0x41, 0x02, 0x6b, 0x10,
+    0x01, 0x6a, 0x0b, 0x0b, 0x00, 0x0d, 0x04, 0x6e, 0x61, 0x6d, 0x65, 0x01,
+    0x06, 0x01, 0x01, 0x03, 0x66, 0x69, 0x62};
+
+int main() {
+  wasmbox_module_t mod = {};
+  assert(wasmbox_load_module_from_buffer(&mod, module_binary,
+                                         sizeof(module_binary)) == 0);
+  wasmbox_name_t *name = mod.functions[1]->name;
+  assert(name != NULL && name->len == 3 && memcmp(name->value, "fib", 3) == 0);
+#ifdef WASMBOX_VM_USE_SAMPLING_PROFILE
+  const char *file_name = "sampling_profile_test.folded";
+  assert(wasmbox_sampling_profile_start(&mod, 1000) == 0);
+  assert(wasmbox_sampling_profile_start(&mod, 1000) == -1);
+#endif
+  wasmbox_value_t stack[1024] = {};
+  assert(wasmbox_eval_module(&mod, stack) == 0);
+  assert(stack[0].s32 == 832040);
+#ifdef WASMBOX_VM_USE_SAMPLING_PROFILE
+  int samples = wasmbox_sampling_profile_stop(&mod, file_name);
+  assert(samples > 0);
+  FILE *fp = fopen(file_name, "r");
+  assert(fp != NULL);
+  char line[4096];
+  int total = 0, recursive = 0;
+  while (fgets(line, sizeof(line), fp) != NULL) {
+    char *count = strrchr(line, ' ');
+    assert(count != NULL);
+    total += atoi(count + 1);
+    recursive |= strncmp(line, "_start;fib;fib", 14) == 0;
+  }
+  fclose(fp);
+  remove(file_name);
+  assert(total == samples);
+#  ifndef WASMBOX_VM_USE_JIT
+  assert(recursive);
+#  endif
+#endif
+  wasmbox_module_dispose(&mod);
+  return 0;
+}
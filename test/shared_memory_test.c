@@ -0,0 +1,69 @@
+/*
+ * Copyright (C) 2021 Masahiro Ide
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "atomic-wait.h"
+#include "memory.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <sched.h>
+
+static wasm_u32_t *futex_word;
+
+static void *wait_for_notify(void *arg) {
+  (void) arg;
+  return (void *) (uintptr_t) wasmbox_atomic_wait(futex_word, 0, 0, -1);
+}
+
+int main() {
+  wasmbox_shared_memory_t *memory = wasmbox_shared_memory_create(1, 4);
+  if (memory == NULL) {
+    // Shared memory needs a reservation, which this host does not have.
+    return 0;
+  }
+  wasmbox_module_t a = {};
+  wasmbox_module_t b = {};
+  a.shared_memory = memory;
+  b.shared_memory = memory;
+  assert(wasmbox_memory_init_shared(&a, 1, 4) == 0);
+  assert(wasmbox_memory_init_shared(&b, 1, 4) == 0);
+  assert(a.memory_block == b.memory_block);
+  assert(wasmbox_memory_is_shared(&a));
+  // Growing through one module is seen by the other.
+  assert(wasmbox_memory_grow(&a, 2) == 1);
+  assert(wasmbox_memory_size(&b) == 3);
+  b.memory_block->data[2 * WASMBOX_PAGE_SIZE] = 1;
+  assert(wasmbox_memory_grow(&b, 2) == WASM_U32_MAX);
+
+  futex_word = (wasm_u32_t *) a.memory_block->data;
+  pthread_t thread;
+  assert(pthread_create(&thread, NULL, wait_for_notify, NULL) == 0);
+  while (wasmbox_atomic_notify(futex_word, 1) == 0) {
+    sched_yield();
+  }
+  void *result;
+  pthread_join(thread, &result);
+  assert((uintptr_t) result == WASMBOX_ATOMIC_WAIT_OK);
+  assert(wasmbox_atomic_wait(futex_word, 1, 0, -1) ==
+         WASMBOX_ATOMIC_WAIT_NOT_EQUAL);
+  assert(wasmbox_atomic_wait(futex_word, 0, 0, 1000) ==
+         WASMBOX_ATOMIC_WAIT_TIMED_OUT);
+
+  wasmbox_memory_dispose(&a);
+  wasmbox_memory_dispose(&b);
+  wasmbox_shared_memory_release(memory);
+  return 0;
+}
@@ -0,0 +1,153 @@
+/*
+ * Copyright (C) 2021 Masahiro Ide
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "wasmbox/wasmbox.h"
+
+#include <assert.h>
+
+/*
+ * (memory 1)
+ * (data (i32.const 0) "\01\00\00\00\02\00\00\00\03\00\00\00\04\00\00\00"
+ *                     "\0a\00\00\00\14\00\00\00\1e\00\00\00\28\00\00\00")
+ * (func $add (export "add") (param v128 v128) (result v128)
+ *   (i32x4.add (local.get 0) (local.get 1)))
+ * (func (export "dot") (result i32) (local v128)
+ *   (local.tee 0 (i32x4.mul (v128.load (i32.const 0))
+ *                           (v128.load offset=16 (i32.const 0))))
+ *   (i32x4.extract_lane 0)
+ *   (i32.add (i32x4.extract_lane 1 (local.get 0)))
+ *   (i32.add (i32x4.extract_lane 2 (local.get 0)))
+ *   (i32.add (i32x4.extract_lane 3 (local.get 0))))
+ * (func (export "shuffle") (result i64)
+ *   (i64x2.extract_lane 0
+ *     (i8x16.shuffle 31 30 29 28 27 26 25 24 23 22 21 20 19 18 17 16
+ *       (v128.const i8x16 0 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15)
+ *       (v128.const i8x16 16 17 18 19 20 21 22 23 24 25 26 27 28 29 30 31))))
+ * (func (export "store") (param i32) (result i32)
+ *   (v128.store offset=32 (i32.const 0) (i32x4.splat (local.get 0)))
+ *   (i32.load offset=44 (i32.const 0)))
+ * (func (export "select") (param i32) (result i64)
+ *   (i64x2.extract_lane 1 (select (v128.const i64x2 1 2)
+ *                                 (v128.const i64x2 3 4) (local.get 0))))
+ * (func (export "call") (result i32) (local i32 v128 v128)
+ *   (block (result v128)
+ *     (call $add (v128.const i32x4 1 2 3 4)
+ *                (v128.const i32x4 10 20 30 0x7fffffff)))
+ *   (local.set 1) (local.set 2 (local.get 1)) (local.set 0 (i32.const 7))
+ *   (i32.add (i32x4.extract_lane 3 (local.get 2)) (local.get 0)))
+ * (func (export "fmin") (result i32)
+ *   (i32x4.extract_lane 0 (f32x4.min (v128.const f32x4 -0 1 5 2)
+ *                                    (v128.const f32x4 0 3 nan 1))))
+ * (func (export "addsat") (result i32)
+ *   (i8x16.bitmask
+ *     (i8x16.add_sat_s
+ *       (v128.const i8x16 100 100 100 100 100 100 100 100
+ *                         -128 -128 -128 -128 -128 -128 -128 -128)
+ *       (v128.const i8x16 100 100 100 100 100 100 100 100
+ *                         -1 -1 -1 -1 -1 -1 -1 -1))))
+ */
+static const wasm_u8_t module_binary[] = {
+    0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00, 0x01, 0x1d, 0x06, 0x60,
+    0x02, 0x7b, 0x7b, 0x01, 0x7b, 0x60, 0x00, 0x01, 0x7f, 0x60, 0x00, 0x01,
+    0x7e, 0x60, 0x01, 0x7f, 0x01, 0x7f, 0x60, 0x01, 0x7f, 0x01, 0x7e, 0x60,
+    0x00, 0x01, 0x7f, 0x03, 0x09, 0x08, 0x00, 0x01, 0x02, 0x03, 0x04, 0x01,
+    0x05, 0x05, 0x05, 0x03, 0x01, 0x00, 0x01, 0x07, 0x3f, 0x08, 0x03, 0x61,
+    0x64, 0x64, 0x00, 0x00, 0x03, 0x64, 0x6f, 0x74, 0x00, 0x01, 0x07, 0x73,
+    0x68, 0x75, 0x66, 0x66, 0x6c, 0x65, 0x00, 0x02, 0x05, 0x73, 0x74, 0x6f,
+    0x72, 0x65, 0x00, 0x03, 0x06, 0x73, 0x65, 0x6c, 0x65, 0x63, 0x74, 0x00,
+    0x04, 0x04, 0x63, 0x61, 0x6c, 0x6c, 0x00, 0x05, 0x04, 0x66, 0x6d, 0x69,
+    0x6e, 0x00, 0x06, 0x06, 0x61, 0x64, 0x64, 0x73, 0x61, 0x74, 0x00, 0x07,
+    0x0a, 0xcb, 0x02, 0x08, 0x09, 0x00, 0x20, 0x00, 0x20, 0x01, 0xfd, 0xae,
+    0x01, 0x0b, 0x2a, 0x01, 0x01, 0x7b, 0x41, 0x00, 0xfd, 0x00, 0x04, 0x00,
+    0x41, 0x00, 0xfd, 0x00, 0x04, 0x10, 0xfd, 0xb5, 0x01, 0x22, 0x00, 0xfd,
+    0x1b, 0x00, 0x20, 0x00, 0xfd, 0x1b, 0x01, 0x6a, 0x20, 0x00, 0xfd, 0x1b,
+    0x02, 0x6a, 0x20, 0x00, 0xfd, 0x1b, 0x03, 0x6a, 0x0b, 0x3b, 0x00, 0xfd,
+    0x0c, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a,
+    0x0b, 0x0c, 0x0d, 0x0e, 0x0f, 0xfd, 0x0c, 0x10, 0x11, 0x12, 0x13, 0x14,
+    0x15, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f, 0xfd,
+    0x0d, 0x1f, 0x1e, 0x1d, 0x1c, 0x1b, 0x1a, 0x19, 0x18, 0x17, 0x16, 0x15,
+    0x14, 0x13, 0x12, 0x11, 0x10, 0xfd, 0x1d, 0x00, 0x0b, 0x11, 0x00, 0x41,
+    0x00, 0x20, 0x00, 0xfd, 0x11, 0xfd, 0x0b, 0x04, 0x20, 0x41, 0x00, 0x28,
+    0x02, 0x2c, 0x0b, 0x2c, 0x00, 0xfd, 0x0c, 0x01, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xfd,
+    0x0c, 0x03, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x04, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x20, 0x00, 0x1b, 0xfd, 0x1d, 0x01, 0x0b,
+    0x41, 0x02, 0x01, 0x7f, 0x02, 0x7b, 0x02, 0x7b, 0xfd, 0x0c, 0x01, 0x00,
+    0x00, 0x00, 0x02, 0x00, 0x00, 0x00, 0x03, 0x00, 0x00, 0x00, 0x04, 0x00,
+    0x00, 0x00, 0xfd, 0x0c, 0x0a, 0x00, 0x00, 0x00, 0x14, 0x00, 0x00, 0x00,
+    0x1e, 0x00, 0x00, 0x00, 0xff, 0xff, 0xff, 0x7f, 0x10, 0x00, 0x0b, 0x21,
+    0x01, 0x20, 0x01, 0x21, 0x02, 0x41, 0x07, 0x21, 0x00, 0x20, 0x02, 0xfd,
+    0x1b, 0x03, 0x20, 0x00, 0x6a, 0x0b, 0x2c, 0x00, 0xfd, 0x0c, 0x00, 0x00,
+    0x00, 0x80, 0x00, 0x00, 0x80, 0x3f, 0x00, 0x00, 0xa0, 0x40, 0x00, 0x00,
+    0x00, 0x40, 0xfd, 0x0c, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x40, 0x40,
+    0x00, 0x00, 0xc0, 0x7f, 0x00, 0x00, 0x80, 0x3f, 0xfd, 0xe8, 0x01, 0xfd,
+    0x1b, 0x00, 0x0b, 0x2a, 0x00, 0xfd, 0x0c, 0x64, 0x64, 0x64, 0x64, 0x64,
+    0x64, 0x64, 0x64, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0xfd,
+    0x0c, 0x64, 0x64, 0x64, 0x64, 0x64, 0x64, 0x64, 0x64, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xfd, 0x6f, 0xfd, 0x64, 0x0b, 0x0b, 0x26,
+    0x01, 0x00, 0x41, 0x00, 0x0b, 0x20, 0x01, 0x00, 0x00, 0x00, 0x02, 0x00,
+    0x00, 0x00, 0x03, 0x00, 0x00, 0x00, 0x04, 0x00, 0x00, 0x00, 0x0a, 0x00,
+    0x00, 0x00, 0x14, 0x00, 0x00, 0x00, 0x1e, 0x00, 0x00, 0x00, 0x28, 0x00,
+    0x00, 0x00};
+
+static wasm_u32_t call_i32(wasmbox_module_t *mod, const char *name,
+                           wasm_s32_t arg) {
+  wasmbox_value_t args[1] = {{.s32 = arg}};
+  wasmbox_value_t result = {};
+  assert(wasmbox_call(mod, wasmbox_lookup_export(mod, name), args, &result) ==
+         0);
+  return result.u32;
+}
+
+static wasm_u64_t call_i64(wasmbox_module_t *mod, const char *name,
+                           wasm_s32_t arg) {
+  wasmbox_value_t args[1] = {{.s32 = arg}};
+  wasmbox_value_t result = {};
+  assert(wasmbox_call(mod, wasmbox_lookup_export(mod, name), args, &result) ==
+         0);
+  return result.u64;
+}
+
+int main() {
+  wasmbox_module_t mod = {};
+  assert(wasmbox_load_module_from_buffer(&mod, module_binary,
+                                         sizeof(module_binary)) == 0);
+
+  // A v128 is passed and returned as two values, the low half first.
+  const wasmbox_export_t *add = wasmbox_lookup_export(&mod, "add");
+  assert(add->func->type->argument_size == 4);
+  assert(add->func->type->return_size == 2);
+  wasmbox_value_t args[4] = {{.u64 = 0x0000000200000001},
+                             {.u64 = 0x00000004ffffffff},
+                             {.u64 = 0x0000001000000010},
+                             {.u64 = 0x0000001000000001}};
+  wasmbox_value_t results[2] = {};
+  assert(wasmbox_call(&mod, add, args, results) == 0);
+  assert(results[0].u64 == 0x0000001200000011);
+  assert(results[1].u64 == 0x0000001400000000);
+
+  assert(call_i32(&mod, "dot", 0) == 300);
+  assert(call_i64(&mod, "shuffle", 0) == 0x18191a1b1c1d1e1f);
+  assert(call_i32(&mod, "store", 1234) == 1234);
+  assert(call_i64(&mod, "select", 1) == 2);
+  assert(call_i64(&mod, "select", 0) == 4);
+  assert(call_i32(&mod, "call", 0) == 0x80000003 + 7);
+  // -0 is less than +0.
+  assert(call_i32(&mod, "fmin", 0) == 0x80000000);
+  assert(call_i32(&mod, "addsat", 0) == 0xff00);
+  wasmbox_module_dispose(&mod);
+  return 0;
+}
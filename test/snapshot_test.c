@@ -0,0 +1,116 @@
+/*
+ * Copyright (C) 2021 Masahiro Ide
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "memory.h"
+#include "snapshot.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h> // mkstemp
+#include <string.h>
+#include <unistd.h>
+
+/*
+ * (table 1 funcref)
+ * (func (export "_start") (result i32)
+ *   (table.grow (ref.null func) (i32.const 1)))
+ */
+static const wasm_u8_t table_grow_binary[] = {
+    0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00, 0x01, 0x05, 0x01, 0x60,
+    0x00, 0x01, 0x7f, 0x03, 0x02, 0x01, 0x00, 0x04, 0x04, 0x01, 0x70, 0x00,
+    0x01, 0x07, 0x0a, 0x01, 0x06, 0x5f, 0x73, 0x74, 0x61, 0x72, 0x74, 0x00,
+    0x00, 0x0a, 0x0b, 0x01, 0x09, 0x00, 0xd0, 0x70, 0x41, 0x01, 0xfc, 0x0f,
+    0x00, 0x0b};
+
+int main() {
+  char file_name[] = "/tmp/wasmbox-snapshot-XXXXXX";
+  close(mkstemp(file_name));
+
+  wasmbox_module_t src = {};
+  wasmbox_value_t src_globals[2] = {};
+  src_globals[0].u64 = 0x1122334455667788ULL;
+  src_globals[1].u32 = 42;
+  src.globals = src_globals;
+  src.global_size = 2;
+  src.source_size = 123;
+  src.source_hash = 0x0123456789abcdefULL;
+  assert(wasmbox_memory_init(&src, 3, 4) == 0);
+  memcpy(src.memory_block->data + 100, "hello", 5);
+  src.memory_block->data[2 * WASMBOX_PAGE_SIZE + 7] = 9;
+  assert(wasmbox_instance_snapshot(&src, file_name) == 0);
+  wasmbox_memory_dispose(&src);
+
+  wasmbox_module_t mod = {};
+  wasmbox_value_t globals[2] = {};
+  wasmbox_snapshot_t snapshot = {};
+  mod.snapshot_file = file_name;
+  // A snapshot only applies to the module binary it was taken from, which
+  // another binary of the same size is not.
+  mod.source_size = 123;
+  mod.source_hash = 0x0123456789abcdeeULL;
+  assert(wasmbox_snapshot_open(&snapshot, &mod) == -1);
+  wasmbox_snapshot_close(&snapshot);
+  mod.source_size = 124;
+  mod.source_hash = 0x0123456789abcdefULL;
+  assert(wasmbox_snapshot_open(&snapshot, &mod) == -1);
+  wasmbox_snapshot_close(&snapshot);
+  mod.source_size = 123;
+  assert(wasmbox_snapshot_open(&snapshot, &mod) == 0);
+  assert(mod.memory_image == mod.snapshot_image);
+  mod.globals = globals;
+  mod.global_size = 2;
+  assert(wasmbox_snapshot_restore_globals(&snapshot, &mod) == 0);
+  wasmbox_snapshot_close(&snapshot);
+  assert(globals[0].u64 == 0x1122334455667788ULL && globals[1].u32 == 42);
+
+  assert(wasmbox_memory_init(&mod, 1, 4) == 0);
+  assert(mod.memory_block_size == 3);
+  assert(memcmp(mod.memory_block->data + 100, "hello", 5) == 0);
+  assert(mod.memory_block->data[2 * WASMBOX_PAGE_SIZE + 7] == 9);
+  assert(mod.memory_block->data[WASMBOX_PAGE_SIZE] == 0);
+  // The file is mapped privately.
+  mod.memory_block->data[100] = 'j';
+  wasmbox_memory_dispose(&mod);
+  wasmbox_memory_image_dispose(mod.snapshot_image);
+
+  // Tables are not saved, so one that table.grow has modified is refused.
+  wasmbox_module_t grown = {};
+  wasmbox_value_t stack[1024] = {};
+  assert(wasmbox_load_module_from_buffer(&grown, table_grow_binary,
+                                         sizeof(table_grow_binary)) == 0);
+  assert(wasmbox_instance_snapshot(&grown, file_name) == 0);
+  assert(wasmbox_eval_module(&grown, stack) == 0);
+  assert(stack[0].s32 == 1 && grown.tables[0].size == 2);
+  assert(wasmbox_instance_snapshot(&grown, file_name) == -1);
+  wasmbox_module_dispose(&grown);
+
+  // The snapshot taken before is matched by the content of the binary.
+  wasm_u8_t binary[sizeof(table_grow_binary)];
+  memcpy(binary, table_grow_binary, sizeof(binary));
+  wasmbox_module_t restored = {};
+  restored.snapshot_file = file_name;
+  assert(wasmbox_load_module_from_buffer(&restored, binary, sizeof(binary)) ==
+         0);
+  wasmbox_module_dispose(&restored);
+  binary[sizeof(binary) - 5] = 0x02; // (i32.const 2)
+  restored = (wasmbox_module_t){};
+  restored.snapshot_file = file_name;
+  assert(wasmbox_load_module_from_buffer(&restored, binary, sizeof(binary)) ==
+         -1);
+  wasmbox_module_dispose(&restored);
+  remove(file_name);
+  return 0;
+}
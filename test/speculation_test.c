@@ -0,0 +1,98 @@
+/*
+ * Copyright (C) 2021 Masahiro Ide
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "wasmbox/wasmbox.h"
+
+#include <assert.h>
+
+/*
+ * (type $unary (func (param i32) (result i32)))
+ * (table 2 funcref)
+ * (elem (i32.const 0) $inc $dbl)
+ * (func $inc (param i32) (result i32) (i32.add (local.get 0) (i32.const 1)))
+ * (func $dbl (param i32) (result i32) (i32.mul (local.get 0) (i32.const 2)))
+ * (func (export "apply") (param i32 i32) (result i32)
+ *   (call_indirect (type $unary) (local.get 0) (local.get 1)))
+ * (func (export "swap") (table.set (i32.const 0) (ref.func $dbl)))
+ */
+static const wasm_u8_t module_binary[] = {
+    0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00, 0x01, 0x0f, 0x03, 0x60,
+    0x01, 0x7f, 0x01, 0x7f, 0x60, 0x02, 0x7f, 0x7f, 0x01, 0x7f, 0x60, 0x00,
+    0x00, 0x03, 0x05, 0x04, 0x00, 0x00, 0x01, 0x02, 0x04, 0x04, 0x01, 0x70,
+    0x00, 0x02, 0x07, 0x10, 0x02, 0x05, 0x61, 0x70, 0x70, 0x6c, 0x79, 0x00,
+    0x02, 0x04, 0x73, 0x77, 0x61, 0x70, 0x00, 0x03, 0x09, 0x08, 0x01, 0x00,
+    0x41, 0x00, 0x0b, 0x02, 0x00, 0x01, 0x0a, 0x24, 0x04, 0x07, 0x00, 0x20,
+    0x00, 0x41, 0x01, 0x6a, 0x0b, 0x07, 0x00, 0x20, 0x00, 0x41, 0x02, 0x6c,
+    0x0b, 0x09, 0x00, 0x20, 0x00, 0x20, 0x01, 0x11, 0x00, 0x00, 0x0b, 0x08,
+    0x00, 0x41, 0x00, 0xd2, 0x01, 0x26, 0x00, 0x0b};
+
+static wasm_s32_t apply(wasmbox_module_t *mod, const wasmbox_export_t *export,
+                        wasm_s32_t x, wasm_s32_t index) {
+  wasmbox_value_t args[2] = {{.s32 = x}, {.s32 = index}};
+  wasmbox_value_t result = {};
+  assert(wasmbox_call(mod, export, args, &result) == 0);
+  return result.s32;
+}
+
+int main() {
+  wasmbox_module_t mod = {};
+#ifdef WASMBOX_VM_USE_LAZY_COMPILE
+  mod.speculation_threshold = 16;
+#endif
+  assert(wasmbox_load_module_from_buffer(&mod, module_binary,
+                                         sizeof(module_binary)) == 0);
+  const wasmbox_export_t *apply_export = wasmbox_lookup_export(&mod, "apply");
+  const wasmbox_export_t *swap = wasmbox_lookup_export(&mod, "swap");
+  assert(apply(&mod, apply_export, 5, 0) == 6);
+  wasmbox_code_t *generic_code = apply_export->func->code;
+  for (int i = 0; i < 64; i++) {
+    assert(apply(&mod, apply_export, i, 0) == i + 1);
+  }
+#ifdef WASMBOX_VM_USE_LAZY_COMPILE
+  // The site has only called $inc, so "apply" calls it directly now.
+  assert(apply_export->func->code != generic_code);
+#else
+  (void) generic_code;
+#endif
+
+  // Other entries take the indirect call, which still checks them.
+  assert(apply(&mod, apply_export, 5, 1) == 10);
+  wasmbox_value_t args[2] = {{.s32 = 5}, {.s32 = 2}};
+  wasmbox_value_t result = {};
+  assert(wasmbox_call(&mod, apply_export, args, &result) == -1);
+
+  // The guard notices that the entry no longer holds $inc.
+  assert(wasmbox_call(&mod, swap, NULL, NULL) == 0);
+  assert(apply(&mod, apply_export, 5, 0) == 10);
+  wasmbox_module_dispose(&mod);
+
+#ifdef WASMBOX_VM_USE_LAZY_COMPILE
+  // A negative threshold disables speculation.
+  wasmbox_module_t disabled = {};
+  disabled.speculation_threshold = -1;
+  assert(wasmbox_load_module_from_buffer(&disabled, module_binary,
+                                         sizeof(module_binary)) == 0);
+  apply_export = wasmbox_lookup_export(&disabled, "apply");
+  assert(apply(&disabled, apply_export, 5, 0) == 6);
+  generic_code = apply_export->func->code;
+  for (int i = 0; i < 64; i++) {
+    assert(apply(&disabled, apply_export, i, 0) == i + 1);
+  }
+  assert(apply_export->func->code == generic_code);
+  wasmbox_module_dispose(&disabled);
+#endif
+  return 0;
+}
@@ -0,0 +1,78 @@
+/*
+ * Copyright (C) 2021 Masahiro Ide
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "wasmbox/wasmbox.h"
+
+#include <assert.h>
+
+/*
+ * (import "env" "swap" (func $swap (param i32) (result i32)))
+ * (global $sp (mut i32) (i32.const 1024))
+ * (func (export "run") (result i32)
+ *   (global.set $sp (i32.sub (global.get $sp) (i32.const 16)))
+ *   (i32.add (call $swap (i32.const 0)) (global.get $sp)))
+ * (func (export "trap") (result i32)
+ *   (global.set $sp (i32.sub (global.get $sp) (i32.const 32)))
+ *   (unreachable))
+ */
+static const wasm_u8_t module_binary[] = {
+    0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00, 0x01, 0x0a, 0x02, 0x60,
+    0x01, 0x7f, 0x01, 0x7f, 0x60, 0x00, 0x01, 0x7f, 0x02, 0x0c, 0x01, 0x03,
+    0x65, 0x6e, 0x76, 0x04, 0x73, 0x77, 0x61, 0x70, 0x00, 0x00, 0x03, 0x03,
+    0x02, 0x01, 0x01, 0x06, 0x07, 0x01, 0x7f, 0x01, 0x41, 0x80, 0x08, 0x0b,
+    0x07, 0x0e, 0x02, 0x03, 0x72, 0x75, 0x6e, 0x00, 0x01, 0x04, 0x74, 0x72,
+    0x61, 0x70, 0x00, 0x02, 0x0a, 0x1d, 0x02, 0x10, 0x00, 0x23, 0x00, 0x41,
+    0x10, 0x6b, 0x24, 0x00, 0x41, 0x00, 0x10, 0x00, 0x23, 0x00, 0x6a, 0x0b,
+    0x0a, 0x00, 0x23, 0x00, 0x41, 0x20, 0x6b, 0x24, 0x00, 0x00, 0x0b};
+
+// Sees the stack pointer the guest left, then moves it as a host would.
+static void swap(wasmbox_module_t *mod, const wasmbox_value_t *args,
+                 wasmbox_value_t *results, void *data) {
+  results[0].u32 = mod->globals[0].u32;
+  mod->globals[0].u64 = 4096;
+}
+
+int main() {
+  static const wasmbox_value_type_t swap_types[] = {WASM_TYPE_I32,
+                                                    WASM_TYPE_I32};
+  wasmbox_host_function_t host = {};
+  host.module = "env";
+  host.name = "swap";
+  host.kind = WASMBOX_HOST_FRAME;
+  host.entry.frame = swap;
+  host.types = swap_types;
+  host.param_size = 1;
+  host.result_size = 1;
+
+  wasmbox_module_t mod = {};
+  mod.host_functions = &host;
+  mod.host_function_size = 1;
+  assert(wasmbox_load_module_from_buffer(&mod, module_binary,
+                                         sizeof(module_binary)) == 0);
+  assert(mod.stack_pointer_global == 1);
+  wasmbox_value_t result = {};
+  assert(wasmbox_call(&mod, wasmbox_lookup_export(&mod, "run"), NULL,
+                      &result) == 0);
+  assert(result.u32 == 1008 + 4096);
+  assert(mod.globals[0].u32 == 4096);
+  // The global is kept up to date even when the guest traps.
+  assert(wasmbox_call(&mod, wasmbox_lookup_export(&mod, "trap"), NULL,
+                      &result) != 0);
+  assert(mod.globals[0].u32 == 4096 - 32);
+  wasmbox_module_dispose(&mod);
+  return 0;
+}
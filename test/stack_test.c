@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) 2021 Masahiro Ide
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "wasmbox/wasmbox.h"
+
+#include <assert.h>
+
+/*
+ * (func $depth (export "depth") (param i32) (result i32)
+ *   (if (result i32) (i32.eqz (local.get 0))
+ *     (then (i32.const 0))
+ *     (else (i32.add (call $depth (i32.sub (local.get 0) (i32.const 1)))
+ *                    (i32.const 1)))))
+ */
+static const wasm_u8_t module_binary[] = {
+    0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00, 0x01, 0x06, 0x01,
+    0x60, 0x01, 0x7f, 0x01, 0x7f, 0x03, 0x02, 0x01, 0x00, 0x07, 0x09,
+    0x01, 0x05, 0x64, 0x65, 0x70, 0x74, 0x68, 0x00, 0x00, 0x0a, 0x17,
+    0x01, 0x15, 0x00, 0x20, 0x00, 0x45, 0x04, 0x7f, 0x41, 0x00, 0x05,
+    0x20, 0x00, 0x41, 0x01, 0x6b, 0x10, 0x00, 0x41, 0x01, 0x6a, 0x0b,
+    0x0b};
+
+int main() {
+  wasmbox_module_t mod = {};
+  assert(wasmbox_load_module_from_buffer(&mod, module_binary,
+                                         sizeof(module_binary)) == 0);
+  const wasmbox_export_t *depth = wasmbox_lookup_export(&mod, "depth");
+  assert(depth != NULL);
+
+  wasmbox_value_t args[1] = {{.s32 = 10}};
+  wasmbox_value_t result = {};
+  assert(wasmbox_call(&mod, depth, args, &result) == 0);
+  wasmbox_memory_usage_t usage;
+  wasmbox_module_memory_usage(&mod, &usage);
+  assert(usage.code > 0 && usage.types > 0 && usage.names > 0);
+  assert(usage.memory_committed == 0 && usage.memory_reserved == 0);
+  wasm_u64_t shallow = usage.stack_high_water;
+  assert(shallow >= 10 * sizeof(wasmbox_value_t));
+
+  // Far deeper than a stack which would be allocated up front.
+  args[0].s32 = 100000;
+  assert(wasmbox_call(&mod, depth, args, &result) == 0);
+  assert(result.s32 == 100000);
+  wasmbox_module_memory_usage(&mod, &usage);
+  assert(usage.stack_high_water > 5000 * shallow);
+
+  // Runaway recursion traps, and the instance can be called again.
+  args[0].s32 = 100000000;
+  assert(wasmbox_call(&mod, depth, args, &result) == -1);
+  args[0].s32 = 10;
+  assert(wasmbox_call(&mod, depth, args, &result) == 0);
+  assert(result.s32 == 10);
+
+  // A stack of the embedder is checked against `stack_size`.
+  wasmbox_value_t stack[64] = {};
+  mod.stack_size = sizeof(stack) / sizeof(stack[0]);
+  WASMBOX_ADD_ARGUMENT(stack, 0, s32, 3);
+  assert(wasmbox_eval_export(&mod, depth, stack) == 0);
+  assert(stack[0].s32 == 3);
+  WASMBOX_ADD_ARGUMENT(stack, 0, s32, 1000);
+  assert(wasmbox_eval_export(&mod, depth, stack) == -1);
+
+  wasmbox_context_t *ctx = wasmbox_context_create(&mod, 256);
+  args[0].s32 = 5;
+  assert(wasmbox_context_call(ctx, depth, args, &result) == 0);
+  assert(result.s32 == 5);
+  args[0].s32 = 1000;
+  assert(wasmbox_context_call(ctx, depth, args, &result) == -1);
+  wasmbox_context_dispose(ctx);
+
+  wasmbox_module_dispose(&mod);
+  return 0;
+}
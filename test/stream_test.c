@@ -0,0 +1,75 @@
+/*
+ * Copyright (C) 2021 Masahiro Ide
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "wasmbox/wasmbox.h"
+
+#include <assert.h>
+
+/**
+ * (memory 1)
+ * (func $add (param i32 i32) (result i32) local.get 0 local.get 1 i32.add)
+ * (func (export "_start") (result i32)
+ *   i32.const 40 i32.load8_u i32.const 2 call $add)
+ * (data (i32.const 40) "\28")
+ */
+static const wasm_u8_t module_binary[] = {
+    0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00, 0x01, 0x0b, 0x02, 0x60,
+    0x02, 0x7f, 0x7f, 0x01, 0x7f, 0x60, 0x00, 0x01, 0x7f, 0x03, 0x03, 0x02,
+    0x00, 0x01, 0x05, 0x03, 0x01, 0x00, 0x01, 0x07, 0x0a, 0x01, 0x06, 0x5f,
+    0x73, 0x74, 0x61, 0x72, 0x74, 0x00, 0x01, 0x0a, 0x15, 0x02, 0x07, 0x00,
+    0x20, 0x00, 0x20, 0x01, 0x6a, 0x0b, 0x0b, 0x00, 0x41, 0x28, 0x2d, 0x00,
+    0x00, 0x41, 0x02, 0x10, 0x00, 0x0b, 0x0b, 0x07, 0x01, 0x00, 0x41, 0x28,
+    0x0b, 0x01, 0x28};
+
+static int load(wasmbox_module_t *mod, size_t length, size_t chunk) {
+  wasmbox_stream_t *stream = wasmbox_stream_create(mod);
+  assert(stream != NULL);
+  for (size_t i = 0; i < length; i += chunk) {
+    size_t size = length - i < chunk ? length - i : chunk;
+    if (wasmbox_stream_feed(stream, module_binary + i, size) != 0) {
+      break;
+    }
+  }
+  return wasmbox_stream_finish(stream);
+}
+
+int main() {
+  static const size_t chunks[] = {1, 7, 44, sizeof(module_binary)};
+  for (int i = 0; i < sizeof(chunks) / sizeof(chunks[0]); i++) {
+    wasmbox_module_t mod = {};
+#ifdef WASMBOX_VM_USE_PARALLEL_COMPILE
+    // Bodies are handed to a worker while the rest is still arriving.
+    mod.compile_threads = 2;
+#endif
+    assert(load(&mod, sizeof(module_binary), chunks[i]) == 0);
+    wasmbox_value_t stack[1024] = {};
+    assert(wasmbox_eval_module(&mod, stack) == 0);
+    assert(stack[0].s32 == 42);
+    wasmbox_module_dispose(&mod);
+  }
+
+  // The binary ends inside the second function body.
+  wasmbox_module_t truncated = {};
+  assert(load(&truncated, 60, 5) != 0);
+  wasmbox_module_dispose(&truncated);
+
+  wasmbox_module_t garbage = {};
+  wasmbox_stream_t *stream = wasmbox_stream_create(&garbage);
+  assert(wasmbox_stream_feed(stream, module_binary + 1, 8) != 0);
+  assert(wasmbox_stream_finish(stream) != 0);
+  wasmbox_module_dispose(&garbage);
+  return 0;
+}
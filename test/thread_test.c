@@ -0,0 +1,85 @@
+/*
+ * Copyright (C) 2021 Masahiro Ide
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "wasmbox/wasmbox.h"
+
+#include <assert.h>
+#include <pthread.h>
+
+/*
+ * (type $t (func (param i32) (result i32)))
+ * (table 2 funcref) (elem (i32.const 0) $inc $dbl)
+ * (global $g (mut i32) (i32.const 0))
+ * (func $inc (param i32) (result i32) (i32.add (local.get 0) (i32.const 1)))
+ * (func $dbl (param i32) (result i32) (i32.mul (local.get 0) (i32.const 2)))
+ * (func (export "pick") (param i32 i32) (result i32)
+ *   (global.set $g (i32.add (global.get $g) (i32.const 1)))
+ *   (call_indirect (type $t) (local.get 0) (local.get 1)))
+ * (func (export "count") (result i32) (global.get $g))
+ */
+static const wasm_u8_t module_binary[] = {
+    0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00, 0x01, 0x10, 0x03, 0x60,
+    0x01, 0x7f, 0x01, 0x7f, 0x60, 0x02, 0x7f, 0x7f, 0x01, 0x7f, 0x60, 0x00,
+    0x01, 0x7f, 0x03, 0x05, 0x04, 0x00, 0x00, 0x01, 0x02, 0x04, 0x04, 0x01,
+    0x70, 0x00, 0x02, 0x06, 0x06, 0x01, 0x7f, 0x01, 0x41, 0x00, 0x0b, 0x07,
+    0x10, 0x02, 0x04, 0x70, 0x69, 0x63, 0x6b, 0x00, 0x02, 0x05, 0x63, 0x6f,
+    0x75, 0x6e, 0x74, 0x00, 0x03, 0x09, 0x08, 0x01, 0x00, 0x41, 0x00, 0x0b,
+    0x02, 0x00, 0x01, 0x0a, 0x27, 0x04, 0x07, 0x00, 0x20, 0x00, 0x41, 0x01,
+    0x6a, 0x0b, 0x07, 0x00, 0x20, 0x00, 0x41, 0x02, 0x6c, 0x0b, 0x10, 0x00,
+    0x23, 0x00, 0x41, 0x01, 0x6a, 0x24, 0x00, 0x20, 0x00, 0x20, 0x01, 0x11,
+    0x00, 0x00, 0x0b, 0x04, 0x00, 0x23, 0x00, 0x0b};
+
+#define THREADS (4)
+#define CALLS   (20000)
+
+static wasmbox_compiled_module_t *compiled;
+
+// Calls both table entries in turn, so that the threads keep refilling the
+// call cache which their instances share.
+static void *run(void *data) {
+  wasmbox_instance_t instance = {};
+  assert(wasmbox_instance_init(&instance, compiled) == 0);
+  const wasmbox_export_t *pick = wasmbox_lookup_export(&instance, "pick");
+  const wasmbox_export_t *count = wasmbox_lookup_export(&instance, "count");
+  for (int i = 0; i < CALLS; i++) {
+    wasmbox_value_t args[2] = {{.s32 = i}, {.s32 = (i >> 1) & 1}};
+    wasmbox_value_t result;
+    assert(wasmbox_call(&instance, pick, args, &result) == 0);
+    assert(result.s32 == (args[1].s32 ? i * 2 : i + 1));
+  }
+  wasmbox_value_t calls;
+  assert(wasmbox_call(&instance, count, NULL, &calls) == 0);
+  assert(calls.s32 == CALLS);
+  wasmbox_module_dispose(&instance);
+  return NULL;
+}
+
+int main() {
+  wasmbox_module_t mod = {};
+  assert(wasmbox_load_module_from_buffer(&mod, module_binary,
+                                         sizeof(module_binary)) == 0);
+  compiled = wasmbox_compiled_module_create(&mod);
+  assert(compiled != NULL);
+  pthread_t threads[THREADS];
+  for (int i = 0; i < THREADS; i++) {
+    assert(pthread_create(&threads[i], NULL, run, NULL) == 0);
+  }
+  for (int i = 0; i < THREADS; i++) {
+    pthread_join(threads[i], NULL);
+  }
+  wasmbox_compiled_module_dispose(compiled);
+  return 0;
+}
@@ -0,0 +1,118 @@
+/*
+ * Copyright (C) 2021 Masahiro Ide
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "opcodes.h"
+
+#include <assert.h>
+
+/*
+ * (func (export "sum") (param i32) (result i32) (local i32)
+ *   (local.set 1 (i32.const 0))
+ *   (block (loop
+ *     (br_if 1 (i32.eqz (local.get 0)))
+ *     (local.set 1 (i32.add (local.get 1) (local.get 0)))
+ *     (local.set 0 (i32.sub (local.get 0) (i32.const 1)))
+ *     (br 0)))
+ *   (local.get 1))
+ * (func (export "base") (param i32) (result i32) (local i32)
+ *   (local.set 1 (i32.const 0))
+ *   (i32.const 1000)
+ *   (block (loop ...)) ;; as above, with 1000 on the operand stack
+ *   (i32.add (local.get 1)))
+ */
+static const wasm_u8_t module_binary[] = {
+    0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00, 0x01, 0x06, 0x01, 0x60,
+    0x01, 0x7f, 0x01, 0x7f, 0x03, 0x03, 0x02, 0x00, 0x00, 0x07, 0x0e, 0x02,
+    0x03, 0x73, 0x75, 0x6d, 0x00, 0x00, 0x04, 0x62, 0x61, 0x73, 0x65, 0x00,
+    0x01, 0x0a, 0x51, 0x02, 0x25, 0x01, 0x01, 0x7f, 0x41, 0x00, 0x21, 0x01,
+    0x02, 0x40, 0x03, 0x40, 0x20, 0x00, 0x45, 0x0d, 0x01, 0x20, 0x01, 0x20,
+    0x00, 0x6a, 0x21, 0x01, 0x20, 0x00, 0x41, 0x01, 0x6b, 0x21, 0x00, 0x0c,
+    0x00, 0x0b, 0x0b, 0x20, 0x01, 0x0b, 0x29, 0x01, 0x01, 0x7f, 0x41, 0x00,
+    0x21, 0x01, 0x41, 0xe8, 0x07, 0x02, 0x40, 0x03, 0x40, 0x20, 0x00, 0x45,
+    0x0d, 0x01, 0x20, 0x01, 0x20, 0x00, 0x6a, 0x21, 0x01, 0x20, 0x00, 0x41,
+    0x01, 0x6b, 0x21, 0x00, 0x0c, 0x00, 0x0b, 0x0b, 0x20, 0x01, 0x6a, 0x0b};
+
+static wasm_s32_t sum(wasmbox_module_t *mod, const wasmbox_export_t *export,
+                      wasm_s32_t n) {
+  wasmbox_value_t arg = {.s32 = n};
+  wasmbox_value_t result = {};
+  assert(wasmbox_call(mod, export, &arg, &result) == 0);
+  return result.s32;
+}
+
+int main() {
+  wasmbox_module_t mod = {};
+#ifdef WASMBOX_VM_USE_LAZY_COMPILE
+  mod.tier_up_threshold = 32;
+#endif
+  assert(wasmbox_load_module_from_buffer(&mod, module_binary,
+                                         sizeof(module_binary)) == 0);
+  const wasmbox_export_t *export = wasmbox_lookup_export(&mod, "sum");
+  assert(sum(&mod, export, 4) == 10);
+  wasmbox_code_t *baseline_code = export->func->code;
+  for (int i = 0; i < 4; i++) {
+    assert(sum(&mod, export, 4) == 10);
+  }
+#ifdef WASMBOX_VM_USE_LAZY_COMPILE
+  // Five calls and twenty iterations are not hot yet.
+  assert(export->func->code == baseline_code);
+#endif
+  // The loop runs out the count in the middle of this call, which continues
+  // in the new code.
+  assert(sum(&mod, export, 100) == 5050);
+#ifdef WASMBOX_VM_USE_LAZY_COMPILE
+  assert(export->func->code != baseline_code);
+#else
+  (void) baseline_code;
+#endif
+  for (int i = 0; i < 100; i++) {
+    assert(sum(&mod, export, i) == i * (i + 1) / 2);
+  }
+  wasmbox_module_dispose(&mod);
+
+  // A single call spent in a loop is moved to the new code with the value it
+  // holds on the operand stack.
+  wasmbox_module_t loop = {};
+#ifdef WASMBOX_VM_USE_LAZY_COMPILE
+  loop.tier_up_threshold = 32;
+#endif
+  assert(wasmbox_load_module_from_buffer(&loop, module_binary,
+                                         sizeof(module_binary)) == 0);
+  export = wasmbox_lookup_export(&loop, "base");
+  assert(sum(&loop, export, 1000) == 1000 + 500500);
+#ifdef WASMBOX_VM_USE_LAZY_COMPILE
+  assert(((wasmbox_mutable_function_t *) export->func)->baseline_code != NULL);
+#endif
+  assert(sum(&loop, export, 10) == 1055);
+  wasmbox_module_dispose(&loop);
+
+#ifdef WASMBOX_VM_USE_LAZY_COMPILE
+  // A negative threshold compiles the optimized code on the first call.
+  wasmbox_module_t eager = {};
+  eager.tier_up_threshold = -1;
+  assert(wasmbox_load_module_from_buffer(&eager, module_binary,
+                                         sizeof(module_binary)) == 0);
+  export = wasmbox_lookup_export(&eager, "sum");
+  assert(sum(&eager, export, 100) == 5050);
+  wasmbox_code_t *code = export->func->code;
+  for (int i = 0; i < 100; i++) {
+    assert(sum(&eager, export, i) == i * (i + 1) / 2);
+  }
+  assert(export->func->code == code);
+  wasmbox_module_dispose(&eager);
+#endif
+  return 0;
+}
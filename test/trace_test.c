@@ -0,0 +1,101 @@
+/*
+ * Copyright (C) 2021 Masahiro Ide
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "wasmbox/wasmbox.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef WASMBOX_VM_USE_TRACE
+/*
+ * (func $f0 (export "_start") (result i32) call $f2 i32.const 2 i32.mul)
+ * (func $f1 (result i32) i32.const 0)
+ * (func $f2 (result i32) call $f3 i32.const 1 i32.add)
+ * (func $f3 (result i32) i32.const 5)
+ */
+static const wasm_u8_t module_binary[] = {
+    0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00, 0x01, 0x05, 0x01, 0x60,
+    0x00, 0x01, 0x7f, 0x03, 0x05, 0x04, 0x00, 0x00, 0x00, 0x00, 0x07, 0x0a,
+    0x01, 0x06, 0x5f, 0x73, 0x74, 0x61, 0x72, 0x74, 0x00, 0x00, 0x0a, 0x1b,
+    0x04, 0x07, 0x00, 0x10, 0x02, 0x41, 0x02, 0x6c, 0x0b, 0x04, 0x00, 0x41,
+    0x00, 0x0b, 0x07, 0x00, 0x10, 0x03, 0x41, 0x01, 0x6a, 0x0b, 0x04, 0x00,
+    0x41, 0x05, 0x0b};
+
+static int run(wasmbox_module_t *mod) {
+  wasmbox_value_t stack[1024] = {};
+  assert(wasmbox_eval_module(mod, stack) == 0);
+  return stack[0].s32;
+}
+
+static int count_lines(const char *file_name, const char *text) {
+  FILE *fp = fopen(file_name, "r");
+  assert(fp != NULL);
+  char line[256];
+  int count = 0;
+  while (fgets(line, sizeof(line), fp) != NULL) {
+    count += strstr(line, text) != NULL;
+  }
+  fclose(fp);
+  return count;
+}
+#endif
+
+int main() {
+#ifdef WASMBOX_VM_USE_TRACE
+  const char *trace_file = "trace_test.bin";
+  const char *text_file = "trace_test.txt";
+  wasmbox_module_t mod = {};
+  mod.inline_threshold = -1;
+  assert(wasmbox_load_module_from_buffer(&mod, module_binary,
+                                         sizeof(module_binary)) == 0);
+  assert(wasmbox_trace_write(&mod, trace_file) == -1);
+  assert(wasmbox_trace_start(0, 0) == -1);
+
+  // Nothing is recorded while stopped.
+  assert(wasmbox_trace_start(1024, 0) == 0);
+  wasmbox_trace_stop();
+  assert(run(&mod) == 12);
+  assert(wasmbox_trace_write(&mod, trace_file) == 0);
+
+  assert(wasmbox_trace_start(1024, 0) == 0);
+  assert(run(&mod) == 12);
+  wasmbox_trace_stop();
+  int records = wasmbox_trace_write(&mod, trace_file);
+  assert(records > 0);
+  assert(wasmbox_trace_decode(trace_file, text_file) == records);
+  assert(count_lines(text_file, "_start+0") == 1);
+
+#  ifndef WASMBOX_VM_USE_JIT
+  // A smaller ring keeps the last events, with the time every other event.
+  // Native code runs only a few instructions.
+  assert(wasmbox_trace_start(4, 2) == 0);
+  assert(run(&mod) == 12);
+  wasmbox_trace_stop();
+  assert(wasmbox_trace_write(&mod, trace_file) == 4);
+  assert(wasmbox_trace_decode(trace_file, text_file) == 4);
+  assert(count_lines(text_file, " time +") >= 1);
+#  endif
+
+  wasmbox_trace_dispose();
+  assert(wasmbox_trace_write(&mod, trace_file) == -1);
+  remove(trace_file);
+  remove(text_file);
+  wasmbox_module_dispose(&mod);
+#endif
+  return 0;
+}
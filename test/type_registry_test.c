@@ -0,0 +1,55 @@
+/*
+ * Copyright (C) 2021 Masahiro Ide
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "type-registry.h"
+
+#include <assert.h>
+
+typedef struct {
+  wasmbox_type_t type;
+  wasmbox_value_type_t args[4];
+} test_type_t;
+
+static wasm_u32_t intern(wasm_u16_t argument_size, wasm_u16_t return_size,
+                         wasmbox_value_type_t t0, wasmbox_value_type_t t1) {
+  test_type_t t = {};
+  t.type.argument_size = argument_size;
+  t.type.return_size = return_size;
+  t.args[0] = t0;
+  t.args[1] = t1;
+  return wasmbox_type_intern(&t.type);
+}
+
+int main() {
+  wasm_u32_t i32_to_i32 = intern(1, 1, WASM_TYPE_I32, WASM_TYPE_I32);
+  wasm_u32_t i32_to_i64 = intern(1, 1, WASM_TYPE_I32, WASM_TYPE_I64);
+  wasm_u32_t i32_i32 = intern(2, 0, WASM_TYPE_I32, WASM_TYPE_I32);
+  assert(i32_to_i32 != i32_to_i64 && i32_to_i32 != i32_i32);
+  assert(i32_to_i64 != i32_i32);
+
+  // Ids stay the same while the registry grows.
+  wasm_u32_t ids[256];
+  for (wasm_u32_t i = 0; i < 256; ++i) {
+    ids[i] = intern(i % 3, 1, WASM_TYPE_I32 + i % 4, WASM_TYPE_F32 + i / 64);
+  }
+  for (wasm_u32_t i = 0; i < 256; ++i) {
+    assert(ids[i] == intern(i % 3, 1, WASM_TYPE_I32 + i % 4,
+                            WASM_TYPE_F32 + i / 64));
+  }
+  assert(intern(1, 1, WASM_TYPE_I32, WASM_TYPE_I32) == i32_to_i32);
+  assert(intern(2, 0, WASM_TYPE_I32, WASM_TYPE_I32) == i32_i32);
+  return 0;
+}
@@ -0,0 +1,129 @@
+/*
+ * Copyright (C) 2021 Masahiro Ide
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "wasmbox/wasmbox.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+// (global i32 (i32.const 7))
+static const wasm_u8_t global_section[] = {0x06, 0x06, 0x01, 0x7f,
+                                           0x00, 0x41, 0x07, 0x0b};
+// (table 1 funcref)
+static const wasm_u8_t table_section[] = {0x04, 0x04, 0x01, 0x70, 0x00, 0x01};
+// (memory 1)
+static const wasm_u8_t memory_section[] = {0x05, 0x03, 0x01, 0x00, 0x01};
+
+// Optional sections of the module.
+enum { HAS_MEMORY = 1, HAS_TABLE = 2 };
+
+static size_t append(wasm_u8_t *buf, size_t len, const wasm_u8_t *data,
+                     size_t size) {
+  memcpy(buf + len, data, size);
+  return len + size;
+}
+
+// Loads a module whose function "f" of type [i32] -> [i32] has `body`, which
+// starts with the declarations of its locals. Returns 0 if the module is
+// valid. A body compiled on its first call is validated when it is loaded.
+static int validate(const char *body, int sections) {
+  static const wasm_u8_t header[] = {
+      0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00, 0x01, 0x06, 0x01,
+      0x60, 0x01, 0x7f, 0x01, 0x7f, 0x03, 0x02, 0x01, 0x00};
+  static const wasm_u8_t export_section[] = {0x07, 0x05, 0x01, 0x01,
+                                             0x66, 0x00, 0x00};
+  size_t size = strlen(body) / 2;
+  wasm_u8_t buf[256];
+  size_t len = append(buf, 0, header, sizeof(header));
+  if (sections & HAS_TABLE) {
+    len = append(buf, len, table_section, sizeof(table_section));
+  }
+  if (sections & HAS_MEMORY) {
+    len = append(buf, len, memory_section, sizeof(memory_section));
+  }
+  len = append(buf, len, global_section, sizeof(global_section));
+  len = append(buf, len, export_section, sizeof(export_section));
+  buf[len++] = 0x0a;
+  buf[len++] = size + 2;
+  buf[len++] = 0x01;
+  buf[len++] = size;
+  for (size_t i = 0; i < size; i++) {
+    unsigned byte;
+    sscanf(body + 2 * i, "%2x", &byte);
+    buf[len++] = byte;
+  }
+  wasmbox_module_t mod = {};
+  int ret = wasmbox_load_module_from_buffer(&mod, buf, len) != 0 ? -1 : 0;
+  wasmbox_module_dispose(&mod);
+  return ret;
+}
+
+int main() {
+  // local.get 0
+  assert(validate("0020000b", 0) == 0);
+  // block (result i32) local.get 0 br 0 i32.add end: the operand stack of
+  // unreachable code is polymorphic.
+  assert(validate("00027f20000c006a0b0b", 0) == 0);
+  // local.get 0 i32.load
+  assert(validate("0020002802000b", HAS_MEMORY) == 0);
+  // (local f64) local.get 1 i32.trunc_f64_s
+  assert(validate("01017c2001aa0b", 0) == 0);
+  // i32.const 0 ref.func 0 table.set 0 local.get 0
+  assert(validate("004100d200260020000b", HAS_TABLE) == 0);
+  // i32.const 0 table.get 0 ref.is_null
+  assert(validate("0041002500d10b", HAS_TABLE) == 0);
+
+  // i32.add with an empty operand stack
+  assert(validate("006a0b", 0) == -1);
+  // No result
+  assert(validate("000b", 0) == -1);
+  // local.get 0 local.get 0: one result too many
+  assert(validate("00200020000b", 0) == -1);
+  // local.get 0 block i32.const 1 end: the block leaves a value
+  assert(validate("002000024041010b0b", 0) == -1);
+  // local.get 0 block (result i32) i32.eqz end: pops below the block
+  assert(validate("002000027f450b0b", 0) == -1);
+  // local.get 1
+  assert(validate("0020010b", 0) == -1);
+  // global.get 1
+  assert(validate("0023010b", 0) == -1);
+  // i32.const 1 global.set 0 local.get 0: the global is immutable
+  assert(validate("004101240020000b", 0) == -1);
+  // local.get 0 br 1
+  assert(validate("0020000c010b", 0) == -1);
+  // local.get 0 i32.load without a memory
+  assert(validate("0020002802000b", 0) == -1);
+  // local.get 0 call 1
+  assert(validate("00200010010b", 0) == -1);
+  // i64.const 1: an i64 result of an i32 function
+  assert(validate("0042010b", 0) == -1);
+  // local.get 0 i64.const 1 i32.add
+  assert(validate("00200042016a0b", 0) == -1);
+  // (local f64) local.get 1: an f64 read as an i32
+  assert(validate("01017c20010b", 0) == -1);
+  // i32.const 0 i64.const 0x414141414141 table.set 0 local.get 0
+  // i32.const 0 call_indirect: an i64 called as a funcref
+  assert(validate("00410042c182858a94a8102600200041001100000b",
+                  HAS_TABLE) == -1);
+  // i32.const 0 table.get 0: a funcref read as an i32
+  assert(validate("00410025000b", HAS_TABLE) == -1);
+  // local.get 0 without its end
+  assert(validate("002000", 0) == -1);
+  // local.get 0 end nop
+  assert(validate("0020000b01", 0) == -1);
+  return 0;
+}
@@ -0,0 +1,112 @@
+/*
+ * Copyright (C) 2021 Masahiro Ide
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "wasmbox/wasmbox.h"
+
+#include <assert.h>
+#include <sched.h>
+
+#ifdef WASMBOX_VM_USE_WARM_POOL
+/*
+ * (memory 1) (global $g (mut i32) (i32.const 0)) (data (i32.const 0) "\2a")
+ * (func (export "_start") (result i32)
+ *   ;; $g += 1; mem[16] += 1; $g * 100 + mem8[0] + mem[16] * 10000
+ */
+static const wasm_u8_t module_binary[] = {
+    0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00, 0x01, 0x05, 0x01, 0x60,
+    0x00, 0x01, 0x7f, 0x03, 0x02, 0x01, 0x00, 0x05, 0x03, 0x01, 0x00, 0x01,
+    0x06, 0x06, 0x01, 0x7f, 0x01, 0x41, 0x00, 0x0b, 0x07, 0x0a, 0x01, 0x06,
+    0x5f, 0x73, 0x74, 0x61, 0x72, 0x74, 0x00, 0x00, 0x0a, 0x2f, 0x01, 0x2d,
+    0x00, 0x23, 0x00, 0x41, 0x01, 0x6a, 0x24, 0x00, 0x41, 0x10, 0x41, 0x10,
+    0x28, 0x02, 0x00, 0x41, 0x01, 0x6a, 0x36, 0x02, 0x00, 0x23, 0x00, 0x41,
+    0xe4, 0x00, 0x6c, 0x41, 0x00, 0x2d, 0x00, 0x00, 0x6a, 0x41, 0x10, 0x28,
+    0x02, 0x00, 0x41, 0x90, 0xce, 0x00, 0x6c, 0x6a, 0x0b, 0x0b, 0x07, 0x01,
+    0x00, 0x41, 0x00, 0x0b, 0x01, 0x2a};
+
+#  define SIZE (4)
+
+static wasm_s32_t run(wasmbox_instance_t *instance) {
+  wasmbox_value_t stack[1024] = {};
+  assert(wasmbox_eval_module(instance, stack) == 0);
+  return stack[0].s32;
+}
+
+// Waits until `pool` has `ready` instances ready.
+static void wait_ready(wasmbox_warm_pool_t *pool, wasm_u32_t ready,
+                       wasmbox_warm_pool_stats_t *stats) {
+  do {
+    sched_yield();
+    wasmbox_warm_pool_stats(pool, stats);
+  } while (stats->ready != ready);
+}
+#endif
+
+int main() {
+#ifdef WASMBOX_VM_USE_WARM_POOL
+  wasmbox_module_t mod = {};
+  assert(wasmbox_load_module_from_buffer(&mod, module_binary,
+                                         sizeof(module_binary)) == 0);
+  wasmbox_compiled_module_t *compiled = wasmbox_compiled_module_create(&mod);
+  assert(compiled != NULL);
+
+  wasmbox_warm_pool_t *pool = wasmbox_warm_pool_create(compiled, SIZE, NULL);
+  assert(pool != NULL);
+  wasmbox_warm_pool_stats_t stats;
+  wait_ready(pool, SIZE, &stats);
+  wasmbox_instance_t *instances[SIZE + 1];
+  for (int i = 0; i < SIZE; i++) {
+    instances[i] = wasmbox_warm_pool_take(pool);
+    assert(instances[i] != NULL && run(instances[i]) == 10142);
+  }
+  // One more is initialized by the taker unless the thread was quicker.
+  instances[SIZE] = wasmbox_warm_pool_take(pool);
+  assert(instances[SIZE] != NULL && run(instances[SIZE]) == 10142);
+  wasmbox_warm_pool_stats(pool, &stats);
+  assert(stats.hits >= SIZE && stats.hits + stats.misses == SIZE + 1);
+  for (int i = 0; i <= SIZE; i++) {
+    wasmbox_warm_pool_release(pool, instances[i]);
+  }
+  wait_ready(pool, SIZE, &stats);
+  assert(stats.reuses == 0);
+  wasmbox_warm_pool_dispose(pool);
+
+  // With a single slot, the thread cannot initialize another instance while
+  // one is out, and resets the resettable one once it is back.
+  wasmbox_instance_pool_t *slots = wasmbox_instance_pool_create(1, 1, 1024);
+  if (slots != NULL) {
+    wasmbox_instance_t options = {};
+    options.resettable = 1;
+    options.instance_pool = slots;
+    pool = wasmbox_warm_pool_create(compiled, 1, &options);
+    assert(pool != NULL);
+    wait_ready(pool, 1, &stats);
+    wasmbox_instance_t *instance = wasmbox_warm_pool_take(pool);
+    assert(run(instance) == 10142 && run(instance) == 20242);
+    wasmbox_warm_pool_release(pool, instance);
+    wait_ready(pool, 1, &stats);
+    assert(stats.reuses == 1);
+    assert(wasmbox_warm_pool_take(pool) == instance);
+    assert(run(instance) == 10142);
+    wasmbox_warm_pool_release(pool, instance);
+    wasmbox_warm_pool_dispose(pool);
+    wasmbox_instance_pool_dispose(slots);
+  }
+
+  wasmbox_compiled_module_dispose(compiled);
+#endif
+  return 0;
+}
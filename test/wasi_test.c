@@ -0,0 +1,162 @@
+/*
+ * Copyright (C) 2021 Masahiro Ide
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "wasmbox/wasmbox.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+/*
+ * (type $io (func (param i32 i32 i32 i32) (result i32)))
+ * (type $pio (func (param i32 i32 i32 i64 i32) (result i32)))
+ * (import "wasi_snapshot_preview1" "fd_write" (func (type $io)))
+ * (import "wasi_snapshot_preview1" "fd_read" (func (type $io)))
+ * (import "wasi_snapshot_preview1" "fd_pwrite" (func (type $pio)))
+ * (import "wasi_snapshot_preview1" "fd_pread" (func (type $pio)))
+ * (memory (export "memory") 1)
+ * ;; and each import is exported under its own name
+ */
+static const wasm_u8_t module_binary[] = {
+    0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00, 0x01, 0x12, 0x02, 0x60,
+    0x04, 0x7f, 0x7f, 0x7f, 0x7f, 0x01, 0x7f, 0x60, 0x05, 0x7f, 0x7f, 0x7f,
+    0x7e, 0x7f, 0x01, 0x7f, 0x02, 0x89, 0x01, 0x04, 0x16, 0x77, 0x61, 0x73,
+    0x69, 0x5f, 0x73, 0x6e, 0x61, 0x70, 0x73, 0x68, 0x6f, 0x74, 0x5f, 0x70,
+    0x72, 0x65, 0x76, 0x69, 0x65, 0x77, 0x31, 0x08, 0x66, 0x64, 0x5f, 0x77,
+    0x72, 0x69, 0x74, 0x65, 0x00, 0x00, 0x16, 0x77, 0x61, 0x73, 0x69, 0x5f,
+    0x73, 0x6e, 0x61, 0x70, 0x73, 0x68, 0x6f, 0x74, 0x5f, 0x70, 0x72, 0x65,
+    0x76, 0x69, 0x65, 0x77, 0x31, 0x07, 0x66, 0x64, 0x5f, 0x72, 0x65, 0x61,
+    0x64, 0x00, 0x00, 0x16, 0x77, 0x61, 0x73, 0x69, 0x5f, 0x73, 0x6e, 0x61,
+    0x70, 0x73, 0x68, 0x6f, 0x74, 0x5f, 0x70, 0x72, 0x65, 0x76, 0x69, 0x65,
+    0x77, 0x31, 0x09, 0x66, 0x64, 0x5f, 0x70, 0x77, 0x72, 0x69, 0x74, 0x65,
+    0x00, 0x01, 0x16, 0x77, 0x61, 0x73, 0x69, 0x5f, 0x73, 0x6e, 0x61, 0x70,
+    0x73, 0x68, 0x6f, 0x74, 0x5f, 0x70, 0x72, 0x65, 0x76, 0x69, 0x65, 0x77,
+    0x31, 0x08, 0x66, 0x64, 0x5f, 0x70, 0x72, 0x65, 0x61, 0x64, 0x00, 0x01,
+    0x05, 0x03, 0x01, 0x00, 0x01, 0x07, 0x36, 0x05, 0x08, 0x66, 0x64, 0x5f,
+    0x77, 0x72, 0x69, 0x74, 0x65, 0x00, 0x00, 0x07, 0x66, 0x64, 0x5f, 0x72,
+    0x65, 0x61, 0x64, 0x00, 0x01, 0x09, 0x66, 0x64, 0x5f, 0x70, 0x77, 0x72,
+    0x69, 0x74, 0x65, 0x00, 0x02, 0x08, 0x66, 0x64, 0x5f, 0x70, 0x72, 0x65,
+    0x61, 0x64, 0x00, 0x03, 0x06, 0x6d, 0x65, 0x6d, 0x6f, 0x72, 0x79, 0x02,
+    0x00};
+
+/*
+ * (import "wasi_snapshot_preview1" "fd_write" (func))
+ */
+static const wasm_u8_t mistyped_binary[] = {
+    0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00, 0x01, 0x04, 0x01, 0x60,
+    0x00, 0x00, 0x02, 0x23, 0x01, 0x16, 0x77, 0x61, 0x73, 0x69, 0x5f, 0x73,
+    0x6e, 0x61, 0x70, 0x73, 0x68, 0x6f, 0x74, 0x5f, 0x70, 0x72, 0x65, 0x76,
+    0x69, 0x65, 0x77, 0x31, 0x08, 0x66, 0x64, 0x5f, 0x77, 0x72, 0x69, 0x74,
+    0x65, 0x00, 0x00};
+
+#define WASI_EBADF  (8)
+#define WASI_EFAULT (21)
+
+static wasmbox_module_t mod;
+
+// Lays out iovecs at 0 for the strings in `bufs`, which are copied from 256
+// on.
+static void iovecs(const char **bufs, wasm_u32_t size) {
+  wasm_u32_t at = 256;
+  for (wasm_u32_t i = 0; i < size; i++) {
+    wasm_u32_t len = (wasm_u32_t) strlen(bufs[i]);
+    memcpy(mod.memory_block->data + at, bufs[i], len);
+    memcpy(mod.memory_block->data + 8 * i, &at, 4);
+    memcpy(mod.memory_block->data + 8 * i + 4, &len, 4);
+    at += len;
+  }
+}
+
+// Calls `name` with the iovecs at 0 and the result at 128, and returns the
+// WASI error. `offset` is passed to the positioned calls.
+static wasm_u32_t call(const char *name, wasm_u32_t fd, wasm_u32_t size,
+                       wasm_u64_t offset, wasm_u32_t *result) {
+  const wasmbox_export_t *f = wasmbox_lookup_export(&mod, name);
+  assert(f != NULL);
+  int positioned = name[3] == 'p';
+  wasmbox_value_t args[5] = {{.u32 = fd}, {.u32 = 0}, {.u32 = size}};
+  args[3].u64 = offset;
+  args[positioned ? 4 : 3].u32 = 128;
+  wasmbox_value_t results[1];
+  assert(wasmbox_call(&mod, f, args, results) == 0);
+  memcpy(result, mod.memory_block->data + 128, 4);
+  return results[0].u32;
+}
+
+int main() {
+  wasmbox_wasi_t *wasi = wasmbox_wasi_create();
+  wasm_u32_t size;
+  mod.host_functions = wasmbox_wasi_functions(wasi, &size);
+  mod.host_function_size = size;
+  assert(wasmbox_load_module_from_buffer(&mod, module_binary,
+                                         sizeof(module_binary)) == 0);
+
+  // The iovecs are written to and read from the memory in place.
+  int fds[2];
+  assert(pipe(fds) == 0);
+  assert(wasmbox_wasi_map_fd(wasi, 3, fds[1]) == 0);
+  assert(wasmbox_wasi_map_fd(wasi, 100, fds[0]) == 0);
+  wasm_u32_t result = 0;
+  iovecs((const char *[]){"hello ", "", "world"}, 3);
+  assert(call("fd_write", 3, 3, 0, &result) == 0 && result == 11);
+  char buf[16] = {};
+  assert(read(fds[0], buf, sizeof(buf)) == 11);
+  assert(strcmp(buf, "hello world") == 0);
+
+  memset(mod.memory_block->data + 256, 0, 16);
+  assert(write(fds[1], "abcdef", 6) == 6);
+  iovecs((const char *[]){"xx", "xxxxxxxxxx"}, 2);
+  assert(call("fd_read", 100, 2, 0, &result) == 0 && result == 6);
+  assert(memcmp(mod.memory_block->data + 256, "abcdefxxxxxx", 12) == 0);
+
+  // Positioned calls leave the file offset alone.
+  FILE *file = tmpfile();
+  assert(file != NULL);
+  assert(wasmbox_wasi_map_fd(wasi, 4, fileno(file)) == 0);
+  iovecs((const char *[]){"0123", "4567"}, 2);
+  assert(call("fd_pwrite", 4, 2, 3, &result) == 0 && result == 8);
+  iovecs((const char *[]){"....", "...."}, 2);
+  assert(call("fd_pread", 4, 1, 5, &result) == 0 && result == 4);
+  assert(memcmp(mod.memory_block->data + 256, "2345....", 8) == 0);
+  assert(lseek(fileno(file), 0, SEEK_CUR) == 0);
+  fclose(file);
+
+  // Unmapped descriptors and buffers out of the memory are refused.
+  assert(wasmbox_wasi_map_fd(wasi, 4, -1) == 0);
+  assert(call("fd_pread", 4, 1, 0, &result) == WASI_EBADF);
+  assert(call("fd_write", 7, 1, 0, &result) == WASI_EBADF);
+  assert(wasmbox_wasi_map_fd(wasi, 1 << 20, 1) == -1);
+  wasm_u32_t far[2] = {WASMBOX_PAGE_SIZE - 2, 4};
+  memcpy(mod.memory_block->data, far, sizeof(far));
+  assert(call("fd_write", 3, 1, 0, &result) == WASI_EFAULT);
+  assert(call("fd_write", 3, 8192, 0, &result) == WASI_EFAULT);
+
+  close(fds[0]);
+  close(fds[1]);
+  wasmbox_module_dispose(&mod);
+
+  // The functions are only imported with their preview1 signature.
+  wasmbox_module_t mistyped = {};
+  mistyped.host_functions = wasmbox_wasi_functions(wasi, &size);
+  mistyped.host_function_size = size;
+  assert(wasmbox_load_module_from_buffer(&mistyped, mistyped_binary,
+                                         sizeof(mistyped_binary)) != 0);
+  wasmbox_module_dispose(&mistyped);
+  wasmbox_wasi_dispose(wasi);
+  return 0;
+}
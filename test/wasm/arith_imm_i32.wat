@@ -0,0 +1,22 @@
+(module
+  (func $main (export "_start") (param $x i32) (result i32)
+    ;; ((((x * 3 + 7) << 2) >> 1) & 0xff | 0x100) ^ 1) - 5
+    get_local $x
+    i32.const 3
+    i32.mul
+    i32.const 7
+    i32.add
+    i32.const 2
+    i32.shl
+    i32.const 1
+    i32.shr_s
+    i32.const 255
+    i32.and
+    i32.const 256
+    i32.or
+    i32.const 1
+    i32.xor
+    i32.const 5
+    i32.sub
+  )
+)
@@ -0,0 +1,16 @@
+(module
+  (func $main (export "_start") (param $x i64) (result i64)
+    ;; (((x << 33) >>u 32) * 5 + 1) - 2
+    get_local $x
+    i64.const 33
+    i64.shl
+    i64.const 32
+    i64.shr_u
+    i64.const 5
+    i64.mul
+    i64.const 1
+    i64.add
+    i64.const 2
+    i64.sub
+  )
+)
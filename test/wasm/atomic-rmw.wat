@@ -0,0 +1,23 @@
+(module
+  (memory 1)
+  (func (export "_start") (param i32) (result i32)
+        (i32.atomic.store (i32.const 8) (local.get 0))
+        (drop (i32.atomic.rmw.add (i32.const 8) (i32.const 10)))
+        (drop (i32.atomic.rmw8.sub_u offset=8 (i32.const 0) (i32.const 1)))
+        (atomic.fence)
+        (i32.add
+          (i32.add
+            ;; Succeeds and returns the old value 14.
+            (i32.atomic.rmw.cmpxchg (i32.const 8) (i32.const 14) (i32.const 100))
+            (i32.atomic.load (i32.const 8)))                   ;; 100
+          (i32.add
+            ;; Fails and returns the current value.
+            (i32.atomic.rmw.cmpxchg (i32.const 8) (i32.const 1) (i32.const 2))
+            (i32.add
+              (i32.wrap_i64 (i64.atomic.rmw.xchg (i32.const 16) (i64.const 7)))
+              (i32.add
+                (i32.wrap_i64 (i64.atomic.load (i32.const 16)))  ;; 7
+                ;; Nobody waits on a memory which is not shared.
+                (memory.atomic.notify (i32.const 8) (i32.const 1)))))))
+  )
+)
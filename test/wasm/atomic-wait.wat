@@ -0,0 +1,16 @@
+(module
+  (memory 1 1 shared)
+  (func (export "_start") (param i32) (result i32)
+        (i32.add
+          (i32.add
+            ;; 1: the value is not the expected one.
+            (i32.mul (i32.const 100)
+                     (memory.atomic.wait32 (i32.const 0) (local.get 0)
+                                           (i64.const -1)))
+            ;; 2: nobody notifies before the timeout.
+            (i32.mul (i32.const 10)
+                     (memory.atomic.wait32 (i32.const 0) (i32.const 0)
+                                           (i64.const 0))))
+          (memory.atomic.wait64 (i32.const 8) (i64.const 0) (i64.const 1000)))
+  )
+)
@@ -0,0 +1,15 @@
+(module
+  (type $pair (func (param i32 i32) (result i32 i32)))
+  (func $pair (type $pair)
+        (local.get 0)
+        (local.get 1)
+        (block (type $pair)
+          (i32.add)
+          (local.get 0)
+          (br 0))
+  )
+  (func (export "_start") (param i32 i32) (result i32)
+        (call $pair (local.get 0) (local.get 1))
+        (i32.sub)
+  )
+)
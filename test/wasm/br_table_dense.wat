@@ -0,0 +1,285 @@
+(module
+  ;; A switch over 64 cases, case k returns k*k+1 and the default 1000.
+  (func $case (param i32) (result i32)
+    block $default
+    block $c63
+    block $c62
+    block $c61
+    block $c60
+    block $c59
+    block $c58
+    block $c57
+    block $c56
+    block $c55
+    block $c54
+    block $c53
+    block $c52
+    block $c51
+    block $c50
+    block $c49
+    block $c48
+    block $c47
+    block $c46
+    block $c45
+    block $c44
+    block $c43
+    block $c42
+    block $c41
+    block $c40
+    block $c39
+    block $c38
+    block $c37
+    block $c36
+    block $c35
+    block $c34
+    block $c33
+    block $c32
+    block $c31
+    block $c30
+    block $c29
+    block $c28
+    block $c27
+    block $c26
+    block $c25
+    block $c24
+    block $c23
+    block $c22
+    block $c21
+    block $c20
+    block $c19
+    block $c18
+    block $c17
+    block $c16
+    block $c15
+    block $c14
+    block $c13
+    block $c12
+    block $c11
+    block $c10
+    block $c9
+    block $c8
+    block $c7
+    block $c6
+    block $c5
+    block $c4
+    block $c3
+    block $c2
+    block $c1
+    block $c0
+    local.get 0
+    br_table
+      $c0 $c1 $c2 $c3 $c4 $c5 $c6 $c7 $c8 $c9
+      $c10 $c11 $c12 $c13 $c14 $c15 $c16 $c17 $c18 $c19
+      $c20 $c21 $c22 $c23 $c24 $c25 $c26 $c27 $c28 $c29
+      $c30 $c31 $c32 $c33 $c34 $c35 $c36 $c37 $c38 $c39
+      $c40 $c41 $c42 $c43 $c44 $c45 $c46 $c47 $c48 $c49
+      $c50 $c51 $c52 $c53 $c54 $c55 $c56 $c57 $c58 $c59
+      $c60 $c61 $c62 $c63 $default
+    end
+    i32.const 1
+    return
+    end
+    i32.const 2
+    return
+    end
+    i32.const 5
+    return
+    end
+    i32.const 10
+    return
+    end
+    i32.const 17
+    return
+    end
+    i32.const 26
+    return
+    end
+    i32.const 37
+    return
+    end
+    i32.const 50
+    return
+    end
+    i32.const 65
+    return
+    end
+    i32.const 82
+    return
+    end
+    i32.const 101
+    return
+    end
+    i32.const 122
+    return
+    end
+    i32.const 145
+    return
+    end
+    i32.const 170
+    return
+    end
+    i32.const 197
+    return
+    end
+    i32.const 226
+    return
+    end
+    i32.const 257
+    return
+    end
+    i32.const 290
+    return
+    end
+    i32.const 325
+    return
+    end
+    i32.const 362
+    return
+    end
+    i32.const 401
+    return
+    end
+    i32.const 442
+    return
+    end
+    i32.const 485
+    return
+    end
+    i32.const 530
+    return
+    end
+    i32.const 577
+    return
+    end
+    i32.const 626
+    return
+    end
+    i32.const 677
+    return
+    end
+    i32.const 730
+    return
+    end
+    i32.const 785
+    return
+    end
+    i32.const 842
+    return
+    end
+    i32.const 901
+    return
+    end
+    i32.const 962
+    return
+    end
+    i32.const 1025
+    return
+    end
+    i32.const 1090
+    return
+    end
+    i32.const 1157
+    return
+    end
+    i32.const 1226
+    return
+    end
+    i32.const 1297
+    return
+    end
+    i32.const 1370
+    return
+    end
+    i32.const 1445
+    return
+    end
+    i32.const 1522
+    return
+    end
+    i32.const 1601
+    return
+    end
+    i32.const 1682
+    return
+    end
+    i32.const 1765
+    return
+    end
+    i32.const 1850
+    return
+    end
+    i32.const 1937
+    return
+    end
+    i32.const 2026
+    return
+    end
+    i32.const 2117
+    return
+    end
+    i32.const 2210
+    return
+    end
+    i32.const 2305
+    return
+    end
+    i32.const 2402
+    return
+    end
+    i32.const 2501
+    return
+    end
+    i32.const 2602
+    return
+    end
+    i32.const 2705
+    return
+    end
+    i32.const 2810
+    return
+    end
+    i32.const 2917
+    return
+    end
+    i32.const 3026
+    return
+    end
+    i32.const 3137
+    return
+    end
+    i32.const 3250
+    return
+    end
+    i32.const 3365
+    return
+    end
+    i32.const 3482
+    return
+    end
+    i32.const 3601
+    return
+    end
+    i32.const 3722
+    return
+    end
+    i32.const 3845
+    return
+    end
+    i32.const 3970
+    return
+    end
+    i32.const 1000
+  )
+  (func (export "_start") (param i32) (result i32)
+    (local i32 i32)
+    (block
+      (loop
+        (br_if 1 (i32.ge_s (local.get 1) (local.get 0)))
+        (local.set 2 (i32.add (local.get 2) (call $case (local.get 1))))
+        (local.set 1 (i32.add (local.get 1) (i32.const 1)))
+        (br 0)
+      )
+    )
+    (local.get 2)
+  )
+)
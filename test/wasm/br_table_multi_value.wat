@@ -0,0 +1,19 @@
+(module
+  (func $select (param i32) (result i32 i32)
+        (block (result i32 i32)
+          (block (result i32 i32)
+            (i32.const 10)
+            (i32.const 20)
+            (br_table 0 1 2 (local.get 0)))
+          (i32.add)
+          (i32.const 1))
+        (i32.add (i32.const 100))
+  )
+  (func (export "_start") (param i32) (result i32)
+        (i32.sub (call $select (local.get 0)))
+        (i32.sub (call $select (i32.add (local.get 0) (i32.const 1))))
+        (i32.add)
+        (i32.sub (call $select (i32.add (local.get 0) (i32.const 2))))
+        (i32.add)
+  )
+)
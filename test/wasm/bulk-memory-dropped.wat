@@ -0,0 +1,10 @@
+(module
+  (memory 1)
+  (data "XYZ")
+  (func (export "_start") (param i32) (result i32)
+        (data.drop 0)
+        ;; A dropped segment is empty, so only a zero-length init succeeds.
+        (memory.init 0 (i32.const 0) (i32.const 0) (local.get 0))
+        (local.get 0)
+  )
+)
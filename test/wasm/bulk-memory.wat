@@ -0,0 +1,17 @@
+(module
+  (memory 1)
+  (data (i32.const 0) "abcdefgh")
+  (data "XYZ")
+  (func (export "_start") (param i32) (result i32)
+        (memory.fill (i32.const 100) (i32.const 65) (local.get 0))
+        ;; Overlapping ranges: memory[0..8] becomes "ababcdgh".
+        (memory.copy (i32.const 2) (i32.const 0) (i32.const 4))
+        (memory.init 1 (i32.const 200) (i32.const 1) (i32.const 2))
+        (data.drop 1)
+        (i32.add
+          (i32.add (i32.load8_u (i32.const 103))   ;; 'A'
+                   (i32.load8_u (i32.const 5)))    ;; 'd'
+          (i32.add (i32.load8_u (i32.const 201))   ;; 'Z'
+                   (i32.load8_u (i32.const 104)))) ;; 0
+  )
+)
@@ -0,0 +1,27 @@
+(module
+  (func $sub (param $a i32) (param $b i32) (result i32)
+    get_local $a
+    get_local $b
+    i32.sub
+  )
+  (func $mad (param $a i32) (param $b i32) (param $c i32) (result i32)
+    get_local $a
+    get_local $b
+    i32.mul
+    get_local $c
+    i32.add
+  )
+  (func $main (export "_start") (param $x i32) (result i32)
+    ;; sub(mad(x, x + 1, 3), sub(x, 4))
+    get_local $x
+    get_local $x
+    i32.const 1
+    i32.add
+    i32.const 3
+    call $mad
+    get_local $x
+    i32.const 4
+    call $sub
+    call $sub
+  )
+)
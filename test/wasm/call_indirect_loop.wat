@@ -0,0 +1,38 @@
+(module
+  (type $unary (func (param i32) (result i32)))
+  (table funcref (elem $inc $double))
+  (func $inc (param $v i32) (result i32)
+    get_local $v
+    i32.const 1
+    i32.add
+  )
+  (func $double (param $v i32) (result i32)
+    get_local $v
+    i32.const 2
+    i32.mul
+  )
+  ;; for (i = 0; i < 10; i++) x = table[i >= 5](x)
+  ;; Each call site sees the same entry several times, then switches to the
+  ;; other one.
+  (func $main (export "_start") (param $x i32) (result i32)
+    (local $i i32)
+    block $exit
+      loop $loop
+        get_local $i
+        i32.const 10
+        i32.ge_u
+        br_if $exit
+        (call_indirect (type $unary)
+          (get_local $x)
+          (i32.ge_u (get_local $i) (i32.const 5)))
+        set_local $x
+        get_local $i
+        i32.const 1
+        i32.add
+        set_local $i
+        br $loop
+      end
+    end
+    get_local $x
+  )
+)
@@ -0,0 +1,25 @@
+(module
+  ;; A comparison kept in a local and also branched on is not fused with the
+  ;; branch, which would drop the write to the local.
+  (func $main (export "_start") (param i32) (result i32)
+    (local i32 i32)
+    block
+      local.get 0
+      i32.const 5
+      i32.lt_s
+      local.tee 1
+      br_if 0
+    end
+    block
+      local.get 0
+      i32.const 5
+      i32.lt_s
+      local.set 2
+      local.get 2
+      br_if 0
+    end
+    local.get 1
+    local.get 2
+    i32.const 2
+    i32.mul
+    i32.add))
@@ -0,0 +1,20 @@
+(module
+  (func (export "_start") (param $n i32) (result i32)
+    (local $acc i32)
+    ;; select on a constant condition keeps only the selected operand.
+    (local.set $acc (select (local.get $n) (i32.const 5) (i32.const 1)))
+    ;; A branch which is never taken.
+    (block $skip
+      (br_if $skip (i32.const 0))
+      (local.set $acc
+        (i32.add (local.get $acc)
+                 (i32.mul (i32.add (i32.const 3) (i32.const 4))
+                          (i32.const 6)))))
+    ;; A branch which is always taken makes the rest of the block dead.
+    (block $dead
+      (br_if $dead (i32.eqz (i32.const 0)))
+      (local.set $acc (i32.const 1000)))
+    (i32.add (local.get $acc)
+             (i32.wrap_i64
+               (i64.div_s (i64.extend_i32_s (i32.const -7)) (i64.const 2)))))
+)
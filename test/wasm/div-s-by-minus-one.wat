@@ -0,0 +1,6 @@
+(module
+  ;; A division of the minimum by the constant -1 still traps.
+  (func (export "_start") (param i32) (result i32)
+        (i32.div_s (local.get 0) (i32.const -1))
+  )
+)
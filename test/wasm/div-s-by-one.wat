@@ -0,0 +1,14 @@
+(module
+  ;; Signed divisions by 1 and remainders by 1 and -1 of a variable.
+  (func (export "_start") (param i32) (result i32)
+        (i32.add
+          (i32.add
+            (i32.add (i32.div_s (local.get 0) (i32.const 1))
+                     (i32.rem_s (local.get 0) (i32.const 1)))
+            (i32.rem_s (local.get 0) (i32.const -1)))
+          (i32.wrap_i64
+            (i64.add
+              (i64.div_s (i64.extend_i32_s (local.get 0)) (i64.const 1))
+              (i64.rem_s (i64.extend_i32_s (local.get 0)) (i64.const -1)))))
+  )
+)
@@ -0,0 +1,7 @@
+(module
+  (func (export "_start") (param i32) (result i32)
+        (i32.wrap_i64
+          (i64.div_s (i64.const 0x8000000000000000)
+                     (i64.extend_i32_s (local.get 0))))
+  )
+)
@@ -0,0 +1,5 @@
+(module
+  (func (export "_start") (param i32) (result i32)
+        (i32.div_s (i32.const 0x80000000) (local.get 0))
+  )
+)
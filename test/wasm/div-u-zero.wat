@@ -0,0 +1,5 @@
+(module
+  (func (export "_start") (param i32) (result i32)
+        (i32.div_u (i32.const 1) (local.get 0))
+  )
+)
@@ -0,0 +1,209 @@
+(module
+  ;; Sums multiplies, divides and remainders by constants of n hashed values.
+  (func $main (export "_start") (param $n i32) (result i32)
+    (local $i i32) (local $x i32) (local $acc i32)
+    block
+      loop
+        local.get $i
+        local.get $n
+        i32.ge_u
+        br_if 1
+        ;; x = i * 0x9e3779b1 + i
+        local.get $i
+        i32.const 0x9e3779b1
+        i32.mul
+        local.get $i
+        i32.add
+        local.set $x
+        local.get $acc
+        i32.const 31
+        i32.mul
+        local.get $x
+        i32.const 7
+        i32.div_u
+        i32.add
+        local.set $acc
+        local.get $acc
+        i32.const 31
+        i32.mul
+        local.get $x
+        i32.const 7
+        i32.rem_u
+        i32.add
+        local.set $acc
+        local.get $acc
+        i32.const 31
+        i32.mul
+        local.get $x
+        i32.const 1000
+        i32.div_u
+        i32.add
+        local.set $acc
+        local.get $acc
+        i32.const 31
+        i32.mul
+        local.get $x
+        i32.const 0xffffffff
+        i32.rem_u
+        i32.add
+        local.set $acc
+        local.get $acc
+        i32.const 31
+        i32.mul
+        local.get $x
+        i32.const 0x80000001
+        i32.div_u
+        i32.add
+        local.set $acc
+        local.get $acc
+        i32.const 31
+        i32.mul
+        local.get $x
+        i32.const 16
+        i32.div_u
+        i32.add
+        local.set $acc
+        local.get $acc
+        i32.const 31
+        i32.mul
+        local.get $x
+        i32.const 16
+        i32.rem_u
+        i32.add
+        local.set $acc
+        local.get $acc
+        i32.const 31
+        i32.mul
+        local.get $x
+        i32.const 8
+        i32.mul
+        i32.add
+        local.set $acc
+        local.get $acc
+        i32.const 31
+        i32.mul
+        local.get $x
+        i32.const 1
+        i32.div_u
+        i32.add
+        local.set $acc
+        local.get $acc
+        i32.const 31
+        i32.mul
+        local.get $x
+        i32.const 1
+        i32.rem_u
+        i32.add
+        local.set $acc
+        local.get $acc
+        i32.const 31
+        i32.mul
+        local.get $x
+        i32.const 7
+        i32.div_s
+        i32.add
+        local.set $acc
+        local.get $acc
+        i32.const 31
+        i32.mul
+        local.get $x
+        i32.const 7
+        i32.rem_s
+        i32.add
+        local.set $acc
+        local.get $acc
+        i32.const 31
+        i32.mul
+        local.get $x
+        i32.const -3
+        i32.div_s
+        i32.add
+        local.set $acc
+        local.get $acc
+        i32.const 31
+        i32.mul
+        local.get $x
+        i32.const -3
+        i32.rem_s
+        i32.add
+        local.set $acc
+        local.get $acc
+        i32.const 31
+        i32.mul
+        local.get $x
+        i32.const 16
+        i32.div_s
+        i32.add
+        local.set $acc
+        local.get $acc
+        i32.const 31
+        i32.mul
+        local.get $x
+        i32.const -16
+        i32.rem_s
+        i32.add
+        local.set $acc
+        local.get $acc
+        i32.const 31
+        i32.mul
+        local.get $x
+        i32.const 0x80000000
+        i32.div_s
+        i32.add
+        local.set $acc
+        local.get $acc
+        i32.const 31
+        i32.mul
+        local.get $x
+        i32.const 0x80000000
+        i32.rem_s
+        i32.add
+        local.set $acc
+        local.get $acc
+        i32.const 31
+        i32.mul
+        local.get $x
+        i32.const 0x7fffffff
+        i32.div_s
+        i32.add
+        local.set $acc
+        local.get $acc
+        i32.const 31
+        i32.mul
+        local.get $x
+        i64.extend_i32_u
+        i64.const 1024
+        i64.mul
+        i32.wrap_i64
+        i32.add
+        local.set $acc
+        local.get $acc
+        i32.const 31
+        i32.mul
+        local.get $x
+        i64.extend_i32_u
+        i64.const 64
+        i64.div_u
+        i32.wrap_i64
+        i32.add
+        local.set $acc
+        local.get $acc
+        i32.const 31
+        i32.mul
+        local.get $x
+        i64.extend_i32_u
+        i64.const 64
+        i64.rem_u
+        i32.wrap_i64
+        i32.add
+        local.set $acc
+        local.get $i
+        i32.const 1
+        i32.add
+        local.set $i
+        br 0
+      end
+    end
+    local.get $acc
+  )
+)
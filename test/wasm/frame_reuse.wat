@@ -0,0 +1,26 @@
+(module
+  (func $square (param $v i32) (result i32)
+    get_local $v
+    get_local $v
+    i32.mul
+  )
+  (func $main (export "_start") (param $x i32) (result i32)
+    (local $a i32)
+    ;; The slot of a dropped value is reused by the next expression.
+    get_local $x
+    i32.const 3
+    i32.add
+    drop
+    ;; a = square(x)
+    get_local $x
+    call $square
+    set_local $a
+    ;; square(x + 1) + a
+    get_local $x
+    i32.const 1
+    i32.add
+    call $square
+    get_local $a
+    i32.add
+  )
+)
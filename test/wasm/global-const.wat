@@ -0,0 +1,15 @@
+(module
+  (global $base i32 (i32.const 1000))
+  (global $scale i64 (i64.const 3))
+  (global $counter (mut i32) (i32.const 0))
+  (func $bump (param $n i32)
+    (global.set $counter (i32.add (global.get $counter) (local.get $n))))
+  (func (export "_start") (result i32)
+    (call $bump (i32.const 5))
+    (call $bump (i32.const 7))
+    ;; $base and $scale are immutable and fold into a single constant.
+    (i32.add
+      (i32.add (global.get $base)
+               (i32.wrap_i64 (i64.mul (global.get $scale) (i64.const 2))))
+      (global.get $counter)))
+)
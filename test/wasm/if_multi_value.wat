@@ -0,0 +1,9 @@
+(module
+  (func (export "_start") (param i32 i32 i32) (result i32)
+        (local.get 0)
+        (local.get 1)
+        (if (param i32 i32) (result i32) (local.get 2)
+          (then (i32.sub))
+          (else (i32.add)))
+  )
+)
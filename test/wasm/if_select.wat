@@ -0,0 +1,32 @@
+(module
+  (func $clamp (param $x i32) (param $lo i32) (param $hi i32) (result i32)
+    (if (result i32) (i32.lt_s (local.get $x) (local.get $lo))
+      (then (local.get $lo))
+      (else
+        (if (result i32) (i32.gt_s (local.get $x) (local.get $hi))
+          (then (local.get $hi))
+          (else (local.get $x))))))
+  (func $step (param $x i32) (result i32)
+    ;; Both arms are side-effect free and become a SELECT.
+    (if (result i32) (i32.and (local.get $x) (i32.const 1))
+      (then (i32.add (i32.mul (local.get $x) (i32.const 3)) (i32.const 1)))
+      (else (i32.shr_u (local.get $x) (i32.const 1)))))
+  (func (export "_start") (param $n i32) (result i32)
+    (local $i i32)
+    (local $x i32)
+    (local $acc i32)
+    (local.set $x (i32.const 27))
+    (block $done
+      (loop $top
+        (br_if $done (i32.ge_s (local.get $i) (local.get $n)))
+        (local.set $x (call $step (local.get $x)))
+        (local.set $acc
+          (i32.add (local.get $acc)
+                   (call $clamp (local.get $x) (i32.const 10) (i32.const 100))))
+        ;; An if without a value runs its arm only when the condition holds.
+        (if (i32.eq (local.get $x) (i32.const 1))
+          (then (local.set $acc (i32.add (local.get $acc) (i32.const 1000)))))
+        (local.set $i (i32.add (local.get $i) (i32.const 1)))
+        (br $top)))
+    (local.get $acc))
+)
@@ -0,0 +1,77 @@
+(module
+  (memory 1)
+  ;; Walks arrays at base + (index << shift) + offset, which loads and stores
+  ;; take as a single instruction.
+  (func $main (export "_start") (param i32) (result i32)
+    (local i32 i32 i32)
+    ;; for (i = 0; i < n; i++) { v = i * i; a[i] = v; b[i] = (u8) v; }
+    block
+      loop
+        local.get 1
+        local.get 0
+        i32.ge_u
+        br_if 1
+        local.get 1
+        local.get 1
+        i32.mul
+        local.set 2
+        i32.const 16
+        local.get 1
+        i32.const 4
+        i32.mul
+        i32.add
+        local.get 2
+        i32.store offset=8
+        i32.const 1024
+        local.get 1
+        i32.add
+        local.get 2
+        i32.store8
+        local.get 1
+        i32.const 1
+        i32.add
+        local.set 1
+        br 0
+      end
+    end
+    ;; for (i = 0; i < n; i++) acc += a[i] + b[i];
+    i32.const 0
+    local.set 1
+    block
+      loop
+        local.get 1
+        local.get 0
+        i32.ge_u
+        br_if 1
+        local.get 3
+        i32.const 16
+        local.get 1
+        i32.const 2
+        i32.shl
+        i32.add
+        i32.load offset=8
+        i32.add
+        i32.const 1024
+        local.get 1
+        i32.add
+        i32.load8_u
+        i32.add
+        local.set 3
+        local.get 1
+        i32.const 1
+        i32.add
+        local.set 1
+        br 0
+      end
+    end
+    ;; -16 + (n << 2) wraps around to the address of a[n - 8].
+    local.get 3
+    i32.const -16
+    local.get 0
+    i32.const 2
+    i32.shl
+    i32.add
+    i32.load offset=8
+    i32.add
+  )
+)
@@ -0,0 +1,25 @@
+(module
+  (global $bias (mut i32) (i32.const 0))
+  (func $inc (param $x i32) (result i32)
+    (i32.add (local.get $x) (i32.const 1)))
+  (func $max (param $a i32) (param $b i32) (result i32)
+    (select (local.get $a) (local.get $b)
+            (i32.gt_s (local.get $a) (local.get $b))))
+  (func $set_bias (param $v i32)
+    (global.set $bias (local.get $v)))
+  (func $scale (param $x i32) (param $k i32) (result i32)
+    (i32.mul (local.get $x) (local.get $k)))
+  (func (export "_start") (param $n i32) (result i32)
+    (local $i i32)
+    (local $acc i32)
+    (call $set_bias (i32.const 3))
+    (block $done
+      (loop $top
+        (br_if $done (i32.ge_s (local.get $i) (local.get $n)))
+        (local.set $acc
+          (call $max (call $inc (local.get $acc))
+                     (call $scale (local.get $i) (i32.const 2))))
+        (local.set $i (call $inc (local.get $i)))
+        (br $top)))
+    (i32.add (local.get $acc) (global.get $bias)))
+)
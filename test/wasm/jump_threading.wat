@@ -0,0 +1,22 @@
+(module
+  ;; Nested blocks exit through chains of jumps, which are threaded to the
+  ;; final destination and laid out as fall-through.
+  (func (export "_start") (param $n i32) (result i32)
+    (local $i i32) (local $acc i32)
+    (local.set $i (i32.const 0))
+    (local.set $acc (i32.const 0))
+    (block $done
+      (loop $top
+        (block $next
+          (block $odd
+            (block $even
+              (br_if $done (i32.ge_s (local.get $i) (local.get $n)))
+              (br_if $odd (i32.and (local.get $i) (i32.const 1)))
+              (br $even))
+            (local.set $acc (i32.add (local.get $acc) (local.get $i)))
+            (br $next))
+          (local.set $acc (i32.sub (local.get $acc) (i32.const 1))))
+        (local.set $i (i32.add (local.get $i) (i32.const 1)))
+        (br $top)))
+    (local.get $acc))
+)
@@ -0,0 +1,22 @@
+(module
+  (func $main (export "_start") (param $x i32) (result i32)
+    (local $a i32) (local $b i32)
+    ;; a = x
+    get_local $x
+    set_local $a
+    ;; t = a; a = a + 1; t + a
+    get_local $a
+    get_local $a
+    i32.const 1
+    i32.add
+    set_local $a
+    get_local $a
+    i32.add
+    ;; (b = x) * b
+    get_local $x
+    tee_local $b
+    get_local $b
+    i32.mul
+    i32.add
+  )
+)
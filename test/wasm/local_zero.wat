@@ -0,0 +1,27 @@
+(module
+  ;; Leaves x in the slots of its locals.
+  (func $dirty (param $x i32) (result i32)
+    (local $a i32) (local $b i32)
+    local.get $x
+    local.set $a
+    local.get $x
+    local.set $b
+    local.get $a
+  )
+  ;; $b is written before it is read, and $a still starts at zero.
+  (func $read (param $x i32) (result i32)
+    (local $b i32) (local $a i32)
+    local.get $x
+    local.set $b
+    local.get $a
+    local.get $b
+    i32.add
+  )
+  (func $main (export "_start") (param i32) (result i32)
+    local.get 0
+    call $dirty
+    drop
+    local.get 0
+    call $read
+  )
+)
@@ -0,0 +1,32 @@
+(module
+  (func $main (export "_start") (param $n i32) (result i32)
+    (local $i i32) (local $sum i32)
+    ;; sum = 0; i = 0
+    block $outer
+      loop $inner
+        ;; if (!(i < n)) goto L_outer;
+        get_local $i
+        get_local $n
+        i32.lt_s
+        i32.eqz
+        br_if $outer
+        ;; sum += i; i += 1
+        get_local $sum
+        get_local $i
+        i32.add
+        set_local $sum
+        get_local $i
+        i32.const 1
+        i32.add
+        set_local $i
+        ;; if (i < 1000) goto L_inner;
+        get_local $i
+        i32.const 1000
+        i32.lt_u
+        br_if $inner
+      end
+    end
+    ;; L_outer
+    get_local $sum
+  )
+)
@@ -0,0 +1,15 @@
+(module
+  ;; Sums i * 3 for 0 <= i < n in the shape clang emits for counted loops.
+  (func (export "_start") (param $n i32) (result i32)
+    (local $i i32)
+    (local $acc i32)
+    (block $done
+      (br_if $done (i32.le_s (local.get $n) (i32.const 0)))
+      (loop $top
+        (local.set $acc
+          (i32.add (local.get $acc) (i32.mul (local.get $i) (i32.const 3))))
+        (br_if $top
+          (i32.lt_s (local.tee $i (i32.add (local.get $i) (i32.const 1)))
+                    (local.get $n)))))
+    (local.get $acc))
+)
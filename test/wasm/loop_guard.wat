@@ -0,0 +1,124 @@
+(module
+  (memory 1)
+  ;; Loops whose indexed accesses are checked once before the loop where
+  ;; memory needs explicit checks.
+  (func $main (export "_start") (param i32) (result i32)
+    (local i32 i32 i32)
+    i32.const 1073741824
+    local.set 3
+    ;; for (i = 0; i < n; i++) a[i] = i;
+    block
+      loop
+        local.get 1
+        local.get 0
+        i32.ge_u
+        br_if 1
+        i32.const 64
+        local.get 1
+        i32.const 2
+        i32.shl
+        i32.add
+        local.get 1
+        i32.store
+        local.get 1
+        i32.const 1
+        i32.add
+        local.set 1
+        br 0
+      end
+    end
+    ;; i = 0; do s += a[i]; while (++i < n);
+    i32.const 0
+    local.set 1
+    loop
+      local.get 2
+      i32.const 64
+      local.get 1
+      i32.const 2
+      i32.shl
+      i32.add
+      i32.load
+      i32.add
+      local.set 2
+      local.get 1
+      i32.const 1
+      i32.add
+      local.tee 1
+      local.get 0
+      i32.lt_u
+      br_if 0
+    end
+    ;; i = 0; do b[i] = i; while (++i != n);
+    i32.const 0
+    local.set 1
+    loop
+      i32.const 4096
+      local.get 1
+      i32.add
+      local.get 1
+      i32.store8
+      local.get 1
+      i32.const 1
+      i32.add
+      local.tee 1
+      local.get 0
+      i32.ne
+      br_if 0
+    end
+    ;; i = 0; do s += b[i] * 5; while (++i < n); as signed integers
+    i32.const 0
+    local.set 1
+    loop
+      local.get 2
+      i32.const 4096
+      local.get 1
+      i32.add
+      i32.load8_u
+      i32.const 5
+      i32.mul
+      i32.add
+      local.set 2
+      local.get 1
+      i32.const 1
+      i32.add
+      local.tee 1
+      local.get 0
+      i32.lt_s
+      br_if 0
+    end
+    ;; The limit is past the memory, so the loop runs with its checks, and
+    ;; leaves before reaching it.
+    ;; for (i = 0; i < m; i++) { if (i == n) break; s += a[i] ^ 1; }
+    i32.const 0
+    local.set 1
+    block
+      loop
+        local.get 1
+        local.get 3
+        i32.ge_u
+        br_if 1
+        local.get 1
+        local.get 0
+        i32.eq
+        br_if 1
+        local.get 2
+        i32.const 64
+        local.get 1
+        i32.const 2
+        i32.shl
+        i32.add
+        i32.load
+        i32.const 1
+        i32.xor
+        i32.add
+        local.set 2
+        local.get 1
+        i32.const 1
+        i32.add
+        local.set 1
+        br 0
+      end
+    end
+    local.get 2
+  )
+)
@@ -0,0 +1,30 @@
+(module
+  (memory 1)
+  ;; The guard before the loop fails, and the loop traps when it reaches the
+  ;; end of the memory.
+  (func $main (export "_start") (param i32) (result i32)
+    (local i32)
+    ;; for (i = 0; i < n; i++) a[i] = i;
+    block
+      loop
+        local.get 1
+        local.get 0
+        i32.ge_u
+        br_if 1
+        i32.const 65000
+        local.get 1
+        i32.const 2
+        i32.shl
+        i32.add
+        local.get 1
+        i32.store
+        local.get 1
+        i32.const 1
+        i32.add
+        local.set 1
+        br 0
+      end
+    end
+    local.get 1
+  )
+)
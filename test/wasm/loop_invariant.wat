@@ -0,0 +1,134 @@
+(module
+  (memory 1)
+  (table 2 funcref)
+  ;; The first mutable i32 global is taken for the stack pointer.
+  (global $sp (mut i32) (i32.const 65536))
+  (global $g (mut i32) (i32.const 3))
+  ;; Reads of globals and of the size of the memory and the table, hoisted out
+  ;; of the loops which do not change them.
+  (func $main (export "_start") (param i32) (result i32)
+    (local i32 i32 i32)
+    ;; i = 0; do s += g + memory.size + table.size; while (++i < n);
+    i32.const 0
+    local.set 1
+    loop
+      local.get 2
+      global.get $g
+      i32.add
+      memory.size
+      i32.add
+      table.size 0
+      i32.add
+      local.set 2
+      local.get 1
+      i32.const 1
+      i32.add
+      local.tee 1
+      local.get 0
+      i32.lt_u
+      br_if 0
+    end
+    ;; do { g += 1; s += g; } while (++i < n);
+    i32.const 0
+    local.set 1
+    loop
+      global.get $g
+      i32.const 1
+      i32.add
+      global.set $g
+      local.get 2
+      global.get $g
+      i32.add
+      local.set 2
+      local.get 1
+      i32.const 1
+      i32.add
+      local.tee 1
+      local.get 0
+      i32.lt_u
+      br_if 0
+    end
+    ;; do { s += memory.size; memory.grow(1); } while (++i < n);
+    i32.const 0
+    local.set 1
+    loop
+      local.get 2
+      memory.size
+      i32.add
+      local.set 2
+      i32.const 1
+      memory.grow
+      drop
+      local.get 1
+      i32.const 1
+      i32.add
+      local.tee 1
+      local.get 0
+      i32.lt_u
+      br_if 0
+    end
+    ;; do { s += table.size; table.grow(null, 1); } while (++i < n);
+    i32.const 0
+    local.set 1
+    loop
+      local.get 2
+      table.size 0
+      i32.add
+      local.set 2
+      ref.null func
+      i32.const 1
+      table.grow 0
+      drop
+      local.get 1
+      i32.const 1
+      i32.add
+      local.tee 1
+      local.get 0
+      i32.lt_u
+      br_if 0
+    end
+    ;; do { bump(); s += g; } while (++i < n);
+    i32.const 0
+    local.set 1
+    loop
+      call $bump
+      local.get 2
+      global.get $g
+      i32.add
+      local.set 2
+      local.get 1
+      i32.const 1
+      i32.add
+      local.tee 1
+      local.get 0
+      i32.lt_u
+      br_if 0
+    end
+    ;; do { t = g; s += t; } while (++i < n); return s + t;
+    i32.const 0
+    local.set 3
+    i32.const 0
+    local.set 1
+    loop
+      global.get $g
+      local.set 3
+      local.get 2
+      local.get 3
+      i32.add
+      local.set 2
+      local.get 1
+      i32.const 1
+      i32.add
+      local.tee 1
+      local.get 0
+      i32.lt_u
+      br_if 0
+    end
+    local.get 2
+    local.get 3
+    i32.add)
+  (func $bump
+    global.get $g
+    i32.const 2
+    i32.add
+    global.set $g))
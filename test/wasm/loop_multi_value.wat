@@ -0,0 +1,14 @@
+(module
+  (func (export "_start") (param i32) (result i32)
+        (local i32)
+        (i32.const 0)
+        (local.get 0)
+        (loop (param i32 i32) (result i32)
+          (local.tee 1)
+          (i32.add)
+          (i32.sub (local.get 1) (i32.const 1))
+          (local.tee 1)
+          (br_if 0 (local.get 1))
+          (drop))
+  )
+)
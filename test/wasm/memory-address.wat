@@ -0,0 +1,11 @@
+(module
+  (memory 2)
+  (data (i32.const 65536) "\01\02\03\04")
+  (func (export "_start") (param i32) (result i32)
+        ;; Address and static offset both contribute to the effective address.
+        (i32.store offset=8 (local.get 0) (i32.const 1000))
+        (i32.add
+          (i32.load offset=0 (i32.add (local.get 0) (i32.const 8)))
+          (i32.load8_u offset=65534 (i32.const 3))) ;; memory[65537] = 2
+  )
+)
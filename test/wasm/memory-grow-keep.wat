@@ -0,0 +1,9 @@
+(module
+  (memory 1 4)
+  (func (export "_start") (param i32) (result i32)
+        (i32.add
+          (i32.add (i32.mul (memory.grow (local.get 0)) (i32.const 100))
+                   (i32.eq (memory.grow (local.get 0)) (i32.const -1)))
+          (i32.mul (memory.size) (i32.const 10)))
+  )
+)
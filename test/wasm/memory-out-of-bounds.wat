@@ -0,0 +1,6 @@
+(module
+  (memory 1)
+  (func (export "_start") (param i32) (result i32)
+        (i32.load offset=4 (local.get 0))
+  )
+)
@@ -0,0 +1,19 @@
+(module
+  ;; Uses division, so it keeps running on the interpreter under the JIT.
+  (func $weight (param $x i32) (result i32)
+    (i32.add (i32.div_u (i32.mul (local.get $x) (i32.const 14)) (i32.const 2))
+             (i32.const 7)))
+
+  (func $sum (param $n i32) (result i32)
+    (local $i i32) (local $acc i32)
+    (block $done
+      (loop $top
+        (br_if $done (i32.ge_s (local.get $i) (local.get $n)))
+        (local.set $acc (i32.add (local.get $acc) (call $weight (local.get $i))))
+        (local.set $i (i32.add (local.get $i) (i32.const 1)))
+        (br $top)))
+    (local.get $acc))
+
+  (func (export "_start") (param $n i32) (result i32)
+    (i32.sub (call $sum (local.get $n)) (call $weight (i32.const 0))))
+)
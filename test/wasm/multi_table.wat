@@ -0,0 +1,15 @@
+(module
+  (type $sig (func (result i32)))
+  (table $t0 2 funcref)
+  (table $t1 3 funcref)
+  (elem (table $t0) (i32.const 0) func $f1 $f2)
+  (elem (table $t1) (i32.const 1) funcref (ref.func $f2) (ref.func $f1))
+  (func $f1 (result i32) (i32.const 11))
+  (func $f2 (result i32) (i32.const 22))
+
+  (func (export "_start") (param i32) (result i32) ;; 1 => 1122
+    (i32.add
+      (i32.mul (call_indirect $t0 (type $sig) (i32.const 0)) (i32.const 100))
+      (call_indirect $t1 (type $sig) (local.get 0)))
+  )
+)
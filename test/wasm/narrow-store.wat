@@ -0,0 +1,17 @@
+(module
+  (memory 1)
+  ;; Narrow stores over bytes set to 0xff leave the bytes after them unchanged.
+  (func (export "_start") (param i32) (result i32)
+        (i64.store (i32.const 0) (i64.const -1))
+        (i64.store (i32.const 8) (i64.const -1))
+        (i32.store8 (i32.const 0) (local.get 0))
+        (i32.store16 (i32.const 2) (local.get 0))
+        (i64.store8 (i32.const 4) (i64.extend_i32_u (local.get 0)))
+        (i64.store16 (i32.const 6) (i64.extend_i32_u (local.get 0)))
+        (i64.store32 (i32.const 8) (i64.extend_i32_u (local.get 0)))
+        ;; 0x0000ff00 + 0x0000ff00 + 0 + 0xffffffff
+        (i32.add
+          (i32.add (i32.load (i32.const 0)) (i32.load (i32.const 4)))
+          (i32.add (i32.load (i32.const 8)) (i32.load (i32.const 12))))
+  )
+)
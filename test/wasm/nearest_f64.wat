@@ -0,0 +1,6 @@
+(module
+  (memory 1)
+  (func (export "_start") (param f64) (result f64)
+        (f64.nearest (local.get 0))
+  )
+)
@@ -0,0 +1,6 @@
+(module
+  (memory 1)
+  (func (export "_start") (param i64) (result i64)
+        (i64.popcnt (local.get 0))
+  )
+)
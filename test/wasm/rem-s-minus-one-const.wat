@@ -0,0 +1,11 @@
+(module
+  ;; Remainders and divisions by -1 of constants, folded while compiling.
+  (func (export "_start") (param i32) (result i32)
+        (i32.add
+          (i32.add
+            (i32.rem_s (i32.const 0x80000000) (i32.const -1))
+            (i32.wrap_i64
+              (i64.rem_s (i64.const 0x8000000000000000) (i64.const -1))))
+          (i32.div_s (i32.const 7) (i32.const -1)))
+  )
+)
@@ -0,0 +1,12 @@
+(module
+  ;; A remainder by -1 is 0, also of the minimum, and does not trap.
+  (func (export "_start") (param i32) (result i32)
+        (i32.add
+          (i32.add
+            (i32.rem_s (i32.const 0x80000000) (local.get 0))
+            (i32.wrap_i64
+              (i64.rem_s (i64.const 0x8000000000000000)
+                         (i64.extend_i32_s (local.get 0)))))
+          (i32.rem_s (i32.const 7) (local.get 0)))
+  )
+)
@@ -0,0 +1,49 @@
+(module
+  (memory 1)
+  (global $sp (mut i32) (i32.const 65536))
+  (global $calls (mut i32) (i32.const 0))
+  ;; Keeps n in a frame on the stack in linear memory, as clang does.
+  (func $sum (param i32) (result i32)
+    (local i32 i32)
+    global.get $sp
+    i32.const 16
+    i32.sub
+    local.tee 1
+    global.set $sp
+    global.get $calls
+    i32.const 1
+    i32.add
+    global.set $calls
+    local.get 1
+    local.get 0
+    i32.store offset=12
+    block
+      local.get 0
+      i32.eqz
+      br_if 0
+      local.get 0
+      i32.const 1
+      i32.sub
+      call $sum
+      local.set 2
+    end
+    local.get 1
+    i32.load offset=12
+    local.get 2
+    i32.add
+    local.set 2
+    local.get 1
+    i32.const 16
+    i32.add
+    global.set $sp
+    local.get 2
+  )
+  (func $main (export "_start") (param i32) (result i32)
+    local.get 0
+    call $sum
+    global.get $sp
+    i32.add
+    global.get $calls
+    i32.add
+  )
+)
@@ -5,8 +5,8 @@
   (func $f (param i32 i32 i32) (result i32) (local.get 1))
 
   (func (export "_start") (result i32) ;; == 2
-        (call_indirect (type $sig) (i32.const 0) 
-        (i32.const 1) (i32.const 2) (i32.const 3)
+        (call_indirect (type $sig)
+        (i32.const 1) (i32.const 2) (i32.const 3) (i32.const 0)
     )
   )
 )
@@ -0,0 +1,14 @@
+(module
+  (type $sig (func (param i32 i32) (result i32)))
+  (table 2 funcref)
+  (elem (i32.const 0) $add)
+  (func $add (param i32 i32) (result i32) (i32.add (local.get 0) (local.get 1)))
+
+  ;; Copies entry 0 to the empty entry 1 and calls it.
+  (func (export "_start") (param i32) (result i32) ;; 5 => 16
+    (table.set 0 (i32.const 1) (table.get 0 (i32.const 0)))
+    (i32.add
+      (call_indirect (type $sig) (local.get 0) (i32.const 10) (i32.const 1))
+      (ref.is_null (ref.null func)))
+  )
+)
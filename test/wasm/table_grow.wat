@@ -0,0 +1,15 @@
+(module
+  (type $sig (func (result i32)))
+  (table 1 4 funcref)
+  (elem declare func $f)
+  (func $f (result i32) (i32.const 7))
+
+  ;; Grows the table by n entries of $f and calls its last entry.
+  (func (export "_start") (param i32) (result i32) ;; 2 => 137
+    (i32.add
+      (i32.add
+        (i32.mul (table.grow 0 (ref.func $f) (local.get 0)) (i32.const 100))
+        (i32.mul (table.size 0) (i32.const 10)))
+      (call_indirect (type $sig) (i32.sub (table.size 0) (i32.const 1))))
+  )
+)
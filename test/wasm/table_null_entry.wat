@@ -0,0 +1,11 @@
+(module
+  (type $sig (func (result i32)))
+  (table 3 funcref)
+  (elem (i32.const 0) $f)
+  (func $f (result i32) (i32.const 1))
+
+  ;; Entry 1 is in bounds but was never set.
+  (func (export "_start") (param i32) (result i32)
+    (call_indirect (type $sig) (local.get 0))
+  )
+)
@@ -0,0 +1,26 @@
+(module
+  ;; sum(n, acc) = n == 0 ? acc : sum(n - 1, acc + n)
+  ;; The recursion is deeper than the operand stack of the test runner, which
+  ;; only works if tail calls reuse the frame.
+  (func $sum (param $n i32) (param $acc i64) (result i64)
+    block
+      get_local $n
+      br_if 0
+      get_local $acc
+      return
+    end
+    get_local $n
+    i32.const 1
+    i32.sub
+    get_local $acc
+    get_local $n
+    i64.extend_i32_u
+    i64.add
+    return_call $sum
+  )
+  (func $main (export "_start") (param $n i32) (result i64)
+    get_local $n
+    i64.const 0
+    return_call $sum
+  )
+)
@@ -0,0 +1,6 @@
+(module
+  (memory 1)
+  (func (export "_start") (param f32) (result f32)
+        (f32.trunc (local.get 0))
+  )
+)
@@ -0,0 +1,6 @@
+(module
+  (memory 1)
+  (func (export "_start") (param f32) (result i64)
+        (i64.trunc_sat_f32_u (local.get 0))
+  )
+)
@@ -0,0 +1,6 @@
+(module
+  (memory 1)
+  (func (export "_start") (param f64) (result i32)
+        (i32.trunc_sat_f64_s (local.get 0))
+  )
+)
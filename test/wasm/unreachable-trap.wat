@@ -0,0 +1,6 @@
+(module
+  (func (export "_start") (param i32) (result i32)
+        (if (local.get 0) (then unreachable))
+        (local.get 0)
+  )
+)
@@ -0,0 +1,30 @@
+/*
+ * Copyright (C) 2021 Masahiro Ide
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "wasmbox/wasmbox.h"
+
+#include <stdio.h>
+
+// Usage: WasmBoxTraceDecode trace [output]
+// Prints a trace written by wasmbox_trace_write.
+int main(int argc, char const *argv[]) {
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s trace [output]\n", argv[0]);
+    return 1;
+  }
+  return wasmbox_trace_decode(argv[1], argc > 2 ? argv[2] : NULL) < 0;
+}
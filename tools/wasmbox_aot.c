@@ -0,0 +1,68 @@
+/*
+ * Copyright (C) 2021 Masahiro Ide
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "wasmbox/wasmbox.h"
+
+#include <stdio.h>
+#include <string.h>
+
+// The base name of `path` without its extensions, with anything a C
+// identifier cannot hold replaced by '_'.
+static void default_name(const char *path, char *name, size_t size) {
+  const char *base = strrchr(path, '/');
+  base = base != NULL ? base + 1 : path;
+  size_t len = 0;
+  if (base[0] >= '0' && base[0] <= '9' && len + 1 < size) {
+    name[len++] = '_';
+  }
+  for (const char *p = base; *p != '\0' && *p != '.' && len + 1 < size; p++) {
+    int ok = *p == '_' || (*p >= '0' && *p <= '9') ||
+             (*p >= 'a' && *p <= 'z') || (*p >= 'A' && *p <= 'Z');
+    name[len++] = ok ? *p : '_';
+  }
+  name[len] = '\0';
+}
+
+// Usage: WasmBoxAot [-n name] input.wasm output.c
+// Translates a module to C defining `wasmbox_aot_<name>`, which a build of
+// WasmBox with the same options runs by setting wasmbox_module_t.aot to it.
+// The name is that of the input file by default.
+int main(int argc, char const *argv[]) {
+  char name[256];
+  int first = 1;
+  if (argc > 2 && strcmp(argv[1], "-n") == 0) {
+    snprintf(name, sizeof(name), "%s", argv[2]);
+    first = 3;
+  } else if (argc > 1) {
+    default_name(argv[1], name, sizeof(name));
+  }
+  if (argc != first + 2) {
+    fprintf(stderr, "usage: %s [-n name] input.wasm output.c\n", argv[0]);
+    return 1;
+  }
+  wasmbox_module_t mod = {};
+  if (wasmbox_load_module(&mod, argv[first], strlen(argv[first])) != 0) {
+    fprintf(stderr, "cannot load %s\n", argv[first]);
+    return 1;
+  }
+  int translated = wasmbox_aot_translate(&mod, name, argv[first + 1]);
+  if (translated < 0) {
+    fprintf(stderr, "cannot translate %s to %s\n", argv[first],
+            argv[first + 1]);
+  }
+  wasmbox_module_dispose(&mod);
+  return translated < 0;
+}